@@ -239,6 +239,10 @@ int jnode_is_releasable(jnode * node/* node to check */)
 	if (!jnode_is_znode(node) && !jnode_is_unformatted(node))
 		return 0;
 
+	/* keep upper levels of the tree while a scan is evicting leaves */
+	if (jnode_is_pinned(node))
+		return 0;
+
 	return 1;
 }
 
@@ -305,13 +309,249 @@ int reiser4_releasepage(struct page *page, gfp_t gfp UNUSED_ARG)
 	}
 }
 
+/*
+ * Clean unformatted pages do not need their jnodes: all jnode state which
+ * matters (atom, capture list, dirty and writeback bits) is there only while
+ * the page is dirty or captured, and the block number is found in the extent
+ * again. On hosts with a large file cache per-page jnodes take a lot of
+ * memory, so under memory pressure jnodes are detached from clean, unused,
+ * uptodate pages which stay in the page cache. Such a page gets a new jnode
+ * from jnode_of_page() when it is captured for write, exactly like a page
+ * which was read without a jnode attached.
+ */
+
+/* number of pages looked up at once by jnode shrinker */
+#define SHED_BATCH 16
+
+/* detach jnode from clean page @page of @mapping. Returns 1 if the jnode
+ * was detached */
+static int shed_page_jnode(struct page *page, struct address_space *mapping)
+{
+	jnode *node;
+	int shed = 0;
+
+	if (!trylock_page(page))
+		return 0;
+	/* page cache, jnode and our own references, see
+	 * reiser4_releasepage() */
+	if (page->mapping != mapping || !PagePrivate(page) ||
+	    !PageUptodate(page) || PageDirty(page) || PageWriteback(page) ||
+	    page_mapped(page) || page_count(page) > 3) {
+		unlock_page(page);
+		return 0;
+	}
+	node = jprivate(page);
+	spin_lock_jnode(node);
+	spin_lock(&(node->load));
+	if (jnode_is_unformatted(node) && node->atom == NULL &&
+	    jnode_is_releasable(node)) {
+		jref(node);
+		page_clear_jnode(page, node);
+		shed = 1;
+	}
+	spin_unlock(&(node->load));
+	spin_unlock_jnode(node);
+	unlock_page(page);
+	if (shed)
+		/* the jnode has no page now, so this frees it */
+		jput(node);
+	return shed;
+}
+
+/* shed jnodes of pages of @inode, look at no more than @nr_to_scan pages */
+static unsigned long shed_inode_jnodes(struct inode *inode,
+				       unsigned long *nr_to_scan)
+{
+	struct address_space *mapping = inode->i_mapping;
+	struct page *pages[SHED_BATCH];
+	unsigned long freed = 0;
+	pgoff_t index = 0;
+	unsigned found;
+	unsigned i;
+
+	while (*nr_to_scan != 0 &&
+	       (found = find_get_pages(mapping, &index,
+				       min_t(unsigned long, SHED_BATCH,
+					     *nr_to_scan), pages)) != 0) {
+		for (i = 0; i < found; i++) {
+			freed += shed_page_jnode(pages[i], mapping);
+			put_page(pages[i]);
+		}
+		*nr_to_scan -= found;
+	}
+	return freed;
+}
+
+static unsigned long jnode_shrink_count(struct shrinker *shrink,
+					struct shrink_control *sc)
+{
+	reiser4_super_info_data *sbinfo;
+
+	sbinfo = container_of(shrink, reiser4_super_info_data, jnode_shrinker);
+	/* all hashed unformatted jnodes, most of them are clean in a large
+	 * file cache */
+	return atomic_read(&sbinfo->tree.jhash_table._count);
+}
+
+static unsigned long jnode_shrink_scan(struct shrinker *shrink,
+				       struct shrink_control *sc)
+{
+	reiser4_super_info_data *sbinfo;
+	struct super_block *super;
+	struct inode *inode;
+	struct inode *toput = NULL;
+	unsigned long nr_to_scan = sc->nr_to_scan;
+	unsigned long freed = 0;
+
+	/* do not recurse into reiser4 from reclaim done by reiser4 itself */
+	if (!(sc->gfp_mask & __GFP_FS) || current->journal_info != NULL)
+		return SHRINK_STOP;
+
+	sbinfo = container_of(shrink, reiser4_super_info_data, jnode_shrinker);
+	super = sbinfo->tree.super;
+
+	spin_lock(&super->s_inode_list_lock);
+	list_for_each_entry(inode, &super->s_inodes, i_sb_list) {
+		reiser4_context ctx;
+
+		spin_lock(&inode->i_lock);
+		if ((inode->i_state & (I_FREEING | I_WILL_FREE | I_NEW)) ||
+		    !S_ISREG(inode->i_mode) || inode->i_nlink == 0 ||
+		    inode->i_mapping->nrpages == 0 ||
+		    inode_file_plugin(inode)->h.id != UNIX_FILE_PLUGIN_ID) {
+			spin_unlock(&inode->i_lock);
+			continue;
+		}
+		__iget(inode);
+		spin_unlock(&inode->i_lock);
+		spin_unlock(&super->s_inode_list_lock);
+
+		iput(toput);
+		toput = inode;
+
+		init_stack_context(&ctx, super);
+		freed += shed_inode_jnodes(inode, &nr_to_scan);
+		reiser4_exit_context(&ctx);
+
+		cond_resched();
+		spin_lock(&super->s_inode_list_lock);
+		if (nr_to_scan == 0)
+			break;
+	}
+	spin_unlock(&super->s_inode_list_lock);
+	iput(toput);
+	atomic_long_add(freed, &sbinfo->tree.nr_jnodes_shed);
+	return freed;
+}
+
+/**
+ * reiser4_init_jnode_shrinker - register shrinker of clean page jnodes
+ * @super: super block being mounted
+ */
+int reiser4_init_jnode_shrinker(struct super_block *super)
+{
+	struct shrinker *shrinker = &get_super_private(super)->jnode_shrinker;
+
+	shrinker->count_objects = jnode_shrink_count;
+	shrinker->scan_objects = jnode_shrink_scan;
+	shrinker->seeks = DEFAULT_SEEKS;
+	return register_shrinker(shrinker);
+}
+
+/**
+ * reiser4_done_jnode_shrinker - unregister shrinker of clean page jnodes
+ * @super: super block being unmounted
+ *
+ * This is called before inodes are evicted, because the shrinker holds inode
+ * references.
+ */
+void reiser4_done_jnode_shrinker(struct super_block *super)
+{
+	unregister_shrinker(&get_super_private(super)->jnode_shrinker);
+}
+
+/*
+ * ->direct_IO method for reiser4
+ *
+ * O_DIRECT reads and writes are served by ->read() and ->write() of file
+ * plugins, see direct_io_unix_file(). This is only reached through
+ * ->read_iter(), and makes generic_file_read_iter() fall back to buffered
+ * read. Having it also lets files be opened with O_DIRECT.
+ */
+ssize_t reiser4_direct_IO(struct kiocb *iocb UNUSED_ARG,
+			  struct iov_iter *iter UNUSED_ARG)
+{
+	return 0;
+}
+
 #ifdef CONFIG_MIGRATION
+/* help function called from reiser4_migratepage(). It returns true if jnode
+ * can be moved to another page */
+static int jnode_is_movable(jnode *node)
+{
+	assert_spin_locked(&(node->guard));
+	assert_spin_locked(&(node->load));
+
+	/* jnode data are mapped by some thread, see jload() */
+	if (atomic_read(&node->d_count) != 0)
+		return 0;
+	assert("", !jnode_is_loaded(node));
+	/* page is being written or prepared for write */
+	if (JF_ISSET(node, JNODE_WRITEBACK) ||
+	    JF_ISSET(node, JNODE_WRITE_PREPARED))
+		return 0;
+	return 1;
+}
+
+/*
+ * ->migratepage method for reiser4
+ *
+ * Pages without jnode are moved by migrate_page(). Otherwise the jnode is
+ * moved to @newpage together with the page cache entry and page content
+ * under the same locks reiser4_releasepage() detaches the jnode under: with
+ * the jnode lock and jload lock held nobody can load the jnode and map the
+ * old page. Captured and dirty pages are moved as well: the atom refers to
+ * the jnode, and anybody referring to the page itself holds a page
+ * reference, which makes migrate_page_move_mapping() fail.
+ */
 int reiser4_migratepage(struct address_space *mapping, struct page *newpage,
 			struct page *page, enum migrate_mode mode)
 {
-	/* TODO: implement movable mapping
-	 */
-	return -EIO;
+	jnode *node;
+	int result;
+
+	assert("", PageLocked(page));
+	assert("", PageLocked(newpage));
+
+	if (!PagePrivate(page))
+		return migrate_page(mapping, newpage, page, mode);
+	if (PageWriteback(page))
+		return -EBUSY;
+
+	node = jprivate(page);
+	assert("", node != NULL);
+	assert("", jnode_page(node) == page);
+
+	spin_lock_jnode(node);
+	spin_lock(&(node->load));
+	if (!jnode_is_movable(node)) {
+		spin_unlock(&(node->load));
+		spin_unlock_jnode(node);
+		return -EAGAIN;
+	}
+	result = migrate_page_move_mapping(mapping, newpage, page, 0);
+	if (result == MIGRATEPAGE_SUCCESS) {
+		/* bind jnode to @newpage, as jnode_attach_page() does */
+		attach_page_private(newpage, detach_page_private(page));
+		node->pg = newpage;
+		if (mode != MIGRATE_SYNC_NO_COPY)
+			migrate_page_copy(newpage, page);
+		else
+			migrate_page_states(newpage, page);
+	}
+	spin_unlock(&(node->load));
+	spin_unlock_jnode(node);
+	return result;
 }
 #endif /* CONFIG_MIGRATION */
 
@@ -334,7 +574,13 @@ int reiser4_readpages_dispatch(struct file *file, struct address_space *mapping,
 int reiser4_writepages_dispatch(struct address_space *mapping,
 				struct writeback_control *wbc)
 {
-	return inode_file_plugin(mapping->host)->writepages(mapping, wbc);
+	int result;
+
+	result = inode_file_plugin(mapping->host)->writepages(mapping, wbc);
+	if (result == 0 && is_in_reiser4_context() &&
+	    get_current_context()->writeback)
+		reiser4_writeback_note(mapping->host);
+	return result;
 }
 
 /* Make Linus happy.
@@ -14,6 +14,8 @@ reiser4/README */
 #include <linux/types.h>	/* for __u??  */
 #include <linux/fs.h>		/* for struct super_block  */
 #include <linux/spinlock.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
 
 /* THE REISER4 DISK SPACE RESERVATION SCHEME. */
 
@@ -249,6 +251,211 @@ int reiser4_check_block_counters(const struct super_block *super)
 	return 1;
 }
 
+/* PER-CPU GRAB CACHES
+
+   Each file system operation grabs space when it starts and returns the
+   unused part when it ends. Both used to take the super block spin lock.
+   To avoid that, each CPU keeps a cache of up to 2 * REISER4_GRAB_BATCH
+   blocks. These blocks were taken from free blocks and are counted as
+   grabbed, but no context owns them.
+
+   A grab of up to REISER4_GRAB_BATCH blocks is served from the current
+   CPU's cache, which is refilled from free blocks REISER4_GRAB_BATCH
+   blocks at a time. Released grabbed blocks go back to the cache, and any
+   excess goes back to free blocks.
+
+   Super block counters are only changed under the spin lock, so
+   reiser4_check_block_counters() keeps holding. statfs reports cached
+   blocks as free (see reiser4_grab_cached_blocks()).
+
+   Once free blocks drop below what the caches of all CPUs can hold, the
+   caches are neither refilled nor given blocks back, so space is accounted
+   exactly. A grab which fails with -ENOSPC first returns all cached blocks
+   to free blocks and then retries.
+*/
+
+/* free blocks below which grab caches are bypassed */
+static __u64 grab_cache_low(const reiser4_super_info_data * sbinfo)
+{
+	return sbinfo->blocks_reserved +
+		2 * REISER4_GRAB_BATCH * num_possible_cpus();
+}
+
+/* grab @count blocks from the cache of the current CPU. Returns true on
+   success */
+static int grab_cached(reiser4_context * ctx,
+		       reiser4_super_info_data * sbinfo, __u64 count)
+{
+	struct reiser4_grab_cache *cache;
+	int ret = 0;
+
+	if (sbinfo->grab_cache == NULL || count > REISER4_GRAB_BATCH)
+		return 0;
+
+	cache = get_cpu_ptr(sbinfo->grab_cache);
+	spin_lock(&cache->guard);
+	if (cache->nr < count) {
+		spin_lock_reiser4_super(sbinfo);
+		if (sbinfo->blocks_free >=
+		    grab_cache_low(sbinfo) + REISER4_GRAB_BATCH) {
+			sbinfo->blocks_free -= REISER4_GRAB_BATCH;
+			sbinfo->blocks_grabbed += REISER4_GRAB_BATCH;
+			cache->nr += REISER4_GRAB_BATCH;
+			assert("", reiser4_check_block_counters(ctx->super));
+		}
+		spin_unlock_reiser4_super(sbinfo);
+	}
+	if (cache->nr >= count) {
+		cache->nr -= count;
+		add_to_ctx_grabbed(ctx, count);
+		ret = 1;
+	}
+	spin_unlock(&cache->guard);
+	put_cpu_ptr(sbinfo->grab_cache);
+	return ret;
+}
+
+/* put @count grabbed blocks to the cache of the current CPU. Returns true
+   on success */
+static int free_cached(reiser4_super_info_data * sbinfo, __u64 count)
+{
+	struct reiser4_grab_cache *cache;
+
+	if (sbinfo->grab_cache == NULL || count > REISER4_GRAB_BATCH ||
+	    READ_ONCE(sbinfo->blocks_free) < grab_cache_low(sbinfo))
+		return 0;
+
+	cache = get_cpu_ptr(sbinfo->grab_cache);
+	spin_lock(&cache->guard);
+	cache->nr += count;
+	if (cache->nr > 2 * REISER4_GRAB_BATCH) {
+		spin_lock_reiser4_super(sbinfo);
+		sub_from_sb_grabbed(sbinfo, REISER4_GRAB_BATCH);
+		sbinfo->blocks_free += REISER4_GRAB_BATCH;
+		spin_unlock_reiser4_super(sbinfo);
+		cache->nr -= REISER4_GRAB_BATCH;
+	}
+	spin_unlock(&cache->guard);
+	put_cpu_ptr(sbinfo->grab_cache);
+	return 1;
+}
+
+/* return blocks of grab caches of all CPUs to free blocks. Returns true if
+   there were any */
+static int grab_cache_drain(reiser4_super_info_data * sbinfo)
+{
+	__u64 drained = 0;
+	int cpu;
+
+	if (sbinfo->grab_cache == NULL)
+		return 0;
+
+	for_each_possible_cpu(cpu) {
+		struct reiser4_grab_cache *cache;
+
+		cache = per_cpu_ptr(sbinfo->grab_cache, cpu);
+		spin_lock(&cache->guard);
+		if (cache->nr != 0) {
+			spin_lock_reiser4_super(sbinfo);
+			sub_from_sb_grabbed(sbinfo, cache->nr);
+			sbinfo->blocks_free += cache->nr;
+			spin_unlock_reiser4_super(sbinfo);
+			drained += cache->nr;
+			cache->nr = 0;
+		}
+		spin_unlock(&cache->guard);
+	}
+	return drained != 0;
+}
+
+/**
+ * reiser4_init_grab_cache - allocate per-CPU grab caches
+ * @super: super block being mounted
+ *
+ * Failure to allocate is not fatal: space is then grabbed under the super
+ * block spin lock only.
+ */
+void reiser4_init_grab_cache(struct super_block *super)
+{
+	reiser4_super_info_data *sbinfo = get_super_private(super);
+	int cpu;
+
+	sbinfo->grab_cache = alloc_percpu_gfp(struct reiser4_grab_cache,
+					      GFP_KERNEL | __GFP_NOWARN);
+	if (sbinfo->grab_cache == NULL)
+		return;
+	for_each_possible_cpu(cpu) {
+		struct reiser4_grab_cache *cache;
+
+		cache = per_cpu_ptr(sbinfo->grab_cache, cpu);
+		spin_lock_init(&cache->guard);
+		cache->nr = 0;
+	}
+}
+
+/**
+ * reiser4_done_grab_cache - free per-CPU grab caches
+ * @super: super block being unmounted
+ */
+void reiser4_done_grab_cache(struct super_block *super)
+{
+	reiser4_super_info_data *sbinfo = get_super_private(super);
+
+	grab_cache_drain(sbinfo);
+	free_percpu(sbinfo->grab_cache);
+	sbinfo->grab_cache = NULL;
+}
+
+/**
+ * reiser4_grab_cached_blocks - number of blocks in grab caches
+ * @super: super block
+ *
+ * The result is approximate: caches are not locked.
+ */
+__u64 reiser4_grab_cached_blocks(const struct super_block *super)
+{
+	reiser4_super_info_data *sbinfo = get_super_private(super);
+	__u64 nr = 0;
+	int cpu;
+
+	if (sbinfo->grab_cache == NULL)
+		return 0;
+	for_each_possible_cpu(cpu)
+		nr += READ_ONCE(per_cpu_ptr(sbinfo->grab_cache, cpu)->nr);
+	return nr;
+}
+
+/* grab @count blocks from free blocks under super block spin lock */
+static int grab_exact(reiser4_context * ctx,
+		      reiser4_super_info_data * sbinfo, __u64 count,
+		      int use_reserved)
+{
+	__u64 free_blocks;
+	int ret = 0;
+
+	spin_lock_reiser4_super(sbinfo);
+
+	free_blocks = sbinfo->blocks_free;
+
+	if ((use_reserved && free_blocks < count) ||
+	    (!use_reserved && free_blocks < count + sbinfo->blocks_reserved)) {
+		ret = RETERR(-ENOSPC);
+		goto unlock_and_ret;
+	}
+
+	add_to_ctx_grabbed(ctx, count);
+
+	sbinfo->blocks_grabbed += count;
+	sbinfo->blocks_free -= count;
+
+	assert("nikita-2986", reiser4_check_block_counters(ctx->super));
+
+unlock_and_ret:
+	spin_unlock_reiser4_super(sbinfo);
+
+	return ret;
+}
+
 /* Adjust "working" free blocks counter for number of blocks we are going to
    allocate.  Record number of grabbed blocks in fs-wide and per-thread
    counters.  This function should be called before bitmap scanning or
@@ -264,8 +471,7 @@ int reiser4_check_block_counters(const struct super_block *super)
 static int
 reiser4_grab(reiser4_context * ctx, __u64 count, reiser4_ba_flags_t flags)
 {
-	__u64 free_blocks;
-	int ret = 0, use_reserved = flags & BA_RESERVED;
+	int ret, use_reserved = flags & BA_RESERVED;
 	reiser4_super_info_data *sbinfo;
 
 	assert("vs-1276", ctx == get_current_context());
@@ -279,35 +485,22 @@ reiser4_grab(reiser4_context * ctx, __u64 count, reiser4_ba_flags_t flags)
 
 	sbinfo = get_super_private(ctx->super);
 
-	spin_lock_reiser4_super(sbinfo);
-
-	free_blocks = sbinfo->blocks_free;
-
-	if ((use_reserved && free_blocks < count) ||
-	    (!use_reserved && free_blocks < count + sbinfo->blocks_reserved)) {
-		ret = RETERR(-ENOSPC);
-		goto unlock_and_ret;
+	if (use_reserved || !grab_cached(ctx, sbinfo, count)) {
+		ret = grab_exact(ctx, sbinfo, count, use_reserved);
+		if (ret == -ENOSPC && grab_cache_drain(sbinfo))
+			ret = grab_exact(ctx, sbinfo, count, use_reserved);
+		if (ret != 0)
+			return ret;
 	}
 
-	add_to_ctx_grabbed(ctx, count);
-
-	sbinfo->blocks_grabbed += count;
-	sbinfo->blocks_free -= count;
-
 #if REISER4_DEBUG
 	if (ctx->grabbed_initially == 0)
 		ctx->grabbed_initially = count;
 #endif
 
-	assert("nikita-2986", reiser4_check_block_counters(ctx->super));
-
 	/* disable grab space in current context */
 	ctx->grab_enabled = 0;
-
-unlock_and_ret:
-	spin_unlock_reiser4_super(sbinfo);
-
-	return ret;
+	return 0;
 }
 
 int reiser4_grab_space(__u64 count, reiser4_ba_flags_t flags)
@@ -325,12 +518,18 @@ int reiser4_grab_space(__u64 count, reiser4_ba_flags_t flags)
 	ret = reiser4_grab(ctx, count, flags);
 	if (ret == -ENOSPC) {
 
-		/* Trying to commit the all transactions if BA_CAN_COMMIT flag
-		   present */
+		/* Trying to commit atoms which give space back, and then all
+		   transactions, if BA_CAN_COMMIT flag present */
 		if (flags & BA_CAN_COMMIT) {
-			txnmgr_force_commit_all(ctx->super, 0);
-			ctx->grab_enabled = 1;
-			ret = reiser4_grab(ctx, count, flags);
+			if (txnmgr_reclaim_space(ctx->super, count) == 0) {
+				ctx->grab_enabled = 1;
+				ret = reiser4_grab(ctx, count, flags);
+			}
+			if (ret == -ENOSPC) {
+				txnmgr_force_commit_all(ctx->super, 0);
+				ctx->grab_enabled = 1;
+				ret = reiser4_grab(ctx, count, flags);
+			}
 		}
 	}
 	/*
@@ -405,12 +604,28 @@ void reiser4_release_reserved(struct super_block *super)
 	}
 }
 
+/* Account @count grabbed blocks spent by balancing. When estimates in
+   estimate.c turned out too small and less than @count blocks are grabbed,
+   grab the rest from the reserved area. See "CALIBRATED ESTIMATES" in
+   estimate.c */
+static void grab_shortfall(reiser4_context * ctx, __u64 count)
+{
+	reiser4_super_info_data *sbinfo = get_super_private(ctx->super);
+
+	ctx->grabbed_consumed += count;
+	if (ctx->grabbed_blocks >= count)
+		return;
+	if (grab_exact(ctx, sbinfo, count - ctx->grabbed_blocks, 1) == 0)
+		reiser4_estimate_miss(&sbinfo->tree);
+}
+
 static reiser4_super_info_data *grabbed2fake_allocated_head(int count)
 {
 	reiser4_context *ctx;
 	reiser4_super_info_data *sbinfo;
 
 	ctx = get_current_context();
+	grab_shortfall(ctx, count);
 	sub_from_ctx_grabbed(ctx, count);
 
 	sbinfo = get_super_private(ctx->super);
@@ -602,6 +817,55 @@ static void flush_reserved2used(txn_atom * atom, __u64 count)
 	spin_unlock_reiser4_super(sbinfo);
 }
 
+/* ALLOCATION GROUPS
+
+   Nodes which have no preceder are allocated from the default blocknr hint,
+   which follows the last written location. With one hint for the whole
+   file system, concurrent flushers all start at the same place and
+   serialize on the same bitmap block.
+
+   So, on a file system with at least REISER4_ALLOC_GROUP_MIN blocks per
+   CPU, the device is split into one allocation group per CPU. Each CPU
+   keeps its own default hint, which starts at its group and then follows
+   the writes submitted on that CPU. Explicit hints (preceders, max_dist)
+   are not affected, so locality policy is kept.
+*/
+
+/**
+ * reiser4_init_alloc_groups - allocate per-CPU default blocknr hints
+ * @super: super block being mounted
+ *
+ * Failure to allocate is not fatal: one default hint is used then.
+ */
+void reiser4_init_alloc_groups(struct super_block *super)
+{
+	reiser4_super_info_data *sbinfo = get_super_private(super);
+
+	if (num_possible_cpus() > 1)
+		sbinfo->blocknr_hints = alloc_percpu_gfp(__u64, GFP_KERNEL |
+							 __GFP_NOWARN);
+}
+
+/**
+ * reiser4_done_alloc_groups - free per-CPU default blocknr hints
+ * @super: super block being unmounted
+ */
+void reiser4_done_alloc_groups(struct super_block *super)
+{
+	reiser4_super_info_data *sbinfo = get_super_private(super);
+
+	free_percpu(sbinfo->blocknr_hints);
+	sbinfo->blocknr_hints = NULL;
+}
+
+/* true if default blocknr hints are kept per CPU */
+static int alloc_groups_enabled(const reiser4_super_info_data * sbinfo)
+{
+	return sbinfo->blocknr_hints != NULL &&
+		div_u64(sbinfo->block_count, num_possible_cpus()) >=
+		REISER4_ALLOC_GROUP_MIN;
+}
+
 /* update the per fs  blocknr hint default value. */
 void
 update_blocknr_hint_default(const struct super_block *s,
@@ -611,6 +875,11 @@ update_blocknr_hint_default(const struct super_block *s,
 
 	assert("nikita-3342", !reiser4_blocknr_is_fake(block));
 
+	if (alloc_groups_enabled(sbinfo) && *block < sbinfo->block_count) {
+		this_cpu_write(*sbinfo->blocknr_hints, *block);
+		return;
+	}
+
 	spin_lock_reiser4_super(sbinfo);
 	if (*block < sbinfo->block_count) {
 		sbinfo->blocknr_hint_default = *block;
@@ -629,12 +898,170 @@ void get_blocknr_hint_default(reiser4_block_nr * result)
 {
 	reiser4_super_info_data *sbinfo = get_current_super_private();
 
+	if (alloc_groups_enabled(sbinfo)) {
+		*result = this_cpu_read(*sbinfo->blocknr_hints);
+		if (*result == 0 || *result >= sbinfo->block_count) {
+			/* nothing was written on this CPU yet: start at the
+			   beginning of its allocation group */
+			*result = div_u64(sbinfo->block_count,
+					  num_possible_cpus()) *
+				(raw_smp_processor_id() % num_possible_cpus());
+		}
+		return;
+	}
+
 	spin_lock_reiser4_super(sbinfo);
 	*result = sbinfo->blocknr_hint_default;
 	assert("zam-677", *result < sbinfo->block_count);
 	spin_unlock_reiser4_super(sbinfo);
 }
 
+/* account @len blocks just allocated on disk according to
+   @hint->block_stage */
+static void alloc_blocks_account(reiser4_context * ctx,
+				 reiser4_super_info_data * sbinfo,
+				 const reiser4_blocknr_hint * hint,
+				 reiser4_block_nr len, reiser4_ba_flags_t flags)
+{
+	if (flags & BA_PERMANENT) {
+		/* we assume that current atom exists at this moment */
+		txn_atom *atom = get_current_atom_locked();
+		atom->nr_blocks_allocated += len;
+		spin_unlock_atom(atom);
+	}
+
+	switch (hint->block_stage) {
+	case BLOCK_NOT_COUNTED:
+	case BLOCK_GRABBED:
+		grabbed2used(ctx, sbinfo, len);
+		break;
+	case BLOCK_UNALLOCATED:
+		fake_allocated2used(sbinfo, len, flags);
+		break;
+	case BLOCK_FLUSH_RESERVED:
+		{
+			txn_atom *atom = get_current_atom_locked();
+			flush_reserved2used(atom, len);
+			spin_unlock_atom(atom);
+		}
+		break;
+	default:
+		impossible("zam-531", "wrong block stage");
+	}
+}
+
+static int prealloc_drain(struct super_block *super);
+
+/* LOG-STRUCTURED ALLOCATION
+
+   Flush allocates relocated blocks close to their preceders, parents and
+   previous extents, so an atom is written to many places of the disk. Disks
+   with shingled recording and flash of many bits per cell want writes to be
+   sequential.
+
+   With the log_alloc mount option and write-anywhere transaction model,
+   where all dirty blocks are relocated, every permanent allocation starts
+   its search at the head of a log, sbinfo->log_head, rather than at the
+   hint of its caller, and the head is moved to the end of the allocated
+   blocks. So all blocks of one atom, formatted and unformatted, are
+   allocated in order of flush in one sequential run as long as there is free
+   space after the head. When the head reaches the end of the disk, it starts
+   over from the beginning, and blocks freed by earlier atoms are reused in
+   order. Preallocation windows are not used in this mode.
+
+   There is no separate cleaner: the background defragmenter (defrag.c) has
+   slums of fragmented files relocated, which in this mode puts them at the
+   head as well.
+*/
+
+static int log_alloc_enabled(const struct super_block *super)
+{
+	return reiser4_is_set(super, REISER4_LOG_ALLOC) &&
+		get_super_private(super)->txmod == WA_TXMOD_ID;
+}
+
+/* point @hint to the head of the log */
+static void log_alloc_hint(reiser4_super_info_data *sbinfo,
+			   reiser4_blocknr_hint *hint)
+{
+	spin_lock_reiser4_super(sbinfo);
+	hint->blk = sbinfo->log_head;
+	spin_unlock_reiser4_super(sbinfo);
+	hint->max_dist = 0;
+	hint->backward = 0;
+}
+
+/* move the head of the log past just allocated blocks ending at @end */
+static void log_alloc_advance(reiser4_super_info_data *sbinfo,
+			      reiser4_block_nr end)
+{
+	spin_lock_reiser4_super(sbinfo);
+	sbinfo->log_head = (end < sbinfo->block_count) ? end : 0;
+	spin_unlock_reiser4_super(sbinfo);
+}
+
+/* METADATA ZONE
+
+   With meta_zone=N mount option the first N blocks of the device are
+   preferred for formatted nodes and wandered blocks, and the rest of the
+   device for unformatted ones. On a device made of a small fast device and a
+   large slow one concatenated (by dm-linear, for example) a zone covering
+   the fast part keeps the tree and the journal on it, and file data on the
+   slow part, without any change of the disk format.
+
+   Both are preferences only: when the zone is full, formatted nodes are
+   allocated anywhere, and when the rest of the device is full, unformatted
+   blocks get into the zone. Formatted nodes are allocated in the zone from
+   where the previous allocation there ended, as the flush preceder usually
+   points to file data. Allocations limited by max_dist (relocation to a
+   close position) are not redirected. */
+
+static int meta_zone_used(const reiser4_super_info_data *sbinfo)
+{
+	return sbinfo->meta_zone != 0 && sbinfo->meta_zone < sbinfo->block_count;
+}
+
+/* allocate formatted blocks in the metadata zone */
+static int meta_zone_alloc(struct super_block *super,
+			   reiser4_blocknr_hint *hint, int needed,
+			   reiser4_block_nr *blk, reiser4_block_nr *len)
+{
+	reiser4_super_info_data *sbinfo = get_super_private(super);
+	reiser4_blocknr_hint zhint = *hint;
+	int ret;
+
+	if (zhint.blk >= sbinfo->meta_zone) {
+		zhint.blk = READ_ONCE(sbinfo->meta_zone_next);
+		if (zhint.blk >= sbinfo->meta_zone)
+			zhint.blk = 0;
+	}
+	zhint.max_dist = sbinfo->meta_zone - zhint.blk;
+	ret = sa_alloc_blocks(reiser4_get_space_allocator(super), &zhint,
+			      needed, blk, len);
+	if (ret == -ENOSPC && zhint.blk != 0) {
+		/* the beginning of the zone */
+		zhint.max_dist = zhint.blk;
+		zhint.blk = 0;
+		*len = needed;
+		ret = sa_alloc_blocks(reiser4_get_space_allocator(super),
+				      &zhint, needed, blk, len);
+	}
+	if (ret == 0)
+		WRITE_ONCE(sbinfo->meta_zone_next, *blk + *len);
+	else
+		*len = needed;
+	return ret;
+}
+
+/* start search for unformatted blocks after the metadata zone */
+static void meta_zone_skip(reiser4_super_info_data *sbinfo,
+			   reiser4_blocknr_hint *hint)
+{
+	if (meta_zone_used(sbinfo) && !hint->backward &&
+	    hint->blk < sbinfo->meta_zone)
+		hint->blk = max(sbinfo->blocknr_hint_default, sbinfo->meta_zone);
+}
+
 /* Allocate "real" disk blocks by calling a proper space allocation plugin
  * method. Blocks are allocated in one contiguous disk region. The plugin
  * independent part accounts blocks by subtracting allocated amount from grabbed
@@ -659,6 +1086,7 @@ reiser4_alloc_blocks(reiser4_blocknr_hint * hint, reiser4_block_nr * blk,
 	__u64 needed = *len;
 	reiser4_context *ctx;
 	reiser4_super_info_data *sbinfo;
+	int log;
 	int ret;
 
 	assert("zam-986", hint != NULL);
@@ -670,6 +1098,9 @@ reiser4_alloc_blocks(reiser4_blocknr_hint * hint, reiser4_block_nr * blk,
 	 * close to last write location. */
 	if (flags & BA_USE_DEFAULT_SEARCH_START)
 		get_blocknr_hint_default(&hint->blk);
+	log = (flags & BA_PERMANENT) && log_alloc_enabled(ctx->super);
+	if (log)
+		log_alloc_hint(sbinfo, hint);
 
 	/* VITALY: allocator should grab this for internal/tx-lists/similar
 	   only. */
@@ -680,40 +1111,28 @@ reiser4_alloc_blocks(reiser4_blocknr_hint * hint, reiser4_block_nr * blk,
 			return ret;
 	}
 
-	ret =
-	    sa_alloc_blocks(reiser4_get_space_allocator(ctx->super),
-			    hint, (int)needed, blk, len);
+	ret = -ENOSPC;
+	if ((flags & BA_FORMATTED) && meta_zone_used(sbinfo) &&
+	    hint->max_dist == 0 && !hint->backward)
+		ret = meta_zone_alloc(ctx->super, hint, (int)needed, blk, len);
+	if (ret == -ENOSPC)
+		ret = sa_alloc_blocks(reiser4_get_space_allocator(ctx->super),
+				      hint, (int)needed, blk, len);
+	if (ret == -ENOSPC && prealloc_drain(ctx->super)) {
+		/* free blocks were kept in preallocation windows */
+		*len = needed;
+		ret = sa_alloc_blocks(reiser4_get_space_allocator(ctx->super),
+				      hint, (int)needed, blk, len);
+	}
 
 	if (!ret) {
 		assert("zam-680", *blk < reiser4_block_count(ctx->super));
 		assert("zam-681",
 		       *blk + *len <= reiser4_block_count(ctx->super));
 
-		if (flags & BA_PERMANENT) {
-			/* we assume that current atom exists at this moment */
-			txn_atom *atom = get_current_atom_locked();
-			atom->nr_blocks_allocated += *len;
-			spin_unlock_atom(atom);
-		}
-
-		switch (hint->block_stage) {
-		case BLOCK_NOT_COUNTED:
-		case BLOCK_GRABBED:
-			grabbed2used(ctx, sbinfo, *len);
-			break;
-		case BLOCK_UNALLOCATED:
-			fake_allocated2used(sbinfo, *len, flags);
-			break;
-		case BLOCK_FLUSH_RESERVED:
-			{
-				txn_atom *atom = get_current_atom_locked();
-				flush_reserved2used(atom, *len);
-				spin_unlock_atom(atom);
-			}
-			break;
-		default:
-			impossible("zam-531", "wrong block stage");
-		}
+		alloc_blocks_account(ctx, sbinfo, hint, *len, flags);
+		if (log)
+			log_alloc_advance(sbinfo, *blk + *len);
 	} else {
 		assert("zam-821",
 		       ergo(hint->max_dist == 0
@@ -725,25 +1144,270 @@ reiser4_alloc_blocks(reiser4_blocknr_hint * hint, reiser4_block_nr * blk,
 	return ret;
 }
 
+/* PREALLOCATION WINDOWS
+
+   Files written at the same time get their blocks allocated by flush, each
+   flush starting at its preceder. Interleaved flushes of several appending
+   files then interleave the files on disk.
+
+   To keep such files contiguous, the first allocation of unformatted blocks
+   for a file takes sbinfo->prealloc_window more blocks than needed from the
+   bitmap. The extra blocks become the file's preallocation window. Further
+   allocations for the file are carved from the window, in order, until it
+   is used up, and the next allocation opens a new window.
+
+   Window blocks are only marked used in the working bitmap. Block counters
+   still count them as free, and since they never get into an atom, they
+   never reach the commit bitmap, so a crash loses nothing. A window is
+   given back to the bitmap
+
+   - when the file is closed (release_unix_file()) or evicted,
+   - when more than REISER4_PREALLOC_MAX windows exist, the least recently
+   used one,
+   - all of them, when the bitmap has no free blocks left for an allocation
+   (see reiser4_alloc_blocks()),
+   - on umount.
+
+   No windows are opened while free blocks are scarce.
+*/
+
+struct prealloc_window {
+	struct hlist_node hash;
+	struct list_head lru;
+	oid_t oid;
+	reiser4_block_nr start;
+	reiser4_block_nr len;
+};
+
+/**
+ * reiser4_init_prealloc - initialize preallocation windows
+ * @super: super block being mounted
+ */
+void reiser4_init_prealloc(struct super_block *super)
+{
+	struct reiser4_prealloc *pa = &get_super_private(super)->prealloc;
+
+	spin_lock_init(&pa->guard);
+	hash_init(pa->table);
+	INIT_LIST_HEAD(&pa->lru);
+	pa->nr = 0;
+	pa->blocks = 0;
+}
+
+static struct prealloc_window *prealloc_lookup(struct reiser4_prealloc *pa,
+					       oid_t oid)
+{
+	struct prealloc_window *win;
+
+	assert_spin_locked(&pa->guard);
+	hash_for_each_possible(pa->table, win, hash, oid)
+		if (win->oid == oid)
+			return win;
+	return NULL;
+}
+
+static void prealloc_unlink(struct reiser4_prealloc *pa,
+			    struct prealloc_window *win)
+{
+	assert_spin_locked(&pa->guard);
+	hash_del(&win->hash);
+	list_del(&win->lru);
+	pa->nr--;
+	pa->blocks -= win->len;
+}
+
+/* give blocks of unlinked @win back to the bitmap and free it */
+static void prealloc_free(struct super_block *super,
+			  struct prealloc_window *win)
+{
+	if (win->len != 0)
+		sa_dealloc_blocks(reiser4_get_space_allocator(super),
+				  win->start, win->len);
+	kfree(win);
+}
+
+/**
+ * reiser4_prealloc_release - give preallocation window of a file back
+ * @super: super block
+ * @oid: object id of the file
+ */
+void reiser4_prealloc_release(struct super_block *super, oid_t oid)
+{
+	struct reiser4_prealloc *pa = &get_super_private(super)->prealloc;
+	struct prealloc_window *win;
+
+	if (READ_ONCE(pa->nr) == 0)
+		return;
+	spin_lock(&pa->guard);
+	win = prealloc_lookup(pa, oid);
+	if (win != NULL)
+		prealloc_unlink(pa, win);
+	spin_unlock(&pa->guard);
+	if (win != NULL)
+		prealloc_free(super, win);
+}
+
+/* give all preallocation windows back. Returns true if there were any */
+static int prealloc_drain(struct super_block *super)
+{
+	struct reiser4_prealloc *pa = &get_super_private(super)->prealloc;
+	struct prealloc_window *win;
+	int drained = 0;
+
+	while (READ_ONCE(pa->nr) != 0) {
+		spin_lock(&pa->guard);
+		win = list_first_entry_or_null(&pa->lru,
+					       struct prealloc_window, lru);
+		if (win != NULL)
+			prealloc_unlink(pa, win);
+		spin_unlock(&pa->guard);
+		if (win == NULL)
+			break;
+		prealloc_free(super, win);
+		drained = 1;
+	}
+	return drained;
+}
+
+/**
+ * reiser4_done_prealloc - give all preallocation windows back
+ * @super: super block being unmounted
+ *
+ * This is called when all atoms are committed, before the space allocator
+ * is destroyed.
+ */
+void reiser4_done_prealloc(struct super_block *super)
+{
+	prealloc_drain(super);
+	assert("", get_super_private(super)->prealloc.nr == 0);
+}
+
+/* carve up to @len blocks for file @oid from its window into @blk and @len.
+   Returns true on success */
+static int prealloc_take(struct reiser4_prealloc *pa, oid_t oid,
+			 reiser4_block_nr * blk, reiser4_block_nr * len)
+{
+	struct prealloc_window *win;
+
+	if (READ_ONCE(pa->nr) == 0)
+		return 0;
+
+	spin_lock(&pa->guard);
+	win = prealloc_lookup(pa, oid);
+	if (win == NULL) {
+		spin_unlock(&pa->guard);
+		return 0;
+	}
+	assert("", win->len != 0);
+	*blk = win->start;
+	*len = min(*len, win->len);
+	win->start += *len;
+	win->len -= *len;
+	pa->blocks -= *len;
+	if (win->len == 0) {
+		hash_del(&win->hash);
+		list_del(&win->lru);
+		pa->nr--;
+	} else {
+		list_move_tail(&win->lru, &pa->lru);
+		win = NULL;
+	}
+	spin_unlock(&pa->guard);
+	kfree(win);
+	return 1;
+}
+
+/* allocate @len blocks for file @oid together with a new preallocation
+   window behind them. Returns true on success */
+static int prealloc_open(struct super_block *super, reiser4_blocknr_hint * hint,
+			 oid_t oid, reiser4_block_nr * blk,
+			 reiser4_block_nr * len)
+{
+	reiser4_super_info_data *sbinfo = get_super_private(super);
+	struct reiser4_prealloc *pa = &sbinfo->prealloc;
+	struct prealloc_window *win;
+	struct prealloc_window *old = NULL;
+	reiser4_block_nr window = sbinfo->prealloc_window;
+	reiser4_block_nr got;
+
+	if (window == 0 || *len >= window ||
+	    READ_ONCE(sbinfo->blocks_free) <
+	    sbinfo->blocks_reserved + 2 * window * REISER4_PREALLOC_MAX)
+		return 0;
+
+	win = kmalloc(sizeof(*win), reiser4_ctx_gfp_mask_get());
+	if (win == NULL)
+		return 0;
+
+	got = *len + window;
+	if (sa_alloc_blocks(reiser4_get_space_allocator(super), hint,
+			    (int)got, blk, &got) != 0) {
+		kfree(win);
+		return 0;
+	}
+	if (got <= *len) {
+		/* no room for a window here */
+		*len = got;
+		kfree(win);
+		return 1;
+	}
+
+	win->oid = oid;
+	win->start = *blk + *len;
+	win->len = got - *len;
+
+	spin_lock(&pa->guard);
+	if (prealloc_lookup(pa, oid) != NULL) {
+		/* somebody opened a window for this file meanwhile */
+		spin_unlock(&pa->guard);
+		prealloc_free(super, win);
+		return 1;
+	}
+	if (pa->nr >= REISER4_PREALLOC_MAX) {
+		old = list_first_entry(&pa->lru, struct prealloc_window, lru);
+		prealloc_unlink(pa, old);
+	}
+	hash_add(pa->table, &win->hash, oid);
+	list_add_tail(&win->lru, &pa->lru);
+	pa->nr++;
+	pa->blocks += win->len;
+	spin_unlock(&pa->guard);
+	if (old != NULL)
+		prealloc_free(super, old);
+	return 1;
+}
+
 /**
  * ask block allocator for some unformatted blocks
  */
-void allocate_blocks_unformatted(reiser4_blocknr_hint *preceder,
+void allocate_blocks_unformatted(reiser4_blocknr_hint *preceder, oid_t oid,
 				 reiser4_block_nr wanted_count,
 				 reiser4_block_nr *first_allocated,
 				 reiser4_block_nr *allocated,
 				 block_stage_t block_stage)
 {
+	reiser4_context *ctx = get_current_context();
+	reiser4_super_info_data *sbinfo = get_super_private(ctx->super);
+
 	*allocated = wanted_count;
 	preceder->max_dist = 0;	/* scan whole disk, if needed */
+	meta_zone_skip(sbinfo, preceder);
 
 	/* that number of blocks (wanted_count) is either in UNALLOCATED or in GRABBED */
 	preceder->block_stage = block_stage;
 
-	/* FIXME: we do not handle errors here now */
-	check_me("vs-420",
-		 reiser4_alloc_blocks(preceder, first_allocated, allocated,
-				      BA_PERMANENT) == 0);
+	if (!log_alloc_enabled(ctx->super) &&
+	    (prealloc_take(&sbinfo->prealloc, oid, first_allocated,
+			   allocated) ||
+	     prealloc_open(ctx->super, preceder, oid, first_allocated,
+			   allocated)))
+		alloc_blocks_account(ctx, sbinfo, preceder, *allocated,
+				     BA_PERMANENT);
+	else
+		/* FIXME: we do not handle errors here now */
+		check_me("vs-420",
+			 reiser4_alloc_blocks(preceder, first_allocated,
+					      allocated, BA_PERMANENT) == 0);
 	/* update flush_pos's preceder to last allocated block number */
 	preceder->blk = *first_allocated + *allocated - 1;
 }
@@ -851,6 +1515,9 @@ void grabbed2free(reiser4_context *ctx, reiser4_super_info_data *sbinfo,
 {
 	sub_from_ctx_grabbed(ctx, count);
 
+	if (free_cached(sbinfo, count))
+		return;
+
 	spin_lock_reiser4_super(sbinfo);
 
 	sub_from_sb_grabbed(sbinfo, count);
@@ -870,6 +1537,7 @@ void grabbed2flush_reserved_nolock(txn_atom * atom, __u64 count)
 	ctx = get_current_context();
 	sbinfo = get_super_private(ctx->super);
 
+	grab_shortfall(ctx, count);
 	sub_from_ctx_grabbed(ctx, count);
 
 	add_to_atom_flush_reserved_nolock(atom, count);
@@ -1081,6 +1749,42 @@ reiser4_dealloc_blocks(const reiser4_block_nr * start,
 	return 0;
 }
 
+/**
+ * reiser4_record_allocated - make allocation of blocks without jnodes durable
+ * @start: first block of the range
+ * @len: number of blocks
+ *
+ * Blocks allocated by flush get into COMMIT BITMAP because their jnodes are
+ * relocated members of the atom. Blocks which were allocated with
+ * BA_PERMANENT, but whose contents are written bypassing jnodes (see
+ * reiser4_fallocate_extent()), are put to the atom's alloc set instead. The
+ * pre-commit hook marks them used in COMMIT BITMAP.
+ */
+int reiser4_record_allocated(const reiser4_block_nr *start,
+			     const reiser4_block_nr *len)
+{
+	txn_atom *atom;
+	void *new_entry = NULL;
+	int ret;
+
+	assert("", *len != 0);
+	assert("", !reiser4_blocknr_is_fake(start));
+
+	do {
+		atom = get_current_atom_locked();
+		ret = blocknr_set_add_extent(atom, &atom->alloc_set,
+					     (blocknr_set_entry **)&new_entry,
+					     start, len);
+		if (ret == -ENOMEM)
+			return ret;
+		/* This loop might spin at most two times */
+	} while (ret == -E_REPEAT);
+
+	assert("", ret == 0);
+	spin_unlock_atom(atom);
+	return 0;
+}
+
 /* wrappers for block allocator plugin methods */
 int reiser4_pre_commit_hook(void)
 {
@@ -1137,25 +1841,32 @@ void reiser4_post_commit_hook(void)
 	sa_post_commit_hook();
 }
 
-void reiser4_post_write_back_hook(void)
+/**
+ * reiser4_free_discarded - free blocks of a discarded extent
+ * @start: first block of the extent
+ * @len: length of the extent
+ *
+ * This is the deferred deallocation of extents queued by discard_atom(),
+ * done once their discard is issued.
+ */
+void reiser4_free_discarded(reiser4_block_nr start, reiser4_block_nr len)
 {
-	struct list_head discarded_set;
-	txn_atom *atom;
-	int ret;
+	reiser4_super_info_data *sbinfo = get_current_super_private();
 
-	/* process and issue discard requests */
-	blocknr_list_init (&discarded_set);
-	do {
-		atom = get_current_atom_locked();
-		ret = discard_atom(atom, &discarded_set);
-	} while (ret == -E_REPEAT);
+	assert("", start + len <= reiser4_block_count(reiser4_get_current_sb()));
 
-	if (ret) {
-		warning("intelfx-8", "discard atom failed (%d)", ret);
-	}
+	sa_dealloc_blocks(&sbinfo->space_allocator, start, len);
+	used2free(sbinfo, len);
+}
+
+void reiser4_post_write_back_hook(void)
+{
+	txn_atom *atom;
 
+	/* queue delete set for discarding, deallocation of queued extents
+	   is deferred until they are discarded */
 	atom = get_current_atom_locked();
-	discard_atom_post(atom, &discarded_set);
+	discard_atom(atom);
 
 	/* do the block deallocation which was deferred
 	   until commit is done */
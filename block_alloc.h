@@ -98,6 +98,14 @@ reiser4_block_nr fake_blocknr_unformatted(int);
 /* free -> grabbed -> fake_allocated -> used */
 
 int reiser4_grab_space(__u64 count, reiser4_ba_flags_t flags);
+void reiser4_init_grab_cache(struct super_block *);
+void reiser4_init_alloc_groups(struct super_block *);
+void reiser4_done_alloc_groups(struct super_block *);
+void reiser4_done_grab_cache(struct super_block *);
+__u64 reiser4_grab_cached_blocks(const struct super_block *);
+void reiser4_init_prealloc(struct super_block *);
+void reiser4_done_prealloc(struct super_block *);
+void reiser4_prealloc_release(struct super_block *, oid_t);
 void all_grabbed2free(void);
 void grabbed2free(reiser4_context * , reiser4_super_info_data * , __u64 count);
 void fake_allocated2free(__u64 count, reiser4_ba_flags_t flags);
@@ -109,6 +117,14 @@ int reiser4_alloc_blocks(reiser4_blocknr_hint * hint,
 int reiser4_dealloc_blocks(const reiser4_block_nr *,
 			   const reiser4_block_nr *,
 			   block_stage_t, reiser4_ba_flags_t flags);
+void reiser4_free_discarded(reiser4_block_nr start, reiser4_block_nr len);
+int reiser4_record_allocated(const reiser4_block_nr *start,
+			     const reiser4_block_nr *len);
+void allocate_blocks_unformatted(reiser4_blocknr_hint *preceder, oid_t oid,
+				 reiser4_block_nr wanted_count,
+				 reiser4_block_nr *first_allocated,
+				 reiser4_block_nr *allocated,
+				 block_stage_t block_stage);
 
 static inline int reiser4_alloc_block(reiser4_blocknr_hint * hint,
 				      reiser4_block_nr * start,
@@ -200,15 +200,77 @@ void blocknr_list_merge(struct list_head *from, struct list_head *to)
 	assert("intelfx-49", list_empty(from));
 }
 
+/* bits of block number sorted by one pass of radix sort */
+#define BLOCKNR_RADIX_BITS (8)
+#define BLOCKNR_RADIX (1 << BLOCKNR_RADIX_BITS)
+
+/**
+ * Sort the extent list by start blocks with LSD radix sort. Only digits in
+ * which start blocks differ are sorted by, which are few as block numbers of
+ * one atom are close. Each pass distributes entries among buckets keeping
+ * their order, there are no comparator calls. Extents with equal starts are
+ * left in any order, join does not need more.
+ *
+ * Returns -ENOMEM if there is no memory for buckets.
+ */
+static int blocknr_list_radix_sort(struct list_head *blist,
+				   reiser4_block_nr varying)
+{
+	struct list_head *buckets;
+	int shift;
+	int i;
+
+	buckets = kmalloc_array(BLOCKNR_RADIX, sizeof(*buckets),
+				reiser4_ctx_gfp_mask_get() | __GFP_NOWARN);
+	if (buckets == NULL)
+		return RETERR(-ENOMEM);
+	for (i = 0; i < BLOCKNR_RADIX; i++)
+		INIT_LIST_HEAD(&buckets[i]);
+
+	for (shift = 0; shift < 64; shift += BLOCKNR_RADIX_BITS) {
+		struct list_head *pos, *tmp;
+
+		if (((varying >> shift) & (BLOCKNR_RADIX - 1)) == 0)
+			/* all starts have the same digit */
+			continue;
+		list_for_each_safe(pos, tmp, blist) {
+			reiser4_block_nr start = blocknr_list_entry(pos)->start;
+
+			list_move_tail(pos, &buckets[(start >> shift) &
+						     (BLOCKNR_RADIX - 1)]);
+		}
+		for (i = 0; i < BLOCKNR_RADIX; i++)
+			list_splice_tail_init(&buckets[i], blist);
+	}
+	kfree(buckets);
+	return 0;
+}
+
 void blocknr_list_sort_and_join(struct list_head *blist)
 {
 	struct list_head *pos, *next;
 	struct blocknr_list_entry *entry, *next_entry;
+	reiser4_block_nr varying = 0;
+	reiser4_block_nr prev;
+	int sorted = 1;
 
 	assert("intelfx-50", blist != NULL);
 
-	/* Step 1. Sort the extent list. */
-	list_sort(NULL, blist, blocknr_list_entry_compare);
+	if (list_empty(blist))
+		return;
+
+	/* Step 1. Sort the extent list, if it is not sorted already, as it
+	 * often is when blocks are freed in order. */
+	prev = blocknr_list_entry(blist->next)->start;
+	list_for_each(pos, blist) {
+		entry = blocknr_list_entry(pos);
+		if (entry->start < prev)
+			sorted = 0;
+		varying |= entry->start ^ prev;
+		prev = entry->start;
+	}
+	if (!sorted && blocknr_list_radix_sort(blist, varying) != 0)
+		list_sort(NULL, blist, blocknr_list_entry_compare);
 
 	/* Step 2. Join adjacent extents in the list. */
 	pos = blist->next;
@@ -233,6 +295,31 @@ void blocknr_list_sort_and_join(struct list_head *blist)
 	}
 }
 
+/**
+ * blocknr_list_pop - take the first extent off a block list
+ * @blist: block list
+ * @start: start of the extent is stored here
+ * @len: length of the extent is stored here
+ *
+ * Returns -ENOENT if @blist is empty.
+ */
+int blocknr_list_pop(struct list_head *blist, reiser4_block_nr *start,
+		     reiser4_block_nr *len)
+{
+	blocknr_list_entry *entry;
+
+	assert("", blist != NULL);
+
+	if (list_empty(blist))
+		return -ENOENT;
+	entry = blocknr_list_entry(blist->next);
+	*start = entry->start;
+	*len = entry->len;
+	list_del_init(&entry->link);
+	blocknr_list_entry_free(entry);
+	return 0;
+}
+
 int blocknr_list_add_extent(txn_atom *atom,
                             struct list_head *blist,
                             blocknr_list_entry **new_entry,
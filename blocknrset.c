@@ -9,6 +9,7 @@ reiser4/README */
 #include "txnmgr.h"
 #include "context.h"
 #include "super.h"
+#include "magazine.h"
 
 #include <linux/slab.h>
 
@@ -43,7 +44,7 @@ reiser4/README */
 	sizeof(struct list_head)) /		\
 	sizeof(reiser4_block_nr))
 
-static struct kmem_cache *blocknr_set_slab = NULL;
+static reiser4_mag_cache blocknr_set_cache;
 
 /* An entry of the blocknr_set */
 struct blocknr_set_entry {
@@ -85,8 +86,8 @@ static blocknr_set_entry *bse_alloc(void)
 {
 	blocknr_set_entry *e;
 
-	if ((e = (blocknr_set_entry *) kmem_cache_alloc(blocknr_set_slab,
-							reiser4_ctx_gfp_mask_get())) == NULL)
+	e = reiser4_mag_alloc(&blocknr_set_cache, reiser4_ctx_gfp_mask_get());
+	if (e == NULL)
 		return NULL;
 
 	bse_init(e);
@@ -98,7 +99,7 @@ static blocknr_set_entry *bse_alloc(void)
 /* Audited by: green(2002.06.11) */
 static void bse_free(blocknr_set_entry * bse)
 {
-	kmem_cache_free(blocknr_set_slab, bse);
+	reiser4_mag_free(&blocknr_set_cache, bse);
 }
 
 /* Add a block number to a blocknr_set_entry */
@@ -231,26 +232,18 @@ blocknr_set_add_pair(txn_atom * atom,
 /* Initialize slab cache of blocknr_set_entry objects. */
 int blocknr_set_init_static(void)
 {
-	assert("intelfx-55", blocknr_set_slab == NULL);
+	assert("intelfx-55", blocknr_set_cache.slab == NULL);
 
-	blocknr_set_slab = kmem_cache_create("blocknr_set_entry",
-					     sizeof(blocknr_set_entry),
-					     0,
-					     SLAB_HWCACHE_ALIGN |
-					     SLAB_RECLAIM_ACCOUNT,
-					     NULL);
-
-	if (blocknr_set_slab == NULL) {
-		return RETERR(-ENOMEM);
-	}
-
-	return 0;
+	return reiser4_init_mag_cache(&blocknr_set_cache, "blocknr_set_entry",
+				      sizeof(blocknr_set_entry),
+				      SLAB_HWCACHE_ALIGN |
+				      SLAB_RECLAIM_ACCOUNT);
 }
 
 /* Destroy slab cache of blocknr_set_entry objects. */
 void blocknr_set_done_static(void)
 {
-	destroy_reiser4_cache(&blocknr_set_slab);
+	reiser4_done_mag_cache(&blocknr_set_cache);
 }
 
 /* Initialize a blocknr_set. */
@@ -0,0 +1,308 @@
+/* Copyright 2001, 2002, 2003 by Hans Reiser, licensing governed by
+ * reiser4/README */
+
+/* Block number trees: sorted sets of block extents used by the atom to track
+   the delete set (when discard is off) and the wandered block mapping.
+
+   A blocknr tree is an rb-tree of non-overlapping extents ordered by start
+   block. An extent added next to (or over) an extent of the tree is
+   coalesced with it, so big deletes and long runs of wandered blocks take a
+   few entries. Adding an extent costs O(log n), fusion of atoms inserts
+   entries of the smaller tree into the larger one, and iteration goes in
+   the order of block numbers, which is the order dealloc_wmap() and the
+   block allocator like.
+
+   Entries of the wandered map carry the start of the run of wandered blocks
+   the extent is mapped to. Two such entries are coalesced only when both
+   runs are contiguous. Entries of the delete set have 0 there: block 0 is
+   never allocated, to the wandered map in particular.
+
+   Protection: blocknr trees belong to reiser4 atom, and their modifications
+   are performed with the atom lock held. */
+
+#include "debug.h"
+#include "dformat.h"
+#include "txnmgr.h"
+#include "context.h"
+#include "super.h"
+#include "magazine.h"
+
+#include <linux/rbtree.h>
+
+static reiser4_mag_cache blocknr_tree_cache;
+
+/* an extent of blocknr tree */
+struct blocknr_tree_entry {
+	struct rb_node node;
+	reiser4_block_nr start;
+	reiser4_block_nr len;
+	/* first block of the run @start is mapped to, 0 if not a mapping */
+	reiser4_block_nr target;
+};
+
+#define bte_entry(ptr) rb_entry(ptr, blocknr_tree_entry, node)
+
+static blocknr_tree_entry *bte_alloc(void)
+{
+	return reiser4_mag_alloc(&blocknr_tree_cache,
+				 reiser4_ctx_gfp_mask_get());
+}
+
+static void bte_free(blocknr_tree_entry *entry)
+{
+	reiser4_mag_free(&blocknr_tree_cache, entry);
+}
+
+static reiser4_block_nr bte_end(const blocknr_tree_entry *entry)
+{
+	return entry->start + entry->len;
+}
+
+/* true if extent [@start, @start + @len) with @target can be followed by an
+   extent starting at @next mapped to @next_target in one entry */
+static int bte_joins(reiser4_block_nr start, reiser4_block_nr len,
+		     reiser4_block_nr target, reiser4_block_nr next,
+		     reiser4_block_nr next_target)
+{
+	if (target == 0 && next_target == 0)
+		return next <= start + len;
+	/* mapped blocks are never added twice */
+	assert("", next >= start + len);
+	return next == start + len && next_target == target + len &&
+		target != 0 && next_target != 0;
+}
+
+/* coalesce entries following @entry into it while they join */
+static void bte_absorb_next(struct rb_root *root, blocknr_tree_entry *entry)
+{
+	struct rb_node *n;
+
+	while ((n = rb_next(&entry->node)) != NULL) {
+		blocknr_tree_entry *next = bte_entry(n);
+
+		if (!bte_joins(entry->start, entry->len, entry->target,
+			       next->start, next->target))
+			break;
+		entry->len = max(bte_end(entry), bte_end(next)) - entry->start;
+		rb_erase(n, root);
+		bte_free(next);
+	}
+}
+
+/* add extent to @root coalescing it with entries it joins. If new entry is
+   needed, *@new is linked into the tree and set to NULL. Returns 1 if new
+   entry is needed and *@new is NULL, 0 otherwise */
+static int blocknr_tree_add(struct rb_root *root, reiser4_block_nr start,
+			    reiser4_block_nr len, reiser4_block_nr target,
+			    blocknr_tree_entry **new)
+{
+	struct rb_node **p = &root->rb_node;
+	struct rb_node *parent = NULL;
+	struct rb_node *n;
+	blocknr_tree_entry *prev = NULL;
+	blocknr_tree_entry *next;
+
+	assert("", len > 0);
+
+	/* find the last entry starting not after @start */
+	while (*p != NULL) {
+		blocknr_tree_entry *entry = bte_entry(*p);
+
+		parent = *p;
+		if (start < entry->start)
+			p = &(*p)->rb_left;
+		else {
+			prev = entry;
+			p = &(*p)->rb_right;
+		}
+	}
+	if (prev != NULL &&
+	    bte_joins(prev->start, prev->len, prev->target, start, target)) {
+		prev->len = max(bte_end(prev), start + len) - prev->start;
+		bte_absorb_next(root, prev);
+		return 0;
+	}
+
+	n = (prev != NULL) ? rb_next(&prev->node) : rb_first(root);
+	next = (n != NULL) ? bte_entry(n) : NULL;
+	if (next != NULL &&
+	    bte_joins(start, len, target, next->start, next->target)) {
+		/* extend @next backward, its place in the tree is the same */
+		next->len = max(bte_end(next), start + len) - start;
+		next->start = start;
+		next->target = target;
+		bte_absorb_next(root, next);
+		return 0;
+	}
+
+	if (*new == NULL)
+		return 1;
+	(*new)->start = start;
+	(*new)->len = len;
+	(*new)->target = target;
+	rb_link_node(&(*new)->node, parent, p);
+	rb_insert_color(&(*new)->node, root);
+	*new = NULL;
+	return 0;
+}
+
+/* calling convention is that of blocknr_set_add(): if an entry has to be
+   allocated and *@new_entry is NULL, the atom is unlocked, new entry is
+   allocated to *@new_entry and -E_REPEAT is returned for the caller to try
+   again. Unused *@new_entry is freed */
+static int blocknr_tree_add_locked(txn_atom *atom, struct rb_root *root,
+				   blocknr_tree_entry **new_entry,
+				   reiser4_block_nr start,
+				   reiser4_block_nr len,
+				   reiser4_block_nr target)
+{
+	assert("", atom_is_protected(atom));
+
+	if (blocknr_tree_add(root, start, len, target, new_entry)) {
+		spin_unlock_atom(atom);
+		*new_entry = bte_alloc();
+		return (*new_entry != NULL) ? -E_REPEAT : RETERR(-ENOMEM);
+	}
+	if (*new_entry != NULL) {
+		bte_free(*new_entry);
+		*new_entry = NULL;
+	}
+	return 0;
+}
+
+/* add extent of deleted blocks to the tree */
+int blocknr_tree_add_extent(txn_atom *atom, struct rb_root *root,
+			    blocknr_tree_entry **new_entry,
+			    const reiser4_block_nr *start,
+			    const reiser4_block_nr *len)
+{
+	assert("", start != NULL && len != NULL && *len > 0);
+	assert("", *start != 0);
+	return blocknr_tree_add_locked(atom, root, new_entry, *start, *len, 0);
+}
+
+/* add mapping of block @a to block @b to the tree */
+int blocknr_tree_add_pair(txn_atom *atom, struct rb_root *root,
+			  blocknr_tree_entry **new_entry,
+			  const reiser4_block_nr *a, const reiser4_block_nr *b)
+{
+	assert("", a != NULL && b != NULL);
+	assert("", *b != 0);
+	return blocknr_tree_add_locked(atom, root, new_entry, *a, 1, *b);
+}
+
+/* Initialize slab cache of blocknr_tree_entry objects. */
+int blocknr_tree_init_static(void)
+{
+	assert("", blocknr_tree_cache.slab == NULL);
+
+	return reiser4_init_mag_cache(&blocknr_tree_cache, "blocknr_tree_entry",
+				      sizeof(blocknr_tree_entry),
+				      SLAB_HWCACHE_ALIGN |
+				      SLAB_RECLAIM_ACCOUNT);
+}
+
+/* Destroy slab cache of blocknr_tree_entry objects. */
+void blocknr_tree_done_static(void)
+{
+	reiser4_done_mag_cache(&blocknr_tree_cache);
+}
+
+/* Initialize a blocknr tree. */
+void blocknr_tree_init(struct rb_root *root)
+{
+	*root = RB_ROOT;
+}
+
+/* Release the entries of a blocknr tree. */
+void blocknr_tree_destroy(struct rb_root *root)
+{
+	blocknr_tree_entry *entry;
+	blocknr_tree_entry *tmp;
+
+	rbtree_postorder_for_each_entry_safe(entry, tmp, root, node)
+		bte_free(entry);
+	*root = RB_ROOT;
+}
+
+/* Move entries of @from into @into. Entries are relinked into @into, or
+   freed when they coalesce with extents of @into, so nothing is
+   allocated. */
+void blocknr_tree_merge(struct rb_root *from, struct rb_root *into)
+{
+	blocknr_tree_entry *entry;
+	blocknr_tree_entry *tmp;
+
+	if (RB_EMPTY_ROOT(into)) {
+		*into = *from;
+		*from = RB_ROOT;
+		return;
+	}
+	rbtree_postorder_for_each_entry_safe(entry, tmp, from, node) {
+		blocknr_tree_entry *new = entry;
+
+		blocknr_tree_add(into, entry->start, entry->len,
+				 entry->target, &new);
+		if (new != NULL)
+			bte_free(new);
+	}
+	*from = RB_ROOT;
+}
+
+/* Iterate over all extents of a blocknr tree in the order of block numbers.
+   @actor is called as by blocknr_set_iterator(): with the block and the
+   extent length, or NULL for single blocks, for deleted blocks; with the
+   block and the block it is mapped to for each block of mapped extents. */
+int blocknr_tree_iterator(txn_atom *atom, struct rb_root *root,
+			  blocknr_set_actor_f actor, void *data, int delete)
+{
+	struct rb_node *n;
+	struct rb_node *next_n;
+
+	assert("", atom != NULL);
+	assert("", atom_is_protected(atom));
+	assert("", root != NULL);
+	assert("", actor != NULL);
+
+	for (n = rb_first(root); n != NULL; n = next_n) {
+		blocknr_tree_entry *entry = bte_entry(n);
+		int ret = 0;
+
+		next_n = rb_next(n);
+		if (entry->target == 0)
+			ret = actor(atom, &entry->start,
+				    entry->len == 1 ? NULL : &entry->len,
+				    data);
+		else {
+			reiser4_block_nr i;
+
+			for (i = 0; i < entry->len; i++) {
+				reiser4_block_nr a = entry->start + i;
+				reiser4_block_nr b = entry->target + i;
+
+				ret = actor(atom, &a, &b, data);
+				if (ret != 0 && !delete)
+					break;
+			}
+		}
+		/* We can't break a loop if delete flag is set. */
+		if (ret != 0 && !delete)
+			return ret;
+		if (delete) {
+			rb_erase(n, root);
+			bte_free(entry);
+		}
+	}
+	return 0;
+}
+
+/*
+ * Local variables:
+ * c-indentation-style: "K&R"
+ * mode-name: "LC"
+ * c-basic-offset: 8
+ * tab-width: 8
+ * fill-column: 79
+ * scroll-step: 1
+ * End:
+ */
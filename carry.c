@@ -147,6 +147,7 @@ exists, but.... -Hans
 #include "carry_ops.h"
 #include "super.h"
 #include "reiser4.h"
+#include "magazine.h"
 
 #include <linux/types.h>
 
@@ -201,11 +202,25 @@ int reiser4_carry(carry_level * doing /* set of carry operations to be
 	gfp_t old_mask;
 	/* queue of new requests */
 	carry_level *todo;
+	reiser4_tree *tree;
+	reiser4_block_nr consumed;
+	estimate_class class = ESTIMATE_INSERT;
+	tree_level height;
 	ON_DEBUG(STORE_COUNTERS);
 
 	assert("nikita-888", doing != NULL);
 	BUG_ON(done != NULL);
 
+	/* remember what was spent so far to calibrate estimates, see
+	   "CALIBRATED ESTIMATES" in estimate.c */
+	tree = current_tree;
+	height = tree->height;
+	consumed = get_current_context()->grabbed_consumed;
+	if (doing->ops_num > 0 &&
+	    list_entry(doing->ops.next, carry_op,
+		       header.level_linkage)->op == COP_INSERT_FLOW)
+		class = ESTIMATE_FLOW;
+
 	todo = doing + 1;
 	init_carry_level(todo, doing->pool);
 
@@ -266,6 +281,12 @@ int reiser4_carry(carry_level * doing /* set of carry operations to be
 				return result;
 			}
 			unlock_carry_level(doing, 1);
+			reiser4_stat_inc(tree->super,
+					 REISER4_STAT_CARRY_RESTARTS);
+			/* all locks of the level are released now: let
+			   the thread which made locking fail finish its
+			   balancing instead of racing it again at once */
+			reiser4_preempt_point();
 		}
 		/* at this point @done can be safely unlocked */
 		done_carry_level(done);
@@ -282,6 +303,9 @@ int reiser4_carry(carry_level * doing /* set of carry operations to be
 	}
 	get_current_context()->gfp_mask = old_mask;
 	done_carry_level(done);
+	if (result == 0)
+		reiser4_estimate_account(tree, class, height,
+			get_current_context()->grabbed_consumed - consumed);
 
 	/* all counters, but x_refs should remain the same. x_refs can change
 	   owing to transaction manager */
@@ -445,15 +469,49 @@ void init_carry_level(carry_level * level /* level to initialize */ ,
 	INIT_LIST_HEAD(&level->ops);
 }
 
+/* carry pools of common sizes, they are allocated for each balancing */
+static reiser4_mag_cache carry_pool_cache;
+
+#define CARRY_POOL_CACHE_SIZE					\
+	(sizeof(carry_pool) + 3 * sizeof(carry_level) +		\
+	 CARRY_POOL_EXTRA_SIZE)
+
+/**
+ * init_carry_pools - create carry pool cache
+ *
+ * It is part of reiser4 module initialization.
+ */
+int init_carry_pools(void)
+{
+	return reiser4_init_mag_cache(&carry_pool_cache, "carry_pool",
+				      CARRY_POOL_CACHE_SIZE, 0);
+}
+
+/**
+ * done_carry_pools - delete carry pool cache
+ *
+ * This is called on reiser4 module unloading or system shutdown.
+ */
+void done_carry_pools(void)
+{
+	reiser4_done_mag_cache(&carry_pool_cache);
+}
+
 /* allocate carry pool and initialize pools within queue */
 carry_pool *init_carry_pool(int size)
 {
 	carry_pool *pool;
+	int kmalloced = size > CARRY_POOL_CACHE_SIZE;
 
 	assert("", size >= sizeof(carry_pool) + 3 * sizeof(carry_level));
-	pool = kmalloc(size, reiser4_ctx_gfp_mask_get());
+	if (kmalloced)
+		pool = kmalloc(size, reiser4_ctx_gfp_mask_get());
+	else
+		pool = reiser4_mag_alloc(&carry_pool_cache,
+					 reiser4_ctx_gfp_mask_get());
 	if (pool == NULL)
 		return ERR_PTR(RETERR(-ENOMEM));
+	pool->kmalloced = kmalloced;
 
 	reiser4_init_pool(&pool->op_pool, sizeof(carry_op), CARRIES_POOL_SIZE,
 			  (char *)pool->op);
@@ -467,7 +525,10 @@ void done_carry_pool(carry_pool * pool/* pool to destroy */)
 {
 	reiser4_done_pool(&pool->op_pool);
 	reiser4_done_pool(&pool->node_pool);
-	kfree(pool);
+	if (pool->kmalloced)
+		kfree(pool);
+	else
+		reiser4_mag_free(&carry_pool_cache, pool);
 }
 
 /* add new carry node to the @level.
@@ -715,7 +776,13 @@ carry_op *node_post_carry(carry_plugin_info * info	/* carry parameters
 	return result;
 }
 
-/* lock all carry nodes in @level */
+/* lock all carry nodes in @level.
+
+   Carry nodes of a level are kept in the order of their nodes in the tree,
+   so nodes are locked left to right, with high priority write locks, which
+   is the canonical order of long term locks. On -E_REPEAT reiser4_carry()
+   releases the whole level and tries it again, such restarts are counted in
+   REISER4_STAT_CARRY_RESTARTS. */
 static int lock_carry_level(carry_level * level/* level to lock */)
 {
 	int result;
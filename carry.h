@@ -293,6 +293,8 @@ typedef struct carry_pool {
 	struct reiser4_pool op_pool;
 	carry_node node[NODES_LOCKED_POOL_SIZE];
 	struct reiser4_pool node_pool;
+	/* allocated by kmalloc(), rather than from carry pool cache */
+	int kmalloced;
 } carry_pool;
 
 /* &carry_tree_level - carry process on given level
@@ -344,6 +346,8 @@ extern carry_node *insert_carry_node(carry_level * doing,
 
 extern carry_pool *init_carry_pool(int);
 extern void done_carry_pool(carry_pool * pool);
+extern int init_carry_pools(void);
+extern void done_carry_pools(void);
 
 extern void init_carry_level(carry_level * level, carry_pool * pool);
 
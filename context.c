@@ -41,6 +41,47 @@
 
 #include <linux/writeback.h> /* for current_is_pdflush() */
 #include <linux/hardirq.h>
+#include <linux/percpu.h>
+
+/* most recently released context of each cpu is kept for the next
+ * reiser4_init_context() on that cpu, so that short system calls do not
+ * allocate and free contexts */
+static DEFINE_PER_CPU(reiser4_context *, context_cache);
+
+static reiser4_context *context_alloc(void)
+{
+	reiser4_context *context;
+
+	context = this_cpu_xchg(context_cache, NULL);
+	if (context != NULL)
+		return context;
+	return kmalloc(sizeof(*context), GFP_KERNEL);
+}
+
+/* keep @context for reuse, free the one kept before */
+static void context_free(reiser4_context *context)
+{
+	assert("", lock_stack_isclean(&context->stack));
+	assert("", context->trans == NULL);
+
+	kfree(this_cpu_xchg(context_cache, context));
+}
+
+/**
+ * reiser4_done_context_cache - free contexts kept for reuse
+ *
+ * This is called on reiser4 module unloading, after all file systems are
+ * unmounted.
+ */
+void reiser4_done_context_cache(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		kfree(per_cpu(context_cache, cpu));
+		per_cpu(context_cache, cpu) = NULL;
+	}
+}
 
 static void _reiser4_init_context(reiser4_context * context,
 				  struct super_block *super)
@@ -86,7 +127,7 @@ reiser4_context * reiser4_init_context(struct super_block *super)
 		return context;
 	}
 
-	context = kmalloc(sizeof(*context), GFP_KERNEL);
+	context = context_alloc();
 	if (context == NULL)
 		return ERR_PTR(RETERR(-ENOMEM));
 
@@ -209,7 +250,7 @@ static void reiser4_done_context(reiser4_context * context)
 		/* restore original ->fs_context value */
 		current->journal_info = context->outer;
 		if (context->on_stack == 0)
-			kfree(context);
+			context_free(context);
 	} else {
 		context->nr_children--;
 #if REISER4_DEBUG
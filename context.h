@@ -42,6 +42,9 @@ struct reiser4_context {
 
 	/* per-thread grabbed (for further allocation) blocks counter */
 	reiser4_block_nr grabbed_blocks;
+	/* grabbed blocks spent on new and dirtied formatted nodes, for
+	 * calibration of estimates (see estimate.c) */
+	reiser4_block_nr grabbed_consumed;
 
 	/* list of taps currently monitored. See tap.c */
 	struct list_head taps;
@@ -64,9 +67,20 @@ struct reiser4_context {
 	unsigned int on_stack:1;
 	/* file system is read-only */
 	unsigned int ro:1;
+	/* set by reiser4_writeback_inodes(): note files written back, see
+	   reiser4_writeback_note() */
+	unsigned int writeback:1;
 
 	/* count non-trivial jnode_set_dirty() calls */
 	unsigned long nr_marked_dirty;
+	/* value of ->nr_marked_dirty at the last reiser4_throttle_write() */
+	unsigned long nr_throttled;
+	/* captured jnodes of files written back by reiser4_writeback_inodes(),
+	   referenced. reiser4_writeout() starts flushes from them, in order,
+	   from ->wb_next on */
+	jnode *wb_start[REISER4_WB_STARTS];
+	int nr_wb_starts;
+	int wb_next;
 	/*
 	 * reiser4_writeback_inodes calls (via generic_writeback_sb_inodes)
 	 * reiser4_writepages_dispatch for each of dirty inodes.
@@ -75,6 +89,10 @@ struct reiser4_context {
 	 * some atoms get flushed
 	 */
 	int nr_captured;
+	/* write-back request ent thread is serving, see entd_flush() */
+	struct wbq *entd_request;
+	/* phases of fsync this thread is doing, see reiser4_fsync_lat_begin() */
+	struct txnmgr_fsync_lat *fsync_lat;
 	int nr_children;	/* number of child contexts */
 	struct page *locked_page; /* page that should be unlocked in
 				   * reiser4_dirty_inode() before taking
@@ -116,6 +134,7 @@ extern void print_contexts(void);
 extern reiser4_context *reiser4_init_context(struct super_block *);
 extern void init_stack_context(reiser4_context *, struct super_block *);
 extern void reiser4_exit_context(reiser4_context *);
+extern void reiser4_done_context_cache(void);
 
 /* magic constant we store in reiser4_context allocated at the stack. Used to
    catch accesses to staled or uninitialized contexts. */
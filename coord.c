@@ -6,6 +6,7 @@
 #include "dformat.h"
 #include "tree.h"
 #include "plugin/item/item.h"
+#include "plugin/item/extent.h"
 #include "znode.h"
 #include "coord.h"
 
@@ -175,7 +176,10 @@ unsigned coord_num_units(const coord_t *coord)
 {
 	assert("jmacd-9806", coord_is_existing_item(coord));
 
-	return item_plugin_by_coord(coord)->b.nr_units(coord);
+	/* items of extents and single unit items are most common, see
+	   NODE_CALL() */
+	return INDIRECT_CALL_2(item_plugin_by_coord(coord)->b.nr_units,
+			       nr_units_extent, nr_units_single_unit, coord);
 }
 
 /* Returns true if the coord was initializewd by coord_init_invalid (). */
@@ -0,0 +1,470 @@
+/* Copyright 2001, 2002, 2003, 2004 by Hans Reiser, licensing governed by
+ * reiser4/README */
+
+/* Background defragmenter.
+
+   Flush relocates only dirty blocks (see forward_try_defragment_locality()
+   and reverse_try_defragment_if_close() in plugin/txmod.c), so a file which
+   is read often but rarely rewritten keeps its original layout forever.
+
+   When enabled by the defrag.budget mount option, the defragmenter thread
+   wakes up every defrag.interval seconds and, if the file system is idle
+   (no atoms, no flush writes in flight), looks at regular files with cached
+   pages. A file whose cached pages map to runs of adjacent blocks shorter
+   than REISER4_DEFRAG_MIN_EXTENT on average is considered fragmented. Its
+   clean up-to-date pages are captured, marked dirty and tagged with
+   JNODE_REPACK, which makes flush relocate the slum (see
+   flush_pos->leaf_relocate in jnode_flush()). No more than defrag.budget
+   pages are dirtied per pass, and nothing is forced to commit: the atom is
+   committed by ktxnmgrd when it gets old, like any other.
+
+   Only pages which are in memory anyway are touched, so the defragmenter
+   itself never reads from disk.
+
+   REISER4_IOC_DEFRAG ioctl (see ioctl.h) does the same for a given range of
+   a given file, whatever its pages cached are: reiser4_defrag_file() reads
+   the range in, captures its clean pages REISER4_DEFRAG_IOC_BATCH at a time
+   and forces commit of the atom after each batch.
+*/
+
+#include "debug.h"
+#include "txnmgr.h"
+#include "jnode.h"
+#include "block_alloc.h"
+#include "context.h"
+#include "inode.h"
+#include "super.h"
+#include "defrag.h"
+#include "reiser4.h"
+#include "ioctl.h"
+#include "tree_walk.h"
+#include "plugin/item/extent.h"
+#include "plugin/object.h"
+#include "plugin/file/file.h"
+
+#include <linux/kthread.h>
+#include <linux/freezer.h>
+#include <linux/pagemap.h>
+
+#define DEFRAG_BATCH 16
+
+/* return block @page is mapped to, 0 if there is none yet or @page is busy */
+static reiser4_block_nr defrag_page_block(struct page *page,
+					  struct address_space *mapping)
+{
+	reiser4_block_nr blk = 0;
+
+	if (!trylock_page(page))
+		return 0;
+	if (page->mapping == mapping && PagePrivate(page)) {
+		blk = *jnode_get_block(jprivate(page));
+		if (reiser4_blocknr_is_fake(&blk))
+			blk = 0;
+	}
+	unlock_page(page);
+	return blk;
+}
+
+/* count cached pages of @mapping with allocated blocks and the number of
+   runs of adjacent blocks they form */
+static void defrag_measure(struct address_space *mapping,
+			   unsigned long *nr_pages, unsigned long *nr_runs)
+{
+	struct page *pages[DEFRAG_BATCH];
+	reiser4_block_nr prev_blk = 0;
+	pgoff_t prev_index = 0;
+	pgoff_t index = 0;
+	unsigned found;
+	unsigned i;
+
+	*nr_pages = 0;
+	*nr_runs = 0;
+	while ((found = find_get_pages(mapping, &index, DEFRAG_BATCH,
+				       pages)) != 0) {
+		for (i = 0; i < found; i++) {
+			reiser4_block_nr blk;
+
+			blk = defrag_page_block(pages[i], mapping);
+			if (blk != 0) {
+				if (*nr_pages == 0 ||
+				    pages[i]->index != prev_index + 1 ||
+				    blk != prev_blk + 1)
+					(*nr_runs)++;
+				(*nr_pages)++;
+			}
+			prev_blk = blk;
+			prev_index = pages[i]->index;
+			put_page(pages[i]);
+		}
+		cond_resched();
+	}
+}
+
+/* capture clean page @page of @mapping for relocation. Returns true if the
+   page was captured */
+static int defrag_capture_page(struct page *page,
+			       struct address_space *mapping)
+{
+	jnode *node;
+	int ret;
+
+	if (!trylock_page(page))
+		return 0;
+	if (page->mapping != mapping || !PagePrivate(page) ||
+	    !PageUptodate(page) || PageDirty(page) || PageWriteback(page)) {
+		unlock_page(page);
+		return 0;
+	}
+	node = jref(jprivate(page));
+	if (*jnode_get_block(node) == 0 ||
+	    reiser4_blocknr_is_fake(jnode_get_block(node)) ||
+	    node->atom != NULL) {
+		unlock_page(page);
+		jput(node);
+		return 0;
+	}
+	JF_SET(node, JNODE_WRITE_PREPARED);
+	set_page_dirty_notag(page);
+	unlock_page(page);
+
+	spin_lock_jnode(node);
+	ret = reiser4_try_capture(node, ZNODE_WRITE_LOCK, 0);
+	if (ret == 0) {
+		JF_SET(node, JNODE_REPACK);
+		jnode_make_dirty_locked(node);
+	}
+	spin_unlock_jnode(node);
+	if (ret != 0) {
+		/* do not leave a dirty page nobody is going to write */
+		lock_page(page);
+		cancel_dirty_page(page);
+		unlock_page(page);
+	}
+	JF_CLR(node, JNODE_WRITE_PREPARED);
+	jput(node);
+	return ret == 0;
+}
+
+/* queue up to @budget pages of @inode for relocation if the file is
+   fragmented. Returns the number of queued pages */
+static unsigned defrag_inode(struct inode *inode, unsigned budget)
+{
+	struct address_space *mapping = inode->i_mapping;
+	struct unix_file_info *uf_info;
+	struct page *pages[DEFRAG_BATCH];
+	unsigned long nr_pages;
+	unsigned long nr_runs;
+	unsigned done = 0;
+	pgoff_t index = 0;
+	unsigned found;
+	unsigned i;
+
+	if (inode_file_plugin(inode)->h.id != UNIX_FILE_PLUGIN_ID)
+		return 0;
+	uf_info = unix_file_inode_data(inode);
+	/* do not compete with writers */
+	if (!try_to_get_nonexclusive_access(uf_info))
+		return 0;
+	if (uf_info->container != UF_CONTAINER_EXTENTS)
+		goto out;
+
+	defrag_measure(mapping, &nr_pages, &nr_runs);
+	if (nr_pages < REISER4_DEFRAG_MIN_EXTENT ||
+	    nr_pages >= nr_runs * REISER4_DEFRAG_MIN_EXTENT)
+		goto out;
+
+	if (budget > nr_pages)
+		budget = nr_pages;
+	/* one block of flush reserve for each dirtied page, see
+	   do_jnode_make_dirty() */
+	grab_space_enable();
+	if (reiser4_grab_space(budget, BA_CAN_COMMIT))
+		goto out;
+
+	while (done < budget &&
+	       (found = find_get_pages(mapping, &index, DEFRAG_BATCH,
+				       pages)) != 0) {
+		for (i = 0; i < found; i++) {
+			if (done < budget &&
+			    defrag_capture_page(pages[i], mapping))
+				done++;
+			put_page(pages[i]);
+		}
+		cond_resched();
+	}
+	all_grabbed2free();
+ out:
+	drop_nonexclusive_access(uf_info);
+	return done;
+}
+
+/* state of counting runs of blocks of a file range */
+struct defrag_count {
+	struct inode *inode;
+	/* end of the range, in bytes */
+	loff_t end;
+	reiser4_block_nr run_end;
+	__u64 runs;
+	/* units visited */
+	unsigned long units;
+};
+
+/* tree_iterate_actor_t called for each extent unit of the file */
+static int defrag_count_actor(reiser4_tree *tree, coord_t *coord,
+			      lock_handle *lh, void *arg)
+{
+	struct defrag_count *c = arg;
+	reiser4_extent *ext;
+	reiser4_key key;
+
+	unit_key_by_coord(coord, &key);
+	if (!item_is_extent(coord) ||
+	    get_key_objectid(&key) != get_inode_oid(c->inode)) {
+		/* lookup can stop at the item before the first extent */
+		return c->units++ == 0;
+	}
+	if (get_key_offset(&key) >= c->end)
+		return 0;
+	c->units++;
+	ext = extent_by_coord(coord);
+	if (state_of_extent(ext) == ALLOCATED_EXTENT) {
+		if (c->runs == 0 || extent_get_start(ext) != c->run_end)
+			c->runs++;
+		c->run_end = extent_get_start(ext) + extent_get_width(ext);
+	}
+	return 1;
+}
+
+/* number of runs of physically contiguous blocks bytes [@start, @end) of
+   @inode are stored in */
+static __u64 defrag_count_runs(struct inode *inode, loff_t start, loff_t end)
+{
+	reiser4_tree *tree = reiser4_tree_by_inode(inode);
+	struct defrag_count c = { .inode = inode, .end = end };
+	reiser4_key key;
+	coord_t coord;
+	lock_handle lh;
+	int result;
+
+	if (tree->height < TWIG_LEVEL)
+		return 0;
+	key_by_inode_and_offset_common(inode, start, &key);
+	init_lh(&lh);
+	result = coord_by_key(tree, &key, &coord, &lh, ZNODE_READ_LOCK,
+			      FIND_MAX_NOT_MORE_THAN, TWIG_LEVEL, TWIG_LEVEL,
+			      CBK_UNIQUE, NULL);
+	if (result == CBK_COORD_FOUND)
+		reiser4_iterate_tree(tree, &coord, &lh, defrag_count_actor,
+				     &c, ZNODE_READ_LOCK, 1);
+	done_lh(&lh);
+	return c.runs;
+}
+
+/* commit the atom of the current transaction handle, if there is one */
+static void defrag_commit(void)
+{
+	txn_handle *txnh = get_current_context()->trans;
+	txn_atom *atom;
+
+	atom = get_current_atom_locked_nocheck();
+	if (atom == NULL)
+		return;
+	spin_lock_txnh(txnh);
+	force_commit_atom(txnh);
+}
+
+/**
+ * reiser4_defrag_file - relocate range of file to contiguous blocks
+ * @inode: regular file
+ * @range: range to defragment, see REISER4_IOC_DEFRAG in ioctl.h
+ *
+ * Pages of the range are read and captured into the atom of the calling
+ * thread with JNODE_REPACK set, and the atom is forced to commit every
+ * REISER4_DEFRAG_IOC_BATCH pages, so that flush relocates them.
+ */
+int reiser4_defrag_file(struct inode *inode, struct reiser4_defrag_range *range)
+{
+	struct address_space *mapping = inode->i_mapping;
+	struct unix_file_info *uf_info;
+	loff_t start = range->start;
+	loff_t end;
+	pgoff_t index;
+	pgoff_t last;
+	int result = 0;
+
+	if (inode_file_plugin(inode)->h.id != UNIX_FILE_PLUGIN_ID)
+		return RETERR(-EOPNOTSUPP);
+	if (range->start > i_size_read(inode))
+		return RETERR(-EINVAL);
+	end = i_size_read(inode);
+	if (range->len != 0 && range->len < end - start)
+		end = start + range->len;
+
+	uf_info = unix_file_inode_data(inode);
+	get_nonexclusive_access(uf_info);
+	range->extents_before = range->extents_after = 0;
+	if (uf_info->container != UF_CONTAINER_EXTENTS || start == end)
+		goto out;
+
+	range->extents_before = defrag_count_runs(inode, start, end);
+	index = start >> PAGE_SHIFT;
+	last = (end - 1) >> PAGE_SHIFT;
+	while (index <= last && result == 0) {
+		pgoff_t batch_end = min_t(pgoff_t, last + 1,
+					  index + REISER4_DEFRAG_IOC_BATCH);
+		unsigned captured = 0;
+
+		/* one block of flush reserve for each dirtied page */
+		grab_space_enable();
+		result = reiser4_grab_space(batch_end - index, BA_CAN_COMMIT);
+		if (result)
+			break;
+		for (; index < batch_end; index++) {
+			struct page *page;
+
+			page = read_mapping_page(mapping, index, NULL);
+			if (IS_ERR(page)) {
+				result = PTR_ERR(page);
+				break;
+			}
+			captured += defrag_capture_page(page, mapping);
+			put_page(page);
+			if (fatal_signal_pending(current)) {
+				result = RETERR(-EINTR);
+				break;
+			}
+		}
+		all_grabbed2free();
+		atomic_add(captured,
+			   &get_super_private(inode->i_sb)->defrag.nr_relocated);
+		if (captured != 0)
+			defrag_commit();
+	}
+	range->extents_after = defrag_count_runs(inode, start, end);
+ out:
+	drop_nonexclusive_access(uf_info);
+	return result;
+}
+
+/* file system is writable, nothing is being committed or written by flush */
+static int defrag_fs_idle(struct super_block *super)
+{
+	reiser4_super_info_data *sbinfo = get_super_private(super);
+
+	return !sb_rdonly(super) &&
+		READ_ONCE(sbinfo->tmgr.atom_count) == 0 &&
+		atomic_read(&sbinfo->flush_cong.inflight) == 0;
+}
+
+static void defrag_pass(struct super_block *super, unsigned budget)
+{
+	struct inode *inode;
+	struct inode *toput = NULL;
+
+	spin_lock(&super->s_inode_list_lock);
+	list_for_each_entry(inode, &super->s_inodes, i_sb_list) {
+		reiser4_context ctx;
+		unsigned done;
+
+		spin_lock(&inode->i_lock);
+		if ((inode->i_state & (I_FREEING | I_WILL_FREE | I_NEW)) ||
+		    !S_ISREG(inode->i_mode) || inode->i_mapping->nrpages == 0) {
+			spin_unlock(&inode->i_lock);
+			continue;
+		}
+		__iget(inode);
+		spin_unlock(&inode->i_lock);
+		spin_unlock(&super->s_inode_list_lock);
+
+		iput(toput);
+		toput = inode;
+
+		init_stack_context(&ctx, super);
+		done = defrag_inode(inode, budget);
+		reiser4_exit_context(&ctx);
+
+		atomic_add(done,
+			   &get_super_private(super)->defrag.nr_relocated);
+		budget -= done;
+		cond_resched();
+		spin_lock(&super->s_inode_list_lock);
+		if (budget == 0 || kthread_should_stop())
+			break;
+	}
+	spin_unlock(&super->s_inode_list_lock);
+	iput(toput);
+}
+
+static int defragd(void *arg)
+{
+	struct super_block *super = arg;
+	defrag_context *ctx = &get_super_private(super)->defrag;
+
+	set_freezable();
+	current->journal_info = NULL;
+	while (!kthread_should_stop()) {
+		schedule_timeout_interruptible(READ_ONCE(ctx->interval) * HZ);
+		try_to_freeze();
+		if (kthread_should_stop())
+			break;
+		if (!defrag_fs_idle(super) || !sb_start_write_trylock(super))
+			continue;
+		defrag_pass(super, READ_ONCE(ctx->budget));
+		sb_end_write(super);
+	}
+	return 0;
+}
+
+/**
+ * reiser4_init_defrag - start defragmenter thread
+ * @super: super block to start defragmenter for
+ *
+ * This is called on mount. Nothing is started if defragmenter is disabled or
+ * file system is read-only.
+ */
+int reiser4_init_defrag(struct super_block *super)
+{
+	defrag_context *ctx = &get_super_private(super)->defrag;
+
+	assert("", ctx->tsk == NULL);
+
+	if (ctx->budget == 0 || sb_rdonly(super))
+		return 0;
+	if (ctx->interval == 0)
+		ctx->interval = 1;
+	ctx->tsk = kthread_run(defragd, super, "defrag:%s", super->s_id);
+	if (IS_ERR(ctx->tsk)) {
+		int ret = PTR_ERR(ctx->tsk);
+
+		ctx->tsk = NULL;
+		return RETERR(ret);
+	}
+	return 0;
+}
+
+/**
+ * reiser4_done_defrag - stop defragmenter thread
+ * @super: super block to stop defragmenter of
+ *
+ * This is called on umount, before inodes are evicted, because the thread
+ * holds inode references.
+ */
+void reiser4_done_defrag(struct super_block *super)
+{
+	defrag_context *ctx = &get_super_private(super)->defrag;
+
+	if (ctx->tsk != NULL) {
+		kthread_stop(ctx->tsk);
+		ctx->tsk = NULL;
+	}
+}
+
+/* Make Linus happy.
+   Local variables:
+   c-indentation-style: "K&R"
+   mode-name: "LC"
+   c-basic-offset: 8
+   tab-width: 8
+   fill-column: 120
+   End:
+*/
@@ -0,0 +1,41 @@
+/* Copyright 2001, 2002, 2003, 2004 by Hans Reiser, licensing governed by
+ * reiser4/README */
+
+/* Background defragmenter. See defrag.c for comments. */
+
+#ifndef __REISER4_DEFRAG_H__
+#define __REISER4_DEFRAG_H__
+
+#include <linux/fs.h>
+#include <linux/sched.h>	/* for struct task_struct */
+
+typedef struct defrag_context {
+	/* defragmenter thread, NULL if it is not running */
+	struct task_struct *tsk;
+	/* number of pages the defragmenter may dirty per pass, 0 disables
+	   it. Set by the defrag.budget mount option */
+	unsigned budget;
+	/* seconds between passes. Set by the defrag.interval mount option */
+	unsigned interval;
+	/* number of pages queued for relocation so far */
+	atomic_t nr_relocated;
+} defrag_context;
+
+extern int reiser4_init_defrag(struct super_block *);
+extern void reiser4_done_defrag(struct super_block *);
+
+struct reiser4_defrag_range;
+extern int reiser4_defrag_file(struct inode *, struct reiser4_defrag_range *);
+
+/* __REISER4_DEFRAG_H__ */
+#endif
+
+/* Make Linus happy.
+   Local variables:
+   c-indentation-style: "K&R"
+   mode-name: "LC"
+   c-basic-offset: 8
+   tab-width: 8
+   fill-column: 120
+   End:
+*/
@@ -58,16 +58,20 @@
  * any data. Thus we can avoid any checks for blocks directly present in the
  * discard set.
  *
- * For now, we don't perform "padding" of extents to erase unit boundaries.
- * This means if extents are not aligned with the device's erase unit lattice,
- * the partial erase units at head and tail of extents are truncated by kernel
- * (in blkdev_issue_discard()).
+ * Discard requests are not issued from the commit path. At commit time the
+ * delete set of the atom is moved to a per-super-block queue, and the blocks
+ * of queued extents stay allocated. A worker running every
+ * REISER4_DISCARD_DELAY jiffies:
+ * - sorts the queued extents, joining adjacent and overlapping ones, so
+ *   that extents freed by different atoms are merged;
+ * - cuts partial erase units off head and tail of each extent, as the device
+ *   would ignore them anyway;
+ * - issues up to REISER4_DISCARD_BATCH blocks of discards, leaving the rest
+ *   queued for its next run;
+ * - only then deallocates the extents (reiser4_free_discarded()), so blocks
+ *   cannot be reused before their discard is issued.
  *
- * So, at commit time the following actions take place:
- * - delete sets are merged to form the discard set;
- * - elements of the discard set are sorted;
- * - the discard set is iterated, joining any adjacent extents;
- * - for each extent, a single call to blkdev_issue_discard() is done.
+ * On umount the queue is drained synchronously, see reiser4_done_discard().
  */
 
 #include "discard.h"
@@ -80,91 +84,186 @@
 #include <linux/fs.h>
 #include <linux/blkdev.h>
 
-static int __discard_extent(struct block_device *bdev, sector_t start,
-                            sector_t len)
+/**
+ * reiser4_discard_extent - discard erase units of a block extent
+ * @sb: super block
+ * @start: first block of the extent
+ * @len: length of the extent
+ *
+ * Partial erase units at head and tail of the extent are not discarded.
+ */
+int reiser4_discard_extent(struct super_block *sb, reiser4_block_nr start,
+			   reiser4_block_nr len)
 {
+	struct block_device *bdev = sb->s_bdev;
+	struct request_queue *q = bdev_get_queue(bdev);
+	const int sec_per_blk = sb->s_blocksize >> 9;
+	sector_t gran;
+	sector_t align;
+	sector_t first;
+	sector_t end;
+	sector_t tmp;
+
 	assert("intelfx-21", bdev != NULL);
+	/* we assume block = N * sector */
+	assert("intelfx-7", sec_per_blk > 0);
+
+	gran = max(q->limits.discard_granularity >> 9, 1u);
+	align = bdev_discard_alignment(bdev) >> 9;
+	align = sector_div(align, gran);
 
-	return blkdev_issue_discard(bdev, start, len, reiser4_ctx_gfp_mask_get(),
-	                            0);
+	/* convert extent to sectors and round it to the erase unit lattice */
+	first = start * sec_per_blk;
+	end = first + len * sec_per_blk;
+	tmp = first + gran - align;
+	tmp = sector_div(tmp, gran);
+	if (tmp != 0)
+		first += gran - tmp;
+	tmp = end + gran - align;
+	end -= sector_div(tmp, gran);
+	if (end <= first)
+		return 0;
+
+	return blkdev_issue_discard(bdev, first, end - first, GFP_NOFS, 0);
 }
 
-static int discard_extent(txn_atom *atom UNUSED_ARG,
-                          const reiser4_block_nr* start,
-                          const reiser4_block_nr* len,
-                          void *data UNUSED_ARG)
+/* discard and deallocate up to @budget blocks of queued extents */
+static void discard_pending(struct super_block *super, __u64 budget)
 {
-	struct super_block *sb = reiser4_get_current_sb();
-	struct block_device *bdev = sb->s_bdev;
+	struct reiser4_discard_queue *q = &get_super_private(super)->discard;
+	struct list_head batch;
+	reiser4_block_nr start;
+	reiser4_block_nr len;
+	int ret = 0;
 
-	sector_t extent_start_sec, extent_len_sec;
+	blocknr_list_init(&batch);
+	spin_lock(&q->guard);
+	blocknr_list_merge(&q->pending, &batch);
+	spin_unlock(&q->guard);
+	if (list_empty(&batch))
+		return;
 
-	const int sec_per_blk = sb->s_blocksize >> 9;
+	blocknr_list_sort_and_join(&batch);
+	while (budget != 0 && blocknr_list_pop(&batch, &start, &len) == 0) {
+		/* on error, keep deallocating without discarding */
+		if (ret == 0)
+			ret = reiser4_discard_extent(super, start, len);
+		reiser4_free_discarded(start, len);
+		budget -= min(budget, len);
+		cond_resched();
+	}
+	if (ret != 0)
+		warning("intelfx-8", "discard failed (%d)", ret);
 
-	/* we assume block = N * sector */
-	assert("intelfx-7", sec_per_blk > 0);
+	if (!list_empty(&batch)) {
+		spin_lock(&q->guard);
+		blocknr_list_merge(&batch, &q->pending);
+		spin_unlock(&q->guard);
+	}
+}
+
+static void discard_worker(struct work_struct *work)
+{
+	struct reiser4_discard_queue *q;
+	reiser4_context ctx;
 
-	/* convert extent to sectors */
-	extent_start_sec = *start * sec_per_blk;
-	extent_len_sec = *len * sec_per_blk;
+	q = container_of(to_delayed_work(work), struct reiser4_discard_queue,
+			 work);
+	init_stack_context(&ctx, q->super);
+	discard_pending(q->super, REISER4_DISCARD_BATCH);
+	reiser4_exit_context(&ctx);
 
-	/* discard the extent, don't pad it to erase unit boundaries for now */
-	return __discard_extent(bdev, extent_start_sec, extent_len_sec);
+	spin_lock(&q->guard);
+	if (!list_empty(&q->pending))
+		schedule_delayed_work(&q->work, REISER4_DISCARD_DELAY);
+	spin_unlock(&q->guard);
 }
 
-int discard_atom(txn_atom *atom, struct list_head *processed_set)
+void discard_atom(txn_atom *atom)
 {
-	int ret;
-	struct list_head discard_set;
-
-	if (!reiser4_is_set(reiser4_get_current_sb(), REISER4_DISCARD)) {
-		spin_unlock_atom(atom);
-		return 0;
-	}
+	struct reiser4_discard_queue *q;
 
 	assert("intelfx-28", atom != NULL);
-	assert("intelfx-59", processed_set != NULL);
 
-	if (list_empty(&atom->discard.delete_set)) {
-		/* Nothing left to discard. */
+	if (!reiser4_is_set(reiser4_get_current_sb(), REISER4_DISCARD) ||
+	    list_empty(&atom->discard.delete_set)) {
 		spin_unlock_atom(atom);
-		return 0;
+		return;
 	}
 
-	/* Take the delete sets from the atom in order to release atom spinlock. */
-	blocknr_list_init(&discard_set);
-	blocknr_list_merge(&atom->discard.delete_set, &discard_set);
+	q = &get_current_super_private()->discard;
+	spin_lock(&q->guard);
+	blocknr_list_merge(&atom->discard.delete_set, &q->pending);
+	schedule_delayed_work(&q->work, REISER4_DISCARD_DELAY);
+	spin_unlock(&q->guard);
 	spin_unlock_atom(atom);
+}
 
-	/* Sort the discard list, joining adjacent and overlapping extents. */
-	blocknr_list_sort_and_join(&discard_set);
-
-	/* Perform actual dirty work. */
-	ret = blocknr_list_iterator(NULL, &discard_set, &discard_extent, NULL, 0);
+/**
+ * reiser4_trim_fs - discard free space, FITRIM ioctl
+ * @super: super block
+ * @range: byte range to trim and minimal length of free extents to discard,
+ *	   the number of discarded bytes is returned in @range->len
+ *
+ * Work is done by the space allocator, which marks free extents used while
+ * discard I/O is in flight.
+ */
+int reiser4_trim_fs(struct super_block *super, struct fstrim_range *range)
+{
+	struct request_queue *q = bdev_get_queue(super->s_bdev);
+	const unsigned bits = super->s_blocksize_bits;
+	reiser4_block_nr block_count = reiser4_block_count(super);
+	reiser4_block_nr start;
+	reiser4_block_nr len;
+	reiser4_block_nr min_len;
+	reiser4_block_nr trimmed = 0;
+	int ret;
 
-	/* Add processed extents to the temporary list. */
-	blocknr_list_merge(&discard_set, processed_set);
+	if (!blk_queue_discard(q))
+		return RETERR(-EOPNOTSUPP);
 
-	if (ret != 0) {
-		return ret;
-	}
+	start = range->start >> bits;
+	len = range->len >> bits;
+	min_len = max_t(reiser4_block_nr, range->minlen >> bits,
+			q->limits.discard_granularity >> bits);
+	if (start >= block_count || len == 0)
+		return RETERR(-EINVAL);
+	len = min(len, block_count - start);
 
-	/* Let's do this again for any new extents in the atom's discard set. */
-	return -E_REPEAT;
+	ret = sa_trim(reiser4_get_space_allocator(super), start, start + len,
+		      min_len, &trimmed);
+	range->len = trimmed << bits;
+	return ret;
 }
 
-void discard_atom_post(txn_atom *atom, struct list_head *processed_set)
+/**
+ * reiser4_init_discard - initialize discard queue
+ * @super: super block being mounted
+ */
+void reiser4_init_discard(struct super_block *super)
 {
-	assert("intelfx-60", atom != NULL);
-	assert("intelfx-61", processed_set != NULL);
+	struct reiser4_discard_queue *q = &get_super_private(super)->discard;
 
-	if (!reiser4_is_set(reiser4_get_current_sb(), REISER4_DISCARD)) {
-		spin_unlock_atom(atom);
-		return;
-	}
+	spin_lock_init(&q->guard);
+	blocknr_list_init(&q->pending);
+	INIT_DELAYED_WORK(&q->work, discard_worker);
+	q->super = super;
+}
 
-	blocknr_list_merge(processed_set, &atom->discard.delete_set);
-	spin_unlock_atom(atom);
+/**
+ * reiser4_done_discard - discard and deallocate all queued extents
+ * @super: super block being unmounted
+ *
+ * This is called when all atoms are committed, before the space allocator
+ * is destroyed.
+ */
+void reiser4_done_discard(struct super_block *super)
+{
+	struct reiser4_discard_queue *q = &get_super_private(super)->discard;
+
+	cancel_delayed_work_sync(&q->work);
+	discard_pending(super, ~0ull);
+	assert("", list_empty(&q->pending));
 }
 
 /* Make Linus happy.
@@ -9,24 +9,24 @@
 #include "forward.h"
 #include "dformat.h"
 
-/**
- * Issue discard requests for all block extents recorded in @atom's delete sets,
- * if discard is enabled. The extents processed are removed from the @atom's
- * delete sets and stored in @processed_set.
- *
- * @atom must be locked on entry and is unlocked on exit.
- * @processed_set must be initialized with blocknr_list_init().
- */
-extern int discard_atom(txn_atom *atom, struct list_head *processed_set);
+struct super_block;
+struct fstrim_range;
 
 /**
- * Splices @processed_set back to @atom's delete set.
- * Must be called after discard_atom() loop, using the same @processed_set.
+ * Move all block extents recorded in @atom's delete set to the discard queue,
+ * if discard is enabled. Queued blocks stay allocated until they are
+ * discarded.
  *
  * @atom must be locked on entry and is unlocked on exit.
- * @processed_set must be the same as passed to discard_atom().
  */
-extern void discard_atom_post(txn_atom *atom, struct list_head *processed_set);
+extern void discard_atom(txn_atom *atom);
+
+extern int reiser4_discard_extent(struct super_block *, reiser4_block_nr start,
+				  reiser4_block_nr len);
+extern int reiser4_trim_fs(struct super_block *, struct fstrim_range *);
+
+extern void reiser4_init_discard(struct super_block *);
+extern void reiser4_done_discard(struct super_block *);
 
 /* __FS_REISER4_DISCARD_H__ */
 #endif
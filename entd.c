@@ -37,22 +37,47 @@ static int entd(void *arg);
 	snprintf(current->comm, sizeof(current->comm),	\
 		"ent:%s%s", super->s_id, (state))
 
+/*
+ * A file system has entd.nr_threads ent threads. They all take requests from
+ * the head of one todo_list: each request makes its thread write out some
+ * atom, and a request has to wait only for its own thread while the others
+ * keep submitting i/o. Writeouts of different threads go to different atoms,
+ * or to the same atom when tmgr.atom_max_flushers allows concurrent flushers.
+ */
+
+/* stop ent threads started so far */
+static void stop_entd_threads(entd_context *ent)
+{
+	unsigned int i;
+
+	for (i = 0; i < ent->nr_threads; i++)
+		if (ent->tsk[i] != NULL) {
+			kthread_stop(ent->tsk[i]);
+			ent->tsk[i] = NULL;
+		}
+}
+
 /**
- * reiser4_init_entd - initialize entd context and start kernel daemon
- * @super: super block to start ent thread for
+ * reiser4_init_entd - initialize entd context and start kernel daemons
+ * @super: super block to start ent threads for
  *
- * Creates entd contexts, starts kernel thread and waits until it
- * initializes.
+ * Creates entd contexts and starts kernel threads.
  */
 int reiser4_init_entd(struct super_block *super)
 {
 	entd_context *ctx;
+	unsigned int nr_threads;
+	unsigned int i;
 
 	assert("nikita-3104", super != NULL);
 
 	ctx = get_entd_context(super);
 
+	/* the only field set by mount options */
+	nr_threads = clamp_t(unsigned int, ctx->nr_threads, 1,
+			     REISER4_ENTD_MAX_THREADS);
 	memset(ctx, 0, sizeof *ctx);
+	ctx->nr_threads = nr_threads;
 	spin_lock_init(&ctx->guard);
 	init_waitqueue_head(&ctx->wait);
 #if REISER4_DEBUG
@@ -62,9 +87,16 @@ int reiser4_init_entd(struct super_block *super)
 	INIT_LIST_HEAD(&ctx->todo_list);
 	INIT_LIST_HEAD(&ctx->done_list);
 	/* start entd */
-	ctx->tsk = kthread_run(entd, super, "ent:%s", super->s_id);
-	if (IS_ERR(ctx->tsk))
-		return PTR_ERR(ctx->tsk);
+	for (i = 0; i < nr_threads; i++) {
+		struct task_struct *tsk;
+
+		tsk = kthread_run(entd, super, "ent:%s", super->s_id);
+		if (IS_ERR(tsk)) {
+			stop_entd_threads(ctx);
+			return PTR_ERR(tsk);
+		}
+		ctx->tsk[i] = tsk;
+	}
 	return 0;
 }
 
@@ -111,12 +143,9 @@ static int entd(void *arg)
 		while (ent->nr_todo_reqs != 0) {
 			struct wbq *rq;
 
-			assert("", list_empty(&ent->done_list));
-
 			/* take request from the queue head */
 			rq = __get_wbq(ent);
 			assert("", rq != NULL);
-			ent->cur_request = rq;
 			spin_unlock(&ent->guard);
 
 			entd_set_comm("!");
@@ -125,7 +154,8 @@ static int entd(void *arg)
 			put_wbq(rq);
 
 			/*
-			 * wakeup all requestors and iput their inodes
+			 * wakeup all requestors and iput their inodes. Done
+			 * requests of other ent threads are put here too
 			 */
 			spin_lock(&ent->guard);
 			while (!list_empty(&ent->done_list)) {
@@ -146,7 +176,9 @@ static int entd(void *arg)
 			DEFINE_WAIT(__wait);
 
 			do {
-				prepare_to_wait(&ent->wait, &__wait, TASK_INTERRUPTIBLE);
+				/* one request wakes up one idle thread */
+				prepare_to_wait_exclusive(&ent->wait, &__wait,
+							  TASK_INTERRUPTIBLE);
 				if (kthread_should_stop()) {
 					done = 1;
 					break;
@@ -163,11 +195,11 @@ static int entd(void *arg)
 }
 
 /**
- * reiser4_done_entd - stop entd kernel thread
- * @super: super block to stop ent thread for
+ * reiser4_done_entd - stop entd kernel threads
+ * @super: super block to stop ent threads for
  *
- * It is called on umount. Sends stop signal to entd and wait until it handles
- * it.
+ * It is called on umount. Sends stop signal to ent threads and waits until
+ * they handle it.
  */
 void reiser4_done_entd(struct super_block *super)
 {
@@ -176,8 +208,8 @@ void reiser4_done_entd(struct super_block *super)
 	assert("nikita-3103", super != NULL);
 
 	ent = get_entd_context(super);
-	assert("zam-1055", ent->tsk != NULL);
-	kthread_stop(ent->tsk);
+	assert("zam-1055", ent->tsk[0] != NULL);
+	stop_entd_threads(ent);
 }
 
 /* called at the beginning of jnode_flush to register flusher thread with ent
@@ -218,7 +250,7 @@ void reiser4_leave_flush(struct super_block *super)
 #endif
 	spin_unlock(&ent->guard);
 	if (wake_up_ent)
-		wake_up_process(ent->tsk);
+		wake_up(&ent->wait);
 }
 
 #define ENTD_CAPTURE_APAGE_BURST SWAP_CLUSTER_MAX
@@ -229,6 +261,7 @@ static void entd_flush(struct super_block *super, struct wbq *rq)
 
 	init_stack_context(&ctx, super);
 	ctx.entd = 1;
+	ctx.entd_request = rq;
 	ctx.gfp_mask = GFP_NOFS;
 
 	rq->wbc->range_start = page_offset(rq->page);
@@ -329,10 +362,9 @@ int write_page_by_ent(struct page *page, struct writeback_control *wbc)
 	spin_lock(&ent->guard);
 	ent->nr_todo_reqs++;
 	list_add_tail(&rq.link, &ent->todo_list);
-	if (ent->nr_todo_reqs == 1)
-		wake_up_process(ent->tsk);
-
 	spin_unlock(&ent->guard);
+	/* wake up an idle ent thread, if there is any */
+	wake_up(&ent->wait);
 
 	/* wait until entd finishes */
 	wait_for_completion(&rq.completion);
@@ -35,8 +35,10 @@ typedef struct entd_context {
 	wait_queue_head_t wait;
 	/* spinlock protecting other fields */
 	spinlock_t guard;
-	/* ent thread */
-	struct task_struct *tsk;
+	/* ent threads serving requests of todo_list */
+	struct task_struct *tsk[REISER4_ENTD_MAX_THREADS];
+	/* number of ent threads, set by entd.nr_threads mount option */
+	unsigned int nr_threads;
 	/* set to indicate that ent thread should leave. */
 	int done;
 	/* counter of active flushers */
@@ -49,7 +51,6 @@ typedef struct entd_context {
 	/* number of elements on the above list */
 	int nr_todo_reqs;
 
-	struct wbq *cur_request;
 	/*
 	 * when entd writes a page it moves write-back request from todo_list
 	 * to done_list. This list is used at the end of entd iteration to
@@ -76,6 +77,13 @@ extern int wbq_available(void);
 extern void ent_writes_page(struct super_block *, struct page *);
 
 extern jnode *get_jnode_by_wbq(struct super_block *, struct wbq *);
+
+/* request of ent thread running in the current context */
+static inline struct wbq *entd_current_request(void)
+{
+	assert("", get_current_context()->entd);
+	return get_current_context()->entd_request;
+}
 /* __ENTD_H__ */
 #endif
 
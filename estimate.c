@@ -8,6 +8,7 @@
 #include "inode.h"
 #include "plugin/cluster.h"
 #include "plugin/item/ctail.h"
+#include "super.h"
 
 /* This returns how many nodes might get dirty and added nodes if @children
    nodes are dirtied
@@ -37,6 +38,119 @@ max_balance_overhead(reiser4_block_nr childen, tree_level tree_height)
 	return ((tree_height < 5 ? 5 : tree_height) * 2 + (4 + ten_percent));
 }
 
+/* CALIBRATED ESTIMATES
+
+   The estimates below assume the worst case balancing on every level, while
+   most carries dirty a leaf or two. Grabbing that much for each operation
+   makes space run out, and flushes and commits get forced, long before the
+   disk is full.
+
+   So reiser4_carry() reports how many grabbed blocks each carry actually
+   spent (ctx->grabbed_consumed) to reiser4_estimate_account(), which keeps
+   a histogram per kind of balancing and tree height. Every
+   REISER4_ESTIMATE_PERIOD carries the 99.9th percentile of the histogram
+   plus a margin becomes the estimate, if it is below the worst case.
+
+   A carry may still spend more than was grabbed. The shortfall is then
+   taken from the reserved area (see grab_shortfall() in block_alloc.c),
+   which is counted as a miss and raises the margin. To keep that possible,
+   worst case estimates are used while free space is below twice the
+   reserved area.
+*/
+
+/* calibrated estimate for @class at @height, or @worst */
+static reiser4_block_nr calibrated(reiser4_tree * tree, estimate_class class,
+				   tree_level height, reiser4_block_nr worst)
+{
+	reiser4_super_info_data *sbinfo = get_super_private(tree->super);
+	reiser4_block_nr bound;
+
+	if (height > REISER4_MAX_ZTREE_HEIGHT)
+		return worst;
+	bound = READ_ONCE(tree->estimator.bound[class][height]);
+	if (bound == 0 || bound >= worst ||
+	    READ_ONCE(sbinfo->blocks_free) < 2 * sbinfo->blocks_reserved)
+		return worst;
+	return bound;
+}
+
+/* recalculate calibrated estimate from histogram @hist */
+static reiser4_block_nr estimate_bound(reiser4_estimator * est,
+				       unsigned int *hist)
+{
+	unsigned long total = 0;
+	unsigned long sum = 0;
+	int i;
+
+	for (i = 0; i < ESTIMATE_BUCKETS; i++)
+		total += READ_ONCE(hist[i]);
+	for (i = 0; i < ESTIMATE_BUCKETS - 1; i++) {
+		sum += READ_ONCE(hist[i]);
+		if (sum >= total - total / 1000)
+			break;
+	}
+	/* let old samples fade away */
+	if (total > 64 * REISER4_ESTIMATE_PERIOD)
+		for (i = 0; i < ESTIMATE_BUCKETS; i++)
+			WRITE_ONCE(hist[i], READ_ONCE(hist[i]) / 2);
+	if (i == ESTIMATE_BUCKETS - 1)
+		/* out of histogram range */
+		return 0;
+	return i + READ_ONCE(est->margin);
+}
+
+/**
+ * reiser4_estimate_account - record space spent by a carry
+ * @tree: tree balanced
+ * @class: kind of balancing
+ * @height: tree height at the start of the carry
+ * @consumed: number of grabbed blocks spent
+ *
+ * Counters are updated without locking, losing an update now and then does
+ * no harm.
+ */
+void reiser4_estimate_account(reiser4_tree * tree, estimate_class class,
+			      tree_level height, reiser4_block_nr consumed)
+{
+	reiser4_estimator *est = &tree->estimator;
+	unsigned int *hist;
+	unsigned int n;
+
+	if (height > REISER4_MAX_ZTREE_HEIGHT)
+		return;
+	hist = est->hist[class][height];
+	if (consumed >= ESTIMATE_BUCKETS)
+		consumed = ESTIMATE_BUCKETS - 1;
+	WRITE_ONCE(hist[consumed], READ_ONCE(hist[consumed]) + 1);
+
+	n = READ_ONCE(est->samples[class][height]) + 1;
+	WRITE_ONCE(est->samples[class][height], n);
+	if (n % REISER4_ESTIMATE_PERIOD == 0)
+		WRITE_ONCE(est->bound[class][height],
+			   estimate_bound(est, hist));
+}
+
+/**
+ * reiser4_estimate_miss - a carry spent more than was grabbed
+ * @tree: tree balanced
+ *
+ * Raises margin of calibrated estimates and drops them until they are
+ * recalculated.
+ */
+void reiser4_estimate_miss(reiser4_tree * tree)
+{
+	reiser4_estimator *est = &tree->estimator;
+	int class;
+	int height;
+
+	est->misses++;
+	if (est->margin < ESTIMATE_BUCKETS / 4)
+		est->margin++;
+	for (class = 0; class < ESTIMATE_CLASSES; class++)
+		for (height = 0; height <= REISER4_MAX_ZTREE_HEIGHT; height++)
+			WRITE_ONCE(est->bound[class][height], 0);
+}
+
 /* this returns maximal possible number of nodes which can be modified plus
    number of new nodes which can be required to perform insertion of one item
    into the tree */
@@ -48,7 +162,8 @@ reiser4_block_nr calc_estimate_one_insert(tree_level height)
 
 reiser4_block_nr estimate_one_insert_item(reiser4_tree * tree)
 {
-	return tree->estimate_one_insert;
+	return calibrated(tree, ESTIMATE_INSERT, tree->height,
+			  tree->estimate_one_insert);
 }
 
 /* this returns maximal possible number of nodes which can be modified plus
@@ -57,14 +172,14 @@ reiser4_block_nr estimate_one_insert_item(reiser4_tree * tree)
 reiser4_block_nr estimate_one_insert_into_item(reiser4_tree * tree)
 {
 	/* estimate insert into item just like item insertion */
-	return tree->estimate_one_insert;
+	return estimate_one_insert_item(tree);
 }
 
 reiser4_block_nr estimate_one_item_removal(reiser4_tree * tree)
 {
 	/* on item removal reiser4 does not try to pack nodes more complact, so,
 	   only one node may be dirtied on leaf level */
-	return tree->estimate_one_insert;
+	return estimate_one_insert_item(tree);
 }
 
 /* on leaf level insert_flow may add CARRY_FLOW_NEW_NODES_LIMIT new nodes and
@@ -73,9 +188,10 @@ reiser4_block_nr estimate_one_item_removal(reiser4_tree * tree)
    added on internal levels */
 reiser4_block_nr estimate_insert_flow(tree_level height)
 {
-	return 3 + CARRY_FLOW_NEW_NODES_LIMIT + max_balance_overhead(3 +
-								     CARRY_FLOW_NEW_NODES_LIMIT,
-								     height);
+	return calibrated(current_tree, ESTIMATE_FLOW, height,
+			  3 + CARRY_FLOW_NEW_NODES_LIMIT +
+			  max_balance_overhead(3 + CARRY_FLOW_NEW_NODES_LIMIT,
+					       height));
 }
 
 /* returnes max number of nodes can be occupied by disk cluster */
@@ -27,6 +27,7 @@
 #include "reiser4.h"
 #include "flush.h"
 #include "writeout.h"
+#include "reiser4_trace.h"
 
 #include <asm/atomic.h>
 #include <linux/fs.h>		/* for struct super_block  */
@@ -467,15 +468,74 @@ assert("nikita-3435",							\
    laziness (because flush has no static initializer function...) */
 ON_DEBUG(atomic_t flush_cnt;)
 
-/* check fs backing device for write congestion */
-static int check_write_congestion(void)
+/* Write congestion controller.
+
+   The backing device congestion state only tells that its request queue is
+   full, which is much too late on devices with deep queues: everything
+   queued before a read delays it. So flush also limits the number of
+   blocks it keeps in flight by a window, which grows by one block with each
+   completed bio while average completion latency is below
+   flush.target_latency and shrinks by a quarter, at most once per target
+   latency, while it is above. Writes which somebody waits for (commit,
+   fsync) are not limited, only opportunistic ones are postponed. */
+
+void reiser4_init_flush_congestion(struct flush_congestion *cong)
 {
-	struct super_block *sb;
-	struct backing_dev_info *bdi;
+	spin_lock_init(&cong->lock);
+	atomic_set(&cong->inflight, 0);
+	cong->window = FLUSH_CONG_MAX_WINDOW;
+	cong->latency = 0;
+	cong->last_shrink = 0;
+}
 
-	sb = reiser4_get_current_sb();
-	bdi = inode_to_bdi(reiser4_get_super_fake(sb));
-	return bdi_write_congested(bdi);
+void flush_io_submitted(struct super_block *sb, int nr)
+{
+	atomic_add(nr, &get_super_private(sb)->flush_cong.inflight);
+}
+
+/* called from bio completion for @nr blocks submitted at @start, which is 0
+   when not known */
+void flush_io_completed(struct super_block *sb, int nr, ktime_t start)
+{
+	reiser4_super_info_data *sbinfo = get_super_private(sb);
+	struct flush_congestion *cong = &sbinfo->flush_cong;
+	unsigned target = READ_ONCE(sbinfo->flush.target_latency);
+	unsigned long flags;
+	ktime_t now;
+	u64 sample;
+
+	atomic_sub(nr, &cong->inflight);
+	if (target == 0 || start == 0)
+		return;
+
+	now = ktime_get();
+	sample = ktime_us_delta(now, start);
+
+	spin_lock_irqsave(&cong->lock, flags);
+	cong->latency = (cong->latency * 7 + sample) / 8;
+	if (cong->latency <= target) {
+		if (cong->window < FLUSH_CONG_MAX_WINDOW)
+			cong->window++;
+	} else if (ktime_us_delta(now, cong->last_shrink) >= target) {
+		cong->window -= cong->window / 4;
+		if (cong->window < FLUSH_CONG_MIN_WINDOW)
+			cong->window = FLUSH_CONG_MIN_WINDOW;
+		cong->last_shrink = now;
+	}
+	spin_unlock_irqrestore(&cong->lock, flags);
+}
+
+/* true if opportunistic write-out should be postponed */
+int flush_write_throttled(struct super_block *sb)
+{
+	reiser4_super_info_data *sbinfo = get_super_private(sb);
+
+	if (bdi_write_congested(inode_to_bdi(reiser4_get_super_fake(sb))))
+		return 1;
+	if (READ_ONCE(sbinfo->flush.target_latency) == 0)
+		return 0;
+	return atomic_read(&sbinfo->flush_cong.inflight) >=
+		READ_ONCE(sbinfo->flush_cong.window);
 }
 
 /* conditionally write flush queue */
@@ -489,7 +549,7 @@ static int write_prepped_nodes(flush_pos_t *pos)
 	if (!(pos->flags & JNODE_FLUSH_WRITE_BLOCKS))
 		return 0;
 
-	if (check_write_congestion())
+	if (flush_write_throttled(reiser4_get_current_sb()))
 		return 0;
 
 	ret = reiser4_write_fq(pos->fq, pos->nr_written,
@@ -684,6 +744,69 @@ static txmod_plugin *get_txmod_plugin(void)
    properly rather than restarting, but there are a bunch of cases to audit.
 */
 
+/* Flush scan cache.
+
+   When jnode_flush() bails out with one of the "try again" errors (see the
+   end of jnode_flush()), flush_current_atom() usually picks the very same
+   starting node on the next iteration and the whole scan_left()/scan_right()
+   pass is repeated over an unchanged slum. To avoid that, results of the last
+   scan are kept in the atom together with the atom's capture generation,
+   which is bumped each time a node enters or leaves the atom (including
+   fusion). While the generation is unchanged both the starting node and the
+   leftmost node found by the scan are still captured by the atom, hence
+   pinned by it, so the cached pointers can be used without holding extra
+   references. */
+
+/* fill @leftmost and scan counts from the cache, if it is still valid for
+   @node */
+static int flush_scan_cache_lookup(jnode *node, jnode **leftmost,
+				   unsigned *left_count, unsigned *right_count)
+{
+	txn_atom *atom;
+	int found = 0;
+
+	atom = get_current_atom_locked();
+	if (atom->flush_scan.start == node &&
+	    atom->flush_scan.gen == atom->capture_gen &&
+	    JF_ISSET(atom->flush_scan.leftmost, JNODE_DIRTY) &&
+	    !JF_ISSET(atom->flush_scan.leftmost, JNODE_HEARD_BANSHEE)) {
+		*leftmost = jref(atom->flush_scan.leftmost);
+		*left_count = atom->flush_scan.left_count;
+		*right_count = atom->flush_scan.right_count;
+		found = 1;
+	} else
+		atom->flush_scan.start = NULL;
+	spin_unlock_atom(atom);
+	return found;
+}
+
+static void flush_scan_cache_store(jnode *node, jnode *leftmost,
+				   unsigned left_count, unsigned right_count)
+{
+	txn_atom *atom;
+
+	atom = get_current_atom_locked();
+	/* ->atom of a node can only be changed under the atom lock */
+	if (node->atom == atom && leftmost->atom == atom) {
+		atom->flush_scan.start = node;
+		atom->flush_scan.leftmost = leftmost;
+		atom->flush_scan.left_count = left_count;
+		atom->flush_scan.right_count = right_count;
+		atom->flush_scan.gen = atom->capture_gen;
+	} else
+		atom->flush_scan.start = NULL;
+	spin_unlock_atom(atom);
+}
+
+static void flush_scan_cache_forget(void)
+{
+	txn_atom *atom;
+
+	atom = get_current_atom_locked();
+	atom->flush_scan.start = NULL;
+	spin_unlock_atom(atom);
+}
+
 static int
 jnode_flush(jnode * node, long nr_to_write, long *nr_written,
 	    flush_queue_t *fq, int flags)
@@ -696,6 +819,7 @@ jnode_flush(jnode * node, long nr_to_write, long *nr_written,
 	struct super_block *sb;
 	reiser4_super_info_data *sbinfo;
 	jnode *leftmost_in_slum = NULL;
+	long nr_written_start = *nr_written;
 
 	assert("jmacd-76619", lock_stack_isclean(get_current_lock_stack()));
 	assert("nikita-3022", reiser4_schedulable());
@@ -721,6 +845,7 @@ jnode_flush(jnode * node, long nr_to_write, long *nr_written,
 #endif
 
 	reiser4_enter_flush(sb);
+	reiser4_stat_inc(sb, REISER4_STAT_FLUSHES);
 
 	/* Initialize a flush position. */
 	pos_init(flush_pos);
@@ -733,6 +858,10 @@ jnode_flush(jnode * node, long nr_to_write, long *nr_written,
 	scan_init(right_scan);
 	scan_init(left_scan);
 
+	if (flush_scan_cache_lookup(node, &leftmost_in_slum,
+				    &left_scan->count, &right_scan->count))
+		goto scanned;
+
 	/* First scan left and remember the leftmost scan position. If the
 	   leftmost position is unformatted we remember its parent_coord. We
 	   scan until counting FLUSH_SCAN_MAXNODES.
@@ -774,9 +903,13 @@ jnode_flush(jnode * node, long nr_to_write, long *nr_written,
 	   right away. */
 	scan_done(right_scan);
 
+	flush_scan_cache_store(node, leftmost_in_slum,
+			       left_scan->count, right_scan->count);
+scanned:
 	/* ... and the answer is: we should relocate leaf nodes if at least
 	   FLUSH_RELOCATE_THRESHOLD nodes were found. */
 	flush_pos->leaf_relocate = JF_ISSET(node, JNODE_REPACK) ||
+	    JF_ISSET(leftmost_in_slum, JNODE_REPACK) ||
 	    (left_scan->count + right_scan->count >=
 	     sbinfo->flush.relocate_threshold);
 
@@ -844,6 +977,9 @@ jnode_flush(jnode * node, long nr_to_write, long *nr_written,
 	pos_stop(flush_pos);
 	if (ret)
 		goto failed;
+	/* the slum is (at least partially) processed, next flush starts from
+	   a different place */
+	flush_scan_cache_forget();
 
 	/* FIXME_NFQUCMPD: Here, handle the twig-special case for unallocated
 	   children. First, the pos_stop() and pos_valid() routines should be
@@ -913,6 +1049,12 @@ failed:
 		ret = 0;
 	}
 
+	trace_reiser4_jnode_flush(sb, *jnode_get_block(node),
+				  left_scan->count + right_scan->count,
+				  flush_pos->squeeze_cnt, flush_pos->alloc_cnt,
+				  flush_pos->leaf_relocate,
+				  *nr_written - nr_written_start, ret);
+
 	if (leftmost_in_slum)
 		jput(leftmost_in_slum);
 
@@ -975,7 +1117,7 @@ static jnode *find_flush_start_jnode(jnode *start, txn_atom * atom,
 	 * dirty nodes processed or not prepped node found in the atom dirty
 	 * lists.
 	 */
-	while ((node = find_first_dirty_jnode(atom, flags))) {
+	while ((node = find_first_dirty_jnode(atom, flags, fq))) {
 		spin_lock_jnode(node);
 enter:
 		assert("zam-881", JF_ISSET(node, JNODE_DIRTY));
@@ -1017,6 +1159,9 @@ enter:
 
 		spin_unlock_jnode(node);
 	}
+	if (node != NULL)
+		/* keep other flushers of this atom off our slum */
+		fq->slum = jnode_slum_id(node);
 	return node;
 }
 
@@ -1030,6 +1175,7 @@ flush_current_atom(int flags, long nr_to_write, long *nr_submitted,
 	reiser4_super_info_data *sinfo = get_current_super_private();
 	flush_queue_t *fq = NULL;
 	jnode *node;
+	ktime_t flush_start;
 	int nr_queued;
 	int ret;
 
@@ -1086,7 +1232,9 @@ flush_current_atom(int flags, long nr_to_write, long *nr_submitted,
 		spin_unlock_atom(*atom);
 		spin_unlock_jnode(node);
 		BUG_ON(nr_to_write == 0);
+		flush_start = ktime_get();
 		ret = jnode_flush(node, nr_to_write, nr_submitted, fq, flags);
+		txnmgr_lat_since(&sinfo->tmgr, TXNMGR_LAT_FLUSH, flush_start);
 		jput(node);
 	}
 
@@ -1695,6 +1843,34 @@ exit:
    is returned.
 */
 
+/* Decide whether shifting from @right into @left is worth its cost: it may
+   dirty either node and costs a carry. This is so if @right can be emptied
+   (one node less to write), or if @left has at least
+   flush.squeeze_min_gain percents of the block free and both nodes are dirty
+   already. */
+static int squeeze_is_profitable(znode * left, znode * right)
+{
+	reiser4_super_info_data *sbinfo;
+	unsigned left_free;
+	unsigned block_size;
+
+	sbinfo = get_current_super_private();
+	if (sbinfo->flush.squeeze_min_gain == 0)
+		return 1;
+
+	block_size = current_blocksize;
+	left_free = znode_free_space(left);
+	if (left_free >= block_size - znode_free_space(right))
+		return 1;
+	if (JF_ISSET(ZJNODE(left), JNODE_DIRTY) &&
+	    JF_ISSET(ZJNODE(right), JNODE_DIRTY) &&
+	    left_free * 100 >= sbinfo->flush.squeeze_min_gain * block_size)
+		return 1;
+
+	atomic_inc(&sbinfo->flush.squeeze_skipped);
+	return 0;
+}
+
 static int squeeze_right_neighbor(flush_pos_t *pos, znode * left,
 				  znode * right)
 {
@@ -1706,6 +1882,11 @@ static int squeeze_right_neighbor(flush_pos_t *pos, znode * left,
 	assert("jmacd-9322", !node_is_empty(right));
 	assert("jmacd-9323", znode_get_level(left) == znode_get_level(right));
 
+	/* as if nothing fits into @left */
+	if (!squeeze_is_profitable(left, right))
+		return SQUEEZE_TARGET_FULL;
+	reiser4_stat_inc(reiser4_get_current_sb(), REISER4_STAT_SQUEEZES);
+
 	switch (znode_get_level(left)) {
 	case TWIG_LEVEL:
 		/* Shift with extent allocating until either an internal item
@@ -1725,6 +1906,8 @@ static int squeeze_right_neighbor(flush_pos_t *pos, znode * left,
 			      ret == SQUEEZE_SOURCE_EMPTY
 			      || ret == SQUEEZE_TARGET_FULL
 			      || ret == SUBTREE_MOVED));
+	if (ret >= 0 && ret != SQUEEZE_TARGET_FULL)
+		pos->squeeze_cnt++;
 	return ret;
 }
 
@@ -66,6 +66,7 @@ struct convert_item_info {
 	dc_item_stat d_next;    /* per-cluster status of the first item on
 				                         the right neighbor */
 	int cluster_shift;      /* disk cluster shift */
+	oid_t oid;              /* object id of the file */
 	flow_t flow;            /* disk cluster data */
 };
 
@@ -114,6 +115,8 @@ struct flush_position {
 				   and allococate. */
 	int prep_or_free_cnt;	/* The number of nodes prepared for write
 				   (allocate) or squeezed and freed. */
+	int squeeze_cnt;	/* The number of squeezes which moved
+				   something. */
 	flush_queue_t *fq;
 	long *nr_written;	/* number of nodes submitted to disk */
 	int flags;		/* a copy of jnode_flush flags argument */
@@ -262,6 +265,11 @@ squeeze_result squalloc_extent(znode *left, const coord_t *, flush_pos_t *,
 extern int reiser4_init_fqs(void);
 extern void reiser4_done_fqs(void);
 
+extern void reiser4_init_flush_congestion(struct flush_congestion *);
+extern void flush_io_submitted(struct super_block *, int nr);
+extern void flush_io_completed(struct super_block *, int nr, ktime_t start);
+extern int flush_write_throttled(struct super_block *);
+
 #if REISER4_DEBUG
 
 extern void reiser4_check_fq(const txn_atom *atom);
@@ -11,6 +11,7 @@
 #include "vfs_ops.h"
 #include "writeout.h"
 #include "flush.h"
+#include "magazine.h"
 
 #include <linux/bio.h>
 #include <linux/mm.h>
@@ -107,23 +108,20 @@ static void init_fq(flush_queue_t *fq)
 	spin_lock_init(&fq->guard);
 }
 
-/* slab for flush queues */
-static struct kmem_cache *fq_slab;
+/* flush queues are taken and released by every flush and commit, they are
+   kept in per-CPU magazines */
+static reiser4_mag_cache fq_cache;
 
 /**
  * reiser4_init_fqs - create flush queue cache
  *
- * Initializes slab cache of flush queues. It is part of reiser4 module
+ * Initializes cache of flush queues. It is part of reiser4 module
  * initialization.
  */
 int reiser4_init_fqs(void)
 {
-	fq_slab = kmem_cache_create("fq",
-				    sizeof(flush_queue_t),
-				    0, SLAB_HWCACHE_ALIGN, NULL);
-	if (fq_slab == NULL)
-		return RETERR(-ENOMEM);
-	return 0;
+	return reiser4_init_mag_cache(&fq_cache, "fq", sizeof(flush_queue_t),
+				      SLAB_HWCACHE_ALIGN);
 }
 
 /**
@@ -133,7 +131,7 @@ int reiser4_init_fqs(void)
  */
 void reiser4_done_fqs(void)
 {
-	destroy_reiser4_cache(&fq_slab);
+	reiser4_done_mag_cache(&fq_cache);
 }
 
 /* create new flush queue object */
@@ -141,7 +139,7 @@ static flush_queue_t *create_fq(gfp_t gfp)
 {
 	flush_queue_t *fq;
 
-	fq = kmem_cache_alloc(fq_slab, gfp);
+	fq = reiser4_mag_alloc(&fq_cache, gfp);
 	if (fq)
 		init_fq(fq);
 
@@ -187,7 +185,7 @@ static void done_fq(flush_queue_t *fq)
 	assert("zam-763", list_empty_careful(ATOM_FQ_LIST(fq)));
 	assert("zam-766", atomic_read(&fq->nr_submitted) == 0);
 
-	kmem_cache_free(fq_slab, fq);
+	reiser4_mag_free(&fq_cache, fq);
 }
 
 /* */
@@ -320,6 +318,7 @@ int current_atom_finish_all_fq(void)
 	txn_atom *atom;
 	int nr_io_errors = 0;
 	int ret = 0;
+	ktime_t start = ktime_get();
 
 	do {
 		while (1) {
@@ -339,6 +338,8 @@ int current_atom_finish_all_fq(void)
 
 	assert_spin_not_locked(&(atom->alock));
 
+	txnmgr_lat_since(&get_current_super_private()->tmgr,
+			 TXNMGR_LAT_FQ_WAIT, start);
 	if (ret)
 		return ret;
 
@@ -403,6 +404,7 @@ static void end_io_handler(struct bio *bio)
 	flush_queue_t *fq;
 	struct bio_vec *bvec;
 	struct bvec_iter_all iter_all;
+	struct super_block *sb = NULL;
 
 	assert("zam-958", bio_op(bio) == WRITE);
 
@@ -426,6 +428,7 @@ static void end_io_handler(struct bio *bio)
 			assert("zam-736", pg != NULL);
 			assert("zam-736", PagePrivate(pg));
 			node = jprivate(pg);
+			sb = jnode_get_tree(node)->super;
 
 			JF_CLR(node, JNODE_WRITEBACK);
 		}
@@ -434,6 +437,9 @@ static void end_io_handler(struct bio *bio)
 		put_page(pg);
 	}
 
+	if (sb)
+		flush_io_completed(sb, nr, fq ? fq->submit_time : 0);
+
 	if (fq) {
 		/* count i/o error in fq object */
 		atomic_add(nr_errors, &fq->nr_errors);
@@ -525,6 +531,8 @@ int reiser4_write_fq(flush_queue_t *fq, long *nr_submitted, int flags)
 	atom->nr_running_queues++;
 	spin_unlock_atom(atom);
 
+	sort_jnode_list(ATOM_FQ_LIST(fq));
+	fq->submit_time = ktime_get();
 	ret = write_jnode_list(ATOM_FQ_LIST(fq), fq, nr_submitted, flags);
 	release_prepped_list(fq);
 
@@ -615,6 +623,7 @@ void reiser4_fq_put_nolock(flush_queue_t *fq)
 {
 	assert("zam-747", fq->atom != NULL);
 	assert("zam-902", list_empty_careful(ATOM_FQ_LIST(fq)));
+	fq->slum = 0;
 	mark_fq_ready(fq);
 	assert("vs-1245", fq->owner == current);
 	ON_DEBUG(fq->owner = NULL);
@@ -39,6 +39,7 @@ typedef struct reiser4_context reiser4_context;
 typedef struct carry_level carry_level;
 typedef struct blocknr_set_entry blocknr_set_entry;
 typedef struct blocknr_list_entry blocknr_list_entry;
+typedef struct blocknr_tree_entry blocknr_tree_entry;
 /* super_block->s_fs_info points to this */
 typedef struct reiser4_super_info_data reiser4_super_info_data;
 /* next two objects are fields of reiser4_super_info_data */
@@ -3,19 +3,27 @@
 
 #include "fsdata.h"
 #include "inode.h"
+#include "magazine.h"
 
 #include <linux/shrinker.h>
 
 /* cache or dir_cursors */
 static struct kmem_cache *d_cursor_cache;
 
-/* list of unused cursors */
+/*
+ * list of all cursors in least recently created order. Cursors are not
+ * removed from it when taken in use, so that stateless readdir takes and
+ * releases cursor without d_c_lock. Shrinker skips used cursors.
+ */
 static LIST_HEAD(cursor_cache);
 
-/* number of cursors in list of ununsed cursors */
-static unsigned long d_cursor_unused = 0;
+/* number of cursors in @cursor_cache */
+static unsigned long d_cursor_nr = 0;
 
-/* spinlock protecting manipulations with dir_cursor's hash table and lists */
+/*
+ * spinlock protecting manipulations with dir_cursor's hash table and lists.
+ * Hash table is looked up under rcu_read_lock() only
+ */
 DEFINE_SPINLOCK(d_c_lock);
 
 static reiser4_file_fsdata *create_fsdata(struct file *file);
@@ -32,10 +40,14 @@ static unsigned long d_cursor_shrink_scan(struct shrinker *shrink,
 	spin_lock(&d_c_lock);
 	while (!list_empty(&cursor_cache) && sc->nr_to_scan) {
 		scan = list_entry(cursor_cache.next, dir_cursor, alist);
-		assert("nikita-3567", scan->ref == 0);
+		sc->nr_to_scan--;
+		/* unused cursor can not be taken after this */
+		if (atomic_cmpxchg(&scan->ref, 0, -1) != 0) {
+			list_move_tail(&scan->alist, &cursor_cache);
+			continue;
+		}
 		kill_cursor(scan);
 		freed++;
-		sc->nr_to_scan--;
 	}
 	spin_unlock(&d_c_lock);
 	return freed;
@@ -44,7 +56,7 @@ static unsigned long d_cursor_shrink_scan(struct shrinker *shrink,
 static unsigned long d_cursor_shrink_count (struct shrinker *shrink,
 					    struct shrink_control *sc)
 {
-	return d_cursor_unused;
+	return d_cursor_nr;
 }
 
 /*
@@ -86,6 +98,8 @@ void reiser4_done_d_cursor(void)
 {
 	unregister_shrinker(&d_cursor_shrinker);
 
+	/* wait for kill_cursor() to free cursors */
+	reiser4_rcu_barrier();
 	destroy_reiser4_cache(&d_cursor_cache);
 }
 
@@ -146,27 +160,39 @@ void reiser4_done_super_d_info(struct super_block *super)
 	dir_cursor *cursor, *next;
 
 	d_info = &get_super_private(super)->d_info;
+	spin_lock(&d_c_lock);
 	for_all_in_htable(&d_info->table, d_cursor, cursor, next)
 		kill_cursor(cursor);
+	spin_unlock(&d_c_lock);
 
 	BUG_ON(!radix_tree_empty(&d_info->tree));
 	d_cursor_hash_done(&d_info->table);
 }
 
+static void free_cursor_rcu(struct rcu_head *head)
+{
+	kmem_cache_free(d_cursor_cache, container_of(head, dir_cursor, rcu));
+}
+
 /**
  * kill_cursor - free dir_cursor and reiser4_file_fsdata attached to it
  * @cursor: cursor to free
  *
  * Removes reiser4_file_fsdata attached to @cursor from readdir list of
  * reiser4_inode, frees that reiser4_file_fsdata. Removes @cursor from from
- * indices, hash table, list of unused cursors and frees it.
+ * indices, hash table, list of cursors and frees it after RCU grace period,
+ * as lookups of the hash table may still see it.
  */
 static void kill_cursor(dir_cursor *cursor)
 {
 	unsigned long index;
 
-	assert("nikita-3566", cursor->ref == 0);
+	assert("nikita-3566", atomic_read(&cursor->ref) <= 0);
 	assert("nikita-3572", cursor->fsdata != NULL);
+	assert_spin_locked(&d_c_lock);
+
+	/* make reiser4_attach_fsdata() fail to take it */
+	atomic_set(&cursor->ref, -1);
 
 	index = (unsigned long)cursor->key.oid;
 	list_del_init(&cursor->fsdata->dir.linkage);
@@ -196,13 +222,13 @@ static void kill_cursor(dir_cursor *cursor)
 		/* remove cursor from circular list */
 		list_del_init(&cursor->list);
 	}
-	/* remove cursor from the list of unused cursors */
+	/* remove cursor from the list of cursors */
 	list_del_init(&cursor->alist);
+	--d_cursor_nr;
 	/* remove cursor from the hash table */
-	d_cursor_hash_remove(&cursor->info->table, cursor);
+	d_cursor_hash_remove_rcu(&cursor->info->table, cursor);
 	/* and free it */
-	kmem_cache_free(d_cursor_cache, cursor);
-	--d_cursor_unused;
+	reiser4_call_rcu(&cursor->rcu, free_cursor_rcu);
 }
 
 /* possible actions that can be performed on all cursors for the given file */
@@ -261,8 +287,8 @@ static void bind_cursor(dir_cursor * cursor, unsigned long index)
 }
 
 /*
- * detach fsdata (if detachable) from file descriptor, and put cursor on the
- * "unused" list. Called when file descriptor is not longer in active use.
+ * detach fsdata (if detachable) from file descriptor and release the cursor.
+ * Called when file descriptor is not longer in active use.
  */
 static void clean_fsdata(struct file *file)
 {
@@ -275,13 +301,10 @@ static void clean_fsdata(struct file *file)
 	if (fsdata != NULL) {
 		cursor = fsdata->cursor;
 		if (cursor != NULL) {
-			spin_lock(&d_c_lock);
-			--cursor->ref;
-			if (cursor->ref == 0) {
-				list_add_tail(&cursor->alist, &cursor_cache);
-				++d_cursor_unused;
-			}
-			spin_unlock(&d_c_lock);
+			assert("", atomic_read(&cursor->ref) > 0);
+			/* cursor stays on the list of cursors, the shrinker
+			 * can take it from now */
+			atomic_dec(&cursor->ref);
 			file->private_data = NULL;
 		}
 	}
@@ -334,7 +357,7 @@ static int insert_cursor(dir_cursor *cursor, struct file *file, loff_t *fpos,
 			cursor->key.oid = oid;
 			cursor->fsdata = fsdata;
 			cursor->info = info;
-			cursor->ref = 1;
+			atomic_set(&cursor->ref, 1);
 
 			spin_lock_inode(inode);
 			/* install cursor as @f's private_data, discarding old
@@ -350,9 +373,11 @@ static int insert_cursor(dir_cursor *cursor, struct file *file, loff_t *fpos,
 			spin_unlock_inode(inode);
 			spin_lock(&d_c_lock);
 			/* insert cursor into hash table */
-			d_cursor_hash_insert(&info->table, cursor);
+			d_cursor_hash_insert_rcu(&info->table, cursor);
 			/* and chain it into radix-tree */
 			bind_cursor(cursor, (unsigned long)oid);
+			list_add_tail(&cursor->alist, &cursor_cache);
+			++d_cursor_nr;
 			spin_unlock(&d_c_lock);
 			radix_tree_preload_end();
 			*fpos = ((__u64) cursor->key.cid) << CID_SHIFT;
@@ -515,7 +540,8 @@ loff_t reiser4_get_dir_fpos(struct file *dir, loff_t fpos)
  * @fpos: effective value of @file->f_pos
  * @inode:
  *
- * Finds or creates cursor for readdir-over-nfs.
+ * Finds or creates cursor for readdir-over-nfs. Existing cursor is found and
+ * taken without d_c_lock: every request of NFS readdir gets here.
  */
 int reiser4_attach_fsdata(struct file *file, loff_t *fpos, struct inode *inode)
 {
@@ -548,18 +574,12 @@ int reiser4_attach_fsdata(struct file *file, loff_t *fpos, struct inode *inode)
 
 		key.cid = pos >> CID_SHIFT;
 		key.oid = get_inode_oid(inode);
-		spin_lock(&d_c_lock);
-		cursor = d_cursor_hash_find(&d_info(inode)->table, &key);
-		if (cursor != NULL) {
-			/* cursor was found */
-			if (cursor->ref == 0) {
-				/* move it from unused list */
-				list_del_init(&cursor->alist);
-				--d_cursor_unused;
-			}
-			++cursor->ref;
-		}
-		spin_unlock(&d_c_lock);
+		rcu_read_lock();
+		cursor = d_cursor_hash_find_rcu(&d_info(inode)->table, &key);
+		if (cursor != NULL && !atomic_inc_unless_negative(&cursor->ref))
+			/* cursor is being killed */
+			cursor = NULL;
+		rcu_read_unlock();
 		if (cursor != NULL) {
 			spin_lock_inode(inode);
 			assert("nikita-3556", cursor->fsdata->back == NULL);
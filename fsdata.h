@@ -112,6 +112,9 @@ typedef struct reiser4_file_fsdata {
 		struct readdir_pos readdir;
 		/* head of this list is reiser4_inode->lists.readdir_list */
 		struct list_head linkage;
+		/* number of leaves readdir reads ahead, see
+		 * reiser4_iterate_common() */
+		unsigned long ra_window;
 	} dir;
 	/* hints to speed up operations with regular files: read and write. */
 	struct {
@@ -142,7 +145,11 @@ typedef struct dir_cursor dir_cursor;
 TYPE_SAFE_HASH_DECLARE(d_cursor, dir_cursor);
 
 struct dir_cursor {
-	int ref;
+	/*
+	 * number of file descriptors using the cursor, -1 when the cursor is
+	 * being killed. Taken without d_c_lock, see reiser4_attach_fsdata()
+	 */
+	atomic_t ref;
 	reiser4_file_fsdata *fsdata;
 
 	/* link to reiser4 super block hash table of cursors */
@@ -155,8 +162,10 @@ struct dir_cursor {
 	struct list_head list;
 	struct d_cursor_key key;
 	struct d_cursor_info *info;
-	/* list of unused cursors */
+	/* list of cursors looked at by shrinker, used ones included */
 	struct list_head alist;
+	/* cursors are freed after RCU grace period */
+	struct rcu_head rcu;
 };
 
 extern int reiser4_init_d_cursor(void);
@@ -2,9 +2,13 @@
 
 #include "super.h"
 #include "inode.h"
+#include "jdev.h"
 #include "plugin/plugin_set.h"
+#include "discard.h"
+#include "sysfs.h"
 
 #include <linux/swap.h>
+#include <linux/blkdev.h>
 
 /**
  * init_fs_info - allocate reiser4 specific super block
@@ -30,6 +34,15 @@ int reiser4_init_fs_info(struct super_block *super)
 
 	mutex_init(&sbinfo->delete_mutex);
 	spin_lock_init(&(sbinfo->guard));
+	seqlock_init(&sbinfo->statfs_lock);
+	reiser4_init_grab_cache(super);
+	reiser4_init_oid_batches(super);
+	reiser4_init_stats(super);
+	reiser4_init_sd_cache(super);
+	reiser4_init_alloc_groups(super);
+	reiser4_init_prealloc(super);
+	reiser4_init_discard(super);
+	reiser4_init_conv_queue(super);
 
 	/*  initialize per-super-block d_cursor resources */
 	reiser4_init_super_d_info(super);
@@ -48,6 +61,12 @@ void reiser4_done_fs_info(struct super_block *super)
 	assert("zam-990", super->s_fs_info != NULL);
 
 	reiser4_done_super_d_info(super);
+	reiser4_done_jdev(super);
+	reiser4_done_grab_cache(super);
+	reiser4_done_oid_batches(super);
+	reiser4_done_stats(super);
+	reiser4_done_sd_cache(super);
+	reiser4_done_alloc_groups(super);
 	kfree(super->s_fs_info);
 	super->s_fs_info = NULL;
 }
@@ -318,7 +337,7 @@ static int parse_options(char *opt_string, struct opt_desc *opts, int nr_opts)
 		}						\
 	}
 
-#define MAX_NR_OPTIONS (30)
+#define MAX_NR_OPTIONS (48)
 
 #if REISER4_DEBUG
 #  define OPT_ARRAY_CHECK(opt, array)					\
@@ -364,14 +383,51 @@ static noinline void push_sb_field_opts(struct opt_desc **p,
 	 * limit of concurrent flushers for one atom. 0 means no limit.
 	 */
 	PUSH_SB_FIELD_OPT(tmgr.atom_max_flushers, "%u");
+	/*
+	 * entd.nr_threads=N
+	 * number of ent threads writing pages on behalf of the VM scanner,
+	 * up to REISER4_ENTD_MAX_THREADS.
+	 */
+	PUSH_SB_FIELD_OPT(entd.nr_threads, "%u");
+	/*
+	 * tmgr.group_commit_window=N
+	 * fsync callers arriving within N microseconds share one atom commit.
+	 * 0 (default) disables group commit.
+	 */
+	PUSH_SB_FIELD_OPT(tmgr.group_commit_window, "%u");
+	/*
+	 * tmgr.writeback_depth=N
+	 * write no more than N blocks of overwrite set in-place at a time. 0
+	 * (default) means no limit.
+	 */
+	PUSH_SB_FIELD_OPT(tmgr.writeback_depth, "%u");
+	/*
+	 * tmgr.fsync_slow_ms=N
+	 * log fsync of regular file taking longer than N milliseconds, with
+	 * time of its phases. 0 (default) disables logging.
+	 */
+	PUSH_SB_FIELD_OPT(tmgr.fsync_slow_ms, "%u");
 	/*
 	 * tree.cbk_cache_slots=N
-	 * Number of slots in the cbk cache.
+	 * Number of slots in the cbk cache of each CPU.
 	 */
 	PUSH_SB_FIELD_OPT(tree.cbk_cache.nr_slots, "%u");
+	/*
+	 * tree.pinned_pages=N
+	 * keep up to N pages of twig and upper level nodes in memory when the
+	 * VM scanner tries to release them. 0 disables pinning.
+	 */
+	PUSH_SB_FIELD_OPT(tree.max_pinned, "%u");
+	/*
+	 * tree.max_cached=N
+	 * keep no more than about N pages of formatted nodes in memory,
+	 * releasing clean ones above it. 0 (default) leaves it to the VM.
+	 */
+	PUSH_SB_FIELD_OPT(tree.max_cached, "%u");
 	/*
 	 * If flush finds more than FLUSH_RELOCATE_THRESHOLD adjacent dirty
-	 * leaf-level blocks it will force them to be relocated.
+	 * leaf-level blocks it will force them to be relocated. Default
+	 * depends on the device, see init_relocate_policy().
 	 */
 	PUSH_SB_FIELD_OPT(flush.relocate_threshold, "%u");
 	/*
@@ -389,6 +445,48 @@ static noinline void push_sb_field_opts(struct opt_desc **p,
 	PUSH_SB_FIELD_OPT(flush.written_threshold, "%u");
 	/* The maximum number of nodes to scan left on a level during flush. */
 	PUSH_SB_FIELD_OPT(flush.scan_maxnodes, "%u");
+	/*
+	 * flush.squeeze_min_gain=N
+	 * Skip squeezing into a left neighbor which has less than N percents
+	 * of the block free, unless the right node can be emptied completely.
+	 * Random overwrites otherwise dirty and write many neighbors for a
+	 * few bytes of space. 0 (default) always squeezes.
+	 */
+	PUSH_SB_FIELD_OPT(flush.squeeze_min_gain, "%u");
+	/*
+	 * flush.target_latency=N
+	 * Keep completion latency of writes submitted by flush around N
+	 * microseconds by limiting the number of blocks in flight. 0
+	 * (default) relies on the backing device congestion state only.
+	 */
+	PUSH_SB_FIELD_OPT(flush.target_latency, "%u");
+	/*
+	 * defrag.budget=N
+	 * Let the background defragmenter relocate up to N cached pages of
+	 * fragmented files per pass. 0 (default) disables it.
+	 */
+	PUSH_SB_FIELD_OPT(defrag.budget, "%u");
+	/* defrag.interval=N: seconds between defragmenter passes */
+	PUSH_SB_FIELD_OPT(defrag.interval, "%u");
+	/*
+	 * prealloc_window=N
+	 * Keep files written concurrently contiguous by allocating their
+	 * blocks from per-file windows of N blocks. 0 disables windows.
+	 */
+	PUSH_SB_FIELD_OPT(prealloc_window, "%u");
+	/*
+	 * statfs_cache_age=N
+	 * statfs reports free blocks counted at most N milliseconds ago. 0
+	 * makes every statfs count them.
+	 */
+	PUSH_SB_FIELD_OPT(statfs_cache_age, "%u");
+	/*
+	 * meta_zone=N
+	 * Allocate formatted nodes and wandered blocks in the first N blocks
+	 * of the device and unformatted blocks after them, while there is
+	 * room. For a fast device concatenated in front of a slow one.
+	 */
+	PUSH_SB_FIELD_OPT(meta_zone, "%llu");
 	/* preferred IO size */
 	PUSH_SB_FIELD_OPT(optimal_io_size, "%u");
 	/* carry flags used for insertion of new nodes */
@@ -409,6 +507,36 @@ static noinline void push_sb_field_opts(struct opt_desc **p,
 #endif
 }
 
+/**
+ * init_relocate_policy - choose default relocation parameters of flush
+ * @super: super block of filesystem
+ *
+ * FLUSH_RELOCATE_THRESHOLD and FLUSH_RELOCATE_DISTANCE suit rotating disks.
+ * Zoned devices get flush relocating nearly everything, as overwrites in
+ * place are expensive there. Non-rotational ones get it relocating only long
+ * runs, and consider blocks within an optimal request of the device close
+ * enough. Mount options still override what is chosen here.
+ */
+static void init_relocate_policy(struct super_block *super)
+{
+	struct flush_params *flush = &get_super_private(super)->flush;
+	struct block_device *bdev = super->s_bdev;
+
+	flush->relocate_threshold = FLUSH_RELOCATE_THRESHOLD;
+	flush->relocate_distance = FLUSH_RELOCATE_DISTANCE;
+	if (bdev == NULL)
+		return;
+	if (bdev_is_zoned(bdev)) {
+		flush->relocate_threshold = FLUSH_RELOCATE_THRESHOLD_ZONED;
+		flush->relocate_distance = FLUSH_RELOCATE_DISTANCE_ZONED;
+	} else if (blk_queue_nonrot(bdev_get_queue(bdev))) {
+		flush->relocate_threshold = FLUSH_RELOCATE_THRESHOLD_NONROT;
+		flush->relocate_distance =
+			max_t(unsigned, FLUSH_RELOCATE_DISTANCE_NONROT,
+			      bdev_io_opt(bdev) >> PAGE_SHIFT);
+	}
+}
+
 /**
  * reiser4_init_super_data - initialize reiser4 private super block
  * @super: super block to initialize
@@ -422,6 +550,7 @@ int reiser4_init_super_data(struct super_block *super, char *opt_string)
 	int result;
 	struct opt_desc *opts, *p;
 	reiser4_super_info_data *sbinfo = get_super_private(super);
+	char *journal_dev = NULL;
 
 	/* initialize super, export, dentry operations */
 	sbinfo->ops.super = reiser4_super_operations;
@@ -436,14 +565,28 @@ int reiser4_init_super_data(struct super_block *super, char *opt_string)
 	sbinfo->tmgr.atom_min_size = 256;
 	sbinfo->tmgr.atom_max_flushers = ATOM_MAX_FLUSHERS;
 
+	/* initialize ent thread parameters */
+	sbinfo->entd.nr_threads = REISER4_ENTD_THREADS;
+
 	/* initialize cbk cache parameter */
 	sbinfo->tree.cbk_cache.nr_slots = CBK_CACHE_SLOTS;
+	sbinfo->tree.max_pinned = totalram_pages() / REISER4_PINNED_FRACTION;
+	sbinfo->tree.max_cached = 0;
 
 	/* initialize flush parameters */
-	sbinfo->flush.relocate_threshold = FLUSH_RELOCATE_THRESHOLD;
-	sbinfo->flush.relocate_distance = FLUSH_RELOCATE_DISTANCE;
+	init_relocate_policy(super);
 	sbinfo->flush.written_threshold = FLUSH_WRITTEN_THRESHOLD;
 	sbinfo->flush.scan_maxnodes = FLUSH_SCAN_MAXNODES;
+	sbinfo->flush.squeeze_min_gain = FLUSH_SQUEEZE_MIN_GAIN;
+	reiser4_init_flush_congestion(&sbinfo->flush_cong);
+
+	/* initialize defragmenter parameters */
+	sbinfo->defrag.budget = 0;
+	sbinfo->defrag.interval = REISER4_DEFRAG_INTERVAL;
+
+	sbinfo->prealloc_window = REISER4_PREALLOC_WINDOW;
+
+	sbinfo->statfs_cache_age = REISER4_STATFS_CACHE_AGE;
 
 	sbinfo->optimal_io_size = REISER4_OPTIMAL_IO_SIZE;
 
@@ -454,11 +597,14 @@ int reiser4_init_super_data(struct super_block *super, char *opt_string)
 	sbinfo->tree.carry.paste_flags = REISER4_PASTE_FLAGS;
 	sbinfo->tree.carry.insert_flags = REISER4_INSERT_FLAGS;
 	rwlock_init(&(sbinfo->tree.tree_lock));
-	spin_lock_init(&(sbinfo->tree.epoch_lock));
 
 	/* initialize default readahead params */
 	sbinfo->ra_params.max = totalram_pages() / 4;
 	sbinfo->ra_params.flags = 0;
+	sbinfo->ra_params.window = min_t(unsigned long, REISER4_RA_WINDOW_INIT,
+					 sbinfo->ra_params.max);
+	atomic_set(&sbinfo->ra_params.hits, 0);
+	atomic_set(&sbinfo->ra_params.wasted, 0);
 
 	/* allocate memory for structure describing reiser4 mount options */
 	opts = kmalloc(sizeof(struct opt_desc) * MAX_NR_OPTIONS,
@@ -489,6 +635,20 @@ int reiser4_init_super_data(struct super_block *super, char *opt_string)
 	PUSH_BIT_OPT("discard", REISER4_DISCARD);
 	/* disable hole punching at flush time */
 	PUSH_BIT_OPT("dont_punch_holes", REISER4_DONT_PUNCH_HOLES);
+	/* do not wait for wander records before journal header write */
+	PUSH_BIT_OPT("async_commit", REISER4_ASYNC_COMMIT);
+	/* write wander records in compact format */
+	PUSH_BIT_OPT("compact_journal", REISER4_COMPACT_JOURNAL);
+	/* allocate relocated blocks sequentially, with txmod=wa */
+	PUSH_BIT_OPT("log_alloc", REISER4_LOG_ALLOC);
+	/* delete large files in background */
+	PUSH_BIT_OPT("async_delete", REISER4_ASYNC_DELETE);
+	/* commit only atoms of the file on fdatasync */
+	PUSH_BIT_OPT("narrow_fsync", REISER4_NARROW_FSYNC);
+	/* charge write-back of file pages to cgroups which dirtied them */
+	PUSH_BIT_OPT("cgroup_writeback", REISER4_CGROUP_WRITEBACK);
+	/* choose cluster size of cryptcompress files by their size */
+	PUSH_BIT_OPT("auto_cluster", REISER4_AUTO_CLUSTER);
 
 	PUSH_OPT(p, opts,
 	{
@@ -547,12 +707,29 @@ int reiser4_init_super_data(struct super_block *super, char *opt_string)
 	}
 	);
 
+	/* put journal on a separate device */
+	PUSH_OPT(p, opts,
+	{
+		.name = "journal_dev",
+		.type = OPT_STRING,
+		.u = {
+			.string = &journal_dev
+		}
+	}
+	);
+
 	/* modify default settings to values set by mount options */
 	result = parse_options(opt_string, opts, p - opts);
 	kfree(opts);
 	if (result != 0)
 		return result;
 
+	if (journal_dev != NULL) {
+		result = reiser4_init_jdev(super, journal_dev);
+		if (result != 0)
+			return result;
+	}
+
 	/* correct settings to sanity values */
 	sbinfo->tmgr.atom_max_age *= HZ;
 	if (sbinfo->tmgr.atom_max_age <= 0)
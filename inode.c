@@ -21,6 +21,8 @@
 #include "reiser4.h"
 
 #include <linux/fs.h>		/* for struct super_block,  address_space */
+#include <linux/hash.h>
+#include <linux/mm.h>
 
 /* return reiser4 internal tree which inode belongs to */
 /* Audited by: green(2002.06.17) */
@@ -237,6 +239,137 @@ static int init_inode(struct inode *inode /* inode to intialise */ ,
 	return result;
 }
 
+/* STAT-DATA LOCATION CACHE
+
+   Inode of a file open through NFS (or looked up once in a while) is often
+   evicted between requests, and decoding of its file handle then costs a
+   full tree lookup of the stat-data. To avoid it, each file system keeps a
+   direct-mapped table recording where stat-data of evicted inodes were:
+   the coord and the seal of the stat-data item as the inode had them.
+
+   read_inode() revalidates the remembered seal and reads stat-data at the
+   remembered coord when the node is still in memory and was not modified
+   since, falling back to lookup_sd() otherwise. The seal makes stale slots
+   harmless, so slots are never invalidated, just overwritten by inodes
+   hashed to them. Memory used is fixed 1 << REISER4_SD_CACHE_BITS slots
+   allocated at mount.
+*/
+
+struct sd_cache_slot {
+	oid_t oid;
+	reiser4_key key;
+	seal_t seal;
+	coord_t coord;
+};
+
+/**
+ * reiser4_init_sd_cache - allocate stat-data location cache
+ * @super: super block being mounted
+ *
+ * Failure to allocate is not fatal: stat-data are always looked up then.
+ */
+void reiser4_init_sd_cache(struct super_block *super)
+{
+	struct reiser4_sd_cache *cache = &get_super_private(super)->sd_cache;
+
+	spin_lock_init(&cache->guard);
+	cache->slots = kvcalloc(1 << REISER4_SD_CACHE_BITS,
+				sizeof(struct sd_cache_slot),
+				GFP_KERNEL | __GFP_NOWARN);
+}
+
+/**
+ * reiser4_done_sd_cache - free stat-data location cache
+ * @super: super block being unmounted
+ */
+void reiser4_done_sd_cache(struct super_block *super)
+{
+	struct reiser4_sd_cache *cache = &get_super_private(super)->sd_cache;
+
+	kvfree(cache->slots);
+	cache->slots = NULL;
+}
+
+static struct sd_cache_slot *sd_cache_slot(struct reiser4_sd_cache *cache,
+					   oid_t oid)
+{
+	return &cache->slots[hash_64(oid, REISER4_SD_CACHE_BITS)];
+}
+
+/**
+ * reiser4_sd_cache_remember - remember where stat-data of inode are
+ * @inode: inode being evicted
+ *
+ * Called by ->evict_inode() for inodes which stay on disk.
+ */
+void reiser4_sd_cache_remember(struct inode *inode)
+{
+	struct reiser4_sd_cache *cache;
+	struct sd_cache_slot *slot;
+	reiser4_inode *info;
+	seal_t seal;
+	coord_t coord;
+
+	cache = &get_super_private(inode->i_sb)->sd_cache;
+	if (cache->slots == NULL || is_bad_inode(inode) ||
+	    !is_inode_loaded(inode))
+		return;
+
+	info = reiser4_inode_data(inode);
+	spin_lock_inode(inode);
+	seal = info->sd_seal;
+	coord = info->sd_coord;
+	spin_unlock_inode(inode);
+	if (!reiser4_seal_is_set(&seal))
+		return;
+
+	slot = sd_cache_slot(cache, get_inode_oid(inode));
+	spin_lock(&cache->guard);
+	slot->oid = get_inode_oid(inode);
+	build_sd_key(inode, &slot->key);
+	slot->seal = seal;
+	slot->coord = coord;
+	spin_unlock(&cache->guard);
+}
+
+/* try to find stat-data with key @key at the place remembered by
+   reiser4_sd_cache_remember(). Returns 0 and @coord read-locked by @lh on
+   success, -E_REPEAT if stat-data have to be looked up */
+static int sd_cache_lookup(struct inode *inode, const reiser4_key *key,
+			   coord_t *coord, lock_handle *lh)
+{
+	struct reiser4_sd_cache *cache;
+	struct sd_cache_slot *slot;
+	seal_t seal;
+	int result;
+
+	cache = &get_super_private(inode->i_sb)->sd_cache;
+	if (cache->slots == NULL)
+		return RETERR(-E_REPEAT);
+
+	reiser4_seal_init(&seal, NULL, NULL);
+	slot = sd_cache_slot(cache, get_key_objectid(key));
+	spin_lock(&cache->guard);
+	if (slot->oid == get_key_objectid(key) && keyeq(&slot->key, key)) {
+		seal = slot->seal;
+		*coord = slot->coord;
+	}
+	spin_unlock(&cache->guard);
+
+	result = RETERR(-E_REPEAT);
+	if (reiser4_seal_is_set(&seal))
+		result = reiser4_seal_validate(&seal, coord, key, lh,
+					       ZNODE_READ_LOCK,
+					       ZNODE_LOCK_LOPRI);
+	if (result == 0)
+		reiser4_stat_inc(inode->i_sb, REISER4_STAT_SD_CACHE_HITS);
+	else {
+		reiser4_stat_inc(inode->i_sb, REISER4_STAT_SD_CACHE_MISSES);
+		coord_init_zero(coord);
+	}
+	return result;
+}
+
 /* read `inode' from the disk. This is what was previously in
    reiserfs_read_inode2().
 
@@ -260,7 +393,10 @@ static int read_inode(struct inode *inode /* inode to read from disk */ ,
 	coord_init_zero(&coord);
 	init_lh(&lh);
 	/* locate stat-data in a tree and return znode locked */
-	result = lookup_sd(inode, ZNODE_READ_LOCK, &coord, &lh, key, silent);
+	result = sd_cache_lookup(inode, key, &coord, &lh);
+	if (result != 0)
+		result = lookup_sd(inode, ZNODE_READ_LOCK, &coord, &lh, key,
+				   silent);
 	assert("nikita-301", !is_inode_loaded(inode));
 	if (result == 0) {
 		/* use stat-data plugin to load sd into inode. */
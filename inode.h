@@ -154,11 +154,19 @@ struct reiser4_inode {
 	 * fs/reiser4/search.c:handle_vroot() */
 	reiser4_block_nr vroot;
 	struct mutex loading;
+	/* negative lookup filter of large directory, see
+	 * plugin/dir/lookup_filter.c */
+	struct lookup_filter *lookup_filter;
+	/* numbers of pages recently overwritten and appended by writes, see
+	 * reiser4_txmod_count_write() */
+	unsigned long overwrites;
+	unsigned long appends;
 };
 
 void loading_init_once(reiser4_inode *);
 void loading_alloc(reiser4_inode *);
 void loading_destroy(reiser4_inode *);
+void reiser4_lookup_filter_done(reiser4_inode *);
 
 struct reiser4_inode_object {
 	/* private part */
@@ -332,6 +340,9 @@ extern int setup_inode_ops(struct inode *inode, reiser4_object_create_data *);
 extern struct inode *reiser4_iget(struct super_block *super,
 				  const reiser4_key * key, int silent);
 extern void reiser4_iget_complete(struct inode *inode);
+extern void reiser4_init_sd_cache(struct super_block *super);
+extern void reiser4_done_sd_cache(struct super_block *super);
+extern void reiser4_sd_cache_remember(struct inode *inode);
 extern void reiser4_inode_set_flag(struct inode *inode,
 				   reiser4_file_plugin_flags f);
 extern void reiser4_inode_clr_flag(struct inode *inode,
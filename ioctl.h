@@ -26,6 +26,31 @@
  */
 #define REISER4_IOC_UNPACK _IOW(0xCD, 1, long)
 
+/*
+ * ioctl(2) command used to defragment reiser4 file built of extents. Pages
+ * of the range are read, captured and committed with relocation forced, so
+ * that flush writes them to contiguous free space found by block allocator.
+ *
+ * This ioctl should be used as
+ *
+ *     struct reiser4_defrag_range range = { .start = 0, .len = 0 };
+ *
+ *     result = ioctl(fd, REISER4_IOC_DEFRAG, &range);
+ *
+ * @len equal to 0 means up to the end of file. On return @extents_before
+ * and @extents_after are numbers of runs of physically contiguous blocks the
+ * range was stored in before and after defragmentation. File descriptor has
+ * to be open for writing.
+ */
+struct reiser4_defrag_range {
+	__u64 start;
+	__u64 len;
+	__u64 extents_before;
+	__u64 extents_after;
+};
+
+#define REISER4_IOC_DEFRAG _IOWR(0xCD, 2, struct reiser4_defrag_range)
+
 /* __REISER4_IOCTL_H__ */
 #endif
 
@@ -0,0 +1,316 @@
+/* Copyright 2001, 2002, 2003, 2004 by Hans Reiser, licensing governed by
+ * reiser4/README */
+
+/* External journal device.
+
+   With journal_dev=PATH mount option the journal header, the journal footer,
+   the wander records and the wandered blocks are placed on a separate block
+   device, so that commit does not seek over the main device. The layout of
+   the journal device is: super block (struct jdev_super), journal header,
+   journal footer, then the area wandered blocks and wander records are
+   allocated from. Space of that area is not accounted in the main device
+   counters, when it is exhausted the wandered blocks are allocated on the
+   main device as usual (see get_more_wandered_blocks()).
+
+   The journal device is formatted on first use. This is refused if the
+   journal on the main device has transactions to replay. Once used, the
+   journal device must be given on every mount, otherwise the transactions
+   committed to it are not replayed.
+
+   Cache flushes of the journal device do not cover the main device, so the
+   main device is flushed explicitly before the journal header and the
+   journal footer are written (see reiser4_jdev_flush_data()).
+*/
+
+#include "debug.h"
+#include "super.h"
+#include "wander.h"
+#include "jdev.h"
+
+#include <linux/blkdev.h>
+#include <linux/buffer_head.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+
+#define JDEV_MODE (FMODE_READ | FMODE_WRITE | FMODE_EXCL)
+
+/**
+ * reiser4_init_jdev - open external journal device
+ * @super: super block being mounted
+ * @path: journal device path from mount options
+ *
+ * This is called on mount, before disk format is initialized. The device is
+ * checked and formatted later by reiser4_jdev_attach(), when block size is
+ * known.
+ */
+int reiser4_init_jdev(struct super_block *super, const char *path)
+{
+	reiser4_super_info_data *sbinfo = get_super_private(super);
+	reiser4_jdev *jdev;
+	struct block_device *bdev;
+
+	assert("", sbinfo->jdev == NULL);
+
+	if (BITS_PER_LONG < 64) {
+		/* page indices of io heads must hold REISER4_JDEV_BASE */
+		warning("", "%s: journal_dev needs a 64 bit kernel",
+			super->s_id);
+		return RETERR(-EINVAL);
+	}
+
+	bdev = blkdev_get_by_path(path, JDEV_MODE, super);
+	if (IS_ERR(bdev)) {
+		warning("", "%s: cannot open journal device %s: %ld",
+			super->s_id, path, PTR_ERR(bdev));
+		return PTR_ERR(bdev);
+	}
+	if (bdev == super->s_bdev) {
+		blkdev_put(bdev, JDEV_MODE);
+		return RETERR(-EINVAL);
+	}
+
+	jdev = kzalloc(sizeof(*jdev), GFP_KERNEL);
+	if (jdev == NULL) {
+		blkdev_put(bdev, JDEV_MODE);
+		return RETERR(-ENOMEM);
+	}
+	jdev->bdev = bdev;
+	spin_lock_init(&jdev->guard);
+	sbinfo->jdev = jdev;
+	return 0;
+}
+
+/**
+ * reiser4_done_jdev - close external journal device
+ * @super: super block being unmounted
+ */
+void reiser4_done_jdev(struct super_block *super)
+{
+	reiser4_super_info_data *sbinfo = get_super_private(super);
+	reiser4_jdev *jdev = sbinfo->jdev;
+
+	if (jdev == NULL)
+		return;
+	kvfree(jdev->map);
+	blkdev_put(jdev->bdev, JDEV_MODE);
+	kfree(jdev);
+	sbinfo->jdev = NULL;
+}
+
+/* size of journal device in file system blocks */
+static reiser4_block_nr jdev_size(struct super_block *super)
+{
+	return i_size_read(get_super_private(super)->jdev->bdev->bd_inode) >>
+		super->s_blocksize_bits;
+}
+
+/**
+ * reiser4_jdev_attach - check super block of journal device
+ * @super: super block being mounted
+ *
+ * Returns 0 if the journal device is formatted for this file system, 1 if it
+ * is to be formatted, negative error code otherwise.
+ */
+int reiser4_jdev_attach(struct super_block *super)
+{
+	reiser4_jdev *jdev = get_super_private(super)->jdev;
+	struct buffer_head *bh;
+	struct jdev_super *js;
+	reiser4_block_nr nr;
+	int ret = 0;
+
+	nr = jdev_size(super);
+	if (nr <= REISER4_JDEV_AREA_START) {
+		warning("", "%s: journal device is too small", super->s_id);
+		return RETERR(-EINVAL);
+	}
+
+	bh = __bread(jdev->bdev, REISER4_JDEV_SUPER_BLOCKNR,
+		     super->s_blocksize);
+	if (bh == NULL)
+		return RETERR(-EIO);
+	js = (struct jdev_super *)bh->b_data;
+	if (memcmp(js->magic, REISER4_JDEV_MAGIC, REISER4_JDEV_MAGIC_SIZE))
+		ret = 1;
+	else if (le32_to_cpu(get_unaligned(&js->blocksize)) !=
+		 super->s_blocksize) {
+		warning("", "%s: journal device block size mismatch",
+			super->s_id);
+		ret = RETERR(-EINVAL);
+	}
+	brelse(bh);
+	if (ret < 0)
+		return ret;
+
+	jdev->nr_blocks = nr - REISER4_JDEV_AREA_START;
+	jdev->map = kvzalloc(BITS_TO_LONGS(jdev->nr_blocks) * sizeof(long),
+			     GFP_KERNEL);
+	if (jdev->map == NULL)
+		return RETERR(-ENOMEM);
+	return ret;
+}
+
+/* write zeroed block @block of journal device, put super block there if
+   @js is not NULL */
+static int jdev_write_block(struct super_block *super, sector_t block,
+			    const struct jdev_super *js)
+{
+	reiser4_jdev *jdev = get_super_private(super)->jdev;
+	struct buffer_head *bh;
+	int ret;
+
+	bh = __getblk(jdev->bdev, block, super->s_blocksize);
+	if (bh == NULL)
+		return RETERR(-ENOMEM);
+	lock_buffer(bh);
+	memset(bh->b_data, 0, super->s_blocksize);
+	if (js != NULL)
+		memcpy(bh->b_data, js, sizeof(*js));
+	set_buffer_uptodate(bh);
+	mark_buffer_dirty(bh);
+	unlock_buffer(bh);
+	ret = sync_dirty_buffer(bh);
+	brelse(bh);
+	return ret;
+}
+
+/**
+ * reiser4_jdev_format - format journal device
+ * @super: super block being mounted
+ *
+ * Writes empty journal header and footer, then super block of the journal
+ * device. Journal of the main device must have been checked to be empty.
+ */
+int reiser4_jdev_format(struct super_block *super)
+{
+	struct jdev_super js;
+	int ret;
+
+	memset(&js, 0, sizeof(js));
+	memcpy(js.magic, REISER4_JDEV_MAGIC, REISER4_JDEV_MAGIC_SIZE);
+	put_unaligned(cpu_to_le32(super->s_blocksize), &js.blocksize);
+	put_unaligned(cpu_to_le64(jdev_size(super)), &js.nr_blocks);
+
+	ret = jdev_write_block(super, REISER4_JDEV_HEADER_BLOCKNR, NULL);
+	if (ret == 0)
+		ret = jdev_write_block(super, REISER4_JDEV_FOOTER_BLOCKNR, NULL);
+	if (ret == 0)
+		ret = jdev_write_block(super, REISER4_JDEV_SUPER_BLOCKNR, &js);
+	if (ret == 0)
+		printk("reiser4: %s: journal device formatted\n", super->s_id);
+	return ret;
+}
+
+/**
+ * reiser4_jdev_alloc - allocate blocks on journal device
+ * @super: super block
+ * @count: number of blocks wanted
+ * @start: first allocated block
+ * @len: number of allocated blocks, up to @count
+ *
+ * Allocates one run of adjacent free blocks. Returns -ENOSPC if the area is
+ * full.
+ */
+int reiser4_jdev_alloc(struct super_block *super, reiser4_block_nr count,
+		       reiser4_block_nr *start, reiser4_block_nr *len)
+{
+	reiser4_jdev *jdev = get_super_private(super)->jdev;
+	unsigned long first;
+	unsigned long end;
+
+	assert("", jdev != NULL && jdev->map != NULL);
+	assert("", count > 0);
+
+	spin_lock(&jdev->guard);
+	first = find_next_zero_bit(jdev->map, jdev->nr_blocks, jdev->cursor);
+	if (first >= jdev->nr_blocks)
+		first = find_first_zero_bit(jdev->map, jdev->nr_blocks);
+	if (first >= jdev->nr_blocks) {
+		spin_unlock(&jdev->guard);
+		return RETERR(-ENOSPC);
+	}
+	end = find_next_bit(jdev->map, min_t(reiser4_block_nr,
+					     jdev->nr_blocks, first + count),
+			    first);
+	bitmap_set(jdev->map, first, end - first);
+	jdev->cursor = end;
+	spin_unlock(&jdev->guard);
+
+	*start = REISER4_JDEV_BASE + REISER4_JDEV_AREA_START + first;
+	*len = end - first;
+	return 0;
+}
+
+/**
+ * reiser4_jdev_free - free blocks allocated by reiser4_jdev_alloc()
+ * @super: super block
+ * @start: first block to free
+ * @len: number of blocks
+ */
+void reiser4_jdev_free(struct super_block *super,
+		       const reiser4_block_nr *start, reiser4_block_nr len)
+{
+	reiser4_jdev *jdev = get_super_private(super)->jdev;
+	reiser4_block_nr first;
+
+	first = *start - REISER4_JDEV_BASE - REISER4_JDEV_AREA_START;
+	assert("", *start >= REISER4_JDEV_BASE + REISER4_JDEV_AREA_START);
+	assert("", first + len <= jdev->nr_blocks);
+
+	spin_lock(&jdev->guard);
+	bitmap_clear(jdev->map, first, len);
+	spin_unlock(&jdev->guard);
+}
+
+/**
+ * reiser4_jdev_flush_data - flush write cache of the main device
+ * @super: super block
+ *
+ * Called before journal header and footer are written to the journal device:
+ * REQ_PREFLUSH of those writes does not make writes to the main device
+ * durable. Does nothing if there is no journal device.
+ */
+int reiser4_jdev_flush_data(struct super_block *super)
+{
+	struct bio *bio;
+	int ret;
+
+	if (get_super_private(super)->jdev == NULL)
+		return 0;
+
+	bio = bio_alloc(GFP_NOIO, 0);
+	if (bio == NULL)
+		return RETERR(-ENOMEM);
+	bio_set_dev(bio, super->s_bdev);
+	bio_set_op_attrs(bio, WRITE, REQ_PREFLUSH);
+	ret = submit_bio_wait(bio);
+	bio_put(bio);
+	return ret;
+}
+
+/**
+ * reiser4_bio_set_block - set device and start sector of bio
+ * @bio: bio to set up
+ * @super: super block
+ * @block: block number, either on main or on journal device
+ */
+void reiser4_bio_set_block(struct bio *bio, struct super_block *super,
+			   reiser4_block_nr block)
+{
+	if (reiser4_is_jdev_block(super, &block)) {
+		bio_set_dev(bio, get_super_private(super)->jdev->bdev);
+		block -= REISER4_JDEV_BASE;
+	} else
+		bio_set_dev(bio, super->s_bdev);
+	bio->bi_iter.bi_sector = block * (super->s_blocksize >> 9);
+}
+
+/* Make Linus happy.
+   Local variables:
+   c-indentation-style: "K&R"
+   mode-name: "LC"
+   c-basic-offset: 8
+   tab-width: 8
+   fill-column: 120
+   End:
+*/
@@ -0,0 +1,83 @@
+/* Copyright 2001, 2002, 2003, 2004 by Hans Reiser, licensing governed by
+ * reiser4/README */
+
+/* External journal device. See jdev.c for comments. */
+
+#ifndef __REISER4_JDEV_H__
+#define __REISER4_JDEV_H__
+
+#include "dformat.h"
+#include "super.h"
+
+#include <linux/fs.h>
+#include <linux/bio.h>
+#include <linux/spinlock.h>
+
+/* Blocks of the journal device are addressed as REISER4_JDEV_BASE + n, so
+   that they can be stored in wander records and used as page indices of the
+   fake inode for io heads like blocks of the main device. */
+#define REISER4_JDEV_BASE ((reiser4_block_nr)1 << 40)
+
+#define REISER4_JDEV_MAGIC "R4ExtJnl"
+#define REISER4_JDEV_MAGIC_SIZE (8)
+
+/* layout of the journal device */
+#define REISER4_JDEV_SUPER_BLOCKNR (0)
+#define REISER4_JDEV_HEADER_BLOCKNR (1)
+#define REISER4_JDEV_FOOTER_BLOCKNR (2)
+/* first block of the area for wandered blocks and wander records */
+#define REISER4_JDEV_AREA_START (3)
+
+/* block 0 of the journal device */
+struct jdev_super {
+	char magic[REISER4_JDEV_MAGIC_SIZE];
+	d32 blocksize;
+	d32 reserved;
+	d64 nr_blocks;
+};
+
+typedef struct reiser4_jdev {
+	struct block_device *bdev;
+	/* size of the wandered area in blocks */
+	reiser4_block_nr nr_blocks;
+	spinlock_t guard;
+	/* bitmap of used blocks of the wandered area, it is not stored on
+	   disk: nothing is allocated there until journal replay is done */
+	unsigned long *map;
+	/* where to start search of free blocks */
+	reiser4_block_nr cursor;
+} reiser4_jdev;
+
+extern int reiser4_init_jdev(struct super_block *, const char *path);
+extern void reiser4_done_jdev(struct super_block *);
+extern int reiser4_jdev_attach(struct super_block *);
+extern int reiser4_jdev_format(struct super_block *);
+extern int reiser4_jdev_alloc(struct super_block *, reiser4_block_nr count,
+			      reiser4_block_nr *start, reiser4_block_nr *len);
+extern void reiser4_jdev_free(struct super_block *,
+			      const reiser4_block_nr *start,
+			      reiser4_block_nr len);
+extern int reiser4_jdev_flush_data(struct super_block *);
+extern void reiser4_bio_set_block(struct bio *, struct super_block *,
+				  reiser4_block_nr);
+
+/* true if @block is on the journal device of @super */
+static inline int reiser4_is_jdev_block(const struct super_block *super,
+					const reiser4_block_nr *block)
+{
+	return get_super_private(super)->jdev != NULL &&
+		*block >= REISER4_JDEV_BASE;
+}
+
+/* __REISER4_JDEV_H__ */
+#endif
+
+/* Make Linus happy.
+   Local variables:
+   c-indentation-style: "K&R"
+   mode-name: "LC"
+   c-basic-offset: 8
+   tab-width: 8
+   fill-column: 120
+   End:
+*/
@@ -55,6 +55,10 @@
  *         . during memory pressure, VM calls ->releasepage() method
  *         (reiser4_releasepage()) to evict page from memory.
  *
+ *         . during memory pressure, jnode shrinker detaches jnode from clean
+ *         unformatted page which stays in the page cache (see
+ *         shed_page_jnode()).
+ *
  *    (there, of course, is also umount, but this is special case we are not
  *    concerned with here).
  *
@@ -114,6 +118,7 @@
 #include "super.h"
 #include "inode.h"
 #include "page_cache.h"
+#include "magazine.h"
 
 #include <asm/uaccess.h>	/* UML needs this for PAGE_OFFSET */
 #include <linux/types.h>
@@ -122,8 +127,11 @@
 #include <linux/swap.h>
 #include <linux/fs.h>		/* for struct address_space  */
 #include <linux/writeback.h>	/* for inode_wb_list_lock */
+#include <linux/hash.h>
+#include <linux/vmalloc.h>
+#include <linux/blkdev.h>	/* for struct blk_plug */
 
-static struct kmem_cache *_jnode_slab = NULL;
+static reiser4_mag_cache jnode_cache;
 
 static void jnode_set_type(jnode * node, jnode_type type);
 static int jdelete(jnode * node);
@@ -155,11 +163,16 @@ static inline int jnode_key_eq(const struct jnode_key *k1,
 static inline __u32 jnode_key_hashfn(j_hash_table * table,
 				     const struct jnode_key *key)
 {
+	__u32 buckets;
+
 	assert("nikita-2352", key != NULL);
-	assert("nikita-3346", IS_POW(table->_buckets));
 
-	/* yes, this is remarkable simply (where not stupid) hash function. */
-	return (key->objectid + key->index) & (table->_buckets - 1);
+	/* table can be resized under RCU readers, read its size once */
+	buckets = READ_ONCE(table->_buckets);
+	assert("nikita-3346", IS_POW(buckets));
+
+	return hash_64(key->objectid ^ hash_64(key->index, 64), 32) &
+		(buckets - 1);
 }
 
 /* The hash table definition */
@@ -174,7 +187,48 @@ TYPE_SAFE_HASH_DEFINE(j, jnode, struct jnode_key, key.j, link.j,
 int jnodes_tree_init(reiser4_tree * tree/* tree to initialise jnodes for */)
 {
 	assert("nikita-2359", tree != NULL);
-	return j_hash_init(&tree->jhash_table, 16384);
+	return j_hash_init(&tree->jhash_table, REISER4_JNODE_HASH_TABLE_SIZE);
+}
+
+/**
+ * jnodes_tree_grow - grow overloaded jnode hash table
+ * @tree: tree whose table to grow
+ *
+ * This is called from the tree's hash_resize work, see znodes_tree_grow().
+ */
+void jnodes_tree_grow(reiser4_tree * tree)
+{
+	j_hash_table *jtable = &tree->jhash_table;
+	jnode **new_table;
+	jnode **old_table;
+	__u32 buckets;
+
+	if (!j_hash_overloaded(jtable, REISER4_HASH_MAX_LOAD) ||
+	    jtable->_buckets >= REISER4_HASH_MAX_BUCKETS)
+		return;
+	buckets = jtable->_buckets * 2;
+	new_table = __vmalloc(sizeof(jnode *) * buckets,
+			      GFP_NOFS | __GFP_NOWARN | __GFP_ZERO);
+	if (new_table == NULL)
+		return;
+	/* there is no reiser4 context here, lock counters are not updated */
+	write_lock(&tree->tree_lock);
+	old_table = j_hash_rehash(jtable, new_table, buckets);
+	write_unlock(&tree->tree_lock);
+	synchronize_rcu();
+	vfree(old_table);
+}
+
+/**
+ * jnodes_tree_stat - collect chain length statistics of jnode hash table
+ * @tree: tree to look at
+ * @stat: where to put statistics
+ */
+void jnodes_tree_stat(reiser4_tree * tree, struct hash_chain_stat *stat)
+{
+	read_lock(&tree->tree_lock);
+	j_hash_stat(&tree->jhash_table, stat);
+	read_unlock(&tree->tree_lock);
 }
 
 /* call this to destroy jnode hash table. This is called during umount. */
@@ -208,15 +262,11 @@ int jnodes_tree_done(reiser4_tree * tree/* tree to destroy jnodes for */)
  */
 int init_jnodes(void)
 {
-	assert("umka-168", _jnode_slab == NULL);
+	assert("umka-168", jnode_cache.slab == NULL);
 
-	_jnode_slab = kmem_cache_create("jnode", sizeof(jnode), 0,
-					SLAB_HWCACHE_ALIGN |
-					SLAB_RECLAIM_ACCOUNT, NULL);
-	if (_jnode_slab == NULL)
-		return RETERR(-ENOMEM);
-
-	return 0;
+	return reiser4_init_mag_cache(&jnode_cache, "jnode", sizeof(jnode),
+				      SLAB_HWCACHE_ALIGN |
+				      SLAB_RECLAIM_ACCOUNT);
 }
 
 /**
@@ -226,7 +276,7 @@ int init_jnodes(void)
  */
 void done_jnodes(void)
 {
-	destroy_reiser4_cache(&_jnode_slab);
+	reiser4_done_mag_cache(&jnode_cache);
 }
 
 /* Initialize a jnode. */
@@ -286,11 +336,12 @@ jnode *jnode_by_page(struct page *pg)
 /* exported functions to allocate/free jnode objects outside this file */
 jnode *jalloc(void)
 {
-	jnode *jal = kmem_cache_alloc(_jnode_slab, reiser4_ctx_gfp_mask_get());
+	jnode *jal = reiser4_mag_alloc(&jnode_cache,
+				       reiser4_ctx_gfp_mask_get());
 	return jal;
 }
 
-/* return jnode back to the slab allocator */
+/* return jnode back to the per-CPU magazine */
 inline void jfree(jnode * node)
 {
 	assert("nikita-2663", (list_empty_careful(&node->capture_link) &&
@@ -300,7 +351,7 @@ inline void jfree(jnode * node)
 
 	/* not yet phash_jnode_destroy(node); */
 
-	kmem_cache_free(_jnode_slab, node);
+	reiser4_mag_free(&jnode_cache, node);
 }
 
 /*
@@ -340,17 +391,18 @@ static inline void jnode_free(jnode * node, jnode_type jtype)
 {
 	if (jtype != JNODE_INODE) {
 		/*assert("nikita-3219", list_empty(&node->rcu.list)); */
-		call_rcu(&node->rcu, jnode_free_actor);
+		reiser4_call_rcu(&node->rcu, jnode_free_actor);
 	} else
 		jnode_list_remove(node);
 }
 
-/* allocate new unformatted jnode */
-static jnode *jnew_unformatted(void)
+/* allocate new unformatted jnode on NUMA node @nid, the node of its page */
+static jnode *jnew_unformatted(int nid)
 {
 	jnode *jal;
 
-	jal = jalloc();
+	jal = reiser4_mag_alloc_node(&jnode_cache, reiser4_ctx_gfp_mask_get(),
+				     nid);
 	if (jal == NULL)
 		return NULL;
 
@@ -376,7 +428,7 @@ jnode *jlookup(reiser4_tree * tree, oid_t objectid, unsigned long index)
 	 */
 
 	rcu_read_lock();
-	node = j_hash_find(&tree->jhash_table, &jkey);
+	node = j_hash_find_rcu(&tree->jhash_table, &jkey);
 	if (node != NULL) {
 		/* protect @node from recycling */
 		jref(node);
@@ -387,7 +439,7 @@ jnode *jlookup(reiser4_tree * tree, oid_t objectid, unsigned long index)
 	return node;
 }
 
-/* per inode radix tree of jnodes is protected by tree's read write spin lock */
+/* per inode radix tree of jnodes is modified under tree's write lock */
 static jnode *jfind_nolock(struct address_space *mapping, unsigned long index)
 {
 	assert("vs-1694", mapping->host != NULL);
@@ -395,6 +447,15 @@ static jnode *jfind_nolock(struct address_space *mapping, unsigned long index)
 	return radix_tree_lookup(jnode_tree_by_inode(mapping->host), index);
 }
 
+/*
+ * look for jnode of page @index of @mapping in inode's radix tree of jnodes.
+ *
+ * Like jlookup() this takes no locks: radix tree nodes and jnodes are freed
+ * after RCU grace period, and jnodes being freed concurrently are detected
+ * by jnode_rip_check(). Jnode removed from the inode's tree after it was
+ * found is not returned either, so that callers see what they would have
+ * seen under tree lock.
+ */
 jnode *jfind(struct address_space *mapping, unsigned long index)
 {
 	reiser4_tree *tree;
@@ -403,11 +464,19 @@ jnode *jfind(struct address_space *mapping, unsigned long index)
 	assert("vs-1694", mapping->host != NULL);
 	tree = reiser4_tree_by_inode(mapping->host);
 
-	read_lock_tree(tree);
+	rcu_read_lock();
 	node = jfind_nolock(mapping, index);
-	if (node != NULL)
+	if (node != NULL) {
+		/* protect @node from recycling */
 		jref(node);
-	read_unlock_tree(tree);
+		node = jnode_rip_check(tree, node);
+	}
+	rcu_read_unlock();
+	if (node != NULL && unlikely(READ_ONCE(node->key.j.mapping) != mapping ||
+				     READ_ONCE(node->key.j.index) != index)) {
+		jput(node);
+		node = NULL;
+	}
 	return node;
 }
 
@@ -493,6 +562,9 @@ hash_unformatted_jnode(jnode * node, struct address_space *mapping,
 	 */
 	/* assert("nikita-3211", j_hash_find(jtable, &node->key.j) == NULL); */
 	j_hash_insert_rcu(jtable, node);
+	if (unlikely(j_hash_overloaded(jtable, REISER4_HASH_MAX_LOAD) &&
+		     jtable->_buckets < REISER4_HASH_MAX_BUCKETS))
+		schedule_work(&jnode_get_tree(node)->hash_resize);
 	inode_attach_jnode(node);
 }
 
@@ -526,18 +598,18 @@ void unhash_unformatted_jnode(jnode * node)
 
 /*
  * search hash table for a jnode with given oid and index. If not found,
- * allocate new jnode, insert it, and also insert into radix tree for the
- * given inode/mapping.
+ * allocate new jnode on node @nid, insert it, and also insert into radix tree
+ * for the given inode/mapping.
  */
 static jnode *find_get_jnode(reiser4_tree * tree,
 			     struct address_space *mapping,
-			     oid_t oid, unsigned long index)
+			     oid_t oid, unsigned long index, int nid)
 {
 	jnode *result;
 	jnode *shadow;
 	int preload;
 
-	result = jnew_unformatted();
+	result = jnew_unformatted(nid);
 
 	if (unlikely(result == NULL))
 		return ERR_PTR(RETERR(-ENOMEM));
@@ -610,7 +682,8 @@ static jnode *do_jget(reiser4_tree * tree, struct page *pg)
 
 	/* since page is locked, jnode should be allocated with GFP_NOFS flag */
 	reiser4_ctx_gfp_mask_force(GFP_NOFS);
-	result = find_get_jnode(tree, pg->mapping, oid, pg->index);
+	result = find_get_jnode(tree, pg->mapping, oid, pg->index,
+				page_to_nid(pg));
 	if (unlikely(IS_ERR(result)))
 		return result;
 	/* attach jnode to page */
@@ -655,6 +728,31 @@ jnode *jnode_of_page(struct page *pg)
 
 /* attach page to jnode: set ->pg pointer in jnode, and ->private one in the
  * page.*/
+/* true if @node is a formatted node of twig level or above */
+static inline int jnode_is_upper(const jnode *node)
+{
+	return jnode_is_znode(node) &&
+		znode_get_level(JZNODE(node)) >= TWIG_LEVEL;
+}
+
+/**
+ * jnode_is_pinned - check whether page of @node should stay in memory
+ * @node: jnode to check
+ *
+ * Pages of twig and upper level nodes are looked up on every tree traversal
+ * but only through the jnode, so the VM never sees them referenced and a
+ * large scan of leaves or file data evicts them first. Up to
+ * tree->max_pinned of them are kept by refusing to release them.
+ */
+int jnode_is_pinned(const jnode *node)
+{
+	reiser4_tree *tree = jnode_get_tree(node);
+
+	return jnode_is_upper(node) &&
+		atomic_read(&tree->nr_upper_pages) <=
+		READ_ONCE(tree->max_pinned);
+}
+
 void jnode_attach_page(jnode * node, struct page *pg)
 {
 	assert("nikita-2060", node != NULL);
@@ -671,6 +769,8 @@ void jnode_attach_page(jnode * node, struct page *pg)
 	set_page_private(pg, (unsigned long)node);
 	node->pg = pg;
 	SetPagePrivate(pg);
+	if (jnode_is_upper(node))
+		atomic_inc(&jnode_get_tree(node)->nr_upper_pages);
 }
 
 /* Dual to jnode_attach_page: break a binding between page and jnode */
@@ -682,11 +782,15 @@ void page_clear_jnode(struct page *page, jnode * node)
 
 	assert("nikita-3551", !PageWriteback(page));
 
+	if (unlikely(JF_ISSET(node, JNODE_READAHEAD)))
+		reiser4_ra_wasted(node);
 	JF_CLR(node, JNODE_PARSED);
 	set_page_private(page, 0ul);
 	ClearPagePrivate(page);
 	node->pg = NULL;
 	put_page(page);
+	if (jnode_is_upper(node))
+		atomic_dec(&jnode_get_tree(node)->nr_upper_pages);
 }
 
 #if 0
@@ -823,6 +927,7 @@ static int jnode_start_read(jnode * node, struct page *page)
 		unlock_page(page);
 		return 0;
 	}
+	reiser4_stat_inc(jnode_get_tree(node)->super, REISER4_STAT_NODE_READS);
 	return reiser4_page_io(page, node, READ, reiser4_ctx_gfp_mask_get());
 }
 
@@ -853,6 +958,95 @@ void jload_prefetch(jnode * node)
 	prefetchw(&node->x_count);
 }
 
+/* start read of @node unless it is in memory already or has no block on
+ * disk yet. The page is added to @rbio, so that nodes in contiguous blocks
+ * are read by one bio; @left is the number of nodes still to be prefetched,
+ * to size new bio. Returns 1 if read was started */
+static int jprefetch(jnode *node, reiser4_read_bio *rbio, int left)
+{
+	struct page *page;
+	reiser4_block_nr blocknr;
+
+	if (node == NULL || jnode_is_parsed(node) ||
+	    reiser4_blocknr_is_fake(jnode_get_block(node)) ||
+	    jnode_page(node) != NULL)
+		return 0;
+	/* somebody else is setting up the page, do not wait for its lock
+	 * while holding locks of pages in @rbio */
+	page = find_get_page(jnode_get_mapping(node), jnode_get_index(node));
+	if (page != NULL) {
+		put_page(page);
+		return 0;
+	}
+	page = jnode_get_page_locked(node, reiser4_ctx_gfp_mask_get());
+	if (IS_ERR(page))
+		return 0;
+	if (PageUptodate(page) || PageWriteback(page)) {
+		unlock_page(page);
+		return 0;
+	}
+	reiser4_stat_inc(jnode_get_tree(node)->super, REISER4_STAT_NODE_READS);
+
+	spin_lock_jnode(node);
+	blocknr = *jnode_get_io_block(node);
+	spin_unlock_jnode(node);
+	if (reiser4_read_bio_add(rbio, page, blocknr, left) == 0)
+		return 1;
+	/* no memory for new bio, try single page one */
+	return reiser4_page_io(page, node, READ,
+			       reiser4_ctx_gfp_mask_get()) == 0;
+}
+
+/**
+ * jload_prefetch_batch - start reads of several jnodes
+ * @nodes: jnodes to read, NULL entries are skipped
+ * @nr: number of entries in @nodes
+ *
+ * Pages of nodes in contiguous blocks are read by multi-page bios, each page
+ * is unlocked by bio completion as it is for single page reads. Bios are
+ * submitted under one block plug, so that the block layer can merge reads of
+ * nearby blocks further. Does not wait for i/o completion: jload() of any of
+ * @nodes waits for its page as usual. Caller keeps references to
+ * @nodes. Returns the number of reads started.
+ */
+int jload_prefetch_batch(jnode **nodes, int nr)
+{
+	reiser4_read_bio rbio = { .bio = NULL };
+	struct blk_plug plug;
+	int started = 0;
+	int i;
+
+	blk_start_plug(&plug);
+	for (i = 0; i < nr; i++)
+		started += jprefetch(nodes[i], &rbio, nr - i);
+	reiser4_read_bio_submit(&rbio);
+	blk_finish_plug(&plug);
+	return started;
+}
+
+/**
+ * zload_prefetch_batch - start reads of several znodes
+ * @nodes: znodes to read, NULL entries are skipped
+ * @nr: number of entries in @nodes
+ *
+ * This is jload_prefetch_batch() for arrays of znodes.
+ */
+int zload_prefetch_batch(znode **nodes, int nr)
+{
+	reiser4_read_bio rbio = { .bio = NULL };
+	struct blk_plug plug;
+	int started = 0;
+	int i;
+
+	blk_start_plug(&plug);
+	for (i = 0; i < nr; i++)
+		if (nodes[i] != NULL)
+			started += jprefetch(ZJNODE(nodes[i]), &rbio, nr - i);
+	reiser4_read_bio_submit(&rbio);
+	blk_finish_plug(&plug);
+	return started;
+}
+
 /* load jnode's data into memory */
 int jload_gfp(jnode * node /* node to load */ ,
 	      gfp_t gfp_flags /* allocation flags */ ,
@@ -879,6 +1073,9 @@ int jload_gfp(jnode * node /* node to load */ ,
 	parsed = jnode_is_parsed(node);
 	spin_unlock(&(node->load));
 
+	if (unlikely(JF_ISSET(node, JNODE_READAHEAD)))
+		reiser4_ra_hit(node);
+
 	if (unlikely(!parsed)) {
 		page = jnode_get_page_locked(node, gfp_flags);
 		if (unlikely(IS_ERR(page))) {
@@ -906,6 +1103,9 @@ int jload_gfp(jnode * node /* node to load */ ,
 			goto failed;
 		}
 		check_jload(node, page);
+		if (jnode_is_znode(node))
+			reiser4_check_cache_budget(jnode_get_tree(node),
+						   page->mapping);
 	} else {
 		page = jnode_page(node);
 		check_jload(node, page);
@@ -1283,7 +1483,7 @@ static void delete_znode(jnode * node, reiser4_tree * tree)
 	assert("vs-898", JF_ISSET(node, JNODE_HEARD_BANSHEE));
 
 	z = JZNODE(node);
-	assert("vs-899", z->c_count == 0);
+	assert("vs-899", atomic_read(&z->c_count) == 0);
 
 	/* delete znode from sibling list. */
 	sibling_list_remove(z);
@@ -1299,7 +1499,7 @@ static int remove_znode(jnode * node, reiser4_tree * tree)
 	assert_rw_write_locked(&(tree->tree_lock));
 	z = JZNODE(node);
 
-	if (z->c_count == 0) {
+	if (atomic_read(&z->c_count) == 0) {
 		/* detach znode from sibling list. */
 		sibling_list_drop(z);
 		/* this is called with tree spin-lock held, so call
@@ -1474,7 +1674,8 @@ static inline int jnode_is_busy(const jnode * node, jnode_type jtype)
 	if (atomic_read(&node->x_count) > 0)
 		return 1;
 	/* also, don't free znode that has children in memory */
-	if (jtype == JNODE_FORMATTED_BLOCK && JZNODE(node)->c_count > 0)
+	if (jtype == JNODE_FORMATTED_BLOCK &&
+	    atomic_read(&JZNODE(node)->c_count) > 0)
 		return 1;
 	return 0;
 }
@@ -225,6 +225,10 @@ typedef enum {
 	/* znode lock is being invalidated */
 	JNODE_IS_DYING = 9,
 
+	/* read of znode was started by formatted readahead and the node was
+	   not loaded since, see readahead.c */
+	JNODE_READAHEAD = 10,
+
 	/* THIS PLACE IS INTENTIONALLY LEFT BLANK */
 
 	/* jnode is queued for flushing. */
@@ -260,6 +264,11 @@ typedef enum {
 	JNODE_REPACK = 23,
 	/* node should be converted by flush in squalloc phase */
 	JNODE_CONVERTIBLE = 24,
+	/* znode was added to the cbk cache of some CPU, see search.c */
+	JNODE_CBK_CACHED = 25,
+	/* checksum in node data is up to date: node was not modified since
+	   it was set by ->csum(), see znode_make_dirty() */
+	JNODE_CSUM_SET = 26,
 	/*
 	 * When jnode is dirtied for the first time in given transaction,
 	 * do_jnode_make_dirty() checks whether this jnode can possible became
@@ -303,6 +312,12 @@ static inline int JF_TEST_AND_SET(jnode * j, int f)
 	return test_and_set_bit(f, &j->state);
 }
 
+static inline int JF_TEST_AND_CLEAR(jnode * j, int f)
+{
+	assert("", j->magic == JMAGIC);
+	return test_and_clear_bit(f, &j->state);
+}
+
 static inline void spin_lock_jnode(jnode *node)
 {
 	/* check that spinlocks of lower priorities are not held */
@@ -424,6 +439,8 @@ extern flush_queue_t *reiser4_pos_fq(flush_pos_t *pos);
 
 extern int jnodes_tree_init(reiser4_tree * tree);
 extern int jnodes_tree_done(reiser4_tree * tree);
+extern void jnodes_tree_grow(reiser4_tree * tree);
+extern void jnodes_tree_stat(reiser4_tree * tree, struct hash_chain_stat *stat);
 
 #if REISER4_DEBUG
 
@@ -510,6 +527,8 @@ extern void jdrop(jnode *) NONNULL;
 extern int jwait_io(jnode *, int rw) NONNULL;
 
 void jload_prefetch(jnode *);
+extern int jload_prefetch_batch(jnode **, int nr);
+extern int jnode_is_pinned(const jnode *);
 
 extern jnode *reiser4_alloc_io_head(const reiser4_block_nr * block) NONNULL;
 extern void reiser4_drop_io_head(jnode * node) NONNULL;
@@ -104,7 +104,11 @@
  *
  * This key assignment policy is designed to keep stat-data in the same order
  * as corresponding directory items, thus speeding up readdir/stat types of
- * workload.
+ * workload. Directory items of a directory (minor 0) and stat-data of objects
+ * first named in it (minor 1) share the locality, so stat-data of a directory
+ * follow its entries in the tree, in the same order whatever the order of
+ * creation and object ids was. Only objects renamed or linked from elsewhere
+ * keep ordering (and locality) of their first name.
  *
  * FILE BODY
  *
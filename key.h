@@ -263,6 +263,25 @@ extern const reiser4_key *reiser4_max_key(void);
 	(e1 < e2) ? LESS_THAN : ((e1 == e2) ? EQUAL_TO : GREATER_THAN);	\
 })
 
+/* find the first element @k1 and @k2 differ in and store both versions of
+   it in @e1 and @e2. Returns 0 if keys are equal. With plan-a key allocation
+   elements are compared in physical order, which is the logical one, so this
+   is all key comparison needs: there is one branch per element and the loop
+   is unrolled by the compiler. */
+static inline int key_diff_el(const reiser4_key * k1, const reiser4_key * k2,
+			      __u64 * e1, __u64 * e2)
+{
+	int i;
+
+	for (i = 0; i < KEY_LAST_INDEX; i++) {
+		*e1 = get_key_el(k1, i);
+		*e2 = get_key_el(k2, i);
+		if (*e1 != *e2)
+			return 1;
+	}
+	return 0;
+}
+
 /* compare `k1' and `k2'.  This function is a heart of "key allocation
     policy". All you need to implement new policy is to add yet another
     clause here. */
@@ -289,18 +308,13 @@ static inline cmp_t keycmp(const reiser4_key * k1 /* first key to compare */ ,
 		   as three 64bit comparisons. */
 		/* logical order of fields in plan-a:
 		   locality->type->objectid->offset. */
-		/* compare locality and type at once */
-		result = KEY_DIFF_EL(k1, k2, 0);
-		if (result == EQUAL_TO) {
-			/* compare objectid (and band if it's there) */
-			result = KEY_DIFF_EL(k1, k2, 1);
-			/* compare offset */
-			if (result == EQUAL_TO) {
-				result = KEY_DIFF_EL(k1, k2, 2);
-				if (REISER4_LARGE_KEY && result == EQUAL_TO)
-					result = KEY_DIFF_EL(k1, k2, 3);
-			}
-		}
+		__u64 e1;
+		__u64 e2;
+
+		if (!key_diff_el(k1, k2, &e1, &e2))
+			result = EQUAL_TO;
+		else
+			result = (e1 < e2) ? LESS_THAN : GREATER_THAN;
 	} else if (REISER4_3_5_KEY_ALLOCATION) {
 		result = KEY_DIFF(k1, k2, locality);
 		if (result == EQUAL_TO) {
@@ -329,8 +343,13 @@ static inline int keyeq(const reiser4_key * k1 /* first key to compare */ ,
 static inline int keylt(const reiser4_key * k1 /* first key to compare */ ,
 			const reiser4_key * k2/* second key to compare */)
 {
+	__u64 e1;
+	__u64 e2;
+
 	assert("nikita-1952", k1 != NULL);
 	assert("nikita-1953", k2 != NULL);
+	if (REISER4_PLANA_KEY_ALLOCATION)
+		return key_diff_el(k1, k2, &e1, &e2) && e1 < e2;
 	return keycmp(k1, k2) == LESS_THAN;
 }
 
@@ -338,8 +357,13 @@ static inline int keylt(const reiser4_key * k1 /* first key to compare */ ,
 static inline int keyle(const reiser4_key * k1 /* first key to compare */ ,
 			const reiser4_key * k2/* second key to compare */)
 {
+	__u64 e1;
+	__u64 e2;
+
 	assert("nikita-1954", k1 != NULL);
 	assert("nikita-1955", k2 != NULL);
+	if (REISER4_PLANA_KEY_ALLOCATION)
+		return !key_diff_el(k1, k2, &e1, &e2) || e1 < e2;
 	return keycmp(k1, k2) != GREATER_THAN;
 }
 
@@ -347,8 +371,13 @@ static inline int keyle(const reiser4_key * k1 /* first key to compare */ ,
 static inline int keygt(const reiser4_key * k1 /* first key to compare */ ,
 			const reiser4_key * k2/* second key to compare */)
 {
+	__u64 e1;
+	__u64 e2;
+
 	assert("nikita-1959", k1 != NULL);
 	assert("nikita-1960", k2 != NULL);
+	if (REISER4_PLANA_KEY_ALLOCATION)
+		return key_diff_el(k1, k2, &e1, &e2) && e1 > e2;
 	return keycmp(k1, k2) == GREATER_THAN;
 }
 
@@ -356,9 +385,14 @@ static inline int keygt(const reiser4_key * k1 /* first key to compare */ ,
 static inline int keyge(const reiser4_key * k1 /* first key to compare */ ,
 			const reiser4_key * k2/* second key to compare */)
 {
+	__u64 e1;
+	__u64 e2;
+
 	assert("nikita-1956", k1 != NULL);
 	assert("nikita-1957", k2 != NULL);	/* October  4: sputnik launched
 						 * November 3: Laika */
+	if (REISER4_PLANA_KEY_ALLOCATION)
+		return !key_diff_el(k1, k2, &e1, &e2) || e1 > e2;
 	return keycmp(k1, k2) != LESS_THAN;
 }
 
@@ -16,9 +16,13 @@
  *     accesses to this directory.
  *
  * ktxnmgrd binds its time sleeping on condition variable. When is awakes
- * either due to (tunable) timeout or because it was explicitly woken up by
- * call to ktxnmgrd_kick(), it scans list of all atoms and commits ones
- * eligible.
+ * either due to timeout or because it was explicitly woken up by call to
+ * ktxnmgrd_kick(), it scans list of all atoms and commits ones eligible.
+ *
+ * The timeout is set so that ktxnmgrd wakes up just when the oldest atom
+ * gets too old, but it sleeps not longer than (tunable) ->timeout, as atoms
+ * also become eligible for committing by their size. When there are no
+ * atoms it sleeps until the first atom is created and kicks it.
  *
  */
 
@@ -38,6 +42,7 @@
 #include <linux/freezer.h>
 
 static int scan_mgr(struct super_block *);
+static signed long ktxnmgrd_timeout(txn_mgr *);
 
 /*
  * change current->comm so that ps, top, and friends will see changed
@@ -83,7 +88,7 @@ static int ktxnmgrd(void *arg)
 			if (kthread_should_stop())
 				done = 1;
 			else
-				schedule_timeout(ctx->timeout);
+				schedule_timeout(ktxnmgrd_timeout(mgr));
 			finish_wait(&ctx->wait, &__wait);
 		}
 		if (done)
@@ -115,6 +120,33 @@ static int ktxnmgrd(void *arg)
 
 #undef set_comm
 
+/* how long ktxnmgrd may sleep, see comment at the top of this file */
+static signed long ktxnmgrd_timeout(txn_mgr *mgr)
+{
+	txn_atom *atom;
+	signed long timeout;
+
+	spin_lock_txnmgr(mgr);
+	if (list_empty(&mgr->atoms_list))
+		timeout = MAX_SCHEDULE_TIMEOUT;
+	else
+		timeout = mgr->daemon->timeout;
+	list_for_each_entry(atom, &mgr->atoms_list, atom_link) {
+		/* atom_is_dotard() is true after this moment */
+		unsigned long deadline =
+			READ_ONCE(atom->start_time) + mgr->atom_max_age + 1;
+
+		/* atoms which are too old already wait for their
+		   transaction handles to close, and closing the last one
+		   commits the atom */
+		if (time_after(deadline, jiffies) &&
+		    time_before(deadline, jiffies + timeout))
+			timeout = deadline - jiffies;
+	}
+	spin_unlock_txnmgr(mgr);
+	return timeout;
+}
+
 /**
  * reiser4_init_ktxnmgrd - initialize ktxnmgrd context and start kernel daemon
  * @super: pointer to super block
@@ -22,7 +22,7 @@ struct ktxnmgrd_context {
 	wait_queue_head_t wait;
 	/* spin lock protecting all fields of this structure */
 	spinlock_t guard;
-	/* timeout of sleeping on ->wait */
+	/* maximal timeout of sleeping on ->wait */
 	signed long timeout;
 	/* kernel thread running ktxnmgrd */
 	struct task_struct *tsk;
@@ -224,8 +224,11 @@
 #include "tree.h"
 #include "plugin/node/node.h"
 #include "super.h"
+#include "reiser4_trace.h"
 
 #include <linux/spinlock.h>
+#include <linux/sched.h>
+#include <linux/sched/clock.h>
 
 #if REISER4_DEBUG
 static int request_is_deadlock_safe(znode * , znode_lock_mode,
@@ -238,6 +241,45 @@ lock_stack *get_current_lock_stack(void)
 	return &get_current_context()->stack;
 }
 
+/* per-CPU statistics @node is accounted to when locked in @mode, NULL if
+   statistics are not kept */
+static inline zlock_stat __percpu *lock_stat(const znode * node,
+					     znode_lock_mode mode)
+{
+	zlock_stats __percpu *stats = znode_get_tree(node)->lock_stats;
+	tree_level level;
+
+	if (unlikely(stats == NULL))
+		return NULL;
+	level = min_t(tree_level, znode_get_level(node),
+		      REISER4_MAX_ZTREE_HEIGHT);
+	return &stats->s[level][mode == ZNODE_WRITE_LOCK];
+}
+
+#define lock_stat_inc(node, mode, field)			\
+do {								\
+	zlock_stat __percpu *__st = lock_stat(node, mode);	\
+								\
+	if (__st != NULL)					\
+		this_cpu_inc(__st->field);			\
+} while (0)
+
+/* account @ns nanoseconds spent in reiser4_go_to_sleep() */
+static void lock_stat_wait(const znode * node, znode_lock_mode mode, u64 ns)
+{
+	zlock_stat __percpu *pst = lock_stat(node, mode);
+	zlock_stat *st;
+
+	if (pst == NULL)
+		return;
+	st = get_cpu_ptr(pst);
+	st->contended++;
+	st->wait_ns += ns;
+	if (ns > st->max_wait_ns)
+		st->max_wait_ns = ns;
+	put_cpu_ptr(pst);
+}
+
 /* Wakes up all low priority owners informing them about possible deadlock */
 static void wake_up_all_lopri_owners(znode * node)
 {
@@ -326,6 +368,8 @@ static void lock_object(lock_stack * owner)
 		assert("nikita-1840", node->lock.nr_readers <= 0);
 		/* We allow recursive locking; a node can be locked several
 		   times for write by same process */
+		if (node->lock.nr_readers == 0)
+			raw_write_seqcount_begin(&node->lock.wseq);
 		node->lock.nr_readers--;
 	}
 
@@ -466,9 +510,12 @@ static int can_lock_object(lock_stack * owner)
 
 /* Setting of a high priority to the process. It clears "signaled" flags
    because znode locked by high-priority process can't satisfy our "deadlock
-   condition". */
-static void set_high_priority(lock_stack * owner)
+   condition". Returns true if priority was raised while the process held
+   locks. */
+static int set_high_priority(lock_stack * owner)
 {
+	int inversion = 0;
+
 	assert("nikita-1846", owner == get_current_lock_stack());
 	/* Do nothing if current priority is already high */
 	if (!owner->curpri) {
@@ -481,6 +528,7 @@ static void set_high_priority(lock_stack * owner)
 		 */
 		lock_handle *item = list_entry(owner->locks.next, lock_handle,
 					       locks_link);
+		inversion = !list_empty(&owner->locks);
 		while (&owner->locks != &item->locks_link) {
 			znode *node = item->node;
 
@@ -500,6 +548,7 @@ static void set_high_priority(lock_stack * owner)
 		owner->curpri = 1;
 		atomic_set(&owner->nr_signaled, 0);
 	}
+	return inversion;
 }
 
 /* Sets a low priority to the process. */
@@ -652,6 +701,8 @@ void longterm_unlock_znode(lock_handle * handle)
 	/* This is enough to be sure whether an object is completely
 	   unlocked. */
 	node->lock.nr_readers += rdelta;
+	if (readers == -1)
+		raw_write_seqcount_end(&node->lock.wseq);
 
 	/* If the node is locked it must have an owners list.  Likewise, if
 	   the node is unlocked it must have an empty owners list. */
@@ -677,6 +728,85 @@ void longterm_unlock_znode(lock_handle * handle)
 	zput(node);
 }
 
+#ifdef CONFIG_SMP
+/* true if @task is running on a CPU which is not preempted by hypervisor */
+static inline int lock_owner_on_cpu(struct task_struct *task)
+{
+	return READ_ONCE(task->on_cpu) && !vcpu_is_preempted(task_cpu(task));
+}
+
+/*
+ * Spin waiting for a lock held by a process which is running on other CPU,
+ * like mutex_optimistic_spin() does: long term locks are usually held for a
+ * few microseconds, much less than it takes to sleep and to be woken up.
+ *
+ * No spinning is done if there are sleeping requestors (the lock is going
+ * to be passed to them), if the owner is not running, or if the current
+ * process is asked to yield its locks. Spinning stops when the lock is
+ * released, when its owner is scheduled out, when the current process has
+ * to reschedule or after REISER4_LOCK_SPIN_NSEC.
+ *
+ * Called and returns with zlock spin lock held, which is released while
+ * spinning. Returns true if the lock was seen released.
+ */
+static int lock_spin_on_owner(lock_stack * owner, znode * node,
+			      znode_lock_mode mode)
+{
+	zlock *lock = &node->lock;
+	zlock_stat __percpu *pst;
+	struct task_struct *task;
+	u64 start;
+	u64 now;
+	int released = 0;
+
+	assert_spin_locked(&(node->lock.guard));
+
+	if (!list_empty(&lock->requestors) || list_empty(&lock->owners) ||
+	    atomic_read(&owner->nr_signaled) != 0)
+		return 0;
+	task = list_entry(lock->owners.next, lock_handle,
+			  owners_link)->owner->task;
+	if (task == current || !lock_owner_on_cpu(task))
+		return 0;
+
+	/* task_struct is freed after RCU grace period, so it can be looked
+	 * at after its lock stack is gone */
+	rcu_read_lock();
+	spin_unlock_zlock(lock);
+	start = now = local_clock();
+	while (now - start < REISER4_LOCK_SPIN_NSEC) {
+		if (READ_ONCE(lock->nr_readers) == 0) {
+			released = 1;
+			break;
+		}
+		if (!lock_owner_on_cpu(task) || need_resched() ||
+		    atomic_read(&owner->nr_signaled) != 0)
+			break;
+		cpu_relax();
+		now = local_clock();
+	}
+	rcu_read_unlock();
+
+	pst = lock_stat(node, mode);
+	if (pst != NULL) {
+		zlock_stat *st = get_cpu_ptr(pst);
+
+		st->spins++;
+		st->spin_released += released;
+		st->spin_ns += local_clock() - start;
+		put_cpu_ptr(pst);
+	}
+	spin_lock_zlock(lock);
+	return released;
+}
+#else
+static inline int lock_spin_on_owner(lock_stack * owner, znode * node,
+				     znode_lock_mode mode)
+{
+	return 0;
+}
+#endif
+
 /* final portion of longterm-lock */
 static int
 lock_tail(lock_stack * owner, int ok, znode_lock_mode mode)
@@ -698,6 +828,7 @@ lock_tail(lock_stack * owner, int ok, znode_lock_mode mode)
 		zref(node);
 
 		LOCK_CNT_INC(long_term_locked_znode);
+		lock_stat_inc(node, mode, acquired);
 	}
 	spin_unlock_zlock(&node->lock);
 	ON_DEBUG(check_lock_data());
@@ -767,6 +898,9 @@ int longterm_lock_znode(
 	zlock *lock;
 	txn_handle *txnh;
 	tree_level level;
+	ktime_t wait_start;
+	u64 wait_ns;
+	int spun = 0;
 
 	/* Get current process context */
 	lock_stack *owner = get_current_lock_stack();
@@ -798,7 +932,8 @@ int longterm_lock_znode(
 	/* If we are changing our process priority we must adjust a number
 	   of high priority owners for each znode that we already lock */
 	if (hipri) {
-		set_high_priority(owner);
+		if (set_high_priority(owner))
+			lock_stat_inc(node, mode, inversions);
 	} else {
 		set_low_priority(owner);
 	}
@@ -941,10 +1076,24 @@ int longterm_lock_znode(
 		if (likely(ret != -E_REPEAT || non_blocking))
 			break;
 
+		/* Lock is unavailable. If its owner is running, it is likely
+		   to be released soon: spin once before going to sleep. */
+		if (!spun) {
+			spun = 1;
+			if (lock_spin_on_owner(owner, node, mode))
+				continue;
+		}
+
 		/* Lock is unavailable, we have to wait. */
 		ret = reiser4_prepare_to_sleep(owner);
-		if (unlikely(ret != 0))
+		if (unlikely(ret != 0)) {
+			if (ret == -E_DEADLOCK)
+				lock_stat_inc(node, mode, deadlocks);
+			trace_reiser4_longterm_lock_wait(
+				znode_get_tree(node)->super,
+				*znode_get_block(node), level, mode, 0, ret);
 			break;
+		}
 
 		assert_spin_locked(&(node->lock.guard));
 		if (hipri) {
@@ -966,7 +1115,15 @@ int longterm_lock_znode(
 		   a znode ... */
 		spin_unlock_zlock(lock);
 		/* ... and sleep */
+		wait_start = ktime_get();
 		reiser4_go_to_sleep(owner);
+		wait_ns = ktime_to_ns(ktime_sub(ktime_get(), wait_start));
+		lock_stat_wait(node, mode, wait_ns);
+		reiser4_hot_node(node);
+		trace_reiser4_longterm_lock_wait(znode_get_tree(node)->super,
+			*znode_get_block(node), level, mode, wait_ns,
+			owner->request.mode == ZNODE_NO_LOCK ?
+			owner->request.ret_code : 0);
 		if (owner->request.mode == ZNODE_NO_LOCK)
 			goto request_is_done;
 		spin_lock_zlock(lock);
@@ -975,6 +1132,7 @@ int longterm_lock_znode(
 request_is_done:
 			if (owner->request.ret_code == 0) {
 				LOCK_CNT_INC(long_term_locked_znode);
+				lock_stat_inc(node, mode, acquired);
 				zref(node);
 			}
 			return owner->request.ret_code;
@@ -982,6 +1140,8 @@ request_is_done:
 		remove_lock_request(owner);
 	}
 
+	if (ret == -E_REPEAT)
+		lock_stat_inc(node, mode, repeats);
 	return lock_tail(owner, ret, mode);
 }
 
@@ -1008,6 +1168,7 @@ void reiser4_invalidate_lock(lock_handle * handle	/* path to lock
 
 	ZF_SET(node, JNODE_IS_DYING);
 	unlink_object(handle);
+	/* wseq is left odd: lockless readers must not trust dying node */
 	node->lock.nr_readers = 0;
 
 	invalidate_all_lock_requests(node);
@@ -1023,6 +1184,7 @@ void init_lock_stack(lock_stack * owner	/* pointer to
 	INIT_LIST_HEAD(&owner->requestors_link);
 	spin_lock_init(&owner->sguard);
 	owner->curpri = 1;
+	owner->task = current;
 	init_waitqueue_head(&owner->wait);
 }
 
@@ -1035,6 +1197,7 @@ void reiser4_init_lock(zlock * lock	/* pointer on allocated
 	spin_lock_init(&lock->guard);
 	INIT_LIST_HEAD(&lock->requestors);
 	INIT_LIST_HEAD(&lock->owners);
+	seqcount_init(&lock->wseq);
 }
 
 /* Transfer a lock handle (presumably so that variables can be moved between
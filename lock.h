@@ -17,6 +17,7 @@
 
 #include <linux/types.h>
 #include <linux/spinlock.h>
+#include <linux/seqlock.h>
 #include <linux/pagemap.h>	/* for PAGE_CACHE_SIZE */
 #include <asm/atomic.h>
 #include <linux/wait.h>
@@ -27,6 +28,10 @@ struct zlock {
 	/* The number of readers if positive; the number of recursively taken
 	   write locks if negative. Protected by zlock spin lock. */
 	int nr_readers;
+	/* Odd while the lock is taken for write. Lets lockless readers of
+	   the node content check that it was not modified under them, see
+	   optimistic_child() in search.c. */
+	seqcount_t wseq;
 	/* A number of processes (lock_stacks) that have this object
 	   locked with high priority */
 	unsigned nr_hipri_owners;
@@ -119,6 +124,9 @@ struct lock_stack {
 	   locking.
 	 */
 	int curpri;
+	/* process this lock stack belongs to, lock_spin_on_owner() checks
+	   whether it is running */
+	struct task_struct *task;
 	/* A list of all locks owned by this process. Elements can be added to
 	 * this list only by the current thread. ->node pointers in this list
 	 * can be only changed by the current thread. */
@@ -143,6 +151,35 @@ struct lock_stack {
 #endif
 };
 
+/* Long term lock statistics of one tree level and lock mode. Counters are
+   per-CPU and updated without locking, see lock_stat_*() in lock.c */
+typedef struct zlock_stat {
+	/* locks taken */
+	unsigned long acquired;
+	/* lock requests which had to sleep, counted once per sleep */
+	unsigned long contended;
+	/* requests failed with -E_DEADLOCK by reiser4_prepare_to_sleep() */
+	unsigned long deadlocks;
+	/* non-blocking requests failed with -E_REPEAT */
+	unsigned long repeats;
+	/* requests which raised priority of a process holding locks */
+	unsigned long inversions;
+	/* time spent in reiser4_go_to_sleep() */
+	u64 wait_ns;
+	u64 max_wait_ns;
+	/* spins on a running lock owner, those which saw the lock released,
+	   and time spent spinning */
+	unsigned long spins;
+	unsigned long spin_released;
+	u64 spin_ns;
+} zlock_stat;
+
+/* indexed by tree level and by (mode == ZNODE_WRITE_LOCK). Levels above
+   REISER4_MAX_ZTREE_HEIGHT are accounted to it. */
+typedef struct zlock_stats {
+	zlock_stat s[REISER4_MAX_ZTREE_HEIGHT + 1][2];
+} zlock_stats;
+
 /*
   User-visible znode locking functions
 */
@@ -0,0 +1,387 @@
+/* Copyright 2001, 2002, 2003, 2004 by Hans Reiser, licensing governed by
+ * reiser4/README */
+
+/* Per-CPU magazines in front of slab caches.
+
+   Jnodes, znodes, carry pools and blocknr set entries are allocated and
+   freed at a very high rate during streaming writes. A magazine is a small
+   per-CPU stack of free objects: freed objects are pushed there and handed
+   out again by the next allocation on that CPU without touching the slab.
+   An empty magazine is refilled by one bulk allocation from the slab, a full
+   one is halved by one bulk free.
+
+   Jnodes and znodes are freed after an RCU grace period. Rather than posting
+   a callback per object, reiser4_call_rcu() collects up to
+   REISER4_RCU_BATCH_SIZE callbacks per CPU and posts one callback for the
+   whole batch. A partially filled batch waits for more frees, so
+   reiser4_rcu_barrier() must be used instead of rcu_barrier() when all
+   callbacks have to be completed (umount, module unload).
+
+   Magazines are accessed with interrupts disabled, because RCU callbacks
+   free objects from softirq context. Hit and miss counters of all caches
+   are in the magazines debugfs file.
+
+   On NUMA machines objects freed on a CPU of another node than their memory
+   bypass the magazine and go back to the slab, otherwise they would be
+   handed out again on this node and stay remote for good. Objects which
+   belong to a page, such as jnodes of pages, are allocated on the node of
+   the page by reiser4_mag_alloc_node().
+*/
+
+#include "debug.h"
+#include "magazine.h"
+
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/topology.h>
+#include <linux/mm.h>
+
+/* all caches, for statistics */
+static LIST_HEAD(mag_caches);
+static DEFINE_MUTEX(mag_caches_guard);
+
+/* callbacks posted as one RCU callback */
+struct rcu_batch {
+	struct rcu_head rcu;
+	unsigned nr;
+	struct {
+		struct rcu_head *head;
+		rcu_callback_t func;
+	} cb[REISER4_RCU_BATCH_SIZE];
+};
+
+/* batch being filled on a CPU */
+struct rcu_batch_slot {
+	/* protects @cur against reiser4_rcu_barrier() on other CPU */
+	spinlock_t guard;
+	struct rcu_batch *cur;
+};
+
+static DEFINE_PER_CPU(struct rcu_batch_slot, rcu_batch_slots);
+static reiser4_mag_cache rcu_batch_cache;
+/* number of callbacks posted in batches and one by one */
+static atomic_long_t nr_batched;
+static atomic_long_t nr_unbatched;
+
+/**
+ * reiser4_init_mag_cache - create slab cache with per-CPU magazines
+ * @cache: cache to initialize
+ * @name: name of slab cache
+ * @size: size of objects
+ * @flags: slab flags
+ *
+ * Objects are not constructed: magazines return objects as they were freed.
+ */
+int reiser4_init_mag_cache(reiser4_mag_cache *cache, const char *name,
+			   size_t size, slab_flags_t flags)
+{
+	cache->slab = kmem_cache_create(name, size, 0, flags, NULL);
+	if (cache->slab == NULL)
+		return RETERR(-ENOMEM);
+	cache->mags = alloc_percpu(struct reiser4_magazine);
+	if (cache->mags == NULL) {
+		kmem_cache_destroy(cache->slab);
+		cache->slab = NULL;
+		return RETERR(-ENOMEM);
+	}
+	cache->name = name;
+	mutex_lock(&mag_caches_guard);
+	list_add_tail(&cache->link, &mag_caches);
+	mutex_unlock(&mag_caches_guard);
+	return 0;
+}
+
+/**
+ * reiser4_done_mag_cache - destroy cache created by reiser4_init_mag_cache()
+ * @cache: cache to destroy
+ *
+ * Completes pending RCU callbacks, which may free objects to @cache, then
+ * empties magazines of all CPUs.
+ */
+void reiser4_done_mag_cache(reiser4_mag_cache *cache)
+{
+	int cpu;
+
+	BUG_ON(cache->slab == NULL);
+
+	reiser4_rcu_barrier();
+	mutex_lock(&mag_caches_guard);
+	list_del(&cache->link);
+	mutex_unlock(&mag_caches_guard);
+	for_each_possible_cpu(cpu) {
+		struct reiser4_magazine *mag = per_cpu_ptr(cache->mags, cpu);
+
+		kmem_cache_free_bulk(cache->slab, mag->nr, mag->objs);
+		mag->nr = 0;
+	}
+	free_percpu(cache->mags);
+	cache->mags = NULL;
+	kmem_cache_destroy(cache->slab);
+	cache->slab = NULL;
+}
+
+/**
+ * reiser4_mag_alloc - allocate object
+ * @cache: cache to allocate from
+ * @gfp: allocation flags, used when the magazine is empty
+ */
+void *reiser4_mag_alloc(reiser4_mag_cache *cache, gfp_t gfp)
+{
+	struct reiser4_magazine *mag;
+	void *refill[REISER4_MAGAZINE_SIZE / 2];
+	unsigned long flags;
+	void *obj = NULL;
+	int nr;
+
+	local_irq_save(flags);
+	mag = this_cpu_ptr(cache->mags);
+	if (mag->nr != 0) {
+		obj = mag->objs[--mag->nr];
+		mag->hits++;
+	} else
+		mag->misses++;
+	local_irq_restore(flags);
+	if (obj != NULL)
+		return obj;
+
+	nr = kmem_cache_alloc_bulk(cache->slab, gfp, ARRAY_SIZE(refill),
+				   refill);
+	if (nr == 0)
+		return kmem_cache_alloc(cache->slab, gfp);
+	obj = refill[--nr];
+
+	/* we could have migrated or the magazine could have been filled by
+	 * an interrupt meanwhile */
+	local_irq_save(flags);
+	mag = this_cpu_ptr(cache->mags);
+	while (nr != 0 && mag->nr < REISER4_MAGAZINE_SIZE)
+		mag->objs[mag->nr++] = refill[--nr];
+	local_irq_restore(flags);
+	if (nr != 0)
+		kmem_cache_free_bulk(cache->slab, nr, refill);
+	return obj;
+}
+
+/**
+ * reiser4_mag_alloc_node - allocate object on given NUMA node
+ * @cache: cache to allocate from
+ * @gfp: allocation flags
+ * @nid: node to allocate on, NUMA_NO_NODE if any
+ *
+ * The magazine is used when @nid is the node of the current CPU.
+ */
+void *reiser4_mag_alloc_node(reiser4_mag_cache *cache, gfp_t gfp, int nid)
+{
+	if (nid == NUMA_NO_NODE || nid == numa_mem_id())
+		return reiser4_mag_alloc(cache, gfp);
+	return kmem_cache_alloc_node(cache->slab, gfp, nid);
+}
+
+/* true if @obj is memory of another node than the current CPU's */
+static inline int mag_obj_remote(const void *obj)
+{
+	return num_online_nodes() > 1 &&
+		page_to_nid(virt_to_page(obj)) != numa_mem_id();
+}
+
+/**
+ * reiser4_mag_free - free object allocated by reiser4_mag_alloc()
+ * @cache: cache object was allocated from
+ * @obj: object to free
+ */
+void reiser4_mag_free(reiser4_mag_cache *cache, void *obj)
+{
+	struct reiser4_magazine *mag;
+	void *spill[REISER4_MAGAZINE_SIZE / 2];
+	unsigned long flags;
+	unsigned nr = 0;
+
+	if (unlikely(mag_obj_remote(obj))) {
+		kmem_cache_free(cache->slab, obj);
+		return;
+	}
+	local_irq_save(flags);
+	mag = this_cpu_ptr(cache->mags);
+	if (mag->nr == REISER4_MAGAZINE_SIZE) {
+		nr = ARRAY_SIZE(spill);
+		mag->nr -= nr;
+		memcpy(spill, mag->objs + mag->nr, nr * sizeof(void *));
+	}
+	mag->objs[mag->nr++] = obj;
+	local_irq_restore(flags);
+	if (nr != 0)
+		kmem_cache_free_bulk(cache->slab, nr, spill);
+}
+
+/* RCU callback of a batch */
+static void rcu_batch_actor(struct rcu_head *head)
+{
+	struct rcu_batch *batch = container_of(head, struct rcu_batch, rcu);
+	unsigned i;
+
+	for (i = 0; i < batch->nr; i++)
+		batch->cb[i].func(batch->cb[i].head);
+	reiser4_mag_free(&rcu_batch_cache, batch);
+}
+
+static void post_rcu_batch(struct rcu_batch *batch)
+{
+	atomic_long_add(batch->nr, &nr_batched);
+	call_rcu(&batch->rcu, rcu_batch_actor);
+}
+
+/**
+ * reiser4_call_rcu - batched call_rcu()
+ * @head: rcu head of object
+ * @func: callback to call after a grace period
+ *
+ * Callback is called no earlier than call_rcu() would call it, but possibly
+ * later: not before the batch it was put to is full or reiser4_rcu_barrier()
+ * is called.
+ */
+void reiser4_call_rcu(struct rcu_head *head, rcu_callback_t func)
+{
+	struct rcu_batch_slot *slot;
+	struct rcu_batch *batch;
+	struct rcu_batch *full = NULL;
+	unsigned long flags;
+
+	slot = get_cpu_ptr(&rcu_batch_slots);
+	spin_lock_irqsave(&slot->guard, flags);
+	batch = slot->cur;
+	if (batch == NULL) {
+		batch = reiser4_mag_alloc(&rcu_batch_cache,
+					  GFP_ATOMIC | __GFP_NOWARN);
+		if (batch == NULL) {
+			spin_unlock_irqrestore(&slot->guard, flags);
+			put_cpu_ptr(&rcu_batch_slots);
+			atomic_long_inc(&nr_unbatched);
+			call_rcu(head, func);
+			return;
+		}
+		batch->nr = 0;
+		slot->cur = batch;
+	}
+	batch->cb[batch->nr].head = head;
+	batch->cb[batch->nr].func = func;
+	if (++batch->nr == REISER4_RCU_BATCH_SIZE) {
+		slot->cur = NULL;
+		full = batch;
+	}
+	spin_unlock_irqrestore(&slot->guard, flags);
+	put_cpu_ptr(&rcu_batch_slots);
+	if (full != NULL)
+		post_rcu_batch(full);
+}
+
+/**
+ * reiser4_rcu_barrier - wait for callbacks posted by reiser4_call_rcu()
+ *
+ * Posts partially filled batches of all CPUs and waits until all RCU
+ * callbacks are completed.
+ */
+void reiser4_rcu_barrier(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct rcu_batch_slot *slot = per_cpu_ptr(&rcu_batch_slots,
+							  cpu);
+		struct rcu_batch *batch;
+		unsigned long flags;
+
+		spin_lock_irqsave(&slot->guard, flags);
+		batch = slot->cur;
+		slot->cur = NULL;
+		spin_unlock_irqrestore(&slot->guard, flags);
+		if (batch != NULL)
+			post_rcu_batch(batch);
+	}
+	rcu_barrier();
+}
+
+/**
+ * reiser4_init_magazines - initialize batched RCU freeing
+ *
+ * This is called on reiser4 module initialization, before any cache with
+ * magazines is created.
+ */
+int reiser4_init_magazines(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct rcu_batch_slot *slot = per_cpu_ptr(&rcu_batch_slots,
+							  cpu);
+
+		spin_lock_init(&slot->guard);
+		slot->cur = NULL;
+	}
+	return reiser4_init_mag_cache(&rcu_batch_cache, "reiser4_rcu_batch",
+				      sizeof(struct rcu_batch),
+				      SLAB_HWCACHE_ALIGN);
+}
+
+/**
+ * reiser4_done_magazines - finish with batched RCU freeing
+ *
+ * This is called on reiser4 module unloading, after all caches with
+ * magazines are destroyed.
+ */
+void reiser4_done_magazines(void)
+{
+	reiser4_done_mag_cache(&rcu_batch_cache);
+	assert("", list_empty(&mag_caches));
+}
+
+/* print "<cache> <hits> <misses>" for each cache, then numbers of RCU
+ * callbacks posted in batches and one by one */
+static int magazines_show(struct seq_file *m, void *unused)
+{
+	reiser4_mag_cache *cache;
+
+	mutex_lock(&mag_caches_guard);
+	list_for_each_entry(cache, &mag_caches, link) {
+		unsigned long hits = 0;
+		unsigned long misses = 0;
+		int cpu;
+
+		for_each_possible_cpu(cpu) {
+			struct reiser4_magazine *mag;
+
+			mag = per_cpu_ptr(cache->mags, cpu);
+			hits += READ_ONCE(mag->hits);
+			misses += READ_ONCE(mag->misses);
+		}
+		seq_printf(m, "%s %lu %lu\n", cache->name,
+			   hits, misses);
+	}
+	mutex_unlock(&mag_caches_guard);
+	seq_printf(m, "rcu_batched %ld\nrcu_unbatched %ld\n",
+		   atomic_long_read(&nr_batched),
+		   atomic_long_read(&nr_unbatched));
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(magazines);
+
+/**
+ * reiser4_magazines_debugfs_init - export magazine statistics
+ * @root: reiser4 debugfs directory
+ */
+void reiser4_magazines_debugfs_init(struct dentry *root)
+{
+	debugfs_create_file("magazines", S_IFREG | S_IRUSR, root, NULL,
+			    &magazines_fops);
+}
+
+/* Make Linus happy.
+   Local variables:
+   c-indentation-style: "K&R"
+   mode-name: "LC"
+   c-basic-offset: 8
+   tab-width: 8
+   fill-column: 120
+   End:
+*/
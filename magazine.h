@@ -0,0 +1,61 @@
+/* Copyright 2001, 2002, 2003, 2004 by Hans Reiser, licensing governed by
+ * reiser4/README */
+
+/* Per-CPU magazines in front of slab caches. See magazine.c for comments. */
+
+#ifndef __REISER4_MAGAZINE_H__
+#define __REISER4_MAGAZINE_H__
+
+#include "reiser4.h"
+
+#include <linux/slab.h>
+#include <linux/list.h>
+#include <linux/percpu.h>
+#include <linux/rcupdate.h>
+
+struct dentry;
+
+/* per-CPU stack of free objects */
+struct reiser4_magazine {
+	unsigned nr;
+	void *objs[REISER4_MAGAZINE_SIZE];
+	/* allocations served from the magazine */
+	unsigned long hits;
+	/* allocations which went to the slab */
+	unsigned long misses;
+};
+
+typedef struct reiser4_mag_cache {
+	struct kmem_cache *slab;
+	const char *name;
+	struct reiser4_magazine __percpu *mags;
+	/* on the list of all caches, for statistics */
+	struct list_head link;
+} reiser4_mag_cache;
+
+extern int reiser4_init_mag_cache(reiser4_mag_cache *, const char *name,
+				  size_t size, slab_flags_t flags);
+extern void reiser4_done_mag_cache(reiser4_mag_cache *);
+extern void *reiser4_mag_alloc(reiser4_mag_cache *, gfp_t);
+extern void *reiser4_mag_alloc_node(reiser4_mag_cache *, gfp_t, int nid);
+extern void reiser4_mag_free(reiser4_mag_cache *, void *);
+
+extern void reiser4_call_rcu(struct rcu_head *, rcu_callback_t);
+extern void reiser4_rcu_barrier(void);
+
+extern int reiser4_init_magazines(void);
+extern void reiser4_done_magazines(void);
+extern void reiser4_magazines_debugfs_init(struct dentry *root);
+
+/* __REISER4_MAGAZINE_H__ */
+#endif
+
+/* Make Linus happy.
+   Local variables:
+   c-indentation-style: "K&R"
+   mode-name: "LC"
+   c-basic-offset: 8
+   tab-width: 8
+   fill-column: 120
+   End:
+*/
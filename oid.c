@@ -4,11 +4,99 @@
 #include "super.h"
 #include "txnmgr.h"
 
+#include <linux/percpu.h>
+
 /* we used to have oid allocation plugin. It was removed because it
    was recognized as providing unneeded level of abstraction. If one
    ever will find it useful - look at yet_unneeded_abstractions/oid
 */
 
+/*
+ * OID BATCHES
+ *
+ * Object ids are handed out from per-CPU batches, each refilled from
+ * ->next_to_use by REISER4_OID_BATCH ids under the super block spin lock.
+ * Allocations and releases are counted per CPU as well and are added up
+ * by oids_used().
+ *
+ * ->next_to_use is above all ids in batches, and it is what goes to disk
+ * with every commit, so ids of a batch are never handed out again after a
+ * crash: they are just skipped. At unmount ids left in batches are given
+ * back, see oid_return_batches().
+ */
+
+/**
+ * reiser4_init_oid_batches - allocate per-CPU oid batches
+ * @super: super block being mounted
+ *
+ * Failure to allocate is not fatal: oids are then allocated under the super
+ * block spin lock one by one.
+ */
+void reiser4_init_oid_batches(struct super_block *super)
+{
+	reiser4_super_info_data *sbinfo = get_super_private(super);
+	int cpu;
+
+	sbinfo->oid_batches = alloc_percpu_gfp(struct reiser4_oid_batch,
+					       GFP_KERNEL | __GFP_NOWARN);
+	if (sbinfo->oid_batches == NULL)
+		return;
+	for_each_possible_cpu(cpu)
+		spin_lock_init(&per_cpu_ptr(sbinfo->oid_batches, cpu)->guard);
+}
+
+/**
+ * reiser4_done_oid_batches - free per-CPU oid batches
+ * @super: super block being unmounted
+ */
+void reiser4_done_oid_batches(struct super_block *super)
+{
+	reiser4_super_info_data *sbinfo = get_super_private(super);
+
+	free_percpu(sbinfo->oid_batches);
+	sbinfo->oid_batches = NULL;
+}
+
+/**
+ * oid_return_batches - give oids of per-CPU batches back
+ * @super: super block being unmounted
+ *
+ * Batches are emptied and their counts are added to ->oids_in_use. The
+ * unused ids of a batch are given back if they are right below
+ * ->next_to_use, which is the case for all batches at once when nobody
+ * allocated ids after them. This is called before the super block is
+ * written for the last time.
+ */
+void oid_return_batches(struct super_block *super)
+{
+	reiser4_super_info_data *sbinfo = get_super_private(super);
+	int returned;
+	int cpu;
+
+	if (sbinfo->oid_batches == NULL)
+		return;
+	do {
+		returned = 0;
+		for_each_possible_cpu(cpu) {
+			struct reiser4_oid_batch *batch;
+
+			batch = per_cpu_ptr(sbinfo->oid_batches, cpu);
+			spin_lock(&batch->guard);
+			spin_lock_reiser4_super(sbinfo);
+			sbinfo->oids_in_use += batch->used;
+			batch->used = 0;
+			if (batch->next != batch->end &&
+			    batch->end == sbinfo->next_to_use) {
+				sbinfo->next_to_use = batch->next;
+				batch->end = batch->next;
+				returned = 1;
+			}
+			spin_unlock_reiser4_super(sbinfo);
+			spin_unlock(&batch->guard);
+		}
+	} while (returned);
+}
+
 /*
  * initialize in-memory data for oid allocator at @super. @nr_files and @next
  * are provided by disk format plugin that reads them from the disk during
@@ -17,25 +105,31 @@
 int oid_init_allocator(struct super_block *super, oid_t nr_files, oid_t next)
 {
 	reiser4_super_info_data *sbinfo;
+	int cpu;
 
 	sbinfo = get_super_private(super);
 
 	sbinfo->next_to_use = next;
 	sbinfo->oids_in_use = nr_files;
+	/* this is called again when journal is replayed, nothing is allocated
+	   yet */
+	if (sbinfo->oid_batches != NULL) {
+		for_each_possible_cpu(cpu) {
+			struct reiser4_oid_batch *batch;
+
+			batch = per_cpu_ptr(sbinfo->oid_batches, cpu);
+			batch->next = batch->end = 0;
+			batch->used = 0;
+		}
+	}
 	return 0;
 }
 
-/*
- * allocate oid and return it. ABSOLUTE_MAX_OID is returned when allocator
- * runs out of oids.
- */
-oid_t oid_allocate(struct super_block *super)
+/* take oid from super block under its spin lock */
+static oid_t oid_allocate_exact(reiser4_super_info_data *sbinfo)
 {
-	reiser4_super_info_data *sbinfo;
 	oid_t oid;
 
-	sbinfo = get_super_private(super);
-
 	spin_lock_reiser4_super(sbinfo);
 	if (sbinfo->next_to_use != ABSOLUTE_MAX_OID) {
 		oid = sbinfo->next_to_use++;
@@ -46,25 +140,68 @@ oid_t oid_allocate(struct super_block *super)
 	return oid;
 }
 
+/*
+ * allocate oid and return it. ABSOLUTE_MAX_OID is returned when allocator
+ * runs out of oids.
+ */
+oid_t oid_allocate(struct super_block *super)
+{
+	reiser4_super_info_data *sbinfo;
+	struct reiser4_oid_batch *batch;
+	oid_t oid = ABSOLUTE_MAX_OID;
+
+	sbinfo = get_super_private(super);
+	if (sbinfo->oid_batches == NULL)
+		return oid_allocate_exact(sbinfo);
+
+	batch = get_cpu_ptr(sbinfo->oid_batches);
+	spin_lock(&batch->guard);
+	if (batch->next == batch->end) {
+		spin_lock_reiser4_super(sbinfo);
+		batch->next = sbinfo->next_to_use;
+		if (ABSOLUTE_MAX_OID - batch->next > REISER4_OID_BATCH)
+			sbinfo->next_to_use += REISER4_OID_BATCH;
+		else
+			sbinfo->next_to_use = ABSOLUTE_MAX_OID;
+		batch->end = sbinfo->next_to_use;
+		spin_unlock_reiser4_super(sbinfo);
+	}
+	if (batch->next != batch->end) {
+		oid = batch->next++;
+		batch->used++;
+	}
+	spin_unlock(&batch->guard);
+	put_cpu_ptr(sbinfo->oid_batches);
+	return oid;
+}
+
 /*
  * Tell oid allocator that @oid is now free.
  */
 int oid_release(struct super_block *super, oid_t oid UNUSED_ARG)
 {
 	reiser4_super_info_data *sbinfo;
+	struct reiser4_oid_batch *batch;
 
 	sbinfo = get_super_private(super);
 
-	spin_lock_reiser4_super(sbinfo);
-	sbinfo->oids_in_use--;
-	spin_unlock_reiser4_super(sbinfo);
+	if (sbinfo->oid_batches == NULL) {
+		spin_lock_reiser4_super(sbinfo);
+		sbinfo->oids_in_use--;
+		spin_unlock_reiser4_super(sbinfo);
+		return 0;
+	}
+	batch = get_cpu_ptr(sbinfo->oid_batches);
+	spin_lock(&batch->guard);
+	batch->used--;
+	spin_unlock(&batch->guard);
+	put_cpu_ptr(sbinfo->oid_batches);
 	return 0;
 }
 
 /*
- * return next @oid that would be allocated (i.e., returned by oid_allocate())
- * without actually allocating it. This is used by disk format plugin to save
- * oid allocator state on the disk.
+ * return @oid above all oids allocated or reserved in batches. This is used by
+ * disk format plugin to save oid allocator state on the disk.
  */
 oid_t oid_next(const struct super_block *super)
 {
@@ -88,12 +225,17 @@ long oids_used(const struct super_block *super)
 {
 	reiser4_super_info_data *sbinfo;
 	oid_t used;
+	int cpu;
 
 	sbinfo = get_super_private(super);
 
 	spin_lock_reiser4_super(sbinfo);
 	used = sbinfo->oids_in_use;
 	spin_unlock_reiser4_super(sbinfo);
+	if (sbinfo->oid_batches != NULL)
+		for_each_possible_cpu(cpu)
+			used += READ_ONCE(per_cpu_ptr(sbinfo->oid_batches,
+						      cpu)->used);
 	if (used < (__u64) ((long)~0) >> 1)
 		return (long)used;
 	else
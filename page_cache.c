@@ -194,6 +194,7 @@
 #include "entd.h"
 #include "page_cache.h"
 #include "ktxnmgrd.h"
+#include "jdev.h"
 
 #include <linux/types.h>
 #include <linux/fs.h>
@@ -406,6 +407,85 @@ int reiser4_page_io(struct page *page, jnode *node, int rw, gfp_t gfp)
 	return result;
 }
 
+/* completion handler for bio built by reiser4_read_bio_add() */
+static void end_bio_pages_read(struct bio *bio)
+{
+	struct bio_vec *bvec;
+	struct bvec_iter_all iter_all;
+
+	bio_for_each_segment_all(bvec, bio, iter_all) {
+		struct page *page = bvec->bv_page;
+
+		if (!bio->bi_status)
+			SetPageUptodate(page);
+		else {
+			ClearPageUptodate(page);
+			SetPageError(page);
+		}
+		unlock_page(page);
+	}
+	bio_put(bio);
+}
+
+/**
+ * reiser4_read_bio_submit - submit bio built by reiser4_read_bio_add()
+ * @rbio: bio being built
+ */
+void reiser4_read_bio_submit(reiser4_read_bio *rbio)
+{
+	if (rbio->bio != NULL) {
+		submit_bio(rbio->bio);
+		rbio->bio = NULL;
+	}
+}
+
+/**
+ * reiser4_read_bio_add - add page to read bio
+ * @rbio: bio being built
+ * @page: locked page to read
+ * @blocknr: block to read @page from
+ * @nr: number of contiguous blocks starting at @blocknr which are going to
+ * be read, to size new bio
+ *
+ * Pages of contiguous blocks are collected into one bio, which is submitted
+ * when a block does not follow the previous one or the bio is full. Pages
+ * are unlocked when read completes. The caller has to submit the last bio
+ * with reiser4_read_bio_submit(), and do so before it blocks on anything
+ * the holders of those page locks can hold.
+ */
+int reiser4_read_bio_add(reiser4_read_bio *rbio, struct page *page,
+			 reiser4_block_nr blocknr, unsigned int nr)
+{
+	struct super_block *super = page->mapping->host->i_sb;
+	struct bio *bio;
+
+	assert("", PageLocked(page));
+	assert("", super->s_blocksize == PAGE_SIZE);
+	assert("", blocknr != 0 && !reiser4_blocknr_is_fake(&blocknr));
+
+	if (rbio->bio != NULL && rbio->next == blocknr &&
+	    bio_add_page(rbio->bio, page, PAGE_SIZE, 0) == PAGE_SIZE) {
+		rbio->next++;
+		return 0;
+	}
+	reiser4_read_bio_submit(rbio);
+
+	bio = bio_alloc(reiser4_ctx_gfp_mask_get(), min_t(unsigned int, nr,
+							   BIO_MAX_PAGES));
+	if (bio == NULL)
+		return RETERR(-ENOMEM);
+	reiser4_bio_set_block(bio, super, blocknr);
+	bio_set_op_attrs(bio, REQ_OP_READ, 0);
+	bio->bi_end_io = end_bio_pages_read;
+	if (bio_add_page(bio, page, PAGE_SIZE, 0) != PAGE_SIZE) {
+		bio_put(bio);
+		return RETERR(-EINVAL);
+	}
+	rbio->bio = bio;
+	rbio->next = blocknr + 1;
+	return 0;
+}
+
 /* helper function to construct bio for page */
 static struct bio *page_bio(struct page *page, jnode * node, int rw, gfp_t gfp)
 {
@@ -437,11 +517,10 @@ static struct bio *page_bio(struct page *page, jnode * node, int rw, gfp_t gfp)
 		assert("nikita-2275", blocknr != (reiser4_block_nr) 0);
 		assert("nikita-2276", !reiser4_blocknr_is_fake(&blocknr));
 
-		bio_set_dev(bio, super->s_bdev);
 		/* fill bio->bi_iter.bi_sector before calling bio_add_page(), because
 		 * q->merge_bvec_fn may want to inspect it (see
 		 * drivers/md/linear.c:linear_mergeable_bvec() for example. */
-		bio->bi_iter.bi_sector = blocknr * (blksz >> 9);
+		reiser4_bio_set_block(bio, super, blocknr);
 
 		if (!bio_add_page(bio, page, blksz, 0)) {
 			warning("nikita-3452",
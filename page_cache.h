@@ -29,6 +29,17 @@ static inline void lock_and_wait_page_writeback(struct page *page)
 #define jprivate(page) ((jnode *)page_private(page))
 
 extern int reiser4_page_io(struct page *, jnode *, int rw, gfp_t);
+
+/* read bio spanning contiguous blocks, see reiser4_read_bio_add() */
+typedef struct reiser4_read_bio {
+	struct bio *bio;
+	/* block following the last one in @bio */
+	reiser4_block_nr next;
+} reiser4_read_bio;
+
+extern int reiser4_read_bio_add(reiser4_read_bio *, struct page *,
+				reiser4_block_nr, unsigned int nr);
+extern void reiser4_read_bio_submit(reiser4_read_bio *);
 extern void reiser4_drop_page(struct page *);
 extern void reiser4_invalidate_pages(struct address_space *, pgoff_t from,
 				     unsigned long count, int even_cows);
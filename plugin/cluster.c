@@ -18,13 +18,14 @@ static int change_cluster(struct inode *inode,
 	assert("edward-1326", is_reiser4_inode(inode));
 	assert("edward-1327", plugin->h.type_id == REISER4_CLUSTER_PLUGIN_TYPE);
 
-	/* Can't change the cluster plugin for already existent regular files */
-	if (!plugin_of_group(inode_file_plugin(inode), REISER4_DIRECTORY_FILE))
+	/* Can't change the cluster plugin for regular files with data */
+	if (!plugin_of_group(inode_file_plugin(inode), REISER4_DIRECTORY_FILE) &&
+	    (i_size_read(inode) != 0 || inode->i_mapping->nrpages != 0))
 		return RETERR(-EINVAL);
 
 	/* If matches, nothing to change. */
-	if (inode_hash_plugin(inode) != NULL &&
-	    inode_hash_plugin(inode)->h.id == plugin->h.id)
+	if (inode_cluster_plugin(inode) != NULL &&
+	    inode_cluster_plugin(inode)->h.id == plugin->h.id)
 		return 0;
 
 	return aset_set_unsafe(&reiser4_inode_data(inode)->pset,
@@ -6,10 +6,15 @@
 #include "../plugin.h"
 
 #include <linux/lzo.h>
+#include <linux/lz4.h>
 #include <linux/zstd.h>
 #include <linux/zlib.h>
 #include <linux/types.h>
 #include <linux/hardirq.h>
+#include <linux/percpu.h>
+#include <linux/shrinker.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 static int change_compression(struct inode *inode,
 			      reiser4_plugin * plugin,
@@ -452,6 +457,136 @@ zstd1_decompress(coa_t coa, __u8 * src_first, size_t src_len,
 }
 
 
+/******************************************************************************/
+/*                         lz4 compression                                    */
+/******************************************************************************/
+
+/*
+ * lz4 and lz4hc produce the same format: clusters compressed by either of
+ * them are read by the same decompressor, lz4hc just spends more time
+ * looking for matches.
+ */
+
+#define LZ4HC_DEF_LEVEL		LZ4HC_DEFAULT_CLEVEL
+
+static int lz4_init(void)
+{
+	return 0;
+}
+
+static int lz4_overrun(unsigned src_len)
+{
+	return LZ4_compressBound(src_len) - src_len;
+}
+
+static coa_t lz4_alloc_mem(tfm_action act, size_t size)
+{
+	coa_t coa = NULL;
+
+	switch (act) {
+	case TFMA_WRITE:	/* compress */
+		coa = reiser4_vmalloc(size);
+		if (!coa)
+			return ERR_PTR(-ENOMEM);
+		break;
+	case TFMA_READ:		/* decompress */
+		break;
+	default:
+		impossible("", "unknown tfm action");
+	}
+	return coa;
+}
+
+static coa_t lz4_alloc(tfm_action act)
+{
+	return lz4_alloc_mem(act, LZ4_MEM_COMPRESS);
+}
+
+static coa_t lz4hc_alloc(tfm_action act)
+{
+	return lz4_alloc_mem(act, LZ4HC_MEM_COMPRESS);
+}
+
+static void lz4_free(coa_t coa, tfm_action act)
+{
+	assert("", coa != NULL);
+
+	switch (act) {
+	case TFMA_WRITE:	/* compress */
+		vfree(coa);
+		break;
+	case TFMA_READ:		/* decompress */
+		impossible("", "trying to free non-allocated workspace");
+	default:
+		impossible("", "unknown tfm action");
+	}
+	return;
+}
+
+static int lz4_min_size_deflate(void)
+{
+	return 256;
+}
+
+static void
+lz4_compress(coa_t coa, __u8 * src_first, size_t src_len,
+	     __u8 * dst_first, size_t *dst_len)
+{
+	int result;
+
+	assert("", coa != NULL);
+	assert("", src_len != 0);
+
+	result = LZ4_compress_default(src_first, dst_first, src_len,
+				      *dst_len, coa);
+	if (result <= 0 || result >= src_len) {
+		/* failed or incompressible data */
+		*dst_len = src_len;
+		return;
+	}
+	*dst_len = result;
+	return;
+}
+
+static void
+lz4hc_compress(coa_t coa, __u8 * src_first, size_t src_len,
+	       __u8 * dst_first, size_t *dst_len)
+{
+	int result;
+
+	assert("", coa != NULL);
+	assert("", src_len != 0);
+
+	result = LZ4_compress_HC(src_first, dst_first, src_len, *dst_len,
+				 LZ4HC_DEF_LEVEL, coa);
+	if (result <= 0 || result >= src_len) {
+		/* failed or incompressible data */
+		*dst_len = src_len;
+		return;
+	}
+	*dst_len = result;
+	return;
+}
+
+static void
+lz4_decompress(coa_t coa, __u8 * src_first, size_t src_len,
+	       __u8 * dst_first, size_t *dst_len)
+{
+	int result;
+
+	assert("", coa == NULL);
+	assert("", src_len != 0);
+
+	result = LZ4_decompress_safe(src_first, dst_first, src_len, *dst_len);
+	if (result < 0) {
+		warning("", "LZ4_decompress_safe failed\n");
+		return;
+	}
+	*dst_len = result;
+	return;
+}
+
+
 compression_plugin compression_plugins[LAST_COMPRESSION_ID] = {
 	[LZO1_COMPRESSION_ID] = {
 		.h = {
@@ -506,9 +641,260 @@ compression_plugin compression_plugins[LAST_COMPRESSION_ID] = {
 		.checksum = reiser4_adler32,
 		.compress = zstd1_compress,
 		.decompress = zstd1_decompress
+	},
+	[LZ4_COMPRESSION_ID] = {
+		.h = {
+			.type_id = REISER4_COMPRESSION_PLUGIN_TYPE,
+			.id = LZ4_COMPRESSION_ID,
+			.pops = &compression_plugin_ops,
+			.label = "lz4",
+			.desc = "lz4 compression transform",
+			.linkage = {NULL, NULL}
+		},
+		.init = lz4_init,
+		.overrun = lz4_overrun,
+		.alloc = lz4_alloc,
+		.free = lz4_free,
+		.min_size_deflate = lz4_min_size_deflate,
+		.checksum = reiser4_adler32,
+		.compress = lz4_compress,
+		.decompress = lz4_decompress
+	},
+	[LZ4HC_COMPRESSION_ID] = {
+		.h = {
+			.type_id = REISER4_COMPRESSION_PLUGIN_TYPE,
+			.id = LZ4HC_COMPRESSION_ID,
+			.pops = &compression_plugin_ops,
+			.label = "lz4hc",
+			.desc = "lz4hc compression transform",
+			.linkage = {NULL, NULL}
+		},
+		.init = lz4_init,
+		.overrun = lz4_overrun,
+		.alloc = lz4hc_alloc,
+		.free = lz4_free,
+		.min_size_deflate = lz4_min_size_deflate,
+		.checksum = reiser4_adler32,
+		.compress = lz4hc_compress,
+		.decompress = lz4_decompress
 	}
 };
 
+/******************************************************************************/
+/*                      pools of (de)compression workspaces                   */
+/******************************************************************************/
+
+/*
+ * Workspaces of zlib and zstd take hundreds of kilobytes of vmalloc-ed memory
+ * and each cluster operation needs one. Freed workspaces are kept in small
+ * per-CPU pools, one for each compression plugin and transform direction,
+ * and handed out to the next operation. A workspace is returned to the pool
+ * of the CPU it is freed on, which is not necessarily the one it was taken
+ * from, so pools are guarded by spin locks. Memory pressure empties pools via
+ * shrinker.
+ */
+
+struct coa_pool {
+	spinlock_t guard;
+	unsigned nr;
+	coa_t ws[REISER4_COA_POOL_SIZE];
+	unsigned long hits;
+	unsigned long misses;
+};
+
+struct coa_pools {
+	struct coa_pool p[LAST_COMPRESSION_ID][TFMA_LAST];
+};
+
+static DEFINE_PER_CPU(struct coa_pools, coa_pools);
+/* number of workspaces in all pools */
+static atomic_long_t nr_pooled;
+static struct shrinker coa_shrinker;
+
+static struct coa_pool *coa_pool_of(int cpu, reiser4_compression_id id,
+				    tfm_action act)
+{
+	return &per_cpu_ptr(&coa_pools, cpu)->p[id][act];
+}
+
+/**
+ * reiser4_get_coa - get workspace of compression algorithm
+ * @id: compression plugin
+ * @act: transform direction
+ *
+ * Returns workspace from the pool of current CPU, or allocates new one by
+ * ->alloc() method of compression plugin.
+ */
+coa_t reiser4_get_coa(reiser4_compression_id id, tfm_action act)
+{
+	struct coa_pool *pool;
+	coa_t coa = NULL;
+
+	assert("", id < LAST_COMPRESSION_ID && act < TFMA_LAST);
+	assert("", compression_plugins[id].alloc != NULL);
+
+	/* it does not matter if we migrate, the pool is locked anyway */
+	pool = coa_pool_of(raw_smp_processor_id(), id, act);
+	spin_lock(&pool->guard);
+	if (pool->nr != 0) {
+		coa = pool->ws[--pool->nr];
+		pool->hits++;
+	} else
+		pool->misses++;
+	spin_unlock(&pool->guard);
+	if (coa != NULL) {
+		atomic_long_dec(&nr_pooled);
+		return coa;
+	}
+	return compression_plugins[id].alloc(act);
+}
+
+/**
+ * reiser4_put_coa - release workspace got by reiser4_get_coa()
+ * @id: compression plugin
+ * @act: transform direction
+ * @coa: workspace to release
+ *
+ * Puts @coa to the pool of current CPU, frees it by ->free() method of
+ * compression plugin if the pool is full.
+ */
+void reiser4_put_coa(reiser4_compression_id id, tfm_action act, coa_t coa)
+{
+	struct coa_pool *pool;
+
+	assert("", coa != NULL);
+
+	pool = coa_pool_of(raw_smp_processor_id(), id, act);
+	spin_lock(&pool->guard);
+	if (pool->nr < REISER4_COA_POOL_SIZE) {
+		pool->ws[pool->nr++] = coa;
+		coa = NULL;
+	}
+	spin_unlock(&pool->guard);
+	if (coa == NULL) {
+		atomic_long_inc(&nr_pooled);
+		return;
+	}
+	assert("", compression_plugins[id].free != NULL);
+	compression_plugins[id].free(coa, act);
+}
+
+/* free up to @nr workspaces of all pools, return number of freed ones */
+static unsigned long drain_coa_pools(unsigned long nr)
+{
+	unsigned long freed = 0;
+	reiser4_compression_id id;
+	tfm_action act;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		for (id = 0; id < LAST_COMPRESSION_ID; id++)
+			for (act = 0; act < TFMA_LAST; act++) {
+				struct coa_pool *pool;
+				coa_t coa;
+
+				pool = coa_pool_of(cpu, id, act);
+				while (freed < nr) {
+					spin_lock(&pool->guard);
+					coa = pool->nr ?
+						pool->ws[--pool->nr] : NULL;
+					spin_unlock(&pool->guard);
+					if (coa == NULL)
+						break;
+					atomic_long_dec(&nr_pooled);
+					compression_plugins[id].free(coa, act);
+					freed++;
+				}
+			}
+	}
+	return freed;
+}
+
+static unsigned long coa_shrink_count(struct shrinker *shrink,
+				      struct shrink_control *sc)
+{
+	return atomic_long_read(&nr_pooled);
+}
+
+static unsigned long coa_shrink_scan(struct shrinker *shrink,
+				     struct shrink_control *sc)
+{
+	return drain_coa_pools(sc->nr_to_scan);
+}
+
+/**
+ * reiser4_init_coa_pools - initialize pools of compression workspaces
+ *
+ * This is called on reiser4 module initialization.
+ */
+int reiser4_init_coa_pools(void)
+{
+	reiser4_compression_id id;
+	tfm_action act;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		for (id = 0; id < LAST_COMPRESSION_ID; id++)
+			for (act = 0; act < TFMA_LAST; act++)
+				spin_lock_init(&coa_pool_of(cpu, id,
+							    act)->guard);
+	coa_shrinker.count_objects = coa_shrink_count;
+	coa_shrinker.scan_objects = coa_shrink_scan;
+	coa_shrinker.seeks = DEFAULT_SEEKS;
+	return register_shrinker(&coa_shrinker);
+}
+
+/**
+ * reiser4_done_coa_pools - free all pooled compression workspaces
+ *
+ * This is called on reiser4 module unloading.
+ */
+void reiser4_done_coa_pools(void)
+{
+	unregister_shrinker(&coa_shrinker);
+	drain_coa_pools(ULONG_MAX);
+	assert("", atomic_long_read(&nr_pooled) == 0);
+}
+
+/* print "<plugin> <direction> <hits> <misses>" for each pool */
+static int coa_pools_show(struct seq_file *m, void *unused)
+{
+	reiser4_compression_id id;
+	tfm_action act;
+
+	for (id = 0; id < LAST_COMPRESSION_ID; id++)
+		for (act = 0; act < TFMA_LAST; act++) {
+			unsigned long hits = 0;
+			unsigned long misses = 0;
+			int cpu;
+
+			for_each_possible_cpu(cpu) {
+				struct coa_pool *pool;
+
+				pool = coa_pool_of(cpu, id, act);
+				hits += READ_ONCE(pool->hits);
+				misses += READ_ONCE(pool->misses);
+			}
+			seq_printf(m, "%s %s %lu %lu\n",
+				   compression_plugins[id].h.label,
+				   act == TFMA_WRITE ? "deflate" : "inflate",
+				   hits, misses);
+		}
+	seq_printf(m, "pooled %ld\n", atomic_long_read(&nr_pooled));
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(coa_pools);
+
+/**
+ * reiser4_coa_pools_debugfs_init - export workspace pool statistics
+ * @root: reiser4 debugfs directory
+ */
+void reiser4_coa_pools_debugfs_init(struct dentry *root)
+{
+	debugfs_create_file("coa_pools", S_IFREG | S_IRUSR, root, NULL,
+			    &coa_pools_fops);
+}
+
 /*
   Local variables:
   c-indentation-style: "K&R"
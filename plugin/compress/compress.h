@@ -16,6 +16,8 @@ typedef enum {
 	LZO1_COMPRESSION_ID,
 	GZIP1_COMPRESSION_ID,
 	ZSTD1_COMPRESSION_ID,
+	LZ4_COMPRESSION_ID,
+	LZ4HC_COMPRESSION_ID,
 	LAST_COMPRESSION_ID,
 } reiser4_compression_id;
 
@@ -29,6 +31,16 @@ typedef void *coa_t;
 typedef coa_t coa_set[LAST_COMPRESSION_ID][TFMA_LAST];
 
 __u32 reiser4_adler32(char *data, __u32 len);
+int reiser4_sample_entropy(const __u8 *data, size_t len);
+
+struct dentry;
+coa_t reiser4_get_coa(reiser4_compression_id id, tfm_action act);
+void reiser4_put_coa(reiser4_compression_id id, tfm_action act, coa_t coa);
+int reiser4_init_coa_pools(void);
+void reiser4_done_coa_pools(void);
+void reiser4_coa_pools_debugfs_init(struct dentry *root);
+void reiser4_compress_bench_debugfs_init(struct dentry *root);
+void reiser4_done_compress_bench(void);
 
 #endif				/* __FS_REISER4_COMPRESS_H__ */
 
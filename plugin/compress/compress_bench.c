@@ -0,0 +1,247 @@
+/* Copyright 2001, 2002, 2003 by Hans Reiser, licensing governed by
+ * reiser4/README */
+
+/*
+ * Benchmark of compression plugins.
+ *
+ * A sample corpus is written to the compress_bench debugfs file, reading
+ * the file runs ->compress() and ->decompress() methods of every compression
+ * plugin on the corpus split in logical clusters of every supported size and
+ * reports for each plugin and cluster size:
+ *
+ *   clusters  number of complete clusters in the corpus
+ *   ratio     size of compressed clusters in percents of the original size.
+ *             Incompressible clusters count as stored uncompressed
+ *   deflate   compression throughput, MB/s
+ *   inflate   decompression throughput, MB/s
+ *   skipped   clusters "sampl" compression mode would not compress
+ *   missed    skipped clusters which are compressible
+ *
+ * Example:
+ *
+ *   cat corpus > /sys/kernel/debug/reiser4/compress_bench
+ *   cat /sys/kernel/debug/reiser4/compress_bench
+ *
+ * Writing at offset 0 replaces the corpus, at most REISER4_BENCH_MAX_BYTES
+ * are kept.
+ */
+
+#include "../../debug.h"
+#include "../../inode.h"
+#include "../plugin.h"
+
+#include <linux/vmalloc.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/mutex.h>
+#include <linux/ktime.h>
+
+/* protects the corpus */
+static DEFINE_MUTEX(bench_guard);
+static char *bench_data;
+static size_t bench_len;
+
+struct bench_result {
+	unsigned long clusters;
+	u64 in_bytes;
+	u64 out_bytes;
+	u64 deflate_ns;
+	u64 inflate_ns;
+	unsigned long skipped;
+	unsigned long missed;
+	unsigned long corrupted;
+};
+
+/* MB/s of @bytes processed in @ns */
+static unsigned long mbps(u64 bytes, u64 ns)
+{
+	return div64_u64(bytes * 1000, ns + 1);
+}
+
+static int bench_plugin(compression_plugin *cplug, size_t csize,
+			struct bench_result *res)
+{
+	coa_t coa_w = NULL;
+	coa_t coa_r = NULL;
+	__u8 *out = NULL;
+	__u8 *back = NULL;
+	size_t off;
+	int result = 0;
+
+	memset(res, 0, sizeof(*res));
+	if (cplug->alloc != NULL) {
+		coa_w = cplug->alloc(TFMA_WRITE);
+		if (IS_ERR(coa_w))
+			return PTR_ERR(coa_w);
+		coa_r = cplug->alloc(TFMA_READ);
+		if (IS_ERR(coa_r)) {
+			result = PTR_ERR(coa_r);
+			coa_r = NULL;
+			goto out;
+		}
+	}
+	out = vmalloc(csize + (cplug->overrun ? cplug->overrun(csize) : 0));
+	back = vmalloc(csize);
+	if (out == NULL || back == NULL) {
+		result = RETERR(-ENOMEM);
+		goto out;
+	}
+
+	for (off = 0; off + csize <= bench_len; off += csize) {
+		__u8 *src = (__u8 *)bench_data + off;
+		size_t dst_len = csize +
+			(cplug->overrun ? cplug->overrun(csize) : 0);
+		size_t back_len = csize;
+		int skip;
+		u64 start;
+
+		skip = reiser4_sample_entropy(src, csize) >
+			REISER4_SAMPLE_ENTROPY_MAX;
+
+		start = ktime_get_ns();
+		cplug->compress(coa_w, src, csize, out, &dst_len);
+		res->deflate_ns += ktime_get_ns() - start;
+
+		res->clusters++;
+		res->in_bytes += csize;
+		res->skipped += skip;
+		if (dst_len >= csize) {
+			/* incompressible, would be stored as is */
+			res->out_bytes += csize;
+			cond_resched();
+			continue;
+		}
+		res->out_bytes += dst_len;
+		res->missed += skip;
+
+		start = ktime_get_ns();
+		cplug->decompress(coa_r, out, dst_len, back, &back_len);
+		res->inflate_ns += ktime_get_ns() - start;
+		if (back_len != csize || memcmp(back, src, csize))
+			res->corrupted++;
+		cond_resched();
+	}
+ out:
+	vfree(back);
+	vfree(out);
+	if (coa_r != NULL)
+		cplug->free(coa_r, TFMA_READ);
+	if (coa_w != NULL)
+		cplug->free(coa_w, TFMA_WRITE);
+	return result;
+}
+
+static int compress_bench_show(struct seq_file *m, void *unused)
+{
+	reiser4_compression_id id;
+	reiser4_cluster_id cid;
+
+	mutex_lock(&bench_guard);
+	seq_printf(m, "corpus %zu\n", bench_len);
+	seq_puts(m, "plugin cluster clusters ratio deflate inflate "
+		 "skipped missed\n");
+	for (id = 0; id < LAST_COMPRESSION_ID; id++) {
+		compression_plugin *cplug = compression_plugin_by_id(id);
+
+		for (cid = 0; cid < LAST_CLUSTER_ID; cid++) {
+			cluster_plugin *clplug = cluster_plugin_by_id(cid);
+			struct bench_result res;
+			int result;
+
+			if (bench_len < (1 << clplug->shift))
+				continue;
+			result = bench_plugin(cplug, 1 << clplug->shift, &res);
+			if (result) {
+				seq_printf(m, "%s %s error %d\n",
+					   cplug->h.label, clplug->h.label,
+					   result);
+				continue;
+			}
+			seq_printf(m, "%s %s %lu %llu%% %lu %lu %lu %lu\n",
+				   cplug->h.label, clplug->h.label,
+				   res.clusters,
+				   (unsigned long long)
+				   div64_u64(res.out_bytes * 100,
+					     res.in_bytes),
+				   mbps(res.in_bytes, res.deflate_ns),
+				   mbps(res.in_bytes, res.inflate_ns),
+				   res.skipped, res.missed);
+			if (res.corrupted)
+				warning("", "%s: %lu clusters inflated wrong",
+					cplug->h.label, res.corrupted);
+		}
+	}
+	mutex_unlock(&bench_guard);
+	return 0;
+}
+
+static int compress_bench_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, compress_bench_show, NULL);
+}
+
+static ssize_t compress_bench_write(struct file *file, const char __user *buf,
+				    size_t count, loff_t *ppos)
+{
+	ssize_t result;
+
+	mutex_lock(&bench_guard);
+	if (bench_data == NULL) {
+		bench_data = vmalloc(REISER4_BENCH_MAX_BYTES);
+		if (bench_data == NULL) {
+			mutex_unlock(&bench_guard);
+			return RETERR(-ENOMEM);
+		}
+	}
+	if (*ppos == 0)
+		bench_len = 0;
+	result = simple_write_to_buffer(bench_data, REISER4_BENCH_MAX_BYTES,
+					ppos, buf, count);
+	if (result > 0 && *ppos > bench_len)
+		bench_len = *ppos;
+	mutex_unlock(&bench_guard);
+	return result;
+}
+
+static const struct file_operations compress_bench_fops = {
+	.owner = THIS_MODULE,
+	.open = compress_bench_open,
+	.read = seq_read,
+	.write = compress_bench_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/**
+ * reiser4_compress_bench_debugfs_init - export benchmark of compression
+ * plugins
+ * @root: reiser4 debugfs directory
+ */
+void reiser4_compress_bench_debugfs_init(struct dentry *root)
+{
+	debugfs_create_file("compress_bench", S_IFREG | S_IRUSR | S_IWUSR,
+			    root, NULL, &compress_bench_fops);
+}
+
+/**
+ * reiser4_done_compress_bench - free the corpus
+ *
+ * This is called on reiser4 module unloading, after debugfs files are
+ * removed.
+ */
+void reiser4_done_compress_bench(void)
+{
+	vfree(bench_data);
+	bench_data = NULL;
+	bench_len = 0;
+}
+
+/* Make Linus happy.
+   Local variables:
+   c-indentation-style: "K&R"
+   mode-name: "LC"
+   c-basic-offset: 8
+   tab-width: 8
+   fill-column: 120
+   End:
+*/
@@ -9,6 +9,8 @@
 #include "../../inode.h"
 #include "../plugin.h"
 
+#include <linux/log2.h>
+
 static int should_deflate_none(struct inode * inode, cloff_t index)
 {
 	return 0;
@@ -71,6 +73,61 @@ static int should_deflate_lattd(struct inode * inode, cloff_t index)
 			      (cryptcompress_inode_data(inode)));
 }
 
+/* Sample compression mode: estimate compressibility of each cluster by
+   entropy of a small sample of its content and do not waste time on data
+   which are compressed already (media, archives).
+
+   Number of bits per byte of a sample is log2(n) - sum(c * log2(c)) / n,
+   where n is the size of the sample and c are counts of byte values in it.
+   Logarithms are computed as ilog2(x^4), that is with 2 bits after the
+   point. */
+
+#define SAMPLE_SIZE (REISER4_SAMPLE_CHUNKS * REISER4_SAMPLE_CHUNK_SIZE)
+
+static unsigned ilog2_w(u64 x)
+{
+	return ilog2(x * x * x * x);
+}
+
+/**
+ * reiser4_sample_entropy - estimate compressibility of data
+ * @data: data to estimate
+ * @len: size of @data
+ *
+ * Returns entropy of a sample of @data in percents of 8 bits per byte, or -1
+ * if @data is too short to be sampled.
+ */
+int reiser4_sample_entropy(const __u8 *data, size_t len)
+{
+	u16 counts[256];
+	size_t step;
+	u64 sum = 0;
+	int i;
+	int j;
+
+	if (len < 2 * SAMPLE_SIZE)
+		/* not worth estimation */
+		return -1;
+	memset(counts, 0, sizeof(counts));
+	step = len / REISER4_SAMPLE_CHUNKS;
+	for (i = 0; i < REISER4_SAMPLE_CHUNKS; i++, data += step)
+		for (j = 0; j < REISER4_SAMPLE_CHUNK_SIZE; j++)
+			counts[data[j]]++;
+
+	for (i = 0; i < 256; i++)
+		if (counts[i])
+			sum += counts[i] * ilog2_w(counts[i]);
+	/* entropy of the sample in quarters of bit per byte */
+	sum = ilog2_w(SAMPLE_SIZE) - div_u64(sum, SAMPLE_SIZE);
+	return div_u64(sum * 100, 4 * 8);
+}
+
+static int should_deflate_data_sampl(struct inode *inode, cloff_t index,
+				     const __u8 *data, size_t len)
+{
+	return reiser4_sample_entropy(data, len) <= REISER4_SAMPLE_ENTROPY_MAX;
+}
+
 /* compression mode_plugins */
 compression_mode_plugin compression_mode_plugins[LAST_COMPRESSION_MODE_ID] = {
 	[NONE_COMPRESSION_MODE_ID] = {
@@ -147,6 +204,22 @@ compression_mode_plugin compression_mode_plugins[LAST_COMPRESSION_MODE_ID] = {
 		.should_deflate = should_deflate_common,
 		.accept_hook = NULL,
 		.discard_hook = NULL
+	},
+	/* Sample compression mode:
+	   Compress clusters whose content does not look random */
+	[SAMPL_COMPRESSION_MODE_ID] = {
+		.h = {
+			.type_id = REISER4_COMPRESSION_MODE_PLUGIN_TYPE,
+			.id = SAMPL_COMPRESSION_MODE_ID,
+			.pops = NULL,
+			.label = "sampl",
+			.desc = "Sample cluster content",
+			.linkage = {NULL, NULL}
+		},
+		.should_deflate = NULL,
+		.should_deflate_data = should_deflate_data_sampl,
+		.accept_hook = NULL,
+		.discard_hook = NULL
 	}
 };
 
@@ -22,6 +22,14 @@ void build_entry_key_hashed(const struct inode *, const struct qstr *,
 void build_entry_key_seekable(const struct inode *, const struct qstr *,
 			      reiser4_key *);
 
+/* negative lookup filter of large directories */
+struct lookup_filter;
+int reiser4_lookup_filter_test(struct inode *, const struct qstr *);
+void reiser4_lookup_filter_missed(struct inode *, const struct qstr *);
+void reiser4_lookup_filter_add(struct inode *, const struct qstr *);
+void reiser4_lookup_filter_remove(struct inode *);
+void reiser4_lookup_filter_debugfs_init(struct dentry *root);
+
 /* __REISER4_DIR_H__ */
 #endif
 
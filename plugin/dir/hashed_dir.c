@@ -24,6 +24,14 @@
  * a portion of file name. Directory item uses this knowledge to avoid storing
  * this portion of file name twice: in the key and in the directory item body.
  *
+ * All entries of a directory share one locality, objectid of the directory.
+ * Within it they are ordered by fibration group and hash of the name, so
+ * entries of a large directory are spread over many leaves, and inserts of
+ * different names go to different leaves already. Entries are not sharded
+ * over several localities: readdir, seekdir positions (see seekable_dir.c),
+ * emptiness checks and lookups all rely on the entries of a directory
+ * forming one contiguous key range.
+ *
  */
 
 #include "../../inode.h"
@@ -0,0 +1,363 @@
+/* Copyright 2001, 2002, 2003 by Hans Reiser, licensing governed by
+ * reiser4/README */
+
+/*
+ * Negative lookup filter of large directories.
+ *
+ * Lookup of a name which is not in a directory costs a tree traversal down to
+ * the leaf level, and build systems and language runtimes probe lots of such
+ * names. A directory of not less than REISER4_LOOKUP_FILTER_MIN_ENTRIES
+ * entries gets a Bloom filter of its names, built by the first lookup which
+ * finds none: lookups of names the filter does not contain return -ENOENT
+ * without touching the tree.
+ *
+ * The filter is built for twice as many names as the directory has, with
+ * REISER4_LOOKUP_FILTER_BITS bits per name. Names added to the directory are
+ * added to the filter, see reiser4_add_entry_common(). Names can not be
+ * removed from Bloom filter, so removals are only counted, see
+ * reiser4_rem_entry_common(). The filter is dropped, to be rebuilt by a
+ * lookup later, when the number of names added exceeds what it was built
+ * for, or when half of its names are removed.
+ *
+ * The filter is used by ->lookup() only, which is called with i_rwsem of the
+ * directory held shared at least, and it is updated and dropped by
+ * ->add_entry() and ->rem_entry(), which are called with i_rwsem held
+ * exclusively. So the only race is between lookups building the filter
+ * simultaneously, inode spin lock resolves it.
+ */
+
+#include "../../inode.h"
+
+#include <linux/jhash.h>
+#include <linux/log2.h>
+#include <linux/mm.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+/* number of hash functions. Together with 16 bits per name of the filter
+   just built it makes false positive rate about 0.05%, with 8 bits per name
+   of the full filter - about 2% */
+#define LOOKUP_FILTER_HASHES (6)
+
+struct lookup_filter {
+	/* number of names added */
+	unsigned long nr;
+	/* number of names the filter is built for */
+	unsigned long capacity;
+	/* number of names removed from the directory since the filter was
+	   built */
+	unsigned long removed;
+	/* log2 of number of bits */
+	unsigned shift;
+	unsigned long bits[];
+};
+
+static atomic_long_t lf_filters;
+static atomic_long_t lf_bytes;
+static atomic_long_t lf_builds;
+static atomic_long_t lf_drops;
+static atomic_long_t lf_lookups;
+static atomic_long_t lf_rejected;
+static atomic_long_t lf_false_positives;
+
+static size_t lookup_filter_size(unsigned shift)
+{
+	return sizeof(struct lookup_filter) +
+		BITS_TO_LONGS(1ul << shift) * sizeof(unsigned long);
+}
+
+static struct lookup_filter *lookup_filter_alloc(unsigned long capacity)
+{
+	struct lookup_filter *lf;
+	unsigned shift;
+
+	shift = order_base_2(capacity * REISER4_LOOKUP_FILTER_BITS);
+	lf = kvzalloc(lookup_filter_size(shift),
+		      reiser4_ctx_gfp_mask_get() | __GFP_NOWARN);
+	if (lf == NULL)
+		return NULL;
+	lf->capacity = capacity;
+	lf->shift = shift;
+	atomic_long_inc(&lf_filters);
+	atomic_long_add(lookup_filter_size(shift), &lf_bytes);
+	return lf;
+}
+
+static void lookup_filter_free(struct lookup_filter *lf)
+{
+	atomic_long_dec(&lf_filters);
+	atomic_long_sub(lookup_filter_size(lf->shift), &lf_bytes);
+	kvfree(lf);
+}
+
+/* bits of @name are got by double hashing */
+static void name_hashes(const char *name, unsigned len, u32 *h1, u32 *h2)
+{
+	*h1 = jhash(name, len, 0);
+	*h2 = jhash(name, len, *h1) | 1;
+}
+
+static void lookup_filter_add(struct lookup_filter *lf, const char *name,
+			      unsigned len)
+{
+	unsigned long mask = (1ul << lf->shift) - 1;
+	u32 h1, h2;
+	int i;
+
+	name_hashes(name, len, &h1, &h2);
+	for (i = 0; i < LOOKUP_FILTER_HASHES; i++)
+		set_bit((h1 + i * h2) & mask, lf->bits);
+	lf->nr++;
+}
+
+static int lookup_filter_test(const struct lookup_filter *lf,
+			      const char *name, unsigned len)
+{
+	unsigned long mask = (1ul << lf->shift) - 1;
+	u32 h1, h2;
+	int i;
+
+	name_hashes(name, len, &h1, &h2);
+	for (i = 0; i < LOOKUP_FILTER_HASHES; i++)
+		if (!test_bit((h1 + i * h2) & mask, lf->bits))
+			return 0;
+	return 1;
+}
+
+/* add names of all entries of @dir to @lf */
+static int fill_lookup_filter(struct inode *dir, struct lookup_filter *lf)
+{
+	de_id did;
+	reiser4_key key;
+	coord_t coord;
+	lock_handle lh;
+	tap_t tap;
+	char buf[DE_NAME_BUF_LEN];
+	int result;
+
+	/* key of the first entry of the directory, as readdir from the
+	   beginning does */
+	memset(&did, 0, sizeof(did));
+	result = extract_key_from_de_id(get_inode_oid(dir), &did, &key);
+	if (result != 0)
+		return result;
+
+	coord_init_zero(&coord);
+	init_lh(&lh);
+	reiser4_tap_init(&tap, &coord, &lh, ZNODE_READ_LOCK);
+	result = reiser4_object_lookup(dir, &key, &coord, &lh, ZNODE_READ_LOCK,
+				       FIND_EXACT, LEAF_LEVEL, LEAF_LEVEL, 0,
+				       &tap.ra_info);
+	if (result != CBK_COORD_FOUND) {
+		reiser4_tap_done(&tap);
+		return cbk_errored(result) ? result : RETERR(-EIO);
+	}
+	tap.prefetch = REISER4_TAP_PREFETCH_PERCENT;
+	result = reiser4_tap_load(&tap);
+	while (result == 0) {
+		item_plugin *iplug = item_plugin_by_coord(&coord);
+		char *name;
+
+		if (!plugin_of_group(iplug, DIR_ENTRY_ITEM_TYPE) ||
+		    !inode_file_plugin(dir)->owns_item(dir, &coord))
+			break;
+		if (lf->nr == lf->capacity) {
+			/* i_size is wrong */
+			result = RETERR(-EIO);
+			break;
+		}
+		name = iplug->s.dir.extract_name(&coord, buf);
+		lookup_filter_add(lf, name, strlen(name));
+
+		if (fatal_signal_pending(current)) {
+			result = RETERR(-EINTR);
+			break;
+		}
+		result = go_next_unit(&tap);
+	}
+	if (result == -E_NO_NEIGHBOR || result == -ENOENT)
+		result = 0;
+	reiser4_tap_relse(&tap);
+	reiser4_tap_done(&tap);
+	return result;
+}
+
+/* get filter of @dir, build it if there is none */
+static struct lookup_filter *get_lookup_filter(struct inode *dir)
+{
+	reiser4_inode *info = reiser4_inode_data(dir);
+	struct lookup_filter *lf;
+
+	lf = READ_ONCE(info->lookup_filter);
+	if (lf != NULL)
+		return lf;
+
+	lf = lookup_filter_alloc(dir->i_size * 2);
+	if (lf == NULL)
+		return NULL;
+	if (fill_lookup_filter(dir, lf) != 0) {
+		lookup_filter_free(lf);
+		return NULL;
+	}
+	atomic_long_inc(&lf_builds);
+
+	spin_lock_inode(dir);
+	if (info->lookup_filter == NULL) {
+		/* paired with READ_ONCE() above */
+		smp_store_release(&info->lookup_filter, lf);
+		lf = NULL;
+	}
+	spin_unlock_inode(dir);
+	if (lf != NULL)
+		/* other lookup built it meanwhile */
+		lookup_filter_free(lf);
+	return info->lookup_filter;
+}
+
+/**
+ * reiser4_lookup_filter_test - check whether name can be in directory
+ * @dir: directory to lookup in
+ * @name: name to look for
+ *
+ * Returns 0 if @name is surely not in @dir, 1 if it may be. Filter of large
+ * directory is built here if there is none. This is called by ->lookup()
+ * with i_rwsem of @dir held.
+ */
+int reiser4_lookup_filter_test(struct inode *dir, const struct qstr *name)
+{
+	struct lookup_filter *lf;
+
+	if (dir->i_size < REISER4_LOOKUP_FILTER_MIN_ENTRIES ||
+	    dir->i_size > REISER4_LOOKUP_FILTER_MAX_ENTRIES)
+		return 1;
+	if (!inode_dir_plugin(dir)->is_name_acceptable(dir, name->name,
+						       name->len))
+		/* let lookup report the error */
+		return 1;
+	lf = get_lookup_filter(dir);
+	if (lf == NULL)
+		return 1;
+	atomic_long_inc(&lf_lookups);
+	if (lookup_filter_test(lf, name->name, name->len))
+		return 1;
+	atomic_long_inc(&lf_rejected);
+	return 0;
+}
+
+/**
+ * reiser4_lookup_filter_missed - count false positive of directory filter
+ * @dir: directory name was not found in
+ * @name: name which was not found
+ *
+ * This is called when lookup allowed by reiser4_lookup_filter_test() fails to
+ * find @name.
+ */
+void reiser4_lookup_filter_missed(struct inode *dir, const struct qstr *name)
+{
+	struct lookup_filter *lf;
+
+	lf = READ_ONCE(reiser4_inode_data(dir)->lookup_filter);
+	if (lf != NULL && lookup_filter_test(lf, name->name, name->len))
+		atomic_long_inc(&lf_false_positives);
+}
+
+/* drop filter of @dir, a lookup will build new one */
+static void drop_lookup_filter(struct inode *dir)
+{
+	reiser4_inode *info = reiser4_inode_data(dir);
+	struct lookup_filter *lf;
+
+	spin_lock_inode(dir);
+	lf = info->lookup_filter;
+	info->lookup_filter = NULL;
+	spin_unlock_inode(dir);
+	if (lf != NULL) {
+		lookup_filter_free(lf);
+		atomic_long_inc(&lf_drops);
+	}
+}
+
+/**
+ * reiser4_lookup_filter_add - update directory filter on name addition
+ * @dir: directory name is added to
+ * @name: new name
+ *
+ * This is called with i_rwsem of @dir held exclusively.
+ */
+void reiser4_lookup_filter_add(struct inode *dir, const struct qstr *name)
+{
+	struct lookup_filter *lf = reiser4_inode_data(dir)->lookup_filter;
+
+	if (lf == NULL)
+		return;
+	if (lf->nr == lf->capacity)
+		drop_lookup_filter(dir);
+	else
+		lookup_filter_add(lf, name->name, name->len);
+}
+
+/**
+ * reiser4_lookup_filter_remove - update directory filter on name removal
+ * @dir: directory name is removed from
+ *
+ * This is called with i_rwsem of @dir held exclusively.
+ */
+void reiser4_lookup_filter_remove(struct inode *dir)
+{
+	struct lookup_filter *lf = reiser4_inode_data(dir)->lookup_filter;
+
+	if (lf != NULL && ++lf->removed > lf->nr / 2)
+		drop_lookup_filter(dir);
+}
+
+/**
+ * reiser4_lookup_filter_done - free directory filter
+ * @info: reiser4 inode being destroyed
+ */
+void reiser4_lookup_filter_done(reiser4_inode *info)
+{
+	if (info->lookup_filter != NULL) {
+		lookup_filter_free(info->lookup_filter);
+		info->lookup_filter = NULL;
+	}
+}
+
+/* print number and memory of filters, how often they are consulted and how
+   well they work. False positive rate is in hundredths of percent */
+static int lookup_filter_show(struct seq_file *m, void *unused)
+{
+	long rejected = atomic_long_read(&lf_rejected);
+	long fp = atomic_long_read(&lf_false_positives);
+
+	seq_printf(m, "filters %ld\nbytes %ld\nbuilds %ld\ndrops %ld\n",
+		   atomic_long_read(&lf_filters),
+		   atomic_long_read(&lf_bytes),
+		   atomic_long_read(&lf_builds),
+		   atomic_long_read(&lf_drops));
+	seq_printf(m, "lookups %ld\nrejected %ld\nfalse_positives %ld\n",
+		   atomic_long_read(&lf_lookups), rejected, fp);
+	seq_printf(m, "false_positive_rate %ld\n",
+		   fp + rejected ? fp * 10000 / (fp + rejected) : 0);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(lookup_filter);
+
+/**
+ * reiser4_lookup_filter_debugfs_init - export directory filter statistics
+ * @root: reiser4 debugfs directory
+ */
+void reiser4_lookup_filter_debugfs_init(struct dentry *root)
+{
+	debugfs_create_file("lookup_filter", S_IFREG | S_IRUSR, root, NULL,
+			    &lookup_filter_fops);
+}
+
+/* Make Linus happy.
+   Local variables:
+   c-indentation-style: "K&R"
+   mode-name: "LC"
+   c-basic-offset: 8
+   tab-width: 8
+   fill-column: 120
+   End:
+*/
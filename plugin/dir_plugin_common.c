@@ -163,6 +163,7 @@ int reiser4_add_entry_common(struct inode *object, /* directory to add new name
 			reiser4_adjust_dir_file(object, where,
 						fsdata->dec.pos + 1, +1);
 			INODE_INC_FIELD(object, i_size);
+			reiser4_lookup_filter_add(object, &where->d_name);
 		}
 	} else if (result == 0) {
 		assert("nikita-2232", coord->node == lh.node);
@@ -267,6 +268,7 @@ int reiser4_rem_entry_common(struct inode *dir,
 		    WITH_COORD(coord,
 			       rem_entry(dir, dentry, entry, coord, &lh));
 		if (result == 0) {
+			reiser4_lookup_filter_remove(dir);
 			if (dir->i_size >= 1)
 				INODE_DEC_FIELD(dir, i_size);
 			else {
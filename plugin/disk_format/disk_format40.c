@@ -15,6 +15,8 @@
 #include "../../inode.h"
 #include "../../ktxnmgrd.h"
 #include "../../status_flags.h"
+#include "../../magazine.h"
+#include "../../discard.h"
 
 #include <linux/types.h>	/* for __u??  */
 #include <linux/fs.h>		/* for struct super_block  */
@@ -532,6 +534,8 @@ int release_format40(struct super_block *s)
 	assert("zam-579", sbinfo != NULL);
 
 	if (!sb_rdonly(s)) {
+		/* so that next oid stored on disk is exact */
+		oid_return_batches(s);
 		ret = reiser4_capture_super_block(s);
 		if (ret != 0)
 			warning("vs-898",
@@ -542,18 +546,22 @@ int release_format40(struct super_block *s)
 		if (ret != 0)
 			warning("jmacd-74438", "txn_force failed: %d", ret);
 
+		/* after everything else is on disk, so that it is exact */
+		sa_save_summary(&sbinfo->space_allocator, s);
 		all_grabbed2free();
 	}
 
+	reiser4_done_prealloc(s);
+	reiser4_done_discard(s);
 	sa_destroy_allocator(&sbinfo->space_allocator, s);
 	reiser4_done_journal_info(s);
 	done_super_jnode(s);
 
-	rcu_barrier();
+	reiser4_rcu_barrier();
 	reiser4_done_tree(&sbinfo->tree);
 	/* call finish_rcu(), because some znode were "released" in
 	 * reiser4_done_tree(). */
-	rcu_barrier();
+	reiser4_rcu_barrier();
 
 	return 0;
 }
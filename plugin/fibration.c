@@ -81,6 +81,31 @@ static __u64 fibre_ext_3(const struct inode *dir, const char *name, int len)
 		return FIBRE_NO(0);
 }
 
+/*
+ * ext.any fibration: separate files by extension of any length. Extension is
+ * what follows the last dot, up to 15 characters, and it is hashed into one
+ * of 127 fibres. Files without extension (and dot files) go into default
+ * fibre 0. Unlike ext.3 it keeps e.g. ".cc", ".cpp" and ".json" files
+ * grouped.
+ */
+static __u64 fibre_ext_any(const struct inode *dir, const char *name, int len)
+{
+	__u32 h = 0;
+	int i;
+
+	for (i = len - 1; i > 0 && len - i <= 16; i--) {
+		if (name[i] == '.') {
+			if (i == len - 1)
+				/* empty extension */
+				break;
+			for (++i; i < len; i++)
+				h = h * 31 + (unsigned char)name[i];
+			return FIBRE_NO(1 + h % 127);
+		}
+	}
+	return FIBRE_NO(0);
+}
+
 static int change_fibration(struct inode *inode,
 			    reiser4_plugin * plugin,
 			    pset_member memb)
@@ -161,6 +186,17 @@ fibration_plugin fibration_plugins[LAST_FIBRATION_ID] = {
 			.linkage = {NULL, NULL}
 		},
 		.fibre = fibre_ext_3
+	},
+	[FIBRATION_EXT_ANY] = {
+		.h = {
+			.type_id = REISER4_FIBRATION_PLUGIN_TYPE,
+			.id = FIBRATION_EXT_ANY,
+			.pops = &fibration_plugin_ops,
+			.label = "ext-any",
+			.desc = "fibrate file by extension of any length",
+			.linkage = {NULL, NULL}
+		},
+		.fibre = fibre_ext_any
 	}
 };
 
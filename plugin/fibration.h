@@ -20,6 +20,7 @@ typedef enum {
 	FIBRATION_DOT_O,
 	FIBRATION_EXT_1,
 	FIBRATION_EXT_3,
+	FIBRATION_EXT_ANY,
 	LAST_FIBRATION_ID
 } reiser4_fibration_id;
 
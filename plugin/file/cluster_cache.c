@@ -0,0 +1,371 @@
+/* Copyright 2001, 2002, 2003 by Hans Reiser, licensing governed by
+ * reiser4/README */
+
+/*
+ * Cache of inflated logical clusters of cryptcompress files.
+ *
+ * Pages of a logical cluster are reclaimed one by one, and a read of any of
+ * them looks up and inflates the whole disk cluster again. Plain text of
+ * recently inflated clusters is kept here, so that such reads just copy it
+ * to the page.
+ *
+ * Entries are keyed by super block, object id and cluster index, rather
+ * than by inode, because disk clusters are updated by flush after the inode
+ * may be evicted. The cache always mirrors disk clusters: an entry is
+ * dropped whenever its disk cluster is killed (truncate, delete) or rewritten
+ * by flush, see kill_hook_ctail() and free_item_convert_data().
+ *
+ * A reader samples the generation of the hash bucket before it looks up the
+ * disk cluster, and inserts the inflated cluster only if the generation did
+ * not change meanwhile, so an entry built from a disk cluster being updated
+ * never survives the update. The cache is bounded by REISER4_CCACHE_MAX_BYTES
+ * and emptied under memory pressure by a shrinker.
+ */
+
+#include "../../debug.h"
+#include "../../inode.h"
+#include "../cluster.h"
+
+#include <linux/hash.h>
+#include <linux/shrinker.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+struct ccache_entry {
+	struct hlist_node hash;
+	struct list_head lru;
+	struct super_block *super;
+	oid_t oid;
+	cloff_t index;
+	/* number of users, entry is freed when this drops to 0 */
+	atomic_t count;
+	size_t len;
+	char data[];
+};
+
+struct ccache_bucket {
+	struct hlist_head chain;
+	/* incremented on every invalidation of a key of this bucket */
+	unsigned long gen;
+};
+
+/* protects hash table, lru list and @ccache_bytes */
+static DEFINE_SPINLOCK(ccache_guard);
+static struct ccache_bucket ccache_hash[1 << REISER4_CCACHE_HASH_BITS];
+/* most recently used entries are at the head */
+static LIST_HEAD(ccache_lru);
+static size_t ccache_bytes;
+static unsigned long ccache_nr;
+static struct shrinker ccache_shrinker;
+
+static atomic_long_t ccache_hits;
+static atomic_long_t ccache_misses;
+static atomic_long_t ccache_inserts;
+
+static struct ccache_bucket *ccache_bucket(struct super_block *super,
+					   oid_t oid, cloff_t index)
+{
+	u64 h = oid ^ ((u64)index << 20) ^ (unsigned long)super;
+
+	return &ccache_hash[hash_64(h, REISER4_CCACHE_HASH_BITS)];
+}
+
+static struct ccache_entry *ccache_find(struct ccache_bucket *b,
+					struct super_block *super,
+					oid_t oid, cloff_t index)
+{
+	struct ccache_entry *e;
+
+	assert_spin_locked(&ccache_guard);
+	hlist_for_each_entry(e, &b->chain, hash)
+		if (e->super == super && e->oid == oid && e->index == index)
+			return e;
+	return NULL;
+}
+
+static void ccache_put(struct ccache_entry *e)
+{
+	if (atomic_dec_and_test(&e->count))
+		kfree(e);
+}
+
+/* remove entry from hash table and lru list, drop reference of the cache */
+static void ccache_unlink(struct ccache_entry *e)
+{
+	assert_spin_locked(&ccache_guard);
+	hlist_del(&e->hash);
+	list_del(&e->lru);
+	ccache_bytes -= e->len;
+	ccache_nr--;
+}
+
+/* unlink least recently used entries until @nr of them are gone or the cache
+   gets not larger than @max_bytes, collect them in @dispose */
+static unsigned long ccache_evict(unsigned long nr, size_t max_bytes,
+				  struct list_head *dispose)
+{
+	unsigned long evicted = 0;
+
+	assert_spin_locked(&ccache_guard);
+	while (!list_empty(&ccache_lru) &&
+	       (evicted < nr || ccache_bytes > max_bytes)) {
+		struct ccache_entry *e;
+
+		e = list_last_entry(&ccache_lru, struct ccache_entry, lru);
+		ccache_unlink(e);
+		list_add(&e->lru, dispose);
+		evicted++;
+	}
+	return evicted;
+}
+
+static void ccache_dispose(struct list_head *dispose)
+{
+	struct ccache_entry *e;
+	struct ccache_entry *tmp;
+
+	list_for_each_entry_safe(e, tmp, dispose, lru)
+		ccache_put(e);
+}
+
+/**
+ * reiser4_ccache_gen - sample generation of cache key
+ * @inode: cryptcompress file
+ * @index: logical cluster index
+ *
+ * This is called before disk cluster is looked up, the result is to be
+ * passed to reiser4_ccache_insert().
+ */
+unsigned long reiser4_ccache_gen(struct inode *inode, cloff_t index)
+{
+	struct ccache_bucket *b;
+	unsigned long gen;
+
+	b = ccache_bucket(inode->i_sb, get_inode_oid(inode), index);
+	spin_lock(&ccache_guard);
+	gen = b->gen;
+	spin_unlock(&ccache_guard);
+	return gen;
+}
+
+/**
+ * reiser4_ccache_insert - remember inflated logical cluster
+ * @inode: cryptcompress file
+ * @index: logical cluster index
+ * @gen: generation sampled by reiser4_ccache_gen() before disk cluster was
+ * looked up
+ * @data: plain text of logical cluster
+ * @len: size of @data
+ *
+ * Insertion is not guaranteed: it is silently skipped when memory is short
+ * or the disk cluster was updated after @gen was got.
+ */
+void reiser4_ccache_insert(struct inode *inode, cloff_t index,
+			   unsigned long gen, const char *data, size_t len)
+{
+	struct super_block *super = inode->i_sb;
+	oid_t oid = get_inode_oid(inode);
+	struct ccache_bucket *b;
+	struct ccache_entry *e;
+	LIST_HEAD(dispose);
+
+	if (len == 0 || len > REISER4_CCACHE_MAX_BYTES / 4)
+		return;
+	e = kmalloc(sizeof(*e) + len, reiser4_ctx_gfp_mask_get() |
+		    __GFP_NOWARN | __GFP_NORETRY);
+	if (e == NULL)
+		return;
+	e->super = super;
+	e->oid = oid;
+	e->index = index;
+	e->len = len;
+	atomic_set(&e->count, 1);
+	memcpy(e->data, data, len);
+
+	b = ccache_bucket(super, oid, index);
+	spin_lock(&ccache_guard);
+	if (b->gen != gen || ccache_find(b, super, oid, index) != NULL) {
+		spin_unlock(&ccache_guard);
+		kfree(e);
+		return;
+	}
+	hlist_add_head(&e->hash, &b->chain);
+	list_add(&e->lru, &ccache_lru);
+	ccache_bytes += len;
+	ccache_nr++;
+	ccache_evict(0, REISER4_CCACHE_MAX_BYTES, &dispose);
+	spin_unlock(&ccache_guard);
+	ccache_dispose(&dispose);
+	atomic_long_inc(&ccache_inserts);
+}
+
+/**
+ * reiser4_ccache_read - fill page from cached logical cluster
+ * @inode: cryptcompress file
+ * @page: locked page, not uptodate
+ * @to_page: number of bytes of file in @page
+ *
+ * Returns 1 and makes @page uptodate if its logical cluster is cached, 0
+ * otherwise.
+ */
+int reiser4_ccache_read(struct inode *inode, struct page *page,
+			size_t to_page)
+{
+	cloff_t index = pg_to_clust(page->index, inode);
+	unsigned cloff = pg_to_off_to_cloff(page->index, inode);
+	struct super_block *super = inode->i_sb;
+	oid_t oid = get_inode_oid(inode);
+	struct ccache_bucket *b;
+	struct ccache_entry *e;
+	char *data;
+
+	assert("", PageLocked(page));
+	assert("", !PageUptodate(page));
+
+	b = ccache_bucket(super, oid, index);
+	spin_lock(&ccache_guard);
+	e = ccache_find(b, super, oid, index);
+	if (e != NULL && cloff + to_page <= e->len) {
+		atomic_inc(&e->count);
+		list_move(&e->lru, &ccache_lru);
+	} else
+		e = NULL;
+	spin_unlock(&ccache_guard);
+	if (e == NULL) {
+		atomic_long_inc(&ccache_misses);
+		return 0;
+	}
+	data = kmap(page);
+	memcpy(data, e->data + cloff, to_page);
+	memset(data + to_page, 0, (size_t) PAGE_SIZE - to_page);
+	flush_dcache_page(page);
+	kunmap(page);
+	SetPageUptodate(page);
+	ccache_put(e);
+	atomic_long_inc(&ccache_hits);
+	return 1;
+}
+
+/**
+ * reiser4_ccache_invalidate - forget logical cluster
+ * @super: super block
+ * @oid: object id of cryptcompress file
+ * @index: logical cluster index
+ *
+ * This is called when disk cluster is killed or rewritten.
+ */
+void reiser4_ccache_invalidate(struct super_block *super, oid_t oid,
+			       cloff_t index)
+{
+	struct ccache_bucket *b;
+	struct ccache_entry *e;
+
+	b = ccache_bucket(super, oid, index);
+	spin_lock(&ccache_guard);
+	b->gen++;
+	e = ccache_find(b, super, oid, index);
+	if (e != NULL)
+		ccache_unlink(e);
+	spin_unlock(&ccache_guard);
+	if (e != NULL)
+		ccache_put(e);
+}
+
+/**
+ * reiser4_ccache_drop_super - forget all clusters of file system
+ * @super: super block being unmounted
+ */
+void reiser4_ccache_drop_super(struct super_block *super)
+{
+	struct ccache_entry *e;
+	struct ccache_entry *tmp;
+	LIST_HEAD(dispose);
+
+	spin_lock(&ccache_guard);
+	list_for_each_entry_safe(e, tmp, &ccache_lru, lru) {
+		if (e->super != super)
+			continue;
+		ccache_unlink(e);
+		list_add(&e->lru, &dispose);
+	}
+	spin_unlock(&ccache_guard);
+	ccache_dispose(&dispose);
+}
+
+static unsigned long ccache_shrink_count(struct shrinker *shrink,
+					 struct shrink_control *sc)
+{
+	return READ_ONCE(ccache_nr);
+}
+
+static unsigned long ccache_shrink_scan(struct shrinker *shrink,
+					struct shrink_control *sc)
+{
+	unsigned long freed;
+	LIST_HEAD(dispose);
+
+	spin_lock(&ccache_guard);
+	freed = ccache_evict(sc->nr_to_scan, ~(size_t)0, &dispose);
+	spin_unlock(&ccache_guard);
+	ccache_dispose(&dispose);
+	return freed;
+}
+
+/**
+ * reiser4_init_ccache - initialize cache of inflated clusters
+ *
+ * This is called on reiser4 module initialization.
+ */
+int reiser4_init_ccache(void)
+{
+	ccache_shrinker.count_objects = ccache_shrink_count;
+	ccache_shrinker.scan_objects = ccache_shrink_scan;
+	ccache_shrinker.seeks = DEFAULT_SEEKS;
+	return register_shrinker(&ccache_shrinker);
+}
+
+/**
+ * reiser4_done_ccache - free cache of inflated clusters
+ *
+ * This is called on reiser4 module unloading, after all file systems are
+ * unmounted.
+ */
+void reiser4_done_ccache(void)
+{
+	unregister_shrinker(&ccache_shrinker);
+	assert("", list_empty(&ccache_lru));
+}
+
+/* print numbers of hits, misses, inserts, entries and cached bytes */
+static int cluster_cache_show(struct seq_file *m, void *unused)
+{
+	seq_printf(m, "hits %ld\nmisses %ld\ninserts %ld\n",
+		   atomic_long_read(&ccache_hits),
+		   atomic_long_read(&ccache_misses),
+		   atomic_long_read(&ccache_inserts));
+	spin_lock(&ccache_guard);
+	seq_printf(m, "entries %lu\nbytes %zu\n", ccache_nr, ccache_bytes);
+	spin_unlock(&ccache_guard);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(cluster_cache);
+
+/**
+ * reiser4_ccache_debugfs_init - export cluster cache statistics
+ * @root: reiser4 debugfs directory
+ */
+void reiser4_ccache_debugfs_init(struct dentry *root)
+{
+	debugfs_create_file("cluster_cache", S_IFREG | S_IRUSR, root, NULL,
+			    &cluster_cache_fops);
+}
+
+/* Make Linus happy.
+   Local variables:
+   c-indentation-style: "K&R"
+   mode-name: "LC"
+   c-basic-offset: 8
+   tab-width: 8
+   fill-column: 120
+   End:
+*/
@@ -978,6 +978,12 @@ static int should_compress(struct tfm_cluster *tc, cloff_t index,
 		/* estimate by compression mode plugin */
 		(mplug->should_deflate ?
 		 mplug->should_deflate(inode, index) :
+		 1) &&
+		/* estimate by content */
+		(mplug->should_deflate_data ?
+		 mplug->should_deflate_data(inode, index,
+					    tfm_stream_data(tc, INPUT_STREAM),
+					    tc->len) :
 		 1);
 }
 
@@ -2209,6 +2215,7 @@ int find_disk_cluster(struct cluster_handle * clust,
 			goto out;
 	}
 
+	reiser4_init_ra_info(&ra_info);
 	ra_info.key_to_stop = f.key;
 	set_key_offset(&ra_info.key_to_stop, get_key_offset(reiser4_max_key()));
 
@@ -2318,6 +2325,7 @@ int get_disk_cluster_locked(struct cluster_handle * clust, struct inode *inode,
 	}
 	key_by_inode_cryptcompress(inode, clust_to_off(clust->index, inode),
 				   &key);
+	reiser4_init_ra_info(&ra_info);
 	ra_info.key_to_stop = key;
 	set_key_offset(&ra_info.key_to_stop, get_key_offset(reiser4_max_key()));
 
@@ -2899,6 +2907,43 @@ static loff_t do_write_cryptcompress(struct file *file, struct inode *inode,
 	return (to_write - count) ? (to_write - count) : result;
 }
 
+/*
+ * With auto_cluster mount option, cluster size of a cryptcompress file is
+ * chosen when the file is empty and gets written: the smallest cluster which
+ * holds @size bytes, that is the end of the first write, or the size the file
+ * had if it is rewritten after truncate to zero. So files start with small
+ * clusters, and files which grew beyond their cluster get larger clusters
+ * when they are rewritten. The choice is stored in stat-data like any
+ * other member of the plugin set.
+ */
+static void auto_cluster(struct inode *inode, loff_t size)
+{
+	struct cryptcompress_info *info = cryptcompress_inode_data(inode);
+	cluster_plugin *cplug;
+	reiser4_plugin_id id;
+
+	if (!reiser4_is_set(inode->i_sb, REISER4_AUTO_CLUSTER) ||
+	    i_size_read(inode) != 0 || inode->i_mapping->nrpages != 0)
+		return;
+	size = max(size, info->rewrite_size);
+	info->rewrite_size = 0;
+
+	/* cluster plugins go from the largest cluster to the smallest one */
+	for (id = LAST_CLUSTER_ID - 1; id > CLUSTER_64K_ID; id--) {
+		cplug = cluster_plugin_by_id(id);
+		if (cplug->shift >= PAGE_SHIFT &&
+		    size <= (loff_t)1 << cplug->shift)
+			break;
+	}
+	cplug = cluster_plugin_by_id(id);
+	if (inode_cluster_plugin(inode) == cplug ||
+	    force_plugin_pset(inode, PSET_CLUSTER,
+			      cluster_plugin_to_plugin(cplug)))
+		return;
+	/* new plugin set goes to disk with stat-data update of the write */
+	assert("", inode_check_cluster(inode) == 0);
+}
+
 /**
  * plugin->write()
  * @file: file to write to
@@ -2932,6 +2977,7 @@ ssize_t write_cryptcompress(struct file *file, const char __user *buf,
 	/* remove_suid might create a transaction */
 	reiser4_txn_restart(ctx);
 
+	auto_cluster(inode, pos + count);
 	result = do_write_cryptcompress(file, inode, buf, count, pos, cont);
 
   	if (unlikely(result < 0)) {
@@ -3250,6 +3296,9 @@ static int prune_cryptcompress(struct inode *inode,
 	assert("edward-1143", current_blocksize == PAGE_SIZE);
 
 	old_size = inode->i_size;
+	if (new_size == 0)
+		/* for auto_cluster() */
+		cryptcompress_inode_data(inode)->rewrite_size = old_size;
 
 	hint = kmalloc(sizeof(*hint), reiser4_ctx_gfp_mask_get());
 	if (hint == NULL)
@@ -18,6 +18,10 @@
 #define MIN_LATTICE_FACTOR 1
 #define MAX_LATTICE_FACTOR 32
 
+/* Encryption of cryptcompress files is not supported: the key manager
+   (create_crypto_info(), alloc_crypto_tfms(), create_keyid()) is compiled
+   out, and crypto-stat loaded from disk carries a key fingerprint only, no
+   transforms are ever instantiated */
 #define REISER4_CRYPTO 0
 
 /* this mask contains all non-standard plugins that might
@@ -181,7 +185,7 @@ static inline int alloc_coa(struct tfm_cluster * tc, compression_plugin * cplug)
 {
 	coa_t coa;
 
-	coa = cplug->alloc(tc->act);
+	coa = reiser4_get_coa(cplug->h.id, tc->act);
 	if (IS_ERR(coa))
 		return PTR_ERR(coa);
 	set_coa(tc, cplug->h.id, tc->act, coa);
@@ -199,7 +203,6 @@ static inline void free_coa_set(struct tfm_cluster * tc)
 {
 	tfm_action j;
 	reiser4_compression_id i;
-	compression_plugin *cplug;
 
 	assert("edward-810", tc != NULL);
 
@@ -207,9 +210,7 @@ static inline void free_coa_set(struct tfm_cluster * tc)
 		for (i = 0; i < LAST_COMPRESSION_ID; i++) {
 			if (!get_coa(tc, i, j))
 				continue;
-			cplug = compression_plugin_by_id(i);
-			assert("edward-812", cplug->free != NULL);
-			cplug->free(get_coa(tc, i, j), j);
+			reiser4_put_coa(i, j, get_coa(tc, i, j));
 			set_coa(tc, i, j, 0);
 		}
 	return;
@@ -504,6 +505,8 @@ struct cryptcompress_info {
 				      * checkin_logical_cluster operations */
 	cloff_t trunc_index;         /* Index of the leftmost truncated disk
 				      * cluster (to resolve races with read) */
+	loff_t rewrite_size;         /* Size the file had before it was
+				      * truncated to zero, see auto_cluster() */
 	struct reiser4_crypto_info *crypt;
 	/*
 	 * the following 2 fields are controlled by compression mode plugin
@@ -571,6 +574,17 @@ int write_dispatch_hook(struct file *file, struct inode * inode,
 			loff_t pos, struct cluster_handle * clust,
 			struct dispatch_context * cont);
 int setattr_dispatch_hook(struct inode * inode);
+unsigned long reiser4_ccache_gen(struct inode *inode, cloff_t index);
+void reiser4_ccache_insert(struct inode *inode, cloff_t index,
+			   unsigned long gen, const char *data, size_t len);
+int reiser4_ccache_read(struct inode *inode, struct page *page,
+			size_t to_page);
+void reiser4_ccache_invalidate(struct super_block *super, oid_t oid,
+			       cloff_t index);
+void reiser4_ccache_drop_super(struct super_block *super);
+int reiser4_init_ccache(void);
+void reiser4_done_ccache(void);
+void reiser4_ccache_debugfs_init(struct dentry *root);
 struct reiser4_crypto_info * inode_crypto_info(struct inode * inode);
 void inherit_crypto_info_common(struct inode * parent, struct inode * object,
 				int (*can_inherit)(struct inode * child,
@@ -0,0 +1,404 @@
+/* Copyright 2001, 2002, 2003, 2004 by Hans Reiser, licensing governed by
+ * reiser4/README */
+
+/*
+ * FIEMAP, SEEK_HOLE/SEEK_DATA and hole preserving copy_file_range for unix
+ * file plugin.
+ *
+ * Body of a unix file is a sequence of extent units and tail items. Both are
+ * walked without reading file data: each step looks up the item covering the
+ * current offset and jumps past the unit (extent) or item (tail) found. Holes
+ * of files built of extents are hole extents, holes of files built of tails
+ * are stored as zeroes, so the body is continuous up to its end, and what is
+ * past the end of body and before i_size is a hole.
+ */
+
+#include "../../inode.h"
+#include "../object.h"
+
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#include <linux/falloc.h>
+
+typedef enum {
+	SEGMENT_HOLE,
+	SEGMENT_ALLOCATED,
+	SEGMENT_UNALLOCATED,
+	SEGMENT_TAIL
+} segment_type;
+
+/* piece of file body stored by one extent unit or one tail item */
+struct file_segment {
+	segment_type type;
+	loff_t offset;
+	loff_t length;
+	/* first block of allocated extent */
+	reiser4_block_nr block;
+};
+
+/**
+ * find_segment - find piece of file body containing given offset
+ * @inode: file
+ * @off: offset in file
+ * @seg: segment to fill
+ *
+ * Returns 0 if @seg is filled, 1 if @off is past the end of body, negative
+ * error code otherwise.
+ */
+static int find_segment(struct inode *inode, loff_t off,
+			struct file_segment *seg)
+{
+	reiser4_key key;
+	coord_t coord;
+	lock_handle lh;
+	int result;
+
+	key_by_inode_and_offset_common(inode, off, &key);
+	init_lh(&lh);
+	result = find_file_item_nohint(&coord, &lh, &key, ZNODE_READ_LOCK,
+				       inode);
+	if (cbk_errored(result)) {
+		done_lh(&lh);
+		return result;
+	}
+	if (result != CBK_COORD_FOUND) {
+		done_lh(&lh);
+		return 1;
+	}
+	result = zload(coord.node);
+	if (result) {
+		done_lh(&lh);
+		return result;
+	}
+
+	result = 0;
+	if (!coord_is_existing_unit(&coord))
+		result = 1;
+	else if (item_is_extent(&coord)) {
+		reiser4_extent *ext = extent_by_coord(&coord);
+
+		unit_key_by_coord(&coord, &key);
+		seg->offset = get_key_offset(&key);
+		seg->length = extent_get_width(ext) << PAGE_SHIFT;
+		seg->block = 0;
+		switch (state_of_extent(ext)) {
+		case HOLE_EXTENT:
+			seg->type = SEGMENT_HOLE;
+			break;
+		case UNALLOCATED_EXTENT:
+			seg->type = SEGMENT_UNALLOCATED;
+			break;
+		case ALLOCATED_EXTENT:
+			seg->type = SEGMENT_ALLOCATED;
+			seg->block = extent_get_start(ext);
+			break;
+		default:
+			result = RETERR(-EIO);
+		}
+	} else if (item_is_tail(&coord)) {
+		item_key_by_coord(&coord, &key);
+		seg->type = SEGMENT_TAIL;
+		seg->offset = get_key_offset(&key);
+		seg->length = coord_num_units(&coord);
+		seg->block = 0;
+	} else
+		result = 1;
+
+	zrelse(coord.node);
+	done_lh(&lh);
+	return result;
+}
+
+/* fiemap flags of segment */
+static u32 segment_flags(const struct file_segment *seg)
+{
+	switch (seg->type) {
+	case SEGMENT_UNALLOCATED:
+		return FIEMAP_EXTENT_DELALLOC | FIEMAP_EXTENT_UNKNOWN;
+	case SEGMENT_TAIL:
+		return FIEMAP_EXTENT_DATA_INLINE | FIEMAP_EXTENT_NOT_ALIGNED;
+	default:
+		return 0;
+	}
+}
+
+/* physical address of segment, in bytes */
+static u64 segment_phys(const struct file_segment *seg)
+{
+	return seg->type == SEGMENT_ALLOCATED ?
+		(u64)seg->block << PAGE_SHIFT : 0;
+}
+
+/* check whether @next continues @seg, so that they are reported as one
+   extent */
+static int segments_mergeable(const struct file_segment *seg,
+			      const struct file_segment *next)
+{
+	if (seg->type != next->type ||
+	    seg->offset + seg->length != next->offset)
+		return 0;
+	return seg->type != SEGMENT_ALLOCATED ||
+		seg->block + (seg->length >> PAGE_SHIFT) == next->block;
+}
+
+static int walk_fiemap(struct inode *inode, struct fiemap_extent_info *fieinfo,
+		       loff_t off, loff_t end)
+{
+	struct file_segment cur;
+	struct file_segment next;
+	int have_cur = 0;
+	int result = 0;
+
+	while (off < end) {
+		result = find_segment(inode, off, &next);
+		if (result)
+			break;
+		off = next.offset + next.length;
+		if (next.type == SEGMENT_HOLE)
+			continue;
+		if (have_cur && segments_mergeable(&cur, &next)) {
+			cur.length += next.length;
+			continue;
+		}
+		if (have_cur) {
+			result = fiemap_fill_next_extent(fieinfo, cur.offset,
+							 segment_phys(&cur),
+							 cur.length,
+							 segment_flags(&cur));
+			if (result)
+				/* 1 means that @fieinfo is full */
+				return result < 0 ? result : 0;
+		}
+		cur = next;
+		have_cur = 1;
+
+		if (fatal_signal_pending(current))
+			return RETERR(-EINTR);
+	}
+	if (result < 0)
+		return result;
+	if (have_cur) {
+		u32 flags = segment_flags(&cur);
+
+		if (cur.offset + cur.length >= i_size_read(inode))
+			flags |= FIEMAP_EXTENT_LAST;
+		result = fiemap_fill_next_extent(fieinfo, cur.offset,
+						 segment_phys(&cur),
+						 cur.length, flags);
+	}
+	return result < 0 ? result : 0;
+}
+
+/**
+ * fiemap_unix_file - fiemap of struct inode_operations
+ * @inode: file to map
+ * @fieinfo: where to put extents
+ * @start: offset to start from
+ * @len: length of range to map
+ *
+ * Adjacent units of the same kind are reported as one extent. Tails are
+ * reported as inline data, unallocated extents as delayed allocation.
+ */
+int fiemap_unix_file(struct inode *inode, struct fiemap_extent_info *fieinfo,
+		     u64 start, u64 len)
+{
+	reiser4_context *ctx;
+	struct unix_file_info *uf_info;
+	loff_t end;
+	int result;
+
+	result = fiemap_prep(inode, fieinfo, start, &len, 0);
+	if (result)
+		return result;
+
+	ctx = reiser4_init_context(inode->i_sb);
+	if (IS_ERR(ctx))
+		return PTR_ERR(ctx);
+	uf_info = unix_file_inode_data(inode);
+	get_nonexclusive_access(uf_info);
+
+	end = i_size_read(inode);
+	if (start + len < end)
+		end = start + len;
+	result = walk_fiemap(inode, fieinfo, start, end);
+
+	drop_nonexclusive_access(uf_info);
+	reiser4_exit_context(ctx);
+	return result;
+}
+
+/* find the first offset not less than @off which is data (@whence is
+   SEEK_DATA) or hole (SEEK_HOLE) */
+static loff_t seek_hole_data(struct inode *inode, loff_t off, int whence)
+{
+	struct file_segment seg;
+	loff_t i_size = i_size_read(inode);
+	int result;
+
+	if (off < 0 || off >= i_size)
+		return RETERR(-ENXIO);
+
+	while (off < i_size) {
+		result = find_segment(inode, off, &seg);
+		if (result < 0)
+			return result;
+		if (result == 1)
+			/* hole up to the end of file */
+			return whence == SEEK_HOLE ? off : RETERR(-ENXIO);
+		if ((seg.type == SEGMENT_HOLE) == (whence == SEEK_HOLE))
+			return off;
+		off = seg.offset + seg.length;
+
+		if (fatal_signal_pending(current))
+			return RETERR(-EINTR);
+	}
+	/* there is implicit hole at the end of file */
+	return whence == SEEK_HOLE ? i_size : RETERR(-ENXIO);
+}
+
+/* seek_hole_data() under nonexclusive access */
+static loff_t seek_unix_file(struct inode *inode, loff_t off, int whence)
+{
+	reiser4_context *ctx;
+	struct unix_file_info *uf_info;
+	loff_t result;
+
+	ctx = reiser4_init_context(inode->i_sb);
+	if (IS_ERR(ctx))
+		return PTR_ERR(ctx);
+	uf_info = unix_file_inode_data(inode);
+	get_nonexclusive_access(uf_info);
+
+	result = seek_hole_data(inode, off, whence);
+
+	drop_nonexclusive_access(uf_info);
+	reiser4_exit_context(ctx);
+	return result;
+}
+
+/**
+ * llseek_unix_file - llseek of struct file_operations
+ * @file: file to seek
+ * @off: offset
+ * @whence: SEEK_SET, SEEK_CUR, SEEK_END, SEEK_DATA or SEEK_HOLE
+ *
+ * SEEK_DATA and SEEK_HOLE move over whole units of the file body, the rest
+ * is done by generic_file_llseek().
+ */
+loff_t llseek_unix_file(struct file *file, loff_t off, int whence)
+{
+	loff_t result;
+
+	if (whence != SEEK_DATA && whence != SEEK_HOLE)
+		return generic_file_llseek(file, off, whence);
+
+	result = seek_unix_file(file_inode(file), off, whence);
+	if (result < 0)
+		return result;
+	return vfs_setpos(file, result, file_inode(file)->i_sb->s_maxbytes);
+}
+
+/* make [@pos, @pos + @len) of @out a hole */
+static int copy_hole(struct file *out, loff_t pos, loff_t len)
+{
+	const int mode = FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE;
+	loff_t size = i_size_read(file_inode(out));
+	int result = 0;
+
+	if (pos < size) {
+		result = vfs_fallocate(out, mode, pos, min(len, size - pos));
+		if (result)
+			return result;
+	}
+	if (pos + len > size)
+		result = vfs_truncate(&out->f_path, pos + len);
+	return result;
+}
+
+/**
+ * copy_file_range_unix_file - copy_file_range of struct file_operations
+ * @in: file to copy from
+ * @pos_in: offset in @in
+ * @out: file to copy to
+ * @pos_out: offset in @out
+ * @len: number of bytes to copy
+ * @flags: copy_file_range flags
+ *
+ * Data of @in are copied by generic_copy_file_range(), holes are not copied
+ * but made holes in @out: a copy of a sparse file is sparse and it takes no
+ * time to write zeroes. Where @out can not have a hole punched (it is built
+ * of tails), zeroes are copied. Extents are not shared between files: the
+ * space allocator has no reference counts of blocks.
+ */
+ssize_t copy_file_range_unix_file(struct file *in, loff_t pos_in,
+				  struct file *out, loff_t pos_out,
+				  size_t len, unsigned int flags)
+{
+	struct inode *inode = file_inode(in);
+	loff_t off = pos_in;
+	loff_t end;
+	loff_t next;
+	ssize_t copied;
+	int result = 0;
+
+	if (file_inode(out)->i_sb != inode->i_sb || file_inode(out) == inode)
+		return generic_copy_file_range(in, pos_in, out, pos_out,
+					       len, flags);
+
+	end = min_t(loff_t, pos_in + len, i_size_read(inode));
+	while (off < end) {
+		next = seek_unix_file(inode, off, SEEK_DATA);
+		if (next == -ENXIO || next > end)
+			next = end;
+		else if (next < 0) {
+			result = next;
+			break;
+		}
+		if (next > off) {
+			/* hole of @in */
+			result = copy_hole(out, pos_out + off - pos_in,
+					   next - off);
+			if (result == 0) {
+				off = next;
+				continue;
+			}
+			if (result != -EOPNOTSUPP)
+				break;
+			result = 0;
+		} else {
+			next = seek_unix_file(inode, off, SEEK_HOLE);
+			if (next < 0) {
+				result = next;
+				break;
+			}
+			if (next > end)
+				next = end;
+		}
+		copied = generic_copy_file_range(in, off, out,
+						 pos_out + off - pos_in,
+						 next - off, 0);
+		if (copied <= 0) {
+			result = copied;
+			break;
+		}
+		off += copied;
+
+		if (fatal_signal_pending(current)) {
+			result = RETERR(-EINTR);
+			break;
+		}
+	}
+	if (off > pos_in)
+		return off - pos_in;
+	return result;
+}
+
+/* Make Linus happy.
+   Local variables:
+   c-indentation-style: "K&R"
+   mode-name: "LC"
+   c-basic-offset: 8
+   tab-width: 8
+   fill-column: 120
+   End:
+*/
@@ -22,6 +22,11 @@
 #include <linux/writeback.h>
 #include <linux/pagevec.h>
 #include <linux/syscalls.h>
+#include <linux/buffer_head.h>
+#include <linux/blkdev.h>
+#include <linux/uio.h>
+#include <linux/falloc.h>
+#include <linux/wait_bit.h>
 
 
 static int unpack(struct file *file, struct inode *inode, int forever);
@@ -241,7 +246,7 @@ int find_file_item_nohint(coord_t *coord, lock_handle *lh,
  * @inode:
  *
  * This finds position in the tree corresponding to @key. It first tries to use
- * @hint's seal if it is set.
+ * @hint's seal if it is set, then @hint's finger.
  */
 int find_file_item(hint_t *hint, const reiser4_key *key,
 		   znode_lock_mode lock_mode,
@@ -278,12 +283,22 @@ int find_file_item(hint_t *hint, const reiser4_key *key,
 
 		set_file_state(unix_file_inode_data(inode), CBK_COORD_FOUND,
 			       znode_get_level(coord->node));
+		if (hint->finger.block[0] != *znode_get_block(coord->node))
+			reiser4_finger_set(&hint->finger, coord->node);
 
 		return CBK_COORD_FOUND;
 	}
 
+	/* seal is broken, start from the nodes where previous search
+	 * stopped if they still cover @key */
 	coord_init_zero(coord);
-	result = find_file_item_nohint(coord, lh, key, lock_mode, inode);
+	result = reiser4_finger_lookup(inode, &hint->finger, key, coord, lh,
+				       lock_mode, FIND_MAX_NOT_MORE_THAN,
+				       TWIG_LEVEL, LEAF_LEVEL,
+				       (lock_mode == ZNODE_READ_LOCK) ?
+				       CBK_UNIQUE :
+				       (CBK_UNIQUE | CBK_FOR_INSERT),
+				       NULL /* ra_info */ );
 	set_file_state(unix_file_inode_data(inode), result,
 		       znode_get_level(coord->node));
 
@@ -566,6 +581,141 @@ static int should_have_notail(const struct unix_file_info *uf_info, loff_t new_s
 
 }
 
+/* keep size history of file for formatting policy, see tail_policy.c */
+static void note_file_size(struct inode *inode)
+{
+	struct unix_file_info *uf_info = unix_file_inode_data(inode);
+
+	if (inode->i_size > uf_info->max_size)
+		uf_info->max_size = inode->i_size;
+}
+
+/*
+ * BACKGROUND TAIL CONVERSION
+ *
+ * Converting a file of tails to extents takes time proportional to the file
+ * size, and the process to pay for it used to be the writer whose write made
+ * the file too large for tails. Now only small files (see
+ * REISER4_TAIL2EXTENT_SYNC_MAX) and files which are about to get more data
+ * written than they have already are converted by the writer. Others are
+ * queued to a per-super work which runs tail2extent() for them. tail2extent()
+ * converts the file by batches of few pages and drops exclusive access
+ * between batches, so readers (read_compound_file()) and writers get to the
+ * file meanwhile: the latter go on writing tails past the converted part of
+ * the file (see uf_info->converted) and wait only if they have to write to
+ * the converted part.
+ *
+ * Queued file holds an inode reference, the queue is drained on umount
+ * without converting, so the file remains built of tails until next write.
+ */
+
+/* check whether writer should convert the file itself */
+static int tail2extent_by_writer(struct inode *inode, size_t left)
+{
+	loff_t size = i_size_read(inode);
+
+	return size <= REISER4_TAIL2EXTENT_SYNC_MAX * PAGE_SIZE ||
+		size <= left;
+}
+
+static void queue_tail2extent(struct inode *inode)
+{
+	struct reiser4_conv_queue *q = &get_super_private(inode->i_sb)->conv;
+	struct unix_file_info *uf_info = unix_file_inode_data(inode);
+
+	spin_lock(&q->guard);
+	if (list_empty(&uf_info->conv_link)) {
+		ihold(inode);
+		list_add_tail(&uf_info->conv_link, &q->inodes);
+		schedule_work(&q->work);
+	}
+	spin_unlock(&q->guard);
+}
+
+static void background_tail2extent(struct inode *inode)
+{
+	struct unix_file_info *uf_info = unix_file_inode_data(inode);
+
+	get_exclusive_access_careful(uf_info, inode);
+	/* file could be converted or truncated while it was queued */
+	if (uf_info->container == UF_CONTAINER_TAILS &&
+	    should_have_notail(uf_info, i_size_read(inode)))
+		/* failure is reported by tail2extent(), the file gets queued
+		   again by next write */
+		tail2extent(uf_info);
+	drop_exclusive_access(uf_info);
+}
+
+/* convert one queued file, requeue if there are more */
+static void tail2extent_worker(struct work_struct *work)
+{
+	struct reiser4_conv_queue *q;
+	struct unix_file_info *uf_info;
+	struct inode *inode;
+	reiser4_context ctx;
+
+	q = container_of(work, struct reiser4_conv_queue, work);
+	spin_lock(&q->guard);
+	if (list_empty(&q->inodes)) {
+		spin_unlock(&q->guard);
+		return;
+	}
+	uf_info = list_first_entry(&q->inodes, struct unix_file_info,
+				   conv_link);
+	list_del_init(&uf_info->conv_link);
+	if (!list_empty(&q->inodes))
+		schedule_work(&q->work);
+	spin_unlock(&q->guard);
+
+	inode = unix_file_info_to_inode(uf_info);
+	if (!sb_rdonly(q->super) && sb_start_write_trylock(q->super)) {
+		init_stack_context(&ctx, q->super);
+		background_tail2extent(inode);
+		reiser4_exit_context(&ctx);
+		sb_end_write(q->super);
+	}
+	iput(inode);
+}
+
+/**
+ * reiser4_init_conv_queue - initialize background tail conversion
+ * @super: super block being mounted
+ */
+void reiser4_init_conv_queue(struct super_block *super)
+{
+	struct reiser4_conv_queue *q = &get_super_private(super)->conv;
+
+	spin_lock_init(&q->guard);
+	INIT_LIST_HEAD(&q->inodes);
+	INIT_WORK(&q->work, tail2extent_worker);
+	q->super = super;
+}
+
+/**
+ * reiser4_done_conv_queue - stop background tail conversion
+ * @super: super block being unmounted
+ *
+ * This is called on umount, before inodes are evicted, because queued files
+ * hold inode references.
+ */
+void reiser4_done_conv_queue(struct super_block *super)
+{
+	struct reiser4_conv_queue *q = &get_super_private(super)->conv;
+	struct unix_file_info *uf_info;
+
+	cancel_work_sync(&q->work);
+	spin_lock(&q->guard);
+	while (!list_empty(&q->inodes)) {
+		uf_info = list_first_entry(&q->inodes, struct unix_file_info,
+					   conv_link);
+		list_del_init(&uf_info->conv_link);
+		spin_unlock(&q->guard);
+		iput(unix_file_info_to_inode(uf_info));
+		spin_lock(&q->guard);
+	}
+	spin_unlock(&q->guard);
+}
+
 /**
  * truncate_file_body - change length of file
  * @inode: inode of file
@@ -580,6 +730,7 @@ static int truncate_file_body(struct inode *inode, struct iattr *attr)
 	int result;
 	loff_t new_size = attr->ia_size;
 
+	note_file_size(inode);
 	if (inode->i_size < new_size) {
 		/* expanding truncate */
 		struct unix_file_info *uf_info = unix_file_inode_data(inode);
@@ -821,12 +972,12 @@ int find_or_create_extent(struct page *page)
 	JF_CLR(node, JNODE_WRITE_PREPARED);
 
 	if (get_current_context()->entd) {
-		entd_context *ent = get_entd_context(node->tree->super);
+		struct wbq *rq = entd_current_request();
 
-		if (ent->cur_request->page == page)
+		if (rq->page == page)
 			/* the following reference will be
 			   dropped in reiser4_writeout */
-			ent->cur_request->node = jref(node);
+			rq->node = jref(node);
 	}
 	jput(node);
 	return 0;
@@ -852,17 +1003,30 @@ static int has_anonymous_pages(struct inode *inode)
 	return result;
 }
 
+/* grab space to capture @nr pages of @inode */
+static int grab_capture_space(struct inode *inode, int nr)
+{
+	/* page capture may require extent creation (if it does not exist yet)
+	   and stat data's update (number of blocks changes on extent
+	   creation) */
+	grab_space_enable();
+	return reiser4_grab_space(nr * 2 * estimate_one_insert_into_item
+				  (reiser4_tree_by_inode(inode)),
+				  BA_CAN_COMMIT);
+}
+
 /**
  * capture_page_and_create_extent -
  * @page: page to be captured
+ * @grabbed: space for capture is grabbed already
  *
- * Grabs space for extent creation and stat data update and calls function to
- * do actual work.
+ * Grabs space for extent creation and stat data update unless it is grabbed
+ * for a batch of pages and calls function to do actual work.
  * Exclusive, or non-exclusive lock must be held.
  */
-static int capture_page_and_create_extent(struct page *page)
+static int capture_page_and_create_extent(struct page *page, int grabbed)
 {
-	int result;
+	int result = 0;
 	struct inode *inode;
 
 	assert("vs-1084", page->mapping && page->mapping->host);
@@ -873,13 +1037,8 @@ static int capture_page_and_create_extent(struct page *page)
 	assert("vs-1393",
 	       inode->i_size > page_offset(page));
 
-	/* page capture may require extent creation (if it does not exist yet)
-	   and stat data's update (number of blocks changes on extent
-	   creation) */
-	grab_space_enable();
-	result = reiser4_grab_space(2 * estimate_one_insert_into_item
-				    (reiser4_tree_by_inode(inode)),
-				    BA_CAN_COMMIT);
+	if (!grabbed)
+		result = grab_capture_space(inode, 1);
 	if (likely(!result))
 		result = find_or_create_extent(page);
 
@@ -912,11 +1071,12 @@ static int capture_page_and_create_extent(struct page *page)
 /**
  * capture_anonymous_page - involve page into transaction
  * @pg: page to deal with
+ * @grabbed: space for capture is grabbed already
  *
  * Takes care that @page has corresponding metadata in the tree, creates jnode
  * for @page and captures it. On success 1 is returned.
  */
-static int capture_anonymous_page(struct page *page)
+static int capture_anonymous_page(struct page *page, int grabbed)
 {
 	int result;
 
@@ -924,7 +1084,7 @@ static int capture_anonymous_page(struct page *page)
 		/* FIXME: do nothing? */
 		return 0;
 
-	result = capture_page_and_create_extent(page);
+	result = capture_page_and_create_extent(page, grabbed);
 	if (result == 0) {
 		result = 1;
 	} else
@@ -943,6 +1103,10 @@ static int capture_anonymous_page(struct page *page)
  * Looks for pages tagged REISER4_MOVED starting from the *@index-th page,
  * captures (involves into atom) them, returns number of captured pages,
  * updates @index to next page after the last captured one.
+ *
+ * Pages written through mmap are found here in batches of adjacent ones,
+ * space for a batch is grabbed at once. If that fails, space is grabbed page
+ * by page, so that as many pages as possible get captured.
  */
 static int
 capture_anonymous_pages(struct address_space *mapping, pgoff_t *index,
@@ -952,6 +1116,7 @@ capture_anonymous_pages(struct address_space *mapping, pgoff_t *index,
 	struct pagevec pvec;
 	unsigned int i, count;
 	int nr;
+	int grabbed;
 
 	pagevec_init(&pvec);
 	count = min(pagevec_space(&pvec), to_capture);
@@ -983,8 +1148,10 @@ capture_anonymous_pages(struct address_space *mapping, pgoff_t *index,
 
 	*index = pvec.pages[i - 1]->index + 1;
 
+	grabbed = (grab_capture_space(mapping->host,
+				      pagevec_count(&pvec)) == 0);
 	for (i = 0; i < pagevec_count(&pvec); i++) {
-		result = capture_anonymous_page(pvec.pages[i]);
+		result = capture_anonymous_page(pvec.pages[i], grabbed);
 		if (result == 1)
 			nr++;
 		else {
@@ -1507,6 +1674,8 @@ int readpage_unix_file(struct file *file, struct page *page)
 struct uf_readpages_context {
 	lock_handle lh;
 	coord_t coord;
+	/* pages of allocated extents are read by bios spanning the extent */
+	reiser4_read_bio rbio;
 };
 
 /*
@@ -1541,6 +1710,9 @@ static int readpages_filler(void * data, struct page * page)
 		reiser4_key key;
 	repeat:
 		unlock_page(page);
+		/* do not sleep on tree locks with pages of a pending bio
+		   locked */
+		reiser4_read_bio_submit(&rc->rbio);
 		key_by_inode_and_offset_common(
 			mapping->host, page_offset(page), &key);
 		ret = coord_by_key(
@@ -1595,6 +1767,24 @@ static int readpages_filler(void * data, struct page * page)
 		ret = PTR_ERR(node);
 		goto unlock;
 	}
+	if (state_of_extent(ext) == ALLOCATED_EXTENT) {
+		reiser4_block_nr pos = page->index - ext_index;
+		reiser4_block_nr blocknr = extent_get_start(ext) + pos;
+
+		if (*jnode_get_block(node) == 0)
+			jnode_set_block(node, &blocknr);
+		else
+			assert("", node->blocknr == blocknr);
+		ret = reiser4_read_bio_add(&rc->rbio, page, blocknr,
+					   extent_get_width(ext) - pos);
+		jput(node);
+		zrelse(rc->coord.node);
+		if (likely(!ret))
+			goto exit;
+		goto unlock;
+	}
+	/* holes are zero-filled inline, unallocated extents are read from
+	   their jnodes */
 	ret = reiser4_do_readpage_extent(ext, page->index - ext_index, page);
 	jput(node);
 	zrelse(rc->coord.node);
@@ -1610,12 +1800,16 @@ static int readpages_filler(void * data, struct page * page)
 /**
  * readpages_unix_file - called by the readahead code, starts reading for each
  * page of given list of pages
+ *
+ * Pages of contiguous allocated blocks are read by one bio, so that a
+ * contiguous extent is read by requests as large as the device takes.
  */
 int readpages_unix_file(struct file *file, struct address_space *mapping,
 			struct list_head *pages, unsigned nr_pages)
 {
 	reiser4_context *ctx;
 	struct uf_readpages_context rc;
+	struct blk_plug plug;
 	int ret;
 
 	ctx = reiser4_init_context(mapping->host->i_sb);
@@ -1624,7 +1818,11 @@ int readpages_unix_file(struct file *file, struct address_space *mapping,
 		return PTR_ERR(ctx);
 	}
 	init_lh(&rc.lh);
+	rc.rbio.bio = NULL;
+	blk_start_plug(&plug);
 	ret = read_cache_pages(mapping, pages,  readpages_filler, &rc);
+	reiser4_read_bio_submit(&rc.rbio);
+	blk_finish_plug(&plug);
 	done_lh(&rc.lh);
 
 	context_set_commit_async(ctx);
@@ -1712,6 +1910,186 @@ static ssize_t do_read_compound_file(hint_t *hint, struct file *file,
 
 static ssize_t read_compound_file(struct file*, char __user*, size_t, loff_t*);
 
+/*
+ * O_DIRECT
+ *
+ * Blocks of allocated extents are read and overwritten directly from and to
+ * user pages. Everything else is left to the buffered path: tails, holes on
+ * write, unallocated extents, partial blocks at the end of file and ranges
+ * which have pages in the page cache which can not be dropped (dirty or
+ * captured). direct_io_unix_file() returns how many bytes were transferred
+ * directly and the caller does the rest as usual.
+ *
+ * Direct writes only overwrite blocks which are already allocated, so they
+ * change neither the tree nor block allocation, and need no transaction.
+ */
+
+/* get_block_t for __blockdev_direct_IO(). Maps the run of allocated extent
+   unit starting at @iblock, fails with -ENOTBLK where buffered I/O has to
+   be used */
+static int get_block_direct_unix_file(struct inode *inode, sector_t iblock,
+				      struct buffer_head *bh, int create)
+{
+	reiser4_key key;
+	reiser4_key unit_key;
+	coord_t coord;
+	lock_handle lh;
+	reiser4_extent *ext;
+	sector_t start;
+	sector_t width;
+	int result;
+
+	key_by_inode_and_offset_common(inode,
+				       (loff_t)iblock << current_blocksize_bits,
+				       &key);
+	init_lh(&lh);
+	result = find_file_item_nohint(&coord, &lh, &key, ZNODE_READ_LOCK,
+				       inode);
+	if (cbk_errored(result)) {
+		done_lh(&lh);
+		return result;
+	}
+	if (result != CBK_COORD_FOUND) {
+		/* hole at the end of file */
+		done_lh(&lh);
+		return create ? RETERR(-ENOTBLK) : 0;
+	}
+	result = zload(coord.node);
+	if (result) {
+		done_lh(&lh);
+		return result;
+	}
+	if (!item_is_extent(&coord) || !coord_is_existing_unit(&coord)) {
+		result = RETERR(-ENOTBLK);
+		goto out;
+	}
+	ext = extent_by_coord(&coord);
+	switch (state_of_extent(ext)) {
+	case ALLOCATED_EXTENT:
+		unit_key_by_coord(&coord, &unit_key);
+		start = iblock -
+			(get_key_offset(&unit_key) >> current_blocksize_bits);
+		width = extent_get_width(ext) - start;
+		if (width > bh->b_size >> current_blocksize_bits)
+			width = bh->b_size >> current_blocksize_bits;
+		map_bh(bh, inode->i_sb, extent_get_start(ext) + start);
+		bh->b_size = width << current_blocksize_bits;
+		break;
+	case HOLE_EXTENT:
+		/* reads of holes are zero-filled by direct-io code */
+		if (create)
+			result = RETERR(-ENOTBLK);
+		break;
+	default:
+		result = RETERR(-ENOTBLK);
+	}
+ out:
+	zrelse(coord.node);
+	done_lh(&lh);
+	return result;
+}
+
+/**
+ * direct_io_unix_file - read or overwrite file bypassing page cache
+ * @file: file opened with O_DIRECT
+ * @rw: READ or WRITE
+ * @buf: user buffer
+ * @count: number of bytes
+ * @off: file offset, not updated
+ *
+ * File is built of extents and access to it is obtained by the caller.
+ * Returns number of bytes transferred, 0 if buffered I/O has to be used.
+ */
+static ssize_t direct_io_unix_file(struct file *file, int rw,
+				   char __user *buf, size_t count, loff_t off)
+{
+	struct inode *inode = file_inode(file);
+	struct super_block *super = inode->i_sb;
+	struct iovec iov = { .iov_base = buf, .iov_len = count };
+	struct iov_iter iter;
+	struct kiocb iocb;
+	unsigned long align;
+	loff_t i_size;
+	ssize_t result;
+
+	align = bdev_logical_block_size(super->s_bdev) - 1;
+	if (((unsigned long)buf & align) ||
+	    ((off | count) & (current_blocksize - 1)))
+		return 0;
+	i_size = i_size_read(inode);
+	if (off >= i_size)
+		return 0;
+	if (count > round_down(i_size - off, current_blocksize))
+		count = round_down(i_size - off, current_blocksize);
+	if (count == 0)
+		return 0;
+
+	/* cached pages would become stale. Dirty or captured ones can not be
+	   dropped, their range is done through the page cache */
+	if (invalidate_inode_pages2_range(inode->i_mapping,
+					  off >> PAGE_SHIFT,
+					  (off + count - 1) >> PAGE_SHIFT))
+		return 0;
+
+	reiser4_txn_restart_current();
+	init_sync_kiocb(&iocb, file);
+	iocb.ki_pos = off;
+	iov.iov_len = count;
+	iov_iter_init(&iter, rw, &iov, 1, count);
+	result = __blockdev_direct_IO(&iocb, inode, super->s_bdev, &iter,
+				      get_block_direct_unix_file,
+				      NULL, NULL, 0);
+	if (result == -ENOTBLK)
+		result = 0;
+	return result;
+}
+
+/**
+ * read_lockless - read file of extents without nonexclusive access
+ * @file: file to read from
+ * @buf: user buffer
+ * @count: number of bytes to read
+ * @off: position in file to read from
+ * @result: where to put number of bytes read or error
+ *
+ * Nonexclusive access is an rw-semaphore, whose cache line bounces between
+ * all readers of a file. Buffered read of a file built of extents does not
+ * need it: pages are read by readpage(s), which do not take it. What must not
+ * happen meanwhile is a change of file layout, and such changes make
+ * ->layout_seq odd while they are in progress. So the file is read without
+ * nonexclusive access and 1 is returned if ->layout_seq has not changed
+ * meanwhile. Otherwise 0 is returned and the caller has to read under
+ * nonexclusive access.
+ */
+static int read_lockless(struct file *file, char __user *buf, size_t count,
+			 loff_t *off, ssize_t *result)
+{
+	struct inode *inode = file_inode(file);
+	struct unix_file_info *uf_info = unix_file_inode_data(inode);
+	loff_t start = *off;
+	pgoff_t first;
+	pgoff_t last;
+	unsigned seq;
+
+	if (file->f_flags & O_DIRECT)
+		return 0;
+	seq = raw_read_seqcount(&uf_info->layout_seq);
+	if ((seq & 1) ||
+	    READ_ONCE(uf_info->container) != UF_CONTAINER_EXTENTS ||
+	    reiser4_inode_get_flag(inode, REISER4_PART_MIXED))
+		return 0;
+
+	first = start >> PAGE_SHIFT;
+	last = (start + count - 1) >> PAGE_SHIFT;
+	reiser4_extent_readahead(file, inode->i_mapping, first,
+				 last - first + 1);
+	*result = new_sync_read(file, buf, count, off);
+	if (!read_seqcount_retry(&uf_info->layout_seq, seq))
+		return 1;
+	*off = start;
+	return 0;
+}
+
 /**
  * unix-file specific ->read() method
  * of struct file_operations.
@@ -1741,6 +2119,9 @@ ssize_t read_unix_file(struct file *file, char __user *buf,
 
 	uf_info = unix_file_inode_data(inode);
 
+	if (read_lockless(file, buf, read_amount, off, &result))
+		goto out2;
+
 	if (uf_info->container == UF_CONTAINER_UNKNOWN) {
 		get_exclusive_access(uf_info);
 		result = find_file_state(inode, uf_info);
@@ -1753,7 +2134,29 @@ ssize_t read_unix_file(struct file *file, char __user *buf,
 	switch (uf_info->container) {
 	case UF_CONTAINER_EXTENTS:
 		if (!reiser4_inode_get_flag(inode, REISER4_PART_MIXED)) {
-			result = new_sync_read(file, buf, read_amount, off);
+			ssize_t direct = 0;
+			pgoff_t first;
+			pgoff_t last;
+
+			if (file->f_flags & O_DIRECT) {
+				direct = direct_io_unix_file(file, READ, buf,
+							     read_amount, *off);
+				result = direct;
+				if (direct < 0)
+					break;
+				*off += direct;
+				if (direct == read_amount)
+					break;
+			}
+			/* what is not read directly is read buffered */
+			first = *off >> PAGE_SHIFT;
+			last = (*off + read_amount - direct - 1) >> PAGE_SHIFT;
+			reiser4_extent_readahead(file, inode->i_mapping, first,
+						 last - first + 1);
+			result = new_sync_read(file, buf + direct,
+					       read_amount - direct, off);
+			if (direct > 0)
+				result = result < 0 ? direct : result + direct;
 			break;
 		}
 		/* fall through */
@@ -1785,6 +2188,10 @@ ssize_t read_unix_file(struct file *file, char __user *buf,
  * In this case applying a generic VFS library function
  * would be suboptimal. We use our own "light-weigth"
  * version below.
+ *
+ * Tail items are copied to the user buffer straight from
+ * the formatted node under a seal (see reiser4_read_tail()),
+ * page cache of the file is not populated.
  */
 static ssize_t read_compound_file(struct file *file, char __user *buf,
 				  size_t count, loff_t *off)
@@ -1827,9 +2234,10 @@ static ssize_t read_compound_file(struct file *file, char __user *buf,
 		/*
 		 * faultin user page
 		 */
-		result = fault_in_pages_writeable(buf, to_read);
-		if (result)
-			return RETERR(-EFAULT);
+		if (fault_in_pages_writeable(buf, to_read)) {
+			result = RETERR(-EFAULT);
+			break;
+		}
 
 		result = do_read_compound_file(hint, file, buf, to_read, off);
 		if (result < 0)
@@ -2005,6 +2413,9 @@ int open_unix_file(struct inode *inode, struct file *file)
 
 	if (!reiser4_inode_get_flag(inode, REISER4_PART_MIXED))
 		return 0;
+	if (reiser4_inode_get_flag(inode, REISER4_PART_IN_CONV))
+		/* conversion is in progress, its owner completes it */
+		return 0;
 
 	ctx = reiser4_init_context(inode->i_sb);
 	if (IS_ERR(ctx))
@@ -2068,40 +2479,185 @@ static void drop_access(struct unix_file_info *uf_info)
 #define debug_wuf(format, ...) printk("%s: %d: %s: " format "\n", \
 			      __FILE__, __LINE__, __FUNCTION__, ## __VA_ARGS__)
 
+/*
+ * RANGE LOCKING
+ *
+ * Writers serialize on i_rwsem taken by reiser4_write_dispatch(). A write
+ * which only overwrites part of a file built of extents changes neither file
+ * size nor its layout, so it does not need to exclude other such writes, but
+ * overlapping ones. Such writes take i_rwsem shared and lock the byte range
+ * they write, so that writers into different parts of a large (for instance,
+ * preallocated) file go through write_unix_file() concurrently: they all take
+ * nonexclusive access to the file. Everything else, which may change file
+ * size or container (appends, conversions, truncate), still takes i_rwsem
+ * exclusive, and exclusive access to the file when needed.
+ */
+
 /**
- * write_unix_file - private ->write() method of unix_file plugin.
+ * unix_file_overwrite - check whether write may take i_rwsem shared
+ * @file: file to write to
+ * @pos: position to write at
+ * @count: number of bytes to write
  *
+ * This is called with i_rwsem taken shared, to recheck the result of a call
+ * made without it.
+ */
+int unix_file_overwrite(struct file *file, loff_t pos, size_t count)
+{
+	struct inode *inode = file_inode(file);
+
+	if (inode_file_plugin(inode) != file_plugin_by_id(UNIX_FILE_PLUGIN_ID))
+		return 0;
+	/* file_remove_privs() would have to change inode */
+	if (!IS_NOSEC(inode) || (file->f_flags & O_APPEND))
+		return 0;
+	return READ_ONCE(unix_file_inode_data(inode)->container) ==
+		UF_CONTAINER_EXTENTS &&
+		!reiser4_inode_get_flag(inode, REISER4_PART_MIXED) &&
+		pos + count <= i_size_read(inode);
+}
+
+/* true if write into @page would wait neither for the page nor for an atom */
+static int page_captured_nowait(struct page *page)
+{
+	jnode *node;
+	int captured = 0;
+
+	/* page lock keeps jnode attached */
+	if (!trylock_page(page))
+		return 0;
+	if (PageUptodate(page) && !PageWriteback(page) && PagePrivate(page)) {
+		node = jprivate(page);
+		spin_lock_jnode(node);
+		captured = JF_ISSET(node, JNODE_DIRTY) && node->atom != NULL &&
+			READ_ONCE(node->atom->stage) == ASTAGE_CAPTURE_FUSE;
+		spin_unlock_jnode(node);
+	}
+	unlock_page(page);
+	return captured;
+}
+
+/**
+ * unix_file_write_nowait - check whether write may be done with IOCB_NOWAIT
  * @file: file to write to
- * @buf: address of user-space buffer
+ * @pos: position to write at
  * @count: number of bytes to write
+ *
+ * Nonblocking write is an overwrite of pages which are uptodate, are not
+ * under writeback and are captured already by an atom not yet committing.
+ * Such write neither reads pages nor allocates blocks, and it does not wait
+ * for an atom to commit when it captures the pages. Tree lookup and space
+ * grab done by the write may still sleep on locks, as nonblocking writes of
+ * other file systems do on their metadata locks. This is called with
+ * i_rwsem taken.
+ */
+int unix_file_write_nowait(struct file *file, loff_t pos, size_t count)
+{
+	pgoff_t index;
+	pgoff_t last;
+
+	if ((file->f_flags & (O_DIRECT | O_SYNC)) ||
+	    IS_SYNC(file_inode(file)) || !unix_file_overwrite(file, pos, count))
+		return 0;
+	if (count == 0)
+		return 1;
+	last = (pos + count - 1) >> PAGE_SHIFT;
+	for (index = pos >> PAGE_SHIFT; index <= last; index++) {
+		struct page *page;
+		int captured;
+
+		page = find_get_page(file->f_mapping, index);
+		if (page == NULL)
+			return 0;
+		captured = page_captured_nowait(page);
+		put_page(page);
+		if (!captured)
+			return 0;
+	}
+	return 1;
+}
+
+/* lock @range unless it overlaps a locked one */
+static int uf_trylock_range(struct unix_file_info *uf_info,
+			    struct uf_range *range)
+{
+	struct uf_range *r;
+
+	spin_lock(&uf_info->range_guard);
+	list_for_each_entry(r, &uf_info->ranges, link) {
+		if (r->start < range->end && range->start < r->end) {
+			spin_unlock(&uf_info->range_guard);
+			return 0;
+		}
+	}
+	list_add(&range->link, &uf_info->ranges);
+	spin_unlock(&uf_info->range_guard);
+	return 1;
+}
+
+/**
+ * uf_lock_range - lock byte range of file
+ * @uf_info: unix file specific part of inode
+ * @range: range to lock
+ * @start: first byte of range
+ * @end: byte past the range
+ *
+ * Waits until no locked range overlaps [@start, @end).
+ */
+void uf_lock_range(struct unix_file_info *uf_info, struct uf_range *range,
+		   loff_t start, loff_t end)
+{
+	range->start = start;
+	range->end = end;
+	wait_var_event(&uf_info->ranges, uf_trylock_range(uf_info, range));
+}
+
+/**
+ * uf_unlock_range - unlock range locked by uf_lock_range()
+ * @uf_info: unix file specific part of inode
+ * @range: range to unlock
+ */
+void uf_unlock_range(struct unix_file_info *uf_info, struct uf_range *range)
+{
+	spin_lock(&uf_info->range_guard);
+	list_del(&range->link);
+	spin_unlock(&uf_info->range_guard);
+	/* pairs with the barrier of prepare_to_wait() in wait_var_event() */
+	smp_mb();
+	wake_up_var(&uf_info->ranges);
+}
+
+/**
+ * write_unix_file_iter - write data of iterator to unix file
+ * @file: file to write to
+ * @from: data to write, user buffer or pages of a pipe
  * @pos: position in file to write to
- * @cont: unused argument, as we don't perform plugin conversion when being
- * managed by unix_file plugin.
+ *
+ * This is called with reiser4 context and i_rwsem of the file taken, after
+ * write checks are done. @from is advanced by the number of bytes written.
  */
-ssize_t write_unix_file(struct file *file,
-			const char __user *buf,
-			size_t count, loff_t *pos,
-			struct dispatch_context *cont)
+ssize_t write_unix_file_iter(struct file *file, struct iov_iter *from,
+			     loff_t *pos)
 {
 	int result;
 	reiser4_context *ctx;
 	struct inode *inode;
 	struct unix_file_info *uf_info;
 	ssize_t written;
-	int to_write = PAGE_SIZE * WRITE_GRANULARITY;
+	size_t count = iov_iter_count(from);
+	size_t to_write;
 	size_t left;
 	ssize_t (*write_op)(struct file *, struct inode *,
-			    const char __user *, size_t,
-			    loff_t *pos);
+			    struct iov_iter *, size_t, loff_t *pos);
 	int ea;
 	int enospc = 0; /* item plugin ->write() returned ENOSPC */
+	int times_set = 0; /* mtime and ctime are updated */
 	loff_t new_size;
 
 	ctx = get_current_context();
 	inode = file_inode(file);
 
 	assert("vs-947", !reiser4_inode_get_flag(inode, REISER4_NO_SD));
-	assert("vs-9471", (!reiser4_inode_get_flag(inode, REISER4_PART_MIXED)));
 
 	result = file_remove_privs(file);
 	if (result) {
@@ -2124,8 +2680,6 @@ ssize_t write_unix_file(struct file *file,
 
 	while (left) {
 		int update_sd = 0;
-		if (left < to_write)
-			to_write = left;
 
 		if (uf_info->container == UF_CONTAINER_EMPTY) {
 			get_exclusive_access(uf_info);
@@ -2157,16 +2711,41 @@ ssize_t write_unix_file(struct file *file,
 		/* either EA or NEA is obtained. Choose item write method */
 		if (uf_info->container == UF_CONTAINER_EXTENTS) {
 			/* file is built of extent items */
-			write_op = reiser4_write_extent;
+			write_op = reiser4_write_extent_iter;
 		} else if (uf_info->container == UF_CONTAINER_EMPTY) {
 			/* file is empty */
 			if (should_have_notail(uf_info, new_size))
-				write_op = reiser4_write_extent;
+				write_op = reiser4_write_extent_iter;
 			else
-				write_op = reiser4_write_tail;
+				write_op = reiser4_write_tail_iter;
 		} else {
 			/* file is built of tail items */
-			if (should_have_notail(uf_info, new_size)) {
+			/* whether to convert file to extents before write */
+			int convert = should_have_notail(uf_info, new_size);
+
+			if (reiser4_inode_get_flag(inode,
+						   REISER4_PART_IN_CONV)) {
+				/*
+				 * file is being converted in background. Tails
+				 * may be written past the converted part only
+				 */
+				if (*pos < uf_info->converted) {
+					drop_access(uf_info);
+					ea = NEITHER_OBTAINED;
+					schedule();
+					continue;
+				}
+				convert = 0;
+			} else if (reiser4_inode_get_flag(inode,
+							  REISER4_PART_MIXED)) {
+				/* conversion failed, complete it right now */
+				convert = 1;
+			} else if (convert &&
+				   !tail2extent_by_writer(inode, left)) {
+				queue_tail2extent(inode);
+				convert = 0;
+			}
+			if (convert) {
 				if (ea == NEA_OBTAINED) {
 					drop_nonexclusive_access(uf_info);
 					get_exclusive_access(uf_info);
@@ -2200,10 +2779,40 @@ ssize_t write_unix_file(struct file *file,
 				ea = NEITHER_OBTAINED;
 				continue;
 			}
-			write_op = reiser4_write_tail;
+			write_op = reiser4_write_tail_iter;
 		}
 
-		written = write_op(file, inode, buf, to_write, pos);
+		/* extents are written in larger batches to spread per call
+		   costs (access, space grab, tree lookup, stat data update)
+		   over more pages */
+		if (write_op == reiser4_write_extent_iter)
+			to_write = PAGE_SIZE * WRITE_EXTENT_GRANULARITY;
+		else
+			to_write = PAGE_SIZE * WRITE_GRANULARITY;
+		if (left < to_write)
+			to_write = left;
+
+		written = 0;
+		/* write_op grabs space for stat data update itself, direct
+		   write has to do that beforehand */
+		if ((file->f_flags & O_DIRECT) && iter_is_iovec(from) &&
+		    write_op == reiser4_write_extent_iter &&
+		    uf_info->container == UF_CONTAINER_EXTENTS) {
+			/* direct write is done from one user segment */
+			size_t seg = min(to_write,
+					 iov_iter_single_seg_count(from));
+
+			grab_space_enable();
+			if (reiser4_grab_space(estimate_update_common(inode),
+					       BA_CAN_COMMIT) == 0)
+				written = direct_io_unix_file(file, WRITE,
+						from->iov->iov_base +
+						from->iov_offset, seg, *pos);
+			if (written > 0)
+				iov_iter_advance(from, written);
+		}
+		if (written == 0)
+			written = write_op(file, inode, from, to_write, pos);
 		if (written == -ENOSPC && !enospc) {
 			drop_access(uf_info);
 			txnmgr_force_commit_all(inode->i_sb, 0);
@@ -2226,21 +2835,30 @@ ssize_t write_unix_file(struct file *file,
 		if (uf_info->container == UF_CONTAINER_EMPTY) {
 			assert("edward-1553", ea == EA_OBTAINED);
 			uf_info->container =
-				(write_op == reiser4_write_extent) ?
+				(write_op == reiser4_write_extent_iter) ?
 				UF_CONTAINER_EXTENTS : UF_CONTAINER_TAILS;
 		}
 		assert("edward-1554",
 		       ergo(uf_info->container == UF_CONTAINER_EXTENTS,
-			    write_op == reiser4_write_extent));
+			    write_op == reiser4_write_extent_iter));
 		assert("edward-1555",
 		       ergo(uf_info->container == UF_CONTAINER_TAILS,
-			    write_op == reiser4_write_tail));
+			    write_op == reiser4_write_tail_iter));
 		if (*pos + written > inode->i_size) {
 			INODE_SET_FIELD(inode, i_size, *pos + written);
+			note_file_size(inode);
 			update_sd = 1;
 		}
-		if (!IS_NOCMTIME(inode)) {
+		/*
+		 * times are updated once per write, as generic_perform_write()
+		 * does. So an overwrite updates stat-data once, rather than
+		 * per chunk. Stat-data is still updated with every chunk that
+		 * extends the file, so that on-disk i_size covers the body
+		 * committed with it.
+		 */
+		if (!IS_NOCMTIME(inode) && !times_set) {
 			inode->i_ctime = inode->i_mtime = current_time(inode);
+			times_set = 1;
 			update_sd = 1;
 		}
 		if (update_sd) {
@@ -2266,7 +2884,6 @@ ssize_t write_unix_file(struct file *file,
 		 */
 		reiser4_throttle_write(inode);
 		left -= written;
-		buf += written;
 		*pos += written;
 	}
 	if (result == 0 && ((file->f_flags & O_SYNC) || IS_SYNC(inode))) {
@@ -2286,6 +2903,28 @@ ssize_t write_unix_file(struct file *file,
 	return (count - left) ? (count - left) : result;
 }
 
+/**
+ * write_unix_file - private ->write() method of unix_file plugin.
+ *
+ * @file: file to write to
+ * @buf: address of user-space buffer
+ * @count: number of bytes to write
+ * @pos: position in file to write to
+ * @cont: unused argument, as we don't perform plugin conversion when being
+ * managed by unix_file plugin.
+ */
+ssize_t write_unix_file(struct file *file,
+			const char __user *buf,
+			size_t count, loff_t *pos,
+			struct dispatch_context *cont)
+{
+	struct iovec iov = { .iov_base = (void __user *)buf, .iov_len = count };
+	struct iov_iter iter;
+
+	iov_iter_init(&iter, WRITE, &iov, 1, count);
+	return write_unix_file_iter(file, &iter, pos);
+}
+
 /**
  * release_unix_file - release of struct file_operations
  * @inode: inode of released file
@@ -2328,6 +2967,9 @@ int release_unix_file(struct inode *inode, struct file *file)
 			}
 		}
 		drop_exclusive_access(uf_info);
+		if (file->f_mode & FMODE_WRITE)
+			reiser4_prealloc_release(inode->i_sb,
+						 get_inode_oid(inode));
 	} else {
 		/*
 		   we are within reiser4 context already. How latter is
@@ -2430,11 +3072,12 @@ static int unpack(struct file *filp, struct inode *inode, int forever)
    plugin
 */
 int ioctl_unix_file(struct file *filp, unsigned int cmd,
-		    unsigned long arg UNUSED_ARG)
+		    unsigned long arg)
 {
 	reiser4_context *ctx;
 	int result;
 	struct inode *inode = filp->f_path.dentry->d_inode;
+	struct reiser4_defrag_range range;
 
 	ctx = reiser4_init_context(inode->i_sb);
 	if (IS_ERR(ctx))
@@ -2447,6 +3090,26 @@ int ioctl_unix_file(struct file *filp, unsigned int cmd,
 		drop_exclusive_access(unix_file_inode_data(inode));
 		break;
 
+	case REISER4_IOC_DEFRAG:
+		if (!(filp->f_mode & FMODE_WRITE)) {
+			result = RETERR(-EBADF);
+			break;
+		}
+		if (copy_from_user(&range, (void __user *)arg,
+				   sizeof(range))) {
+			result = RETERR(-EFAULT);
+			break;
+		}
+		result = mnt_want_write_file(filp);
+		if (result)
+			break;
+		result = reiser4_defrag_file(inode, &range);
+		mnt_drop_write_file(filp);
+		if (result == 0 &&
+		    copy_to_user((void __user *)arg, &range, sizeof(range)))
+			result = RETERR(-EFAULT);
+		break;
+
 	default:
 		result = RETERR(-ENOTTY);
 		break;
@@ -2583,8 +3246,11 @@ static int setattr_truncate(struct inode *inode, struct iattr *attr)
 	result = safe_link_grab(tree, BA_CAN_COMMIT);
 	if (result == 0)
 		result = safe_link_add(inode, SAFE_TRUNCATE);
-	if (result == 0)
+	if (result == 0) {
+		layout_change_begin(unix_file_inode_data(inode));
 		result = truncate_file_body(inode, attr);
+		layout_change_end(unix_file_inode_data(inode));
+	}
 	if (result)
 		warning("vs-1588", "truncate_file failed: oid %lli, "
 			"old size %lld, new size %lld, retval %d",
@@ -2633,6 +3299,246 @@ int setattr_unix_file(struct dentry *dentry,	/* Object to change attributes */
 	return result;
 }
 
+/* update times, size if @new_size is past it, and stat data of file
+   fallocate has changed */
+static int fallocate_update_sd(struct inode *inode, loff_t new_size)
+{
+	int result;
+
+	grab_space_enable();
+	result = reiser4_grab_reserved(inode->i_sb,
+				       estimate_update_common(inode),
+				       BA_CAN_COMMIT);
+	if (result == 0) {
+		if (new_size > inode->i_size) {
+			INODE_SET_SIZE(inode, new_size);
+			inode->i_mtime = current_time(inode);
+		}
+		inode->i_ctime = current_time(inode);
+		result = reiser4_update_sd(inode);
+	}
+	/* the below does up(sbinfo->delete_mutex). Do not get confused */
+	reiser4_release_reserved(inode->i_sb);
+	return result;
+}
+
+/**
+ * prealloc_unix_file - allocate blocks for range of file
+ * @inode: file
+ * @off: start of range
+ * @end: end of range
+ * @keep_size: FALLOC_FL_KEEP_SIZE is set
+ *
+ * Only files built of extents can be preallocated. Ranges which are holes
+ * inside of file body are not supported, glibc's posix_fallocate() writes
+ * zeroes then.
+ */
+static int prealloc_unix_file(struct inode *inode, loff_t off, loff_t end,
+			      int keep_size)
+{
+	struct unix_file_info *uf_info = unix_file_inode_data(inode);
+	reiser4_tree *tree = reiser4_tree_by_inode(inode);
+	loff_t pos = round_down(off, PAGE_SIZE);
+	loff_t prealloc_end = round_up(end, PAGE_SIZE);
+	reiser4_block_nr count;
+	int result = 0;
+	int update;
+
+	if (uf_info->container == UF_CONTAINER_TAILS ||
+	    (uf_info->container == UF_CONTAINER_EMPTY &&
+	     !should_have_notail(uf_info, end)))
+		return RETERR(-EOPNOTSUPP);
+
+	while (pos < prealloc_end) {
+		count = min_t(reiser4_block_nr, FALLOCATE_GRANULARITY,
+			      (prealloc_end - pos) >> PAGE_SHIFT);
+		grab_space_enable();
+		result = reiser4_grab_space(count +
+					    estimate_one_insert_item(tree) +
+					    estimate_one_insert_into_item(tree),
+					    BA_CAN_COMMIT);
+		if (result)
+			break;
+		result = reiser4_fallocate_extent(inode, pos, count);
+		all_grabbed2free();
+		if (result < 0)
+			break;
+		if (uf_info->container == UF_CONTAINER_EMPTY)
+			uf_info->container = UF_CONTAINER_EXTENTS;
+		pos += (loff_t)result << PAGE_SHIFT;
+		result = 0;
+
+		reiser4_txn_restart_current();
+		if (fatal_signal_pending(current)) {
+			result = RETERR(-EINTR);
+			break;
+		}
+	}
+
+	/* the file is extended up to what is preallocated */
+	update = fallocate_update_sd(inode, keep_size ? 0 : min(pos, end));
+	return result ? result : update;
+}
+
+/* zero bytes [@from, @to) of one page of file built of extents */
+static int zero_partial_page(struct inode *inode, loff_t from, loff_t to)
+{
+	struct page *page;
+	int result;
+
+	assert("", from >> PAGE_SHIFT == (to - 1) >> PAGE_SHIFT);
+
+	result = reserve_partial_page(reiser4_tree_by_inode(inode));
+	if (result) {
+		reiser4_release_reserved(inode->i_sb);
+		return result;
+	}
+	page = read_mapping_page(inode->i_mapping, from >> PAGE_SHIFT, NULL);
+	if (IS_ERR(page)) {
+		reiser4_release_reserved(inode->i_sb);
+		return PTR_ERR(page);
+	}
+	wait_on_page_locked(page);
+	if (!PageUptodate(page))
+		result = RETERR(-EIO);
+	else
+		result = find_or_create_extent(page);
+	if (result == 0) {
+		lock_page(page);
+		zero_user(page, from & (PAGE_SIZE - 1), to - from);
+		unlock_page(page);
+	}
+	put_page(page);
+	/* the below does up(sbinfo->delete_mutex). Do not get confused */
+	reiser4_release_reserved(inode->i_sb);
+	return result;
+}
+
+/* update_actor of cut_file_items() for hole punching which does not change
+   file size */
+static int punch_update_actor(struct inode *inode, loff_t new_size UNUSED_ARG,
+			      int update_sd)
+{
+	if (update_sd) {
+		inode->i_ctime = inode->i_mtime = current_time(inode);
+		return reiser4_update_sd(inode);
+	}
+	return 0;
+}
+
+/**
+ * punch_hole_unix_file - free blocks of range of file
+ * @inode: file
+ * @off: start of range
+ * @end: end of range
+ *
+ * Partial pages at the edges of the range are zeroed. Whole pages up to the
+ * end of file are cut by cut_file_items(), like truncate does, the file body
+ * just ends before i_size then. Whole pages inside of file body are turned
+ * into hole extents by reiser4_punch_extent().
+ */
+static int punch_hole_unix_file(struct inode *inode, loff_t off, loff_t end)
+{
+	struct unix_file_info *uf_info = unix_file_inode_data(inode);
+	reiser4_tree *tree = reiser4_tree_by_inode(inode);
+	loff_t first;
+	loff_t last;
+	int result = 0;
+
+	if (uf_info->container == UF_CONTAINER_TAILS)
+		return RETERR(-EOPNOTSUPP);
+	if (uf_info->container == UF_CONTAINER_EMPTY || off >= inode->i_size)
+		return 0;
+
+	first = round_up(off, PAGE_SIZE);
+	if (end >= inode->i_size) {
+		/* nothing after the range is to be kept */
+		if (off != first)
+			result = zero_partial_page(inode, off,
+						   min(first, inode->i_size));
+		if (result)
+			return result;
+		result = cut_file_items(inode, first, 1,
+					get_key_offset(reiser4_max_key()),
+					punch_update_actor);
+		/* there may be nothing to cut */
+		return result == CBK_COORD_NOTFOUND ? 0 : result;
+	}
+
+	last = round_down(end, PAGE_SIZE);
+	if (first > last)
+		/* the range is inside of one page */
+		return zero_partial_page(inode, off, end);
+	if (off != first)
+		result = zero_partial_page(inode, off, first);
+	if (result == 0 && last != end)
+		result = zero_partial_page(inode, last, end);
+
+	while (result == 0 && first < last) {
+		all_grabbed2free();
+		result = reserve_cut_iteration(tree);
+		if (result == 0)
+			result = reiser4_punch_extent(inode, first,
+						      (last - first) >>
+						      PAGE_SHIFT);
+		/* the below does up(sbinfo->delete_mutex) */
+		reiser4_release_reserved(inode->i_sb);
+		if (result <= 0)
+			/* error or the end of file body */
+			break;
+		first += (loff_t)result << PAGE_SHIFT;
+		result = 0;
+
+		reiser4_txn_restart_current();
+		if (fatal_signal_pending(current))
+			result = RETERR(-EINTR);
+	}
+	all_grabbed2free();
+	if (result == 0)
+		result = fallocate_update_sd(inode, 0);
+	return result;
+}
+
+/**
+ * fallocate_unix_file - fallocate of struct file_operations
+ * @file: file to allocate or free space of
+ * @mode: 0, FALLOC_FL_KEEP_SIZE or FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE
+ * @off: start of range
+ * @len: length of range
+ */
+long fallocate_unix_file(struct file *file, int mode, loff_t off, loff_t len)
+{
+	struct inode *inode = file_inode(file);
+	reiser4_context *ctx;
+	struct unix_file_info *uf_info;
+	int result;
+
+	/* VFS checks that PUNCH_HOLE comes with KEEP_SIZE */
+	if (mode & ~(FALLOC_FL_KEEP_SIZE | FALLOC_FL_PUNCH_HOLE))
+		return RETERR(-EOPNOTSUPP);
+
+	ctx = reiser4_init_context(inode->i_sb);
+	if (IS_ERR(ctx))
+		return PTR_ERR(ctx);
+
+	uf_info = unix_file_inode_data(inode);
+	get_exclusive_access_careful(uf_info, inode);
+	result = find_file_state(inode, uf_info);
+	if (result == 0) {
+		if (mode & FALLOC_FL_PUNCH_HOLE) {
+			layout_change_begin(uf_info);
+			result = punch_hole_unix_file(inode, off, off + len);
+			layout_change_end(uf_info);
+		} else
+			result = prealloc_unix_file(inode, off, off + len,
+						    mode & FALLOC_FL_KEEP_SIZE);
+	}
+	drop_exclusive_access(uf_info);
+	context_set_commit_async(ctx);
+	reiser4_exit_context(ctx);
+	return result;
+}
+
 /* plugin->u.file.init_inode_data */
 void
 init_inode_data_unix_file(struct inode *inode,
@@ -2645,6 +3551,12 @@ init_inode_data_unix_file(struct inode *inode,
 	init_rwsem(&data->latch);
 	data->tplug = inode_formatting_plugin(inode);
 	data->exclusive_use = 0;
+	data->converted = 0;
+	INIT_LIST_HEAD(&data->conv_link);
+	data->max_size = 0;
+	seqcount_init(&data->layout_seq);
+	spin_lock_init(&data->range_guard);
+	INIT_LIST_HEAD(&data->ranges);
 
 #if REISER4_DEBUG
 	data->ea_owner = NULL;
@@ -28,17 +28,26 @@ struct dispatch_context {
 
 /* inode operations */
 int reiser4_setattr_dispatch(struct dentry *, struct iattr *);
+int reiser4_fiemap_dispatch(struct inode *, struct fiemap_extent_info *,
+			    u64 start, u64 len);
 
 /* file operations */
+loff_t reiser4_llseek_dispatch(struct file *, loff_t off, int whence);
 ssize_t reiser4_read_dispatch(struct file *, char __user *buf,
 			      size_t count, loff_t *off);
 ssize_t reiser4_write_dispatch(struct file *, const char __user *buf,
 			       size_t count, loff_t * off);
+ssize_t reiser4_write_iter_dispatch(struct kiocb *, struct iov_iter *from);
 long reiser4_ioctl_dispatch(struct file *filp, unsigned int cmd,
 			    unsigned long arg);
 int reiser4_mmap_dispatch(struct file *, struct vm_area_struct *);
 int reiser4_open_dispatch(struct inode *inode, struct file *file);
 int reiser4_release_dispatch(struct inode *, struct file *);
+long reiser4_fallocate_dispatch(struct file *, int mode, loff_t off,
+				loff_t len);
+ssize_t reiser4_copy_file_range_dispatch(struct file *, loff_t pos_in,
+					 struct file *, loff_t pos_out,
+					 size_t len, unsigned int flags);
 int reiser4_sync_file_common(struct file *, loff_t, loff_t, int datasync);
 int reiser4_sync_page(struct page *page);
 
@@ -65,17 +74,26 @@ sector_t reiser4_bmap_dispatch(struct address_space *, sector_t lblock);
 
 /* private inode operations */
 int setattr_unix_file(struct dentry *, struct iattr *);
+int fiemap_unix_file(struct inode *, struct fiemap_extent_info *,
+		     u64 start, u64 len);
 
 /* private file operations */
+loff_t llseek_unix_file(struct file *, loff_t off, int whence);
 
 ssize_t read_unix_file(struct file *, char __user *buf, size_t read_amount,
 		       loff_t *off);
 ssize_t write_unix_file(struct file *, const char __user *buf, size_t write_amount,
 			loff_t * off, struct dispatch_context * cont);
+ssize_t write_unix_file_iter(struct file *, struct iov_iter *from,
+			     loff_t *off);
 int ioctl_unix_file(struct file *, unsigned int cmd, unsigned long arg);
 int mmap_unix_file(struct file *, struct vm_area_struct *);
 int open_unix_file(struct inode *, struct file *);
 int release_unix_file(struct inode *, struct file *);
+long fallocate_unix_file(struct file *, int mode, loff_t off, loff_t len);
+ssize_t copy_file_range_unix_file(struct file *, loff_t pos_in,
+				  struct file *, loff_t pos_out,
+				  size_t len, unsigned int flags);
 
 /* private address space operations */
 int readpage_unix_file(struct file *, struct page *);
@@ -173,6 +191,13 @@ typedef enum {
 struct formatting_plugin;
 struct inode;
 
+/* byte range of file locked by a writer, see uf_lock_range() */
+struct uf_range {
+	loff_t start;
+	loff_t end;
+	struct list_head link;
+};
+
 /* unix file plugin specific part of reiser4 inode */
 struct unix_file_info {
 	/*
@@ -193,6 +218,30 @@ struct unix_file_info {
 	struct formatting_plugin *tplug;
 	/* if this is set, file is in exclusive use */
 	int exclusive_use;
+	/*
+	 * while REISER4_PART_IN_CONV is set: file body below this offset is
+	 * converted to extents already, see tail2extent()
+	 */
+	loff_t converted;
+	/* link in queue of background tail2extent conversion */
+	struct list_head conv_link;
+	/*
+	 * the largest size file had since inode was loaded, used by "smart"
+	 * formatting policy
+	 */
+	loff_t max_size;
+	/*
+	 * odd while layout of file built of extents is being changed under
+	 * exclusive access (truncate, hole punching, extent2tail), see
+	 * read_lockless()
+	 */
+	seqcount_t layout_seq;
+	/*
+	 * byte ranges locked by writers which overwrite file under shared
+	 * i_rwsem, protected by ->range_guard
+	 */
+	spinlock_t range_guard;
+	struct list_head ranges;
 #if REISER4_DEBUG
 	/* pointer to task struct of thread owning exclusive access to file */
 	void *ea_owner;
@@ -207,6 +256,11 @@ void drop_exclusive_access(struct unix_file_info *);
 void get_nonexclusive_access(struct unix_file_info *);
 void drop_nonexclusive_access(struct unix_file_info *);
 int try_to_get_nonexclusive_access(struct unix_file_info *);
+int unix_file_overwrite(struct file *, loff_t pos, size_t count);
+int unix_file_write_nowait(struct file *, loff_t pos, size_t count);
+void uf_lock_range(struct unix_file_info *, struct uf_range *,
+		   loff_t start, loff_t end);
+void uf_unlock_range(struct unix_file_info *, struct uf_range *);
 int find_file_item(hint_t *, const reiser4_key *, znode_lock_mode,
 		   struct inode *);
 int find_file_item_nohint(coord_t *, lock_handle *,
@@ -244,6 +298,7 @@ struct uf_coord {
  */
 struct hint {
 	seal_t seal; /* a seal over last file item accessed */
+	reiser4_finger finger; /* where to search when the seal is broken */
 	uf_coord_t ext_coord;
 	loff_t offset;
 	znode_lock_mode mode;
@@ -291,9 +346,27 @@ static inline int ea_obtained(struct unix_file_info * uf_info)
 
 #endif
 
+static inline void layout_change_begin(struct unix_file_info *uf_info)
+{
+	assert("", ea_obtained(uf_info));
+	raw_write_seqcount_begin(&uf_info->layout_seq);
+}
+
+static inline void layout_change_end(struct unix_file_info *uf_info)
+{
+	assert("", ea_obtained(uf_info));
+	raw_write_seqcount_end(&uf_info->layout_seq);
+}
+
 #define WRITE_GRANULARITY 32
+/* number of pages written to extents at once, see reiser4_write_extent() */
+#define WRITE_EXTENT_GRANULARITY 128
+/* number of pages preallocated at once, see fallocate_unix_file() */
+#define FALLOCATE_GRANULARITY 1024
 
 int tail2extent(struct unix_file_info *);
+void reiser4_init_conv_queue(struct super_block *);
+void reiser4_done_conv_queue(struct super_block *);
 int extent2tail(struct file *, struct unix_file_info *);
 
 int goto_right_neighbor(coord_t *, lock_handle *);
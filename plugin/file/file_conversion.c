@@ -13,7 +13,9 @@
  * incompressible data. Current heuristic to estimate compressibility is
  * very simple: if first complete logical cluster (64K by default) of a
  * file is incompressible, then we make a decision, that the whole file
- * is incompressible.
+ * is incompressible. Compressibility of the cluster is estimated by
+ * entropy of its sample, and trial compression is only done when the
+ * estimate is not conclusive.
  *
  * To enable dispatching we install a special "magic" compression mode
  * plugin CONVX_COMPRESSION_MODE_ID at file creation time.
@@ -131,6 +133,12 @@ static int __cryptcompress2unixfile(struct file *file, struct inode * inode)
 	init_rwsem(&uf->latch);
 	uf->tplug = inode_formatting_plugin(inode);
 	uf->exclusive_use = 0;
+	uf->converted = 0;
+	INIT_LIST_HEAD(&uf->conv_link);
+	uf->max_size = 0;
+	seqcount_init(&uf->layout_seq);
+	spin_lock_init(&uf->range_guard);
+	INIT_LIST_HEAD(&uf->ranges);
 #if REISER4_DEBUG
 	uf->ea_owner = NULL;
 	atomic_set(&uf->nr_neas, 0);
@@ -267,6 +275,10 @@ static int prepped_dclust_ok(hint_t * hint)
  * This is called not more then one time per file's life.
  * Read first logical cluster (of index #0) and estimate its compressibility.
  * Save estimation result in @cont.
+ *
+ * Entropy of a sample of the cluster decides in most cases: data of low
+ * entropy are compressible, and data of high entropy are not. The cluster
+ * is actually compressed only when the sample is not conclusive.
  */
 static int read_check_compressibility(struct inode * inode,
 				      struct cluster_handle * clust,
@@ -274,6 +286,7 @@ static int read_check_compressibility(struct inode * inode,
 {
 	int i;
 	int result;
+	int entropy;
 	size_t dst_len;
 	hint_t tmp_hint;
 	hint_t * cur_hint = clust->hint;
@@ -324,14 +337,24 @@ static int read_check_compressibility(struct inode * inode,
 			kunmap(clust->pages[i]);
 			unlock_page(clust->pages[i]);
 		}
+		tc->len = tc->lsize = lbytes(clust->index, inode);
+		assert("edward-1513", tc->len == inode_cluster_size(inode));
+		entropy = reiser4_sample_entropy(tfm_input_data(clust),
+						 tc->len);
+		if (entropy >= 0 && entropy <= REISER4_SAMPLE_ENTROPY_LOW) {
+			dst_len = 0;
+			goto done;
+		}
+		if (entropy > REISER4_SAMPLE_ENTROPY_MAX) {
+			dst_len = tc->len;
+			goto done;
+		}
 		result = grab_tfm_stream(inode, tc, OUTPUT_STREAM);
 		if (result)
 			goto error;
 		result = grab_coa(tc, cplug);
 		if (result)
 			goto error;
-		tc->len = tc->lsize = lbytes(clust->index, inode);
-		assert("edward-1513", tc->len == inode_cluster_size(inode));
 		dst_len = tfm_stream_size(tc, OUTPUT_STREAM);
 		cplug->compress(get_coa(tc, cplug->h.id, tc->act),
 				tfm_input_data(clust), tc->len,
@@ -339,6 +362,7 @@ static int read_check_compressibility(struct inode * inode,
 		assert("edward-1514",
 		       dst_len <= tfm_stream_size(tc, OUTPUT_STREAM));
 	}
+ done:
 	finish_check_compressibility(inode, clust, cur_hint);
 	cont->state =
 		(data_is_compressible(dst_len, inode_cluster_size(inode)) ?
@@ -544,17 +568,37 @@ ssize_t reiser4_write_dispatch(struct file *file, const char __user *buf,
 	ssize_t written_new = 0; /* bytes written with new plugin */
 	struct dispatch_context cont;
 	struct inode * inode = file_inode(file);
+	/* overwrite under shared i_rwsem, see RANGE LOCKING in file.c */
+	int shared;
+	struct uf_range range;
 
 	ctx = reiser4_init_context(inode->i_sb);
 	if (IS_ERR(ctx))
 		return PTR_ERR(ctx);
 	current->backing_dev_info = inode_to_bdi(inode);
 	init_dispatch_context(&cont);
-	inode_lock(inode);
+	shared = unix_file_overwrite(file, *off, count);
+	if (shared) {
+		inode_lock_shared(inode);
+		shared = unix_file_overwrite(file, *off, count);
+		if (!shared)
+			inode_unlock_shared(inode);
+	}
+	if (!shared)
+		inode_lock(inode);
 
 	result = reiser4_write_checks(file, buf, count, off);
 	if (unlikely(result <= 0))
 		goto exit;
+	if (shared) {
+		uf_lock_range(unix_file_inode_data(inode), &range,
+			      *off, *off + count);
+		written_old = inode_file_plugin(inode)->write(file, buf, count,
+							      off, &cont);
+		uf_unlock_range(unix_file_inode_data(inode), &range);
+		assert("", cont.state != DISPATCH_ASSIGNED_NEW);
+		goto exit;
+	}
 	/**
 	 * First step.
 	 * Start write with initial file plugin.
@@ -604,7 +648,10 @@ ssize_t reiser4_write_dispatch(struct file *file, const char __user *buf,
 						      off,
 						      NULL);
  exit:
-	inode_unlock(inode);
+	if (shared)
+		inode_unlock_shared(inode);
+	else
+		inode_unlock(inode);
 	done_dispatch_context(&cont, inode);
 	current->backing_dev_info = NULL;
 	context_set_commit_async(ctx);
@@ -613,6 +660,83 @@ ssize_t reiser4_write_dispatch(struct file *file, const char __user *buf,
 	return written_old + (written_new < 0 ? 0 : written_new);
 }
 
+/* write user segments of @from one by one, as VFS does for a file without
+   ->write_iter() */
+static ssize_t write_iter_by_segments(struct kiocb *iocb,
+				      struct iov_iter *from)
+{
+	ssize_t written = 0;
+	ssize_t result;
+
+	/* ->write() of those plugins may always block */
+	if (iocb->ki_flags & IOCB_NOWAIT)
+		return RETERR(-EAGAIN);
+	if (!iter_is_iovec(from))
+		return RETERR(-EINVAL);
+	while (iov_iter_count(from)) {
+		struct iovec iov = iov_iter_iovec(from);
+
+		result = reiser4_write_dispatch(iocb->ki_filp, iov.iov_base,
+						iov.iov_len, &iocb->ki_pos);
+		if (result < 0)
+			return written ? written : result;
+		written += result;
+		iov_iter_advance(from, result);
+		if (result != iov.iov_len)
+			break;
+	}
+	return written;
+}
+
+/*
+ * ->write_iter() VFS file operation
+ *
+ * Used by writev(), asynchronous writes and iter_file_splice_write(), which
+ * passes pages of a pipe. Files of plugins without ->write_iter() method get
+ * their segments written by ->write() one by one.
+ *
+ * Write with IOCB_NOWAIT (RWF_NOWAIT, io_uring) fails with -EAGAIN unless it
+ * overwrites pages captured already, see unix_file_write_nowait().
+ */
+ssize_t reiser4_write_iter_dispatch(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct file *file = iocb->ki_filp;
+	struct inode *inode = file_inode(file);
+	reiser4_context *ctx;
+	ssize_t result;
+
+	/* the unix file plugin is never converted to other plugins */
+	if (inode_file_plugin(inode)->write_iter == NULL)
+		return write_iter_by_segments(iocb, from);
+
+	ctx = reiser4_init_context(inode->i_sb);
+	if (IS_ERR(ctx))
+		return PTR_ERR(ctx);
+	current->backing_dev_info = inode_to_bdi(inode);
+	if (iocb->ki_flags & IOCB_NOWAIT) {
+		if (!inode_trylock(inode)) {
+			result = RETERR(-EAGAIN);
+			goto out;
+		}
+	} else
+		inode_lock(inode);
+
+	result = generic_write_checks(iocb, from);
+	if (result > 0 && (iocb->ki_flags & IOCB_NOWAIT) &&
+	    !unix_file_write_nowait(file, iocb->ki_pos, iov_iter_count(from)))
+		result = RETERR(-EAGAIN);
+	if (result > 0)
+		result = inode_file_plugin(inode)->write_iter(file, from,
+							      &iocb->ki_pos);
+
+	inode_unlock(inode);
+ out:
+	current->backing_dev_info = NULL;
+	context_set_commit_async(ctx);
+	reiser4_exit_context(ctx);
+	return result;
+}
+
 /*
  * Dispatchers with "passive" protection for:
  *
@@ -621,12 +745,25 @@ ssize_t reiser4_write_dispatch(struct file *file, const char __user *buf,
  * ->ioctl();
  * ->mmap();
  * ->release();
- * ->bmap().
+ * ->bmap();
+ * ->fiemap();
+ * ->llseek();
+ * ->fallocate();
+ * ->copy_file_range().
  */
 
 int reiser4_open_dispatch(struct inode *inode, struct file *file)
 {
-	return PROT_PASSIVE(int, open, (inode, file));
+	int result;
+
+	result = PROT_PASSIVE(int, open, (inode, file));
+	/*
+	 * reads of cached pages by generic_file_read_iter() and writes
+	 * checked by reiser4_write_iter_dispatch() do not block
+	 */
+	if (result == 0)
+		file->f_mode |= FMODE_NOWAIT;
+	return result;
 }
 
 ssize_t reiser4_read_dispatch(struct file * file, char __user * buf,
@@ -660,6 +797,46 @@ sector_t reiser4_bmap_dispatch(struct address_space * mapping, sector_t lblock)
 	return PROT_PASSIVE(sector_t, bmap, (mapping, lblock));
 }
 
+int reiser4_fiemap_dispatch(struct inode *inode,
+			    struct fiemap_extent_info *fieinfo,
+			    u64 start, u64 len)
+{
+	/* files are only converted to unix file plugin, which has it */
+	if (inode_file_plugin(inode)->fiemap == NULL)
+		return RETERR(-EOPNOTSUPP);
+	return PROT_PASSIVE(int, fiemap, (inode, fieinfo, start, len));
+}
+
+loff_t reiser4_llseek_dispatch(struct file *file, loff_t off, int whence)
+{
+	struct inode *inode = file_inode(file);
+	return PROT_PASSIVE(loff_t, llseek, (file, off, whence));
+}
+
+long reiser4_fallocate_dispatch(struct file *file, int mode,
+				loff_t off, loff_t len)
+{
+	struct inode *inode = file_inode(file);
+
+	if (inode_file_plugin(inode)->fallocate == NULL)
+		return RETERR(-EOPNOTSUPP);
+	return PROT_PASSIVE(long, fallocate, (file, mode, off, len));
+}
+
+/* method of the source file plugin is called */
+ssize_t reiser4_copy_file_range_dispatch(struct file *in, loff_t pos_in,
+					 struct file *out, loff_t pos_out,
+					 size_t len, unsigned int flags)
+{
+	struct inode *inode = file_inode(in);
+
+	if (inode_file_plugin(inode)->copy_file_range == NULL)
+		return generic_copy_file_range(in, pos_in, out, pos_out,
+					       len, flags);
+	return PROT_PASSIVE(ssize_t, copy_file_range,
+			    (in, pos_in, out, pos_out, len, flags));
+}
+
 /**
  * NOTE: The following two methods are
  * used only for loopback functionality.
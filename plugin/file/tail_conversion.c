@@ -351,6 +351,7 @@ int tail2extent(struct unix_file_info *uf_info)
 		first_iteration = 0;
 	}
 
+	uf_info->converted = offset;
 	reiser4_inode_set_flag(inode, REISER4_PART_IN_CONV);
 
 	/* get key of first byte of a file */
@@ -481,6 +482,8 @@ int tail2extent(struct unix_file_info *uf_info)
 			release_all_pages(pages, sizeof_array(pages));
 			if (result)
 				goto error;
+			/* writers may go on with tails past this offset */
+			uf_info->converted = get_key_offset(&key);
 			/*
 			 * We have to drop exclusive access to avoid deadlock
 			 * which may happen because called by reiser4_writepages
@@ -599,6 +602,7 @@ int extent2tail(struct file * file, struct unix_file_info *uf_info)
 			return result;
 	}
 	reiser4_inode_set_flag(inode, REISER4_PART_IN_CONV);
+	layout_change_begin(uf_info);
 
 	/* number of pages in the file */
 	num_pages =
@@ -690,6 +694,7 @@ int extent2tail(struct file * file, struct unix_file_info *uf_info)
 			"Report the error code %i to developers. Run FSCK",
 					result);
 				put_page(page);
+				layout_change_end(uf_info);
 				reiser4_inode_clr_flag(inode,
 						       REISER4_PART_IN_CONV);
 				return result;
@@ -721,6 +726,7 @@ int extent2tail(struct file * file, struct unix_file_info *uf_info)
 		assert("", reiser4_inode_get_flag(inode, REISER4_PART_MIXED));
 	}
 
+	layout_change_end(uf_info);
 	reiser4_inode_clr_flag(inode, REISER4_PART_IN_CONV);
 
 	if (i == num_pages) {
@@ -6,8 +6,12 @@
 */
 
 #include "../inode.h"
+#include "../znode.h"
+#include "../discard.h"
 #include "object.h"
 
+#include <linux/uaccess.h>
+
 /* file operations */
 
 /* implementation of vfs's llseek method of struct file_operations for
@@ -40,6 +44,45 @@ int reiser4_release_dir_common(struct inode *inode, struct file *file)
 	return 0;
 }
 
+/**
+ * reiser4_ioctl_dir_common - ioctl of struct file_operations
+ * @file: directory file
+ * @cmd: ioctl command
+ * @arg: ioctl argument
+ *
+ * Implementation of ioctl method of struct file_operations for typical
+ * directory. Only FITRIM is supported, fstrim(8) issues it on the mount
+ * point.
+ */
+long reiser4_ioctl_dir_common(struct file *file, unsigned int cmd,
+			      unsigned long arg)
+{
+	struct super_block *super = file_inode(file)->i_sb;
+	struct fstrim_range range;
+	reiser4_context *ctx;
+	int result;
+
+	if (cmd != FITRIM)
+		return RETERR(-ENOTTY);
+	if (!capable(CAP_SYS_ADMIN))
+		return RETERR(-EPERM);
+	if (copy_from_user(&range, (struct fstrim_range __user *)arg,
+			   sizeof(range)))
+		return RETERR(-EFAULT);
+
+	ctx = reiser4_init_context(super);
+	if (IS_ERR(ctx))
+		return PTR_ERR(ctx);
+	result = reiser4_trim_fs(super, &range);
+	reiser4_exit_context(ctx);
+
+	if (result == 0 &&
+	    copy_to_user((struct fstrim_range __user *)arg, &range,
+			 sizeof(range)))
+		result = RETERR(-EFAULT);
+	return result;
+}
+
 /* this is common implementation of vfs's fsync method of struct
    file_operations
 */
@@ -60,6 +103,45 @@ int reiser4_sync_common(struct file *file, loff_t start,
 	return result;
 }
 
+/*
+ * Commit atoms of the file for fdatasync with narrow_fsync mount option:
+ * atoms holding pages of the file and the atom of the node of its stat-data.
+ *
+ * Stat-data is updated in place by reiser4_dirty_inode() every time the
+ * inode is changed, so there is nothing to write here, and a clean file
+ * commits nothing. Stat-data seal keeps the block it was last updated in.
+ * If stat-data was shifted since, that node was captured along with the one
+ * stat-data went to, so committing its atom is enough.
+ *
+ * Atoms are committed whole: they are not split, so unrelated changes fused
+ * with the file get committed too. Returns 1 if the seal is not set, and
+ * stat-data has to be updated the usual way.
+ */
+static int sync_file_atoms(struct inode *inode)
+{
+	reiser4_inode *info = reiser4_inode_data(inode);
+	reiser4_block_nr block;
+	znode *node;
+	int result;
+
+	spin_lock_inode(inode);
+	result = reiser4_seal_is_set(&info->sd_seal);
+	block = info->sd_seal.block;
+	spin_unlock_inode(inode);
+	if (!result)
+		return 1;
+
+	result = txnmgr_commit_inode_atoms(inode);
+	if (result)
+		return result;
+	node = zlook(reiser4_tree_by_inode(inode), &block);
+	if (node != NULL) {
+		result = txnmgr_commit_jnode_atom(ZJNODE(node));
+		zput(node);
+	}
+	return result;
+}
+
 /*
  * common sync method for regular files.
  *
@@ -79,6 +161,8 @@ int reiser4_sync_file_common(struct file *file, loff_t start, loff_t end, int da
 	reiser4_block_nr reserve;
 	struct dentry *dentry = file->f_path.dentry;
 	struct inode *inode = file->f_mapping->host;
+	struct txnmgr_fsync_lat lat;
+	ktime_t fsync_start = ktime_get();
 
 	int err = filemap_write_and_wait_range(file->f_mapping->host->i_mapping, start, end);
 	if (err)
@@ -87,11 +171,23 @@ int reiser4_sync_file_common(struct file *file, loff_t start, loff_t end, int da
 	ctx = reiser4_init_context(dentry->d_inode->i_sb);
 	if (IS_ERR(ctx))
 		return PTR_ERR(ctx);
+	reiser4_fsync_lat_begin(&lat, fsync_start);
 
 	inode_lock(inode);
 
+	if (datasync && reiser4_is_set(inode->i_sb, REISER4_NARROW_FSYNC)) {
+		err = sync_file_atoms(inode);
+		if (err <= 0) {
+			reiser4_fsync_lat_end(&lat, inode);
+			reiser4_exit_context(ctx);
+			inode_unlock(inode);
+			return err;
+		}
+	}
+
 	reserve = estimate_update_common(dentry->d_inode);
 	if (reiser4_grab_space(reserve, BA_CAN_COMMIT)) {
+		reiser4_fsync_lat_end(&lat, inode);
 		reiser4_exit_context(ctx);
 		inode_unlock(inode);
 		return RETERR(-ENOSPC);
@@ -100,7 +196,8 @@ int reiser4_sync_file_common(struct file *file, loff_t start, loff_t end, int da
 
 	atom = get_current_atom_locked();
 	spin_lock_txnh(ctx->trans);
-	force_commit_atom(ctx->trans);
+	fsync_commit_atom(ctx->trans);
+	reiser4_fsync_lat_end(&lat, inode);
 	reiser4_exit_context(ctx);
 	inode_unlock(inode);
 
@@ -284,6 +284,40 @@ static int dir_rewind(struct file *dir, loff_t *fpos, struct readdir_pos *pos, t
 	return result;
 }
 
+/*
+ * Stat-data of entries of a directory are usually spread over many leaves,
+ * and readdir callers like ls -l stat every entry right after getdents. When
+ * readdir enters a node, keys of stat-data of the entries of that node are
+ * collected, and reads of the leaves containing them are started in one
+ * batch as soon as the node is unlocked.
+ */
+struct sd_prefetch {
+	/* node keys were collected from. Only compared, never dereferenced */
+	znode *node;
+	int nr;
+	reiser4_key keys[REISER4_PREFETCH_BATCH];
+};
+
+static void collect_sd_keys(struct inode *dir, const coord_t *coord,
+			    struct sd_prefetch *pf)
+{
+	coord_t scan;
+
+	if (coord->node == pf->node)
+		return;
+	pf->node = coord->node;
+	pf->nr = 0;
+	coord_dup(&scan, coord);
+	do {
+		if (!is_valid_dir_coord(dir, &scan))
+			break;
+		if (item_plugin_by_coord(&scan)->s.dir.extract_key(
+			    &scan, &pf->keys[pf->nr]) == 0)
+			pf->nr++;
+	} while (pf->nr < REISER4_PREFETCH_BATCH &&
+		 coord_next_unit(&scan) == 0);
+}
+
 /*
  * Function that is called by common_readdir() on each directory entry while
  * doing readdir. ->filldir callback may block, so we had to release long term
@@ -297,7 +331,7 @@ static int dir_rewind(struct file *dir, loff_t *fpos, struct readdir_pos *pos, t
  * unlocked.
  */
 static int
-feed_entry(tap_t *tap, struct dir_context *context)
+feed_entry(tap_t *tap, struct dir_context *context, struct sd_prefetch *pf)
 {
 	item_plugin *iplug;
 	char *name;
@@ -341,6 +375,10 @@ feed_entry(tap_t *tap, struct dir_context *context)
 
 	longterm_unlock_znode(tap->lh);
 
+	if (pf->nr != 0) {
+		reiser4_prefetch_keys(current_tree, pf->keys, pf->nr);
+		pf->nr = 0;
+	}
 	/*
 	 * send information about directory entry to the ->filldir() filler
 	 * supplied to us by caller (VFS).
@@ -569,6 +607,10 @@ int reiser4_iterate_common(struct file *f /* directory file being read */,
 	lock_handle lh;
 	tap_t tap;
 	struct readdir_pos *pos;
+	struct sd_prefetch pf;
+	reiser4_file_fsdata *fsdata;
+	znode *last = NULL;
+	unsigned long leaves = 0;
 
 	assert("nikita-1359", f != NULL);
 	inode = file_inode(f);
@@ -586,10 +628,16 @@ int reiser4_iterate_common(struct file *f /* directory file being read */,
 	reiser4_tap_init(&tap, &coord, &lh, ZNODE_READ_LOCK);
 
 	reiser4_readdir_readahead_init(inode, &tap);
+	pf.node = NULL;
+	pf.nr = 0;
 
 repeat:
 	result = dir_readdir_init(f, &context->pos, &tap, &pos);
 	if (result == 0) {
+		fsdata = container_of(pos, reiser4_file_fsdata, dir.readdir);
+		tap.ra_info.window = fsdata->dir.ra_window ? :
+			REISER4_READDIR_RA_MIN;
+		tap.prefetch = REISER4_TAP_PREFETCH_PERCENT;
 		result = reiser4_tap_load(&tap);
 		/* scan entries one by one feeding them to @filld */
 		while (result == 0) {
@@ -599,7 +647,14 @@ repeat:
 			assert("nikita-2572", coord_is_existing_unit(coord));
 			assert("nikita-3227", is_valid_dir_coord(inode, coord));
 
-			result = feed_entry(&tap, context);
+			if (coord->node != last) {
+				/* only compared, never dereferenced */
+				last = coord->node;
+				leaves++;
+			}
+
+			collect_sd_keys(inode, coord, &pf);
+			result = feed_entry(&tap, context, &pf);
 			if (result > 0) {
 				break;
 			} else if (result == 0) {
@@ -626,6 +681,11 @@ repeat:
 					result);
 		}
 		reiser4_tap_relse(&tap);
+		/* next call reads ahead twice as many leaves as this one
+		 * went through */
+		fsdata->dir.ra_window = clamp_t(unsigned long, 2 * leaves,
+						REISER4_READDIR_RA_MIN,
+						REISER4_READDIR_RA_MAX);
 
 		if (result >= 0)
 			f->f_version = inode_query_iversion(inode);
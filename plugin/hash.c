@@ -10,6 +10,7 @@
 #include "../inode.h"
 
 #include <linux/types.h>
+#include <linux/xxhash.h>
 
 /* old rupasov (yura) hash */
 static __u64 hash_rupasov(const unsigned char *name /* name to hash */ ,
@@ -246,6 +247,23 @@ static __u64 hash_deg(const unsigned char *name UNUSED_ARG /* name to hash */ ,
 	return 0xc0c0c0c010101010ull;
 }
 
+/* xxhash64 hash.
+
+   Fast and well distributed on names differing in a few characters only, like
+   machine generated ones, so that directories of such names have few hash
+   collisions. The seed is fixed, as it is part of on-disk format: it is not a
+   defense against names chosen to collide. */
+#define XXHASH64_SEED (0x5265697365723421ull)
+
+static __u64 hash_xxhash64(const unsigned char *name /* name to hash */ ,
+			   int len/* @name's length */)
+{
+	assert("", name != NULL);
+	assert("", len >= 0);
+
+	return xxh64(name, len, XXHASH64_SEED);
+}
+
 static int change_hash(struct inode *inode,
 		       reiser4_plugin * plugin,
 		       pset_member memb)
@@ -338,6 +356,17 @@ hash_plugin hash_plugins[LAST_HASH_ID] = {
 			.linkage = {NULL, NULL}
 		},
 		.hash = hash_deg
+	},
+	[XXHASH64_HASH_ID] = {
+		.h = {
+			.type_id = REISER4_HASH_PLUGIN_TYPE,
+			.id = XXHASH64_HASH_ID,
+			.pops = &hash_plugin_ops,
+			.label = "xxhash64",
+			.desc = "xxhash64 hash",
+			.linkage = {NULL, NULL}
+		},
+		.hash = hash_xxhash64
 	}
 };
 
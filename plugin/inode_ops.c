@@ -73,7 +73,14 @@ struct dentry *reiser4_lookup_common(struct inode *parent,
 	/* set up operations on dentry. */
 	dentry->d_op = &get_super_private(parent->i_sb)->ops.dentry;
 
-	result = reiser4_lookup_name(parent, dentry, &entry.key);
+	if (!reiser4_lookup_filter_test(parent, &dentry->d_name))
+		/* name is surely not there */
+		result = RETERR(-ENOENT);
+	else {
+		result = reiser4_lookup_name(parent, dentry, &entry.key);
+		if (result == -ENOENT)
+			reiser4_lookup_filter_missed(parent, &dentry->d_name);
+	}
 	if (result) {
 		context_set_commit_async(ctx);
 		reiser4_exit_context(ctx);
@@ -3,9 +3,24 @@
 
 #include "../inode.h"
 #include "../safe_link.h"
+#include "../super.h"
+
+#include <linux/ktime.h>
 
 static const char *possible_leak = "Possible disk space leak.";
 
+/* release lock on directory entry node taken by rename at @start (ns) and
+   account time it was held. Only entries are modified under these locks:
+   link counts are changed in memory, and stat-data of directories and
+   objects are written after the locks are released, so that operations in
+   the directories do not wait on rename's stat-data lookups */
+static void rename_done_lh(struct inode *dir, lock_handle *lh, u64 start)
+{
+	done_lh(lh);
+	reiser4_stat_add(dir->i_sb, REISER4_STAT_RENAME_LOCK_US,
+			 div_u64(ktime_get_ns() - start, NSEC_PER_USEC));
+}
+
 /* re-bind existing name at @from_coord in @from_dir to point to @to_inode.
 
    Helper function called from hashed_rename() */
@@ -421,6 +436,7 @@ int reiser4_rename2_common(struct inode *old_dir /* directory where @old
 	lock_handle * new_lh, *dotdot_lh;
 	struct dentry *dotdot_name;
 	struct reiser4_dentry_fsdata *dataonstack;
+	u64 start;
 
 	ctx = reiser4_init_context(old_dir->i_sb);
 	if (IS_ERR(ctx))
@@ -509,9 +525,11 @@ int reiser4_rename2_common(struct inode *old_dir /* directory where @old
 		return result;
 	}
 
+	reiser4_stat_inc(old_dir->i_sb, REISER4_STAT_RENAMES);
 	init_lh(new_lh);
 
 	/* find entry for @new_name */
+	start = ktime_get_ns();
 	result = reiser4_find_entry(new_dir, new_name, new_lh, ZNODE_WRITE_LOCK,
 				    new_entry);
 
@@ -561,7 +579,7 @@ int reiser4_rename2_common(struct inode *old_dir /* directory where @old
 
 	/* We are done with all modifications to the @new_dir, release lock on
 	   node. */
-	done_lh(new_lh);
+	rename_done_lh(new_dir, new_lh, start);
 
 	if (fplug != NULL) {
 		/* detach @new_inode from name-space */
@@ -622,6 +640,7 @@ int reiser4_rename2_common(struct inode *old_dir /* directory where @old
 			dotdot_coord = &dataonstack->dec.entry_coord;
 			coord_clear_iplug(dotdot_coord);
 
+			start = ktime_get_ns();
 			result = reiser4_find_entry(old_inode, dotdot_name,
 						    dotdot_lh, ZNODE_WRITE_LOCK,
 						    dotdot_entry);
@@ -634,7 +653,7 @@ int reiser4_rename2_common(struct inode *old_dir /* directory where @old
 						      dotdot_coord, dotdot_lh);
 			} else
 				result = RETERR(-EIO);
-			done_lh(dotdot_lh);
+			rename_done_lh(old_inode, dotdot_lh, start);
 		}
 	}
 	reiser4_update_dir(new_dir);
@@ -396,6 +396,15 @@ int kill_hook_ctail(const coord_t * coord, pos_in_node_t from,
 	assert("edward-1157", item_id_by_coord(coord) == CTAIL_ID);
 	assert("edward-291", znode_is_write_locked(coord->node));
 
+	if (!coord_is_unprepped_ctail(coord)) {
+		/* forget inflated cluster, unprepped ones are not cached */
+		reiser4_key key;
+
+		item_key_by_coord(coord, &key);
+		reiser4_ccache_invalidate(reiser4_get_current_sb(),
+					  get_key_objectid(&key),
+					  clust_by_coord(coord, NULL));
+	}
 	inode = kdata->inode;
 	if (inode) {
 		reiser4_key key;
@@ -580,6 +589,7 @@ static int ctail_read_disk_cluster(struct cluster_handle * clust,
 				   znode_lock_mode mode)
 {
 	int result;
+	unsigned long gen;
 
 	assert("edward-1450", mode == ZNODE_READ_LOCK || ZNODE_WRITE_LOCK);
 	assert("edward-671", clust->hint != NULL);
@@ -588,6 +598,7 @@ static int ctail_read_disk_cluster(struct cluster_handle * clust,
 	assert("edward-1527", PageLocked(page));
 
 	unlock_page(page);
+	gen = reiser4_ccache_gen(inode, clust->index);
 
 	/* set input stream */
 	result = grab_tfm_stream(inode, &clust->tc, INPUT_STREAM);
@@ -634,6 +645,9 @@ static int ctail_read_disk_cluster(struct cluster_handle * clust,
 	result = reiser4_inflate_cluster(clust, inode);
 	if (result)
 		return result;
+	reiser4_ccache_insert(inode, clust->index, gen,
+			      tfm_stream_data(&clust->tc, OUTPUT_STREAM),
+			      clust->tc.len);
 	/*
 	 * The stream is ready! It won't be obsolete as
 	 * long as we keep last disk cluster item locked.
@@ -667,6 +681,8 @@ int do_readpage_ctail(struct inode * inode, struct cluster_handle * clust,
 		goto exit;
 	}
 	if (!tfm_cluster_is_uptodate(&clust->tc)) {
+		if (reiser4_ccache_read(inode, page, to_page))
+			goto exit;
 		clust->index = pg_to_clust(page->index, inode);
 
 		/* this will unlock/lock the page */
@@ -1161,6 +1177,7 @@ static int init_convert_data_ctail(struct convert_item_info * idata,
 	assert("edward-814", inode != NULL);
 
 	idata->cluster_shift = inode_cluster_shift(inode);
+	idata->oid = get_inode_oid(inode);
 	idata->d_cur = DC_FIRST_ITEM;
 	idata->d_next = DC_INVALID_STATE;
 
@@ -1186,6 +1203,9 @@ static void free_item_convert_data(struct convert_info * sq)
 	assert("edward-819", sq->itm != NULL);
 	assert("edward-820", sq->iplug != NULL);
 
+	/* disk cluster has been rewritten */
+	reiser4_ccache_invalidate(reiser4_get_current_sb(), sq->itm->oid,
+				  sq->clust.index);
 	done_lh(&sq->right_lock);
 	sq->right_locked = 0;
 	kfree(sq->itm);
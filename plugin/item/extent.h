@@ -133,6 +133,8 @@ int reiser4_check_extent(const coord_t * coord, const char **error);
 /* plugin->u.item.s.file.* */
 ssize_t reiser4_write_extent(struct file *, struct inode * inode,
 			     const char __user *, size_t, loff_t *);
+ssize_t reiser4_write_extent_iter(struct file *, struct inode *,
+				  struct iov_iter *, size_t, loff_t *);
 int reiser4_read_extent(struct file *, flow_t *, hint_t *);
 int reiser4_readpage_extent(void *, struct page *);
 int reiser4_do_readpage_extent(reiser4_extent*, reiser4_block_nr, struct page*);
@@ -163,6 +165,9 @@ void reiser4_set_extent(reiser4_extent *, reiser4_block_nr start,
 			reiser4_block_nr width);
 int reiser4_update_extent(struct inode *, jnode *, loff_t pos,
 			  int *plugged_hole);
+int reiser4_fallocate_extent(struct inode *, loff_t pos,
+			     reiser4_block_nr count);
+int reiser4_punch_extent(struct inode *, loff_t pos, reiser4_block_nr count);
 
 #include "../../coord.h"
 #include "../../lock.h"
@@ -6,6 +6,7 @@
 #include "../object.h"
 
 #include <linux/swap.h>
+#include <linux/blkdev.h>
 
 static inline reiser4_extent *ext_by_offset(const znode *node, int offset)
 {
@@ -446,6 +447,64 @@ static int insert_first_extent(uf_coord_t *uf_coord, const reiser4_key *key,
 	return count;
 }
 
+/*
+ * Plugged hole of width 1 neighbours unallocated units: merge them into one
+ * unallocated unit in place, so that filling a file page by page through
+ * holes does not leave runs of units of width 1 for flush to merge. The first
+ * unit of the item stays, and units after the merged ones keep their keys, as
+ * widths only move between units, so the item is just shrunk. Returns 1 if
+ * units were merged.
+ */
+static int merge_plugged_hole(uf_coord_t *uf_coord)
+{
+	coord_t *coord;
+	struct extent_coord_extension *ext_coord;
+	reiser4_extent *ext;
+	reiser4_extent *first;
+	reiser4_block_nr width;
+	int left, right;
+	char *end;
+
+	coord = coord_by_uf_coord(uf_coord);
+	ext_coord = ext_coord_by_uf_coord(uf_coord);
+	ext = ext_by_ext_coord(uf_coord);
+	assert("", extent_get_width(ext) == 1);
+
+	left = coord->unit_pos > 0 &&
+		state_of_extent(ext - 1) == UNALLOCATED_EXTENT;
+	right = coord->unit_pos < nr_units_extent(coord) - 1 &&
+		state_of_extent(ext + 1) == UNALLOCATED_EXTENT;
+	if (!left && !right)
+		return 0;
+
+	first = ext;
+	ext_coord->pos_in_unit = 0;
+	if (left) {
+		first = ext - 1;
+		ext_coord->pos_in_unit = extent_get_width(first);
+		coord->unit_pos--;
+		ext_coord->ext_offset -= sizeof(reiser4_extent);
+	}
+	width = ext_coord->pos_in_unit + 1;
+	if (right)
+		width += extent_get_width(ext + 1);
+	reiser4_set_extent(first, UNALLOCATED_EXTENT_START, width);
+
+	/* remove units merged into @first */
+	end = (char *)item_body_by_coord(coord) + item_length_by_coord(coord);
+	memmove(first + 1, first + 1 + left + right,
+		end - (char *)(first + 1 + left + right));
+	node_plugin_by_coord(coord)->shrink_item(coord, (left + right) *
+						  sizeof(reiser4_extent));
+	znode_make_dirty(coord->node);
+
+	/* update coord extension */
+	ext_coord->width = width;
+	ext_coord->nr_units -= left + right;
+	ON_DEBUG(ext_coord->extent = *first);
+	return 1;
+}
+
 /**
  * plug_hole - replace hole extent with unallocated and holes
  * @uf_coord:
@@ -480,6 +539,10 @@ static int plug_hole(uf_coord_t *uf_coord, const reiser4_key *key, int *how)
 
 	*how = 0;
 	if (width == 1) {
+		if (merge_plugged_hole(uf_coord)) {
+			*how = 7;
+			return 0;
+		}
 		reiser4_set_extent(ext, UNALLOCATED_EXTENT_START, 1);
 		znode_make_dirty(coord->node);
 		/* update uf_coord */
@@ -897,18 +960,19 @@ static int update_extents(struct file *file, struct inode *inode,
 /**
  * write_extent_reserve_space - reserve space for extent write operation
  * @inode:
+ * @nr_pages: number of pages to be written
  *
- * Estimates and reserves space which may be required for writing
- * WRITE_GRANULARITY pages of file.
+ * Estimates and reserves space which may be required for writing @nr_pages
+ * pages of file.
  */
-static int write_extent_reserve_space(struct inode *inode)
+static int write_extent_reserve_space(struct inode *inode, int nr_pages)
 {
 	__u64 count;
 	reiser4_tree *tree;
 
 	/*
-	 * to write WRITE_GRANULARITY pages to a file by extents we have to
-	 * reserve disk space for:
+	 * to write @nr_pages pages to a file by extents we have to reserve
+	 * disk space for:
 
 	 * 1. find_file_item may have to insert empty node to the tree (empty
 	 * leaf node between two extent items). This requires 1 block and
@@ -923,52 +987,73 @@ static int write_extent_reserve_space(struct inode *inode)
 	 */
 	tree = reiser4_tree_by_inode(inode);
 	count = estimate_one_insert_item(tree) +
-		WRITE_GRANULARITY * (1 + estimate_one_insert_into_item(tree)) +
+		nr_pages * (1 + estimate_one_insert_into_item(tree)) +
 		estimate_one_insert_item(tree);
 	grab_space_enable();
 	return reiser4_grab_space(count, 0 /* flags */);
 }
 
-/*
- * filemap_copy_from_user no longer exists in generic code, because it
- * is deadlocky (copying from user while holding the page lock is bad).
- * As a temporary fix for reiser4, just define it here.
- */
-static inline size_t
-filemap_copy_from_user(struct page *page, unsigned long offset,
-			const char __user *buf, unsigned bytes)
+/* copy @bytes of @from into @page at @offset. User buffers are faulted in
+   beforehand, so the atomic copy under page lock normally succeeds */
+static size_t copy_page_from_source(struct page *page, unsigned long offset,
+				    unsigned bytes, struct iov_iter *from)
 {
-	char *kaddr;
-	int left;
+	size_t copied;
 
-	kaddr = kmap_atomic(page);
-	left = __copy_from_user_inatomic(kaddr + offset, buf, bytes);
-	kunmap_atomic(kaddr);
+	copied = iov_iter_copy_from_user_atomic(page, from, offset, bytes);
+	iov_iter_advance(from, copied);
 
-	if (left != 0) {
+	if (copied != bytes)
 		/* Do it the slow way */
-		kaddr = kmap(page);
-		left = __copy_from_user(kaddr + offset, buf, bytes);
-		kunmap(page);
+		copied += copy_page_from_iter(page, offset + copied,
+					      bytes - copied, from);
+	return copied;
+}
+
+/* read page which is going to be written partially, if it is in file */
+static void read_partial_page(struct inode *inode, struct page *page)
+{
+	int result;
+
+	/*
+	 * the below is not optimal for partial write to last page of file
+	 * when file size is not at boundary of page
+	 */
+	if (page_offset(page) >= inode->i_size || PageUptodate(page))
+		return;
+	lock_page(page);
+	if (!PageUptodate(page)) {
+		result = readpage_unix_file(NULL, page);
+		BUG_ON(result != 0);
+		/* wait for read completion */
+		lock_page(page);
+		BUG_ON(!PageUptodate(page));
 	}
-	return bytes - left;
+	unlock_page(page);
 }
 
 /**
- * reiser4_write_extent - write method of extent item plugin
+ * reiser4_write_extent_iter - write data of iterator to extents
  * @file: file to write to
- * @buf: address of user-space buffer
+ * @inode: inode of @file
+ * @from: data to write, user buffer or pages of a pipe
  * @count: number of bytes to write
  * @pos: position in file to write to
  *
+ * Writes up to WRITE_EXTENT_GRANULARITY pages at once: all pages and their
+ * jnodes are obtained first, then the data is copied into them in one pass
+ * and extents of the whole range are updated by one update_extents() call,
+ * under one space reservation. @from is advanced by the number of bytes
+ * written.
  */
-ssize_t reiser4_write_extent(struct file *file, struct inode * inode,
-			     const char __user *buf, size_t count, loff_t *pos)
+ssize_t reiser4_write_extent_iter(struct file *file, struct inode *inode,
+				  struct iov_iter *from, size_t count,
+				  loff_t *pos)
 {
 	int have_to_update_extent;
 	int nr_pages, nr_dirty;
 	struct page *page;
-	jnode *jnodes[WRITE_GRANULARITY + 1];
+	jnode **jnodes;
 	unsigned long index;
 	unsigned long end;
 	int i;
@@ -976,24 +1061,32 @@ ssize_t reiser4_write_extent(struct file *file, struct inode * inode,
 	size_t left, written;
 	int result = 0;
 
-	if (write_extent_reserve_space(inode))
-		return RETERR(-ENOSPC);
-
 	if (count == 0) {
 		/* truncate case */
-		update_extents(file, inode, jnodes, 0, *pos);
+		if (write_extent_reserve_space(inode, 1))
+			return RETERR(-ENOSPC);
+		update_extents(file, inode, NULL, 0, *pos);
 		return 0;
 	}
 
 	BUG_ON(get_current_context()->trans->atom != NULL);
 
+	reiser4_txmod_count_write(inode, *pos, count);
 	left = count;
 	index = *pos >> PAGE_SHIFT;
 	/* calculate number of pages which are to be written */
-      	end = ((*pos + count - 1) >> PAGE_SHIFT);
+	end = ((*pos + count - 1) >> PAGE_SHIFT);
 	nr_pages = end - index + 1;
 	nr_dirty = 0;
-	assert("", nr_pages <= WRITE_GRANULARITY + 1);
+	assert("", nr_pages <= WRITE_EXTENT_GRANULARITY + 1);
+
+	if (write_extent_reserve_space(inode, nr_pages))
+		return RETERR(-ENOSPC);
+
+	jnodes = kmalloc_array(nr_pages, sizeof(jnode *),
+			       reiser4_ctx_gfp_mask_get());
+	if (jnodes == NULL)
+		return RETERR(-ENOMEM);
 
 	/* get pages and jnodes */
 	for (i = 0; i < nr_pages; i ++) {
@@ -1020,36 +1113,27 @@ ssize_t reiser4_write_extent(struct file *file, struct inode * inode,
 
 	BUG_ON(get_current_context()->trans->atom != NULL);
 
-	have_to_update_extent = 0;
-
+	/*
+	 * only the first and the last pages can be written partially. Bring
+	 * them up to date before copying, so that the copy loop below does
+	 * not have to stop for reads
+	 */
 	page_off = (*pos & (PAGE_SIZE - 1));
+	if (page_off != 0 || count < PAGE_SIZE)
+		read_partial_page(inode, jnode_page(jnodes[0]));
+	if (nr_pages > 1 && ((*pos + count) & (PAGE_SIZE - 1)) != 0)
+		read_partial_page(inode, jnode_page(jnodes[nr_pages - 1]));
+
+	/* fault in the whole user buffer once rather than page by page */
+	iov_iter_fault_in_readable(from, count);
+	BUG_ON(get_current_context()->trans->atom != NULL);
+
+	have_to_update_extent = 0;
 	for (i = 0; i < nr_pages; i ++) {
 		to_page = PAGE_SIZE - page_off;
 		if (to_page > left)
 			to_page = left;
 		page = jnode_page(jnodes[i]);
-		if (page_offset(page) < inode->i_size &&
-		    !PageUptodate(page) && to_page != PAGE_SIZE) {
-			/*
-			 * the above is not optimal for partial write to last
-			 * page of file when file size is not at boundary of
-			 * page
-			 */
-			lock_page(page);
-			if (!PageUptodate(page)) {
-				result = readpage_unix_file(NULL, page);
-				BUG_ON(result != 0);
-				/* wait for read completion */
-				lock_page(page);
-				BUG_ON(!PageUptodate(page));
-			} else
-				result = 0;
-			unlock_page(page);
-		}
-
-		BUG_ON(get_current_context()->trans->atom != NULL);
-		fault_in_pages_readable(buf, to_page);
-		BUG_ON(get_current_context()->trans->atom != NULL);
 
 		lock_page(page);
 		if (!PageUptodate(page) && to_page != PAGE_SIZE)
@@ -1057,8 +1141,9 @@ ssize_t reiser4_write_extent(struct file *file, struct inode * inode,
 					   page_off + to_page,
 					   PAGE_SIZE);
 
-		written = filemap_copy_from_user(page, page_off, buf, to_page);
+		written = copy_page_from_source(page, page_off, to_page, from);
 		if (unlikely(written != to_page)) {
+			iov_iter_revert(from, written);
 			unlock_page(page);
 			result = RETERR(-EFAULT);
 			break;
@@ -1076,7 +1161,6 @@ ssize_t reiser4_write_extent(struct file *file, struct inode * inode,
 			have_to_update_extent ++;
 
 		page_off = 0;
-		buf += to_page;
 		left -= to_page;
 		BUG_ON(get_current_context()->trans->atom != NULL);
 	}
@@ -1100,6 +1184,7 @@ out:
 		JF_CLR(jnodes[i], JNODE_WRITE_PREPARED);
 		jput(jnodes[i]);
 	}
+	kfree(jnodes);
 
 	/* the only errors handled so far is ENOMEM and
 	   EFAULT on copy_from_user  */
@@ -1107,6 +1192,349 @@ out:
 	return (count - left) ? (count - left) : result;
 }
 
+/**
+ * reiser4_write_extent - write method of extent item plugin
+ * @file: file to write to
+ * @inode: inode of @file
+ * @buf: address of user-space buffer
+ * @count: number of bytes to write
+ * @pos: position in file to write to
+ */
+ssize_t reiser4_write_extent(struct file *file, struct inode * inode,
+			     const char __user *buf, size_t count, loff_t *pos)
+{
+	struct iovec iov = { .iov_base = (void __user *)buf, .iov_len = count };
+	struct iov_iter iter;
+
+	iov_iter_init(&iter, WRITE, &iov, 1, count);
+	return reiser4_write_extent_iter(file, inode, &iter, count, pos);
+}
+
+/*
+ * Preallocation and hole punching.
+ *
+ * Extent units have no state for blocks which are allocated but were never
+ * written: start 0 and 1 mean hole and unallocated extent, any other start is
+ * a real block. Preallocated blocks are therefore zeroed on disk and described
+ * by ordinary allocated extents.
+ */
+
+/**
+ * prealloc_blocks - allocate and zero blocks for file body
+ * @inode: file
+ * @ext: last extent unit of file or NULL
+ * @count: number of blocks wanted
+ * @start: first allocated block
+ *
+ * Returns number of allocated blocks or error code. @count blocks have to be
+ * grabbed.
+ */
+static int prealloc_blocks(struct inode *inode, reiser4_extent *ext,
+			   reiser4_block_nr count, reiser4_block_nr *start)
+{
+	reiser4_blocknr_hint preceder;
+	reiser4_block_nr len;
+	int shift = inode->i_sb->s_blocksize_bits - 9;
+	int result;
+
+	reiser4_blocknr_hint_init(&preceder);
+	if (ext != NULL && state_of_extent(ext) == ALLOCATED_EXTENT)
+		/* continue the file on disk */
+		preceder.blk = extent_get_start(ext) + extent_get_width(ext);
+	if (preceder.blk == 0 ||
+	    preceder.blk >= reiser4_block_count(inode->i_sb))
+		get_blocknr_hint_default(&preceder.blk);
+	allocate_blocks_unformatted(&preceder, get_inode_oid(inode), count,
+				    start, &len, BLOCK_GRABBED);
+	reiser4_blocknr_hint_done(&preceder);
+
+	/* devices which can zero blocks without data transfer do that */
+	result = blkdev_issue_zeroout(inode->i_sb->s_bdev, *start << shift,
+				      len << shift,
+				      reiser4_ctx_gfp_mask_get(), 0);
+	if (result == 0)
+		result = reiser4_record_allocated(start, &len);
+	if (result) {
+		reiser4_dealloc_blocks(start, &len, BLOCK_GRABBED,
+				       BA_PERMANENT);
+		return result;
+	}
+	return len;
+}
+
+/**
+ * append_allocated - append last file item with allocated extent
+ * @coord: coord set after last unit of the item
+ * @lh: lock handle of twig node
+ * @key: key of first byte after the item
+ * @start: first block
+ * @width: number of blocks
+ */
+static int append_allocated(coord_t *coord, lock_handle *lh,
+			    const reiser4_key *key, reiser4_block_nr start,
+			    reiser4_block_nr width)
+{
+	reiser4_extent *ext;
+	reiser4_extent new_ext;
+	reiser4_item_data idata;
+
+	assert("", coord->between == AFTER_UNIT);
+	assert("", can_append(key, coord));
+
+	ext = extent_by_coord(coord);
+	if (state_of_extent(ext) == ALLOCATED_EXTENT &&
+	    extent_get_start(ext) + extent_get_width(ext) == start) {
+		/* blocks continue the last unit, widen it */
+		extent_set_width(ext, extent_get_width(ext) + width);
+		znode_make_dirty(coord->node);
+		return 0;
+	}
+	reiser4_set_extent(&new_ext, start, width);
+	init_new_extent(&idata, &new_ext, 1);
+	return insert_into_item(coord, lh, key, &idata, 0);
+}
+
+/**
+ * reiser4_fallocate_extent - back part of file body by disk blocks
+ * @inode: file built of extents or empty one
+ * @pos: page aligned offset in file
+ * @count: number of pages from @pos
+ *
+ * Allocated and unallocated extent units @pos is in are left as they are.
+ * When @pos is past the end of file body, the body is appended with a hole
+ * up to @pos, or, when it ends at @pos, with up to @count blocks allocated
+ * and zeroed by prealloc_blocks(). Space for that has to be grabbed.
+ *
+ * Returns number of pages from @pos on which are backed by blocks, 0 if only
+ * a hole was appended, -EOPNOTSUPP if @pos is in a hole extent, or error
+ * code.
+ */
+int reiser4_fallocate_extent(struct inode *inode, loff_t pos,
+			     reiser4_block_nr count)
+{
+	coord_t coord;
+	lock_handle lh;
+	reiser4_key key;
+	reiser4_key unit_key;
+	reiser4_extent *ext;
+	reiser4_extent new_ext;
+	reiser4_item_data idata;
+	reiser4_block_nr start;
+	reiser4_block_nr allocated = 0;
+	znode *loaded;
+	int result;
+
+	assert("", (pos & (PAGE_SIZE - 1)) == 0);
+	assert("", count != 0);
+
+	key_by_inode_and_offset_common(inode, pos, &key);
+	init_lh(&lh);
+	result = find_file_item_nohint(&coord, &lh, &key, ZNODE_WRITE_LOCK,
+				       inode);
+	if (IS_CBKERR(result)) {
+		done_lh(&lh);
+		return result;
+	}
+	result = zload(coord.node);
+	if (result) {
+		done_lh(&lh);
+		return result;
+	}
+	loaded = coord.node;
+
+	if (coord.between == AT_UNIT) {
+		/* @pos is inside of file body */
+		assert("", item_is_extent(&coord));
+		ext = extent_by_coord(&coord);
+		unit_key_by_coord(&coord, &unit_key);
+		if (state_of_extent(ext) == HOLE_EXTENT)
+			result = RETERR(-EOPNOTSUPP);
+		else
+			result = min_t(reiser4_block_nr, count,
+				       extent_get_width(ext) -
+				       ((pos - get_key_offset(&unit_key)) >>
+					PAGE_SHIFT));
+	} else if (coord.between == AFTER_UNIT) {
+		ext = extent_by_coord(&coord);
+		if (!can_append(&key, &coord))
+			result = append_hole(&coord, &lh, &key);
+		else {
+			result = prealloc_blocks(inode, ext, count, &start);
+			if (result > 0) {
+				allocated = result;
+				result = append_allocated(&coord, &lh, &key,
+							  start, allocated);
+			}
+		}
+	} else if (pos != 0) {
+		/* there are no items of this file in the tree yet */
+		result = insert_first_hole(&coord, &lh, &key);
+	} else {
+		result = prealloc_blocks(inode, NULL, count, &start);
+		if (result > 0) {
+			allocated = result;
+			reiser4_set_extent(&new_ext, start, allocated);
+			init_new_extent(&idata, &new_ext, 1);
+			result = insert_extent_by_coord(&coord, &idata, &key,
+							&lh);
+		}
+	}
+	zrelse(loaded);
+	done_lh(&lh);
+
+	if (allocated != 0) {
+		if (result) {
+			/* blocks are in the alloc set already */
+			reiser4_dealloc_blocks(&start, &allocated,
+					       BLOCK_NOT_COUNTED, BA_DEFER);
+			return result;
+		}
+		inode_add_blocks(inode, allocated);
+		result = allocated;
+	}
+	return result;
+}
+
+/**
+ * extent_tail - extent unit of the last blocks of @ext
+ * @dst: unit to set
+ * @ext: unit whose blocks from @skip on are to be described by @dst
+ * @skip: number of leading blocks of @ext not described by @dst
+ */
+static void extent_tail(reiser4_extent *dst, reiser4_extent *ext,
+			reiser4_block_nr skip)
+{
+	reiser4_block_nr start = extent_get_start(ext);
+
+	if (state_of_extent(ext) == ALLOCATED_EXTENT)
+		start += skip;
+	reiser4_set_extent(dst, start, extent_get_width(ext) - skip);
+}
+
+/**
+ * reiser4_punch_extent - replace part of file body by hole
+ * @inode: file built of extents
+ * @pos: page aligned offset in file
+ * @count: number of pages from @pos
+ *
+ * Turns the part of extent unit @pos is in, up to @count pages, into a hole
+ * extent. Pages and jnodes of that part are dropped and its blocks are freed
+ * the way kill_hook_extent() does that on truncate. Units are replaced
+ * rather than cut, because their offsets are not stored: removing units from
+ * the middle of an item would shift the rest of file body.
+ *
+ * Returns number of pages from @pos on which are hole, 0 if @pos is past the
+ * end of file body, or error code. Space for unit insertion has to be
+ * grabbed.
+ */
+int reiser4_punch_extent(struct inode *inode, loff_t pos,
+			 reiser4_block_nr count)
+{
+	struct replace_handle *h;
+	coord_t coord;
+	lock_handle lh;
+	reiser4_key key;
+	reiser4_extent *ext;
+	reiser4_extent orig;
+	reiser4_block_nr from, to, width;
+	reiser4_block_nr start, len;
+	znode *loaded;
+	int result;
+
+	assert("", (pos & (PAGE_SIZE - 1)) == 0);
+	assert("", count != 0);
+
+	key_by_inode_and_offset_common(inode, pos, &key);
+	init_lh(&lh);
+	result = find_file_item_nohint(&coord, &lh, &key, ZNODE_WRITE_LOCK,
+				       inode);
+	if (IS_CBKERR(result)) {
+		done_lh(&lh);
+		return result;
+	}
+	result = zload(coord.node);
+	if (result) {
+		done_lh(&lh);
+		return result;
+	}
+	loaded = coord.node;
+
+	if (coord.between != AT_UNIT) {
+		/* past the end of file body */
+		result = 0;
+		goto out;
+	}
+
+	assert("", item_is_extent(&coord));
+	ext = extent_by_coord(&coord);
+	orig = *ext;
+	unit_key_by_coord(&coord, &key);
+	width = extent_get_width(ext);
+	from = (pos - get_key_offset(&key)) >> PAGE_SHIFT;
+	to = min(width, from + count);
+	len = to - from;
+	if (state_of_extent(ext) == HOLE_EXTENT) {
+		result = len;
+		goto out;
+	}
+
+	if (from == 0 && to == width) {
+		reiser4_set_extent(ext, HOLE_EXTENT_START, width);
+		znode_make_dirty(coord.node);
+	} else {
+		h = kmalloc(sizeof(*h), reiser4_ctx_gfp_mask_get());
+		if (h == NULL) {
+			result = RETERR(-ENOMEM);
+			goto out;
+		}
+		h->coord = &coord;
+		h->lh = &lh;
+		h->pkey = &h->key;
+		h->flags = 0;
+		if (from == 0) {
+			reiser4_set_extent(&h->overwrite, HOLE_EXTENT_START,
+					   to);
+			extent_tail(&h->new_extents[0], &orig, to);
+			h->nr_new_extents = 1;
+		} else {
+			reiser4_set_extent(&h->overwrite,
+					   extent_get_start(&orig), from);
+			reiser4_set_extent(&h->new_extents[0],
+					   HOLE_EXTENT_START, len);
+			h->nr_new_extents = 1;
+			if (to < width) {
+				extent_tail(&h->new_extents[1], &orig, to);
+				h->nr_new_extents = 2;
+			}
+		}
+		h->key = key;
+		h->paste_key = key;
+		set_key_offset(&h->paste_key, get_key_offset(&key) +
+			       extent_get_width(&h->overwrite) *
+			       current_blocksize);
+		result = reiser4_replace_extent(h, 0);
+		kfree(h);
+		if (result)
+			goto out;
+	}
+
+	/* take care of pages and jnodes of the part turned into hole */
+	reiser4_invalidate_pages(inode->i_mapping, pos >> PAGE_SHIFT, len, 1);
+	inode_sub_blocks(inode, len);
+	if (state_of_extent(&orig) == UNALLOCATED_EXTENT)
+		fake_allocated2free(len, 0 /* unformatted */);
+	else {
+		start = extent_get_start(&orig) + from;
+		reiser4_dealloc_blocks(&start, &len, 0 /* not used */,
+				       BA_DEFER /* unformatted with defer */);
+	}
+	result = len;
+ out:
+	zrelse(loaded);
+	done_lh(&lh);
+	return result;
+}
+
 int reiser4_do_readpage_extent(reiser4_extent * ext, reiser4_block_nr pos,
 			       struct page *page)
 {
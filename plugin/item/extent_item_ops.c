@@ -309,6 +309,8 @@ kill_hook_extent(const coord_t * coord, pos_in_node_t from, pos_in_node_t count,
 {
 	reiser4_extent *ext;
 	reiser4_block_nr start, length;
+	/* run of physically contiguous blocks not yet deallocated */
+	reiser4_block_nr run_start, run_len;
 	const reiser4_key *pfrom_key, *pto_key;
 	struct inode *inode;
 	reiser4_tree *tree;
@@ -453,6 +455,7 @@ kill_hook_extent(const coord_t * coord, pos_in_node_t from, pos_in_node_t count,
 	assert("vs-1552", from_off - offset <= extent_get_width(ext));
 	skip = from_off - offset;
 	offset = from_off;
+	run_start = run_len = 0;
 
 	while (offset < to_off) {
 		length = extent_get_width(ext) - skip;
@@ -484,17 +487,29 @@ kill_hook_extent(const coord_t * coord, pos_in_node_t from, pos_in_node_t count,
 		if (length != 0) {
 			start = extent_get_start(ext) + skip;
 
-			/* BA_DEFER bit parameter is turned on because blocks which get freed are not safe to be freed
-			   immediately */
-			reiser4_dealloc_blocks(&start, &length,
-					       0 /* not used */ ,
-					       BA_DEFER
-					       /* unformatted with defer */ );
+			/* units of huge files are often contiguous on disk:
+			   free them in one call adding one extent to the
+			   delete set */
+			if (run_len != 0 && run_start + run_len == start)
+				run_len += length;
+			else {
+				if (run_len != 0)
+					reiser4_dealloc_blocks(&run_start,
+							       &run_len, 0,
+							       BA_DEFER);
+				run_start = start;
+				run_len = length;
+			}
 		}
 		skip = 0;
 		offset += length;
 		ext++;
 	}
+	/* BA_DEFER bit parameter is turned on because blocks which get freed are
+	   not safe to be freed immediately */
+	if (run_len != 0)
+		reiser4_dealloc_blocks(&run_start, &run_len, 0 /* not used */ ,
+				       BA_DEFER /* unformatted with defer */ );
 	return retval;
 }
 
@@ -266,7 +266,7 @@ int create_hook_internal(const coord_t * item /* coord of item */ ,
 		write_lock_dk(tree);
 		assert("nikita-1400", (child->in_parent.node == NULL)
 		       || (znode_above_root(child->in_parent.node)));
-		++item->node->c_count;
+		atomic_inc(&item->node->c_count);
 		coord_to_parent_coord(item, &child->in_parent);
 		sibling_list_insert_nolock(child, left);
 
@@ -329,13 +329,13 @@ int kill_hook_internal(const coord_t * item /* coord of item */ ,
 		reiser4_tree *tree;
 
 		assert("nikita-1397", znode_is_write_locked(child));
-		assert("nikita-1398", child->c_count == 0);
+		assert("nikita-1398", atomic_read(&child->c_count) == 0);
 		assert("nikita-2546", ZF_ISSET(child, JNODE_HEARD_BANSHEE));
 
 		tree = znode_get_tree(item->node);
 		write_lock_tree(tree);
 		init_parent_coord(&child->in_parent, NULL);
-		--item->node->c_count;
+		atomic_dec(&item->node->c_count);
 		write_unlock_tree(tree);
 	} else {
 		warning("nikita-1223",
@@ -375,14 +375,14 @@ int shift_hook_internal(const coord_t * item /* coord of item */ ,
 		return 0;
 	if (!IS_ERR(child)) {
 		write_lock_tree(tree);
-		++new_node->c_count;
+		atomic_inc(&new_node->c_count);
 		assert("nikita-1395", znode_parent(child) == old_node);
-		assert("nikita-1396", old_node->c_count > 0);
+		assert("nikita-1396", atomic_read(&old_node->c_count) > 0);
 		coord_to_parent_coord(item, &child->in_parent);
 		assert("nikita-1781", znode_parent(child) == new_node);
 		assert("nikita-1782",
 		       check_tree_pointer(item, child) == NS_FOUND);
-		--old_node->c_count;
+		atomic_dec(&old_node->c_count);
 		write_unlock_tree(tree);
 		zput(child);
 		return 0;
@@ -26,7 +26,8 @@ void item_body_by_coord_hard(coord_t * coord /* coord to query */ )
 	assert("nikita-3200", coord->offset == INVALID_OFFSET);
 
 	coord->offset =
-	    node_plugin_by_node(coord->node)->item_by_coord(coord) -
+	    NODE_CALL(node_plugin_by_node(coord->node), item_by_coord,
+		      coord) -
 	    zdata(coord->node);
 	ON_DEBUG(coord->body_v = coord->node->times_locked);
 }
@@ -42,7 +43,8 @@ int item_body_is_valid(const coord_t * coord)
 {
 	return
 	    coord->offset ==
-	    node_plugin_by_node(coord->node)->item_by_coord(coord) -
+	    NODE_CALL(node_plugin_by_node(coord->node), item_by_coord,
+		      coord) -
 	    zdata(coord->node);
 }
 
@@ -57,7 +59,8 @@ pos_in_node_t item_length_by_coord(const coord_t * coord /* coord to query */ )
 	assert("nikita-328", coord->node != NULL);
 	assert("nikita-329", znode_is_loaded(coord->node));
 
-	len = node_plugin_by_node(coord->node)->length_by_coord(coord);
+	len = NODE_CALL(node_plugin_by_node(coord->node), length_by_coord,
+			coord);
 	return len;
 }
 
@@ -68,8 +71,8 @@ void obtain_item_plugin(const coord_t * coord)
 	assert("nikita-332", znode_is_loaded(coord->node));
 
 	coord_set_iplug((coord_t *) coord,
-			node_plugin_by_node(coord->node)->
-			plugin_by_coord(coord));
+			NODE_CALL(node_plugin_by_node(coord->node),
+				  plugin_by_coord, coord));
 	assert("nikita-2479",
 	       coord_iplug(coord) ==
 	       node_plugin_by_node(coord->node)->plugin_by_coord(coord));
@@ -98,7 +101,7 @@ reiser4_key *item_key_by_coord(const coord_t * coord /* coord to query */ ,
 	assert("nikita-339", coord->node != NULL);
 	assert("nikita-340", znode_is_loaded(coord->node));
 
-	return node_plugin_by_node(coord->node)->key_at(coord, key);
+	return NODE_CALL(node_plugin_by_node(coord->node), key_at, coord, key);
 }
 
 /* this returns max key in the item */
@@ -440,14 +440,15 @@ int readpage_tail(void *vp, struct page *page)
  * @flow:
  * @coord:
  *
- * Overwrites tail item or its part by user data. Returns number of bytes
+ * Overwrites tail item or its part by data of @flow. Returns number of bytes
  * written or error code.
  */
 static int overwrite_tail(flow_t *flow, coord_t *coord)
 {
+	char *item;
 	unsigned count;
 
-	assert("vs-570", flow->user == 1);
+	assert("vs-570", flow->user == 0 || flow->user == 1);
 	assert("vs-946", flow->data);
 	assert("vs-947", coord_is_existing_unit(coord));
 	assert("vs-948", znode_is_write_locked(coord->node));
@@ -457,8 +458,10 @@ static int overwrite_tail(flow_t *flow, coord_t *coord)
 	if (count > flow->length)
 		count = flow->length;
 
-	if (__copy_from_user((char *)item_body_by_coord(coord) + coord->unit_pos,
-			     (const char __user *)flow->data, count))
+	item = (char *)item_body_by_coord(coord) + coord->unit_pos;
+	if (!flow->user)
+		memcpy(item, flow->data, count);
+	else if (__copy_from_user(item, (const char __user *)flow->data, count))
 		return RETERR(-EFAULT);
 
 	znode_make_dirty(coord->node);
@@ -619,14 +622,12 @@ static loff_t faultin_user_pages(const char __user *buf, size_t count)
 	return faulted;
 }
 
-ssize_t reiser4_write_tail_noreserve(struct file *file,
-				     struct inode * inode,
-				     const char __user *buf,
-				     size_t count, loff_t *pos)
+/* write data of @flow, whose length, data and user fields are set, at @pos */
+static ssize_t write_tail_flow(struct file *file, struct inode *inode,
+			       flow_t *flow, loff_t *pos)
 {
 	struct hint hint;
 	int result;
-	flow_t flow;
 	coord_t *coord;
 	lock_handle *lh;
 	znode *loaded;
@@ -636,13 +637,10 @@ ssize_t reiser4_write_tail_noreserve(struct file *file,
 	result = load_file_hint(file, &hint);
 	BUG_ON(result != 0);
 
-	flow.length = faultin_user_pages(buf, count);
-	flow.user = 1;
-	memcpy(&flow.data, &buf, sizeof(buf));
-	flow.op = WRITE_OP;
-	key_by_inode_and_offset_common(inode, *pos, &flow.key);
+	flow->op = WRITE_OP;
+	key_by_inode_and_offset_common(inode, *pos, &flow->key);
 
-	result = find_file_item(&hint, &flow.key, ZNODE_WRITE_LOCK, inode);
+	result = find_file_item(&hint, &flow->key, ZNODE_WRITE_LOCK, inode);
 	if (IS_CBKERR(result))
 		return result;
 
@@ -655,13 +653,13 @@ ssize_t reiser4_write_tail_noreserve(struct file *file,
 
 	if (coord->between == AFTER_UNIT) {
 		/* append with data or hole */
-		result = append_tail(inode, &flow, coord, lh);
+		result = append_tail(inode, flow, coord, lh);
 	} else if (coord->between == AT_UNIT) {
 		/* overwrite */
-		result = overwrite_tail(&flow, coord);
+		result = overwrite_tail(flow, coord);
 	} else {
 		/* no items of this file yet. insert data or hole */
-		result = insert_first_tail(inode, &flow, coord, lh);
+		result = insert_first_tail(inode, flow, coord, lh);
 	}
 	zrelse(loaded);
 	if (result < 0) {
@@ -672,7 +670,7 @@ ssize_t reiser4_write_tail_noreserve(struct file *file,
 	/* seal and unlock znode */
 	hint.ext_coord.valid = 0;
 	if (hint.ext_coord.valid)
-		reiser4_set_hint(&hint, &flow.key, ZNODE_WRITE_LOCK);
+		reiser4_set_hint(&hint, &flow->key, ZNODE_WRITE_LOCK);
 	else
 		reiser4_unset_hint(&hint);
 
@@ -680,6 +678,19 @@ ssize_t reiser4_write_tail_noreserve(struct file *file,
 	return result;
 }
 
+ssize_t reiser4_write_tail_noreserve(struct file *file,
+				     struct inode * inode,
+				     const char __user *buf,
+				     size_t count, loff_t *pos)
+{
+	flow_t flow;
+
+	flow.length = faultin_user_pages(buf, count);
+	flow.user = 1;
+	memcpy(&flow.data, &buf, sizeof(buf));
+	return write_tail_flow(file, inode, &flow, pos);
+}
+
 /**
  * reiser4_write_tail - write method of tail item plugin
  * @file: file to write to
@@ -699,6 +710,51 @@ ssize_t reiser4_write_tail(struct file *file,
 	return reiser4_write_tail_noreserve(file, inode, buf, count, pos);
 }
 
+/**
+ * reiser4_write_tail_iter - write data of iterator to tails
+ * @file: file to write to
+ * @inode: inode of @file
+ * @from: data to write, user buffer or pages of a pipe
+ * @count: number of bytes to write
+ * @pos: position in file to write to
+ *
+ * Writes from the first segment of @from only: pages of a pipe are written
+ * from kernel space one at a time. @from is advanced by the number of bytes
+ * written, which is returned.
+ */
+ssize_t reiser4_write_tail_iter(struct file *file, struct inode *inode,
+				struct iov_iter *from, size_t count,
+				loff_t *pos)
+{
+	const struct bio_vec *bvec;
+	flow_t flow;
+	char *kaddr;
+	ssize_t result;
+
+	if (count > iov_iter_single_seg_count(from))
+		count = iov_iter_single_seg_count(from);
+	if (iter_is_iovec(from)) {
+		result = reiser4_write_tail(file, inode,
+					    from->iov->iov_base +
+					    from->iov_offset, count, pos);
+	} else {
+		assert("", iov_iter_is_bvec(from));
+
+		if (write_extent_reserve_space(inode))
+			return RETERR(-ENOSPC);
+		bvec = from->bvec;
+		kaddr = kmap(bvec->bv_page);
+		flow.length = count;
+		flow.user = 0;
+		flow.data = kaddr + bvec->bv_offset + from->iov_offset;
+		result = write_tail_flow(file, inode, &flow, pos);
+		kunmap(bvec->bv_page);
+	}
+	if (result > 0)
+		iov_iter_advance(from, result);
+	return result;
+}
+
 #if REISER4_DEBUG
 
 static int
@@ -38,6 +38,9 @@ ssize_t reiser4_write_tail_noreserve(struct file *file, struct inode * inode,
 				     loff_t *pos);
 ssize_t reiser4_write_tail(struct file *file, struct inode * inode,
 			   const char __user *buf, size_t count, loff_t *pos);
+ssize_t reiser4_write_tail_iter(struct file *file, struct inode *inode,
+				struct iov_iter *from, size_t count,
+				loff_t *pos);
 int reiser4_read_tail(struct file *, flow_t *, hint_t *);
 int readpage_tail(void *vp, struct page *page);
 reiser4_key *append_key_tail(const coord_t *, reiser4_key *);
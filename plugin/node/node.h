@@ -85,6 +85,15 @@
    might be suboptimal.
 */
 
+/* Formatted nodes are not compressed on disk. A node is exactly one block:
+   the block allocator, the wandered log and relocation by flush all move
+   whole blocks, and a node compressed into fewer sectors would still take
+   its block, so neither space nor write volume would shrink. Getting both
+   needs packing several compressed nodes into a block, that is a node
+   address made of a block number and a slot, which changes every down link
+   and the on-disk format. Leaves get dense by squeezing in flush instead.
+*/
+
 #if !defined( __REISER4_NODE_H__ )
 #define __REISER4_NODE_H__
 
@@ -248,6 +248,70 @@ reiser4_key *key_at_node40(const coord_t * coord, reiser4_key * key)
 #define NODE_ADDSTAT(n, counter, val)						\
 	reiser4_stat_add_at_level(znode_get_level(n), node.lookup.counter, val)
 
+/* search key of lookup_node40() in cpu byte order. Keys of item headers are
+   compared with it word by word, so that the search key is not loaded and
+   byte-swapped again on each comparison. */
+typedef struct node40_skey {
+	const reiser4_key *key;
+	__u64 el[KEY_LAST_INDEX];
+} node40_skey;
+
+static inline void node40_skey_init(node40_skey * skey,
+				    const reiser4_key * key)
+{
+	int i;
+
+	skey->key = key;
+	for (i = 0; i < KEY_LAST_INDEX; i++)
+		skey->el[i] = get_key_el(key, i);
+}
+
+/* same as keycmp(@k, @skey->key) */
+static inline cmp_t node40_skeycmp(const reiser4_key * k,
+				   const node40_skey * skey)
+{
+	int i;
+
+	if (!REISER4_PLANA_KEY_ALLOCATION)
+		return keycmp(k, skey->key);
+
+	/* physical order of key words is the logical one, see keycmp() */
+	for (i = 0; i < KEY_LAST_INDEX; i++) {
+		__u64 el;
+
+		el = get_key_el(k, i);
+		if (el != skey->el[i])
+			return el < skey->el[i] ? LESS_THAN : GREATER_THAN;
+	}
+	return EQUAL_TO;
+}
+
+/* check whether item at @pos is the one lookup_node40() looks for. Returns
+   -1 if it is not, otherwise 1 if the item key is equal to the search key and
+   0 if it is less. */
+static int node40_check_hint(znode * node, int pos, int items,
+			     const node40_skey * skey)
+{
+	item_header40 *ih;
+
+	ih = node40_ih_at(node, pos);
+	switch (node40_skeycmp(&ih->key, skey)) {
+	case EQUAL_TO:
+		/* the leftmost of items with equal keys is looked for. Headers
+		   are ordered from right to left */
+		if (pos > 0 && node40_skeycmp(&(ih + 1)->key, skey) == EQUAL_TO)
+			return -1;
+		return 1;
+	case LESS_THAN:
+		if (pos + 1 < items &&
+		    node40_skeycmp(&(ih - 1)->key, skey) != GREATER_THAN)
+			return -1;
+		return 0;
+	default:
+		return -1;
+	}
+}
+
 /* plugin->u.node.lookup
    look for description of this method in plugin/node/node.h */
 node_search_result lookup_node40(znode * node /* node to query */ ,
@@ -267,6 +331,9 @@ node_search_result lookup_node40(znode * node /* node to query */ ,
 	item_header40 *bstop;
 	item_header40 *ih;
 	cmp_t order;
+	node40_skey skey;
+	int hint;
+	int pos;
 
 	assert("nikita-583", node != NULL);
 	assert("nikita-584", key != NULL);
@@ -281,6 +348,7 @@ node_search_result lookup_node40(znode * node /* node to query */ ,
 		return NS_NOT_FOUND;
 	}
 
+	node40_skey_init(&skey, key);
 	/* binary search for item that can contain given key */
 	left = 0;
 	right = items - 1;
@@ -291,6 +359,22 @@ node_search_result lookup_node40(znode * node /* node to query */ ,
 	lefth = node40_ih_at(node, left);
 	righth = node40_ih_at(node, right);
 
+	/* try the item found by the previous lookup and the one after it
+	   first: repeated and sequential lookups into hot nodes end there */
+	hint = READ_ONCE(node->search_hint);
+	for (pos = hint; pos <= hint + 1 && pos < items; pos++) {
+		int ret;
+
+		ret = node40_check_hint(node, pos, items, &skey);
+		if (ret >= 0) {
+			left = right = pos;
+			lefth = righth = node40_ih_at(node, pos);
+			ih = lefth;
+			found = ret;
+			break;
+		}
+	}
+
 	/* It is known that for small arrays sequential search is on average
 	   more efficient than binary. This is because sequential search is
 	   coded as tight loop that can be better optimized by compilers and
@@ -318,14 +402,14 @@ node_search_result lookup_node40(znode * node /* node to query */ ,
 
 		assert("nikita-1084", median >= 0);
 		assert("nikita-1085", median < items);
-		switch (keycmp(key, &medianh->key)) {
-		case LESS_THAN:
+		switch (node40_skeycmp(&medianh->key, &skey)) {
+		case GREATER_THAN:
 			right = median;
 			righth = medianh;
 			break;
 		default:
 			wrong_return_value("nikita-586", "keycmp");
-		case GREATER_THAN:
+		case LESS_THAN:
 			left = median;
 			lefth = medianh;
 			break;
@@ -334,7 +418,9 @@ node_search_result lookup_node40(znode * node /* node to query */ ,
 				--median;
 				/* headers are ordered from right to left */
 				++medianh;
-			} while (median >= 0 && keyeq(key, &medianh->key));
+			} while (median >= 0 &&
+				 node40_skeycmp(&medianh->key,
+						&skey) == EQUAL_TO);
 			right = left = median + 1;
 			ih = lefth = righth = medianh - 1;
 			found = 1;
@@ -351,7 +437,7 @@ node_search_result lookup_node40(znode * node /* node to query */ ,
 			cmp_t comparison;
 
 			prefetchkey(&(ih + 1)->key);
-			comparison = keycmp(&ih->key, key);
+			comparison = node40_skeycmp(&ih->key, &skey);
 			if (comparison == GREATER_THAN)
 				continue;
 			if (comparison == EQUAL_TO) {
@@ -359,7 +445,9 @@ node_search_result lookup_node40(znode * node /* node to query */ ,
 				do {
 					--left;
 					++ih;
-				} while (left >= 0 && keyeq(&ih->key, key));
+				} while (left >= 0 &&
+					 node40_skeycmp(&ih->key,
+							&skey) == EQUAL_TO);
 				++left;
 				--ih;
 			} else {
@@ -378,6 +466,8 @@ node_search_result lookup_node40(znode * node /* node to query */ ,
 	coord_set_item_pos(coord, left);
 	coord->unit_pos = 0;
 	coord->between = AT_UNIT;
+	if (left != hint)
+		WRITE_ONCE(node->search_hint, left);
 
 	/* key < leftmost key in a mode or node is corrupted and keys
 	   are not sorted  */
@@ -1682,6 +1772,48 @@ wanted_units(coord_t *source, coord_t *stop_coord, shift_direction pend)
 	}
 }
 
+/* offset of the end of body of item @pos */
+static unsigned node40_item_end(const znode * node, pos_in_node_t pos)
+{
+	if (pos == node40_num_of_items_internal(node) - 1)
+		return nh40_get_free_space_start(node40_node_header(node));
+	return ih40_get_offset(node40_ih_at(node, pos + 1));
+}
+
+/* how many of @nr items of @node starting from @pos in direction @pend fit
+   into @free_space as whole, each taking @overhead bytes more. Bodies of
+   adjacent items are adjacent, so the space needed by a run of items is
+   known from headers of its ends, and the longest run is found by binary
+   search. Length of bodies of the run is stored in @bytes. */
+static unsigned node40_fit_entire(const znode * node, pos_in_node_t pos,
+				  unsigned nr, shift_direction pend,
+				  unsigned free_space, unsigned overhead,
+				  unsigned *bytes)
+{
+	unsigned lo = 0;
+	unsigned hi = nr;
+
+	*bytes = 0;
+	while (lo < hi) {
+		unsigned mid = (lo + hi + 1) / 2;
+		unsigned len;
+
+		if (pend == SHIFT_LEFT)
+			len = node40_item_end(node, pos + mid - 1) -
+				ih40_get_offset(node40_ih_at(node, pos));
+		else
+			len = node40_item_end(node, pos) -
+				ih40_get_offset(node40_ih_at(node,
+							     pos - mid + 1));
+		if (len + mid * overhead <= free_space) {
+			lo = mid;
+			*bytes = len;
+		} else
+			hi = mid - 1;
+	}
+	return lo;
+}
+
 /* this calculates what can be copied from @shift->wish_stop.node to
    @shift->target */
 static void
@@ -1778,6 +1910,35 @@ estimate_shift(struct shift_params *shift, const reiser4_context * ctx)
 	/* number of item nothing of which we want to shift */
 	stop_item = shift->wish_stop.item_pos + shift->pend;
 
+	/* items before the one @wish_stop is in are wanted entirely: move as
+	   many of them as fit at once */
+	want = ((int)shift->wish_stop.item_pos - (int)source.item_pos) *
+		shift->pend;
+	if ((int)want > 0) {
+		unsigned overhead;
+		unsigned nr;
+
+		overhead = item_creation_overhead(&source);
+		nr = node40_fit_entire(source.node, source.item_pos, want,
+				       shift->pend, target_free_space,
+				       overhead, &size);
+		if (nr > 0) {
+			target_free_space -= size + nr * overhead;
+			shift->shift_bytes += size;
+			shift->entire_bytes += size;
+			shift->entire += nr;
+
+			coord_add_item_pos(&source, (nr - 1) * shift->pend);
+			shift->real_stop = source;
+			if (shift->pend == SHIFT_LEFT)
+				shift->real_stop.unit_pos =
+					coord_last_unit_pos(&shift->real_stop);
+			else
+				shift->real_stop.unit_pos = 0;
+			coord_add_item_pos(&source, shift->pend);
+		}
+	}
+
 	/* calculate how many items can be copied into given free
 	   space as whole */
 	for (; source.item_pos != stop_item;
@@ -1892,6 +2053,13 @@ copy_units(coord_t * target, coord_t * source, unsigned from, unsigned count,
 	}
 }
 
+/* add @delta to offsets of @nr adjacent item headers starting from @ih */
+static void ih40_add_offsets(item_header40 * ih, unsigned nr, int delta)
+{
+	for (; nr > 0; nr--, ih++)
+		ih40_set_offset(ih, ih40_get_offset(ih) + delta);
+}
+
 /* copy part of @shift->real_stop.node starting either from its beginning or
    from its end and ending at @shift->real_stop to either the end or the
    beginning of @shift->target */
@@ -1905,7 +2073,6 @@ static void copy(struct shift_params *shift, size_t node_header_size)
 	int new_items;
 	unsigned old_items;
 	int old_offset;
-	unsigned i;
 
 	nh = node40_node_header(shift->target);
 	free_space_start = nh40_get_free_space_start(nh);
@@ -1965,11 +2132,11 @@ static void copy(struct shift_params *shift, size_t node_header_size)
 			       shift->entire * sizeof(item_header40));
 			/* update item header offset */
 			old_offset = ih40_get_offset(from_ih);
-			/* AUDIT: Looks like if we calculate old_offset + free_space_start here instead of just old_offset, we can perform one "add" operation less per each iteration */
-			for (i = 0; i < shift->entire; i++, to_ih--, from_ih--)
-				ih40_set_offset(to_ih,
-						ih40_get_offset(from_ih) -
-						old_offset + free_space_start);
+			ih40_add_offsets(to_ih - shift->entire + 1,
+					 shift->entire,
+					 free_space_start - old_offset);
+			to_ih -= shift->entire;
+			from_ih -= shift->entire;
 
 			/* copy item bodies */
 			memcpy(zdata(shift->target) + free_space_start, zdata(from.node) + old_offset,	/*ih40_get_offset (from_ih), */
@@ -2036,10 +2203,9 @@ static void copy(struct shift_params *shift, size_t node_header_size)
 					shift->shift_bytes -
 					shift->merging_bytes);
 
-		for (i = 1; i < old_items; i++)
-			ih40_set_offset(to_ih - i,
-					ih40_get_offset(to_ih - i) +
-					shift->shift_bytes);
+		if (old_items > 1)
+			ih40_add_offsets(to_ih - old_items + 1, old_items - 1,
+					 shift->shift_bytes);
 
 		/* move item headers to make space for new items */
 		memmove(to_ih - old_items + 1 - new_items,
@@ -2084,13 +2250,11 @@ static void copy(struct shift_params *shift, size_t node_header_size)
 			/* update item header offset */
 			old_offset =
 			    ih40_get_offset(from_ih + shift->entire - 1);
-			/* AUDIT: old_offset + sizeof (node40_header) + shift->part_bytes calculation can be taken off the loop. */
-			for (i = 0; i < shift->entire; i++, to_ih++, from_ih++)
-				ih40_set_offset(to_ih,
-						ih40_get_offset(from_ih) -
-						old_offset +
-						node_header_size +
-						shift->part_bytes);
+			ih40_add_offsets(to_ih, shift->entire,
+					 node_header_size + shift->part_bytes -
+					 old_offset);
+			to_ih += shift->entire;
+			from_ih += shift->entire;
 			/* copy item bodies */
 			coord_add_item_pos(&from, -(int)(shift->entire - 1));
 			memcpy(zdata(to.node) + node_header_size +
@@ -61,7 +61,9 @@ typedef struct node40_header {
 typedef struct item_header40 {
 	/* key of item */
 	/*  0 */ reiser4_key key;
-	/* offset from start of a node measured in 8-byte chunks */
+	/* offset from start of a node in bytes. Like free space fields of
+	   node40_header it is 16 bits wide, which limits node size to less
+	   than 64K */
 	/* 24 */ d16 offset;
 	/* 26 */ d16 flags;
 	/* 28 */ d16 plugin_id;
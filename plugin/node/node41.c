@@ -46,6 +46,13 @@ int csum_node41(znode *node, int check)
 {
 	__u32 cpu_csum;
 
+	/*
+	 * overwrite set is written twice on commit: to wandered blocks and
+	 * back to its place. Do not calculate the same checksum again.
+	 */
+	if (!check && ZF_ISSET(node, JNODE_CSUM_SET))
+		return 1;
+
 	cpu_csum = reiser4_crc32c(get_current_super_private()->csum_tfm,
 				  ~0,
 				  zdata(node),
@@ -59,6 +66,7 @@ int csum_node41(znode *node, int check)
 		return cpu_csum == nh41_get_csum(node41_node_header(node));
 	else {
 		nh41_set_csum(node41_node_header(node), cpu_csum);
+		ZF_SET(node, JNODE_CSUM_SET);
 		return 1;
 	}
 }
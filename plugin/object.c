@@ -121,13 +121,15 @@ static struct address_space_operations null_a_ops = {.writepage = NULL};
 static struct inode_operations regular_file_i_ops = {
 	.permission = reiser4_permission_common,
 	.setattr = reiser4_setattr_dispatch,
-	.getattr = reiser4_getattr_common
+	.getattr = reiser4_getattr_common,
+	.fiemap = reiser4_fiemap_dispatch
 };
 static struct file_operations regular_file_f_ops = {
-	.llseek = generic_file_llseek,
+	.llseek = reiser4_llseek_dispatch,
 	.read = reiser4_read_dispatch,
 	.write = reiser4_write_dispatch,
 	.read_iter = generic_file_read_iter,
+	.write_iter = reiser4_write_iter_dispatch,
 	.unlocked_ioctl = reiser4_ioctl_dispatch,
 #ifdef CONFIG_COMPAT
 	.compat_ioctl = reiser4_ioctl_dispatch,
@@ -137,6 +139,9 @@ static struct file_operations regular_file_f_ops = {
 	.release = reiser4_release_dispatch,
 	.fsync = reiser4_sync_file_common,
 	.splice_read = generic_file_splice_read,
+	.splice_write = iter_file_splice_write,
+	.fallocate = reiser4_fallocate_dispatch,
+	.copy_file_range = reiser4_copy_file_range_dispatch,
 };
 static struct address_space_operations regular_file_a_ops = {
 	.writepage = reiser4_writepage,
@@ -151,6 +156,7 @@ static struct address_space_operations regular_file_a_ops = {
 	.invalidatepage = reiser4_invalidatepage,
 	.releasepage = reiser4_releasepage,
 	.migratepage = reiser4_migratepage,
+	.direct_IO = reiser4_direct_IO,
 	.batch_lock_tabu = 1
 };
 
@@ -189,6 +195,10 @@ static struct file_operations directory_f_ops = {
 	.read = generic_read_dir,
 	.iterate = reiser4_iterate_common,
 	.release = reiser4_release_dir_common,
+	.unlocked_ioctl = reiser4_ioctl_dir_common,
+#ifdef CONFIG_COMPAT
+	.compat_ioctl = reiser4_ioctl_dir_common,
+#endif
 	.fsync = reiser4_sync_common
 };
 static struct address_space_operations directory_a_ops = {
@@ -220,12 +230,17 @@ file_plugin file_plugins[LAST_FILE_PLUGIN_ID] = {
 		 * private i_ops
 		 */
 		.setattr = setattr_unix_file,
+		.fiemap = fiemap_unix_file,
+		.llseek = llseek_unix_file,
 		.open = open_unix_file,
 		.read = read_unix_file,
 		.write = write_unix_file,
+		.write_iter = write_unix_file_iter,
 		.ioctl = ioctl_unix_file,
 		.mmap = mmap_unix_file,
 		.release = release_unix_file,
+		.fallocate = fallocate_unix_file,
+		.copy_file_range = copy_file_range_unix_file,
 		/*
 		 * private f_ops
 		 */
@@ -416,6 +431,7 @@ file_plugin file_plugins[LAST_FILE_PLUGIN_ID] = {
 		.as_ops = &regular_file_a_ops,
 
 		.setattr = setattr_cryptcompress,
+		.llseek = generic_file_llseek,
 		.open = open_cryptcompress,
 		.read = read_cryptcompress,
 		.write = write_cryptcompress,
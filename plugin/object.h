@@ -36,6 +36,8 @@ int reiser4_getattr_common(const struct path *path, struct kstat *stat,
 loff_t reiser4_llseek_dir_common(struct file *, loff_t off, int origin);
 int reiser4_iterate_common(struct file *, struct dir_context *context);
 int reiser4_release_dir_common(struct inode *, struct file *);
+long reiser4_ioctl_dir_common(struct file *, unsigned int cmd,
+			      unsigned long arg);
 int reiser4_sync_common(struct file *, loff_t, loff_t, int datasync);
 
 /* file plugin operations: common implementations */
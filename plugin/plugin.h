@@ -216,9 +216,13 @@ typedef struct file_plugin {
 	 * private inode_ops
 	 */
 	int (*setattr)(struct dentry *, struct iattr *);
+	/* optional, -EOPNOTSUPP if not set */
+	int (*fiemap)(struct inode *, struct fiemap_extent_info *,
+		      u64 start, u64 len);
 	/*
 	 * private file_ops
 	 */
+	loff_t (*llseek) (struct file *, loff_t off, int whence);
 	/* do whatever is necessary to do when object is opened */
 	int (*open) (struct inode *inode, struct file *file);
 	ssize_t (*read) (struct file *, char __user *buf, size_t read_amount,
@@ -229,9 +233,19 @@ typedef struct file_plugin {
 	ssize_t (*write) (struct file *, const char __user *buf,
 			  size_t write_amount, loff_t * off,
 			  struct dispatch_context * cont);
+	/* optional, writes data of iterator. Called with i_rwsem held, after
+	 * write checks */
+	ssize_t (*write_iter) (struct file *, struct iov_iter *from,
+			       loff_t *off);
 	int (*ioctl) (struct file *filp, unsigned int cmd, unsigned long arg);
 	int (*mmap) (struct file *, struct vm_area_struct *);
 	int (*release) (struct inode *, struct file *);
+	/* optional, -EOPNOTSUPP if not set */
+	long (*fallocate) (struct file *, int mode, loff_t off, loff_t len);
+	/* optional, generic_copy_file_range() is used if not set */
+	ssize_t (*copy_file_range) (struct file *, loff_t pos_in,
+				    struct file *, loff_t pos_out,
+				    size_t len, unsigned int flags);
 	/*
 	 * private a_ops
 	 */
@@ -606,6 +620,10 @@ typedef struct compression_mode_plugin {
 	/* this is called when estimating compressibility
 	   of a logical cluster by its content */
 	int (*should_deflate) (struct inode *inode, cloff_t index);
+	/* this is called, if not NULL, to estimate compressibility of a
+	   logical cluster by its @data of @len bytes */
+	int (*should_deflate_data) (struct inode *inode, cloff_t index,
+				    const __u8 *data, size_t len);
 	/* this is called when results of compression should be saved */
 	int (*accept_hook) (struct inode *inode, cloff_t index);
 	/* this is called when results of compression should be discarded */
@@ -783,6 +801,7 @@ typedef enum {
 	TEA_HASH_ID,
 	FNV1_HASH_ID,
 	DEGENERATE_HASH_ID,
+	XXHASH64_HASH_ID,
 	LAST_HASH_ID
 } reiser4_hash_id;
 
@@ -807,6 +826,7 @@ typedef enum {
 	ULTIM_COMPRESSION_MODE_ID,
 	FORCE_COMPRESSION_MODE_ID,
 	CONVX_COMPRESSION_MODE_ID,
+	SAMPL_COMPRESSION_MODE_ID,
 	LAST_COMPRESSION_MODE_ID
 } reiser4_compression_mode_id;
 
@@ -825,6 +845,7 @@ typedef enum {
 	NEVER_TAILS_FORMATTING_ID,
 	ALWAYS_TAILS_FORMATTING_ID,
 	SMALL_FILE_FORMATTING_ID,
+	SMART_FORMATTING_ID,
 	LAST_TAIL_FORMATTING_ID
 } reiser4_formatting_id;
 
@@ -833,6 +854,7 @@ typedef enum {
 	HYBRID_TXMOD_ID,
 	JOURNAL_TXMOD_ID,
 	WA_TXMOD_ID,
+	ADAPTIVE_TXMOD_ID,
 	LAST_TXMOD_ID
 } reiser4_txmod_id;
 
@@ -963,6 +985,8 @@ extern hash_plugin hash_plugins[LAST_HASH_ID];
 extern fibration_plugin fibration_plugins[LAST_FIBRATION_ID];
 /* defined in fs/reiser4/plugin/txmod.c */
 extern txmod_plugin txmod_plugins[LAST_TXMOD_ID];
+extern void reiser4_txmod_count_write(struct inode *, loff_t pos,
+				      size_t count);
 /* defined in fs/reiser4/plugin/crypt.c */
 extern cipher_plugin cipher_plugins[LAST_CIPHER_ID];
 /* defined in fs/reiser4/plugin/digest.c */
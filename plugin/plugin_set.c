@@ -21,6 +21,12 @@
  * archived by storing psets and hsets in global hash table. Races are avoided
  * by simple (and efficient so far) solution of never recycling psets, even
  * when last inode pointing to it is destroyed.
+ *
+ * Loading of an inode sets pset members one by one, and as volumes have a
+ * handful of distinct psets, the same steps from one pset to another are
+ * made over and over. Recent steps are remembered in a small per-cpu cache
+ * (see ps_cache_find()), so that most of them skip hashing and comparing of
+ * whole sets. As psets are never recycled, cached pointers stay valid.
  */
 
 #include "../debug.h"
@@ -29,6 +35,8 @@
 
 #include <linux/slab.h>
 #include <linux/stddef.h>
+#include <linux/percpu.h>
+#include <linux/hash.h>
 
 /* slab for plugin sets */
 static struct kmem_cache *plugin_set_slab;
@@ -172,6 +180,52 @@ static inline unsigned long *pset_field(plugin_set * set, int offset)
 	return (unsigned long *)(((char *)set) + offset);
 }
 
+/* per-cpu cache of recent plugin_set_field() results */
+#define PS_CACHE_BITS (4)
+#define PS_CACHE_SIZE (1 << PS_CACHE_BITS)
+
+struct ps_step {
+	plugin_set *from;
+	unsigned long val;
+	int offset;
+	plugin_set *to;
+};
+
+static DEFINE_PER_CPU(struct ps_step[PS_CACHE_SIZE], ps_cache);
+
+static inline unsigned ps_cache_slot(const plugin_set *from,
+				     unsigned long val, int offset)
+{
+	return hash_long((unsigned long)from ^ val ^ offset, PS_CACHE_BITS);
+}
+
+/* pset which setting member at @offset of @from to @val gave recently */
+static plugin_set *ps_cache_find(plugin_set *from, unsigned long val,
+				 int offset)
+{
+	struct ps_step *step;
+	plugin_set *to = NULL;
+
+	step = get_cpu_ptr(ps_cache) + ps_cache_slot(from, val, offset);
+	if (step->from == from && step->val == val && step->offset == offset)
+		to = step->to;
+	put_cpu_ptr(ps_cache);
+	return to;
+}
+
+static void ps_cache_add(plugin_set *from, unsigned long val, int offset,
+			 plugin_set *to)
+{
+	struct ps_step *step;
+
+	step = get_cpu_ptr(ps_cache) + ps_cache_slot(from, val, offset);
+	step->from = from;
+	step->val = val;
+	step->offset = offset;
+	step->to = to;
+	put_cpu_ptr(ps_cache);
+}
+
 static int plugin_set_field(plugin_set ** set, const unsigned long val,
 			    const int offset)
 {
@@ -189,7 +243,14 @@ static int plugin_set_field(plugin_set ** set, const unsigned long val,
 	if (unlikely(*spot == val))
 		return 0;
 
-	replica = *(orig = *set);
+	orig = *set;
+	twin = ps_cache_find(orig, val, offset);
+	if (likely(twin != NULL)) {
+		*set = twin;
+		return 0;
+	}
+
+	replica = *orig;
 	*pset_field(&replica, offset) = val;
 	replica.hashval = calculate_hash(&replica);
 	rcu_read_lock();
@@ -216,6 +277,7 @@ static int plugin_set_field(plugin_set ** set, const unsigned long val,
 		rcu_read_unlock();
 		*set = twin;
 	}
+	ps_cache_add(orig, val, offset, *set);
 	return 0;
 }
 
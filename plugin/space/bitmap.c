@@ -7,13 +7,20 @@
 #include "../../block_alloc.h"
 #include "../../tree.h"
 #include "../../super.h"
+#include "../../reiser4_trace.h"
+#include "../../discard.h"
 #include "../plugin.h"
+#include "../item/blackbox.h"
 #include "space_allocator.h"
 #include "bitmap.h"
 
 #include <linux/types.h>
 #include <linux/fs.h>		/* for struct super_block  */
 #include <linux/mutex.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #include <asm/div64.h>
 
 /* Proposed (but discarded) optimization: dynamic loading/unloading of bitmap
@@ -49,7 +56,22 @@
    loaded into memory on fs mount time or each bitmap nodes are loaded at the
    first access to it, the "dont_load_bitmap" mount option controls whether
    bimtap nodes should be loaded at mount time. Dynamic unloading of bitmap
-   nodes currently is not supported. */
+   nodes currently is not supported.
+
+   WORKING bitmap block gets its own copy only when it starts to differ from
+   COMMIT bitmap block, at the first allocation from it or when an atom
+   changes COMMIT bitmap block first. Until then, and again once all
+   allocations and deallocations done since then are committed, WORKING
+   bitmap is read from COMMIT bitmap block, so that clean bitmap blocks take
+   one page of memory rather than two. See bnode_unshare() and
+   bnode_try_share().
+
+   The number of bitmap blocks is fixed at mount by the block count of the
+   format super block: the kernel cannot grow a volume, that is done offline
+   by the resize utility, which writes the new bitmap blocks. Marking new
+   bitmap blocks "all free, not written yet" would need a flag per bitmap
+   block on disk, which format40 does not have, and reading them only on
+   first use is what dont_load_bitmap already does. */
 
 #define CHECKSUM_SIZE    4
 
@@ -74,10 +96,36 @@ struct bitmap_node {
 	struct mutex mutex;	/* long term lock object */
 
 	jnode *wjnode;		/* j-nodes for WORKING ... */
-	jnode *cjnode;		/* ... and COMMIT bitmap blocks */
+	jnode *cjnode;		/* ... and COMMIT bitmap blocks. @wjnode
+				 * is NULL while both bitmaps are the same */
+	/* j-node of COMMIT bitmap block read of which was started by
+	   prefetch_bnodes(), taken by prepare_bnode() */
+	jnode *prefetched;
 
 	bmap_off_t first_zero_bit;	/* for skip_busy option implementation */
 
+	/* upper bound on the length of the longest free extent of WORKING
+	   bitmap. Allocations can only shorten free extents, so it is
+	   updated on deallocation and set exactly when a full scan finds no
+	   extent long enough. bitmap_alloc_forward() and
+	   bitmap_alloc_backward() skip bitmap blocks without free extent of
+	   wanted length without loading or scanning them. */
+	bmap_off_t max_free_run;
+	/* number of free blocks in WORKING bitmap. Counted when bnode is
+	   loaded, all blocks are assumed free before that */
+	bmap_off_t nr_free;
+	/* number of free blocks in COMMIT bitmap of loaded bnode */
+	bmap_off_t commit_free;
+
+	/* on bitmap_allocator_data->crc_dirty list while COMMIT bitmap was
+	   changed without updating its checksum, see fold_commit_crcs() */
+	struct list_head crc_link;
+
+	/* true while nr_free and max_free_run of bitmap block which is not
+	   loaded come from the summary, see reiser4_load_summary_bitmap().
+	   Protected by @mutex */
+	int summary;
+
 	atomic_t loaded;	/* a flag which shows that bnode is loaded
 				 * already */
 };
@@ -86,7 +134,7 @@ static inline char *bnode_working_data(struct bitmap_node *bnode)
 {
 	char *data;
 
-	data = jdata(bnode->wjnode);
+	data = jdata(bnode->wjnode ? : bnode->cjnode);
 	assert("zam-429", data != NULL);
 
 	return data + CHECKSUM_SIZE;
@@ -134,8 +182,22 @@ static inline void bnode_set_commit_crc(struct bitmap_node *bnode, __u32 crc)
 struct bitmap_allocator_data {
 	/* an array for bitmap blocks direct access */
 	struct bitmap_node *bitmap;
+	/* for free_extents debugfs file and bitmap loader */
+	struct super_block *super;
+	/* thread loading bitmap blocks in background, see bitmap_loader() */
+	struct task_struct *loader;
+	/* true while the loader thread has bitmap blocks to load */
+	int loading;
+	/* bitmap blocks with stale commit checksum. Only accessed by
+	   reiser4_pre_commit_hook_bitmap(), which is serialized */
+	struct list_head crc_dirty;
+	/* number of bitmap blocks with summary */
+	atomic_t nr_summary;
 };
 
+#define get_bitmap_data(super) \
+((struct bitmap_allocator_data *)(get_super_private(super)->space_allocator.u.generic))
+
 #define get_barray(super) \
 (((struct bitmap_allocator_data *)(get_super_private(super)->space_allocator.u.generic)) -> bitmap)
 
@@ -159,16 +221,9 @@ static jnode *bnew(void)
 /* Audited by: green(2002.06.12) */
 static int find_next_zero_bit_in_word(ulong_t word, int start_bit)
 {
-	ulong_t mask = 1UL << start_bit;
-	int i = start_bit;
+	ulong_t zeroes = ~word & (~0UL << start_bit);
 
-	while ((word & mask) != 0) {
-		mask <<= 1;
-		if (++i >= BITS_PER_LONG)
-			break;
-	}
-
-	return i;
+	return zeroes ? __ffs(zeroes) : BITS_PER_LONG;
 }
 
 #include <linux/bitops.h>
@@ -267,24 +322,50 @@ static bmap_off_t reiser4_find_next_set_bit(void *addr, bmap_off_t max_offset,
   __reiser4_find_next_set_bit(addr, max_offset, start_offset)
 #endif
 
+/* Search for an aligned word of zero bits within [@start_offset,
+ * @max_offset[, return the offset of its first bit if it is found,
+ * @max_offset otherwise. A free extent of at least 2 * BITS_PER_LONG blocks
+ * always contains such word, this is used to skip short free extents. */
+static bmap_off_t __reiser4_find_next_zero_word(void *addr,
+						bmap_off_t max_offset,
+						bmap_off_t start_offset)
+{
+	ulong_t *base = addr;
+	bmap_off_t word_nr = DIV_ROUND_UP(start_offset, BITS_PER_LONG);
+	bmap_off_t end_word_nr = max_offset >> LONG_INT_SHIFT;
+
+	for (; word_nr < end_word_nr; word_nr++)
+		if (base[word_nr] == 0)
+			return word_nr << LONG_INT_SHIFT;
+	return max_offset;
+}
+
+#if BITS_PER_LONG == 64
+
+static bmap_off_t reiser4_find_next_zero_word(void *addr,
+					      bmap_off_t max_offset,
+					      bmap_off_t start_offset)
+{
+	bmap_off_t off = OFF(addr);
+
+	return __reiser4_find_next_zero_word(BASE(addr), max_offset + off,
+					     start_offset + off) - off;
+}
+
+#else
+#define reiser4_find_next_zero_word(addr, max_offset, start_offset) \
+  __reiser4_find_next_zero_word(addr, max_offset, start_offset)
+#endif
+
 /* search for the first set bit in single word. */
 static int find_last_set_bit_in_word(ulong_t word, int start_bit)
 {
-	ulong_t bit_mask;
-	int nr = start_bit;
-
 	assert("zam-965", start_bit < BITS_PER_LONG);
 	assert("zam-966", start_bit >= 0);
 
-	bit_mask = (1UL << nr);
-
-	while (bit_mask != 0) {
-		if (bit_mask & word)
-			return nr;
-		bit_mask >>= 1;
-		nr--;
-	}
-	return BITS_PER_LONG;
+	/* clear bits above @start_bit */
+	word &= ~0UL >> (BITS_PER_LONG - 1 - start_bit);
+	return word ? __fls(word) : BITS_PER_LONG;
 }
 
 /* Search bitmap for a set bit in backward direction from the end to the
@@ -470,10 +551,17 @@ __u32 reiser4_adler32(char *data, __u32 len)
 	__u32 s2 = 0;
 	int k;
 
+#define ADLER_DO1(i) do { s1 += t[i]; s2 += s1; } while (0)
+
 	while (len > 0) {
 		k = len < ADLER_NMAX ? len : ADLER_NMAX;
 		len -= k;
 
+		/* unrolled, as in later zlib versions */
+		for (; k >= 8; k -= 8, t += 8) {
+			ADLER_DO1(0); ADLER_DO1(1); ADLER_DO1(2); ADLER_DO1(3);
+			ADLER_DO1(4); ADLER_DO1(5); ADLER_DO1(6); ADLER_DO1(7);
+		}
 		while (k--) {
 			s1 += *t++;
 			s2 += s1;
@@ -482,11 +570,12 @@ __u32 reiser4_adler32(char *data, __u32 len)
 		s1 %= ADLER_BASE;
 		s2 %= ADLER_BASE;
 	}
+#undef ADLER_DO1
 	return (s2 << 16) | s1;
 }
 
 #define sb_by_bnode(bnode) \
-	((struct super_block *)jnode_get_tree(bnode->wjnode)->super)
+	((struct super_block *)jnode_get_tree(bnode->cjnode)->super)
 
 static __u32 bnode_calc_crc(const struct bitmap_node *bnode, unsigned long size)
 {
@@ -628,9 +717,11 @@ check_block_range(const reiser4_block_nr * start, const reiser4_block_nr * len)
 static void check_bnode_loaded(const struct bitmap_node *bnode)
 {
 	assert("zam-485", bnode != NULL);
-	assert("zam-483", jnode_page(bnode->wjnode) != NULL);
+	assert("zam-483", ergo(bnode->wjnode != NULL,
+			       jnode_page(bnode->wjnode) != NULL));
 	assert("zam-484", jnode_page(bnode->cjnode) != NULL);
-	assert("nikita-2820", jnode_is_loaded(bnode->wjnode));
+	assert("nikita-2820", ergo(bnode->wjnode != NULL,
+				   jnode_is_loaded(bnode->wjnode)));
 	assert("nikita-2821", jnode_is_loaded(bnode->cjnode));
 }
 
@@ -697,12 +788,15 @@ static void get_working_bitmap_blocknr(bmap_nr_t bmap, reiser4_block_nr * bnr)
 /* bnode structure initialization */
 static void
 init_bnode(struct bitmap_node *bnode,
-	   struct super_block *super UNUSED_ARG, bmap_nr_t bmap UNUSED_ARG)
+	   struct super_block *super, bmap_nr_t bmap UNUSED_ARG)
 {
 	memset(bnode, 0, sizeof(struct bitmap_node));
 
 	mutex_init(&bnode->mutex);
 	atomic_set(&bnode->loaded, 0);
+	bnode->max_free_run = bmap_bit_count(super->s_blocksize);
+	bnode->nr_free = bmap_bit_count(super->s_blocksize);
+	INIT_LIST_HEAD(&bnode->crc_link);
 }
 
 static void release(jnode * node)
@@ -712,72 +806,176 @@ static void release(jnode * node)
 	jput(node);
 }
 
+/* drop jnode of prefetch_bnodes(), which has no d-reference */
+static void release_prefetched(jnode *node)
+{
+	JF_SET(node, JNODE_HEARD_BANSHEE);
+	jput(node);
+}
+
+/* number of set bits in [@start, @end[ of @data */
+static bmap_off_t count_set_bits(char *data, bmap_off_t start, bmap_off_t end)
+{
+	bmap_off_t nr = 0;
+
+	while (start < end) {
+		bmap_off_t zero;
+
+		start = reiser4_find_next_set_bit(data, end, start);
+		if (start >= end)
+			break;
+		zero = reiser4_find_next_zero_bit((long *)data, end, start);
+		if (zero > end)
+			zero = end;
+		nr += zero - start;
+		start = zero;
+	}
+	return nr;
+}
+
+/* give WORKING bitmap its own copy of COMMIT bitmap before either of them
+   is changed; bnode should be locked */
+static int bnode_unshare(struct bitmap_node *bnode)
+{
+	struct super_block *super = reiser4_get_current_sb();
+	jnode *wjnode;
+	int ret;
+
+	if (bnode->wjnode != NULL)
+		return 0;
+	wjnode = bnew();
+	if (wjnode == NULL)
+		return RETERR(-ENOMEM);
+	get_working_bitmap_blocknr(bnode - get_bnode(super, 0),
+				   &wjnode->blocknr);
+	jref(wjnode);
+	ret = jinit_new(wjnode, GFP_NOFS);
+	if (ret != 0) {
+		release_prefetched(wjnode);
+		return ret;
+	}
+	memcpy(jdata(wjnode) + CHECKSUM_SIZE, bnode_commit_data(bnode),
+	       bmap_size(super->s_blocksize));
+	bnode->wjnode = wjnode;
+	return 0;
+}
+
+/* bnode_unshare() for deallocation and commit, which can not fail */
+static void bnode_unshare_nofail(struct bitmap_node *bnode)
+{
+	while (bnode_unshare(bnode) != 0)
+		schedule_timeout_uninterruptible(HZ / 50);
+}
+
+/* drop copy of WORKING bitmap once it is the same as COMMIT bitmap again;
+   bnode should be locked */
+static void bnode_try_share(struct bitmap_node *bnode)
+{
+	if (bnode->wjnode == NULL || bnode->nr_free != bnode->commit_free ||
+	    !list_empty(&bnode->crc_link))
+		return;
+	if (memcmp(jdata(bnode->wjnode) + CHECKSUM_SIZE,
+		   bnode_commit_data(bnode), bmap_size(current_blocksize)))
+		return;
+	release(bnode->wjnode);
+	bnode->wjnode = NULL;
+}
+
 /* This function is for internal bitmap.c use because it assumes that jnode is
    in under full control of this thread */
 static void done_bnode(struct bitmap_node *bnode)
 {
 	if (bnode) {
+		jnode *prefetched = xchg(&bnode->prefetched, NULL);
+
 		atomic_set(&bnode->loaded, 0);
 		if (bnode->wjnode != NULL)
 			release(bnode->wjnode);
 		if (bnode->cjnode != NULL)
 			release(bnode->cjnode);
 		bnode->wjnode = bnode->cjnode = NULL;
+		if (prefetched != NULL)
+			release_prefetched(prefetched);
+	}
+}
+
+/* Start reads of COMMIT bitmap blocks of @nr bnodes starting from @first,
+   wrapping around the end of bnode array. Bitmap blocks are read and their
+   checksums verified one by one when bnodes are loaded, so that loading all
+   of them at mount waits for every block in turn. With reads of the blocks
+   ahead submitted in batches, the device has work queued while checksums are
+   verified. */
+static void prefetch_bnodes(struct super_block *super, bmap_nr_t first,
+			    bmap_nr_t nr)
+{
+	bmap_nr_t bitmap_blocks_nr = get_nr_bmap(super);
+	jnode *batch[REISER4_PREFETCH_BATCH];
+	int nr_batch = 0;
+	bmap_nr_t i;
+
+	for (i = 0; i < nr && i < bitmap_blocks_nr; i++) {
+		bmap_nr_t bmap = (first + i) % bitmap_blocks_nr;
+		struct bitmap_node *bnode = get_bnode(super, bmap);
+		jnode *cjnode;
+
+		if (atomic_read(&bnode->loaded) ||
+		    READ_ONCE(bnode->prefetched) != NULL)
+			continue;
+		cjnode = bnew();
+		if (cjnode == NULL)
+			break;
+		get_bitmap_blocknr(super, bmap, &cjnode->blocknr);
+		jref(cjnode);
+		if (cmpxchg(&bnode->prefetched, NULL, cjnode) != NULL) {
+			release_prefetched(cjnode);
+			continue;
+		}
+		batch[nr_batch++] = cjnode;
+		if (nr_batch == REISER4_PREFETCH_BATCH) {
+			jload_prefetch_batch(batch, nr_batch);
+			nr_batch = 0;
+		}
 	}
+	jload_prefetch_batch(batch, nr_batch);
 }
 
 /* ZAM-FIXME-HANS: comment this.  Called only by load_and_lock_bnode()*/
-static int prepare_bnode(struct bitmap_node *bnode, jnode **cjnode_ret,
-			 jnode **wjnode_ret)
+static int prepare_bnode(struct bitmap_node *bnode, jnode **cjnode_ret)
 {
 	struct super_block *super;
 	jnode *cjnode;
-	jnode *wjnode;
 	bmap_nr_t bmap;
 	int ret;
 
 	super = reiser4_get_current_sb();
 
-	*wjnode_ret = wjnode = bnew();
-	if (wjnode == NULL) {
-		*cjnode_ret = NULL;
-		return RETERR(-ENOMEM);
-	}
-
-	*cjnode_ret = cjnode = bnew();
-	if (cjnode == NULL)
-		return RETERR(-ENOMEM);
-
 	bmap = bnode - get_bnode(super, 0);
 
-	get_working_bitmap_blocknr(bmap, &wjnode->blocknr);
-	get_bitmap_blocknr(super, bmap, &cjnode->blocknr);
-
-	jref(cjnode);
-	jref(wjnode);
+	/* read of commit bitmap may have been started already */
+	cjnode = xchg(&bnode->prefetched, NULL);
+	if (cjnode == NULL) {
+		cjnode = bnew();
+		if (cjnode == NULL) {
+			*cjnode_ret = NULL;
+			return RETERR(-ENOMEM);
+		}
+		get_bitmap_blocknr(super, bmap, &cjnode->blocknr);
+		jref(cjnode);
+	}
+	*cjnode_ret = cjnode;
 
-	/* load commit bitmap */
+	/* load commit bitmap. Working bitmap shares it until either of them
+	 * is changed */
 	ret = jload_gfp(cjnode, GFP_NOFS, 1);
 
 	if (ret)
 		goto error;
 
-	/* allocate memory for working bitmap block. Note that for
-	 * bitmaps jinit_new() doesn't actually modifies node content,
-	 * so parallel calls to this are ok. */
-	ret = jinit_new(wjnode, GFP_NOFS);
-
-	if (ret != 0) {
-		jrelse(cjnode);
-		goto error;
-	}
-
 	return 0;
 
       error:
 	jput(cjnode);
-	jput(wjnode);
-	*wjnode_ret = *cjnode_ret = NULL;
+	*cjnode_ret = NULL;
 	return ret;
 
 }
@@ -814,7 +1012,6 @@ static int load_and_lock_bnode(struct bitmap_node *bnode)
 	int ret;
 
 	jnode *cjnode;
-	jnode *wjnode;
 
 	assert("nikita-3040", reiser4_schedulable());
 
@@ -829,7 +1026,7 @@ static int load_and_lock_bnode(struct bitmap_node *bnode)
 		return 0;
 	}
 
-	ret = prepare_bnode(bnode, &cjnode, &wjnode);
+	ret = prepare_bnode(bnode, &cjnode);
 	if (ret)
 		return ret;
 
@@ -837,11 +1034,8 @@ static int load_and_lock_bnode(struct bitmap_node *bnode)
 
 	if (!atomic_read(&bnode->loaded)) {
 		assert("nikita-2822", cjnode != NULL);
-		assert("nikita-2823", wjnode != NULL);
 		assert("nikita-2824", jnode_is_loaded(cjnode));
-		assert("nikita-2825", jnode_is_loaded(wjnode));
 
-		bnode->wjnode = wjnode;
 		bnode->cjnode = cjnode;
 
 		ret = check_struct_bnode(bnode, current_blocksize);
@@ -849,12 +1043,23 @@ static int load_and_lock_bnode(struct bitmap_node *bnode)
 			goto error;
 
 		atomic_set(&bnode->loaded, 1);
-		/* working bitmap is initialized by on-disk
-		 * commit bitmap. This should be performed
-		 * under mutex. */
-		memcpy(bnode_working_data(bnode),
-		       bnode_commit_data(bnode),
-		       bmap_size(current_blocksize));
+		reiser4_stat_inc(reiser4_get_current_sb(),
+				 REISER4_STAT_BITMAP_LOADS);
+		/* working bitmap is the on-disk commit bitmap until
+		 * either of them is changed */
+		bnode->commit_free = bmap_bit_count(current_blocksize) -
+			memweight(bnode_commit_data(bnode),
+				  bmap_size(current_blocksize));
+		WRITE_ONCE(bnode->nr_free, bnode->commit_free);
+		if (bnode->summary) {
+			/* nr_free is exact now, max_free_run is to be found
+			   again by scanning */
+			bnode->summary = 0;
+			WRITE_ONCE(bnode->max_free_run,
+				   bmap_bit_count(current_blocksize));
+			atomic_dec(&get_bitmap_data(reiser4_get_current_sb())->
+				   nr_summary);
+		}
 	} else
 		/* race: someone already loaded bitmap
 		 * while we were busy initializing data. */
@@ -862,9 +1067,7 @@ static int load_and_lock_bnode(struct bitmap_node *bnode)
 	return 0;
 
  error:
-	release(wjnode);
 	release(cjnode);
-	bnode->wjnode = NULL;
 	bnode->cjnode = NULL;
 	mutex_unlock(&bnode->mutex);
 	return ret;
@@ -896,6 +1099,8 @@ search_one_bitmap_forward(bmap_nr_t bmap, bmap_off_t * offset,
 	bmap_off_t end;
 
 	int set_first_zero_bit = 0;
+	/* the whole bitmap block is scanned */
+	int full_scan;
 
 	int ret;
 
@@ -916,8 +1121,10 @@ search_one_bitmap_forward(bmap_nr_t bmap, bmap_off_t * offset,
 		start = bnode->first_zero_bit;
 		set_first_zero_bit = 1;
 	}
+	full_scan = set_first_zero_bit &&
+		max_offset == bmap_bit_count(super->s_blocksize);
 
-	while (start + min_len < max_offset) {
+	while (start + min_len <= max_offset) {
 
 		start =
 		    reiser4_find_next_zero_bit((long *)data, max_offset, start);
@@ -928,6 +1135,23 @@ search_one_bitmap_forward(bmap_nr_t bmap, bmap_off_t * offset,
 		if (start >= max_offset)
 			break;
 
+		if (min_len >= 2 * BITS_PER_LONG) {
+			/* skip free extents too short to contain a zero
+			   word, then back up to the beginning of the extent
+			   containing it */
+			bmap_off_t word;
+			bmap_off_t last_set;
+
+			word = reiser4_find_next_zero_word(data, max_offset,
+							   start);
+			if (word >= max_offset)
+				break;
+			if (word > start &&
+			    reiser4_find_last_set_bit(&last_set, data, start,
+						      word - 1) == 0)
+				start = last_set + 1;
+		}
+
 		search_end = LIMIT(start + max_len, max_offset);
 		end =
 		    reiser4_find_next_set_bit((long *)data, search_end, start);
@@ -938,10 +1162,15 @@ search_one_bitmap_forward(bmap_nr_t bmap, bmap_off_t * offset,
 			if (end > search_end)
 				end = search_end;
 
+			ret = bnode_unshare(bnode);
+			if (ret != 0)
+				break;
+			data = bnode_working_data(bnode);
 			ret = end - start;
 			*offset = start;
 
 			reiser4_set_bits(data, start, end);
+			WRITE_ONCE(bnode->nr_free, bnode->nr_free - ret);
 
 			/* FIXME: we may advance first_zero_bit if [start,
 			   end] region overlaps the first_zero_bit point */
@@ -952,6 +1181,10 @@ search_one_bitmap_forward(bmap_nr_t bmap, bmap_off_t * offset,
 		start = end + 1;
 	}
 
+	if (ret == 0 && full_scan && bnode->max_free_run >= min_len)
+		/* there is no free extent of @min_len blocks */
+		WRITE_ONCE(bnode->max_free_run, min_len - 1);
+
 	release_and_unlock_bnode(bnode);
 
 	return ret;
@@ -1004,12 +1237,17 @@ search_one_bitmap_backward(bmap_nr_t bmap, bmap_off_t * start_offset,
 		if (end + min_len <= start + 1) {
 			if (end < search_end)
 				end = search_end;
+			ret = bnode_unshare(bnode);
+			if (ret != 0)
+				break;
+			data = bnode_working_data(bnode);
 			ret = start - end + 1;
 			*start_offset = end;	/* `end' is lowest offset */
 			assert("zam-987",
 			       reiser4_find_next_set_bit(data, start + 1,
 							 end) >= start + 1);
 			reiser4_set_bits(data, end, start + 1);
+			WRITE_ONCE(bnode->nr_free, bnode->nr_free - ret);
 			break;
 		}
 
@@ -1023,10 +1261,27 @@ search_one_bitmap_backward(bmap_nr_t bmap, bmap_off_t * start_offset,
 	return ret;
 }
 
-/* allocate contiguous range of blocks in bitmap */
+/* true if bitmap block @bmap is known to have no free extent of @min_len
+   blocks. Full bitmap blocks are skipped this way as well */
+static inline int bnode_too_fragmented(struct super_block *super,
+				       bmap_nr_t bmap, int min_len)
+{
+	struct bitmap_node *bnode = get_bnode(super, bmap);
+
+	return READ_ONCE(bnode->nr_free) < min_len ||
+		READ_ONCE(bnode->max_free_run) < min_len;
+}
+
+static inline int bnode_is_loaded(struct super_block *super, bmap_nr_t bmap)
+{
+	return atomic_read(&get_bnode(super, bmap)->loaded);
+}
+
+/* allocate contiguous range of blocks in bitmap. If @loaded_only is set,
+   bitmap blocks which are not loaded yet are skipped */
 static int bitmap_alloc_forward(reiser4_block_nr * start,
 				const reiser4_block_nr * end, int min_len,
-				int max_len)
+				int max_len, int loaded_only)
 {
 	bmap_nr_t bmap, end_bmap;
 	bmap_off_t offset, end_offset;
@@ -1047,6 +1302,9 @@ static int bitmap_alloc_forward(reiser4_block_nr * start,
 	assert("zam-359", ergo(end_bmap == bmap, end_offset >= offset));
 
 	for (; bmap < end_bmap; bmap++, offset = 0) {
+		if (bnode_too_fragmented(super, bmap, min_len) ||
+		    (loaded_only && !bnode_is_loaded(super, bmap)))
+			continue;
 		len =
 		    search_one_bitmap_forward(bmap, &offset, max_offset,
 					      min_len, max_len);
@@ -1054,9 +1312,10 @@ static int bitmap_alloc_forward(reiser4_block_nr * start,
 			goto out;
 	}
 
-	len =
-	    search_one_bitmap_forward(bmap, &offset, end_offset, min_len,
-				      max_len);
+	len = 0;
+	if (!loaded_only || bnode_is_loaded(super, bmap))
+		len = search_one_bitmap_forward(bmap, &offset, end_offset,
+						min_len, max_len);
       out:
 	*start = bmap * max_offset + offset;
 	return len;
@@ -1081,6 +1340,8 @@ static int bitmap_alloc_backward(reiser4_block_nr * start,
 	assert("zam-962", ergo(end_bmap == bmap, end_offset <= offset));
 
 	for (; bmap > end_bmap; bmap--, offset = max_offset - 1) {
+		if (bnode_too_fragmented(super, bmap, min_len))
+			continue;
 		len =
 		    search_one_bitmap_backward(bmap, &offset, 0, min_len,
 					       max_len);
@@ -1121,8 +1382,31 @@ static int alloc_blocks_forward(reiser4_blocknr_hint *hint, int needed,
 	   of the disk or in given region if @hint -> max_dist is not zero */
 	search_start = hint->blk;
 
-	actual_len =
-	    bitmap_alloc_forward(&search_start, &search_end, 1, needed);
+	/* Large requests first look for a free extent of full length, so
+	   that they are not split over the first short free extents after
+	   the hint on a fragmented file system. Bitmap blocks without such
+	   extent are skipped quickly after they were scanned once, see
+	   bitmap_node->max_free_run. */
+	actual_len = 0;
+	/* While bitmap blocks are being loaded in background, prefer those
+	   which are loaded already over reading a bitmap block in the
+	   allocation path. */
+	if (READ_ONCE(get_bitmap_data(super)->loading)) {
+		actual_len = bitmap_alloc_forward(&search_start, &search_end,
+						  1, needed, 1);
+		if (actual_len == 0)
+			search_start = hint->blk;
+	}
+	if (actual_len == 0 && needed >= REISER4_BITMAP_CONTIG_MIN) {
+		actual_len = bitmap_alloc_forward(&search_start, &search_end,
+						  needed, needed, 0);
+		if (actual_len == 0)
+			search_start = hint->blk;
+	}
+
+	if (actual_len == 0)
+		actual_len = bitmap_alloc_forward(&search_start, &search_end,
+						  1, needed, 0);
 
 	/* There is only one bitmap search if max_dist was specified or first
 	   pass was from the beginning of the bitmap. We also do one pass for
@@ -1131,8 +1415,8 @@ static int alloc_blocks_forward(reiser4_blocknr_hint *hint, int needed,
 		/* next step is a scanning from 0 to search_start */
 		search_end = search_start;
 		search_start = 0;
-		actual_len =
-		    bitmap_alloc_forward(&search_start, &search_end, 1, needed);
+		actual_len = bitmap_alloc_forward(&search_start, &search_end,
+						  1, needed, 0);
 	}
 	if (actual_len == 0)
 		return RETERR(-ENOSPC);
@@ -1174,14 +1458,72 @@ static int alloc_blocks_backward(reiser4_blocknr_hint * hint, int needed,
 	return 0;
 }
 
+/* forget summaries of bitmap blocks which are not loaded yet. Returns true
+   if there were any */
+static int drop_summary(struct super_block *super)
+{
+	struct bitmap_allocator_data *data = get_bitmap_data(super);
+	const bmap_off_t max_offset = bmap_bit_count(super->s_blocksize);
+	bmap_nr_t bitmap_blocks_nr = get_nr_bmap(super);
+	bmap_nr_t i;
+
+	if (atomic_read(&data->nr_summary) == 0)
+		return 0;
+	for (i = 0; i < bitmap_blocks_nr; i++) {
+		struct bitmap_node *bnode = data->bitmap + i;
+
+		if (!READ_ONCE(bnode->summary))
+			continue;
+		mutex_lock(&bnode->mutex);
+		if (bnode->summary) {
+			bnode->summary = 0;
+			WRITE_ONCE(bnode->nr_free, max_offset);
+			WRITE_ONCE(bnode->max_free_run, max_offset);
+			atomic_dec(&data->nr_summary);
+		}
+		mutex_unlock(&bnode->mutex);
+	}
+	return 1;
+}
+
 /* plugin->u.space_allocator.alloc_blocks() */
 int reiser4_alloc_blocks_bitmap(reiser4_space_allocator * allocator,
 				reiser4_blocknr_hint * hint, int needed,
 				reiser4_block_nr * start, reiser4_block_nr * len)
 {
-	if (hint->backward)
-		return alloc_blocks_backward(hint, needed, start, len);
-	return alloc_blocks_forward(hint, needed, start, len);
+	int ret;
+
+	do {
+		if (hint->backward)
+			ret = alloc_blocks_backward(hint, needed, start, len);
+		else
+			ret = alloc_blocks_forward(hint, needed, start, len);
+		/* summary of the previous mount may understate free space of
+		   bitmap blocks it made the search skip */
+	} while (ret == -ENOSPC && drop_summary(reiser4_get_current_sb()));
+	trace_reiser4_bitmap_alloc(reiser4_get_current_sb(), hint->blk,
+				   hint->max_dist, hint->backward, needed,
+				   ret ? 0 : *start, ret ? 0 : *len, ret);
+	return ret;
+}
+
+/* extend bnode->max_free_run after bits [@start, @end[ of WORKING bitmap
+   were cleared; bnode should be locked */
+static void update_max_free_run(struct bitmap_node *bnode, bmap_off_t start,
+				bmap_off_t end, bmap_off_t max_offset)
+{
+	char *data = bnode_working_data(bnode);
+	bmap_off_t run_start = 0;
+
+	if (start != 0 &&
+	    reiser4_find_last_set_bit(&run_start, data, 0, start - 1) == 0)
+		run_start++;
+	if (end < max_offset)
+		end = reiser4_find_next_set_bit(data, max_offset, end);
+	if (end > max_offset)
+		end = max_offset;
+	if (end - run_start > bnode->max_free_run)
+		WRITE_ONCE(bnode->max_free_run, end - run_start);
 }
 
 /* plugin->u.space_allocator.dealloc_blocks(). */
@@ -1198,28 +1540,158 @@ void reiser4_dealloc_blocks_bitmap(reiser4_space_allocator * allocator,
 	bmap_off_t offset;
 
 	struct bitmap_node *bnode;
+	bmap_off_t max_offset = bmap_bit_count(super->s_blocksize);
+	bmap_off_t count;
 	int ret;
 
 	assert("zam-468", len != 0);
 	check_block_range(&start, &len);
 
-	parse_blocknr(&start, &bmap, &offset);
+	/* extents joined by the discard queue may span several bitmap
+	   blocks */
+	for (; len != 0; start += count, len -= count) {
+		parse_blocknr(&start, &bmap, &offset);
+		count = min_t(reiser4_block_nr, len, max_offset - offset);
 
-	assert("zam-469", offset + len <= bmap_bit_count(super->s_blocksize));
+		bnode = get_bnode(super, bmap);
 
-	bnode = get_bnode(super, bmap);
+		assert("zam-470", bnode != NULL);
 
-	assert("zam-470", bnode != NULL);
+		ret = load_and_lock_bnode(bnode);
+		assert("zam-481", ret == 0);
 
-	ret = load_and_lock_bnode(bnode);
-	assert("zam-481", ret == 0);
+		bnode_unshare_nofail(bnode);
+		reiser4_clear_bits(bnode_working_data(bnode), offset,
+				   (bmap_off_t) (offset + count));
 
-	reiser4_clear_bits(bnode_working_data(bnode), offset,
-			   (bmap_off_t) (offset + len));
+		adjust_first_zero_bit(bnode, offset);
+		update_max_free_run(bnode, offset, offset + count, max_offset);
+		WRITE_ONCE(bnode->nr_free, bnode->nr_free + count);
+		bnode_try_share(bnode);
 
-	adjust_first_zero_bit(bnode, offset);
+		release_and_unlock_bnode(bnode);
+	}
+}
 
-	release_and_unlock_bnode(bnode);
+/* free extents taken off one bitmap block at a time by trim_one_bitmap() */
+#define TRIM_BATCH (32)
+
+/* Discard free extents of at least @min_len blocks within [@offset,
+   @end_offset[ of bitmap block @bmap. Free extents are marked used in
+   WORKING bitmap, so that they are not allocated while bnode mutex is
+   released for discard I/O, and are freed again after that. */
+static int trim_one_bitmap(reiser4_space_allocator * allocator,
+			   bmap_nr_t bmap, bmap_off_t offset,
+			   bmap_off_t end_offset, bmap_off_t min_len,
+			   reiser4_block_nr * trimmed)
+{
+	struct super_block *super = reiser4_get_current_sb();
+	const bmap_off_t max_offset = bmap_bit_count(super->s_blocksize);
+	struct bitmap_node *bnode = get_bnode(super, bmap);
+	struct {
+		bmap_off_t start;
+		bmap_off_t len;
+	} runs[TRIM_BATCH];
+	int nr;
+	int i;
+	int ret;
+
+	while (offset < end_offset) {
+		char *data;
+
+		ret = load_and_lock_bnode(bnode);
+		if (ret)
+			return ret;
+		data = bnode_working_data(bnode);
+		for (nr = 0; nr < TRIM_BATCH && offset < end_offset;) {
+			bmap_off_t start;
+
+			start = reiser4_find_next_zero_bit((long *)data,
+							   end_offset, offset);
+			if (start >= end_offset) {
+				offset = end_offset;
+				break;
+			}
+			offset = reiser4_find_next_set_bit(data, end_offset,
+							   start);
+			if (offset > end_offset)
+				offset = end_offset;
+			if (offset - start < min_len)
+				continue;
+			ret = bnode_unshare(bnode);
+			if (ret != 0)
+				break;
+			data = bnode_working_data(bnode);
+			reiser4_set_bits(data, start, offset);
+			WRITE_ONCE(bnode->nr_free,
+				   bnode->nr_free - (offset - start));
+			runs[nr].start = start;
+			runs[nr].len = offset - start;
+			nr++;
+		}
+		release_and_unlock_bnode(bnode);
+
+		/* runs taken before bnode_unshare() failed are freed without
+		   discard */
+		for (i = 0; i < nr; i++) {
+			reiser4_block_nr start = bmap * max_offset +
+				runs[i].start;
+
+			if (ret == 0)
+				ret = reiser4_discard_extent(super, start,
+							     runs[i].len);
+			reiser4_dealloc_blocks_bitmap(allocator, start,
+						      runs[i].len);
+			if (ret == 0)
+				*trimmed += runs[i].len;
+		}
+		if (ret)
+			return ret;
+		if (fatal_signal_pending(current))
+			return RETERR(-ERESTARTSYS);
+		cond_resched();
+	}
+	return 0;
+}
+
+/* sa_trim()
+   discards free extents of at least @min_len blocks within [@start, @end[.
+   The number of discarded blocks is added to @trimmed */
+int reiser4_trim_bitmap(reiser4_space_allocator * allocator,
+			reiser4_block_nr start, reiser4_block_nr end,
+			reiser4_block_nr min_len, reiser4_block_nr * trimmed)
+{
+	struct super_block *super = reiser4_get_current_sb();
+	const bmap_off_t max_offset = bmap_bit_count(super->s_blocksize);
+	bmap_nr_t bmap, end_bmap;
+	bmap_off_t offset, end_offset;
+	reiser4_block_nr last;
+	int ret;
+
+	assert("", start < end);
+	assert("", end <= reiser4_block_count(super));
+
+	if (min_len > max_offset)
+		return 0;
+	if (min_len == 0)
+		min_len = 1;
+
+	last = end - 1;
+	parse_blocknr(&start, &bmap, &offset);
+	parse_blocknr(&last, &end_bmap, &end_offset);
+
+	for (; bmap <= end_bmap; bmap++, offset = 0) {
+		bmap_off_t limit = bmap == end_bmap ? end_offset + 1 :
+			max_offset;
+
+		if (bnode_too_fragmented(super, bmap, min_len))
+			continue;
+		ret = trim_one_bitmap(allocator, bmap, offset, limit,
+				      min_len, trimmed);
+		if (ret)
+			return ret;
+	}
+	return 0;
 }
 
 static int check_blocks_one_bitmap(bmap_nr_t bmap, bmap_off_t start_offset,
@@ -1234,7 +1706,8 @@ static int check_blocks_one_bitmap(bmap_nr_t bmap, bmap_off_t start_offset,
 	ret = load_and_lock_bnode(bnode);
 	assert("zam-626", ret == 0);
 
-	assert("nikita-2216", jnode_is_loaded(bnode->wjnode));
+	assert("nikita-2216", ergo(bnode->wjnode != NULL,
+				   jnode_is_loaded(bnode->wjnode)));
 
 	if (desired) {
 		ret = reiser4_find_next_zero_bit(bnode_working_data(bnode),
@@ -1353,31 +1826,110 @@ apply_dset_to_commit_bmap(txn_atom * atom, const reiser4_block_nr * start,
 	/* put bnode into atom's overwrite set */
 	cond_add_to_overwrite_set(atom, bnode->cjnode);
 
+	/* working bitmap keeps the blocks until they are freed there after
+	   commit */
+	bnode_unshare_nofail(bnode);
 	data = bnode_commit_data(bnode);
 
-	ret = bnode_check_crc(bnode);
-	if (ret != 0)
-		return ret;
+	if (list_empty(&bnode->crc_link)) {
+		ret = bnode_check_crc(bnode);
+		if (ret != 0)
+			return ret;
+		/* checksum is recalculated once for all extents of the
+		   atom, by fold_commit_crcs() */
+		list_add_tail(&bnode->crc_link, &get_bitmap_data(sb)->crc_dirty);
+	}
 
 	if (len != NULL) {
 		/* FIXME-ZAM: a check that all bits are set should be there */
 		assert("zam-443",
 		       offset + *len <= bmap_bit_count(sb->s_blocksize));
+		bnode->commit_free += count_set_bits(data, offset,
+						     offset + *len);
 		reiser4_clear_bits(data, offset, (bmap_off_t) (offset + *len));
 
 		(*blocks_freed_p) += *len;
 	} else {
+		if (reiser4_test_bit(offset, data))
+			bnode->commit_free++;
 		reiser4_clear_bit(offset, data);
 		(*blocks_freed_p)++;
 	}
 
-	bnode_set_commit_crc(bnode, bnode_calc_crc(bnode, sb->s_blocksize));
-
 	release_and_unlock_bnode(bnode);
 
 	return 0;
 }
 
+/* an actor which marks blocks of atom's alloc set used in COMMIT bitmap. Unlike
+   the delete set, the alloc set is built of whole allocations, which still may
+   be merged across a boundary of bitmap blocks, so the range is split here */
+static int
+apply_aset_to_commit_bmap(txn_atom * atom, const reiser4_block_nr * start,
+			  const reiser4_block_nr * len, void *data UNUSED_ARG)
+{
+	struct super_block *sb = reiser4_get_current_sb();
+	reiser4_block_nr blk = *start;
+	reiser4_block_nr left = len ? *len : 1;
+	bmap_off_t max_offset = bmap_bit_count(sb->s_blocksize);
+	int ret;
+
+	assert("", atom->stage == ASTAGE_PRE_COMMIT);
+
+	while (left != 0) {
+		struct bitmap_node *bnode;
+		bmap_nr_t bmap;
+		bmap_off_t offset;
+		bmap_off_t end;
+
+		parse_blocknr(&blk, &bmap, &offset);
+		end = offset + min_t(reiser4_block_nr, left,
+				     max_offset - offset);
+
+		bnode = get_bnode(sb, bmap);
+		ret = load_and_lock_bnode(bnode);
+		if (ret)
+			return ret;
+		cond_add_to_overwrite_set(atom, bnode->cjnode);
+		if (list_empty(&bnode->crc_link)) {
+			ret = bnode_check_crc(bnode);
+			if (ret != 0) {
+				release_and_unlock_bnode(bnode);
+				return ret;
+			}
+			list_add_tail(&bnode->crc_link,
+				      &get_bitmap_data(sb)->crc_dirty);
+		}
+		bnode_unshare_nofail(bnode);
+		bnode->commit_free -= end - offset -
+			count_set_bits(bnode_commit_data(bnode), offset, end);
+		reiser4_set_bits(bnode_commit_data(bnode), offset, end);
+		release_and_unlock_bnode(bnode);
+
+		blk += end - offset;
+		left -= end - offset;
+	}
+	return 0;
+}
+
+/* recalculate commit checksums of bitmap blocks changed by
+   apply_dset_to_commit_bmap(), once per block */
+static void fold_commit_crcs(struct super_block *super)
+{
+	struct bitmap_allocator_data *data = get_bitmap_data(super);
+	struct bitmap_node *bnode;
+	struct bitmap_node *next;
+
+	list_for_each_entry_safe(bnode, next, &data->crc_dirty, crc_link) {
+		mutex_lock(&bnode->mutex);
+		list_del_init(&bnode->crc_link);
+		bnode_set_commit_crc(bnode,
+				     bnode_calc_crc(bnode, super->s_blocksize));
+		bnode_try_share(bnode);
+		mutex_unlock(&bnode->mutex);
+	}
+}
+
 /* plugin->u.space_allocator.pre_commit_hook(). */
 /* It just applies transaction changes to fs-wide COMMIT BITMAP, hoping the
    rest is done by transaction manager (allocate wandered locations for COMMIT
@@ -1432,7 +1984,11 @@ int reiser4_pre_commit_hook_bitmap(void)
 				check_bnode_loaded(bn);
 				load_and_lock_bnode(bn);
 
+				bnode_unshare_nofail(bn);
 				byte = *(bnode_commit_data(bn) + index);
+				if (!reiser4_test_bit(offset,
+						      bnode_commit_data(bn)))
+					bn->commit_free--;
 				reiser4_set_bit(offset, bnode_commit_data(bn));
 
 				crc = adler32_recalc(bnode_commit_crc(bn), byte,
@@ -1458,7 +2014,19 @@ int reiser4_pre_commit_hook_bitmap(void)
 		}
 	}
 
+	/* blocks allocated and freed by the same atom are in both sets, the
+	   alloc set has to be applied first */
+	{
+		int ret;
+
+		ret = blocknr_set_iterator(atom, &atom->alloc_set,
+					   apply_aset_to_commit_bmap, NULL, 1);
+		if (ret != 0)
+			return ret;
+	}
+
 	atom_dset_deferred_apply(atom, apply_dset_to_commit_bmap, &blocks_freed, 0);
+	fold_commit_crcs(super);
 
 	blocks_freed -= atom->nr_blocks_allocated;
 
@@ -1475,6 +2043,74 @@ int reiser4_pre_commit_hook_bitmap(void)
 	return 0;
 }
 
+/* Thread loading bitmap blocks after mount with dont_load_bitmap. Blocks
+   are loaded starting from the one the default allocation hint points to,
+   so that those the allocator is going to look at first are loaded first.
+   While it runs, alloc_blocks_forward() prefers loaded bitmap blocks. */
+static int bitmap_loader(void *arg)
+{
+	struct bitmap_allocator_data *data = arg;
+	struct super_block *super = data->super;
+	bmap_nr_t bitmap_blocks_nr = get_nr_bmap(super);
+	bmap_nr_t next_prefetch = 0;
+	bmap_nr_t first;
+	bmap_nr_t i;
+
+	set_freezable();
+	current->journal_info = NULL;
+
+	first = div_u64(get_super_private(super)->blocknr_hint_default,
+			bmap_bit_count(super->s_blocksize));
+	if (first >= bitmap_blocks_nr)
+		first = 0;
+
+	for (i = 0; i < bitmap_blocks_nr && !kthread_should_stop(); i++) {
+		struct bitmap_node *bnode;
+		reiser4_context ctx;
+		int ret;
+
+		bnode = data->bitmap + (first + i) % bitmap_blocks_nr;
+		if (atomic_read(&bnode->loaded))
+			continue;
+
+		init_stack_context(&ctx, super);
+		if (i >= next_prefetch) {
+			/* keep a batch of reads ahead */
+			prefetch_bnodes(super, first + i,
+					2 * REISER4_PREFETCH_BATCH);
+			next_prefetch = i + REISER4_PREFETCH_BATCH;
+		}
+		ret = load_and_lock_bnode(bnode);
+		if (ret == 0) {
+			if (bnode_check_crc(bnode))
+				warning("", "%s: bitmap block %llu is corrupted",
+					super->s_id, (unsigned long long)
+					(bnode - data->bitmap));
+			release_and_unlock_bnode(bnode);
+		}
+		reiser4_exit_context(&ctx);
+		if (ret) {
+			/* leave the rest to the allocation path */
+			warning("", "%s: bitmap loading stopped: %d",
+				super->s_id, ret);
+			break;
+		}
+		cond_resched();
+		try_to_freeze();
+	}
+	WRITE_ONCE(data->loading, 0);
+
+	/* kthread_stop() expects the thread to exist */
+	while (1) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (kthread_should_stop())
+			break;
+		schedule();
+	}
+	__set_current_state(TASK_RUNNING);
+	return 0;
+}
+
 /* plugin->u.space_allocator.init_allocator
     constructor of reiser4_space_allocator object. It is called on fs mount */
 int reiser4_init_allocator_bitmap(reiser4_space_allocator * allocator,
@@ -1513,6 +2149,11 @@ int reiser4_init_allocator_bitmap(reiser4_space_allocator * allocator,
 
 	for (i = 0; i < bitmap_blocks_nr; i++)
 		init_bnode(data->bitmap + i, super, i);
+	data->super = super;
+	data->loader = NULL;
+	data->loading = 0;
+	INIT_LIST_HEAD(&data->crc_dirty);
+	atomic_set(&data->nr_summary, 0);
 
 	allocator->u.generic = data;
 
@@ -1532,6 +2173,10 @@ int reiser4_init_allocator_bitmap(reiser4_space_allocator * allocator,
 		start_time = jiffies;
 
 		for (i = 0; i < bitmap_blocks_nr; i++) {
+			if (i % REISER4_PREFETCH_BATCH == 0)
+				/* keep a batch of reads ahead */
+				prefetch_bnodes(super, i,
+						2 * REISER4_PREFETCH_BATCH);
 			bnode = data->bitmap + i;
 			ret = load_and_lock_bnode(bnode);
 			if (ret) {
@@ -1546,11 +2191,84 @@ int reiser4_init_allocator_bitmap(reiser4_space_allocator * allocator,
 		if (REISER4_DEBUG)
 			printk("...done (%llu jiffies)\n",
 			       (unsigned long long)elapsed_time);
+	} else if (!sb_rdonly(super)) {
+		/* Load bitmap blocks in background instead. */
+		data->loading = 1;
+		data->loader = kthread_run(bitmap_loader, data, "bmapload:%s",
+					   super->s_id);
+		if (IS_ERR(data->loader)) {
+			warning("", "%s: cannot start bitmap loader: %ld",
+				super->s_id, PTR_ERR(data->loader));
+			data->loader = NULL;
+			data->loading = 0;
+		}
 	}
 
 	return 0;
 }
 
+/* print "<minimal length> <extents> <blocks>" for free extents of WORKING
+   bitmap with length in [2^n, 2^(n+1)[, then the number of bitmap blocks
+   which are not loaded and thus not accounted */
+static int free_extents_show(struct seq_file *m, void *unused)
+{
+	struct bitmap_allocator_data *data = m->private;
+	struct super_block *super = data->super;
+	const bmap_off_t max_offset = bmap_bit_count(super->s_blocksize);
+	unsigned long nr[BITS_PER_TYPE(bmap_off_t)] = { 0 };
+	__u64 blocks[BITS_PER_TYPE(bmap_off_t)] = { 0 };
+	bmap_nr_t bitmap_blocks_nr = get_nr_bmap(super);
+	bmap_nr_t unloaded = 0;
+	bmap_nr_t i;
+	int n;
+
+	for (i = 0; i < bitmap_blocks_nr; i++) {
+		struct bitmap_node *bnode = data->bitmap + i;
+		bmap_off_t start = 0;
+		bmap_off_t end;
+		char *bits;
+
+		if (!atomic_read(&bnode->loaded)) {
+			unloaded++;
+			continue;
+		}
+		mutex_lock(&bnode->mutex);
+		bits = bnode_working_data(bnode);
+		while (1) {
+			start = reiser4_find_next_zero_bit((long *)bits,
+							   max_offset, start);
+			if (start >= max_offset)
+				break;
+			end = reiser4_find_next_set_bit(bits, max_offset,
+							start);
+			if (end > max_offset)
+				end = max_offset;
+			n = fls(end - start) - 1;
+			nr[n]++;
+			blocks[n] += end - start;
+			start = end;
+		}
+		mutex_unlock(&bnode->mutex);
+		cond_resched();
+	}
+	for (n = 0; n < ARRAY_SIZE(nr); n++)
+		if (nr[n] != 0)
+			seq_printf(m, "%lu %lu %llu\n", 1ul << n, nr[n],
+				   (unsigned long long)blocks[n]);
+	seq_printf(m, "unloaded %llu\n", (unsigned long long)unloaded);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(free_extents);
+
+/* sa_debugfs_init()
+   exports free extent histogram. It is called on fs mount */
+void reiser4_debugfs_init_bitmap(reiser4_space_allocator * allocator,
+				 struct dentry *root)
+{
+	debugfs_create_file("free_extents", S_IFREG | S_IRUSR, root,
+			    allocator->u.generic, &free_extents_fops);
+}
+
 /* plugin->u.space_allocator.destroy_allocator
    destructor. It is called on fs unmount */
 int reiser4_destroy_allocator_bitmap(reiser4_space_allocator * allocator,
@@ -1564,6 +2282,11 @@ int reiser4_destroy_allocator_bitmap(reiser4_space_allocator * allocator,
 	assert("zam-414", data != NULL);
 	assert("zam-376", data->bitmap != NULL);
 
+	if (data->loader != NULL) {
+		kthread_stop(data->loader);
+		data->loader = NULL;
+	}
+
 	bitmap_blocks_nr = get_nr_bmap(super);
 
 	for (i = 0; i < bitmap_blocks_nr; i++) {
@@ -1577,11 +2300,13 @@ int reiser4_destroy_allocator_bitmap(reiser4_space_allocator * allocator,
 			jnode *cj = bnode->cjnode;
 
 			assert("zam-480", jnode_page(cj) != NULL);
-			assert("zam-633", jnode_page(wj) != NULL);
+			assert("zam-633", ergo(wj != NULL,
+					       jnode_page(wj) != NULL));
 
 			assert("zam-634",
-			       memcmp(jdata(wj), jdata(wj),
-				      bmap_size(super->s_blocksize)) == 0);
+			       ergo(wj != NULL,
+				    memcmp(jdata(wj), jdata(wj),
+					   bmap_size(super->s_blocksize)) == 0));
 
 		}
 #endif
@@ -1597,6 +2322,255 @@ int reiser4_destroy_allocator_bitmap(reiser4_space_allocator * allocator,
 	return 0;
 }
 
+/* Summary of bitmap blocks.
+
+   With dont_load_bitmap nothing is known about a bitmap block until it is
+   loaded: all its blocks are assumed free. On a file system which is nearly
+   full, allocations done right after mount read one full bitmap block after
+   another before bitmap_loader() gets to them.
+
+   To avoid that, at umount nr_free and max_free_run of all bitmap blocks are
+   stored in black box items, and at the next mount they are set to bitmap
+   blocks which are not loaded yet, so that bitmap_alloc_forward() and
+   bitmap_alloc_backward() skip full and fragmented ones right away. The
+   items are removed at mount, so that a summary is used once.
+
+   Summary is a hint. It is ignored if the free block counter of the super
+   block changed by more than storing of the summary could change it. When a
+   bitmap block is loaded, its summary is replaced by exact nr_free, and if
+   allocation fails, summaries of bitmap blocks which are still not loaded
+   are dropped and allocation is repeated, so that summary written before
+   file system was modified by a kernel not knowing about it only affects
+   block placement.
+
+   Item with offset 0 is struct summary_head. It is followed by nr_items
+   items of struct summary_entry, one per bitmap block, in the order of
+   bitmap blocks. */
+
+#define SUMMARY_MAGIC (0x52344253)	/* "R4BS" */
+
+struct summary_head {
+	d32 magic;
+	d32 nr_items;
+	d64 nr_bmap;
+	/* free block counter when summary was taken */
+	d64 free_blocks;
+} PACKED;
+
+struct summary_entry {
+	d32 nr_free;
+	d32 max_free_run;
+} PACKED;
+
+/* summary items are in the locality next to the one of safe-links */
+static reiser4_key *summary_key(struct super_block *super, __u64 nr,
+				reiser4_key *key)
+{
+	oid_t root = get_key_objectid(get_super_private(super)->df_plug->
+				      root_dir_key(super));
+
+	reiser4_key_init(key);
+	set_key_locality(key, root + 2);
+	set_key_offset(key, nr);
+	return key;
+}
+
+/* number of bitmap blocks summary item is for */
+static unsigned summary_per_item(struct super_block *super)
+{
+	return (super->s_blocksize / 2) / sizeof(struct summary_entry);
+}
+
+static int summary_store(struct super_block *super, __u64 nr, void *body,
+			 int len)
+{
+	reiser4_tree *tree = &get_super_private(super)->tree;
+	reiser4_key key;
+	int ret;
+
+	summary_key(super, nr, &key);
+	ret = store_black_box(tree, &key, body, len);
+	if (ret == -EEXIST) {
+		/* left by mount which could not remove it */
+		ret = kill_black_box(tree, &key);
+		if (ret == 0)
+			ret = store_black_box(tree, &key, body, len);
+	}
+	return ret;
+}
+
+/* how much disk space storing of summary takes at most */
+static __u64 summary_tograb(struct super_block *super, __u64 nr_items)
+{
+	return (nr_items + 1) *
+		estimate_one_insert_item(&get_super_private(super)->tree);
+}
+
+/* sa_save_summary()
+   stores summary of bitmap blocks and commits it. It is called on umount of
+   file system mounted with dont_load_bitmap, when everything else is
+   committed already */
+void reiser4_save_summary_bitmap(reiser4_space_allocator * allocator,
+				 struct super_block *super)
+{
+	struct bitmap_allocator_data *data = allocator->u.generic;
+	bmap_nr_t bitmap_blocks_nr = get_nr_bmap(super);
+	unsigned per_item = summary_per_item(super);
+	struct summary_entry *entries;
+	struct summary_head head;
+	__u64 nr_items;
+	__u64 n;
+	int ret;
+
+	if (sb_rdonly(super) ||
+	    !reiser4_is_set(super, REISER4_DONT_LOAD_BITMAP))
+		return;
+
+	nr_items = div_u64(bitmap_blocks_nr + per_item - 1, per_item);
+	put_unaligned(cpu_to_le32(SUMMARY_MAGIC), &head.magic);
+	put_unaligned(cpu_to_le32(nr_items), &head.nr_items);
+	put_unaligned(cpu_to_le64(bitmap_blocks_nr), &head.nr_bmap);
+	put_unaligned(cpu_to_le64(reiser4_free_blocks(super)),
+		      &head.free_blocks);
+
+	entries = kmalloc(per_item * sizeof(*entries),
+			  reiser4_ctx_gfp_mask_get());
+	if (entries == NULL)
+		return;
+	grab_space_enable();
+	ret = reiser4_grab_space_force(summary_tograb(super, nr_items),
+				       BA_RESERVED);
+	for (n = 0; n < nr_items && ret == 0; n++) {
+		bmap_nr_t first = n * per_item;
+		unsigned count = min_t(bmap_nr_t, per_item,
+				       bitmap_blocks_nr - first);
+		unsigned i;
+
+		for (i = 0; i < count; i++) {
+			struct bitmap_node *bnode = data->bitmap + first + i;
+
+			put_unaligned(cpu_to_le32(READ_ONCE(bnode->nr_free)),
+				      &entries[i].nr_free);
+			put_unaligned(cpu_to_le32(READ_ONCE(
+						  bnode->max_free_run)),
+				      &entries[i].max_free_run);
+		}
+		ret = summary_store(super, n + 1, entries,
+				    count * sizeof(*entries));
+	}
+	kfree(entries);
+	/* head goes last, so that summary without some items is not used */
+	if (ret == 0)
+		ret = summary_store(super, 0, &head, sizeof(head));
+	if (ret == 0)
+		ret = txnmgr_force_commit_all(super, 1);
+	if (ret != 0 && ret != -ENOSPC)
+		warning("", "%s: failed to store bitmap summary: %d",
+			super->s_id, ret);
+}
+
+/* set summary of @count bitmap blocks starting from @first to those which
+   are not loaded yet */
+static void summary_apply(struct bitmap_allocator_data *data,
+			  bmap_nr_t first, const struct summary_entry *entries,
+			  unsigned count)
+{
+	const bmap_off_t max_offset = bmap_bit_count(data->super->s_blocksize);
+	unsigned i;
+
+	for (i = 0; i < count; i++) {
+		struct bitmap_node *bnode = data->bitmap + first + i;
+		bmap_off_t nr_free;
+		bmap_off_t max_free_run;
+
+		nr_free = le32_to_cpu(get_unaligned(&entries[i].nr_free));
+		max_free_run =
+			le32_to_cpu(get_unaligned(&entries[i].max_free_run));
+		if (nr_free > max_offset || max_free_run > max_offset)
+			continue;
+		mutex_lock(&bnode->mutex);
+		if (!atomic_read(&bnode->loaded)) {
+			WRITE_ONCE(bnode->nr_free, nr_free);
+			WRITE_ONCE(bnode->max_free_run, max_free_run);
+			if (!bnode->summary) {
+				bnode->summary = 1;
+				atomic_inc(&data->nr_summary);
+			}
+		}
+		mutex_unlock(&bnode->mutex);
+	}
+}
+
+/* sa_load_summary()
+   uses and removes summary stored by reiser4_save_summary_bitmap(). It is
+   called on mount */
+void reiser4_load_summary_bitmap(reiser4_space_allocator * allocator,
+				 struct super_block *super)
+{
+	struct bitmap_allocator_data *data = allocator->u.generic;
+	reiser4_tree *tree = &get_super_private(super)->tree;
+	bmap_nr_t bitmap_blocks_nr = get_nr_bmap(super);
+	unsigned per_item = summary_per_item(super);
+	struct summary_entry *entries;
+	struct summary_head head;
+	reiser4_key key;
+	reiser4_key last;
+	__u64 nr_items;
+	__u64 free_blocks;
+	__u64 slack;
+	__u64 n;
+	int use;
+	int ret;
+
+	if (sb_rdonly(super))
+		return;
+	ret = load_black_box(tree, summary_key(super, 0, &key), &head,
+			     sizeof(head), 1);
+	if (ret != 0)
+		return;
+
+	nr_items = 0;
+	if (le32_to_cpu(get_unaligned(&head.magic)) == SUMMARY_MAGIC)
+		nr_items = le32_to_cpu(get_unaligned(&head.nr_items));
+	free_blocks = le64_to_cpu(get_unaligned(&head.free_blocks));
+	slack = summary_tograb(super, nr_items);
+	use = reiser4_is_set(super, REISER4_DONT_LOAD_BITMAP) &&
+		nr_items != 0 &&
+		le64_to_cpu(get_unaligned(&head.nr_bmap)) == bitmap_blocks_nr &&
+		nr_items == div_u64(bitmap_blocks_nr + per_item - 1, per_item) &&
+		reiser4_free_blocks(super) <= free_blocks + slack &&
+		free_blocks <= reiser4_free_blocks(super) + slack;
+
+	entries = NULL;
+	if (use)
+		entries = kmalloc(per_item * sizeof(*entries),
+				  reiser4_ctx_gfp_mask_get());
+	for (n = 0; n < nr_items && entries != NULL; n++) {
+		bmap_nr_t first = n * per_item;
+		unsigned count = min_t(bmap_nr_t, per_item,
+				       bitmap_blocks_nr - first);
+
+		if (load_black_box(tree, summary_key(super, n + 1, &key),
+				   entries, count * sizeof(*entries), 1))
+			break;
+		summary_apply(data, first, entries, count);
+	}
+	kfree(entries);
+
+	/* items left by summary of other size go too */
+	grab_space_enable();
+	ret = reiser4_grab_space_force((nr_items + 1) *
+				       estimate_one_item_removal(tree),
+				       BA_RESERVED);
+	if (ret == 0)
+		ret = reiser4_cut_tree(tree, summary_key(super, 0, &key),
+				       summary_key(super, ~0ull, &last), NULL,
+				       1);
+	if (ret != 0)
+		warning("", "%s: failed to remove bitmap summary: %d",
+			super->s_id, ret);
+}
+
 /*
  * Local variables:
  * c-indentation-style: "K&R"
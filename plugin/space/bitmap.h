@@ -25,6 +25,15 @@ extern void reiser4_dealloc_blocks_bitmap(reiser4_space_allocator *,
 					  reiser4_block_nr,
 					  reiser4_block_nr);
 extern int reiser4_pre_commit_hook_bitmap(void);
+extern void reiser4_debugfs_init_bitmap(reiser4_space_allocator *,
+					struct dentry *);
+extern int reiser4_trim_bitmap(reiser4_space_allocator *, reiser4_block_nr,
+			       reiser4_block_nr, reiser4_block_nr,
+			       reiser4_block_nr *);
+extern void reiser4_save_summary_bitmap(reiser4_space_allocator *,
+					struct super_block *);
+extern void reiser4_load_summary_bitmap(reiser4_space_allocator *,
+					struct super_block *);
 
 #define reiser4_post_commit_hook_bitmap() do{}while(0)
 #define reiser4_post_write_back_hook_bitmap() do{}while(0)
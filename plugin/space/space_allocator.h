@@ -52,6 +52,27 @@ static inline void sa_post_write_back_hook (void) 									\
 static inline void sa_print_info(const char * prefix, reiser4_space_allocator * al)					\
 {															\
 	reiser4_print_info_##allocator (prefix, al);                                                                    \
+}															\
+															\
+static inline void sa_debugfs_init(reiser4_space_allocator * al, struct dentry *root)					\
+{															\
+	reiser4_debugfs_init_##allocator (al, root);									\
+}															\
+															\
+static inline int sa_trim(reiser4_space_allocator * al, reiser4_block_nr start, reiser4_block_nr end,			\
+			  reiser4_block_nr min_len, reiser4_block_nr * trimmed)						\
+{															\
+	return reiser4_trim_##allocator (al, start, end, min_len, trimmed);						\
+}															\
+															\
+static inline void sa_save_summary(reiser4_space_allocator * al, struct super_block *s)					\
+{															\
+	reiser4_save_summary_##allocator (al, s);									\
+}															\
+															\
+static inline void sa_load_summary(reiser4_space_allocator * al, struct super_block *s)					\
+{															\
+	reiser4_load_summary_##allocator (al, s);									\
 }
 
 DEF_SPACE_ALLOCATOR(bitmap)
@@ -11,6 +11,8 @@
  *  never store file in formatted nodes
  *  always store file in formatted nodes
  *  store file in formatted nodes if file is smaller than 4 blocks (default)
+ *  store file in formatted nodes if file is smaller than 4 blocks, but pack
+ *  file of extents into formatted nodes only if it pays off (smart)
  */
 
 #include "../tree.h"
@@ -65,6 +67,36 @@ have_formatting_default(const struct inode *inode UNUSED_ARG
 	return 1;
 }
 
+/*
+ * Like the default policy, but file of extents is packed into tails only if
+ * saved space justifies the conversion. Such file is packed if it has not
+ * been longer than 4 blocks since its inode was loaded (otherwise it shrank
+ * and likely grows again, and the default policy would make it bounce between
+ * tails and extents), and if the unused space of its last block, which is what
+ * tails save, exceeds the data to be moved.
+ */
+static int have_formatting_smart(const struct inode *inode, loff_t size)
+{
+	const loff_t threshold = inode->i_sb->s_blocksize * 4;
+	struct unix_file_info *uf_info;
+	loff_t slack;
+
+	assert("", inode_file_plugin(inode) ==
+	       file_plugin_by_id(UNIX_FILE_PLUGIN_ID));
+
+	if (size > threshold)
+		return 0;
+	uf_info = unix_file_inode_data(inode);
+	if (uf_info->container != UF_CONTAINER_EXTENTS)
+		return 1;
+
+	slack = round_up(size, inode->i_sb->s_blocksize) - size;
+	if (uf_info->max_size <= threshold && slack > size)
+		return 1;
+	atomic_inc(&get_super_private(inode->i_sb)->nr_packs_avoided);
+	return 0;
+}
+
 /* tail plugins */
 formatting_plugin formatting_plugins[LAST_TAIL_FORMATTING_ID] = {
 	[NEVER_TAILS_FORMATTING_ID] = {
@@ -99,6 +131,18 @@ formatting_plugin formatting_plugins[LAST_TAIL_FORMATTING_ID] = {
 			.linkage = {NULL, NULL}
 		},
 		.have_tail = have_formatting_default
+	},
+	[SMART_FORMATTING_ID] = {
+		.h = {
+			.type_id = REISER4_FORMATTING_PLUGIN_TYPE,
+			.id = SMART_FORMATTING_ID,
+			.pops = NULL,
+			.label = "smart",
+			.desc = "store short files in tail items, avoid "
+				"conversions which do not pay off",
+			.linkage = {NULL, NULL}
+		},
+		.have_tail = have_formatting_smart
 	}
 };
 
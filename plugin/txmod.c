@@ -7,6 +7,7 @@
 #include "../block_alloc.h"
 #include "../reiser4.h"
 #include "../flush.h"
+#include "../inode.h"
 
 /*
  * This file contains implementation of different transaction models.
@@ -84,7 +85,7 @@ static void mark_jnode_overwrite(struct list_head *jnodes, jnode *node);
 int split_allocated_extent(coord_t *coord, reiser4_block_nr pos_in_unit);
 int allocated_extent_slum_size(flush_pos_t *flush_pos, oid_t oid,
 			       unsigned long index, unsigned long count);
-void allocate_blocks_unformatted(reiser4_blocknr_hint *preceder,
+void allocate_blocks_unformatted(reiser4_blocknr_hint *preceder, oid_t oid,
 				 reiser4_block_nr wanted_count,
 				 reiser4_block_nr *first_allocated,
 				 reiser4_block_nr *allocated,
@@ -156,6 +157,7 @@ static void jnode_make_reloc_nolock(flush_queue_t * fq, jnode * node)
 	assert("zam-920", !JF_ISSET(node, JNODE_FLUSH_QUEUED));
 	assert("nikita-3367", !reiser4_blocknr_is_fake(jnode_get_block(node)));
 	jnode_set_reloc(node);
+	reiser4_stat_inc(jnode_get_tree(node)->super, REISER4_STAT_RELOCATIONS);
 }
 
 /*
@@ -276,7 +278,7 @@ static int forward_relocate_unformatted(flush_pos_t *flush_pos,
 	/*
 	 * allocate new block numbers for protected nodes
 	 */
-	allocate_blocks_unformatted(reiser4_pos_hint(flush_pos),
+	allocate_blocks_unformatted(reiser4_pos_hint(flush_pos), oid,
 				    protected,
 				    &first_allocated, &allocated,
 				    block_stage);
@@ -373,7 +375,7 @@ static squeeze_result squeeze_relocate_unformatted(znode *left,
 	/*
 	 * allocate new block numbers for protected nodes
 	 */
-	allocate_blocks_unformatted(reiser4_pos_hint(flush_pos),
+	allocate_blocks_unformatted(reiser4_pos_hint(flush_pos), oid,
 				    protected,
 				    &first_allocated, &allocated,
 				    block_stage);
@@ -715,7 +717,9 @@ static int forward_try_defragment_locality(znode * node,
 		uber = uber_lock.node;
 
 		write_lock_tree(tree);
+		write_seqcount_begin(&tree->root_seq);
 		tree->root_block = blk;
+		write_seqcount_end(&tree->root_seq);
 		write_unlock_tree(tree);
 
 		znode_make_dirty(uber);
@@ -1180,6 +1184,152 @@ static squeeze_result squeeze_alloc_unformatted_wa(znode *left,
 	return ret;
 }
 
+/**********************  ADAPTIVE TRANSACTION MODEL  *************************/
+
+/*
+ * Adaptive transaction model handles formatted nodes as the hybrid one, and
+ * chooses between overwrite and relocation of allocated unformatted nodes
+ * per slum, by how the file is written. Bodies of files which are mostly
+ * overwritten (databases, images of virtual machines) keep their place on
+ * disk and are journalled, bodies of files which are appended to or
+ * written anew are relocated next to their preceder.
+ */
+
+/**
+ * reiser4_txmod_count_write - note pages written to a file
+ * @inode: file being written
+ * @pos: offset of write
+ * @count: number of bytes written
+ *
+ * This is called by write of extents with i_rwsem held.
+ */
+void reiser4_txmod_count_write(struct inode *inode, loff_t pos, size_t count)
+{
+	reiser4_inode *info = reiser4_inode_data(inode);
+	pgoff_t start = pos >> PAGE_SHIFT;
+	pgoff_t size = (i_size_read(inode) + PAGE_SIZE - 1) >> PAGE_SHIFT;
+	unsigned long nr = ((pos + count - 1) >> PAGE_SHIFT) - start + 1;
+	unsigned long over;
+	unsigned long overwrites;
+	unsigned long appends;
+
+	if (count == 0)
+		return;
+	over = (size > start) ? min_t(unsigned long, size - start, nr) : 0;
+	overwrites = READ_ONCE(info->overwrites) + over;
+	appends = READ_ONCE(info->appends) + nr - over;
+	if (overwrites + appends > REISER4_TXMOD_ADAPTIVE_WINDOW) {
+		/* forget old writes gradually */
+		overwrites /= 2;
+		appends /= 2;
+	}
+	WRITE_ONCE(info->overwrites, overwrites);
+	WRITE_ONCE(info->appends, appends);
+}
+
+/* true if slum of allocated nodes of file @oid starting at @index is to be
+   relocated */
+static int adaptive_relocate(flush_pos_t *flush_pos, oid_t oid, __u64 index)
+{
+	jnode *node;
+	int relocate = flush_pos->leaf_relocate;
+
+	/* the inode is found through the page of the first node of the
+	   slum, which is dirty and keeps the inode from eviction */
+	node = jlookup(current_tree, oid, index);
+	if (node != NULL) {
+		reiser4_inode *info;
+		unsigned long overwrites;
+		unsigned long appends;
+
+		info = reiser4_inode_data(jnode_get_mapping(node)->host);
+		overwrites = READ_ONCE(info->overwrites);
+		appends = READ_ONCE(info->appends);
+		if (overwrites + appends != 0)
+			relocate = overwrites * 100 <
+				REISER4_TXMOD_ADAPTIVE_OVERWRITE_PERCENT *
+				(overwrites + appends);
+		jput(node);
+	}
+	reiser4_stat_inc(reiser4_get_current_sb(), relocate ?
+			 REISER4_STAT_ADAPTIVE_RELOCATES :
+			 REISER4_STAT_ADAPTIVE_OVERWRITES);
+	return relocate;
+}
+
+static int forward_alloc_unformatted_adaptive(flush_pos_t *flush_pos)
+{
+	coord_t *coord;
+	reiser4_extent *ext;
+	oid_t oid;
+	__u64 index;
+	__u64 width;
+	extent_state state;
+	reiser4_key key;
+
+	assert("", flush_pos->state == POS_ON_EPOINT);
+	assert("", coord_is_existing_unit(&flush_pos->coord)
+	       && item_is_extent(&flush_pos->coord));
+
+	coord = &flush_pos->coord;
+
+	ext = extent_by_coord(coord);
+	state = state_of_extent(ext);
+	if (state == HOLE_EXTENT) {
+		flush_pos->state = POS_INVALID;
+		return 0;
+	}
+	item_key_by_coord(coord, &key);
+	oid = get_key_objectid(&key);
+	index = extent_unit_index(coord) + flush_pos->pos_in_unit;
+	width = extent_get_width(ext);
+
+	assert("", width > flush_pos->pos_in_unit);
+
+	if (state == UNALLOCATED_EXTENT ||
+	    adaptive_relocate(flush_pos, oid, index)) {
+		int exit;
+		int result;
+		result = forward_relocate_unformatted(flush_pos, ext, state,
+						      oid,
+						      index, width, &exit);
+		if (exit)
+			return result;
+	} else
+		forward_overwrite_unformatted(flush_pos, oid, index, width);
+
+	flush_pos->pos_in_unit = 0;
+	return 0;
+}
+
+static squeeze_result squeeze_alloc_unformatted_adaptive(znode *left,
+							 const coord_t *coord,
+							 flush_pos_t *flush_pos,
+							 reiser4_key *stop_key)
+{
+	squeeze_result ret;
+	reiser4_key key;
+	reiser4_extent *ext;
+	extent_state state;
+
+	ext = extent_by_coord(coord);
+	state = state_of_extent(ext);
+
+	if (state == UNALLOCATED_EXTENT ||
+	    (state == ALLOCATED_EXTENT &&
+	     adaptive_relocate(flush_pos,
+			       get_key_objectid(item_key_by_coord(coord, &key)),
+			       extent_unit_index(coord))))
+		ret = squeeze_relocate_unformatted(left, coord,
+						   flush_pos, &key, stop_key);
+	else
+		ret = squeeze_overwrite_unformatted(left, coord,
+						    flush_pos, &key, stop_key);
+	if (ret == SQUEEZE_CONTINUE)
+		*stop_key = key;
+	return ret;
+}
+
 /******************************************************************************/
 
 txmod_plugin txmod_plugins[LAST_TXMOD_ID] = {
@@ -1224,6 +1374,20 @@ txmod_plugin txmod_plugins[LAST_TXMOD_ID] = {
 		.reverse_alloc_formatted = NULL,
 		.forward_alloc_unformatted = forward_alloc_unformatted_wa,
 		.squeeze_alloc_unformatted = squeeze_alloc_unformatted_wa
+	},
+	[ADAPTIVE_TXMOD_ID] = {
+		.h = {
+			.type_id = REISER4_TXMOD_PLUGIN_TYPE,
+			.id = ADAPTIVE_TXMOD_ID,
+			.pops = NULL,
+			.label = "adaptive",
+			.desc =	"Adaptive Transaction Model",
+			.linkage = {NULL, NULL}
+		},
+		.forward_alloc_formatted = forward_alloc_formatted_hybrid,
+		.reverse_alloc_formatted = reverse_alloc_formatted_hybrid,
+		.forward_alloc_unformatted = forward_alloc_unformatted_adaptive,
+		.squeeze_alloc_unformatted = squeeze_alloc_unformatted_adaptive
 	}
 };
 
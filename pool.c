@@ -78,7 +78,8 @@ void reiser4_init_pool(struct reiser4_pool *pool /* pool to initialize */ ,
 	INIT_LIST_HEAD(&pool->free);
 	INIT_LIST_HEAD(&pool->used);
 	INIT_LIST_HEAD(&pool->extra);
-	memset(data, 0, obj_size * num_of_objs);
+	/* bodies of objects are cleared by reiser4_pool_alloc(), only
+	   headers are initialized here */
 	for (i = 0; i < num_of_objs; ++i) {
 		h = (struct reiser4_pool_header *) (data + i * obj_size);
 		reiser4_init_pool_obj(h);
@@ -8,12 +8,17 @@
 #include "inode.h"
 #include "key.h"
 #include "znode.h"
+#include "coord.h"
+#include "plugin/item/item.h"
+#include "plugin/object.h"
 
 #include <linux/swap.h>		/* for totalram_pages */
+#include <linux/pagemap.h>
 
 void reiser4_init_ra_info(ra_info_t *rai)
 {
 	rai->key_to_stop = *reiser4_min_key();
+	rai->window = 0;
 }
 
 /* global formatted node readahead parameter. It can be set by mount option
@@ -46,11 +51,86 @@ static int low_on_memory(void)
 	return freepages < (totalram_pages() * LOW_MEM_PERCENTAGE / 100);
 }
 
+/* Formatted readahead window adapts to how well it works for the tree: nodes
+   whose reads readahead starts are marked JNODE_READAHEAD. When such a node
+   is loaded, readahead guessed right and the window grows by one node. When
+   it is evicted, never loaded, the read was wasted and the window is halved.
+   So scattered lookups quickly stop reading neighbors, and sequential scans
+   slowly open the window up to formatted_ra_params.max */
+
+/* mark @node, which is not in memory, as being read by readahead */
+static void mark_readahead(znode *node)
+{
+	if (znode_page(node) == NULL) {
+		JF_SET(ZJNODE(node), JNODE_READAHEAD);
+		reiser4_stat_inc(znode_get_tree(node)->super,
+				 REISER4_STAT_READAHEAD);
+	}
+}
+
+static struct formatted_ra_params *ra_params_of(jnode *node)
+{
+	return &get_super_private(jnode_get_tree(node)->super)->ra_params;
+}
+
+/**
+ * reiser4_ra_hit - count load of node read by readahead
+ * @node: node being loaded
+ *
+ * This is called by jload() of a node marked JNODE_READAHEAD.
+ */
+void reiser4_ra_hit(jnode *node)
+{
+	struct formatted_ra_params *params;
+	unsigned long window;
+
+	if (!JF_TEST_AND_CLEAR(node, JNODE_READAHEAD))
+		return;
+	params = ra_params_of(node);
+	atomic_inc(&params->hits);
+	window = READ_ONCE(params->window);
+	if (window < params->max)
+		WRITE_ONCE(params->window, window + 1);
+}
+
+/**
+ * reiser4_ra_wasted - count eviction of node read by readahead in vain
+ * @node: node whose page is being released
+ *
+ * This is called when a node marked JNODE_READAHEAD loses its page.
+ */
+void reiser4_ra_wasted(jnode *node)
+{
+	struct formatted_ra_params *params;
+	unsigned long window;
+
+	if (!JF_TEST_AND_CLEAR(node, JNODE_READAHEAD))
+		return;
+	params = ra_params_of(node);
+	atomic_inc(&params->wasted);
+	window = READ_ONCE(params->window) / 2;
+	WRITE_ONCE(params->window, max_t(unsigned long, window,
+					 REISER4_RA_WINDOW_MIN));
+}
+
+/* start reads of @nr referenced znodes in one batch and drop references */
+static void submit_ra_batch(znode **batch, int nr)
+{
+	int i;
+
+	zload_prefetch_batch(batch, nr);
+	for (i = 0; i < nr; i++)
+		zput(batch[i]);
+}
+
 /* start read for @node and for a few of its right neighbors */
 void formatted_readahead(znode * node, ra_info_t *info)
 {
 	struct formatted_ra_params *ra_params;
+	znode *batch[REISER4_PREFETCH_BATCH];
 	znode *cur;
+	unsigned long max;
+	int nr;
 	int i;
 	int grn_flags;
 	lock_handle next_lh;
@@ -61,16 +141,20 @@ void formatted_readahead(znode * node, ra_info_t *info)
 		return;
 
 	ra_params = get_current_super_ra_params();
+	max = min(ra_params->max, READ_ONCE(ra_params->window));
+	if (info->window != 0)
+		max = min(max, info->window);
 
+	nr = 0;
 	if (znode_page(node) == NULL)
-		jstartio(ZJNODE(node));
+		batch[nr++] = zref(node);
 
 	if (znode_get_level(node) != LEAF_LEVEL)
-		return;
+		goto out;
 
 	/* don't waste memory for read-ahead when low on memory */
 	if (low_on_memory())
-		return;
+		goto out;
 
 	/* We can have locked nodes on upper tree levels, in this situation lock
 	   priorities do not help to resolve deadlocks, we have to use TRY_LOCK
@@ -80,7 +164,7 @@ void formatted_readahead(znode * node, ra_info_t *info)
 	i = 0;
 	cur = zref(node);
 	init_lh(&next_lh);
-	while (i < ra_params->max) {
+	while (i < max) {
 		const reiser4_block_nr * nextblk;
 
 		if (!should_readahead_neighbor(cur, info))
@@ -99,17 +183,364 @@ void formatted_readahead(znode * node, ra_info_t *info)
 		zput(cur);
 		cur = zref(next_lh.node);
 		done_lh(&next_lh);
-		if (znode_page(cur) == NULL)
-			jstartio(ZJNODE(cur));
-		else
+		i++;
+		if (znode_page(cur) != NULL) {
+			if (info->window != 0)
+				/* slide the window: read what is behind
+				 * nodes read already */
+				continue;
 			/* Do not scan read-ahead window if pages already
 			 * allocated (and i/o already started). */
 			break;
+		}
 
-		i++;
+		/* reads are submitted after the neighbor lock is released */
+		mark_readahead(cur);
+		batch[nr++] = zref(cur);
+		if (nr == REISER4_PREFETCH_BATCH) {
+			submit_ra_batch(batch, nr);
+			nr = 0;
+		}
 	}
 	zput(cur);
 	done_lh(&next_lh);
+ out:
+	submit_ra_batch(batch, nr);
+}
+
+/**
+ * reiser4_prefetch_children - start reads of children of a twig node
+ * @coord: internal item of locked and loaded twig node
+ * @info: readahead information of tree lookup
+ *
+ * This is called by tree lookup just before it descends from twig level to
+ * the child @coord points to. Reads of that child and of children of the
+ * following internal items with keys not greater than @info->key_to_stop are
+ * submitted in one batch, so that readdir and other scans with readahead do
+ * not read leaves one by one. Extent items are skipped.
+ */
+void reiser4_prefetch_children(const coord_t *coord, ra_info_t *info)
+{
+	struct formatted_ra_params *params;
+	znode *batch[REISER4_PREFETCH_BATCH];
+	reiser4_key key;
+	coord_t scan;
+	int max;
+	int nr;
+
+	assert("", znode_get_level(coord->node) == TWIG_LEVEL);
+
+	/* no readahead was asked for */
+	if (keyeq(&info->key_to_stop, reiser4_min_key()))
+		return;
+	params = get_current_super_ra_params();
+	max = min_t(unsigned long,
+		    min(params->max, READ_ONCE(params->window)) + 1,
+		    REISER4_PREFETCH_BATCH);
+	if (info->window != 0)
+		max = min_t(unsigned long, max, info->window + 1);
+	if (low_on_memory())
+		return;
+
+	nr = 0;
+	coord_dup(&scan, coord);
+	do {
+		znode *child;
+
+		if (!keyle(item_key_by_coord(&scan, &key), &info->key_to_stop))
+			break;
+		if (!item_is_internal(&scan))
+			continue;
+		child = child_znode(&scan, scan.node, 0, 0);
+		if (IS_ERR(child))
+			break;
+		if (nr != 0)
+			/* the first one is the child being descended to */
+			mark_readahead(child);
+		batch[nr++] = child;
+	} while (nr < max && coord_next_item(&scan) == 0);
+	submit_ra_batch(batch, nr);
+}
+
+/**
+ * reiser4_prefetch_keys - start reads of leaves containing given keys
+ * @tree: tree to read
+ * @keys: keys to look for
+ * @nr: number of @keys
+ *
+ * Each key is looked up down to twig level only, and the leaf it belongs to
+ * is put into one batch of reads with the others. Keys sorted by object id
+ * mostly fall into a few leaves, which are read once. This is used by
+ * readdir to read stat-data of the entries fed to user space. No locks may
+ * be held by the caller.
+ */
+void reiser4_prefetch_keys(reiser4_tree *tree, const reiser4_key *keys, int nr)
+{
+	znode *batch[REISER4_PREFETCH_BATCH];
+	int nr_batch = 0;
+	int i;
+	int j;
+
+	assert("", lock_stack_isclean(get_current_lock_stack()));
+
+	if (low_on_memory() || tree->height < TWIG_LEVEL)
+		return;
+	for (i = 0; i < nr && nr_batch < REISER4_PREFETCH_BATCH; i++) {
+		coord_t coord;
+		lock_handle lh;
+		znode *child = NULL;
+
+		init_lh(&lh);
+		if (coord_by_key(tree, &keys[i], &coord, &lh, ZNODE_READ_LOCK,
+				 FIND_EXACT, TWIG_LEVEL, TWIG_LEVEL,
+				 CBK_UNIQUE, NULL) == CBK_COORD_FOUND &&
+		    zload(coord.node) == 0) {
+			if (coord_is_existing_item(&coord) &&
+			    item_is_internal(&coord))
+				child = child_znode(&coord, coord.node, 0, 0);
+			zrelse(coord.node);
+		}
+		done_lh(&lh);
+		if (IS_ERR_OR_NULL(child))
+			continue;
+		for (j = 0; j < nr_batch; j++)
+			if (batch[j] == child)
+				break;
+		if (j < nr_batch)
+			/* the leaf is in the batch already */
+			zput(child);
+		else {
+			mark_readahead(child);
+			batch[nr_batch++] = child;
+		}
+	}
+	submit_ra_batch(batch, nr_batch);
+}
+
+/**
+ * reiser4_prefetch_right_neighbor - start read of right neighbor of a node
+ * @node: node being scanned to the right
+ *
+ * This is called by scans with taps, see go_dir_el(), before they reach the
+ * end of @node. The neighbor is found by sibling pointer only: nothing is
+ * locked and the parent is not looked at, so if @node is not connected to
+ * its right neighbor, or it is not in memory, nothing is done.
+ */
+void reiser4_prefetch_right_neighbor(znode *node)
+{
+	reiser4_tree *tree = znode_get_tree(node);
+	znode *right = NULL;
+
+	if (low_on_memory())
+		return;
+	read_lock_tree(tree);
+	if (ZF_ISSET(node, JNODE_RIGHT_CONNECTED) && node->right != NULL)
+		right = zref(node->right);
+	read_unlock_tree(tree);
+	if (right == NULL)
+		return;
+	if (znode_page(right) != NULL ||
+	    reiser4_blocknr_is_fake(znode_get_block(right))) {
+		zput(right);
+		return;
+	}
+	mark_readahead(right);
+	submit_ra_batch(&right, 1);
+}
+
+/**
+ * reiser4_prefetch_left - start reads of a node and of its left neighbors
+ * @node: referenced node a scan to the left is going to load next
+ * @nr: maximal number of left neighbors of @node to read
+ *
+ * This is called by cut_tree_worker_common(), which removes file body twig
+ * by twig right to left: reads of the twigs to cut next go on while the
+ * current one is cut. Neighbors are found by sibling pointers only, as by
+ * reiser4_prefetch_right_neighbor().
+ */
+void reiser4_prefetch_left(znode *node, int nr)
+{
+	reiser4_tree *tree = znode_get_tree(node);
+	znode *batch[REISER4_PREFETCH_BATCH];
+	znode *cur;
+	int count;
+	int i;
+
+	if (low_on_memory())
+		return;
+	nr = min(nr, REISER4_PREFETCH_BATCH - 1);
+	count = 0;
+	read_lock_tree(tree);
+	for (cur = node, i = 0; cur != NULL && i <= nr; cur = cur->left, i++) {
+		if (znode_page(cur) == NULL &&
+		    !reiser4_blocknr_is_fake(znode_get_block(cur))) {
+			mark_readahead(cur);
+			batch[count++] = zref(cur);
+		}
+		if (!ZF_ISSET(cur, JNODE_LEFT_CONNECTED))
+			break;
+	}
+	read_unlock_tree(tree);
+	submit_ra_batch(batch, count);
+}
+
+/* EXTENT READAHEAD
+
+   Generic readahead sizes its window by the access pattern only. For a file
+   built of extents, the pages which are cheap to read together are those of
+   one run of physically contiguous allocated blocks. When a sequential read
+   misses the page cache, reiser4_extent_readahead() reads ahead the run
+   starting at the missed page, up to REISER4_EXTENT_RA_MAX pages. Pages are
+   read by ->readpages(), which submits a run as few large bios. If the run
+   reaches the end of the twig node, read of the right neighbor twig is
+   started, so that the lookup of the next run does not wait for it.
+*/
+
+/* number of pages of the run of contiguous allocated blocks which starts at
+   @index, not more than @max. @coord is set to the extent unit containing
+   @index. *@at_end is set if the run goes up to the end of the twig node */
+static unsigned long extent_run(const coord_t *coord, pgoff_t index,
+				unsigned long max, int *at_end)
+{
+	coord_t scan;
+	reiser4_extent *ext;
+	reiser4_block_nr next;
+	unsigned long run;
+
+	*at_end = 0;
+	ext = extent_by_coord(coord);
+	if (state_of_extent(ext) != ALLOCATED_EXTENT)
+		return 0;
+	run = extent_get_width(ext) - (index - extent_unit_index(coord));
+	next = extent_get_start(ext) + extent_get_width(ext);
+
+	coord_dup(&scan, coord);
+	while (run < max) {
+		if (coord_next_unit(&scan)) {
+			*at_end = 1;
+			break;
+		}
+		if (scan.item_pos != coord->item_pos)
+			/* item of other file */
+			break;
+		ext = extent_by_coord(&scan);
+		if (state_of_extent(ext) != ALLOCATED_EXTENT ||
+		    extent_get_start(ext) != next)
+			break;
+		run += extent_get_width(ext);
+		next += extent_get_width(ext);
+	}
+	return min(run, max);
+}
+
+/* find the run of contiguous blocks starting at @index and start read of the
+   next twig node if the run ends with the node */
+static unsigned long lookup_extent_run(struct inode *inode, pgoff_t index,
+				       unsigned long max)
+{
+	reiser4_key key;
+	coord_t coord;
+	lock_handle lh;
+	lock_handle next_lh;
+	ra_info_t info;
+	znode *next = NULL;
+	unsigned long run = 0;
+	int at_end = 0;
+
+	key_by_inode_and_offset_common(inode, (loff_t)index << PAGE_SHIFT,
+				       &key);
+	init_lh(&lh);
+	if (coord_by_key(reiser4_tree_by_inode(inode), &key, &coord, &lh,
+			 ZNODE_READ_LOCK, FIND_EXACT, TWIG_LEVEL, TWIG_LEVEL,
+			 CBK_UNIQUE, NULL) != CBK_COORD_FOUND) {
+		done_lh(&lh);
+		return 0;
+	}
+	if (zload(coord.node)) {
+		done_lh(&lh);
+		return 0;
+	}
+	if (coord_is_existing_unit(&coord) && item_is_extent(&coord))
+		run = extent_run(&coord, index, max, &at_end);
+	zrelse(coord.node);
+
+	/* the next twig is worth reading if the file continues there */
+	reiser4_init_ra_info(&info);
+	info.key_to_stop = key;
+	set_key_offset(&info.key_to_stop, get_key_offset(reiser4_max_key()));
+	init_lh(&next_lh);
+	if (at_end && should_readahead_neighbor(coord.node, &info) &&
+	    reiser4_get_right_neighbor(&next_lh, coord.node, ZNODE_READ_LOCK,
+				       GN_CAN_USE_UPPER_LEVELS |
+				       GN_TRY_LOCK) == 0 &&
+	    znode_page(next_lh.node) == NULL &&
+	    !reiser4_blocknr_is_fake(znode_get_block(next_lh.node)))
+		next = zref(next_lh.node);
+	done_lh(&next_lh);
+	done_lh(&lh);
+
+	if (next != NULL)
+		submit_ra_batch(&next, 1);
+	return run;
+}
+
+/**
+ * reiser4_extent_readahead - read ahead a run of contiguous blocks of file
+ * @file: file being read
+ * @mapping: its mapping
+ * @index: first page of the read
+ * @nr: number of pages of the read
+ *
+ * This is called by read of a file built of extents before the generic read
+ * path. Non-sequential reads and reads of cached pages are left to generic
+ * readahead.
+ */
+void reiser4_extent_readahead(struct file *file, struct address_space *mapping,
+			      pgoff_t index, unsigned long nr)
+{
+	struct inode *inode = mapping->host;
+	pgoff_t prev = file->f_ra.prev_pos >> PAGE_SHIFT;
+	loff_t size = i_size_read(inode);
+	unsigned long max;
+	unsigned long run;
+	unsigned long i;
+	pgoff_t miss;
+	LIST_HEAD(pages);
+	int nr_pages = 0;
+
+	if (index != 0 && index != prev && index != prev + 1)
+		return;
+	miss = page_cache_next_miss(mapping, index, nr);
+	if (miss - index >= nr)
+		/* everything to be read is cached */
+		return;
+	index = miss;
+	if (size == 0 || index > (size - 1) >> PAGE_SHIFT || low_on_memory())
+		return;
+	max = min_t(unsigned long, REISER4_EXTENT_RA_MAX,
+		    ((size - 1) >> PAGE_SHIFT) - index + 1);
+
+	run = lookup_extent_run(inode, index, max);
+	if (run == 0)
+		return;
+
+	for (i = 0; i < run; i++) {
+		struct page *page;
+
+		page = xa_load(&mapping->i_pages, index + i);
+		if (page != NULL && !xa_is_value(page))
+			continue;
+		page = __page_cache_alloc(readahead_gfp_mask(mapping));
+		if (page == NULL)
+			break;
+		page->index = index + i;
+		list_add(&page->lru, &pages);
+		nr_pages++;
+	}
+	if (nr_pages != 0)
+		mapping->a_ops->readpages(file, mapping, &pages, nr_pages);
+	/* pages ->readpages() did not take */
+	put_pages_list(&pages);
 }
 
 void reiser4_readdir_readahead_init(struct inode *dir, tap_t *tap)
@@ -17,14 +17,34 @@ struct formatted_ra_params {
 	unsigned long max;	/* request not more than this amount of nodes.
 				   Default is totalram_pages() / 4 */
 	int flags;
+	/* adaptive limit of nodes read ahead, not greater than @max. It grows
+	   as nodes read ahead are used and shrinks as they are evicted
+	   unused */
+	unsigned long window;
+	/* nodes read ahead which were loaded later */
+	atomic_t hits;
+	/* nodes read ahead which were evicted without being loaded */
+	atomic_t wasted;
 };
 
 typedef struct {
 	reiser4_key key_to_stop;
+	/* if not 0, readahead keeps that many nodes read ahead of the node
+	   being loaded, not more than formatted_ra_params.max. Otherwise it
+	   stops at the first node already read */
+	unsigned long window;
 } ra_info_t;
 
 void formatted_readahead(znode * , ra_info_t *);
+void reiser4_prefetch_children(const coord_t *, ra_info_t *);
+void reiser4_prefetch_keys(reiser4_tree *, const reiser4_key *keys, int nr);
+void reiser4_prefetch_right_neighbor(znode *node);
+void reiser4_prefetch_left(znode *node, int nr);
 void reiser4_init_ra_info(ra_info_t *rai);
+void reiser4_ra_hit(jnode *node);
+void reiser4_ra_wasted(jnode *node);
+void reiser4_extent_readahead(struct file *, struct address_space *,
+			      pgoff_t index, unsigned long nr);
 
 extern void reiser4_readdir_readahead_init(struct inode *dir, tap_t *tap);
 
@@ -64,10 +64,70 @@ extern const int REISER4_MAGIC_OFFSET;	/* offset to magic string from the
 
 /* default number of slots in coord-by-key caches */
 #define CBK_CACHE_SLOTS    (16)
+/* number of index entries before the binary search position checked by cbk
+   cache lookup, see cbk_cache_probe() */
+#define CBK_CACHE_PROBE    (4)
 /* how many elementary tree operation to carry on the next level */
 #define CARRIES_POOL_SIZE        (5)
 /* size of pool of preallocated nodes for carry process. */
 #define NODES_LOCKED_POOL_SIZE   (5)
+/* room for carry levels and per-operation data after struct carry_pool in
+   objects of carry pool cache, see init_carry_pool() */
+#define CARRY_POOL_EXTRA_SIZE    (1024)
+
+/* number of free objects kept per CPU in front of jnode, znode, carry pool
+   and blocknr set entry slabs */
+#define REISER4_MAGAZINE_SIZE    (32)
+/* number of RCU callbacks posted as one by reiser4_call_rcu() */
+#define REISER4_RCU_BATCH_SIZE   (32)
+/* number of free (de)compression workspaces kept per CPU for each
+   compression plugin and transform direction */
+#define REISER4_COA_POOL_SIZE    (2)
+/* "sampl" compression mode looks at REISER4_SAMPLE_CHUNKS pieces of
+   REISER4_SAMPLE_CHUNK_SIZE bytes spread over the logical cluster, and does
+   not compress it if entropy of the sample is above REISER4_SAMPLE_ENTROPY_MAX
+   percents of 8 bits per byte */
+#define REISER4_SAMPLE_CHUNKS        (16)
+#define REISER4_SAMPLE_CHUNK_SIZE    (32)
+#define REISER4_SAMPLE_ENTROPY_MAX   (90)
+/* first logical cluster of a file whose sample entropy is not above this is
+   considered compressible without trial compression, see
+   read_check_compressibility() */
+#define REISER4_SAMPLE_ENTROPY_LOW   (50)
+/* upper limit of memory taken by cache of inflated logical clusters of
+   cryptcompress files, and log2 of number of its hash buckets */
+#define REISER4_CCACHE_MAX_BYTES     (16 << 20)
+#define REISER4_CCACHE_HASH_BITS     (10)
+/* maximal size of sample corpus of compression benchmark */
+#define REISER4_BENCH_MAX_BYTES      (16 << 20)
+/* maximal number of items of tree benchmark, and number of its operations
+   per transaction, see tree_bench.c */
+#define REISER4_TREE_BENCH_MAX_ITEMS (1 << 20)
+#define REISER4_TREE_BENCH_BATCH     (1024)
+/* walk of the tree by tree shape report pauses for that many milliseconds
+   every that many nodes, see tree_shape.c */
+#define REISER4_TREE_SHAPE_BATCH     (256)
+#define REISER4_TREE_SHAPE_PAUSE     (10)
+/* directories of that many entries get negative lookup filter of
+   REISER4_LOOKUP_FILTER_BITS bits per entry, see plugin/dir/lookup_filter.c */
+#define REISER4_LOOKUP_FILTER_MIN_ENTRIES (1024)
+#define REISER4_LOOKUP_FILTER_MAX_ENTRIES (1 << 20)
+#define REISER4_LOOKUP_FILTER_BITS        (8)
+/* limits of number of leaves readdir keeps read ahead */
+#define REISER4_READDIR_RA_MIN       (4)
+#define REISER4_READDIR_RA_MAX       (64)
+/* tap scanning to the right with prefetch enabled starts read of the right
+   neighbor when it passes this percentage of the current node, see
+   go_dir_el() */
+#define REISER4_TAP_PREFETCH_PERCENT (50)
+/* adaptive transaction model overwrites in place the body of a file more
+   than this percentage of whose recently written pages were overwritten,
+   and relocates it otherwise. Counts of written pages are halved when they
+   sum up to REISER4_TXMOD_ADAPTIVE_WINDOW, see plugin/txmod.c */
+#define REISER4_TXMOD_ADAPTIVE_OVERWRITE_PERCENT (50)
+#define REISER4_TXMOD_ADAPTIVE_WINDOW (1024)
+/* maximal number of coords protected by one seal set, see seal.c */
+#define REISER4_SEAL_SET_SIZE (16)
 
 #define REISER4_NEW_NODE_FLAGS (COPI_LOAD_LEFT | COPI_LOAD_RIGHT | COPI_GO_LEFT)
 #define REISER4_NEW_EXTENT_FLAGS (COPI_LOAD_LEFT | COPI_LOAD_RIGHT | COPI_GO_LEFT)
@@ -93,8 +153,100 @@ extern const int REISER4_MAGIC_OFFSET;	/* offset to magic string from the
 /* key allocation follows good old 3.x scheme */
 #define REISER4_3_5_KEY_ALLOCATION (0)
 
-/* size of hash-table for znodes */
+/* initial size of hash-table for znodes */
 #define REISER4_ZNODE_HASH_TABLE_SIZE (1 << 13)
+/* initial size of hash-table for jnodes */
+#define REISER4_JNODE_HASH_TABLE_SIZE (1 << 14)
+/* znode and jnode hash-tables are doubled when they hold more than this many
+   items per bucket on average */
+#define REISER4_HASH_MAX_LOAD (2)
+/* hash-tables do not grow beyond this number of buckets */
+#define REISER4_HASH_MAX_BUCKETS (1 << 25)
+/* number of locks serializing insertions into the znode hash tables under
+   read tree lock, see zget(). Not more than REISER4_ZNODE_HASH_TABLE_SIZE */
+#define REISER4_ZHASH_STRIPES (64)
+
+/* maximal number of nodes whose reads are submitted in one batch by
+   formatted node readahead, see reiser4_prefetch_children() */
+#define REISER4_PREFETCH_BATCH (16)
+
+/* limit of formatted node readahead adapts between these numbers of nodes,
+   see reiser4_ra_hit() */
+#define REISER4_RA_WINDOW_MIN (2)
+#define REISER4_RA_WINDOW_INIT (REISER4_PREFETCH_BATCH)
+
+/* cut of a file body from the tree starts reads of that many twig nodes to
+   the left of the one it is going to cut next, see cut_tree_worker_common() */
+#define REISER4_CUT_PREFETCH (8)
+
+/* by default up to this fraction of memory is used by pages of twig and
+   upper level nodes the VM scanner cannot release, see tree.pinned_pages
+   mount option */
+#define REISER4_PINNED_FRACTION (32)
+
+/* reiser4_grab_space() takes blocks from per-CPU caches, which are refilled
+   and emptied by this many blocks at a time. See grab_cached() */
+#define REISER4_GRAB_BATCH (64)
+
+/* oid_allocate() takes object ids from per-CPU batches, which are refilled
+   by this many ids at a time */
+#define REISER4_OID_BATCH (64)
+
+/* longest time (in nanoseconds) longterm_lock_znode() spins waiting for a
+   lock held by a running process before going to sleep, see
+   lock_spin_on_owner() */
+#define REISER4_LOCK_SPIN_NSEC (20 * NSEC_PER_USEC)
+
+/* the default blocknr hint is kept per CPU, each CPU starting in its own
+   allocation group, when the file system has at least this many blocks per
+   CPU. See get_blocknr_hint_default() */
+#define REISER4_ALLOC_GROUP_MIN (1 << 15)
+
+/* allocation requests of at least this many blocks look for a free extent
+   of full length before taking the first free blocks after the hint, see
+   alloc_blocks_forward() */
+#define REISER4_BITMAP_CONTIG_MIN (64)
+
+/* default size (in blocks) of per-file preallocation windows, and their
+   maximal number per file system. See PREALLOCATION WINDOWS in
+   block_alloc.c */
+#define REISER4_PREALLOC_WINDOW (256)
+#define REISER4_PREALLOC_MAX (128)
+#define REISER4_PREALLOC_HASH_BITS (6)
+
+/* stat-data location cache has 1 << REISER4_SD_CACHE_BITS slots per file
+   system, see STAT-DATA LOCATION CACHE in inode.c */
+#define REISER4_SD_CACHE_BITS (14)
+
+/* freed extents are discarded in background at most this many blocks at a
+   time, every REISER4_DISCARD_DELAY jiffies. The delay also lets extents of
+   subsequent atoms merge. See discard.c */
+#define REISER4_DISCARD_BATCH (1 << 18)
+#define REISER4_DISCARD_DELAY (HZ)
+
+/* balancing estimates are calibrated from observed consumption once per
+   this many carries of a kind, see estimate.c */
+#define REISER4_ESTIMATE_PERIOD (1024)
+/* initial number of blocks added to calibrated estimates */
+#define REISER4_ESTIMATE_MARGIN (2)
+
+/* maximal number of pages read ahead at once from a run of contiguous
+   blocks of a file, see EXTENT READAHEAD in readahead.c */
+#define REISER4_EXTENT_RA_MAX (1024)
+
+/* files built of tails not longer than this many pages are converted to
+   extents by writer, longer ones are converted in background, see
+   BACKGROUND TAIL CONVERSION in plugin/file/file.c */
+#define REISER4_TAIL2EXTENT_SYNC_MAX (16)
+
+/* REISER4_IOC_DEFRAG forces commit after capturing that many pages, see
+   defrag.c */
+#define REISER4_DEFRAG_IOC_BATCH (1024)
+
+/* with async_delete mount option, regular files of at least this many bytes
+   are deleted in background after their last link and reference are gone,
+   see DEFERRED DELETION in safe_link.c */
+#define REISER4_ASYNC_DELETE_MIN (64 << 20)
 
 /* number of buckets in lnode hash-table */
 #define LNODE_HTABLE_BUCKETS (1024)
@@ -133,9 +285,41 @@ extern const int REISER4_MAGIC_OFFSET;	/* offset to magic string from the
    be overwritten by tmgr.atom_max_age mount option. */
 #define REISER4_ATOM_MAX_AGE          (600 * HZ)
 
+/* Atom is committed as soon as it pins more blocks than can be written
+   back in this time (in milliseconds) at the write-back bandwidth measured on
+   previous commits. See atom_too_big(). */
+#define REISER4_ATOM_COMMIT_TIME      (2000)
+
+/* atom_too_big() never limits atom below this number of blocks */
+#define REISER4_ATOM_MIN_DYNAMIC_SIZE (1024)
+
+/* default of statfs_cache_age mount option, in milliseconds, see
+   reiser4_statfs() */
+#define REISER4_STATFS_CACHE_AGE      (100)
+
+/* reiser4_writeout() called from ->writeback_inodes() starts flushes from
+   atoms of at most this many of the files written back */
+#define REISER4_WB_STARTS             (8)
+
+/* Writers are delayed once all atoms together pin more blocks than can be
+   committed in this time (in milliseconds) at the measured bandwidth, by at
+   most REISER4_THROTTLE_MAX_PAUSE milliseconds at a time. It is larger than
+   REISER4_ATOM_COMMIT_TIME, so that a single atom commits before it becomes a
+   reason to delay writers. See reiser4_throttle_capture(). */
+#define REISER4_THROTTLE_WINDOW       (4000)
+#define REISER4_THROTTLE_MAX_PAUSE    (200)
+
 /* sleeping period for ktxnmrgd */
 #define REISER4_TXNMGR_TIMEOUT  (5 * HZ)
 
+/* how many times in a row commit_some_atoms() may prefer an atom with
+   synchronous waiters over an older committable atom without ones */
+#define REISER4_TXNMGR_SYNC_BATCH (8)
+
+/* txnmgr_force_commit_all() flushes at most this many atoms in parallel, in
+   addition to the one flushed by the caller itself */
+#define REISER4_SYNC_WORKERS (3)
+
 /* timeout to wait for ent thread in writepage. Default: 3 milliseconds. */
 #define REISER4_ENTD_TIMEOUT (3 * HZ / 1000)
 
@@ -169,6 +353,15 @@ extern const int REISER4_MAGIC_OFFSET;	/* offset to magic string from the
  */
 #define FLUSH_RELOCATE_DISTANCE  64
 
+/* Defaults of the above for non-rotational devices, where closeness of
+   blocks matters little and relocation mostly costs writes, and for zoned
+   devices, where overwriting in place is what is expensive. See
+   init_relocate_policy() */
+#define FLUSH_RELOCATE_THRESHOLD_NONROT 256
+#define FLUSH_RELOCATE_DISTANCE_NONROT  1024
+#define FLUSH_RELOCATE_THRESHOLD_ZONED  1
+#define FLUSH_RELOCATE_DISTANCE_ZONED   0
+
 /* If we have written this much or more blocks before encountering busy jnode
    in flush list - abort flushing hoping that next time we get called
    this jnode will be clean already, and we will save some seeks. */
@@ -177,9 +370,33 @@ extern const int REISER4_MAGIC_OFFSET;	/* offset to magic string from the
 /* The maximum number of nodes to scan left on a level during flush. */
 #define FLUSH_SCAN_MAXNODES 10000
 
+/* Flush doesn't squeeze a node into its left neighbor unless the latter has
+   at least this many percents of the block free, or the node can be emptied.
+   0 means to always squeeze. */
+#define FLUSH_SQUEEZE_MIN_GAIN 0
+
+/* the background defragmenter considers a file fragmented if its cached
+   pages form runs of adjacent blocks shorter than this on average */
+#define REISER4_DEFRAG_MIN_EXTENT 16
+/* default seconds between defragmenter passes */
+#define REISER4_DEFRAG_INTERVAL 60
+
+/* limits of the flush write congestion window, in blocks */
+#define FLUSH_CONG_MIN_WINDOW 64
+#define FLUSH_CONG_MAX_WINDOW 16384
+
+/* default and maximal number of ent threads of a file system */
+#define REISER4_ENTD_THREADS (1)
+#define REISER4_ENTD_MAX_THREADS (16)
+
 /* per-atom limit of flushers */
 #define ATOM_MAX_FLUSHERS (1)
 
+/* concurrent flushers of an atom start in different slums. Unformatted nodes
+   of a file are considered to be in the same slum if their indices are equal
+   after shifting by this, see jnode_slum_id() */
+#define FLUSH_SLUM_SHIFT (14)
+
 /* default tracing buffer size */
 #define REISER4_TRACE_BUF_SIZE (1 << 15)
 
@@ -0,0 +1,232 @@
+/* Copyright 2001, 2002, 2003, 2004 by Hans Reiser, licensing governed by
+ * reiser4/README */
+
+/* Tracepoints of reiser4 hot paths: tree lookup, long term locking, capture,
+   flush, commit and block allocation. They are available in production
+   builds, use perf or bpftrace to attribute latency. */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM reiser4
+
+#if !defined(__REISER4_TRACE_H__) || defined(TRACE_HEADER_MULTI_READ)
+#define __REISER4_TRACE_H__
+
+#include <linux/tracepoint.h>
+#include <linux/fs.h>
+#include <linux/types.h>
+
+/* coord_by_key(): @levels is the number of tree levels traversed, 0 if the
+   key was found in the cbk cache */
+TRACE_EVENT(reiser4_coord_by_key,
+	TP_PROTO(struct super_block *sb, u64 objectid, u64 offset,
+		 int cache_hit, int levels, int restarts, int result),
+	TP_ARGS(sb, objectid, offset, cache_hit, levels, restarts, result),
+
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(u64, objectid)
+		__field(u64, offset)
+		__field(int, cache_hit)
+		__field(int, levels)
+		__field(int, restarts)
+		__field(int, result)
+	),
+
+	TP_fast_assign(
+		__entry->dev = sb->s_dev;
+		__entry->objectid = objectid;
+		__entry->offset = offset;
+		__entry->cache_hit = cache_hit;
+		__entry->levels = levels;
+		__entry->restarts = restarts;
+		__entry->result = result;
+	),
+
+	TP_printk("dev %d:%d oid %llu off %llu cache %s levels %d restarts %d "
+		  "result %d", MAJOR(__entry->dev), MINOR(__entry->dev),
+		  __entry->objectid, __entry->offset,
+		  __entry->cache_hit ? "hit" : "miss", __entry->levels,
+		  __entry->restarts, __entry->result)
+);
+
+/* longterm_lock_znode() had to wait for a lock. @result is -E_DEADLOCK if
+   the request was refused to avoid a deadlock */
+TRACE_EVENT(reiser4_longterm_lock_wait,
+	TP_PROTO(struct super_block *sb, u64 block, int level, int mode,
+		 u64 wait_ns, int result),
+	TP_ARGS(sb, block, level, mode, wait_ns, result),
+
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(u64, block)
+		__field(int, level)
+		__field(int, mode)
+		__field(u64, wait_ns)
+		__field(int, result)
+	),
+
+	TP_fast_assign(
+		__entry->dev = sb->s_dev;
+		__entry->block = block;
+		__entry->level = level;
+		__entry->mode = mode;
+		__entry->wait_ns = wait_ns;
+		__entry->result = result;
+	),
+
+	TP_printk("dev %d:%d block %llu level %d mode %d wait %llu ns "
+		  "result %d", MAJOR(__entry->dev), MINOR(__entry->dev),
+		  __entry->block, __entry->level, __entry->mode,
+		  __entry->wait_ns, __entry->result)
+);
+
+/* atom @small is fused into @large */
+TRACE_EVENT(reiser4_atom_fuse,
+	TP_PROTO(struct super_block *sb, u32 small, u32 large,
+		 unsigned captured),
+	TP_ARGS(sb, small, large, captured),
+
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(u32, small)
+		__field(u32, large)
+		__field(unsigned, captured)
+	),
+
+	TP_fast_assign(
+		__entry->dev = sb->s_dev;
+		__entry->small = small;
+		__entry->large = large;
+		__entry->captured = captured;
+	),
+
+	TP_printk("dev %d:%d atom %u into %u captured %u",
+		  MAJOR(__entry->dev), MINOR(__entry->dev),
+		  __entry->small, __entry->large, __entry->captured)
+);
+
+/* capture request slept in capture_fuse_wait() */
+TRACE_EVENT(reiser4_capture_wait,
+	TP_PROTO(struct super_block *sb, u32 atom, u64 wait_ns, int result),
+	TP_ARGS(sb, atom, wait_ns, result),
+
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(u32, atom)
+		__field(u64, wait_ns)
+		__field(int, result)
+	),
+
+	TP_fast_assign(
+		__entry->dev = sb->s_dev;
+		__entry->atom = atom;
+		__entry->wait_ns = wait_ns;
+		__entry->result = result;
+	),
+
+	TP_printk("dev %d:%d atom %u wait %llu ns result %d",
+		  MAJOR(__entry->dev), MINOR(__entry->dev),
+		  __entry->atom, __entry->wait_ns, __entry->result)
+);
+
+/* one jnode_flush() call. @allocated is the number of nodes (re)allocated,
+   @relocate tells whether leaves were relocated */
+TRACE_EVENT(reiser4_jnode_flush,
+	TP_PROTO(struct super_block *sb, u64 block, unsigned scanned,
+		 int squeezed, int allocated, int relocate, long written,
+		 int result),
+	TP_ARGS(sb, block, scanned, squeezed, allocated, relocate, written,
+		result),
+
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(u64, block)
+		__field(unsigned, scanned)
+		__field(int, squeezed)
+		__field(int, allocated)
+		__field(int, relocate)
+		__field(long, written)
+		__field(int, result)
+	),
+
+	TP_fast_assign(
+		__entry->dev = sb->s_dev;
+		__entry->block = block;
+		__entry->scanned = scanned;
+		__entry->squeezed = squeezed;
+		__entry->allocated = allocated;
+		__entry->relocate = relocate;
+		__entry->written = written;
+		__entry->result = result;
+	),
+
+	TP_printk("dev %d:%d start %llu scanned %u squeezed %d allocated %d "
+		  "relocate %d written %ld result %d", MAJOR(__entry->dev),
+		  MINOR(__entry->dev), __entry->block, __entry->scanned,
+		  __entry->squeezed, __entry->allocated, __entry->relocate,
+		  __entry->written, __entry->result)
+);
+
+/* duration of a transaction manager phase, see txnmgr_lat_names[] */
+TRACE_EVENT(reiser4_txn_phase,
+	TP_PROTO(struct super_block *sb, const char *phase, u64 usecs),
+	TP_ARGS(sb, phase, usecs),
+
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__string(phase, phase)
+		__field(u64, usecs)
+	),
+
+	TP_fast_assign(
+		__entry->dev = sb->s_dev;
+		__assign_str(phase, phase);
+		__entry->usecs = usecs;
+	),
+
+	TP_printk("dev %d:%d %s %llu us", MAJOR(__entry->dev),
+		  MINOR(__entry->dev), __get_str(phase), __entry->usecs)
+);
+
+/* bitmap block allocator search */
+TRACE_EVENT(reiser4_bitmap_alloc,
+	TP_PROTO(struct super_block *sb, u64 hint, u64 max_dist, int backward,
+		 int needed, u64 start, u64 len, int result),
+	TP_ARGS(sb, hint, max_dist, backward, needed, start, len, result),
+
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(u64, hint)
+		__field(u64, max_dist)
+		__field(int, backward)
+		__field(int, needed)
+		__field(u64, start)
+		__field(u64, len)
+		__field(int, result)
+	),
+
+	TP_fast_assign(
+		__entry->dev = sb->s_dev;
+		__entry->hint = hint;
+		__entry->max_dist = max_dist;
+		__entry->backward = backward;
+		__entry->needed = needed;
+		__entry->start = start;
+		__entry->len = len;
+		__entry->result = result;
+	),
+
+	TP_printk("dev %d:%d hint %llu max_dist %llu %s needed %d "
+		  "got %llu+%llu result %d", MAJOR(__entry->dev),
+		  MINOR(__entry->dev), __entry->hint, __entry->max_dist,
+		  __entry->backward ? "backward" : "forward", __entry->needed,
+		  __entry->start, __entry->len, __entry->result)
+);
+
+#endif /* __REISER4_TRACE_H__ */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE reiser4_trace
+#include <trace/define_trace.h>
@@ -44,6 +44,32 @@
  *
  * For the reference: ext3 also has similar mechanism, it's called "an orphan
  * list" there.
+ *
+ * Only truncates are replayed by mount itself: a partially truncated file is
+ * visible, and it must not be accessed before its truncate is finished.
+ * Files in the middle of unlink have no names, they can only be reached by
+ * file handle, and finishing them just frees their space. After a crash with
+ * many open-but-unlinked files that would take a long time, so unlinks are
+ * replayed by a kernel thread started at the end of mount. A file reached by
+ * file handle meanwhile is left alone: the last iput() of it deletes the file
+ * and its safe-link as usual.
+ *
+ * DEFERRED DELETION
+ *
+ * The same thread deletes large files in background when file system is
+ * mounted with async_delete option. When the last reference to a regular
+ * file with no links and with at least REISER4_ASYNC_DELETE_MIN bytes is
+ * dropped, reiser4_defer_delete() makes ->evict_inode() leave the file in
+ * the tree, its unlink safe-link included, and wakes the thread up. The
+ * thread gets the file by reiser4_iget() again and its iput() deletes the
+ * body as usual, in as many transactions as truncate takes. So the process
+ * which unlinked the file does not wait for that. The thread runs at the
+ * lowest priority, and a crash before the file is deleted leaves the
+ * safe-link to be replayed on the next mount.
+ *
+ * Files evicted by memory reclaim are deferred whatever their size: reclaim
+ * must not wait for truncate and for the transactions it opens. One wake up
+ * of the thread deletes all deferred files found by one scan of safe-links.
  */
 
 #include "safe_link.h"
@@ -53,6 +79,8 @@
 #include "plugin/item/blackbox.h"
 
 #include <linux/fs.h>
+#include <linux/kthread.h>
+#include <linux/sched/task.h>
 
 /*
  * On-disk format of safe-link.
@@ -67,7 +95,7 @@ typedef struct safelink {
  * locality where safe-link items are stored. Next to the objectid of root
  * directory.
  */
-static oid_t safe_link_locality(reiser4_tree * tree)
+oid_t safe_link_locality(reiser4_tree * tree)
 {
 	return get_key_objectid(get_super_private(tree->super)->df_plug->
 				root_dir_key(tree->super)) + 1;
@@ -243,6 +271,19 @@ static int safe_link_iter_finished(struct safe_link_context *ctx)
 	return get_key_locality(&ctx->key) != safe_link_locality(ctx->tree);
 }
 
+/*
+ * step past the current safe-link, which is left in the tree.
+ */
+static void safe_link_iter_skip(struct safe_link_context *ctx)
+{
+	if (ctx->link != 0)
+		set_key_offset(&ctx->key, ctx->link - 1);
+	else {
+		set_key_objectid(&ctx->key, ctx->oid - 1);
+		set_key_offset(&ctx->key, get_key_offset(reiser4_max_key()));
+	}
+}
+
 /*
  * finish safe-link iteration.
  */
@@ -272,6 +313,13 @@ static int process_safelink(struct super_block *super, reiser4_safe_link_t link,
 		fplug = inode_file_plugin(inode);
 		assert("nikita-3428", fplug != NULL);
 		assert("", oid == get_inode_oid(inode));
+		if (link == SAFE_UNLINK && atomic_read(&inode->i_count) > 1) {
+			/* file is used by somebody who got it by file handle,
+			 * see comment at the top of this file */
+			reiser4_iget_complete(inode);
+			iput(inode);
+			return RETERR(-EBUSY);
+		}
 		if (fplug->safelink != NULL) {
 			/* reiser4_txn_restart_current is not necessary because
 			 * mounting is signle thread. However, without it
@@ -315,33 +363,194 @@ static int process_safelink(struct super_block *super, reiser4_safe_link_t link,
 }
 
 /*
- * iterate over all safe-links in the file-system processing them one by one.
+ * iterate over all safe-links in the file-system processing truncate ones one
+ * by one. Returns the number of unlink safe-links left to
+ * reiser4_start_safelinks() or error.
  */
 int process_safelinks(struct super_block *super)
 {
 	struct safe_link_context ctx;
+	int deferred;
 	int result;
 
 	if (sb_rdonly(super))
 		/* do nothing on the read-only file system */
 		return 0;
 	safe_link_iter_begin(&get_super_private(super)->tree, &ctx);
-	result = 0;
+	deferred = 0;
 	do {
 		result = safe_link_iter_next(&ctx);
 		if (safe_link_iter_finished(&ctx) || result == -ENOENT) {
 			result = 0;
 			break;
 		}
-		if (result == 0)
-			result = process_safelink(super, ctx.link,
-						  &ctx.sdkey, ctx.oid,
-						  ctx.size);
+		if (result != 0)
+			break;
+		if (ctx.link == SAFE_UNLINK) {
+			deferred++;
+			safe_link_iter_skip(&ctx);
+			continue;
+		}
+		result = process_safelink(super, ctx.link, &ctx.sdkey,
+					  ctx.oid, ctx.size);
 	} while (result == 0);
 	safe_link_iter_end(&ctx);
+	return result ? result : deferred;
+}
+
+/*
+ * process unlink safe-link @ctx points to. Returns 0 if the iteration is to
+ * be continued.
+ */
+static int process_unlink_safelink(struct super_block *super,
+				   struct safe_link_context *ctx)
+{
+	reiser4_context context;
+	int result;
+
+	while (!sb_start_write_trylock(super)) {
+		/* file system is frozen */
+		if (kthread_should_stop())
+			return RETERR(-EINTR);
+		schedule_timeout_interruptible(HZ);
+	}
+	init_stack_context(&context, super);
+	result = safe_link_iter_next(ctx);
+	if (safe_link_iter_finished(ctx) || result == -ENOENT)
+		result = 1;
+	else if (result == 0) {
+		if (ctx->link == SAFE_UNLINK)
+			result = process_safelink(super, ctx->link,
+						  &ctx->sdkey, ctx->oid,
+						  ctx->size);
+		else
+			/* truncate which mount failed to finish */
+			result = RETERR(-EBUSY);
+		if (result != 0) {
+			safe_link_iter_skip(ctx);
+			result = 0;
+		}
+	}
+	reiser4_exit_context(&context);
+	sb_end_write(super);
 	return result;
 }
 
+/* body of the kernel thread replaying unlinks. After all unlink safe-links
+ * are processed, it exits, unless deletion of files can be deferred to it,
+ * in which case it sleeps until reiser4_defer_delete() asks for one more
+ * scan */
+static int safelinkd(void *arg)
+{
+	struct super_block *super = arg;
+	reiser4_super_info_data *sbinfo = get_super_private(super);
+	struct safe_link_context ctx;
+
+	set_user_nice(current, MAX_NICE);
+	while (!kthread_should_stop()) {
+		atomic_set(&sbinfo->safelink_pending, 0);
+		safe_link_iter_begin(&sbinfo->tree, &ctx);
+		while (!kthread_should_stop() && !sb_rdonly(super) &&
+		       process_unlink_safelink(super, &ctx) == 0)
+			cond_resched();
+		safe_link_iter_end(&ctx);
+		if (!reiser4_is_set(super, REISER4_ASYNC_DELETE))
+			break;
+
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!atomic_read(&sbinfo->safelink_pending) &&
+		    !kthread_should_stop())
+			schedule();
+		__set_current_state(TASK_RUNNING);
+	}
+	return 0;
+}
+
+/**
+ * reiser4_start_safelinks - start replaying unlinks
+ * @super: super block being mounted
+ *
+ * This is called at the end of mount when process_safelinks() leaves unlink
+ * safe-links, or when deletion of large files is deferred. The thread exits
+ * when all of them are processed, or on umount in the latter case.
+ */
+int reiser4_start_safelinks(struct super_block *super)
+{
+	reiser4_super_info_data *sbinfo = get_super_private(super);
+	struct task_struct *tsk;
+
+	assert("", sbinfo->safelink_tsk == NULL);
+
+	tsk = kthread_create(safelinkd, super, "safelink:%s", super->s_id);
+	if (IS_ERR(tsk))
+		return PTR_ERR(tsk);
+	/* the thread may exit before it is stopped */
+	get_task_struct(tsk);
+	sbinfo->safelink_tsk = tsk;
+	wake_up_process(tsk);
+	return 0;
+}
+
+/**
+ * reiser4_done_safelinks - stop replaying unlinks
+ * @super: super block being unmounted
+ *
+ * This is called on umount, before inodes are evicted. Safe-links left are
+ * processed on the next mount.
+ */
+void reiser4_done_safelinks(struct super_block *super)
+{
+	reiser4_super_info_data *sbinfo = get_super_private(super);
+
+	if (sbinfo->safelink_tsk != NULL) {
+		kthread_stop(sbinfo->safelink_tsk);
+		put_task_struct(sbinfo->safelink_tsk);
+		sbinfo->safelink_tsk = NULL;
+	}
+}
+
+/**
+ * reiser4_defer_delete - leave deletion of a large file to safe-link thread
+ * @inode: inode with no links being evicted
+ *
+ * Returns true if the file is left in the tree for the safe-link thread to
+ * delete, see DEFERRED DELETION above. Small files are deleted in place,
+ * unless they are evicted by memory reclaim.
+ */
+int reiser4_defer_delete(struct inode *inode)
+{
+	reiser4_super_info_data *sbinfo = get_super_private(inode->i_sb);
+	struct task_struct *tsk = READ_ONCE(sbinfo->safelink_tsk);
+	reiser4_tree *tree = reiser4_tree_by_inode(inode);
+	reiser4_key key;
+	safelink_t sl;
+
+	if (!reiser4_is_set(inode->i_sb, REISER4_ASYNC_DELETE) ||
+	    tsk == NULL || tsk == current || sb_rdonly(inode->i_sb) ||
+	    !S_ISREG(inode->i_mode) || (inode->i_state & I_DIRTY) ||
+	    (i_size_read(inode) < REISER4_ASYNC_DELETE_MIN &&
+	     !(current->flags & PF_MEMALLOC)) ||
+	    inode_file_plugin(inode)->safelink == NULL)
+		return 0;
+	/*
+	 * stat-data have to be up to date for the thread to find the whole
+	 * body. Flush does not expect dirty pages without items they belong
+	 * to, so only a file with nothing in memory is left
+	 */
+	invalidate_mapping_pages(inode->i_mapping, 0, -1);
+	if (inode->i_mapping->nrpages != 0 ||
+	    !inode_has_no_jnodes(reiser4_inode_data(inode)))
+		return 0;
+	/* the file would leak if unlink failed to add its safe-link */
+	build_link_key(tree, get_inode_oid(inode), SAFE_UNLINK, &key);
+	if (load_black_box(tree, &key, &sl, sizeof sl, 1) != 0)
+		return 0;
+
+	atomic_set(&sbinfo->safelink_pending, 1);
+	wake_up_process(tsk);
+	return 1;
+}
+
 /* Make Linus happy.
    Local variables:
    c-indentation-style: "K&R"
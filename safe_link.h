@@ -12,8 +12,12 @@ int safe_link_grab(reiser4_tree * tree, reiser4_ba_flags_t flags);
 void safe_link_release(reiser4_tree * tree);
 int safe_link_add(struct inode *inode, reiser4_safe_link_t link);
 int safe_link_del(reiser4_tree *, oid_t oid, reiser4_safe_link_t link);
+oid_t safe_link_locality(reiser4_tree * tree);
 
 int process_safelinks(struct super_block *super);
+int reiser4_start_safelinks(struct super_block *super);
+void reiser4_done_safelinks(struct super_block *super);
+int reiser4_defer_delete(struct inode *inode);
 
 /* __FS_SAFE_LINK_H__ */
 #endif
@@ -29,7 +29,17 @@
    znode->version. This is done so, because just incrementing znode->version
    on each update is not enough: it may so happen, that znode get deleted, new
    znode is allocated for the same disk block and gets the same version
-   counter, tricking seal code into false positive.
+   counter, tricking seal code into false positive. znode_epoch is atomic, so
+   that znodes modified on different CPUs do not contend on a lock for it.
+
+   Scans which keep many positions across lock drops (readdir, operations on
+   ranges of extents) use seal sets. A seal set holds seals of up to
+   REISER4_SEAL_SET_SIZE coords. reiser4_seal_set_check() looks every node up
+   in cache and reads its version once for all seals of that node, seals of
+   nodes modified or evicted are cleared. Coord of a seal which survived is
+   then used as usual, through reiser4_seal_validate() of
+   reiser4_seal_set_get(), which takes the lock. Coords of cleared seals have
+   to be looked up again.
 */
 
 #include "forward.h"
@@ -183,6 +193,89 @@ int reiser4_seal_validate(seal_t *seal /* seal to validate */,
 	return result;
 }
 
+/* initialise empty seal set */
+void reiser4_seal_set_init(reiser4_seal_set *set)
+{
+	assert("", set != NULL);
+	set->nr = 0;
+}
+
+/**
+ * reiser4_seal_set_add - seal one more coord
+ * @set: seal set to add to
+ * @coord: coord to seal, its node is locked
+ * @key: key @coord is at, can be NULL
+ *
+ * Returns index of seal of @coord in @set, or -ENOSPC when @set is full.
+ */
+int reiser4_seal_set_add(reiser4_seal_set *set, const coord_t *coord,
+			 const reiser4_key *key)
+{
+	assert("", set != NULL);
+	assert("", coord != NULL);
+
+	if (set->nr == REISER4_SEAL_SET_SIZE)
+		return RETERR(-ENOSPC);
+	reiser4_seal_init(&set->seal[set->nr], coord, key);
+	return set->nr++;
+}
+
+/**
+ * reiser4_seal_set_check - find which seals of a set are still pristine
+ * @set: seal set to check
+ *
+ * Each node seals of @set are attached to is looked up in cache once and its
+ * version is read once. Seals whose node is not in cache or was modified are
+ * cleared. Nothing is locked: surviving seals are to be validated with
+ * reiser4_seal_validate() before their coords are used, which is cheap
+ * then. Returns number of seals which are still set.
+ */
+int reiser4_seal_set_check(reiser4_seal_set *set)
+{
+	DECLARE_BITMAP(checked, REISER4_SEAL_SET_SIZE);
+	int alive = 0;
+	int i;
+	int j;
+
+	assert("", set != NULL);
+	assert("", set->nr <= REISER4_SEAL_SET_SIZE);
+
+	bitmap_zero(checked, REISER4_SEAL_SET_SIZE);
+	for (i = 0; i < set->nr; i++) {
+		reiser4_block_nr block;
+		__u64 version = 0;
+		znode *node;
+
+		if (test_bit(i, checked))
+			continue;
+		if (!reiser4_seal_is_set(&set->seal[i]))
+			continue;
+		block = set->seal[i].block;
+		node = seal_node(&set->seal[i]);
+		if (node != NULL) {
+			spin_lock_znode(node);
+			if (!ZF_ISSET(node, JNODE_HEARD_BANSHEE))
+				version = node->version;
+			spin_unlock_znode(node);
+			zput(node);
+		}
+		/* all seals of the same node are checked against version
+		   read once */
+		for (j = i; j < set->nr; j++) {
+			seal_t *seal = &set->seal[j];
+
+			if (seal->block != block || !reiser4_seal_is_set(seal))
+				continue;
+			__set_bit(j, checked);
+			if (seal->version == version)
+				alive++;
+			else
+				reiser4_seal_done(seal);
+		}
+	}
+	return alive;
+}
+
 /* helpers functions */
 
 /* obtain reference to znode seal points to, if in cache */
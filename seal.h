@@ -28,6 +28,24 @@ typedef struct seal_s {
 #endif
 } seal_t;
 
+/* finger: nodes on the path to the position found by the last lookup of a
+   sequential access. When the seal on that position is broken, the next
+   lookup starts from the lowest of these nodes which still covers the key
+   (see reiser4_finger_lookup()) rather than from the tree root. */
+typedef struct reiser4_finger {
+	/* block numbers of the node the lookup stopped at and of its parent,
+	   0 if not known */
+	reiser4_block_nr block[2];
+} reiser4_finger;
+
+/* seal set: seals of several coords, possibly in several nodes, which are
+   checked together by reiser4_seal_set_check(). See seal.c */
+typedef struct reiser4_seal_set {
+	/* number of seals added */
+	int nr;
+	seal_t seal[REISER4_SEAL_SET_SIZE];
+} reiser4_seal_set;
+
 extern void reiser4_seal_init(seal_t *, const coord_t *, const reiser4_key *);
 extern void reiser4_seal_done(seal_t *);
 extern int reiser4_seal_is_set(const seal_t *);
@@ -35,6 +53,18 @@ extern int reiser4_seal_validate(seal_t *, coord_t *,
 			 const reiser4_key *, lock_handle * ,
 			 znode_lock_mode mode, znode_lock_request request);
 
+extern void reiser4_seal_set_init(reiser4_seal_set *);
+extern int reiser4_seal_set_add(reiser4_seal_set *, const coord_t *,
+				const reiser4_key *);
+extern int reiser4_seal_set_check(reiser4_seal_set *);
+
+/* seal of coord number @i of seal set @set */
+static inline seal_t *reiser4_seal_set_get(reiser4_seal_set *set, int i)
+{
+	assert("", 0 <= i && i < set->nr);
+	return &set->seal[i];
+}
+
 /* __SEAL_H__ */
 #endif
 
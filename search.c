@@ -18,8 +18,11 @@
 #include "reiser4.h"
 #include "super.h"
 #include "inode.h"
+#include "reiser4_trace.h"
 
 #include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/mm.h>		/* for kvmalloc_array() */
 
 static const char *bias_name(lookup_bias bias);
 
@@ -36,6 +39,8 @@ static const char *bias_name(lookup_bias bias);
  * The efficiency of coord cache depends heavily on locality of reference for
  * tree accesses. Our user level simulations show reasonably good hit ratios
  * for coord cache under most loads so far.
+ *
+ * Each CPU has its own list, see comment before &cbk_cache in tree.h.
  */
 
 /* Initialise coord cache slot */
@@ -50,57 +55,159 @@ static void cbk_cache_init_slot(cbk_cache_slot *slot)
 /* Initialize coord cache */
 int cbk_cache_init(cbk_cache * cache/* cache to init */)
 {
+	int cpu;
 	int i;
 
 	assert("nikita-346", cache != NULL);
 
-	cache->slot =
-		kmalloc(sizeof(cbk_cache_slot) * cache->nr_slots,
-			reiser4_ctx_gfp_mask_get());
-	if (cache->slot == NULL)
+	cache->cpu = NULL;
+	if (cache->nr_slots == 0)
+		return 0;
+	cache->cpu = alloc_percpu(cbk_cache_cpu);
+	if (cache->cpu == NULL)
 		return RETERR(-ENOMEM);
 
-	INIT_LIST_HEAD(&cache->lru);
-	for (i = 0; i < cache->nr_slots; ++i) {
-		cbk_cache_init_slot(cache->slot + i);
-		list_add_tail(&((cache->slot + i)->lru), &cache->lru);
+	for_each_possible_cpu(cpu) {
+		cbk_cache_cpu *cc = per_cpu_ptr(cache->cpu, cpu);
+
+		spin_lock_init(&cc->guard);
+		INIT_LIST_HEAD(&cc->lru);
+		cc->slot = kvmalloc_array(cache->nr_slots,
+					  sizeof(cbk_cache_slot),
+					  reiser4_ctx_gfp_mask_get());
+		cc->index = kvmalloc_array(cache->nr_slots,
+					   sizeof(cbk_cache_slot *),
+					   reiser4_ctx_gfp_mask_get());
+		if (cc->slot == NULL || cc->index == NULL) {
+			cbk_cache_done(cache);
+			return RETERR(-ENOMEM);
+		}
+		for (i = 0; i < cache->nr_slots; ++i) {
+			cbk_cache_init_slot(cc->slot + i);
+			list_add_tail(&((cc->slot + i)->lru), &cc->lru);
+		}
 	}
-	rwlock_init(&cache->guard);
 	return 0;
 }
 
 /* free cbk cache data */
 void cbk_cache_done(cbk_cache * cache/* cache to release */)
 {
+	int cpu;
+
 	assert("nikita-2493", cache != NULL);
-	if (cache->slot != NULL) {
-		kfree(cache->slot);
-		cache->slot = NULL;
+	if (cache->cpu != NULL) {
+		for_each_possible_cpu(cpu) {
+			cbk_cache_cpu *cc = per_cpu_ptr(cache->cpu, cpu);
+
+			kvfree(cc->slot);
+			kvfree(cc->index);
+		}
+		free_percpu(cache->cpu);
+		cache->cpu = NULL;
 	}
 }
 
-/* macro to iterate over all cbk cache slots */
-#define for_all_slots(cache, slot)					  \
-	for ((slot) = list_entry((cache)->lru.next, cbk_cache_slot, lru); \
-	     &(cache)->lru != &(slot)->lru;				  \
+/* macro to iterate over all cbk cache slots of one CPU */
+#define for_all_slots(cc, slot)						\
+	for ((slot) = list_entry((cc)->lru.next, cbk_cache_slot, lru);	\
+	     &(cc)->lru != &(slot)->lru;				\
 	     (slot) = list_entry(slot->lru.next, cbk_cache_slot, lru))
 
+/* return position of the first index entry with key greater than @key */
+static int cbk_index_upper(const cbk_cache_cpu * cc, const reiser4_key * key)
+{
+	int lo = 0;
+	int hi = cc->nr_used;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+
+		if (keygt(&cc->index[mid]->ld_key, key))
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return lo;
+}
+
+/* add used slot @slot to the index */
+static void cbk_index_insert(cbk_cache_cpu * cc, cbk_cache_slot * slot)
+{
+	int pos;
+
+	pos = cbk_index_upper(cc, &slot->ld_key);
+	memmove(cc->index + pos + 1, cc->index + pos,
+		(cc->nr_used - pos) * sizeof(cbk_cache_slot *));
+	cc->index[pos] = slot;
+	cc->nr_used++;
+}
+
+/* remove used slot @slot from the index */
+static void cbk_index_remove(cbk_cache_cpu * cc, cbk_cache_slot * slot)
+{
+	int pos;
+
+	/* @slot is among entries with equal keys just before @pos */
+	pos = cbk_index_upper(cc, &slot->ld_key);
+	do {
+		--pos;
+		assert("", pos >= 0);
+	} while (cc->index[pos] != slot);
+	memmove(cc->index + pos, cc->index + pos + 1,
+		(cc->nr_used - pos - 1) * sizeof(cbk_cache_slot *));
+	cc->nr_used--;
+}
+
+static int znode_contains_key_strict(znode * node, const reiser4_key * key,
+				     int isunique);
+
+/* return slot of node at @level which contains @key, NULL if there is no
+ * such node among the nodes around @key in the index */
+static cbk_cache_slot *cbk_cache_probe(cbk_cache_cpu * cc, tree_level level,
+				       const reiser4_key * key, int isunique)
+{
+	int pos;
+	int i;
+
+	assert_spin_locked(&cc->guard);
+
+	/* the node containing @key usually has the greatest left delimiting
+	 * key not greater than @key, but upper level nodes, which have
+	 * smaller keys, are indexed together with leaves. Entry at @pos is
+	 * checked in case the left delimiting key of its node decreased */
+	pos = cbk_index_upper(cc, key);
+	for (i = min(pos, cc->nr_used - 1);
+	     i >= 0 && i >= pos - CBK_CACHE_PROBE; --i) {
+		znode *node = cc->index[i]->node;
+
+		/*
+		 * this is only "guess" anyway---keys are rechecked by
+		 * cbk_cache_scan_slots() when the node is locked.
+		 */
+		if (znode_get_level(node) == level &&
+		    /* reiser4_min_key < key < reiser4_max_key */
+		    znode_contains_key_strict(node, key, isunique))
+			return cc->index[i];
+	}
+	return NULL;
+}
+
 #if REISER4_DEBUG
-/* this function assures that [cbk-cache-invariant] invariant holds */
-static int cbk_cache_invariant(const cbk_cache * cache)
+/* check [cbk-cache-invariant] for the slots of one CPU */
+static int cbk_cache_cpu_invariant(cbk_cache_cpu *cc)
 {
 	cbk_cache_slot *slot;
 	int result;
 	int unused;
+	int used;
+	int i;
 
-	if (cache->nr_slots == 0)
-		return 1;
-
-	assert("nikita-2469", cache != NULL);
 	unused = 0;
+	used = 0;
 	result = 1;
-	read_lock(&((cbk_cache *)cache)->guard);
-	for_all_slots(cache, slot) {
+	spin_lock(&cc->guard);
+	for_all_slots(cc, slot) {
 		/* in LRU first go all `used' slots followed by `unused' */
 		if (unused && (slot->node != NULL))
 			result = 0;
@@ -109,12 +216,13 @@ static int cbk_cache_invariant(const cbk_cache * cache)
 		else {
 			cbk_cache_slot *scan;
 
+			used++;
 			/* all cached nodes are different */
 			scan = slot;
 			while (result) {
 				scan = list_entry(scan->lru.next,
 						  cbk_cache_slot, lru);
-				if (&cache->lru == &scan->lru)
+				if (&cc->lru == &scan->lru)
 					break;
 				if (slot->node == scan->node)
 					result = 0;
@@ -123,10 +231,35 @@ static int cbk_cache_invariant(const cbk_cache * cache)
 		if (!result)
 			break;
 	}
-	read_unlock(&((cbk_cache *)cache)->guard);
+	/* index has all used slots in key order */
+	if (result && used != cc->nr_used)
+		result = 0;
+	for (i = 0; result && i < cc->nr_used; ++i) {
+		if (cc->index[i]->node == NULL ||
+		    (i > 0 && keygt(&cc->index[i - 1]->ld_key,
+				    &cc->index[i]->ld_key)))
+			result = 0;
+	}
+	spin_unlock(&cc->guard);
 	return result;
 }
 
+/* this function assures that [cbk-cache-invariant] invariant holds */
+static int cbk_cache_invariant(const cbk_cache * cache)
+{
+	int cpu;
+
+	assert("nikita-2469", cache != NULL);
+	if (cache->nr_slots == 0)
+		return 1;
+
+	for_each_possible_cpu(cpu) {
+		if (!cbk_cache_cpu_invariant(per_cpu_ptr(cache->cpu, cpu)))
+			return 0;
+	}
+	return 1;
+}
+
 #endif
 
 /* Remove references, if any, to @node from coord cache */
@@ -135,6 +268,7 @@ void cbk_cache_invalidate(const znode * node /* node to remove from cache */ ,
 {
 	cbk_cache_slot *slot;
 	cbk_cache *cache;
+	int cpu;
 	int i;
 
 	assert("nikita-350", node != NULL);
@@ -143,15 +277,28 @@ void cbk_cache_invalidate(const znode * node /* node to remove from cache */ ,
 	cache = &tree->cbk_cache;
 	assert("nikita-2470", cbk_cache_invariant(cache));
 
-	write_lock(&(cache->guard));
-	for (i = 0, slot = cache->slot; i < cache->nr_slots; ++i, ++slot) {
-		if (slot->node == node) {
-			list_move_tail(&slot->lru, &cache->lru);
-			slot->node = NULL;
-			break;
+	/* the last reference to @node is being dropped, so nobody can add it
+	 * to the cache concurrently */
+	if (cache->cpu == NULL || !JF_ISSET(ZJNODE(node), JNODE_CBK_CACHED))
+		return;
+
+	for_each_possible_cpu(cpu) {
+		cbk_cache_cpu *cc = per_cpu_ptr(cache->cpu, cpu);
+
+		spin_lock(&cc->guard);
+		for (i = 0, slot = cc->slot; i < cache->nr_slots;
+		     ++i, ++slot) {
+			if (slot->node == node) {
+				cbk_index_remove(cc, slot);
+				list_move_tail(&slot->lru, &cc->lru);
+				slot->node = NULL;
+				cc->invalidations++;
+				break;
+			}
 		}
+		spin_unlock(&cc->guard);
 	}
-	write_unlock(&(cache->guard));
+	JF_CLR(ZJNODE((znode *) node), JNODE_CBK_CACHED);
 	assert("nikita-2471", cbk_cache_invariant(cache));
 }
 
@@ -160,8 +307,9 @@ void cbk_cache_invalidate(const znode * node /* node to remove from cache */ ,
 static void cbk_cache_add(const znode * node/* node to add to the cache */)
 {
 	cbk_cache *cache;
-
+	cbk_cache_cpu *cc;
 	cbk_cache_slot *slot;
+	reiser4_key ld_key;
 	int i;
 
 	assert("nikita-352", node != NULL);
@@ -172,23 +320,63 @@ static void cbk_cache_add(const znode * node/* node to add to the cache */)
 	if (cache->nr_slots == 0)
 		return;
 
-	write_lock(&(cache->guard));
+	znode_read_dk(node, &ld_key, NULL);
+
+	JF_SET(ZJNODE((znode *) node), JNODE_CBK_CACHED);
+	cc = get_cpu_ptr(cache->cpu);
+	spin_lock(&cc->guard);
 	/* find slot to update/add */
-	for (i = 0, slot = cache->slot; i < cache->nr_slots; ++i, ++slot) {
+	for (i = 0, slot = cc->slot; i < cache->nr_slots; ++i, ++slot) {
 		/* oops, this node is already in a cache */
 		if (slot->node == node)
 			break;
 	}
-	/* if all slots are used, reuse least recently used one */
 	if (i == cache->nr_slots) {
-		slot = list_entry(cache->lru.prev, cbk_cache_slot, lru);
+		/* if all slots are used, reuse least recently used one */
+		slot = list_entry(cc->lru.prev, cbk_cache_slot, lru);
+		if (slot->node != NULL)
+			cbk_index_remove(cc, slot);
 		slot->node = (znode *) node;
+		slot->ld_key = ld_key;
+		cbk_index_insert(cc, slot);
+	} else if (!keyeq(&slot->ld_key, &ld_key)) {
+		/* node was balanced since it was added, update the index */
+		cbk_index_remove(cc, slot);
+		slot->ld_key = ld_key;
+		cbk_index_insert(cc, slot);
 	}
-	list_move(&slot->lru, &cache->lru);
-	write_unlock(&(cache->guard));
+	list_move(&slot->lru, &cc->lru);
+	spin_unlock(&cc->guard);
+	put_cpu_ptr(cache->cpu);
 	assert("nikita-2473", cbk_cache_invariant(cache));
 }
 
+/**
+ * cbk_cache_stat - collect cbk cache statistics
+ * @cache: cache to collect statistics of
+ * @hits: number of lookups satisfied by the cache
+ * @misses: number of lookups which went through the tree
+ * @invalidations: number of cached nodes removed from the cache
+ *
+ * Counters of all CPUs are summed without locking.
+ */
+void cbk_cache_stat(const cbk_cache * cache, unsigned long *hits,
+		    unsigned long *misses, unsigned long *invalidations)
+{
+	int cpu;
+
+	*hits = *misses = *invalidations = 0;
+	if (cache->cpu == NULL)
+		return;
+	for_each_possible_cpu(cpu) {
+		cbk_cache_cpu *cc = per_cpu_ptr(cache->cpu, cpu);
+
+		*hits += READ_ONCE(cc->hits);
+		*misses += READ_ONCE(cc->misses);
+		*invalidations += READ_ONCE(cc->invalidations);
+	}
+}
+
 static int setup_delimiting_keys(cbk_handle * h);
 static lookup_result coord_by_handle(cbk_handle * handle);
 static lookup_result traverse_tree(cbk_handle * h);
@@ -323,6 +511,87 @@ lookup_result coord_by_key(reiser4_tree * tree	/* tree to perform search
 	return result;
 }
 
+/**
+ * reiser4_finger_lookup - tree lookup starting from a finger
+ * @object: object to use vroot of, may be NULL
+ * @finger: nodes where previous lookup stopped, updated on success
+ *
+ * Like reiser4_object_lookup(), but first tries to start the traversal from
+ * the nodes of @finger, if they are still in memory and cover @key. This
+ * helps sequential accesses when a seal is broken by a concurrent
+ * modification of the node: the node or its parent most likely still covers
+ * the key.
+ */
+lookup_result reiser4_finger_lookup(struct inode *object,
+				    reiser4_finger *finger,
+				    const reiser4_key * key,
+				    coord_t *coord,
+				    lock_handle * lh,
+				    znode_lock_mode lock_mode,
+				    lookup_bias bias,
+				    tree_level lock_level,
+				    tree_level stop_level, __u32 flags,
+				    ra_info_t *info)
+{
+	cbk_handle handle;
+	lock_handle parent_lh;
+	lookup_result result;
+
+	init_lh(lh);
+	init_lh(&parent_lh);
+
+	assert("", finger != NULL);
+	assert("nikita-3023", reiser4_schedulable());
+	assert("nikita-354", key != NULL);
+	assert("nikita-355", coord != NULL);
+	assert("nikita-356", (bias == FIND_EXACT)
+	       || (bias == FIND_MAX_NOT_MORE_THAN));
+	assert("nikita-357", stop_level >= LEAF_LEVEL);
+	/* no locks can be held during tree search by key */
+	assert("nikita-2104", lock_stack_isclean(get_current_lock_stack()));
+
+	cbk_pack(&handle,
+		 object != NULL ? reiser4_tree_by_inode(object) : current_tree,
+		 key,
+		 coord,
+		 lh,
+		 &parent_lh,
+		 lock_mode, bias, lock_level, stop_level, flags, info);
+	handle.object = object;
+	handle.finger = finger;
+
+	result = coord_by_handle(&handle);
+	assert("nikita-3247",
+	       ergo(!IS_CBKERR(result), coord->node == lh->node));
+	if (!IS_CBKERR(result))
+		reiser4_finger_set(finger, coord->node);
+	return result;
+}
+
+/**
+ * reiser4_finger_set - remember path to a node
+ * @finger: finger to update
+ * @node: locked node lookup stopped at
+ */
+void reiser4_finger_set(reiser4_finger *finger, znode *node)
+{
+	reiser4_tree *tree = znode_get_tree(node);
+	znode *parent;
+
+	assert("", znode_is_any_locked(node));
+
+	finger->block[0] = 0;
+	finger->block[1] = 0;
+	if (!reiser4_blocknr_is_fake(znode_get_block(node)))
+		finger->block[0] = *znode_get_block(node);
+	read_lock_tree(tree);
+	parent = znode_parent(node);
+	if (parent != NULL && !znode_above_root(parent) &&
+	    !reiser4_blocknr_is_fake(znode_get_block(parent)))
+		finger->block[1] = *znode_get_block(parent);
+	read_unlock_tree(tree);
+}
+
 /* like coord_by_key(), but starts traversal from vroot of @object rather than
  * from tree root. */
 lookup_result reiser4_object_lookup(struct inode *object,
@@ -375,11 +644,17 @@ static lookup_result coord_by_handle(cbk_handle * handle)
 	 * first check cbk_cache (which is look-aside cache for our tree) and
 	 * of this fails, start traversal.
 	 */
+	reiser4_stat_inc(handle->tree->super, REISER4_STAT_LOOKUPS);
+	reiser4_hot_key(handle->tree, handle->key);
 	/* first check whether "key" is in cache of recent lookups. */
-	if (cbk_cache_search(handle) == 0)
+	if (cbk_cache_search(handle) == 0) {
+		trace_reiser4_coord_by_key(handle->tree->super,
+					   get_key_objectid(handle->key),
+					   get_key_offset(handle->key), 1, 0, 0,
+					   handle->result);
 		return handle->result;
-	else
-		return traverse_tree(handle);
+	}
+	return traverse_tree(handle);
 }
 
 /* Execute actor for each item (or unit, depending on @through_units_p),
@@ -459,6 +734,104 @@ int reiser4_iterate_tree(reiser4_tree * tree /* tree to scan */ ,
 	return result;
 }
 
+/* look @h->key up in the node locked by @h->active_lh without tree
+ * traversal. Returns 0 if the node covers the key and lookup finished in
+ * it (or in its neighbor, for non-unique keys and extents), -ENOENT
+ * otherwise. */
+static int lookup_in_locked_node(cbk_handle * h)
+{
+	znode *node = h->active_lh->node;
+	level_lookup_result llr;
+	int inside;
+
+	inside = (znode_contains_key_strict(node, h->key,
+					    h->flags & CBK_UNIQUE) &&
+		  !ZF_ISSET(node, JNODE_HEARD_BANSHEE));
+	if (!inside || zload(node) != 0)
+		return RETERR(-ENOENT);
+
+	h->level = znode_get_level(node);
+	h->result = CBK_COORD_FOUND;
+	coord_init_zero(h->coord);
+	llr = cbk_node_lookup(h);
+	zrelse(node);
+	done_lh(h->parent_lh);
+	if (llr != LOOKUP_DONE || IS_CBKERR(h->result))
+		return RETERR(-ENOENT);
+	return 0;
+}
+
+/**
+ * reiser4_iterate_keys - look up a vector of sorted keys
+ * @tree: tree to search in
+ * @keys: keys to look up, in ascending order
+ * @nr_keys: number of keys
+ * @mode: lock mode to put on the nodes found
+ * @bias: lookup bias, as for coord_by_key()
+ * @lock_level: as for coord_by_key()
+ * @stop_level: as for coord_by_key()
+ * @flags: as for coord_by_key()
+ * @actor: called for each key with position found in the tree
+ * @arg: passed to @actor
+ *
+ * A key which falls into the node where the previous key was found is looked
+ * up in that node without releasing its lock and without a tree traversal, so
+ * each leaf is locked and searched from the top once for a run of close keys.
+ * Other keys are looked up by coord_by_key().
+ *
+ * @actor gets the lookup result (CBK_COORD_FOUND or CBK_COORD_NOTFOUND) and
+ * must not release @lh. If @actor returns negative value, iteration stops and
+ * that value is returned. Otherwise 0 or lookup error is returned.
+ */
+int reiser4_iterate_keys(reiser4_tree * tree, const reiser4_key * keys,
+			 int nr_keys, znode_lock_mode mode, lookup_bias bias,
+			 tree_level lock_level, tree_level stop_level,
+			 __u32 flags, keys_iterate_actor_t actor, void *arg)
+{
+	cbk_handle handle;
+	lock_handle lh;
+	lock_handle parent_lh;
+	coord_t coord;
+	int result = 0;
+	int i;
+
+	assert("", keys != NULL);
+	assert("", actor != NULL);
+	assert("", lock_stack_isclean(get_current_lock_stack()));
+
+	init_lh(&lh);
+	init_lh(&parent_lh);
+	/* found nodes are in cbk cache already, do not reshuffle it */
+	cbk_pack(&handle, tree, NULL, &coord, &lh, &parent_lh, mode, bias,
+		 lock_level, stop_level, flags | CBK_IN_CACHE, NULL);
+
+	for (i = 0; i < nr_keys; i++) {
+		lookup_result found;
+
+		assert("", ergo(i > 0, keyle(&keys[i - 1], &keys[i])));
+
+		handle.key = &keys[i];
+		if (lh.node != NULL && lookup_in_locked_node(&handle) == 0)
+			found = handle.result;
+		else {
+			done_lh(&lh);
+			found = coord_by_key(tree, &keys[i], &coord, &lh, mode,
+					     bias, lock_level, stop_level,
+					     flags, NULL);
+			if (IS_CBKERR(found)) {
+				result = found;
+				break;
+			}
+		}
+		result = actor(tree, &coord, &lh, i, found, arg);
+		if (result < 0)
+			break;
+		result = 0;
+	}
+	done_lh(&lh);
+	return result;
+}
+
 /* return locked uber znode for @tree */
 int get_uber_znode(reiser4_tree * tree, znode_lock_mode mode,
 		   znode_lock_request pri, lock_handle * lh)
@@ -480,15 +853,18 @@ static int znode_contains_key_strict(znode * node	/* node to check key
 				     key /* key to check */ ,
 				     int isunique)
 {
+	reiser4_key ld;
+	reiser4_key rd;
 	int answer;
 
 	assert("nikita-1760", node != NULL);
 	assert("nikita-1722", key != NULL);
 
-	if (keyge(key, &node->rd_key))
+	znode_read_dk(node, &ld, &rd);
+	if (keyge(key, &rd))
 		return 0;
 
-	answer = keycmp(&node->ld_key, key);
+	answer = keycmp(&ld, key);
 
 	if (isunique)
 		return answer != GREATER_THAN;
@@ -571,25 +947,16 @@ static void handle_vroot(struct inode *object, znode * node)
 }
 
 /*
- * helper function used by traverse tree to start tree traversal not from the
- * tree root, but from @h->object's vroot, if possible.
+ * start tree traversal from referenced @node, which is supposed to cover
+ * @h->key. Reference to @node is released.
  */
-static int prepare_object_lookup(cbk_handle * h)
+static int lookup_from_node(cbk_handle * h, znode * node)
 {
-	znode *vroot;
 	int result;
 
-	vroot = inode_get_vroot(h->object);
-	if (vroot == NULL) {
-		/*
-		 * object doesn't have known vroot, start from real tree root.
-		 */
-		return LOOKUP_CONT;
-	}
-
-	h->level = znode_get_level(vroot);
-	/* take a long-term lock on vroot */
-	h->result = longterm_lock_znode(h->active_lh, vroot,
+	h->level = znode_get_level(node);
+	/* take a long-term lock on node */
+	h->result = longterm_lock_znode(h->active_lh, node,
 					cbk_lock_mode(h->level, h),
 					ZNODE_LOCK_LOPRI);
 	result = LOOKUP_REST;
@@ -598,18 +965,16 @@ static int prepare_object_lookup(cbk_handle * h)
 		int inside;
 
 		isunique = h->flags & CBK_UNIQUE;
-		/* check that key is inside vroot */
-		read_lock_dk(h->tree);
-		inside = (znode_contains_key_strict(vroot, h->key, isunique) &&
-			  !ZF_ISSET(vroot, JNODE_HEARD_BANSHEE));
-		read_unlock_dk(h->tree);
+		/* check that key is inside node */
+		inside = (znode_contains_key_strict(node, h->key, isunique) &&
+			  !ZF_ISSET(node, JNODE_HEARD_BANSHEE));
 		if (inside) {
-			h->result = zload(vroot);
+			h->result = zload(node);
 			if (h->result == 0) {
-				/* search for key in vroot. */
+				/* search for key in node. */
 				result = cbk_node_lookup(h);
-				zrelse(vroot);	/*h->active_lh->node); */
-				if (h->active_lh->node != vroot) {
+				zrelse(node);	/*h->active_lh->node); */
+				if (h->active_lh->node != node) {
 					result = LOOKUP_REST;
 				} else if (result == LOOKUP_CONT) {
 					move_lh(h->parent_lh, h->active_lh);
@@ -619,13 +984,248 @@ static int prepare_object_lookup(cbk_handle * h)
 		}
 	}
 
-	zput(vroot);
+	zput(node);
 
 	if (IS_CBKERR(h->result) || result == LOOKUP_REST)
 		hput(h);
 	return result;
 }
 
+/* prepare @h for another start after lookup_from_node() failed */
+static void reset_start(cbk_handle * h)
+{
+	h->result = CBK_COORD_FOUND;
+	h->ld_key = *reiser4_min_key();
+	h->rd_key = *reiser4_max_key();
+	h->flags |= CBK_DKSET;
+	h->error = NULL;
+}
+
+/*
+ * try to start tree traversal from nodes of @h->finger, lowest first.
+ * Returns LOOKUP_REST if none of them covers the key.
+ */
+static int prepare_finger_lookup(cbk_handle * h)
+{
+	int result;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(h->finger->block); i++) {
+		znode *node;
+
+		if (h->finger->block[i] == 0)
+			continue;
+		node = zlook(h->tree, &h->finger->block[i]);
+		if (node == NULL)
+			continue;
+		if (znode_get_level(node) < h->stop_level) {
+			zput(node);
+			continue;
+		}
+		result = lookup_from_node(h, node);
+		if (result != LOOKUP_REST)
+			return result;
+		/* failure to use the finger is not an error */
+		reset_start(h);
+	}
+	return LOOKUP_REST;
+}
+
+#if !REISER4_DEBUG && !defined(CONFIG_HIGHMEM)
+/*
+ * Levels of the tree above the first node a lookup locks are descended
+ * without taking long-term locks, so readers do not write to zlocks of the
+ * root and other shared upper nodes. A node is searched in place, and the
+ * search is trusted if the write lock sequence count of the node did not
+ * change meanwhile (see zlock->wseq). Node plugins check that nodes they look
+ * into are locked in debug builds, and with highmem data of unlocked node may
+ * be unmapped, so this is not done there.
+ */
+#define OPTIMISTIC_CBK (1)
+#else
+#define OPTIMISTIC_CBK (0)
+#endif
+
+/* referenced znode of @blk at @level, or NULL */
+static znode *zlook_level(reiser4_tree * tree, const reiser4_block_nr * blk,
+			  tree_level level)
+{
+	znode *node;
+
+	node = zlook(tree, blk);
+	if (node != NULL && znode_get_level(node) != level) {
+		zput(node);
+		node = NULL;
+	}
+	return node;
+}
+
+#if OPTIMISTIC_CBK
+/*
+ * find the child of cached @node the search for @key goes to, without
+ * locking @node. Caller holds rcu_read_lock(). Returns 0 on success, -EAGAIN
+ * if @node was write locked, not loaded, or changed during the search.
+ */
+static int optimistic_child(znode * node, const reiser4_key * key,
+			    reiser4_block_nr * child)
+{
+	struct page *pg;
+	item_plugin *iplug;
+	coord_t coord;
+	unsigned seq;
+
+	seq = raw_read_seqcount(&node->lock.wseq);
+	if (seq & 1)
+		return -EAGAIN;
+	pg = READ_ONCE(ZJNODE(node)->pg);
+	if (pg == NULL || !ZF_ISSET(node, JNODE_PARSED) ||
+	    ZF_ISSET(node, JNODE_HEARD_BANSHEE) ||
+	    READ_ONCE(ZJNODE(node)->data) == NULL)
+		return -EAGAIN;
+	smp_rmb();
+
+	if (NODE_CALL(node->nplug, lookup, node, key, FIND_MAX_NOT_MORE_THAN,
+		      &coord) != NS_FOUND)
+		return -EAGAIN;
+	/* item header may be garbage if node was modified */
+	if (read_seqcount_retry(&node->lock.wseq, seq) ||
+	    !item_is_internal(&coord))
+		return -EAGAIN;
+	iplug = item_plugin_by_coord(&coord);
+	iplug->s.internal.down_link(&coord, key, child);
+
+	smp_rmb();
+	if (read_seqcount_retry(&node->lock.wseq, seq) ||
+	    READ_ONCE(ZJNODE(node)->pg) != pg ||
+	    !ZF_ISSET(node, JNODE_PARSED))
+		return -EAGAIN;
+	return 0;
+}
+
+/*
+ * descend from the tree root to the level where @h wants its first lock along
+ * nodes which are in memory, without locking them. Returns referenced znode
+ * to start the locked search from: the node at that level if it is cached,
+ * otherwise the deepest node the descent got to. NULL is returned if that is
+ * the root. The znode is not necessarily the right one: that is checked under
+ * lock by lookup_from_node().
+ */
+static znode *optimistic_descent(cbk_handle * h)
+{
+	reiser4_block_nr blk;
+	/* deepest node reached */
+	reiser4_block_nr last = 0;
+	tree_level last_level = 0;
+	tree_level height;
+	tree_level level;
+	tree_level target;
+	znode *node;
+
+	target = max(h->lock_level, h->stop_level);
+	height = READ_ONCE(h->tree->height);
+	if (height <= target)
+		return NULL;
+	blk = READ_ONCE(h->tree->root_block);
+	rcu_read_lock();
+	for (level = height; level > target; --level) {
+		node = zlook_rcu(h->tree, &blk);
+		if (node == NULL || znode_get_level(node) != level)
+			break;
+		last = blk;
+		last_level = level;
+		/* extent items on the twig level also stop the descent */
+		if (optimistic_child(node, h->key, &blk) != 0)
+			break;
+	}
+	rcu_read_unlock();
+
+	if (level == target) {
+		node = zlook_level(h->tree, &blk, target);
+		if (node != NULL)
+			return node;
+	}
+	if (last == 0 || last_level == height)
+		return NULL;
+	return zlook_level(h->tree, &last, last_level);
+}
+#endif
+
+/*
+ * start tree traversal from the root node if it is in memory, without
+ * locking uber znode first. Root block and tree height are read consistently
+ * against the root epoch (->root_seq). Uber znode is still write locked by
+ * tree growth, tree shrink and relocation of the root, which bump the epoch.
+ * If the root changes after it was read, lookup_from_node() finds out under
+ * the node lock that the node no longer covers the key or is dying, and
+ * LOOKUP_REST is returned.
+ */
+static int prepare_root_lookup(cbk_handle * h)
+{
+	reiser4_tree *tree = h->tree;
+	reiser4_block_nr blk;
+	tree_level height;
+	unsigned seq;
+	znode *root;
+
+	do {
+		seq = read_seqcount_begin(&tree->root_seq);
+		blk = tree->root_block;
+		height = tree->height;
+	} while (read_seqcount_retry(&tree->root_seq, seq));
+
+	if (height < h->stop_level)
+		return LOOKUP_REST;
+	root = zlook_level(tree, &blk, height);
+	if (root == NULL)
+		return LOOKUP_REST;
+	return lookup_from_node(h, root);
+}
+
+/*
+ * helper function used by traverse tree to start tree traversal not from
+ * uber znode, but from @h->finger, from @h->object's vroot, from a node
+ * found by optimistic descent of the upper levels, or from the cached root,
+ * if possible.
+ */
+static int prepare_object_lookup(cbk_handle * h)
+{
+	znode *vroot;
+	int result;
+
+	if (h->finger != NULL) {
+		result = prepare_finger_lookup(h);
+		if (result != LOOKUP_REST)
+			return result;
+	}
+	if (h->object != NULL) {
+		vroot = inode_get_vroot(h->object);
+		/*
+		 * if object doesn't have known vroot, start from real tree
+		 * root.
+		 */
+		if (vroot != NULL) {
+			result = lookup_from_node(h, vroot);
+			if (result != LOOKUP_REST)
+				return result;
+			reset_start(h);
+		}
+	}
+#if OPTIMISTIC_CBK
+	{
+		znode *node;
+
+		node = optimistic_descent(h);
+		if (node != NULL)
+			return lookup_from_node(h, node);
+	}
+#endif
+	result = prepare_root_lookup(h);
+	if (result != LOOKUP_REST)
+		return result;
+	reset_start(h);
+	return LOOKUP_CONT;
+}
+
 /* main function that handles common parts of tree traversal: starting
     (fake znode handling), restarts, error handling, completion */
 static lookup_result traverse_tree(cbk_handle * h/* search handle */)
@@ -633,6 +1233,8 @@ static lookup_result traverse_tree(cbk_handle * h/* search handle */)
 	int done;
 	int iterations;
 	int vroot_used;
+	int levels = 0;
+	int restarts = 0;
 
 	assert("nikita-365", h != NULL);
 	assert("nikita-366", h->tree != NULL);
@@ -660,7 +1262,7 @@ restart:
 	h->flags |= CBK_DKSET;
 	h->error = NULL;
 
-	if (!vroot_used && h->object != NULL) {
+	if (!vroot_used) {
 		vroot_used = 1;
 		done = prepare_object_lookup(h);
 		if (done == LOOKUP_REST)
@@ -700,14 +1302,17 @@ restart:
 		}
 		switch (cbk_level_lookup(h)) {
 		case LOOKUP_CONT:
+			++levels;
 			move_lh(h->parent_lh, h->active_lh);
 			continue;
 		default:
 			wrong_return_value("nikita-372", "cbk_level");
 		case LOOKUP_DONE:
+			++levels;
 			done = 1;
 			break;
 		case LOOKUP_REST:
+			++restarts;
 			hput(h);
 			/* deadlock avoidance is normal case. */
 			if (h->result != -E_DEADLOCK)
@@ -739,6 +1344,9 @@ restart:
 			     (!node_is_empty(h->coord->node)),
 			     coord_is_existing_item(h->coord))));
 	}
+	trace_reiser4_coord_by_key(h->tree->super, get_key_objectid(h->key),
+				   get_key_offset(h->key), 0, levels, restarts,
+				   h->result);
 	return h->result;
 }
 
@@ -809,9 +1417,11 @@ set_child_delimiting_keys(znode * parent, const coord_t *coord, znode * child)
 		tree = znode_get_tree(parent);
 		write_lock_dk(tree);
 		if (likely(!ZF_ISSET(child, JNODE_DKSET))) {
+			write_seqcount_begin(&child->dk_seq);
 			find_child_delimiting_keys(parent, coord,
 						   &child->ld_key,
 						   &child->rd_key);
+			write_seqcount_end(&child->dk_seq);
 			ON_DEBUG(child->ld_key_version =
 				 atomic_inc_return(&delim_key_version);
 				 child->rd_key_version =
@@ -838,13 +1448,24 @@ static level_lookup_result cbk_level_lookup(cbk_handle * h/* search handle */)
 	reiser4_key ldkey;
 	reiser4_key key;
 	znode *active;
+	/* @h->coord is at the item of parent pointing to @active */
+	int down;
 
 	assert("nikita-3025", reiser4_schedulable());
 
 	/* acquire reference to @active node */
-	active =
-	    zget(h->tree, &h->block, h->parent_lh->node, h->level,
-		 reiser4_ctx_gfp_mask_get());
+	down = h->coord->node != NULL && h->coord->node == h->parent_lh->node;
+	active = NULL;
+	if (down)
+		active = zlook_child(h->coord->node, h->coord->item_pos,
+				     &h->block);
+	if (active == NULL) {
+		active = zget(h->tree, &h->block, h->parent_lh->node,
+			      h->level, reiser4_ctx_gfp_mask_get());
+		if (down && !IS_ERR(active))
+			zcache_child(h->coord->node, h->coord->item_pos,
+				     active);
+	}
 
 	if (IS_ERR(active)) {
 		h->result = PTR_ERR(active);
@@ -1025,16 +1646,15 @@ void check_dkeys(znode * node)
 /* true if @key is left delimiting key of @node */
 static int key_is_ld(znode * node, const reiser4_key * key)
 {
-	int ld;
+	reiser4_key ld;
+	reiser4_key rd;
 
 	assert("nikita-1716", node != NULL);
 	assert("nikita-1758", key != NULL);
 
-	read_lock_dk(znode_get_tree(node));
-	assert("nikita-1759", znode_contains_key(node, key));
-	ld = keyeq(znode_get_ld_key(node), key);
-	read_unlock_dk(znode_get_tree(node));
-	return ld;
+	znode_read_dk(node, &ld, &rd);
+	assert("nikita-1759", keyle(&ld, key) && keyle(key, &rd));
+	return keyeq(&ld, key);
 }
 
 /* Process one node during tree traversal.
@@ -1068,7 +1688,7 @@ static level_lookup_result cbk_node_lookup(cbk_handle * h/* search handle */)
 	/* return item from "active" node with maximal key not greater than
 	   "key"  */
 	node_bias = h->bias;
-	result = nplug->lookup(active, h->key, node_bias, h->coord);
+	result = NODE_CALL(nplug, lookup, active, h->key, node_bias, h->coord);
 	if (unlikely(result != NS_FOUND && result != NS_NOT_FOUND)) {
 		/* error occurred */
 		h->result = result;
@@ -1111,6 +1731,10 @@ static level_lookup_result cbk_node_lookup(cbk_handle * h/* search handle */)
 	assert("nikita-2116", item_is_internal(h->coord));
 	iplug = item_plugin_by_coord(h->coord);
 	iplug->s.internal.down_link(h->coord, h->key, &h->block);
+	/* start reads of the leaves readahead is going to want before the
+	   first of them is read synchronously */
+	if (h->ra_info != NULL && h->level == TWIG_LEVEL)
+		reiser4_prefetch_children(h->coord, h->ra_info);
 	zrelse(h->coord->node);
 	--h->level;
 	return LOOKUP_CONT;	/* continue */
@@ -1124,6 +1748,7 @@ static int cbk_cache_scan_slots(cbk_handle * h/* cbk handle */)
 	reiser4_tree *tree;
 	cbk_cache_slot *slot;
 	cbk_cache *cache;
+	cbk_cache_cpu *cc;
 	tree_level level;
 	int isunique;
 	const reiser4_key *key;
@@ -1150,12 +1775,12 @@ static int cbk_cache_scan_slots(cbk_handle * h/* cbk handle */)
 	 * this is time-critical function and dragons had, hence, been settled
 	 * here.
 	 *
-	 * Loop below scans cbk cache slots trying to find matching node with
+	 * cbk_cache_probe() looks in cbk cache index for matching node with
 	 * suitable range of delimiting keys and located at the h->level.
 	 *
-	 * Scan is done under cbk cache spin lock that protects slot->node
-	 * pointers. If suitable node is found we want to pin it in
-	 * memory. But slot->node can point to the node with x_count 0
+	 * Scan is done under spin lock of the cbk cache of this CPU that
+	 * protects slot->node pointers. If suitable node is found we want to
+	 * pin it in memory. But slot->node can point to the node with x_count 0
 	 * (unreferenced). Such node can be recycled at any moment, or can
 	 * already be in the process of being recycled (within jput()).
 	 *
@@ -1167,39 +1792,18 @@ static int cbk_cache_scan_slots(cbk_handle * h/* cbk handle */)
 	 */
 
 	rcu_read_lock();
-	read_lock(&((cbk_cache *)cache)->guard);
-
-	slot = list_entry(cache->lru.next, cbk_cache_slot, lru);
-	slot = list_entry(slot->lru.prev, cbk_cache_slot, lru);
-	BUG_ON(&slot->lru != &cache->lru);/*????*/
-	while (1) {
-
-		slot = list_entry(slot->lru.next, cbk_cache_slot, lru);
-
-		if (&cache->lru != &slot->lru)
-			node = slot->node;
-		else
-			node = NULL;
-
-		if (unlikely(node == NULL))
-			break;
-
-		/*
-		 * this is (hopefully) the only place in the code where we are
-		 * working with delimiting keys without holding dk lock. This
-		 * is fine here, because this is only "guess" anyway---keys
-		 * are rechecked under dk lock below.
-		 */
-		if (znode_get_level(node) == level &&
-		    /* reiser4_min_key < key < reiser4_max_key */
-		    znode_contains_key_strict(node, key, isunique)) {
-			zref(node);
-			result = 0;
-			spin_lock_prefetch(&tree->tree_lock);
-			break;
-		}
+	cc = get_cpu_ptr(cache->cpu);
+	spin_lock(&cc->guard);
+
+	slot = cbk_cache_probe(cc, level, key, isunique);
+	if (slot != NULL) {
+		node = slot->node;
+		zref(node);
+		result = 0;
+		spin_lock_prefetch(&tree->tree_lock);
 	}
-	read_unlock(&((cbk_cache *)cache)->guard);
+	spin_unlock(&cc->guard);
+	put_cpu_ptr(cache->cpu);
 
 	assert("nikita-2475", cbk_cache_invariant(cache));
 
@@ -1224,10 +1828,8 @@ static int cbk_cache_scan_slots(cbk_handle * h/* cbk handle */)
 		return result;
 
 	/* recheck keys */
-	read_lock_dk(tree);
 	result = (znode_contains_key_strict(node, key, isunique) &&
 		!ZF_ISSET(node, JNODE_HEARD_BANSHEE));
-	read_unlock_dk(tree);
 	if (result) {
 		/* do lookup inside node */
 		llr = cbk_node_lookup(h);
@@ -1245,13 +1847,15 @@ static int cbk_cache_scan_slots(cbk_handle * h/* cbk handle */)
 			/* good. Either item found or definitely not found. */
 			result = 0;
 
-			write_lock(&(cache->guard));
+			/* this thread could have migrated to another CPU
+			   meanwhile, the slot is still in @cc */
+			spin_lock(&cc->guard);
 			if (slot->node == h->active_lh->node) {
 				/* if this node is still in cbk cache---move
 				   its slot to the head of the LRU list. */
-				list_move(&slot->lru, &cache->lru);
+				list_move(&slot->lru, &cc->lru);
 			}
-			write_unlock(&(cache->guard));
+			spin_unlock(&cc->guard);
 		}
 	} else {
 		/* race. While this thread was waiting for the lock, node was
@@ -1306,6 +1910,12 @@ static int cbk_cache_search(cbk_handle * h/* cbk handle */)
 		}
 	}
 	h->flags &= ~CBK_IN_CACHE;
+	if (h->tree->cbk_cache.cpu != NULL) {
+		if (result == 0)
+			this_cpu_inc(h->tree->cbk_cache.cpu->hits);
+		else
+			this_cpu_inc(h->tree->cbk_cache.cpu->misses);
+	}
 	return result;
 }
 
@@ -1342,22 +1952,23 @@ static void update_stale_dk(reiser4_tree * tree, znode * node)
 {
 	znode *right;
 	reiser4_key rd;
+	reiser4_key ld;
+	int stale = 0;
 
+	/* keys are compared without dk lock, stale_dk() checks them again */
 	read_lock_tree(tree);
-	read_lock_dk(tree);
-	rd = *znode_get_rd_key(node);
 	right = node->right;
-	if (unlikely(ZF_ISSET(node, JNODE_RIGHT_CONNECTED) &&
-		     right && ZF_ISSET(right, JNODE_DKSET) &&
-		     !keyeq(&rd, znode_get_ld_key(right)))) {
+	if (ZF_ISSET(node, JNODE_RIGHT_CONNECTED) &&
+	    right && ZF_ISSET(right, JNODE_DKSET)) {
+		znode_read_dk(node, NULL, &rd);
+		znode_read_dk(right, &ld, NULL);
+		stale = !keyeq(&rd, &ld);
+	}
+	read_unlock_tree(tree);
+	if (unlikely(stale)) {
 		assert("nikita-38211", ZF_ISSET(node, JNODE_DKSET));
-		read_unlock_dk(tree);
-		read_unlock_tree(tree);
 		stale_dk(tree, node);
-		return;
 	}
-	read_unlock_dk(tree);
-	read_unlock_tree(tree);
 }
 
 /*
@@ -1425,7 +2036,8 @@ static level_lookup_result search_to_left(cbk_handle * h/* search handle */)
 			bias = h->bias;
 			h->bias = FIND_EXACT;
 			h->result =
-			    nplug->lookup(neighbor, h->key, h->bias, &crd);
+			    NODE_CALL(nplug, lookup, neighbor, h->key, h->bias,
+				      &crd);
 			h->bias = bias;
 
 			if (h->result == NS_NOT_FOUND) {
@@ -1436,10 +2048,8 @@ static level_lookup_result search_to_left(cbk_handle * h/* search handle */)
 	default:		/* some other error */
 				result = LOOKUP_DONE;
 			} else if (h->result == NS_FOUND) {
-				read_lock_dk(znode_get_tree(neighbor));
-				h->rd_key = *znode_get_ld_key(node);
+				znode_read_dk(node, &h->rd_key, NULL);
 				leftmost_key_in_node(neighbor, &h->ld_key);
-				read_unlock_dk(znode_get_tree(neighbor));
 				h->flags |= CBK_DKSET;
 
 				h->block = *znode_get_block(neighbor);
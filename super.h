@@ -7,9 +7,16 @@
 #define __REISER4_SUPER_H__
 
 #include <linux/exportfs.h>
+#include <linux/shrinker.h>
+#include <linux/hashtable.h>
+#include <linux/workqueue.h>
+#include <linux/kobject.h>
+#include <linux/completion.h>
+#include <linux/percpu.h>
 
 #include "tree.h"
 #include "entd.h"
+#include "defrag.h"
 #include "wander.h"
 #include "fsdata.h"
 #include "plugin/object.h"
@@ -23,6 +30,29 @@ struct flush_params {
 	unsigned relocate_distance;
 	unsigned written_threshold;
 	unsigned scan_maxnodes;
+	/* minimal gain (percents of block size) a squeeze must promise */
+	unsigned squeeze_min_gain;
+	/* number of squeezes skipped as unprofitable */
+	atomic_t squeeze_skipped;
+	/* write completion latency (usecs) flush tries to keep, 0 disables
+	   the write congestion controller, see flush_write_throttled() */
+	unsigned target_latency;
+};
+
+/*
+ * State of the flush write congestion controller. Updated from bio
+ * completion, hence the irq-safe lock.
+ */
+struct flush_congestion {
+	spinlock_t lock;
+	/* blocks submitted by write_jnode_list() and not completed yet */
+	atomic_t inflight;
+	/* current limit on ->inflight in blocks */
+	unsigned long window;
+	/* moving average of completion latency in usecs */
+	unsigned long latency;
+	/* when ->window was shrunk last time */
+	ktime_t last_shrink;
 };
 
 typedef enum {
@@ -53,7 +83,26 @@ typedef enum {
 	/* enable issuing of discard requests */
 	REISER4_DISCARD = 8,
 	/* disable hole punching at flush time */
-	REISER4_DONT_PUNCH_HOLES = 9
+	REISER4_DONT_PUNCH_HOLES = 9,
+	/* write journal header together with checksummed wander records, see
+	   update_journal_header_async() */
+	REISER4_ASYNC_COMMIT = 10,
+	/* store wandered map as runs of blocks, see encode_wander_runs() */
+	REISER4_COMPACT_JOURNAL = 11,
+	/* with write-anywhere transaction model, allocate relocated blocks at
+	   the head of a log, see LOG-STRUCTURED ALLOCATION in block_alloc.c */
+	REISER4_LOG_ALLOC = 12,
+	/* delete large files in background, see DEFERRED DELETION in
+	   safe_link.c */
+	REISER4_ASYNC_DELETE = 13,
+	/* fdatasync commits only atoms of the file, see
+	   reiser4_sync_file_common() */
+	REISER4_NARROW_FSYNC = 14,
+	/* charge write-back of file pages to cgroups, see jnode_blkcg_css() */
+	REISER4_CGROUP_WRITEBACK = 15,
+	/* choose cluster size of cryptcompress files by their size, see
+	   auto_cluster() */
+	REISER4_AUTO_CLUSTER = 16
 } reiser4_fs_flag;
 
 /*
@@ -118,6 +167,107 @@ struct object_ops {
       [sb-grabbed]
       [sb-fake-allocated]
 */
+/* per-CPU cache of grabbed blocks not owned by any context, see
+   grab_cached() in block_alloc.c */
+struct reiser4_grab_cache {
+	spinlock_t guard;
+	__u64 nr;
+};
+
+/* per-CPU batch of object ids reserved from super block, see oid.c */
+struct reiser4_oid_batch {
+	spinlock_t guard;
+	/* oids [next, end) are still to be handed out */
+	oid_t next;
+	oid_t end;
+	/* oids allocated less oids released on this CPU, not added to
+	   ->oids_in_use yet */
+	long used;
+};
+
+/* monotonic per-super block event counters exported in
+   /sys/fs/reiser4/<dev>/stats, see sysfs.c */
+typedef enum {
+	/* tree lookups by coord_by_key() */
+	REISER4_STAT_LOOKUPS,
+	/* reads of nodes from disk */
+	REISER4_STAT_NODE_READS,
+	/* reads of formatted nodes started by readahead */
+	REISER4_STAT_READAHEAD,
+	/* nodes captured by atoms */
+	REISER4_STAT_CAPTURES,
+	/* atom fusions */
+	REISER4_STAT_FUSIONS,
+	/* calls of jnode_flush() */
+	REISER4_STAT_FLUSHES,
+	/* squeezes of a node into its left neighbor */
+	REISER4_STAT_SQUEEZES,
+	/* nodes flush decided to relocate */
+	REISER4_STAT_RELOCATIONS,
+	/* wandered and log record blocks written by commits */
+	REISER4_STAT_JOURNAL_BLOCKS,
+	/* bitmap blocks loaded */
+	REISER4_STAT_BITMAP_LOADS,
+	/* slums of allocated blocks adaptive transaction model decided to
+	   overwrite and to relocate */
+	REISER4_STAT_ADAPTIVE_OVERWRITES,
+	REISER4_STAT_ADAPTIVE_RELOCATES,
+	/* stat-data found through the stat-data location cache, and not */
+	REISER4_STAT_SD_CACHE_HITS,
+	REISER4_STAT_SD_CACHE_MISSES,
+	/* renames, and microseconds they held directory leaves write locked */
+	REISER4_STAT_RENAMES,
+	REISER4_STAT_RENAME_LOCK_US,
+	/* carry levels unlocked and locked again, because locking or
+	   balancing of the level had to be repeated */
+	REISER4_STAT_CARRY_RESTARTS,
+	REISER4_STAT_NR
+} reiser4_stat_id;
+
+struct reiser4_stats {
+	unsigned long count[REISER4_STAT_NR];
+};
+
+/* preallocation windows of files, see PREALLOCATION WINDOWS in
+   block_alloc.c */
+struct reiser4_prealloc {
+	spinlock_t guard;
+	/* windows hashed by object id */
+	DECLARE_HASHTABLE(table, REISER4_PREALLOC_HASH_BITS);
+	/* windows, least recently used first */
+	struct list_head lru;
+	unsigned nr;
+	/* number of blocks in all windows */
+	__u64 blocks;
+};
+
+/* where stat-data of evicted inodes were, see STAT-DATA LOCATION CACHE in
+   inode.c */
+struct reiser4_sd_cache {
+	spinlock_t guard;
+	/* 1 << REISER4_SD_CACHE_BITS slots hashed by object id, NULL if they
+	   could not be allocated */
+	struct sd_cache_slot *slots;
+};
+
+/* extents of committed atoms waiting to be discarded, see discard.c */
+struct reiser4_discard_queue {
+	spinlock_t guard;
+	/* blocknr_list of extents, still allocated */
+	struct list_head pending;
+	struct delayed_work work;
+	struct super_block *super;
+};
+
+/* files waiting for background tail2extent conversion, see file.c */
+struct reiser4_conv_queue {
+	spinlock_t guard;
+	/* unix_file_info-s linked by ->conv_link, each holds inode reference */
+	struct list_head inodes;
+	struct work_struct work;
+	struct super_block *super;
+};
+
 struct reiser4_super_info_data {
 	/*
 	 * guard spinlock which protects reiser4 super block fields (currently
@@ -125,10 +275,15 @@ struct reiser4_super_info_data {
 	 */
 	spinlock_t guard;
 
-	/* next oid that will be returned by oid_allocate() */
+	/* next oid that will be reserved for oid_allocate(). Oids below it
+	   may still be in per-CPU batches */
 	oid_t next_to_use;
-	/* total number of used oids */
+	/* total number of used oids, less those counted in per-CPU
+	   batches */
 	oid_t oids_in_use;
+	/* per-CPU batches of reserved oids. NULL if they could not be
+	   allocated */
+	struct reiser4_oid_batch __percpu *oid_batches;
 
 	/* space manager plugin */
 	reiser4_space_allocator space_allocator;
@@ -180,6 +335,13 @@ struct reiser4_super_info_data {
 	 */
 	__u64 blocks_grabbed;
 
+	/*
+	 * per-CPU caches of grabbed blocks which are counted in
+	 * blocks_grabbed, but are not owned by any context. NULL if they
+	 * could not be allocated.
+	 */
+	struct reiser4_grab_cache __percpu *grab_cache;
+
 	/* number of fake allocated unformatted blocks in tree. */
 	__u64 blocks_fake_allocated_unformatted;
 
@@ -208,6 +370,17 @@ struct reiser4_super_info_data {
 
 	/* ent thread */
 	entd_context entd;
+	/* background defragmenter */
+	defrag_context defrag;
+	/* thread replaying unlinks after mount and deleting files deferred by
+	   reiser4_defer_delete(), see safe_link.c */
+	struct task_struct *safelink_tsk;
+	/* set when the thread is to scan safe-links again */
+	atomic_t safelink_pending;
+	/* detaches jnodes from clean cached pages, see shed_page_jnode() */
+	struct shrinker jnode_shrinker;
+	/* frees znodes nothing keeps in memory, see znode_shrink_scan() */
+	struct shrinker znode_shrinker;
 
 	/* fake inode used to bind formatted nodes */
 	struct inode *fake;
@@ -229,12 +402,15 @@ struct reiser4_super_info_data {
 
 	/* parameters for the flush algorithm */
 	struct flush_params flush;
+	struct flush_congestion flush_cong;
 
 	/* pointers to jnodes for journal header and footer */
 	jnode *journal_header;
 	jnode *journal_footer;
 
 	journal_location jloc;
+	/* external journal device, NULL if journal is on the main device */
+	struct reiser4_jdev *jdev;
 
 	/* head block number of last committed transaction */
 	__u64 last_committed_tx;
@@ -244,6 +420,48 @@ struct reiser4_super_info_data {
 	 * allocation
 	 */
 	__u64 blocknr_hint_default;
+	/* head of the log of log-structured allocation, protected by
+	 * super block spin lock */
+	__u64 log_head;
+	/*
+	 * per-CPU versions of the above, see ALLOCATION GROUPS in
+	 * block_alloc.c. NULL if they could not be allocated.
+	 */
+	__u64 __percpu *blocknr_hints;
+
+	/*
+	 * size of preallocation windows in blocks (prealloc_window mount
+	 * option), 0 disables them
+	 */
+	unsigned prealloc_window;
+	struct reiser4_prealloc prealloc;
+
+	/*
+	 * number of free blocks reported by the last statfs, with the time
+	 * it was counted at (0 if it is to be counted again), and how long it
+	 * can be reported again in milliseconds (statfs_cache_age mount
+	 * option). See reiser4_statfs().
+	 */
+	seqlock_t statfs_lock;
+	unsigned long statfs_stamp;
+	__u64 statfs_free;
+	unsigned statfs_cache_age;
+
+	/*
+	 * number of blocks at the start of the device formatted nodes are
+	 * preferably allocated in (meta_zone mount option), 0 if none, and
+	 * where the next search in it starts. See METADATA ZONE in
+	 * block_alloc.c.
+	 */
+	__u64 meta_zone;
+	__u64 meta_zone_next;
+
+	struct reiser4_discard_queue discard;
+
+	struct reiser4_conv_queue conv;
+	/* conversions of files into tails "smart" formatting policy has
+	   refused to do, see tail_policy.c */
+	atomic_t nr_packs_avoided;
 
 	/* committed number of files (oid allocator state variable ) */
 	__u64 nr_files_committed;
@@ -302,6 +520,14 @@ struct reiser4_super_info_data {
 	struct list_head all_jnodes;
 #endif
 	struct dentry *debugfs_root;
+
+	/* per-CPU event counters. NULL if they could not be allocated */
+	struct reiser4_stats __percpu *stats;
+	struct reiser4_sd_cache sd_cache;
+	/* /sys/fs/reiser4/<dev>, registered if ->kobj_registered is set */
+	struct kobject kobj;
+	struct completion kobj_unregister;
+	int kobj_registered;
 };
 
 extern reiser4_super_info_data *get_super_private_nocheck(const struct
@@ -342,6 +568,22 @@ static inline struct formatted_ra_params *get_current_super_ra_params(void)
 	return &(get_current_super_private()->ra_params);
 }
 
+/* add @nr to event counter @id of @super */
+static inline void reiser4_stat_add(const struct super_block *super,
+				    reiser4_stat_id id, unsigned long nr)
+{
+	struct reiser4_stats __percpu *stats = get_super_private(super)->stats;
+
+	if (stats != NULL)
+		this_cpu_add(stats->count[id], nr);
+}
+
+static inline void reiser4_stat_inc(const struct super_block *super,
+				    reiser4_stat_id id)
+{
+	reiser4_stat_add(super, id, 1);
+}
+
 /*
  * true, if @tree represents read-only file system
  */
@@ -424,6 +666,9 @@ extern reiser4_plugin *get_default_plugin(pset_member memb);
 #define  ABSOLUTE_MAX_OID ((oid_t)~0)
 
 #define OIDS_RESERVED  (1 << 16)
+void reiser4_init_oid_batches(struct super_block *);
+void reiser4_done_oid_batches(struct super_block *);
+void oid_return_batches(struct super_block *);
 int oid_init_allocator(struct super_block *, oid_t nr_files, oid_t next);
 oid_t oid_allocate(struct super_block *);
 int oid_release(struct super_block *, oid_t);
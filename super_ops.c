@@ -7,6 +7,9 @@
 #include "flush.h"
 #include "safe_link.h"
 #include "checksum.h"
+#include "carry.h"
+#include "magazine.h"
+#include "sysfs.h"
 
 #include <linux/vfs.h>
 #include <linux/writeback.h>
@@ -114,6 +117,9 @@ static struct inode *reiser4_alloc_inode(struct super_block *super)
 		/* this deals with info's loading semaphore */
 		loading_alloc(info);
 		info->vroot = UBER_TREE_ADDR;
+		info->lookup_filter = NULL;
+		info->overwrites = 0;
+		info->appends = 0;
 		return &obj->vfs_inode;
 	} else
 		return NULL;
@@ -139,6 +145,7 @@ static void reiser4_destroy_inode(struct inode *inode)
 			fplug->destroy_inode(inode);
 	}
 	reiser4_dispose_cursors(inode);
+	reiser4_lookup_filter_done(info);
 	if (info->pset)
 		plugin_set_put(info->pset);
 	if (info->hset)
@@ -218,11 +225,16 @@ static void reiser4_evict_inode(struct inode *inode)
 
 	if (inode->i_nlink == 0 && is_inode_loaded(inode)) {
 		fplug = inode_file_plugin(inode);
-		if (fplug != NULL && fplug->delete_object != NULL)
+		if (reiser4_defer_delete(inode))
+			/* safe-link thread will delete the file */
+			;
+		else if (fplug != NULL && fplug->delete_object != NULL)
 			fplug->delete_object(inode);
-	}
+	} else
+		reiser4_sd_cache_remember(inode);
 
 	truncate_inode_pages_final(&inode->i_data);
+	reiser4_prealloc_release(inode->i_sb, get_inode_oid(inode));
 	inode->i_blocks = 0;
 	clear_inode(inode);
 	reiser4_exit_context(ctx);
@@ -245,6 +257,7 @@ static void reiser4_put_super(struct super_block *super)
 	debugfs_remove(sbinfo->tmgr.debugfs_atom_count);
 	debugfs_remove(sbinfo->tmgr.debugfs_id_count);
 	debugfs_remove(sbinfo->debugfs_root);
+	reiser4_sysfs_unregister(super);
 
 	ctx = reiser4_init_context(super);
 	if (IS_ERR(ctx)) {
@@ -272,6 +285,42 @@ static void reiser4_put_super(struct super_block *super)
 	reiser4_done_fs_info(super);
 }
 
+/*
+ * Number of free blocks for statfs. Counting them walks delete sets of all
+ * atoms under transaction manager and atom locks, which writers need too, so
+ * the result is kept and reported again for statfs_cache_age
+ * milliseconds. Monitoring that calls statfs thousands of times a second
+ * thereby counts them a few times a second. sync_fs() forgets the kept value,
+ * so that statfs after sync(2) is exact.
+ */
+static __u64 statfs_free_blocks(struct super_block *super)
+{
+	reiser4_super_info_data *sbinfo = get_super_private(super);
+	unsigned long age = msecs_to_jiffies(sbinfo->statfs_cache_age);
+	unsigned long stamp;
+	unsigned seq;
+	__u64 free;
+
+	if (age != 0) {
+		do {
+			seq = read_seqbegin(&sbinfo->statfs_lock);
+			stamp = sbinfo->statfs_stamp;
+			free = sbinfo->statfs_free;
+		} while (read_seqretry(&sbinfo->statfs_lock, seq));
+		if (stamp != 0 && time_before(jiffies, stamp + age))
+			return free;
+	}
+
+	free = reiser4_free_blocks(super) + reiser4_grab_cached_blocks(super) +
+		txnmgr_count_deleted_blocks();
+
+	write_seqlock(&sbinfo->statfs_lock);
+	sbinfo->statfs_free = free;
+	sbinfo->statfs_stamp = jiffies ? : 1;
+	write_sequnlock(&sbinfo->statfs_lock);
+	return free;
+}
+
 /**
  * reiser4_statfs - statfs of super operations
  * @super: super block of file system in queried
@@ -285,7 +334,6 @@ static int reiser4_statfs(struct dentry *dentry, struct kstatfs *statfs)
 	sector_t reserved;
 	sector_t free;
 	sector_t forroot;
-	sector_t deleted;
 	reiser4_context *ctx;
 	struct super_block *super = dentry->d_sb;
 
@@ -314,8 +362,7 @@ static int reiser4_statfs(struct dentry *dentry, struct kstatfs *statfs)
 	 */
 	total = reiser4_block_count(super);
 	reserved = get_super_private(super)->blocks_reserved;
-	deleted = txnmgr_count_deleted_blocks();
-	free = reiser4_free_blocks(super) + deleted;
+	free = statfs_free_blocks(super);
 	forroot = reiser4_reserved_blocks(super, 0, 0);
 
 	/*
@@ -361,7 +408,9 @@ static int reiser4_statfs(struct dentry *dentry, struct kstatfs *statfs)
  * reiser4_writepages_dispatch for each of dirty inodes.
  * reiser4_writepages_dispatch handles pages dirtied via shared
  * mapping - dirty pages get into atoms. Writeout is called to flush
- * some atoms.
+ * some atoms, atoms of the inodes written back first, see
+ * reiser4_writeback_note(). Each bdi_writeback, of each cgroup, calls this
+ * from its own worker, so that flushes of different atoms run in parallel.
  */
 static long reiser4_writeback_inodes(struct super_block *super,
 				     struct bdi_writeback *wb,
@@ -388,7 +437,9 @@ static long reiser4_writeback_inodes(struct super_block *super,
 	 * dirty pages into transactions if they were not yet.
 	 */
 	spin_lock(&wb->list_lock);
+	ctx->writeback = 1;
 	result = generic_writeback_sb_inodes(super, wb, wbc, work, flush_all);
+	ctx->writeback = 0;
 	spin_unlock(&wb->list_lock);
 
 	if (result <= 0)
@@ -398,6 +449,7 @@ static long reiser4_writeback_inodes(struct super_block *super,
 	/* flush goes here */
 	reiser4_writeout(super, wbc);
  exit:
+	reiser4_writeback_done(ctx);
 	/* avoid recursive calls to ->writeback_inodes */
 	context_set_commit_async(ctx);
 	reiser4_exit_context(ctx);
@@ -453,6 +505,11 @@ static int reiser4_sync_fs(struct super_block *super, int wait)
 	 */
 	reiser4_writeout(super, &wbc);
 
+	/* let the next statfs count free blocks */
+	write_seqlock(&get_super_private(super)->statfs_lock);
+	get_super_private(super)->statfs_stamp = 0;
+	write_sequnlock(&get_super_private(super)->statfs_lock);
+
 	reiser4_exit_context(ctx);
 	return 0;
 }
@@ -483,8 +540,13 @@ static int reiser4_show_options(struct seq_file *m, struct dentry *dentry)
 	seq_printf(m, ",atom_min_size=0x%x", sbinfo->tmgr.atom_min_size);
 	seq_printf(m, ",atom_max_flushers=0x%x",
 		   sbinfo->tmgr.atom_max_flushers);
+	seq_printf(m, ",entd_threads=0x%x", sbinfo->entd.nr_threads);
+	seq_printf(m, ",group_commit_window=0x%x",
+		   sbinfo->tmgr.group_commit_window);
 	seq_printf(m, ",cbk_cache_slots=0x%x",
 		   sbinfo->tree.cbk_cache.nr_slots);
+	seq_printf(m, ",pinned_pages=0x%x", sbinfo->tree.max_pinned);
+	seq_printf(m, ",max_cached=0x%x", sbinfo->tree.max_cached);
 
 	return 0;
 }
@@ -514,11 +576,15 @@ static int fill_super(struct super_block *super, void *data, int silent)
 {
 	reiser4_context ctx;
 	int result;
+	int unlinks;
 	reiser4_super_info_data *sbinfo;
 
 	assert("zam-989", super != NULL);
 
 	super->s_op = NULL;
+	/* let file_remove_privs() mark inodes with nothing to remove, writers
+	   check that to overwrite files under shared i_rwsem */
+	super->s_flags |= SB_NOSEC;
 	init_stack_context(&ctx, super);
 
 	/* allocate reiser4 specific super block */
@@ -539,7 +605,8 @@ static int fill_super(struct super_block *super, void *data, int silent)
 		goto failed_init_read_super;
 
 	/* initialize transaction manager */
-	reiser4_init_txnmgr(&sbinfo->tmgr);
+	if ((result = reiser4_init_txnmgr(&sbinfo->tmgr)) != 0)
+		goto failed_init_txnmgr;
 
 	/* initialize ktxnmgrd context and start kernel thread ktxnmrgd */
 	if ((result = reiser4_init_ktxnmgrd(super)) != 0)
@@ -573,7 +640,9 @@ static int fill_super(struct super_block *super, void *data, int silent)
 	if ((result = get_super_private(super)->df_plug->version_update(super)) != 0)
 		goto failed_update_format_version;
 
-	process_safelinks(super);
+	/* before safe-links free any blocks */
+	sa_load_summary(&sbinfo->space_allocator, super);
+	unlinks = process_safelinks(super);
 	reiser4_exit_context(&ctx);
 
 	sbinfo->debugfs_root = debugfs_create_dir(super->s_id,
@@ -585,9 +654,51 @@ static int fill_super(struct super_block *super, void *data, int silent)
 		debugfs_create_u32("id_count", S_IFREG|S_IRUSR,
 				   sbinfo->debugfs_root,
 				   &sbinfo->tmgr.id_count);
+		debugfs_create_atomic_t("squeeze_skipped", S_IFREG|S_IRUSR,
+					sbinfo->debugfs_root,
+					&sbinfo->flush.squeeze_skipped);
+		debugfs_create_atomic_t("defrag_relocated", S_IFREG|S_IRUSR,
+					sbinfo->debugfs_root,
+					&sbinfo->defrag.nr_relocated);
+		debugfs_create_atomic_t("tail_packs_avoided", S_IFREG|S_IRUSR,
+					sbinfo->debugfs_root,
+					&sbinfo->nr_packs_avoided);
+		debugfs_create_atomic_t("readahead_hits", S_IFREG|S_IRUSR,
+					sbinfo->debugfs_root,
+					&sbinfo->ra_params.hits);
+		debugfs_create_atomic_t("readahead_wasted", S_IFREG|S_IRUSR,
+					sbinfo->debugfs_root,
+					&sbinfo->ra_params.wasted);
+		debugfs_create_ulong("readahead_window", S_IFREG|S_IRUSR,
+				     sbinfo->debugfs_root,
+				     &sbinfo->ra_params.window);
+		reiser4_txnmgr_debugfs_init(&sbinfo->tmgr,
+					    sbinfo->debugfs_root);
+		reiser4_tree_debugfs_init(&sbinfo->tree,
+					  sbinfo->debugfs_root);
+		reiser4_tree_bench_debugfs_init(super, sbinfo->debugfs_root);
+		reiser4_tree_shape_debugfs_init(super, sbinfo->debugfs_root);
+		reiser4_tree_hot_debugfs_init(super, sbinfo->debugfs_root);
+		reiser4_stats_debugfs_init(super, sbinfo->debugfs_root);
+		sa_debugfs_init(&sbinfo->space_allocator,
+				sbinfo->debugfs_root);
 	}
+	if (reiser4_sysfs_register(super))
+		warning("", "%s: failed to register in sysfs", super->s_id);
 	printk("reiser4: %s: using %s.\n", super->s_id,
 	       txmod_plugin_by_id(sbinfo->txmod)->h.desc);
+	if (reiser4_init_defrag(super))
+		warning("", "%s: failed to start defragmenter", super->s_id);
+	if ((unlinks > 0 || reiser4_is_set(super, REISER4_ASYNC_DELETE)) &&
+	    !sb_rdonly(super) && reiser4_start_safelinks(super))
+		warning("", "%s: failed to replay %d unlinks", super->s_id,
+			unlinks);
+	if (reiser4_init_jnode_shrinker(super))
+		warning("", "%s: failed to register jnode shrinker",
+			super->s_id);
+	if (reiser4_init_znode_shrinker(super))
+		warning("", "%s: failed to register znode shrinker",
+			super->s_id);
 	return 0;
 
  failed_update_format_version:
@@ -602,6 +713,7 @@ static int fill_super(struct super_block *super, void *data, int silent)
 	reiser4_done_ktxnmgrd(super);
  failed_init_ktxnmgrd:
 	reiser4_done_txnmgr(&sbinfo->tmgr);
+ failed_init_txnmgr:
  failed_init_read_super:
  failed_init_super_data:
  failed_init_csum_tfm:
@@ -626,13 +738,34 @@ static struct dentry *reiser4_mount(struct file_system_type *fs_type, int flags,
 	return mount_bdev(fs_type, flags, dev_name, data, fill_super);
 }
 
+/**
+ * reiser4_kill_super - kill_sb of file_system_type operations
+ * @super: super block to shut down
+ *
+ * Stops the defragmenter, unlink replay and background tail conversion before
+ * generic code evicts inodes they may hold references to. Inflated clusters
+ * of the file system are forgotten when it is gone.
+ */
+static void reiser4_kill_super(struct super_block *super)
+{
+	if (get_super_private(super) != NULL) {
+		reiser4_done_jnode_shrinker(super);
+		reiser4_done_znode_shrinker(super);
+		reiser4_done_safelinks(super);
+		reiser4_done_defrag(super);
+		reiser4_done_conv_queue(super);
+	}
+	kill_block_super(super);
+	reiser4_ccache_drop_super(super);
+}
+
 /* structure describing the reiser4 filesystem implementation */
 static struct file_system_type reiser4_fs_type = {
 	.owner = THIS_MODULE,
 	.name = "reiser4",
 	.fs_flags = FS_REQUIRES_DEV,
 	.mount = reiser4_mount,
-	.kill_sb = kill_block_super,
+	.kill_sb = reiser4_kill_super,
 	.next = NULL
 };
 
@@ -659,6 +792,10 @@ static int __init init_reiser4(void)
 	       get_release_number_major(),
 	       get_release_number_minor());
 
+	/* initialize batched RCU freeing used by caches below */
+	if ((result = reiser4_init_magazines()) != 0)
+		goto failed_init_magazines;
+
 	/* initialize slab cache of inodes */
 	if ((result = init_inodes()) != 0)
 		goto failed_inode_cache;
@@ -671,6 +808,14 @@ static int __init init_reiser4(void)
 	if ((result = init_plugins()) != 0)
 		goto failed_init_plugins;
 
+	/* initialize pools of compression workspaces */
+	if ((result = reiser4_init_coa_pools()) != 0)
+		goto failed_init_coa_pools;
+
+	/* initialize cache of inflated clusters of cryptcompress files */
+	if ((result = reiser4_init_ccache()) != 0)
+		goto failed_init_ccache;
+
 	/* initialize cache of plugin_set-s and plugin_set's hash table */
 	if ((result = init_plugin_set()) != 0)
 		goto failed_init_plugin_set;
@@ -710,11 +855,33 @@ static int __init init_reiser4(void)
 	if ((result = blocknr_list_init_static()) != 0)
 		goto failed_init_blocknr_list;
 
+	/* initialize cache of blocknr tree entries */
+	if ((result = blocknr_tree_init_static()) != 0)
+		goto failed_init_blocknr_tree;
+
+	/* initialize cache of carry pools */
+	if ((result = init_carry_pools()) != 0)
+		goto failed_init_carry_pools;
+
 	if ((result = register_filesystem(&reiser4_fs_type)) == 0) {
 		reiser4_debugfs_root = debugfs_create_dir("reiser4", NULL);
+		if (reiser4_debugfs_root) {
+			reiser4_magazines_debugfs_init(reiser4_debugfs_root);
+			reiser4_coa_pools_debugfs_init(reiser4_debugfs_root);
+			reiser4_ccache_debugfs_init(reiser4_debugfs_root);
+			reiser4_lookup_filter_debugfs_init(
+				reiser4_debugfs_root);
+			reiser4_compress_bench_debugfs_init(
+				reiser4_debugfs_root);
+		}
+		reiser4_init_sysfs();
 		return 0;
 	}
 
+	done_carry_pools();
+ failed_init_carry_pools:
+	blocknr_tree_done_static();
+ failed_init_blocknr_tree:
 	blocknr_list_done_static();
  failed_init_blocknr_list:
 	blocknr_set_done_static();
@@ -733,11 +900,17 @@ static int __init init_reiser4(void)
  failed_init_txnmgr_static:
 	done_plugin_set();
  failed_init_plugin_set:
+	reiser4_done_ccache();
+ failed_init_ccache:
+	reiser4_done_coa_pools();
+ failed_init_coa_pools:
  failed_init_plugins:
 	done_znodes();
  failed_init_znodes:
 	done_inodes();
  failed_inode_cache:
+	reiser4_done_magazines();
+ failed_init_magazines:
 	return result;
 }
 
@@ -752,8 +925,13 @@ static void __exit done_reiser4(void)
 	int result;
 
 	debugfs_remove(reiser4_debugfs_root);
+	reiser4_done_compress_bench();
+	reiser4_done_sysfs();
 	result = unregister_filesystem(&reiser4_fs_type);
 	BUG_ON(result != 0);
+	reiser4_done_context_cache();
+	done_carry_pools();
+	blocknr_tree_done_static();
 	blocknr_list_done_static();
 	blocknr_set_done_static();
 	reiser4_done_d_cursor();
@@ -763,8 +941,11 @@ static void __exit done_reiser4(void)
 	done_jnodes();
 	done_txnmgr_static();
 	done_plugin_set();
+	reiser4_done_ccache();
+	reiser4_done_coa_pools();
 	done_znodes();
 	destroy_reiser4_cache(&inode_cache);
+	reiser4_done_magazines();
 }
 
 module_init(init_reiser4);
@@ -777,6 +958,9 @@ MODULE_AUTHOR("Hans Reiser <Reiser@Namesys.COM>");
 
 MODULE_LICENSE("GPL");
 
+/* let crypto_alloc_shash() find an accelerated crc32c implementation */
+MODULE_SOFTDEP("pre: crc32c");
+
 /*
  * Local variables:
  * c-indentation-style: "K&R"
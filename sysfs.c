@@ -0,0 +1,356 @@
+/* Copyright 2001, 2002, 2003 by Hans Reiser, licensing governed by
+ * reiser4/README */
+
+/*
+ * Performance counters of reiser4 in sysfs.
+ *
+ * Every mounted reiser4 file system has /sys/fs/reiser4/<dev>/stats
+ * directory with a file per counter. Counters are monotonic since mount, so
+ * rates are obtained by sampling them twice:
+ *
+ *   lookups           tree lookups
+ *   cbk_hits          lookups satisfied by the cbk cache
+ *   cbk_misses        lookups which went down from the root
+ *   node_reads        nodes read from disk
+ *   readahead         formatted nodes read by readahead
+ *   readahead_hits    nodes read by readahead and used later
+ *   readahead_wasted  nodes read by readahead and evicted unused
+ *   captures          nodes captured by atoms
+ *   fusions           atom fusions
+ *   flushes           flush passes
+ *   squeezes          nodes squeezed into left neighbors
+ *   relocations       nodes assigned to relocate set
+ *   journal_blocks    wandered and log record blocks written
+ *   bitmap_loads      bitmap blocks loaded
+ *   adaptive_overwrites, adaptive_relocates
+ *                     slums the adaptive transaction model overwrote and
+ *                     relocated
+ *   sd_cache_hits, sd_cache_misses
+ *                     stat-data found through the location cache, and not
+ *   renames           renames
+ *   rename_lock_us    microseconds renames held directory leaves locked
+ *
+ * Events are counted in per-CPU struct reiser4_stats by reiser4_stat_inc(),
+ * counters kept elsewhere (cbk cache, readahead) are just read from there.
+ * Debugging statistics of the same subsystems stay in debugfs.
+ *
+ * The stats file of the per-super block debugfs directory has all counters,
+ * "name value" per line, after the parameters runs differ in: transaction
+ * model, atom_max_size and scan_maxnodes. Benchmark drivers read it before
+ * and after a run, and the difference is the report of the run. One read
+ * is cheaper than a read per counter and samples all counters at once.
+ */
+
+#include "debug.h"
+#include "super.h"
+#include "sysfs.h"
+
+#include "plugin/plugin.h"
+
+#include <linux/fs.h>
+#include <linux/kobject.h>
+#include <linux/sysfs.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+/* /sys/fs/reiser4, NULL if it could not be created */
+static struct kobject *reiser4_kobj;
+
+struct stat_attr {
+	struct attribute attr;
+	/* counter of struct reiser4_stats */
+	reiser4_stat_id id;
+	/* if not NULL, gets value of counter kept outside of reiser4_stats */
+	unsigned long (*get)(reiser4_super_info_data *);
+};
+
+#define STAT_ATTR(_name, _id, _get)					\
+static struct stat_attr stat_attr_##_name = {				\
+	.attr = { .name = __stringify(_name), .mode = 0444 },		\
+	.id = _id,							\
+	.get = _get							\
+}
+
+/**
+ * reiser4_init_stats - allocate per-CPU event counters
+ * @super: super block being mounted
+ *
+ * Failure to allocate is not fatal: events are not counted then.
+ */
+void reiser4_init_stats(struct super_block *super)
+{
+	get_super_private(super)->stats =
+		alloc_percpu_gfp(struct reiser4_stats,
+				 GFP_KERNEL | __GFP_NOWARN);
+}
+
+/**
+ * reiser4_done_stats - free per-CPU event counters
+ * @super: super block being unmounted
+ */
+void reiser4_done_stats(struct super_block *super)
+{
+	reiser4_super_info_data *sbinfo = get_super_private(super);
+
+	free_percpu(sbinfo->stats);
+	sbinfo->stats = NULL;
+}
+
+static unsigned long stat_sum(reiser4_super_info_data *sbinfo,
+			      reiser4_stat_id id)
+{
+	unsigned long sum = 0;
+	int cpu;
+
+	if (sbinfo->stats == NULL)
+		return 0;
+	for_each_possible_cpu(cpu)
+		sum += per_cpu_ptr(sbinfo->stats, cpu)->count[id];
+	return sum;
+}
+
+static unsigned long get_cbk_hits(reiser4_super_info_data *sbinfo)
+{
+	unsigned long hits, misses, invalidations;
+
+	cbk_cache_stat(&sbinfo->tree.cbk_cache, &hits, &misses,
+		       &invalidations);
+	return hits;
+}
+
+static unsigned long get_cbk_misses(reiser4_super_info_data *sbinfo)
+{
+	unsigned long hits, misses, invalidations;
+
+	cbk_cache_stat(&sbinfo->tree.cbk_cache, &hits, &misses,
+		       &invalidations);
+	return misses;
+}
+
+static unsigned long get_ra_hits(reiser4_super_info_data *sbinfo)
+{
+	return atomic_read(&sbinfo->ra_params.hits);
+}
+
+static unsigned long get_ra_wasted(reiser4_super_info_data *sbinfo)
+{
+	return atomic_read(&sbinfo->ra_params.wasted);
+}
+
+/* pages of formatted nodes in memory, see tree.max_cached mount option */
+static unsigned long get_formatted_pages(reiser4_super_info_data *sbinfo)
+{
+	struct inode *fake = sbinfo->fake;
+
+	return fake != NULL ? READ_ONCE(fake->i_mapping->nrpages) : 0;
+}
+
+static unsigned long get_formatted_trimmed(reiser4_super_info_data *sbinfo)
+{
+	return atomic_long_read(&sbinfo->tree.nr_pages_trimmed);
+}
+
+STAT_ATTR(lookups, REISER4_STAT_LOOKUPS, NULL);
+STAT_ATTR(cbk_hits, REISER4_STAT_NR, get_cbk_hits);
+STAT_ATTR(cbk_misses, REISER4_STAT_NR, get_cbk_misses);
+STAT_ATTR(node_reads, REISER4_STAT_NODE_READS, NULL);
+STAT_ATTR(readahead, REISER4_STAT_READAHEAD, NULL);
+STAT_ATTR(readahead_hits, REISER4_STAT_NR, get_ra_hits);
+STAT_ATTR(readahead_wasted, REISER4_STAT_NR, get_ra_wasted);
+STAT_ATTR(captures, REISER4_STAT_CAPTURES, NULL);
+STAT_ATTR(fusions, REISER4_STAT_FUSIONS, NULL);
+STAT_ATTR(flushes, REISER4_STAT_FLUSHES, NULL);
+STAT_ATTR(squeezes, REISER4_STAT_SQUEEZES, NULL);
+STAT_ATTR(relocations, REISER4_STAT_RELOCATIONS, NULL);
+STAT_ATTR(journal_blocks, REISER4_STAT_JOURNAL_BLOCKS, NULL);
+STAT_ATTR(bitmap_loads, REISER4_STAT_BITMAP_LOADS, NULL);
+STAT_ATTR(adaptive_overwrites, REISER4_STAT_ADAPTIVE_OVERWRITES, NULL);
+STAT_ATTR(adaptive_relocates, REISER4_STAT_ADAPTIVE_RELOCATES, NULL);
+STAT_ATTR(sd_cache_hits, REISER4_STAT_SD_CACHE_HITS, NULL);
+STAT_ATTR(sd_cache_misses, REISER4_STAT_SD_CACHE_MISSES, NULL);
+STAT_ATTR(renames, REISER4_STAT_RENAMES, NULL);
+STAT_ATTR(rename_lock_us, REISER4_STAT_RENAME_LOCK_US, NULL);
+STAT_ATTR(carry_restarts, REISER4_STAT_CARRY_RESTARTS, NULL);
+STAT_ATTR(formatted_pages, REISER4_STAT_NR, get_formatted_pages);
+STAT_ATTR(formatted_trimmed, REISER4_STAT_NR, get_formatted_trimmed);
+
+static unsigned long stat_value(reiser4_super_info_data *sbinfo,
+				struct stat_attr *sa)
+{
+	return sa->get != NULL ? sa->get(sbinfo) : stat_sum(sbinfo, sa->id);
+}
+
+static struct attribute *stat_attrs[] = {
+	&stat_attr_lookups.attr,
+	&stat_attr_cbk_hits.attr,
+	&stat_attr_cbk_misses.attr,
+	&stat_attr_node_reads.attr,
+	&stat_attr_readahead.attr,
+	&stat_attr_readahead_hits.attr,
+	&stat_attr_readahead_wasted.attr,
+	&stat_attr_captures.attr,
+	&stat_attr_fusions.attr,
+	&stat_attr_flushes.attr,
+	&stat_attr_squeezes.attr,
+	&stat_attr_relocations.attr,
+	&stat_attr_journal_blocks.attr,
+	&stat_attr_bitmap_loads.attr,
+	&stat_attr_adaptive_overwrites.attr,
+	&stat_attr_adaptive_relocates.attr,
+	&stat_attr_sd_cache_hits.attr,
+	&stat_attr_sd_cache_misses.attr,
+	&stat_attr_renames.attr,
+	&stat_attr_rename_lock_us.attr,
+	&stat_attr_carry_restarts.attr,
+	&stat_attr_formatted_pages.attr,
+	&stat_attr_formatted_trimmed.attr,
+	NULL
+};
+
+static const struct attribute_group stat_group = {
+	.name = "stats",
+	.attrs = stat_attrs
+};
+
+static const struct attribute_group *super_groups[] = {
+	&stat_group,
+	NULL
+};
+
+static ssize_t super_attr_show(struct kobject *kobj, struct attribute *attr,
+			       char *buf)
+{
+	reiser4_super_info_data *sbinfo;
+	struct stat_attr *sa;
+	unsigned long value;
+
+	sbinfo = container_of(kobj, reiser4_super_info_data, kobj);
+	sa = container_of(attr, struct stat_attr, attr);
+	value = stat_value(sbinfo, sa);
+	return sprintf(buf, "%lu\n", value);
+}
+
+static const struct sysfs_ops super_sysfs_ops = {
+	.show = super_attr_show
+};
+
+static void super_kobj_release(struct kobject *kobj)
+{
+	reiser4_super_info_data *sbinfo;
+
+	sbinfo = container_of(kobj, reiser4_super_info_data, kobj);
+	complete(&sbinfo->kobj_unregister);
+}
+
+static struct kobj_type super_ktype = {
+	.default_groups = super_groups,
+	.sysfs_ops = &super_sysfs_ops,
+	.release = super_kobj_release
+};
+
+static int stats_show(struct seq_file *m, void *unused)
+{
+	reiser4_super_info_data *sbinfo = m->private;
+	struct attribute **attr;
+
+	seq_printf(m, "txmod %s\natom_max_size %u\nscan_maxnodes %u\n",
+		   txmod_plugin_by_id(sbinfo->txmod)->h.label,
+		   sbinfo->tmgr.atom_max_size, sbinfo->flush.scan_maxnodes);
+	for (attr = stat_attrs; *attr != NULL; attr++) {
+		struct stat_attr *sa = container_of(*attr, struct stat_attr,
+						    attr);
+
+		seq_printf(m, "%s %lu\n", sa->attr.name,
+			   stat_value(sbinfo, sa));
+	}
+	return 0;
+}
+
+DEFINE_SHOW_ATTRIBUTE(stats);
+
+/**
+ * reiser4_stats_debugfs_init - export all counters in one file
+ * @super: super block
+ * @root: debugfs directory of the file system
+ */
+void reiser4_stats_debugfs_init(struct super_block *super,
+				struct dentry *root)
+{
+	debugfs_create_file("stats", S_IFREG | S_IRUSR, root,
+			    get_super_private(super), &stats_fops);
+}
+
+/**
+ * reiser4_sysfs_register - create /sys/fs/reiser4/<dev>
+ * @super: super block being mounted
+ */
+int reiser4_sysfs_register(struct super_block *super)
+{
+	reiser4_super_info_data *sbinfo = get_super_private(super);
+	int result;
+
+	if (reiser4_kobj == NULL)
+		return 0;
+	init_completion(&sbinfo->kobj_unregister);
+	result = kobject_init_and_add(&sbinfo->kobj, &super_ktype,
+				      reiser4_kobj, "%s", super->s_id);
+	if (result) {
+		kobject_put(&sbinfo->kobj);
+		wait_for_completion(&sbinfo->kobj_unregister);
+		return result;
+	}
+	sbinfo->kobj_registered = 1;
+	return 0;
+}
+
+/**
+ * reiser4_sysfs_unregister - remove /sys/fs/reiser4/<dev>
+ * @super: super block being unmounted
+ *
+ * Waits until the kobject embedded into reiser4_super_info_data is released.
+ */
+void reiser4_sysfs_unregister(struct super_block *super)
+{
+	reiser4_super_info_data *sbinfo = get_super_private(super);
+
+	if (!sbinfo->kobj_registered)
+		return;
+	kobject_del(&sbinfo->kobj);
+	kobject_put(&sbinfo->kobj);
+	wait_for_completion(&sbinfo->kobj_unregister);
+	sbinfo->kobj_registered = 0;
+}
+
+/**
+ * reiser4_init_sysfs - create /sys/fs/reiser4
+ *
+ * This is called on reiser4 module initialization. Failure is not fatal:
+ * file systems are mounted without sysfs directories then.
+ */
+void reiser4_init_sysfs(void)
+{
+	reiser4_kobj = kobject_create_and_add("reiser4", fs_kobj);
+	if (reiser4_kobj == NULL)
+		warning("", "failed to create /sys/fs/reiser4");
+}
+
+/**
+ * reiser4_done_sysfs - remove /sys/fs/reiser4
+ *
+ * This is called on reiser4 module unloading.
+ */
+void reiser4_done_sysfs(void)
+{
+	kobject_put(reiser4_kobj);
+	reiser4_kobj = NULL;
+}
+
+/* Make Linus happy.
+   Local variables:
+   c-indentation-style: "K&R"
+   mode-name: "LC"
+   c-basic-offset: 8
+   tab-width: 8
+   fill-column: 120
+   End:
+*/
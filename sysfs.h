@@ -0,0 +1,33 @@
+/* Copyright 2001, 2002, 2003 by Hans Reiser, licensing governed by
+ * reiser4/README */
+
+/* Performance counters of reiser4 exported in sysfs. See sysfs.c */
+
+#if !defined(__FS_REISER4_SYSFS_H__)
+#define __FS_REISER4_SYSFS_H__
+
+struct super_block;
+struct dentry;
+
+extern void reiser4_init_stats(struct super_block *);
+extern void reiser4_done_stats(struct super_block *);
+
+extern void reiser4_init_sysfs(void);
+extern void reiser4_done_sysfs(void);
+extern int reiser4_sysfs_register(struct super_block *);
+extern void reiser4_sysfs_unregister(struct super_block *);
+extern void reiser4_stats_debugfs_init(struct super_block *,
+				       struct dentry *);
+
+/* __FS_REISER4_SYSFS_H__ */
+#endif
+
+/* Make Linus happy.
+   Local variables:
+   c-indentation-style: "K&R"
+   mode-name: "LC"
+   c-basic-offset: 8
+   tab-width: 8
+   fill-column: 120
+   End:
+*/
@@ -71,6 +71,8 @@ void reiser4_tap_init(tap_t *tap, coord_t *coord, lock_handle * lh,
 	tap->loaded = 0;
 	INIT_LIST_HEAD(&tap->linkage);
 	reiser4_init_ra_info(&tap->ra_info);
+	tap->prefetch = 0;
+	tap->prefetched = NULL;
 }
 
 /** add @tap to the per-thread list of all taps */
@@ -96,6 +98,8 @@ void reiser4_tap_copy(tap_t *dst, tap_t *src)
 	dst->loaded = 0;
 	INIT_LIST_HEAD(&dst->linkage);
 	dst->ra_info = src->ra_info;
+	dst->prefetch = src->prefetch;
+	dst->prefetched = src->prefetched;
 }
 
 /** finish with @tap */
@@ -191,6 +195,26 @@ struct list_head *reiser4_taps_list(void)
 }
 
 /** helper function for go_{next,prev}_{item,unit,node}() */
+/* start read of right neighbor of the node @tap is in, once @tap passed
+   ->prefetch percents of the node. So that scan does not wait for the
+   neighbor when it gets there */
+static void tap_prefetch(tap_t *tap)
+{
+	coord_t *coord = tap->coord;
+	unsigned nr_items;
+	unsigned done;
+
+	if (tap->prefetch == 0 || tap->prefetched == coord->node)
+		return;
+	nr_items = node_num_items(coord->node);
+	done = coord->item_pos * 100 +
+		coord->unit_pos * 100 / coord_num_units(coord);
+	if (done >= tap->prefetch * nr_items) {
+		tap->prefetched = coord->node;
+		reiser4_prefetch_right_neighbor(coord->node);
+	}
+}
+
 int go_dir_el(tap_t *tap, sideof dir, int units_p)
 {
 	coord_t dup;
@@ -244,6 +268,8 @@ int go_dir_el(tap_t *tap, sideof dir, int units_p)
 		result = 0;
 		coord_dup(coord, &dup);
 	}
+	if (result == 0 && dir == RIGHT_SIDE)
+		tap_prefetch(tap);
 	assert("nikita-2564", ergo(!result, coord_check(tap->coord)));
 	tap_check(tap);
 	return result;
@@ -268,12 +294,35 @@ int go_prev_unit(tap_t *tap)
 }
 
 /**
- * @shift times apply @actor to the @tap. This is used to move @tap by
- * @shift units (or items, or nodes) in either direction.
+ * move @tap by at most @shift units towards @side within its item, returns the
+ * number of units passed
  */
-static int rewind_to(tap_t *tap, go_actor_t actor, int shift)
+static int skip_units(tap_t *tap, sideof side, int shift)
+{
+	coord_t *coord = tap->coord;
+	int room;
+
+	if (!coord_is_existing_unit(coord))
+		return 0;
+	if (side == RIGHT_SIDE)
+		room = coord_last_unit_pos(coord) - coord->unit_pos;
+	else
+		room = coord->unit_pos;
+	room = min(room, shift);
+	coord->unit_pos += (side == RIGHT_SIDE) ? room : -room;
+	return room;
+}
+
+/**
+ * move @tap by @shift units towards @side, with @actor moving it by one
+ * unit. Units of one item are passed at once, so that rewinding a directory,
+ * whose items hold many entries each, costs about a step per item rather than
+ * per entry.
+ */
+static int rewind_to(tap_t *tap, go_actor_t actor, sideof side, int shift)
 {
 	int result;
+	int skipped;
 
 	assert("nikita-2555", shift >= 0);
 	assert("nikita-2562", tap->coord->node == tap->lh->node);
@@ -283,11 +332,17 @@ static int rewind_to(tap_t *tap, go_actor_t actor, int shift)
 	if (result != 0)
 		return result;
 
-	for (; shift > 0; --shift) {
+	while (shift > 0) {
+		skipped = skip_units(tap, side, shift);
+		if (skipped != 0) {
+			shift -= skipped;
+			continue;
+		}
 		result = actor(tap);
 		assert("nikita-2563", tap->coord->node == tap->lh->node);
 		if (result != 0)
 			break;
+		shift--;
 	}
 	reiser4_tap_relse(tap);
 	tap_check(tap);
@@ -297,13 +352,13 @@ static int rewind_to(tap_t *tap, go_actor_t actor, int shift)
 /** move @tap @shift units rightward */
 int rewind_right(tap_t *tap, int shift)
 {
-	return rewind_to(tap, go_next_unit, shift);
+	return rewind_to(tap, go_next_unit, RIGHT_SIDE, shift);
 }
 
 /** move @tap @shift units leftward */
 int rewind_left(tap_t *tap, int shift)
 {
-	return rewind_to(tap, go_prev_unit, shift);
+	return rewind_to(tap, go_prev_unit, LEFT_SIDE, shift);
 }
 
 #if REISER4_DEBUG
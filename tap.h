@@ -29,6 +29,11 @@ struct tree_access_pointer {
 	struct list_head linkage;
 	/* read-ahead hint */
 	ra_info_t ra_info;
+	/* if not 0, moving to the right past this percentage of a node starts
+	   read of its right neighbor */
+	unsigned prefetch;
+	/* node whose right neighbor was prefetched, only compared */
+	const znode *prefetched;
 };
 
 typedef int (*go_actor_t) (tap_t *tap);
@@ -0,0 +1,7 @@
+/* Copyright 2001, 2002, 2003, 2004 by Hans Reiser, licensing governed by
+ * reiser4/README */
+
+/* Instantiation of reiser4 tracepoints, see reiser4_trace.h */
+
+#define CREATE_TRACE_POINTS
+#include "reiser4_trace.h"
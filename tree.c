@@ -191,9 +191,12 @@
 #include "super.h"
 #include "reiser4.h"
 #include "inode.h"
+#include "context.h"
 
 #include <linux/fs.h>		/* for struct super_block  */
 #include <linux/spinlock.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 /* Disk address (block number) never ever used for any real tree node. This is
    used as block number of "uber" znode.
@@ -251,6 +254,62 @@ insert_result insert_by_key(reiser4_tree * tree	/* tree to insert new item
 	return result;
 }
 
+struct insert_keys_arg {
+	const reiser4_key *keys;
+	reiser4_item_data *data;
+};
+
+/* reiser4_iterate_keys() actor of insert_by_keys() */
+static int insert_keys_actor(reiser4_tree * tree, coord_t *coord,
+			     lock_handle * lh, int idx, lookup_result found,
+			     void *arg)
+{
+	struct insert_keys_arg *ika = arg;
+
+	if (found == CBK_COORD_FOUND)
+		return IBK_ALREADY_EXISTS;
+	assert("", found == CBK_COORD_NOTFOUND);
+	assert("", coord->node == lh->node);
+	return insert_by_coord(coord, &ika->data[idx], &ika->keys[idx], lh,
+			       0/*flags */);
+}
+
+/**
+ * insert_by_keys - insert items sorted by key
+ * @tree: tree to insert new items into
+ * @keys: keys of new items, in ascending order
+ * @data: parameters for creation of each item
+ * @nr: number of items
+ * @stop_level: level where to insert
+ * @flags: insertion flags, as for insert_by_key()
+ *
+ * Same as insert_by_key() called for each item, but an item which goes into
+ * the node the previous one was inserted into is inserted without releasing
+ * the lock and without a tree traversal, so consecutive items landing in the
+ * same leaf cost one lookup within that leaf each. Balancings which move the
+ * insertion point keep the lock on the node the item went to (see
+ * insert_with_carry_by_coord()).
+ *
+ * Stops at the first failed insertion and returns its error. Items before it
+ * are inserted.
+ */
+int insert_by_keys(reiser4_tree * tree, const reiser4_key * keys,
+		   reiser4_item_data * data, int nr, tree_level stop_level,
+		   __u32 flags)
+{
+	struct insert_keys_arg ika;
+
+	assert("", tree != NULL);
+	assert("", data != NULL);
+
+	ika.keys = keys;
+	ika.data = data;
+	return reiser4_iterate_keys(tree, keys, nr, ZNODE_WRITE_LOCK,
+				    FIND_EXACT, stop_level, stop_level,
+				    flags | CBK_FOR_INSERT, insert_keys_actor,
+				    &ika);
+}
+
 /* insert item by calling carry. Helper function called if short-cut
    insertion failed  */
 static insert_result insert_with_carry_by_coord(coord_t *coord,
@@ -594,7 +653,7 @@ int reiser4_insert_flow(coord_t * coord, lock_handle * lh, flow_t * f)
 
 	/* these are permanent during insert_flow */
 	data = (reiser4_item_data *) (lowest_level + 3);
-	data->user = 1;
+	data->user = f->user;
 	data->iplug = item_plugin_by_id(FORMATTING_ID);
 	data->arg = NULL;
 	/* data.length and data.data will be set before calling paste or
@@ -651,13 +710,18 @@ znode *child_znode(const coord_t * parent_coord	/* coord of pointer to
 		iplug->s.internal.down_link(parent_coord, NULL, &addr);
 
 		tree = znode_get_tree(parent);
-		if (incore_p)
+		child = zlook_child(parent, parent_coord->item_pos, &addr);
+		if (child == NULL && incore_p)
 			child = zlook(tree, &addr);
-		else
+		else if (child == NULL) {
 			child =
 			    zget(tree, &addr, parent,
 				 znode_get_level(parent) - 1,
 				 reiser4_ctx_gfp_mask_get());
+			if (!IS_ERR(child))
+				zcache_child(parent, parent_coord->item_pos,
+					     child);
+		}
 		if ((child != NULL) && !IS_ERR(child) && setup_dkeys_p)
 			set_child_delimiting_keys(parent, parent_coord, child);
 	} else {
@@ -912,7 +976,7 @@ int find_child_ptr(znode * parent /* parent znode, passed locked */ ,
 	 * hash collision. But, we check block number in check_tree_pointer()
 	 * and, so, are safe.
 	 */
-	lookup_res = nplug->lookup(parent, &ld, FIND_EXACT, result);
+	lookup_res = NODE_CALL(nplug, lookup, parent, &ld, FIND_EXACT, result);
 	/* update cached pos_in_node */
 	if (lookup_res == NS_FOUND) {
 		write_lock_tree(tree);
@@ -1466,7 +1530,7 @@ int reiser4_delete_node(znode * node, reiser4_key * smallest_removed,
 	tree = znode_get_tree(node);
 	write_lock_tree(tree);
 	init_parent_coord(&node->in_parent, NULL);
-	--parent_lock.node->c_count;
+	atomic_dec(&parent_lock.node->c_count);
 	write_unlock_tree(tree);
 
 	assert("zam-989", item_is_internal(&cut_from));
@@ -1580,6 +1644,10 @@ cut_tree_worker_common(tap_t * tap, const reiser4_key * from_key,
 					      GN_CAN_USE_UPPER_LEVELS);
 		if (result != 0 && result != -E_NO_NEIGHBOR)
 			break;
+		if (result == 0 && znode_get_level(node) == TWIG_LEVEL)
+			/* read twigs to cut next while this one is cut */
+			reiser4_prefetch_left(next_node_lock.node,
+					      REISER4_CUT_PREFETCH);
 		/* Check can we delete the node as a whole. */
 		if (*progress && znode_get_level(node) == LEAF_LEVEL &&
 		    can_delete(from_key, node)) {
@@ -1812,6 +1880,69 @@ int reiser4_cut_tree(reiser4_tree * tree, const reiser4_key * from,
 	return result;
 }
 
+/* grow znode and jnode hash tables, scheduled on insertion into an
+ * overloaded table */
+static void hash_resize_work(struct work_struct *work)
+{
+	reiser4_tree *tree = container_of(work, reiser4_tree, hash_resize);
+
+	znodes_tree_grow(tree);
+	jnodes_tree_grow(tree);
+}
+
+/* number of pages of formatted nodes looked up at once by cache trim */
+#define TRIM_BATCH 16
+
+/*
+ * release clean pages of formatted nodes until no more than 7/8 of
+ * tree->max_cached of them are left. Pages are visited in the order of
+ * blocks, starting where the previous trim stopped. Pages on the active list
+ * are skipped until the first wrap around. reiser4_releasepage() keeps the
+ * pages it always keeps: dirty, referenced and pinned upper level ones.
+ */
+static void cache_trim_work(struct work_struct *work)
+{
+	reiser4_tree *tree = container_of(work, reiser4_tree, cache_trim);
+	struct address_space *mapping;
+	struct page *pages[TRIM_BATCH];
+	reiser4_context ctx;
+	unsigned long target;
+	unsigned long trimmed = 0;
+	pgoff_t index;
+	int pass = 0;
+
+	target = READ_ONCE(tree->max_cached);
+	target -= target / 8;
+	mapping = get_super_private(tree->super)->fake->i_mapping;
+	index = tree->trim_cursor;
+
+	init_stack_context(&ctx, tree->super);
+	while (pass < 2 && READ_ONCE(mapping->nrpages) > target) {
+		unsigned found;
+		unsigned i;
+
+		found = find_get_pages(mapping, &index, TRIM_BATCH, pages);
+		if (found == 0) {
+			index = 0;
+			pass++;
+			continue;
+		}
+		for (i = 0; i < found; i++) {
+			pgoff_t idx = pages[i]->index;
+			int skip = (pass == 0 && PageActive(pages[i]));
+
+			put_page(pages[i]);
+			if (!skip)
+				trimmed += invalidate_mapping_pages(mapping,
+								    idx, idx);
+		}
+		cond_resched();
+	}
+	tree->trim_cursor = index;
+	reiser4_exit_context(&ctx);
+	atomic_long_add(trimmed, &tree->nr_pages_trimmed);
+}
+
 /* finishing reiser4 initialization */
 int reiser4_init_tree(reiser4_tree * tree	/* pointer to structure being
 					 * initialized */ ,
@@ -1836,13 +1967,20 @@ int reiser4_init_tree(reiser4_tree * tree	/* pointer to structure being
 
 	tree->root_block = *root_block;
 	tree->height = height;
+	seqcount_init(&tree->root_seq);
 	tree->estimate_one_insert = calc_estimate_one_insert(height);
+	tree->estimator.margin = REISER4_ESTIMATE_MARGIN;
 	tree->nplug = nplug;
 
-	tree->znode_epoch = 1ull;
+	atomic64_set(&tree->znode_epoch, 1);
 
 	cbk_cache_init(&tree->cbk_cache);
+	/* statistics are optional, do not fail mount for them */
+	tree->lock_stats = alloc_percpu_gfp(zlock_stats,
+					    GFP_KERNEL | __GFP_NOWARN);
 
+	INIT_WORK(&tree->hash_resize, hash_resize_work);
+	INIT_WORK(&tree->cache_trim, cache_trim_work);
 	result = znodes_tree_init(tree);
 	if (result == 0)
 		result = jnodes_tree_init(tree);
@@ -1867,9 +2005,174 @@ void reiser4_done_tree(reiser4_tree * tree /* tree to release */ )
 		zput(tree->uber);
 		tree->uber = NULL;
 	}
+	cancel_work_sync(&tree->hash_resize);
+	cancel_work_sync(&tree->cache_trim);
+	reiser4_done_tree_hot(tree);
 	znodes_tree_done(tree);
 	jnodes_tree_done(tree);
 	cbk_cache_done(&tree->cbk_cache);
+	free_percpu(tree->lock_stats);
+	tree->lock_stats = NULL;
+}
+
+/* print one line of hash_tables debugfs file */
+static void hash_stat_show(struct seq_file *m, const char *name,
+			   const struct hash_chain_stat *stat)
+{
+	/* average length of non-empty chains, in hundredths */
+	__u32 avg = stat->used ? div_u64(stat->items * 100ull, stat->used) : 0;
+
+	seq_printf(m, "%s %u %u %u %u.%02u %u\n", name, stat->items,
+		   stat->buckets, stat->used, avg / 100, avg % 100,
+		   stat->longest);
+}
+
+/* print "<table> <items> <buckets> <used buckets> <average chain> <longest
+ * chain>" for znode and jnode hash tables */
+static int hash_tables_show(struct seq_file *m, void *unused)
+{
+	reiser4_tree *tree = m->private;
+	struct hash_chain_stat real;
+	struct hash_chain_stat fake;
+
+	znodes_tree_stat(tree, &real, &fake);
+	hash_stat_show(m, "znode", &real);
+	hash_stat_show(m, "znode_fake", &fake);
+	jnodes_tree_stat(tree, &real);
+	hash_stat_show(m, "jnode", &real);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(hash_tables);
+
+/* print "<slots per cpu> <hits> <misses> <invalidations>" of cbk cache */
+static int cbk_cache_show(struct seq_file *m, void *unused)
+{
+	reiser4_tree *tree = m->private;
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long invalidations;
+
+	cbk_cache_stat(&tree->cbk_cache, &hits, &misses, &invalidations);
+	seq_printf(m, "%d %lu %lu %lu\n", tree->cbk_cache.nr_slots,
+		   hits, misses, invalidations);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(cbk_cache);
+
+/* print "<hashed> <released>" for znodes and jnodes: numbers of nodes in the
+   hash tables and of nodes released by znode and jnode shrinkers */
+static int shrinkers_show(struct seq_file *m, void *unused)
+{
+	reiser4_tree *tree = m->private;
+
+	seq_printf(m, "znode %u %ld\n", atomic_read(&tree->zhash_table._count),
+		   atomic_long_read(&tree->nr_znodes_shrunk));
+	seq_printf(m, "jnode %u %ld\n", atomic_read(&tree->jhash_table._count),
+		   atomic_long_read(&tree->nr_jnodes_shed));
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(shrinkers);
+
+/* print "<level> <r|w> <acquired> <contended> <deadlocks> <repeats>
+ * <inversions> <wait us> <max wait us> <spins> <spins seen release> <spin
+ * us>" for each level and lock mode which was locked or requested */
+static int lock_stat_show(struct seq_file *m, void *unused)
+{
+	reiser4_tree *tree = m->private;
+	int level;
+	int wr;
+	int cpu;
+
+	if (tree->lock_stats == NULL)
+		return 0;
+	for (level = 0; level <= REISER4_MAX_ZTREE_HEIGHT; level++) {
+		for (wr = 0; wr < 2; wr++) {
+			zlock_stat sum;
+
+			memset(&sum, 0, sizeof(sum));
+			for_each_possible_cpu(cpu) {
+				zlock_stat *st;
+
+				st = &per_cpu_ptr(tree->lock_stats,
+						  cpu)->s[level][wr];
+				sum.acquired += READ_ONCE(st->acquired);
+				sum.contended += READ_ONCE(st->contended);
+				sum.deadlocks += READ_ONCE(st->deadlocks);
+				sum.repeats += READ_ONCE(st->repeats);
+				sum.inversions += READ_ONCE(st->inversions);
+				sum.wait_ns += READ_ONCE(st->wait_ns);
+				if (READ_ONCE(st->max_wait_ns) > sum.max_wait_ns)
+					sum.max_wait_ns = st->max_wait_ns;
+				sum.spins += READ_ONCE(st->spins);
+				sum.spin_released +=
+					READ_ONCE(st->spin_released);
+				sum.spin_ns += READ_ONCE(st->spin_ns);
+			}
+			if (sum.acquired == 0 && sum.contended == 0 &&
+			    sum.deadlocks == 0 && sum.repeats == 0)
+				continue;
+			seq_printf(m, "%d %c %lu %lu %lu %lu %lu %llu %llu "
+				   "%lu %lu %llu\n",
+				   level, wr ? 'w' : 'r', sum.acquired,
+				   sum.contended, sum.deadlocks, sum.repeats,
+				   sum.inversions,
+				   div_u64(sum.wait_ns, NSEC_PER_USEC),
+				   div_u64(sum.max_wait_ns, NSEC_PER_USEC),
+				   sum.spins, sum.spin_released,
+				   div_u64(sum.spin_ns, NSEC_PER_USEC));
+		}
+	}
+	return 0;
+}
+
+static int lock_stat_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, lock_stat_show, inode->i_private);
+}
+
+/* any write resets lock statistics. Counters updated meanwhile on other
+ * CPUs may survive the reset or be lost */
+static ssize_t lock_stat_write(struct file *file, const char __user *buf,
+			       size_t count, loff_t *ppos)
+{
+	reiser4_tree *tree = ((struct seq_file *)file->private_data)->private;
+	int cpu;
+
+	if (tree->lock_stats == NULL)
+		return count;
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(tree->lock_stats, cpu), 0,
+		       sizeof(zlock_stats));
+	return count;
+}
+
+static const struct file_operations lock_stat_fops = {
+	.owner = THIS_MODULE,
+	.open = lock_stat_open,
+	.read = seq_read,
+	.write = lock_stat_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/**
+ * reiser4_tree_debugfs_init - export tree statistics
+ * @tree: tree
+ * @root: debugfs directory of the file system
+ *
+ * This is called on mount, after the per-super block debugfs directory is
+ * created. Files are removed together with that directory.
+ */
+void reiser4_tree_debugfs_init(reiser4_tree * tree, struct dentry *root)
+{
+	debugfs_create_file("hash_tables", S_IFREG | S_IRUSR, root, tree,
+			    &hash_tables_fops);
+	debugfs_create_file("cbk_cache", S_IFREG | S_IRUSR, root, tree,
+			    &cbk_cache_fops);
+	debugfs_create_file("shrinkers", S_IFREG | S_IRUSR, root, tree,
+			    &shrinkers_fops);
+	debugfs_create_file("lock_stat", S_IFREG | S_IRUSR | S_IWUSR, root,
+			    tree, &lock_stat_fops);
 }
 
 /* Make Linus happy.
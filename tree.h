@@ -10,14 +10,18 @@
 #include "debug.h"
 #include "dformat.h"
 #include "plugin/node/node.h"
+#include "plugin/node/node40.h"
 #include "plugin/plugin.h"
 #include "znode.h"
 #include "tap.h"
+#include "seal.h"
 
 #include <linux/types.h>	/* for __u??  */
 #include <linux/fs.h>		/* for struct super_block  */
 #include <linux/spinlock.h>
+#include <linux/workqueue.h>
 #include <linux/sched.h>	/* for struct task_struct */
+#include <linux/indirect_call_wrapper.h>
 
 /* fictive block number never actually used */
 extern const reiser4_block_nr UBER_TREE_ADDR;
@@ -31,6 +35,9 @@ extern const reiser4_block_nr UBER_TREE_ADDR;
 typedef struct cbk_cache_slot {
 	/* cached node */
 	znode *node;
+	/* left delimiting key of @node when it was added to the cache. The
+	   index of the cache is sorted by this key */
+	reiser4_key ld_key;
 	/* linkage to the next cbk cache slot in a LRU order */
 	struct list_head lru;
 } cbk_cache_slot;
@@ -49,21 +56,45 @@ typedef struct cbk_cache_slot {
    is inserted into cache, possibly pulling least recently used entry out of
    it.
 
-   Tree spin lock is used to protect coord cache. If contention for this
-   lock proves to be too high, more finer grained locking can be added.
+   Every CPU has its own LRU list of slots (&cbk_cache_cpu), so that lookups
+   running on different CPUs do not bounce a shared cache line. The lock of a
+   per-CPU part is taken by other CPUs only to remove a node which is going
+   away (cbk_cache_invalidate()). A znode which was ever added to the cache
+   has JNODE_CBK_CACHED bit set, other znodes are removed without looking at
+   the caches.
+
+   Lookups do not scan the slots. Used slots of a CPU are indexed by an array
+   sorted by the left delimiting keys the nodes had when they were added, and
+   a lookup checks only the few slots around the binary search position of
+   the key (see cbk_cache_probe()). Delimiting keys move when nodes are
+   balanced, so the index is only a hint: a node whose left delimiting key
+   moved far may be missed until it is added to the cache again.
 
    Invariants involving parts of this data-type:
 
       [cbk-cache-invariant]
 */
-typedef struct cbk_cache {
-	/* serializator */
-	rwlock_t guard;
-	int nr_slots;
+typedef struct cbk_cache_cpu {
+	/* protects slots of this CPU */
+	spinlock_t guard;
 	/* head of LRU list of cache slots */
 	struct list_head lru;
+	/* lookups satisfied and not satisfied by the cache */
+	unsigned long hits;
+	unsigned long misses;
+	/* cached nodes removed by cbk_cache_invalidate() */
+	unsigned long invalidations;
 	/* actual array of slots */
 	cbk_cache_slot *slot;
+	/* used slots sorted by ->ld_key */
+	cbk_cache_slot **index;
+	int nr_used;
+} cbk_cache_cpu;
+
+typedef struct cbk_cache {
+	/* number of slots of each CPU */
+	int nr_slots;
+	cbk_cache_cpu __percpu *cpu;
 } cbk_cache;
 
 /* level_lookup_result - possible outcome of looking up key at some level.
@@ -78,6 +109,31 @@ typedef enum {
 	LOOKUP_REST
 } level_lookup_result;
 
+/* kinds of balancing with separately calibrated estimates */
+typedef enum {
+	/* item insertion, paste or removal: estimate_one_insert_item() */
+	ESTIMATE_INSERT,
+	/* flow insertion: estimate_insert_flow() */
+	ESTIMATE_FLOW,
+	ESTIMATE_CLASSES
+} estimate_class;
+
+#define ESTIMATE_BUCKETS (64)
+
+/* histograms of grabbed blocks actually consumed by one carry, per kind of
+   balancing and tree height. See estimate.c */
+typedef struct reiser4_estimator {
+	unsigned int hist[ESTIMATE_CLASSES][REISER4_MAX_ZTREE_HEIGHT + 1]
+		[ESTIMATE_BUCKETS];
+	unsigned int samples[ESTIMATE_CLASSES][REISER4_MAX_ZTREE_HEIGHT + 1];
+	/* calibrated estimates, 0 if unknown */
+	reiser4_block_nr bound[ESTIMATE_CLASSES][REISER4_MAX_ZTREE_HEIGHT + 1];
+	/* added to percentile bounds, raised on each miss */
+	unsigned int margin;
+	/* carries which spent more than was grabbed */
+	unsigned long misses;
+} reiser4_estimator;
+
 /*    This is representation of internal reiser4 tree where all file-system
    data and meta-data are stored. This structure is passed to all tree
    manipulation functions. It's different from the super block because:
@@ -104,11 +160,18 @@ struct reiser4_tree {
 	   node only */
 	tree_level height;
 
+	/* root epoch, bumped under tree lock around changes of
+	   ->root_block and ->height, so that lookups can read both without
+	   locking uber znode. See prepare_root_lookup() */
+	seqcount_t root_seq;
+
 	/*
 	 * this is cached here avoid calling plugins through function
 	 * dereference all the time.
 	 */
 	__u64 estimate_one_insert;
+	/* observed space consumption of balancing, see estimate.c */
+	reiser4_estimator estimator;
 
 	/* cache of recent tree lookup results */
 	cbk_cache cbk_cache;
@@ -118,6 +181,39 @@ struct reiser4_tree {
 	z_hash_table zfake_table;
 	/* hash table to look up jnodes by inode and offset. */
 	j_hash_table jhash_table;
+	/* grows the hash tables above when they get overloaded, see
+	   znodes_tree_grow() */
+	struct work_struct hash_resize;
+	/* next bucket of @zhash_table for znode shrinker to look at, and
+	   number of znodes it released, see znode_shrink_scan() */
+	__u32 zshrink_cursor;
+	atomic_long_t nr_znodes_shrunk;
+	/* number of jnodes detached from clean pages, see
+	   shed_page_jnode() */
+	atomic_long_t nr_jnodes_shed;
+
+	/* pages of formatted nodes of twig level and above. Up to
+	   @max_pinned of them are not released by reiser4_releasepage(), so
+	   that a scan of leaves does not evict the upper levels of the tree */
+	atomic_t nr_upper_pages;
+	__u32 max_pinned;
+
+	/* budget of pages of formatted nodes, 0 if not limited. Clean pages
+	   above it are released by @cache_trim work, see cache_trim_work().
+	   @trim_cursor is the index the next trim starts from */
+	__u32 max_cached;
+	struct work_struct cache_trim;
+	pgoff_t trim_cursor;
+	atomic_long_t nr_pages_trimmed;
+
+	/* long term lock statistics, NULL if they could not be allocated.
+	   Exported in lock_stat debugfs file */
+	zlock_stats __percpu *lock_stats;
+
+	/* every @hot_rate-th lookup and lock wait is accounted in @hot, 0 if
+	   hot keys profiler is off, see tree_hot.c */
+	__u32 hot_rate;
+	struct hot_table *hot;
 
 	/* lock protecting:
 	   - parent pointers,
@@ -132,17 +228,21 @@ struct reiser4_tree {
 	   more SMP scalable we should test this locking change on n-ways (n >
 	   4) SMP machines.  Current 4-ways machine test does not show that tree
 	   lock is contented and it is a bottleneck (2003.07.25). */
+	/* Lookups do not take the tree lock, see zlook(). Insertion of new
+	   znodes is done under read tree lock and the lock of the stripe of
+	   buckets the znode hashes to, so that znodes are created in parallel.
+	   Removal and rehashing of znodes still take the tree lock for
+	   writing, which excludes insertions. */
 
 	rwlock_t tree_lock;
+	spinlock_t zhash_stripe[REISER4_ZHASH_STRIPES];
 
 	/* lock protecting delimiting keys */
 	rwlock_t dk_lock;
 
-	/* spin lock protecting znode_epoch */
-	spinlock_t epoch_lock;
 	/* version stamp used to mark znode updates. See seal.[ch] for more
 	 * information. */
-	__u64 znode_epoch;
+	atomic64_t znode_epoch;
 
 	znode *uber;
 	node_plugin *nplug;
@@ -164,6 +264,43 @@ extern int reiser4_init_tree(reiser4_tree * tree,
 			     tree_level height, node_plugin * default_plugin);
 extern void reiser4_done_tree(reiser4_tree * tree);
 
+/* start trimming of cached formatted nodes if @mapping, the mapping of
+   formatted nodes of @tree, holds more pages than the budget */
+static inline void reiser4_check_cache_budget(reiser4_tree * tree,
+					      struct address_space *mapping)
+{
+	__u32 budget = READ_ONCE(tree->max_cached);
+
+	if (unlikely(budget != 0) && READ_ONCE(mapping->nrpages) > budget)
+		schedule_work(&tree->cache_trim);
+}
+
+extern void reiser4_tree_debugfs_init(reiser4_tree * tree, struct dentry *root);
+extern void reiser4_tree_bench_debugfs_init(struct super_block *,
+					    struct dentry *root);
+extern void reiser4_tree_shape_debugfs_init(struct super_block *,
+					    struct dentry *root);
+extern void reiser4_tree_hot_debugfs_init(struct super_block *,
+					  struct dentry *root);
+extern void reiser4_done_tree_hot(reiser4_tree * tree);
+extern void __reiser4_hot_key(reiser4_tree * tree, const reiser4_key * key);
+extern void __reiser4_hot_node(const znode * node);
+
+/* sample lookup of @key for hot keys profiler, see tree_hot.c */
+static inline void reiser4_hot_key(reiser4_tree * tree,
+				   const reiser4_key * key)
+{
+	if (unlikely(READ_ONCE(tree->hot_rate) != 0))
+		__reiser4_hot_key(tree, key);
+}
+
+/* sample wait for lock of @node for hot keys profiler */
+static inline void reiser4_hot_node(const znode * node)
+{
+	if (unlikely(READ_ONCE(znode_get_tree(node)->hot_rate) != 0))
+		__reiser4_hot_node(node);
+}
+
 /* cbk flags: options for coord_by_key() */
 typedef enum {
 	/* coord_by_key() is called for insertion. This is necessary because
@@ -208,6 +345,16 @@ extern int reiser4_iterate_tree(reiser4_tree * tree, coord_t * coord,
 				lock_handle * lh,
 				tree_iterate_actor_t actor, void *arg,
 				znode_lock_mode mode, int through_units_p);
+/* actor called by reiser4_iterate_keys() for the key number @idx */
+typedef int (*keys_iterate_actor_t) (reiser4_tree * tree, coord_t * coord,
+				     lock_handle * lh, int idx,
+				     lookup_result result, void *arg);
+extern int reiser4_iterate_keys(reiser4_tree * tree,
+				const reiser4_key * keys, int nr_keys,
+				znode_lock_mode mode, lookup_bias bias,
+				tree_level lock_level, tree_level stop_level,
+				__u32 flags, keys_iterate_actor_t actor,
+				void *arg);
 extern int get_uber_znode(reiser4_tree * tree, znode_lock_mode mode,
 			  znode_lock_request pri, lock_handle * lh);
 
@@ -221,6 +368,12 @@ static inline node_plugin *node_plugin_by_node(const znode *
 	return node->nplug;
 }
 
+/* call @method of node plugin @nplug. Node40 and node41, the layouts of
+   nearly all trees, share methods of node40, so they are called directly
+   when they match rather than through retpoline of indirect call */
+#define NODE_CALL(nplug, method, ...)					\
+	INDIRECT_CALL_1((nplug)->method, method##_node40, __VA_ARGS__)
+
 /* number of items in @node */
 static inline pos_in_node_t node_num_items(const znode * node)
 {
@@ -292,6 +445,18 @@ lookup_result coord_by_key(reiser4_tree * tree, const reiser4_key * key,
 			   tree_level lock_level, tree_level stop_level,
 			   __u32 flags, ra_info_t *);
 
+lookup_result reiser4_finger_lookup(struct inode *object,
+				    reiser4_finger *finger,
+				    const reiser4_key * key,
+				    coord_t * coord,
+				    lock_handle * lh,
+				    znode_lock_mode lock_mode,
+				    lookup_bias bias,
+				    tree_level lock_level,
+				    tree_level stop_level,
+				    __u32 flags, ra_info_t * info);
+void reiser4_finger_set(reiser4_finger *finger, znode *node);
+
 lookup_result reiser4_object_lookup(struct inode *object,
 				    const reiser4_key * key,
 				    coord_t * coord,
@@ -306,6 +471,9 @@ insert_result insert_by_key(reiser4_tree * tree, const reiser4_key * key,
 			    reiser4_item_data * data, coord_t * coord,
 			    lock_handle * lh,
 			    tree_level stop_level, __u32 flags);
+int insert_by_keys(reiser4_tree * tree, const reiser4_key * keys,
+		   reiser4_item_data * data, int nr, tree_level stop_level,
+		   __u32 flags);
 insert_result insert_by_coord(coord_t * coord,
 			      reiser4_item_data * data, const reiser4_key * key,
 			      lock_handle * lh, __u32);
@@ -356,6 +524,8 @@ extern znode *child_znode(const coord_t * in_parent, znode * parent,
 extern int cbk_cache_init(cbk_cache * cache);
 extern void cbk_cache_done(cbk_cache * cache);
 extern void cbk_cache_invalidate(const znode * node, reiser4_tree * tree);
+extern void cbk_cache_stat(const cbk_cache * cache, unsigned long *hits,
+			   unsigned long *misses, unsigned long *invalidations);
 
 extern char *sprint_address(const reiser4_block_nr * block);
 
@@ -416,6 +586,8 @@ typedef struct cbk_handle {
 	__u32 flags;
 	ra_info_t *ra_info;
 	struct inode *object;
+	/* nodes to start lookup from, if they still cover the key */
+	const reiser4_finger *finger;
 } cbk_handle;
 
 extern znode_lock_mode cbk_lock_mode(tree_level level, cbk_handle * h);
@@ -553,6 +725,9 @@ static inline void write_unlock_dk(reiser4_tree *tree)
 }
 
 /* estimate api. Implementation is in estimate.c */
+void reiser4_estimate_account(reiser4_tree *, estimate_class, tree_level,
+			      reiser4_block_nr consumed);
+void reiser4_estimate_miss(reiser4_tree *);
 reiser4_block_nr estimate_one_insert_item(reiser4_tree *);
 reiser4_block_nr estimate_one_insert_into_item(reiser4_tree *);
 reiser4_block_nr estimate_insert_flow(tree_level);
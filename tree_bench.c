@@ -0,0 +1,393 @@
+/* Copyright 2001, 2002, 2003 by Hans Reiser, licensing governed by
+ * reiser4/README */
+
+/*
+ * Benchmark of tree operations.
+ *
+ * Writing "<distribution> <number>" to the tree_bench file of the per-super
+ * block debugfs directory inserts that many black box items into the tree of
+ * the mounted file system, looks them all up, searches for each of them
+ * within its leaf and removes them one by one. Distributions of keys are:
+ *
+ *   seq     consecutive object ids
+ *   random  object ids scattered over the whole key space
+ *   dir     directory entry keys of names like "f000123.c", fibrated as the
+ *           root directory does it
+ *
+ * Items live in a locality of an object id allocated for the run, so they
+ * do not mix with keys of real objects, and whatever is left of them after
+ * an error is removed. Reading the file reports the last run, one operation
+ * per line:
+ *
+ *   insert       insert_by_key(), with carry shifts and splits it does
+ *   lookup       coord_by_key() down to the leaf
+ *   node_lookup  ->lookup() method of node plugin in the leaf found
+ *   cut          reiser4_cut_tree() of single item, with carry shifts
+ *
+ * and for each of them number of operations, total time in microseconds and
+ * average time in nanoseconds. Example:
+ *
+ *   echo random 100000 > /sys/kernel/debug/reiser4/sda1/tree_bench
+ *   cat /sys/kernel/debug/reiser4/sda1/tree_bench
+ */
+
+#include "debug.h"
+#include "super.h"
+#include "tree.h"
+#include "txnmgr.h"
+#include "block_alloc.h"
+#include "kassign.h"
+#include "inode.h"
+#include "plugin/item/blackbox.h"
+
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/mutex.h>
+#include <linux/ktime.h>
+
+typedef enum {
+	BENCH_INSERT,
+	BENCH_LOOKUP,
+	BENCH_NODE_LOOKUP,
+	BENCH_CUT,
+	BENCH_NR_OPS
+} bench_op;
+
+static const char *bench_op_names[BENCH_NR_OPS] = {
+	[BENCH_INSERT] = "insert",
+	[BENCH_LOOKUP] = "lookup",
+	[BENCH_NODE_LOOKUP] = "node_lookup",
+	[BENCH_CUT] = "cut"
+};
+
+typedef enum {
+	BENCH_SEQ,
+	BENCH_RANDOM,
+	BENCH_DIR,
+	BENCH_NR_DISTS
+} bench_dist;
+
+static const char *bench_dist_names[BENCH_NR_DISTS] = {
+	[BENCH_SEQ] = "seq",
+	[BENCH_RANDOM] = "random",
+	[BENCH_DIR] = "dir"
+};
+
+/* extensions of names of "dir" distribution */
+static const char *bench_exts[] = { "c", "h", "o", "cc", "json" };
+
+struct bench_run {
+	char dev[32];
+	bench_dist dist;
+	unsigned long nr;
+	/* tree height after insertions */
+	tree_level height;
+	unsigned long count[BENCH_NR_OPS];
+	u64 ns[BENCH_NR_OPS];
+};
+
+/* protects the last run, serializes runs */
+static DEFINE_MUTEX(bench_guard);
+static struct bench_run bench_last;
+
+/* key of @i-th item of @dist in @locality */
+static void bench_key(struct super_block *super, bench_dist dist,
+		      oid_t locality, unsigned long i, reiser4_key *key)
+{
+	char name[24];
+	int len;
+
+	reiser4_key_init(key);
+	set_key_locality(key, locality);
+	switch (dist) {
+	case BENCH_SEQ:
+		set_key_objectid(key, i + 1);
+		break;
+	case BENCH_RANDOM:
+		/* multiplication by odd number is a bijection modulo 2^60 */
+		set_key_objectid(key, ((i + 1) * 0x9e3779b97f4a7c15ull) &
+				 ((1ull << 60) - 1));
+		break;
+	case BENCH_DIR:
+		len = snprintf(name, sizeof(name), "f%06lu.%s", i,
+			       bench_exts[i % ARRAY_SIZE(bench_exts)]);
+		complete_entry_key(super->s_root->d_inode, name, len, key);
+		break;
+	default:
+		impossible("", "wrong distribution");
+	}
+}
+
+static u64 bench_insert(reiser4_tree *tree, const reiser4_key *key,
+			int *result)
+{
+	u64 payload = 0;
+	u64 start;
+
+	*result = reiser4_grab_space(estimate_one_insert_item(tree),
+				     BA_CAN_COMMIT);
+	if (*result)
+		return 0;
+	start = ktime_get_ns();
+	*result = store_black_box(tree, key, &payload, sizeof(payload));
+	start = ktime_get_ns() - start;
+	all_grabbed2free();
+	return start;
+}
+
+/* time lookup of @key in the tree and within its leaf */
+static u64 bench_lookup(reiser4_tree *tree, const reiser4_key *key,
+			u64 *node_ns, int *result)
+{
+	coord_t coord;
+	coord_t in_node;
+	lock_handle lh;
+	u64 start;
+	u64 ns;
+
+	init_lh(&lh);
+	start = ktime_get_ns();
+	*result = coord_by_key(tree, key, &coord, &lh, ZNODE_READ_LOCK,
+			       FIND_EXACT, LEAF_LEVEL, LEAF_LEVEL, CBK_UNIQUE,
+			       NULL);
+	ns = ktime_get_ns() - start;
+	if (*result != CBK_COORD_FOUND) {
+		done_lh(&lh);
+		*result = cbk_errored(*result) ? *result : RETERR(-EIO);
+		return ns;
+	}
+	*result = zload(coord.node);
+	if (*result == 0) {
+		start = ktime_get_ns();
+		if (node_plugin_by_node(coord.node)->lookup(coord.node, key,
+							    FIND_EXACT,
+							    &in_node) !=
+		    NS_FOUND)
+			*result = RETERR(-EIO);
+		*node_ns = ktime_get_ns() - start;
+		zrelse(coord.node);
+	}
+	done_lh(&lh);
+	return ns;
+}
+
+static u64 bench_cut(reiser4_tree *tree, const reiser4_key *key, int *result)
+{
+	u64 start;
+
+	*result = reiser4_grab_space(estimate_one_item_removal(tree),
+				     BA_CAN_COMMIT | BA_RESERVED);
+	if (*result)
+		return 0;
+	start = ktime_get_ns();
+	*result = reiser4_cut_tree(tree, key, key, NULL, 1);
+	start = ktime_get_ns() - start;
+	all_grabbed2free();
+	return start;
+}
+
+/* remove whatever is left in @locality */
+static int bench_cleanup(reiser4_tree *tree, oid_t locality)
+{
+	reiser4_key from;
+	reiser4_key to;
+	int result;
+
+	reiser4_key_init(&from);
+	set_key_locality(&from, locality);
+	to = *reiser4_max_key();
+	set_key_locality(&to, locality);
+
+	result = reiser4_grab_space(estimate_one_item_removal(tree),
+				    BA_CAN_COMMIT | BA_RESERVED);
+	if (result)
+		return result;
+	result = reiser4_cut_tree(tree, &from, &to, NULL, 1);
+	all_grabbed2free();
+	return result;
+}
+
+/* run all phases in @locality. Distribution and number of items are taken
+   from @run */
+static int bench_phases(struct super_block *super, oid_t locality,
+			struct bench_run *run)
+{
+	reiser4_tree *tree = &get_super_private(super)->tree;
+	reiser4_key key;
+	bench_op op;
+	unsigned long i;
+	int result = 0;
+
+	for (op = BENCH_INSERT; op < BENCH_NR_OPS; op++) {
+		if (op == BENCH_NODE_LOOKUP)
+			/* measured together with BENCH_LOOKUP */
+			continue;
+		for (i = 0; i < run->nr && result == 0; i++) {
+			u64 node_ns = 0;
+
+			bench_key(super, run->dist, locality, i, &key);
+			switch (op) {
+			case BENCH_INSERT:
+				run->ns[op] += bench_insert(tree, &key,
+							    &result);
+				break;
+			case BENCH_LOOKUP:
+				run->ns[op] += bench_lookup(tree, &key,
+							    &node_ns, &result);
+				run->ns[BENCH_NODE_LOOKUP] += node_ns;
+				run->count[BENCH_NODE_LOOKUP]++;
+				break;
+			default:
+				run->ns[op] += bench_cut(tree, &key, &result);
+			}
+			run->count[op]++;
+
+			if ((i + 1) % REISER4_TREE_BENCH_BATCH == 0) {
+				reiser4_txn_restart_current();
+				cond_resched();
+			}
+			if (fatal_signal_pending(current))
+				result = RETERR(-EINTR);
+		}
+		if (result)
+			break;
+		if (op == BENCH_INSERT)
+			run->height = tree->height;
+		reiser4_txn_restart_current();
+	}
+	return result;
+}
+
+static int tree_bench_run(struct super_block *super, bench_dist dist,
+			  unsigned long nr)
+{
+	reiser4_context *ctx;
+	struct bench_run *run;
+	oid_t locality;
+	int result;
+	int ret;
+
+	run = kzalloc(sizeof(*run), GFP_KERNEL);
+	if (run == NULL)
+		return RETERR(-ENOMEM);
+	strlcpy(run->dev, super->s_id, sizeof(run->dev));
+	run->dist = dist;
+	run->nr = nr;
+
+	ctx = reiser4_init_context(super);
+	if (IS_ERR(ctx)) {
+		kfree(run);
+		return PTR_ERR(ctx);
+	}
+	locality = oid_allocate(super);
+	if (locality == ABSOLUTE_MAX_OID) {
+		reiser4_exit_context(ctx);
+		kfree(run);
+		return RETERR(-EOVERFLOW);
+	}
+
+	result = bench_phases(super, locality, run);
+	ret = bench_cleanup(&get_super_private(super)->tree, locality);
+	if (result == 0)
+		result = ret;
+	oid_release(super, locality);
+	reiser4_exit_context(ctx);
+
+	if (result == 0) {
+		mutex_lock(&bench_guard);
+		bench_last = *run;
+		mutex_unlock(&bench_guard);
+	}
+	kfree(run);
+	return result;
+}
+
+static int tree_bench_show(struct seq_file *m, void *unused)
+{
+	bench_op op;
+
+	mutex_lock(&bench_guard);
+	if (bench_last.nr == 0) {
+		mutex_unlock(&bench_guard);
+		return 0;
+	}
+	seq_printf(m, "dev %s\ndist %s\nitems %lu\nheight %u\n",
+		   bench_last.dev, bench_dist_names[bench_last.dist],
+		   bench_last.nr, bench_last.height);
+	seq_puts(m, "op count total_us avg_ns\n");
+	for (op = BENCH_INSERT; op < BENCH_NR_OPS; op++)
+		seq_printf(m, "%s %lu %llu %llu\n", bench_op_names[op],
+			   bench_last.count[op],
+			   div_u64(bench_last.ns[op], NSEC_PER_USEC),
+			   div64_u64(bench_last.ns[op],
+				     bench_last.count[op] ? : 1));
+	mutex_unlock(&bench_guard);
+	return 0;
+}
+
+static int tree_bench_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, tree_bench_show, inode->i_private);
+}
+
+static ssize_t tree_bench_write(struct file *file, const char __user *buf,
+				size_t count, loff_t *ppos)
+{
+	struct super_block *super =
+		((struct seq_file *)file->private_data)->private;
+	char cmd[32];
+	char name[8];
+	unsigned long nr;
+	bench_dist dist;
+	int result;
+
+	if (count >= sizeof(cmd))
+		return RETERR(-EINVAL);
+	if (copy_from_user(cmd, buf, count))
+		return RETERR(-EFAULT);
+	cmd[count] = 0;
+	if (sscanf(cmd, "%7s %lu", name, &nr) != 2 ||
+	    nr == 0 || nr > REISER4_TREE_BENCH_MAX_ITEMS)
+		return RETERR(-EINVAL);
+	for (dist = 0; dist < BENCH_NR_DISTS; dist++)
+		if (!strcmp(name, bench_dist_names[dist]))
+			break;
+	if (dist == BENCH_NR_DISTS)
+		return RETERR(-EINVAL);
+	if (sb_rdonly(super))
+		return RETERR(-EROFS);
+
+	result = tree_bench_run(super, dist, nr);
+	return result ? result : count;
+}
+
+static const struct file_operations tree_bench_fops = {
+	.owner = THIS_MODULE,
+	.open = tree_bench_open,
+	.read = seq_read,
+	.write = tree_bench_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/**
+ * reiser4_tree_bench_debugfs_init - export benchmark of tree operations
+ * @super: super block
+ * @root: debugfs directory of the file system
+ */
+void reiser4_tree_bench_debugfs_init(struct super_block *super,
+				     struct dentry *root)
+{
+	debugfs_create_file("tree_bench", S_IFREG | S_IRUSR | S_IWUSR, root,
+			    super, &tree_bench_fops);
+}
+
+/* Make Linus happy.
+   Local variables:
+   c-indentation-style: "K&R"
+   mode-name: "LC"
+   c-basic-offset: 8
+   tab-width: 8
+   fill-column: 120
+   End:
+*/
@@ -0,0 +1,298 @@
+/* Copyright 2001, 2002, 2003 by Hans Reiser, licensing governed by
+ * reiser4/README */
+
+/*
+ * Sampling profiler of hot keys and nodes.
+ *
+ * Writing N to the hot_keys file of the per-super block debugfs directory
+ * starts sampling of every N-th tree lookup and of every N-th long term lock
+ * request which had to sleep. Writing 0 stops it, writing "reset" clears the
+ * table. Reading the file reports the sampled objects, most frequent first:
+ *
+ *   <samples> sd|dir|body|attr|safelink <objectid>
+ *   <samples> node <block>
+ *
+ * Lookups are accounted by key class to the object the key belongs to, or
+ * for directory entries to the directory. Waits for long term locks are
+ * accounted to the block of the node. Example:
+ *
+ *   echo 64 > /sys/kernel/debug/reiser4/sda1/hot_keys
+ *   cat /sys/kernel/debug/reiser4/sda1/hot_keys
+ *
+ * The table keeps HOT_SLOTS objects. A sample of an object which is not in
+ * the table replaces the object with fewest samples and inherits its count
+ * ("space saving" algorithm), so objects sampled often enough always make it
+ * to the table, while counts of the rarer ones are overestimated.
+ *
+ * Only sampled events take the table lock, and when sampling is off lookups
+ * and locks pay one test of tree->hot_rate.
+ */
+
+#include "debug.h"
+#include "super.h"
+#include "tree.h"
+#include "key.h"
+#include "znode.h"
+#include "safe_link.h"
+
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/percpu.h>
+#include <linux/sort.h>
+#include <linux/slab.h>
+
+#define HOT_SLOTS (64)
+
+typedef enum {
+	HOT_SD,
+	HOT_DIR,
+	HOT_BODY,
+	HOT_ATTR,
+	HOT_SAFELINK,
+	HOT_NODE,
+	HOT_KINDS
+} hot_kind;
+
+static const char *hot_kind_name[HOT_KINDS] = {
+	[HOT_SD] = "sd",
+	[HOT_DIR] = "dir",
+	[HOT_BODY] = "body",
+	[HOT_ATTR] = "attr",
+	[HOT_SAFELINK] = "safelink",
+	[HOT_NODE] = "node"
+};
+
+struct hot_entry {
+	unsigned long count;
+	__u64 id;
+	hot_kind kind;
+};
+
+struct hot_table {
+	spinlock_t guard;
+	/* slots in use */
+	int used;
+	struct hot_entry slot[HOT_SLOTS];
+};
+
+/* serializes allocation of tables and changes of sampling rate */
+static DEFINE_MUTEX(hot_guard);
+static DEFINE_PER_CPU(unsigned, hot_tick);
+
+/* true for every tree->hot_rate-th event on this cpu */
+static int hot_sampled(reiser4_tree * tree)
+{
+	unsigned rate = READ_ONCE(tree->hot_rate);
+
+	return rate != 0 && this_cpu_inc_return(hot_tick) % rate == 0;
+}
+
+static void hot_account(reiser4_tree * tree, hot_kind kind, __u64 id)
+{
+	/* paired with smp_store_release() in hot_keys_write() */
+	struct hot_table *table = smp_load_acquire(&tree->hot);
+	struct hot_entry *victim;
+	int i;
+
+	if (table == NULL)
+		return;
+	spin_lock(&table->guard);
+	victim = &table->slot[0];
+	for (i = 0; i < table->used; i++) {
+		struct hot_entry *e = &table->slot[i];
+
+		if (e->kind == kind && e->id == id) {
+			e->count++;
+			spin_unlock(&table->guard);
+			return;
+		}
+		if (e->count < victim->count)
+			victim = e;
+	}
+	if (table->used < HOT_SLOTS) {
+		victim = &table->slot[table->used++];
+		victim->count = 0;
+	}
+	victim->count++;
+	victim->kind = kind;
+	victim->id = id;
+	spin_unlock(&table->guard);
+}
+
+/**
+ * __reiser4_hot_key - sample tree lookup of @key
+ * @tree: tree looked up
+ * @key: key looked for
+ *
+ * Called through reiser4_hot_key(), when sampling is on.
+ */
+void __reiser4_hot_key(reiser4_tree * tree, const reiser4_key * key)
+{
+	hot_kind kind;
+	__u64 id;
+
+	if (!hot_sampled(tree))
+		return;
+	id = get_key_objectid(key);
+	switch (get_key_type(key)) {
+	case KEY_FILE_NAME_MINOR:
+		kind = HOT_DIR;
+		id = get_key_locality(key);
+		break;
+	case KEY_SD_MINOR:
+		kind = HOT_SD;
+		break;
+	case KEY_BODY_MINOR:
+		kind = (get_key_locality(key) == safe_link_locality(tree)) ?
+			HOT_SAFELINK : HOT_BODY;
+		break;
+	default:
+		kind = HOT_ATTR;
+		break;
+	}
+	hot_account(tree, kind, id);
+}
+
+/**
+ * __reiser4_hot_node - sample wait for long term lock of @node
+ * @node: node whose lock the current thread waited for
+ *
+ * Called through reiser4_hot_node(), when sampling is on.
+ */
+void __reiser4_hot_node(const znode * node)
+{
+	reiser4_tree *tree = znode_get_tree(node);
+
+	if (hot_sampled(tree))
+		hot_account(tree, HOT_NODE, *znode_get_block(node));
+}
+
+static int hot_entry_cmp(const void *a, const void *b)
+{
+	const struct hot_entry *e1 = a;
+	const struct hot_entry *e2 = b;
+
+	if (e1->count == e2->count)
+		return 0;
+	return e1->count < e2->count ? 1 : -1;
+}
+
+static int hot_keys_show(struct seq_file *m, void *unused)
+{
+	reiser4_tree *tree = m->private;
+	struct hot_table *table;
+	struct hot_entry *copy;
+	int used = 0;
+	int i;
+
+	copy = kmalloc_array(HOT_SLOTS, sizeof(*copy), GFP_KERNEL);
+	if (copy == NULL)
+		return RETERR(-ENOMEM);
+	mutex_lock(&hot_guard);
+	table = tree->hot;
+	if (table != NULL) {
+		spin_lock(&table->guard);
+		used = table->used;
+		memcpy(copy, table->slot, used * sizeof(*copy));
+		spin_unlock(&table->guard);
+	}
+	seq_printf(m, "rate %u\n", tree->hot_rate);
+	mutex_unlock(&hot_guard);
+
+	sort(copy, used, sizeof(*copy), hot_entry_cmp, NULL);
+	for (i = 0; i < used; i++)
+		seq_printf(m, "%lu %s %llu\n", copy[i].count,
+			   hot_kind_name[copy[i].kind],
+			   (unsigned long long)copy[i].id);
+	kfree(copy);
+	return 0;
+}
+
+static int hot_keys_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, hot_keys_show, inode->i_private);
+}
+
+static ssize_t hot_keys_write(struct file *file, const char __user *buf,
+			      size_t count, loff_t *ppos)
+{
+	reiser4_tree *tree = ((struct seq_file *)file->private_data)->private;
+	struct hot_table *table;
+	ssize_t result = count;
+	char cmd[16];
+	unsigned rate;
+
+	if (count >= sizeof(cmd))
+		return RETERR(-EINVAL);
+	if (copy_from_user(cmd, buf, count))
+		return RETERR(-EFAULT);
+	cmd[count] = 0;
+
+	mutex_lock(&hot_guard);
+	table = tree->hot;
+	if (!strcmp(strim(cmd), "reset")) {
+		if (table != NULL) {
+			spin_lock(&table->guard);
+			table->used = 0;
+			spin_unlock(&table->guard);
+		}
+	} else if (kstrtouint(strim(cmd), 10, &rate) == 0) {
+		if (table == NULL && rate != 0) {
+			table = kzalloc(sizeof(*table), GFP_KERNEL);
+			if (table == NULL) {
+				mutex_unlock(&hot_guard);
+				return RETERR(-ENOMEM);
+			}
+			spin_lock_init(&table->guard);
+			smp_store_release(&tree->hot, table);
+		}
+		WRITE_ONCE(tree->hot_rate, rate);
+	} else
+		result = RETERR(-EINVAL);
+	mutex_unlock(&hot_guard);
+	return result;
+}
+
+static const struct file_operations hot_keys_fops = {
+	.owner = THIS_MODULE,
+	.open = hot_keys_open,
+	.read = seq_read,
+	.write = hot_keys_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/**
+ * reiser4_tree_hot_debugfs_init - export hot keys profiler
+ * @super: super block
+ * @root: debugfs directory of the file system
+ */
+void reiser4_tree_hot_debugfs_init(struct super_block *super,
+				   struct dentry *root)
+{
+	debugfs_create_file("hot_keys", S_IFREG | S_IRUSR | S_IWUSR, root,
+			    &get_super_private(super)->tree, &hot_keys_fops);
+}
+
+/**
+ * reiser4_done_tree_hot - release table of hot keys profiler
+ * @tree: tree being released
+ *
+ * This is called on umount, when no lookups can sample the table anymore.
+ */
+void reiser4_done_tree_hot(reiser4_tree * tree)
+{
+	tree->hot_rate = 0;
+	kfree(tree->hot);
+	tree->hot = NULL;
+}
+
+/* Make Linus happy.
+   Local variables:
+   c-indentation-style: "K&R"
+   mode-name: "LC"
+   c-basic-offset: 8
+   tab-width: 8
+   fill-column: 120
+   End:
+*/
@@ -154,6 +154,7 @@ znode *reiser4_add_tree_root(znode * old_root /* existing tree root */ ,
 
 				/* new root is a child of "fake" node */
 				write_lock_tree(tree);
+				write_seqcount_begin(&tree->root_seq);
 
 				++tree->height;
 
@@ -162,6 +163,7 @@ znode *reiser4_add_tree_root(znode * old_root /* existing tree root */ ,
 					calc_estimate_one_insert(tree->height);
 
 				tree->root_block = *znode_get_block(new_root);
+				write_seqcount_end(&tree->root_seq);
 				in_parent = &new_root->in_parent;
 				init_parent_coord(in_parent, fake);
 				/* manually insert new root into sibling
@@ -299,8 +301,10 @@ static int reiser4_kill_root(reiser4_tree * tree /* tree from which root is
 
 		write_lock_tree(tree);
 
+		write_seqcount_begin(&tree->root_seq);
 		tree->root_block = *new_root_blk;
 		--tree->height;
+		write_seqcount_end(&tree->root_seq);
 
 		/* recalculate max balance overhead */
 		tree->estimate_one_insert =
@@ -311,7 +315,7 @@ static int reiser4_kill_root(reiser4_tree * tree /* tree from which root is
 
 		/* new root is child on "fake" node */
 		init_parent_coord(&new_root->in_parent, uber);
-		++uber->c_count;
+		atomic_inc(&uber->c_count);
 
 		/* sibling_list_insert_nolock(new_root, NULL); */
 		write_unlock_tree(tree);
@@ -322,7 +326,7 @@ static int reiser4_kill_root(reiser4_tree * tree /* tree from which root is
 		if (result == 0) {
 			assert("nikita-1279", node_is_empty(old_root));
 			ZF_SET(old_root, JNODE_HEARD_BANSHEE);
-			old_root->c_count = 0;
+			atomic_set(&old_root->c_count, 0);
 		}
 	}
 	done_lh(&handle_for_uber);
@@ -0,0 +1,362 @@
+/* Copyright 2001, 2002, 2003 by Hans Reiser, licensing governed by
+ * reiser4/README */
+
+/*
+ * Report of the tree shape.
+ *
+ * Writing "scan" to the tree_shape file of the per-super block debugfs
+ * directory walks the tree of the mounted file system level by level, from
+ * the root down to the leaves, and reading the file reports the last walk:
+ *
+ *   level   number of nodes and items at each level, average fill of nodes
+ *           in percents of node size and histogram of fill in 10% steps
+ *   twig    number of internal and extent items at twig level
+ *   extent  number of allocated, unallocated and hole extent units, number
+ *           of allocated blocks and of fragments, that is runs of allocated
+ *           blocks physically contiguous across units and items
+ *   run     histogram of fragment lengths in blocks, by powers of 2
+ *
+ * Example:
+ *
+ *   echo scan > /sys/kernel/debug/reiser4/sda1/tree_shape
+ *   cat /sys/kernel/debug/reiser4/sda1/tree_shape
+ *
+ * Many short fragments mean the defragmenter is worth running, low fill of
+ * leaves and twigs that squeezing of the tree is.
+ *
+ * Nodes are scanned under read lock, one at a time. The walk leaves the
+ * tree every REISER4_TREE_SHAPE_BATCH nodes and sleeps for
+ * REISER4_TREE_SHAPE_PAUSE milliseconds before it looks up the node it
+ * stopped at, so that it does not compete with the file system users
+ * much. As the tree changes meanwhile, figures are approximate.
+ */
+
+#include "debug.h"
+#include "super.h"
+#include "tree.h"
+#include "tree_walk.h"
+#include "znode.h"
+#include "coord.h"
+#include "plugin/item/item.h"
+#include "plugin/item/extent.h"
+#include "plugin/node/node.h"
+
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/mutex.h>
+#include <linux/delay.h>
+#include <linux/log2.h>
+
+#define SHAPE_FILL_BUCKETS (10)
+#define SHAPE_RUN_BUCKETS (20)
+
+struct shape_level {
+	unsigned long nodes;
+	unsigned long items;
+	/* sum of used bytes of nodes */
+	u64 used;
+	unsigned long fill[SHAPE_FILL_BUCKETS];
+};
+
+struct shape_report {
+	char dev[32];
+	tree_level height;
+	unsigned blocksize;
+	struct shape_level level[REISER4_MAX_ZTREE_HEIGHT];
+	unsigned long twig_internal;
+	unsigned long twig_extent;
+	unsigned long allocated;
+	unsigned long unallocated;
+	unsigned long holes;
+	u64 blocks;
+	unsigned long fragments;
+	unsigned long run[SHAPE_RUN_BUCKETS];
+};
+
+/* state of the walk of one level */
+struct shape_walk {
+	struct shape_report *report;
+	tree_level level;
+	/* block of the node being scanned */
+	reiser4_block_nr block;
+	/* nodes scanned since the walk entered the tree */
+	unsigned long batch;
+	/* key of the node the walk stopped at to pause */
+	reiser4_key resume;
+	int paused;
+	/* the fragment being scanned */
+	reiser4_block_nr run_end;
+	reiser4_block_nr run_len;
+};
+
+/* protects the last report */
+static DEFINE_MUTEX(shape_guard);
+static struct shape_report shape_last;
+
+static void shape_end_run(struct shape_walk *w)
+{
+	if (w->run_len == 0)
+		return;
+	w->report->fragments++;
+	w->report->run[min_t(unsigned, ilog2(w->run_len),
+			     SHAPE_RUN_BUCKETS - 1)]++;
+	w->run_len = 0;
+}
+
+static void shape_extent(struct shape_walk *w, const coord_t *coord)
+{
+	struct shape_report *report = w->report;
+	reiser4_extent *ext = extent_item(coord);
+	unsigned i;
+
+	report->twig_extent++;
+	for (i = 0; i < coord_num_units(coord); i++, ext++) {
+		reiser4_block_nr start;
+		reiser4_block_nr width = extent_get_width(ext);
+
+		switch (state_of_extent(ext)) {
+		case HOLE_EXTENT:
+			report->holes++;
+			continue;
+		case UNALLOCATED_EXTENT:
+			report->unallocated++;
+			continue;
+		default:
+			break;
+		}
+		report->allocated++;
+		report->blocks += width;
+		start = extent_get_start(ext);
+		if (w->run_len == 0 || start != w->run_end) {
+			shape_end_run(w);
+			w->run_end = start;
+		}
+		w->run_len += width;
+		w->run_end += width;
+	}
+}
+
+static void shape_node(struct shape_walk *w, znode *node)
+{
+	struct shape_level *level = &w->report->level[w->level - 1];
+	unsigned size = znode_size(node);
+	unsigned used = size - node->nplug->free_space(node);
+
+	level->nodes++;
+	level->used += used;
+	level->fill[min(used * SHAPE_FILL_BUCKETS / size,
+			(unsigned)SHAPE_FILL_BUCKETS - 1)]++;
+}
+
+/* tree_iterate_actor_t called for each item of the level */
+static int shape_actor(reiser4_tree *tree, coord_t *coord, lock_handle *lh,
+		       void *arg)
+{
+	struct shape_walk *w = arg;
+
+	if (*znode_get_block(coord->node) != w->block) {
+		if (w->batch == REISER4_TREE_SHAPE_BATCH) {
+			/* leave the tree to pause */
+			item_key_by_coord(coord, &w->resume);
+			w->paused = 1;
+			return 0;
+		}
+		if (fatal_signal_pending(current))
+			return RETERR(-EINTR);
+		w->block = *znode_get_block(coord->node);
+		w->batch++;
+		shape_node(w, coord->node);
+	}
+	w->report->level[w->level - 1].items++;
+	if (w->level == TWIG_LEVEL) {
+		if (item_is_internal(coord))
+			w->report->twig_internal++;
+		else if (item_is_extent(coord))
+			shape_extent(w, coord);
+	}
+	return 1;
+}
+
+/* scan nodes of @w->level starting from the one containing @key */
+static int shape_scan(reiser4_tree *tree, struct shape_walk *w,
+		      const reiser4_key *key)
+{
+	coord_t coord;
+	lock_handle lh;
+	int result;
+
+	init_lh(&lh);
+	result = coord_by_key(tree, key, &coord, &lh, ZNODE_READ_LOCK,
+			      FIND_MAX_NOT_MORE_THAN, w->level, w->level, 0,
+			      NULL);
+	if (cbk_errored(result)) {
+		done_lh(&lh);
+		return result;
+	}
+	result = zload(lh.node);
+	if (result == 0) {
+		if (node_is_empty(lh.node))
+			result = -E_NO_NEIGHBOR;
+		else if (keyeq(key, reiser4_min_key()) ||
+			 !coord_is_existing_item(&coord))
+			coord_init_first_unit(&coord, lh.node);
+		else {
+			coord.unit_pos = 0;
+			coord.between = AT_UNIT;
+		}
+		zrelse(lh.node);
+	}
+	if (result == 0) {
+		w->batch = 0;
+		w->paused = 0;
+		result = reiser4_iterate_tree(tree, &coord, &lh, shape_actor,
+					      w, ZNODE_READ_LOCK, 0);
+	}
+	done_lh(&lh);
+	/* end of the level */
+	return result == -E_NO_NEIGHBOR ? 0 : result;
+}
+
+static int shape_walk_tree(struct super_block *super,
+			   struct shape_report *report)
+{
+	reiser4_tree *tree = &get_super_private(super)->tree;
+	struct shape_walk w;
+	tree_level level;
+	int result = 0;
+
+	report->height = tree->height;
+	report->blocksize = super->s_blocksize;
+	for (level = tree->height; level >= LEAF_LEVEL && result == 0;
+	     level--) {
+		memset(&w, 0, sizeof(w));
+		w.report = report;
+		w.level = level;
+		result = shape_scan(tree, &w, reiser4_min_key());
+		while (result == 0 && w.paused) {
+			msleep_interruptible(REISER4_TREE_SHAPE_PAUSE);
+			result = shape_scan(tree, &w, &w.resume);
+		}
+		shape_end_run(&w);
+	}
+	return result;
+}
+
+static int tree_shape_run(struct super_block *super)
+{
+	reiser4_context *ctx;
+	struct shape_report *report;
+	int result;
+
+	report = kzalloc(sizeof(*report), GFP_KERNEL);
+	if (report == NULL)
+		return RETERR(-ENOMEM);
+	strlcpy(report->dev, super->s_id, sizeof(report->dev));
+
+	ctx = reiser4_init_context(super);
+	if (IS_ERR(ctx)) {
+		kfree(report);
+		return PTR_ERR(ctx);
+	}
+	result = shape_walk_tree(super, report);
+	reiser4_exit_context(ctx);
+
+	if (result == 0) {
+		mutex_lock(&shape_guard);
+		shape_last = *report;
+		mutex_unlock(&shape_guard);
+	}
+	kfree(report);
+	return result;
+}
+
+static int tree_shape_show(struct seq_file *m, void *unused)
+{
+	struct shape_report *r = &shape_last;
+	tree_level level;
+	int i;
+
+	mutex_lock(&shape_guard);
+	if (r->height == 0) {
+		mutex_unlock(&shape_guard);
+		return 0;
+	}
+	seq_printf(m, "dev %s\nheight %u\n", r->dev, r->height);
+	seq_puts(m, "level nodes items fill% fill-histogram\n");
+	for (level = r->height; level >= LEAF_LEVEL; level--) {
+		struct shape_level *l = &r->level[level - 1];
+
+		seq_printf(m, "%u %lu %lu %llu", level, l->nodes, l->items,
+			   div64_u64(l->used * 100,
+				     (u64)(l->nodes ? : 1) * r->blocksize));
+		for (i = 0; i < SHAPE_FILL_BUCKETS; i++)
+			seq_printf(m, " %lu", l->fill[i]);
+		seq_putc(m, '\n');
+	}
+	seq_printf(m, "twig internal %lu extent %lu\n", r->twig_internal,
+		   r->twig_extent);
+	seq_printf(m, "extent allocated %lu unallocated %lu holes %lu "
+		   "blocks %llu fragments %lu\n", r->allocated, r->unallocated,
+		   r->holes, (unsigned long long)r->blocks, r->fragments);
+	for (i = 0; i < SHAPE_RUN_BUCKETS; i++)
+		if (r->run[i] != 0)
+			seq_printf(m, "run %lu %lu\n", 1ul << i, r->run[i]);
+	mutex_unlock(&shape_guard);
+	return 0;
+}
+
+static int tree_shape_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, tree_shape_show, inode->i_private);
+}
+
+static ssize_t tree_shape_write(struct file *file, const char __user *buf,
+				size_t count, loff_t *ppos)
+{
+	struct super_block *super =
+		((struct seq_file *)file->private_data)->private;
+	char cmd[8];
+	int result;
+
+	if (count >= sizeof(cmd))
+		return RETERR(-EINVAL);
+	if (copy_from_user(cmd, buf, count))
+		return RETERR(-EFAULT);
+	cmd[count] = 0;
+	if (strcmp(strim(cmd), "scan"))
+		return RETERR(-EINVAL);
+
+	result = tree_shape_run(super);
+	return result ? result : count;
+}
+
+static const struct file_operations tree_shape_fops = {
+	.owner = THIS_MODULE,
+	.open = tree_shape_open,
+	.read = seq_read,
+	.write = tree_shape_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/**
+ * reiser4_tree_shape_debugfs_init - export report of the tree shape
+ * @super: super block
+ * @root: debugfs directory of the file system
+ */
+void reiser4_tree_shape_debugfs_init(struct super_block *super,
+				     struct dentry *root)
+{
+	debugfs_create_file("tree_shape", S_IFREG | S_IRUSR | S_IWUSR, root,
+			    super, &tree_shape_fops);
+}
+
+/* Make Linus happy.
+   Local variables:
+   c-indentation-style: "K&R"
+   mode-name: "LC"
+   c-basic-offset: 8
+   tab-width: 8
+   fill-column: 120
+   End:
+*/
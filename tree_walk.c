@@ -494,8 +494,89 @@ static int connect_one_side(coord_t * coord, znode * node, int flags)
 	return ret;
 }
 
+/* find in memory the neighbor of @child which @parent_coord's node points to
+   on the side given by @to_left. Returns 1 if @parent_coord is the edge unit
+   of its node on that side, 0 otherwise. *@neighbor is set to the
+   referenced neighbor znode, or to NULL if it is not in memory or is not
+   formatted */
+static int neighbor_in_parent(const coord_t * parent_coord, znode * child,
+			      int to_left, znode ** neighbor)
+{
+	coord_t local;
+	reiser4_block_nr da;
+	znode *side;
+
+	coord_dup_nocheck(&local, parent_coord);
+	if (to_left ? coord_prev_unit(&local) : coord_next_unit(&local))
+		return 1;
+
+	*neighbor = NULL;
+	if (!item_is_internal(&local))
+		return 0;
+	item_plugin_by_coord(&local)->s.internal.down_link(&local, NULL, &da);
+	side = zlook(znode_get_tree(child), &da);
+	if (side == NULL)
+		return 0;
+	if (znode_get_level(side) != znode_get_level(child) || side == child) {
+		warning("", "Sibling nodes on the different levels: %i != %i\n",
+			znode_get_level(child), znode_get_level(side));
+		zput(side);
+		return RETERR(-EIO);
+	}
+	set_child_delimiting_keys(local.node, &local, side);
+	*neighbor = side;
+	return 0;
+}
+
+/* establish sibling links of @child to neighbors which share its parent in
+   one pass. Unlike renew_sibling_link() this neither locks nodes nor walks
+   the parent level, and both sides are linked under one tree lock. Sides on
+   which @child is the edge child of its parent are left to
+   connect_one_side() */
+static int connect_inside_parent(coord_t * parent_coord, znode * child)
+{
+	reiser4_tree *tree = znode_get_tree(child);
+	znode *left = NULL;
+	znode *right = NULL;
+	int link_left = 0;
+	int link_right = 0;
+	int ret;
+
+	if (!znode_is_left_connected(child)) {
+		ret = neighbor_in_parent(parent_coord, child, 1, &left);
+		if (ret < 0)
+			return ret;
+		link_left = !ret;
+	}
+	if (!znode_is_right_connected(child)) {
+		ret = neighbor_in_parent(parent_coord, child, 0, &right);
+		if (ret < 0) {
+			if (left != NULL)
+				zput(left);
+			return ret;
+		}
+		link_right = !ret;
+	}
+	if (link_left || link_right) {
+		write_lock_tree(tree);
+		if (link_left)
+			link_left_and_right(left, child);
+		if (link_right)
+			link_left_and_right(child, right);
+		write_unlock_tree(tree);
+	}
+	if (left != NULL)
+		zput(left);
+	if (right != NULL)
+		zput(right);
+	return 0;
+}
+
 /* if @child is not in `connected' state, performs hash searches for left and
-   right neighbor nodes and establishes horizontal sibling links */
+   right neighbor nodes and establishes horizontal sibling links. Neighbors
+   sharing the parent with @child are linked by connect_inside_parent(), and
+   the parent level is walked only for the sides @child is the edge child
+   of its parent on */
 /* Audited by: umka (2002.06.14), umka (2002.06.15) */
 int connect_znode(coord_t * parent_coord, znode * child)
 {
@@ -530,6 +611,10 @@ int connect_znode(coord_t * parent_coord, znode * child)
 	if (ret != 0)
 		return ret;
 
+	ret = connect_inside_parent(parent_coord, child);
+	if (ret)
+		goto zrelse_and_ret;
+
 	/* protect `connected' state check by tree_lock */
 	read_lock_tree(tree);
 
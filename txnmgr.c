@@ -234,6 +234,7 @@ year old --- define all technical terms used.
 #include "inode.h"
 #include "flush.h"
 #include "discard.h"
+#include "reiser4_trace.h"
 
 #include <asm/atomic.h>
 #include <linux/types.h>
@@ -243,6 +244,10 @@ year old --- define all technical terms used.
 #include <linux/pagemap.h>
 #include <linux/writeback.h>
 #include <linux/swap.h>		/* for totalram_pages */
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/log2.h>
+#include <linux/delay.h>
 
 static void atom_free(txn_atom * atom);
 
@@ -264,6 +269,9 @@ static int capture_fuse_wait(txn_handle *, txn_atom *, txn_atom *, txn_capture);
 
 static void capture_fuse_into(txn_atom * small, txn_atom * large);
 
+static void lock_two_atoms(txn_atom * one, txn_atom * two);
+static void release_two_atoms(txn_atom *one, txn_atom *two);
+
 void reiser4_invalidate_list(struct list_head *);
 
 /* GENERIC STRUCTURES */
@@ -278,12 +286,25 @@ struct _txn_wait_links {
 	int (*waiting_cb) (txn_atom * atom, struct _txn_wait_links * wlinks);
 };
 
+static int wait_for_fusion(txn_atom * atom, txn_wait_links * wlinks);
+
 /* FIXME: In theory, we should be using the slab cache init & destructor
    methods instead of, e.g., jnode_init, etc. */
+/* Atoms are SLAB_TYPESAFE_BY_RCU: rcu protected pointer to an atom obtained
+   from a jnode or a transaction handle can be dereferenced and the atom can
+   be spin locked even if the atom was freed or even reused meanwhile. The
+   pointer is validated by re-checking it under the atom lock (see
+   jnode_get_atom()), so that no reference has to be acquired for that.
+   Therefore atom->alock is initialized by the slab constructor only. */
 static struct kmem_cache *_atom_slab = NULL;
 /* this is for user-visible, cross system-call transactions. */
 static struct kmem_cache *_txnh_slab = NULL;
 
+static void atom_ctor(void *obj)
+{
+	spin_lock_init(&((txn_atom *)obj)->alock);
+}
+
 /**
  * init_txnmgr_static - create transaction manager slab caches
  *
@@ -299,7 +320,8 @@ int init_txnmgr_static(void)
 
 	_atom_slab = kmem_cache_create("txn_atom", sizeof(txn_atom), 0,
 				       SLAB_HWCACHE_ALIGN |
-				       SLAB_RECLAIM_ACCOUNT, NULL);
+				       SLAB_RECLAIM_ACCOUNT |
+				       SLAB_TYPESAFE_BY_RCU, atom_ctor);
 	if (_atom_slab == NULL)
 		return RETERR(-ENOMEM);
 
@@ -331,8 +353,10 @@ void done_txnmgr_static(void)
  *
  * This is called on mount. Makes necessary initializations.
  */
-void reiser4_init_txnmgr(txn_mgr *mgr)
+int reiser4_init_txnmgr(txn_mgr *mgr)
 {
+	int ret;
+
 	assert("umka-169", mgr != NULL);
 
 	mgr->atom_count = 0;
@@ -340,6 +364,32 @@ void reiser4_init_txnmgr(txn_mgr *mgr)
 	INIT_LIST_HEAD(&mgr->atoms_list);
 	spin_lock_init(&mgr->tmgr_lock);
 	mutex_init(&mgr->commit_mutex);
+	mutex_init(&mgr->wb_mutex);
+	mgr->group_atom = NULL;
+	mgr->nr_sync_picks = 0;
+	mgr->commit_bandwidth = 0;
+	atomic_set(&mgr->nr_group_commits, 0);
+	atomic_set(&mgr->nr_group_joined, 0);
+	atomic_set(&mgr->nr_affine_joins, 0);
+	atomic_set(&mgr->nr_throttled, 0);
+	atomic_set(&mgr->nr_copied_on_capture, 0);
+	memset(mgr->lat, 0, sizeof(mgr->lat));
+
+	ret = percpu_counter_init(&mgr->nr_fast_captures, 0, GFP_KERNEL);
+	if (ret)
+		return RETERR(ret);
+	ret = percpu_counter_init(&mgr->nr_slow_captures, 0, GFP_KERNEL);
+	if (ret) {
+		percpu_counter_destroy(&mgr->nr_fast_captures);
+		return RETERR(ret);
+	}
+	ret = percpu_counter_init(&mgr->nr_captured, 0, GFP_KERNEL);
+	if (ret) {
+		percpu_counter_destroy(&mgr->nr_slow_captures);
+		percpu_counter_destroy(&mgr->nr_fast_captures);
+		return RETERR(ret);
+	}
+	return 0;
 }
 
 /**
@@ -353,6 +403,231 @@ void reiser4_done_txnmgr(txn_mgr *mgr)
 	assert("umka-170", mgr != NULL);
 	assert("umka-1701", list_empty_careful(&mgr->atoms_list));
 	assert("umka-1702", mgr->atom_count == 0);
+
+	percpu_counter_destroy(&mgr->nr_fast_captures);
+	percpu_counter_destroy(&mgr->nr_slow_captures);
+	percpu_counter_destroy(&mgr->nr_captured);
+}
+
+static int txnmgr_counter_get(void *data, u64 *val)
+{
+	*val = percpu_counter_sum_positive(data);
+	return 0;
+}
+DEFINE_DEBUGFS_ATTRIBUTE(txnmgr_counter_fops, txnmgr_counter_get, NULL,
+			 "%llu\n");
+
+static const char *txnmgr_lat_names[TXNMGR_LAT_NR] = {
+	[TXNMGR_LAT_ATOM_AGE] = "atom_age",
+	[TXNMGR_LAT_FLUSH] = "jnode_flush",
+	[TXNMGR_LAT_ALLOC_TX] = "alloc_tx",
+	[TXNMGR_LAT_COMMIT_TX] = "commit_tx",
+	[TXNMGR_LAT_WRITE_TX_BACK] = "write_tx_back",
+	[TXNMGR_LAT_FQ_WAIT] = "fq_wait",
+	[TXNMGR_LAT_BARRIER] = "barrier",
+	[TXNMGR_LAT_DISCARD] = "discard",
+	[TXNMGR_LAT_FDATAWRITE] = "fdatawrite",
+	[TXNMGR_LAT_FSYNC] = "fsync",
+	[TXNMGR_LAT_FSYNC_WAIT] = "fsync_wait"
+};
+
+static void lat_hist_add(struct txnmgr_lat_hist *hist, u64 usecs)
+{
+	int idx;
+
+	idx = usecs ? ilog2(usecs) + 1 : 0;
+	if (idx >= TXNMGR_LAT_BUCKETS)
+		idx = TXNMGR_LAT_BUCKETS - 1;
+	atomic_inc(&hist->bucket[idx]);
+}
+
+/**
+ * txnmgr_lat_add - account one latency sample
+ * @mgr: transaction manager
+ * @which: histogram to update
+ * @usecs: sample in microseconds
+ *
+ * If current thread is doing fsync, the sample is added to its phases too.
+ */
+void txnmgr_lat_add(txn_mgr *mgr, txnmgr_lat_t which, u64 usecs)
+{
+	struct super_block *super;
+	reiser4_context *ctx;
+
+	assert("", which < TXNMGR_LAT_NR);
+
+	lat_hist_add(&mgr->lat[which], usecs);
+
+	super = container_of(mgr, reiser4_super_info_data, tmgr)->tree.super;
+	ctx = get_current_context_check();
+	if (ctx != NULL && ctx->fsync_lat != NULL && ctx->super == super)
+		ctx->fsync_lat->us[which] += usecs;
+
+	trace_reiser4_txn_phase(super, txnmgr_lat_names[which], usecs);
+}
+
+/* account time elapsed since @start */
+void txnmgr_lat_since(txn_mgr *mgr, txnmgr_lat_t which, ktime_t start)
+{
+	s64 delta = ktime_us_delta(ktime_get(), start);
+
+	txnmgr_lat_add(mgr, which, delta > 0 ? delta : 0);
+}
+
+/* phases fsync does itself, the rest of its time is TXNMGR_LAT_FSYNC_WAIT.
+   Other phases are either nested into these or are not time of fsync */
+static const txnmgr_lat_t fsync_own_phases[] = {
+	TXNMGR_LAT_FDATAWRITE,
+	TXNMGR_LAT_FLUSH,
+	TXNMGR_LAT_COMMIT_TX,
+	TXNMGR_LAT_WRITE_TX_BACK,
+	TXNMGR_LAT_DISCARD
+};
+
+/**
+ * reiser4_fsync_lat_begin - start accounting phases of fsync
+ * @lat: phases of fsync to fill
+ * @start: when fsync started, before its fdatawrite
+ *
+ * This is called in reiser4 context of fsync, after data of the file are
+ * written by filemap_write_and_wait_range(). If the context is doing an
+ * fsync already, this one is accounted as a part of that.
+ */
+void reiser4_fsync_lat_begin(struct txnmgr_fsync_lat *lat, ktime_t start)
+{
+	reiser4_context *ctx = get_current_context();
+
+	memset(lat, 0, sizeof(*lat));
+	lat->start = start;
+	if (ctx->fsync_lat == NULL)
+		ctx->fsync_lat = lat;
+	txnmgr_lat_since(&get_super_private(ctx->super)->tmgr,
+			 TXNMGR_LAT_FDATAWRITE, start);
+}
+
+/**
+ * reiser4_fsync_lat_end - finish accounting phases of fsync
+ * @lat: phases of fsync started by reiser4_fsync_lat_begin()
+ * @inode: file synced
+ *
+ * Adds phases of fsync to fsync histograms, and logs them if fsync took
+ * longer than tmgr.fsync_slow_ms.
+ */
+void reiser4_fsync_lat_end(struct txnmgr_fsync_lat *lat, struct inode *inode)
+{
+	reiser4_context *ctx = get_current_context();
+	txn_mgr *mgr = &get_super_private(ctx->super)->tmgr;
+	s64 total;
+	u64 own = 0;
+	char buf[256];
+	int len = 0;
+	int i;
+
+	if (ctx->fsync_lat != lat)
+		/* nested fsync */
+		return;
+	ctx->fsync_lat = NULL;
+
+	total = ktime_us_delta(ktime_get(), lat->start);
+	if (total < 0)
+		total = 0;
+	for (i = 0; i < ARRAY_SIZE(fsync_own_phases); i++)
+		own += lat->us[fsync_own_phases[i]];
+	lat->us[TXNMGR_LAT_FSYNC] = total;
+	lat->us[TXNMGR_LAT_FSYNC_WAIT] = (u64)total > own ? total - own : 0;
+	txnmgr_lat_add(mgr, TXNMGR_LAT_FSYNC, lat->us[TXNMGR_LAT_FSYNC]);
+	txnmgr_lat_add(mgr, TXNMGR_LAT_FSYNC_WAIT,
+		       lat->us[TXNMGR_LAT_FSYNC_WAIT]);
+
+	for (i = 0; i < TXNMGR_LAT_NR; i++) {
+		if (lat->us[i] == 0 && i != TXNMGR_LAT_FSYNC)
+			continue;
+		lat_hist_add(&mgr->fsync_lat[i], lat->us[i]);
+		len += scnprintf(buf + len, sizeof(buf) - len, " %s %llu",
+				 txnmgr_lat_names[i], lat->us[i]);
+	}
+	if (mgr->fsync_slow_ms != 0 &&
+	    total >= (s64)mgr->fsync_slow_ms * USEC_PER_MSEC)
+		printk_ratelimited(KERN_WARNING "reiser4: %s: slow fsync of "
+				   "object %llu, usecs:%s\n",
+				   ctx->super->s_id,
+				   (unsigned long long)get_inode_oid(inode),
+				   buf);
+}
+
+/* print non-empty buckets as "<low> <high> <count>", bounds in us */
+static int txnmgr_lat_show(struct seq_file *m, void *unused)
+{
+	struct txnmgr_lat_hist *hist = m->private;
+	int i;
+
+	for (i = 0; i < TXNMGR_LAT_BUCKETS; i++) {
+		int count = atomic_read(&hist->bucket[i]);
+
+		if (count == 0)
+			continue;
+		if (i == 0)
+			seq_printf(m, "0 0 %d\n", count);
+		else if (i == TXNMGR_LAT_BUCKETS - 1)
+			seq_printf(m, "%llu - %d\n", 1ULL << (i - 1), count);
+		else
+			seq_printf(m, "%llu %llu %d\n",
+				   1ULL << (i - 1), (1ULL << i) - 1, count);
+	}
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(txnmgr_lat);
+
+/**
+ * reiser4_txnmgr_debugfs_init - export transaction manager statistics
+ * @mgr: transaction manager
+ * @root: debugfs directory of the file system
+ *
+ * This is called on mount, after the per-super block debugfs directory is
+ * created. Files are removed together with that directory.
+ */
+void reiser4_txnmgr_debugfs_init(txn_mgr *mgr, struct dentry *root)
+{
+	struct dentry *dir;
+	int i;
+
+	debugfs_create_file_unsafe("capture_fast", S_IFREG|S_IRUSR, root,
+				   &mgr->nr_fast_captures,
+				   &txnmgr_counter_fops);
+	debugfs_create_file_unsafe("capture_slow", S_IFREG|S_IRUSR, root,
+				   &mgr->nr_slow_captures,
+				   &txnmgr_counter_fops);
+	debugfs_create_atomic_t("group_commits", S_IFREG|S_IRUSR, root,
+				&mgr->nr_group_commits);
+	debugfs_create_atomic_t("group_commit_joined", S_IFREG|S_IRUSR, root,
+				&mgr->nr_group_joined);
+	debugfs_create_atomic_t("capture_affine", S_IFREG|S_IRUSR, root,
+				&mgr->nr_affine_joins);
+	debugfs_create_file_unsafe("captured", S_IFREG|S_IRUSR, root,
+				   &mgr->nr_captured, &txnmgr_counter_fops);
+	debugfs_create_atomic_t("throttled", S_IFREG|S_IRUSR, root,
+				&mgr->nr_throttled);
+	debugfs_create_atomic_t("copy_on_capture", S_IFREG|S_IRUSR, root,
+				&mgr->nr_copied_on_capture);
+
+	debugfs_create_ulong("commit_bandwidth", S_IFREG|S_IRUSR, root,
+			     &mgr->commit_bandwidth);
+
+	dir = debugfs_create_dir("latency", root);
+	if (IS_ERR_OR_NULL(dir))
+		return;
+	for (i = 0; i < TXNMGR_LAT_NR; i++)
+		debugfs_create_file(txnmgr_lat_names[i], S_IFREG|S_IRUSR, dir,
+				    &mgr->lat[i], &txnmgr_lat_fops);
+
+	debugfs_create_u32("fsync_slow_ms", S_IFREG|S_IRUSR|S_IWUSR, root,
+			   &mgr->fsync_slow_ms);
+	dir = debugfs_create_dir("fsync", dir);
+	if (IS_ERR_OR_NULL(dir))
+		return;
+	for (i = 0; i < TXNMGR_LAT_NR; i++)
+		debugfs_create_file(txnmgr_lat_names[i], S_IFREG|S_IRUSR, dir,
+				    &mgr->fsync_lat[i], &txnmgr_lat_fops);
 }
 
 /* Initialize a transaction handle. */
@@ -386,7 +661,11 @@ static void atom_init(txn_atom * atom)
 
 	assert("umka-173", atom != NULL);
 
-	memset(atom, 0, sizeof(txn_atom));
+	/* ->alock is initialized by atom_ctor() and may be held by somebody
+	   who still looks at the old incarnation of this atom */
+	BUILD_BUG_ON(offsetof(txn_atom, alock) != 0);
+	memset((char *)atom + offsetofend(txn_atom, alock), 0,
+	       sizeof(txn_atom) - offsetofend(txn_atom, alock));
 
 	atom->stage = ASTAGE_FREE;
 	atom->start_time = jiffies;
@@ -398,14 +677,14 @@ static void atom_init(txn_atom * atom)
 	INIT_LIST_HEAD(ATOM_OVRWR_LIST(atom));
 	INIT_LIST_HEAD(ATOM_WB_LIST(atom));
 	INIT_LIST_HEAD(&atom->inodes);
-	spin_lock_init(&(atom->alock));
 	/* list of transaction handles */
 	INIT_LIST_HEAD(&atom->txnh_list);
 	/* link to transaction manager's list of atoms */
 	INIT_LIST_HEAD(&atom->atom_link);
 	INIT_LIST_HEAD(&atom->fwaitfor_list);
 	INIT_LIST_HEAD(&atom->fwaiting_list);
-	blocknr_set_init(&atom->wandered_map);
+	blocknr_tree_init(&atom->wandered_map);
+	blocknr_set_init(&atom->alloc_set);
 
 	atom_dset_init(atom);
 
@@ -515,19 +794,19 @@ static txn_atom *txnh_get_atom(txn_handle * txnh)
 		if (spin_trylock_atom(atom))
 			break;
 
-		atomic_inc(&atom->refcount);
-
+		/* no reference is needed to keep the atom memory valid, see
+		   comment at _atom_slab */
+		rcu_read_lock();
 		spin_unlock_txnh(txnh);
 		spin_lock_atom(atom);
 		spin_lock_txnh(txnh);
+		rcu_read_unlock();
 
-		if (txnh->atom == atom) {
-			atomic_dec(&atom->refcount);
+		if (txnh->atom == atom)
 			break;
-		}
 
 		spin_unlock_txnh(txnh);
-		atom_dec_and_unlock(atom);
+		spin_unlock_atom(atom);
 	}
 
 	return atom;
@@ -574,29 +853,27 @@ txn_atom *jnode_get_atom(jnode * node)
 		if (spin_trylock_atom(atom))
 			break;
 
-		/* At least one jnode belongs to this atom it guarantees that
-		 * atom->refcount > 0, we can safely increment refcount. */
-		atomic_inc(&atom->refcount);
+		/* Atom may be freed as soon as jnode lock is released, but its
+		 * memory stays an atom while we are in rcu read-side section,
+		 * see comment at _atom_slab. So, unlike taking a reference,
+		 * this requires no atom_dec_and_unlock() when node moves to
+		 * another atom meanwhile. */
+		rcu_read_lock();
 		spin_unlock_jnode(node);
 
 		/* re-acquire spin locks in the right order */
 		spin_lock_atom(atom);
 		spin_lock_jnode(node);
+		rcu_read_unlock();
 
 		/* check if node still points to the same atom. */
-		if (node->atom == atom) {
-			atomic_dec(&atom->refcount);
+		if (node->atom == atom)
 			break;
-		}
 
-		/* releasing of atom lock and reference requires not holding
-		 * locks on jnodes.  */
+		/* releasing of atom lock requires not holding locks on
+		 * jnodes. */
 		spin_unlock_jnode(node);
-
-		/* We do not sure that this atom has extra references except our
-		 * one, so we should call proper function which may free atom if
-		 * last reference is released. */
-		atom_dec_and_unlock(atom);
+		spin_unlock_atom(atom);
 
 		/* lock jnode again for getting valid node->atom pointer
 		 * value. */
@@ -613,6 +890,7 @@ int
 same_slum_check(jnode * node, jnode * check, int alloc_check, int alloc_value)
 {
 	int compat;
+	int same;
 	txn_atom *atom;
 
 	assert("umka-182", node != NULL);
@@ -629,14 +907,26 @@ same_slum_check(jnode * node, jnode * check, int alloc_check, int alloc_value)
 	   check->atom) because atom could be locked and being fused at that
 	   moment, jnodes of the atom of that state (being fused) can point to
 	   different objects, but the atom is the same. */
+	/* However, if both nodes point to the same atom they are in the same
+	   atom, and stay so even if the atom is fused meanwhile. The lock on
+	   CHECK keeps its atom alive, so comparing pointers is all the atom
+	   lock is needed for, and it is only taken when they differ. */
 	spin_lock_jnode(check);
 
-	atom = jnode_get_atom(check);
+	same = (check->atom != NULL && READ_ONCE(node->atom) == check->atom);
+	if (!same && check->atom != NULL) {
+		/* pointers may differ while the atoms are being fused */
+		atom = jnode_get_atom(check);
+		if (atom != NULL) {
+			same = (node->atom == atom);
+			spin_unlock_atom(atom);
+		}
+	}
 
-	if (atom == NULL) {
+	if (!same) {
 		compat = 0;
 	} else {
-		compat = (node->atom == atom && JF_ISSET(check, JNODE_DIRTY));
+		compat = JF_ISSET(check, JNODE_DIRTY);
 
 		if (compat && jnode_is_znode(check)) {
 			compat &= znode_is_connected(JZNODE(check));
@@ -645,8 +935,6 @@ same_slum_check(jnode * node, jnode * check, int alloc_check, int alloc_value)
 		if (compat && alloc_check) {
 			compat &= (alloc_value == jnode_is_flushprepped(check));
 		}
-
-		spin_unlock_atom(atom);
 	}
 
 	spin_unlock_jnode(check);
@@ -695,6 +983,7 @@ static int atom_begin_and_assign_to_txnh(txn_atom ** atom_alloc, txn_handle * tx
 {
 	txn_atom *atom;
 	txn_mgr *mgr;
+	int first;
 
 	if (REISER4_DEBUG && rofs_tree(current_tree)) {
 		warning("nikita-3366", "Creating atom on rofs");
@@ -737,14 +1026,18 @@ static int atom_begin_and_assign_to_txnh(txn_atom ** atom_alloc, txn_handle * tx
 	 * lock ordering is broken here. It is ok, as long as @atom is new
 	 * and inaccessible for others. We can't use spin_lock_atom or
 	 * spin_lock(&atom->alock) because they care about locking
-	 * dependencies. spin_trylock_lock doesn't.
+	 * dependencies. spin_trylock_lock doesn't. The trylock may fail only
+	 * for a short while if a stale reader of an rcu protected pointer
+	 * to a freed atom, which the slab handed to us, holds the lock.
 	 */
-	check_me("", spin_trylock_atom(atom));
+	while (!spin_trylock_atom(atom))
+		cpu_relax();
 
 	/* add atom to the end of transaction manager's list of atoms */
 	list_add_tail(&atom->atom_link, &mgr->atoms_list);
 	atom->atom_id = mgr->id_count++;
 	mgr->atom_count += 1;
+	first = (mgr->atom_count == 1);
 
 	/* Release txnmgr lock */
 	spin_unlock_txnmgr(mgr);
@@ -758,6 +1051,9 @@ static int atom_begin_and_assign_to_txnh(txn_atom ** atom_alloc, txn_handle * tx
 	spin_unlock_atom(atom);
 	spin_unlock_txnh(txnh);
 
+	if (first && mgr->daemon != NULL)
+		/* ktxnmgrd sleeps with no timeout when there are no atoms */
+		ktxnmgrd_kick(mgr);
 	return -E_REPEAT;
 }
 
@@ -800,7 +1096,8 @@ static void atom_free(txn_atom * atom)
 	       (atom->stage == ASTAGE_INVALID || atom->stage == ASTAGE_DONE));
 	atom->stage = ASTAGE_FREE;
 
-	blocknr_set_destroy(&atom->wandered_map);
+	blocknr_tree_destroy(&atom->wandered_map);
+	blocknr_set_destroy(&atom->alloc_set);
 
 	atom_dset_destroy(atom);
 
@@ -824,6 +1121,44 @@ static int atom_can_be_committed(txn_atom * atom)
 	return atom->txnh_count == atom->nr_waiters + 1;
 }
 
+/* number of blocks all atoms may pin at commit bandwidth @bw */
+static u64 capture_budget(unsigned long bw)
+{
+	return max_t(u64, (u64)bw * REISER4_THROTTLE_WINDOW / MSEC_PER_SEC,
+		     REISER4_ATOM_MIN_DYNAMIC_SIZE);
+}
+
+/* Return true if an atom pins too much memory. Unlike static atom_max_size
+   limit, it depends on the current amount of free memory and on how fast
+   atoms are written back: an atom should not pin more than a half of free
+   memory, and it should be possible to commit it in
+   REISER4_ATOM_COMMIT_TIME. Otherwise memory pressure overtakes the commit
+   and writers get stuck in direct reclaim. All atoms together should not pin
+   more than the budget of reiser4_throttle_capture(), or the writers it
+   delays would wait for nothing. */
+static int atom_too_big(const txn_atom * atom)
+{
+	txn_mgr *mgr = &get_current_super_private()->tmgr;
+	unsigned long pinned;
+	unsigned long limit;
+	unsigned long bw;
+
+	pinned = atom->capture_count + atom->flush_reserved;
+	if (pinned <= REISER4_ATOM_MIN_DYNAMIC_SIZE)
+		return 0;
+
+	limit = global_zone_page_state(NR_FREE_PAGES) / 2;
+	bw = READ_ONCE(mgr->commit_bandwidth);
+	if (bw != 0) {
+		if (percpu_counter_read_positive(&mgr->nr_captured) >
+		    capture_budget(bw))
+			return 1;
+		limit = min(limit, bw * REISER4_ATOM_COMMIT_TIME / MSEC_PER_SEC);
+	}
+	return pinned > max_t(unsigned long, limit,
+			      REISER4_ATOM_MIN_DYNAMIC_SIZE);
+}
+
 /* Return true if an atom should commit now.  This is determined by aging, atom
    size or atom flags. */
 static int atom_should_commit(const txn_atom * atom)
@@ -833,7 +1168,7 @@ static int atom_should_commit(const txn_atom * atom)
 	    (atom->flags & ATOM_FORCE_COMMIT) ||
 	    ((unsigned)atom_pointer_count(atom) >
 	     get_current_super_private()->tmgr.atom_max_size)
-	    || atom_is_dotard(atom);
+	    || atom_too_big(atom) || atom_is_dotard(atom);
 }
 
 /* return 1 if current atom exists and requires commit. */
@@ -863,7 +1198,47 @@ static int atom_should_commit_asap(const txn_atom * atom)
 	return (pinnedpages > (totalram_pages() >> 3)) || (atom->flushed > 100);
 }
 
-static jnode *find_first_dirty_in_list(struct list_head *head, int flags)
+/**
+ * jnode_slum_id - identify slum a node is likely to belong to
+ * @node: dirty jnode
+ *
+ * Returns a non-zero cookie which is equal for nodes that flush would most
+ * probably process together: formatted nodes with the same parent and
+ * unformatted nodes of the same range of a file. Concurrent flushers of an
+ * atom use it to start in different slums. This is only a hint, parent
+ * pointer is read without tree lock.
+ */
+unsigned long jnode_slum_id(const jnode * node)
+{
+	if (jnode_is_unformatted(node))
+		return (unsigned long)node->key.j.mapping ^
+			(node->key.j.index >> FLUSH_SLUM_SHIFT);
+	if (jnode_is_znode(node) && READ_ONCE(JZNODE(node)->in_parent.node))
+		return (unsigned long)READ_ONCE(JZNODE(node)->in_parent.node);
+	return (unsigned long)node;
+}
+
+/* Return true if flusher other than owner of @fq flushes the slum of @node.
+   Atom is locked. */
+static int slum_is_claimed(txn_atom * atom, flush_queue_t * fq, jnode * node)
+{
+	flush_queue_t *other;
+	unsigned long slum;
+
+	if (atom->nr_flushers < 2)
+		return 0;
+
+	slum = jnode_slum_id(node);
+	list_for_each_entry(other, &atom->flush_queues, alink) {
+		if (other != fq && other->slum == slum)
+			return 1;
+	}
+	return 0;
+}
+
+static jnode *find_first_dirty_in_list(struct list_head *head, int flags,
+				       txn_atom * atom, flush_queue_t * fq,
+				       int *skipped)
 {
 	jnode *first_dirty;
 
@@ -876,21 +1251,28 @@ static jnode *find_first_dirty_in_list(struct list_head *head, int flags)
 			if (JF_ISSET(first_dirty, JNODE_HEARD_BANSHEE) ||
 			    JF_ISSET(first_dirty, JNODE_WRITEBACK))
 				continue;
+			/*
+			 * skip jnodes which are to be flushed from another
+			 * flusher's slum. Already prepped ones are just
+			 * queued, so they are taken as they are.
+			 */
+			if (fq != NULL && !jnode_is_flushprepped(first_dirty) &&
+			    slum_is_claimed(atom, fq, first_dirty)) {
+				*skipped = 1;
+				continue;
+			}
 		}
 		return first_dirty;
 	}
 	return NULL;
 }
 
-/* Get first dirty node from the atom's dirty_nodes[n] lists; return NULL if atom has no dirty
-   nodes on atom's lists */
-jnode *find_first_dirty_jnode(txn_atom * atom, int flags)
+static jnode *find_first_dirty_jnode_in_lists(txn_atom * atom, int flags,
+					      flush_queue_t * fq, int *skipped)
 {
 	jnode *first_dirty;
 	tree_level level;
 
-	assert_spin_locked(&(atom->alock));
-
 	/* The flush starts from LEAF_LEVEL (=1). */
 	for (level = 1; level < REAL_MAX_ZTREE_HEIGHT + 1; level += 1) {
 		if (list_empty_careful(ATOM_DIRTY_LIST(atom, level)))
@@ -898,13 +1280,33 @@ jnode *find_first_dirty_jnode(txn_atom * atom, int flags)
 
 		first_dirty =
 		    find_first_dirty_in_list(ATOM_DIRTY_LIST(atom, level),
-					     flags);
+					     flags, atom, fq, skipped);
 		if (first_dirty)
 			return first_dirty;
 	}
 
 	/* znode-above-root is on the list #0. */
-	return find_first_dirty_in_list(ATOM_DIRTY_LIST(atom, 0), flags);
+	return find_first_dirty_in_list(ATOM_DIRTY_LIST(atom, 0), flags,
+					atom, fq, skipped);
+}
+
+/* Get first dirty node from the atom's dirty_nodes[n] lists; return NULL if atom has no dirty
+   nodes on atom's lists. If @fq is not NULL, nodes from slums other flushers
+   work on are avoided unless there is nothing else to flush. */
+jnode *find_first_dirty_jnode(txn_atom * atom, int flags, flush_queue_t * fq)
+{
+	jnode *first_dirty;
+	int skipped = 0;
+
+	assert_spin_locked(&(atom->alock));
+
+	first_dirty = find_first_dirty_jnode_in_lists(atom, flags, fq,
+						      &skipped);
+	if (first_dirty == NULL && skipped)
+		/* everything left is claimed, rather collide than stall */
+		first_dirty = find_first_dirty_jnode_in_lists(atom, flags,
+							      NULL, &skipped);
+	return first_dirty;
 }
 
 static void dispatch_wb_list(txn_atom * atom, flush_queue_t * fq)
@@ -1004,6 +1406,66 @@ static inline void reiser4_info_atom(const char *prefix, const txn_atom * atom)
 
 #define TOOMANYFLUSHES (1 << 13)
 
+/* Fold a sample of commit bandwidth into the running average used by
+   atom_too_big(). Small commits are dominated by latency rather than by
+   bandwidth and are not accounted. Updates are lockless, a lost one does not
+   matter. */
+static void update_commit_bandwidth(txn_mgr *mgr, unsigned long captured,
+				    ktime_t start)
+{
+	s64 elapsed;
+	unsigned long sample;
+	unsigned long bw;
+
+	if (captured < REISER4_ATOM_MIN_DYNAMIC_SIZE)
+		return;
+	elapsed = ktime_us_delta(ktime_get(), start);
+	if (elapsed <= 0)
+		return;
+	sample = div64_u64((u64)captured * USEC_PER_SEC, elapsed);
+	bw = READ_ONCE(mgr->commit_bandwidth);
+	WRITE_ONCE(mgr->commit_bandwidth,
+		   bw ? (bw * 7 + sample) / 8 : sample);
+}
+
+/**
+ * reiser4_throttle_capture - delay writer when atoms pin too much
+ * @mgr: transaction manager
+ * @nr: number of blocks the writer dirtied since it was last throttled
+ *
+ * Budget of captured blocks is what can be committed in
+ * REISER4_THROTTLE_WINDOW at the commit bandwidth measured on previous
+ * commits. Once atoms pin more than that, atom_too_big() is true for all but
+ * small atoms, ktxnmgrd is kicked to commit them in the background and the
+ * writer sleeps for the time its @nr blocks take to
+ * write out, scaled by how far the budget is exceeded. Writers are thereby
+ * slowed down smoothly to the rate the device sustains, rather than run
+ * free until some atom is too big and its writer has to commit it.
+ */
+void reiser4_throttle_capture(txn_mgr *mgr, unsigned long nr)
+{
+	unsigned long bw = READ_ONCE(mgr->commit_bandwidth);
+	u64 budget;
+	u64 captured;
+	u64 pause;
+
+	if (bw == 0 || nr == 0)
+		return;
+
+	budget = capture_budget(bw);
+	captured = percpu_counter_read_positive(&mgr->nr_captured);
+	if (captured <= budget)
+		return;
+
+	ktxnmgrd_kick(mgr);
+	pause = div64_u64((u64)nr * MSEC_PER_SEC * captured, (u64)bw * budget);
+	pause = min_t(u64, pause, REISER4_THROTTLE_MAX_PAUSE);
+	if (pause == 0)
+		return;
+	atomic_inc(&mgr->nr_throttled);
+	schedule_timeout_killable(msecs_to_jiffies(pause));
+}
+
 /* Called with the atom locked and no open "active" transaction handlers except
    ours, this function calls flush_current_atom() until all dirty nodes are
    processed.  Then it initiates commit processing.
@@ -1018,11 +1480,13 @@ static inline void reiser4_info_atom(const char *prefix, const txn_atom * atom)
 */
 static int commit_current_atom(long *nr_submitted, txn_atom ** atom)
 {
-	reiser4_super_info_data *sbinfo = get_current_super_private();
 	long ret = 0;
 	/* how many times jnode_flush() was called as a part of attempt to
 	 * commit this atom. */
 	int flushiters;
+	/* to estimate commit bandwidth */
+	unsigned long captured;
+	ktime_t start;
 
 	assert("zam-888", atom != NULL && *atom != NULL);
 	assert_spin_locked(&((*atom)->alock));
@@ -1032,6 +1496,7 @@ static int commit_current_atom(long *nr_submitted, txn_atom ** atom)
 	assert("nikita-3184",
 	       get_current_super_private()->delete_mutex_owner != current);
 
+	start = ktime_get();
 	for (flushiters = 0;; ++flushiters) {
 		ret =
 		    flush_current_atom(JNODE_FLUSH_WRITE_BLOCKS |
@@ -1073,6 +1538,11 @@ static int commit_current_atom(long *nr_submitted, txn_atom ** atom)
 	   at this point, commit should be successful. */
 	reiser4_atom_set_stage(*atom, ASTAGE_PRE_COMMIT);
 	ON_DEBUG(((*atom)->committer = current));
+	txnmgr_lat_add(&get_super_private((*atom)->super)->tmgr,
+		       TXNMGR_LAT_ATOM_AGE,
+		       (u64)jiffies_to_msecs(jiffies - (*atom)->start_time) *
+		       USEC_PER_MSEC);
+	captured = (*atom)->capture_count;
 	spin_unlock_atom(*atom);
 
 	ret = current_atom_complete_writes();
@@ -1081,21 +1551,22 @@ static int commit_current_atom(long *nr_submitted, txn_atom ** atom)
 
 	assert("zam-906", list_empty(ATOM_WB_LIST(*atom)));
 
-	/* isolate critical code path which should be executed by only one
-	 * thread using tmgr mutex */
-	mutex_lock(&sbinfo->tmgr.commit_mutex);
-
+	/* reiser4_write_logs() isolates critical code path which should be
+	 * executed by only one thread using tmgr mutexes */
 	ret = reiser4_write_logs(nr_submitted);
 	if (ret < 0)
 		reiser4_panic("zam-597", "write log failed (%ld)\n", ret);
 
-	/* The atom->ovrwr_nodes list is processed under commit mutex held
-	   because of bitmap nodes which are captured by special way in
-	   reiser4_pre_commit_hook_bitmap(), that way does not include
-	   capture_fuse_wait() as a capturing of other nodes does -- the commit
-	   mutex is used for transaction isolation instead. */
+	update_commit_bandwidth(&get_current_super_private()->tmgr,
+				captured, start);
+
+	/* Bitmap nodes which are captured by special way in
+	   reiser4_pre_commit_hook_bitmap(), (that way does not include
+	   capture_fuse_wait() as a capturing of other nodes does) were already
+	   removed from the atom->ovrwr_nodes list by reiser4_write_logs()
+	   under commit mutex. The rest of the list cannot be captured by other
+	   atoms until it is invalidated here. */
 	reiser4_invalidate_list(ATOM_OVRWR_LIST(*atom));
-	mutex_unlock(&sbinfo->tmgr.commit_mutex);
 
 	reiser4_invalidate_list(ATOM_CLEAN_LIST(*atom));
 	reiser4_invalidate_list(ATOM_WB_LIST(*atom));
@@ -1149,7 +1620,7 @@ int force_commit_atom(txn_handle *txnh)
 	 * commit completion
 	 */
 	txnh->flags |= TXNH_WAIT_COMMIT;
-	atom->flags |= ATOM_FORCE_COMMIT;
+	atom->flags |= ATOM_FORCE_COMMIT | ATOM_SYNC_WAITERS;
 
 	spin_unlock_txnh(txnh);
 	spin_unlock_atom(atom);
@@ -1159,6 +1630,305 @@ int force_commit_atom(txn_handle *txnh)
 	return 0;
 }
 
+/* Try to make current atom part of a group commit. If there is no group atom
+   yet, current atom becomes one, and we sleep for the group commit window
+   keeping our transaction handle open, so that the atom cannot be committed
+   until the window expires. Otherwise current atom is fused into the group
+   atom, so that we share its commit.
+
+   Called with nothing locked. This is nothing but an optimization, so all
+   races are resolved by giving up. */
+static void group_commit_join(txn_mgr *mgr, txn_handle *txnh)
+{
+	txn_atom *atom;
+	txn_atom *group;
+
+	spin_lock_txnmgr(mgr);
+	atom = txnh_get_atom(txnh);
+	spin_unlock_txnh(txnh);
+	if (atom == NULL) {
+		spin_unlock_txnmgr(mgr);
+		return;
+	}
+	group = mgr->group_atom;
+	if (group == NULL) {
+		if (atom->stage != ASTAGE_CAPTURE_FUSE) {
+			spin_unlock_atom(atom);
+			spin_unlock_txnmgr(mgr);
+			return;
+		}
+		/* open new group commit window */
+		atomic_inc(&atom->refcount);
+		mgr->group_atom = atom;
+		atomic_inc(&mgr->nr_group_commits);
+		spin_unlock_atom(atom);
+		spin_unlock_txnmgr(mgr);
+
+		usleep_range(mgr->group_commit_window,
+			     mgr->group_commit_window +
+			     mgr->group_commit_window / 4 + 1);
+
+		spin_lock_txnmgr(mgr);
+		assert("", mgr->group_atom == atom);
+		mgr->group_atom = NULL;
+		spin_unlock_txnmgr(mgr);
+
+		spin_lock_atom(atom);
+		atom_dec_and_unlock(atom);
+		return;
+	}
+	if (group == atom || group->stage != ASTAGE_CAPTURE_FUSE ||
+	    atom->stage != ASTAGE_CAPTURE_FUSE) {
+		spin_unlock_atom(atom);
+		spin_unlock_txnmgr(mgr);
+		return;
+	}
+	/* group atom cannot go away while we hold a reference to it, even
+	 * after the window owner drops its one */
+	atomic_inc(&atom->refcount);
+	atomic_inc(&group->refcount);
+	spin_unlock_atom(atom);
+	spin_unlock_txnmgr(mgr);
+
+	lock_two_atoms(atom, group);
+	if (txnh->atom != atom || atom->stage != ASTAGE_CAPTURE_FUSE ||
+	    group->stage != ASTAGE_CAPTURE_FUSE) {
+		release_two_atoms(atom, group);
+		return;
+	}
+	/* both atoms have other references: @atom is referenced by @txnh and
+	 * @group by the transaction handle of the window owner */
+	atomic_dec(&atom->refcount);
+	atomic_dec(&group->refcount);
+	atomic_inc(&mgr->nr_group_joined);
+	capture_fuse_into(atom, group);
+}
+
+/**
+ * fsync_commit_atom - commit current atom on behalf of fsync
+ * @txnh:
+ *
+ * Like force_commit_atom(), but if group commit is enabled by the
+ * tmgr.group_commit_window mount option, lets concurrent fsync callers share
+ * one atom commit, and thereby one journal header and footer update.
+ */
+int fsync_commit_atom(txn_handle *txnh)
+{
+	txn_mgr *mgr = &get_current_super_private()->tmgr;
+	txn_atom *atom;
+
+	if (mgr->group_commit_window == 0)
+		return force_commit_atom(txnh);
+
+	assert("", txnh != NULL);
+	assert_spin_locked(&(txnh->hlock));
+	assert("", lock_stack_isclean(get_current_lock_stack()));
+
+	atom = txnh->atom;
+	assert("", atom != NULL);
+	assert_spin_locked(&(atom->alock));
+
+	txnh->flags |= TXNH_WAIT_COMMIT;
+	atom->flags |= ATOM_FORCE_COMMIT | ATOM_SYNC_WAITERS;
+
+	spin_unlock_txnh(txnh);
+	spin_unlock_atom(atom);
+
+	group_commit_join(mgr, txnh);
+
+	/* commit is here */
+	reiser4_txn_restart_current();
+	return 0;
+}
+
+/**
+ * txnmgr_commit_jnode_atom - commit atom jnode is captured into
+ * @node: referenced jnode
+ *
+ * Commits the atom @node is captured into, if any, or waits until it is
+ * committed when its commit is already in progress. Other atoms are left
+ * alone.
+ */
+int txnmgr_commit_jnode_atom(jnode *node)
+{
+	txn_handle *txnh = get_current_context()->trans;
+	txn_atom *atom;
+
+	assert("", lock_stack_isclean(get_current_lock_stack()));
+
+	reiser4_txn_restart_current();
+	while (1) {
+		spin_lock_jnode(node);
+		atom = jnode_get_atom(node);
+		spin_unlock_jnode(node);
+		if (atom == NULL)
+			return 0;
+		if (atom->stage < ASTAGE_PRE_COMMIT)
+			break;
+		if (atom->stage > ASTAGE_POST_COMMIT) {
+			spin_unlock_atom(atom);
+			return 0;
+		}
+		reiser4_atom_wait_event(atom);
+	}
+	spin_lock_txnh(txnh);
+	capture_assign_txnh_nolock(atom, txnh);
+	return force_commit_atom(txnh);
+}
+
+#define INODE_ATOMS_GANG (16)
+
+/**
+ * txnmgr_commit_inode_atoms - commit atoms holding pages of a file
+ * @inode: inode of the file
+ *
+ * Calls txnmgr_commit_jnode_atom() for each jnode of @inode. As jnodes of
+ * an atom are committed at once, each atom is committed once.
+ */
+int txnmgr_commit_inode_atoms(struct inode *inode)
+{
+	reiser4_inode *info = reiser4_inode_data(inode);
+	reiser4_tree *tree = reiser4_tree_by_inode(inode);
+	unsigned long index = 0;
+	int ret = 0;
+
+	while (ret == 0) {
+		jnode *gang[INODE_ATOMS_GANG];
+		int taken;
+		int i;
+
+		read_lock_tree(tree);
+		taken = radix_tree_gang_lookup(jnode_tree_by_reiser4_inode(info),
+					       (void **)gang, index,
+					       INODE_ATOMS_GANG);
+		for (i = 0; i < taken; ++i)
+			jref(gang[i]);
+		read_unlock_tree(tree);
+		if (taken == 0)
+			break;
+
+		index = index_jnode(gang[taken - 1]) + 1;
+		for (i = 0; i < taken; ++i) {
+			if (ret == 0)
+				ret = txnmgr_commit_jnode_atom(gang[i]);
+			jput(gang[i]);
+		}
+		if (index == 0)
+			break;
+	}
+	return ret;
+}
+
+/* true if txnmgr_force_commit_all() started at @start_time has to commit
+ * @atom. Locking is up to the caller */
+static int atom_should_force(const txn_atom *atom, unsigned long start_time,
+			     int commit_all_atoms)
+{
+	return commit_all_atoms || time_before_eq(atom->start_time, start_time);
+}
+
+/* Force commit of one atom txnmgr_force_commit_all() has to commit and which
+ * is not being forced by anybody else yet. Returns 0 if there is no such atom
+ * left, 1 if an atom was committed.
+ *
+ * The atom is chosen under the txnmgr lock and claimed by setting
+ * ATOM_FORCE_COMMIT under the atom lock, so that several threads calling this
+ * in parallel commit different atoms. Atoms forced by others are left to the
+ * serial loop of txnmgr_force_commit_all() which waits for them. */
+static int force_commit_one_atom(txn_mgr *mgr, unsigned long start_time,
+				 int commit_all_atoms)
+{
+	txn_atom *atom;
+	txn_handle *txnh = get_current_context()->trans;
+
+	spin_lock_txnmgr(mgr);
+	list_for_each_entry(atom, &mgr->atoms_list, atom_link) {
+		spin_lock_atom(atom);
+		if (atom_should_force(atom, start_time, commit_all_atoms) &&
+		    atom->stage < ASTAGE_PRE_COMMIT &&
+		    !(atom->flags & ATOM_FORCE_COMMIT)) {
+			spin_unlock_txnmgr(mgr);
+			spin_lock_txnh(txnh);
+			capture_assign_txnh_nolock(atom, txnh);
+			force_commit_atom(txnh);
+			return 1;
+		}
+		spin_unlock_atom(atom);
+	}
+	spin_unlock_txnmgr(mgr);
+	return 0;
+}
+
+/* helper flushing and committing atoms for txnmgr_force_commit_all() */
+struct sync_worker {
+	struct work_struct work;
+	struct super_block *super;
+	unsigned long start_time;
+	int commit_all_atoms;
+};
+
+static void sync_worker_fn(struct work_struct *work)
+{
+	struct sync_worker *w = container_of(work, struct sync_worker, work);
+	txn_mgr *mgr = &get_super_private(w->super)->tmgr;
+	reiser4_context ctx;
+
+	init_stack_context(&ctx, w->super);
+	while (force_commit_one_atom(mgr, w->start_time, w->commit_all_atoms))
+		;
+	reiser4_exit_context(&ctx);
+}
+
+/* number of atoms txnmgr_force_commit_all() would commit itself */
+static int count_atoms_to_force(txn_mgr *mgr, unsigned long start_time,
+				int commit_all_atoms)
+{
+	txn_atom *atom;
+	int nr = 0;
+
+	spin_lock_txnmgr(mgr);
+	list_for_each_entry(atom, &mgr->atoms_list, atom_link) {
+		spin_lock_atom(atom);
+		if (atom_should_force(atom, start_time, commit_all_atoms) &&
+		    atom->stage < ASTAGE_PRE_COMMIT &&
+		    !(atom->flags & ATOM_FORCE_COMMIT))
+			nr++;
+		spin_unlock_atom(atom);
+	}
+	spin_unlock_txnmgr(mgr);
+	return nr;
+}
+
+/* When there are several atoms to commit, flush them in parallel: up to
+ * REISER4_SYNC_WORKERS work items and the caller pick atoms one by one and
+ * commit them. Flush and waiting for writes of the atoms overlap, while
+ * writing of logs is serialized by the commit mutex, so that journal updates
+ * still go one after another. */
+static void force_commit_parallel(struct super_block *super,
+				  unsigned long start_time, int commit_all_atoms)
+{
+	txn_mgr *mgr = &get_super_private(super)->tmgr;
+	struct sync_worker workers[REISER4_SYNC_WORKERS];
+	int nr;
+	int i;
+
+	nr = min(count_atoms_to_force(mgr, start_time, commit_all_atoms) - 1,
+		 REISER4_SYNC_WORKERS);
+	for (i = 0; i < nr; i++) {
+		INIT_WORK_ONSTACK(&workers[i].work, sync_worker_fn);
+		workers[i].super = super;
+		workers[i].start_time = start_time;
+		workers[i].commit_all_atoms = commit_all_atoms;
+		schedule_work(&workers[i].work);
+	}
+	while (force_commit_one_atom(mgr, start_time, commit_all_atoms))
+		;
+	for (i = 0; i < nr; i++) {
+		flush_work(&workers[i].work);
+		destroy_work_on_stack(&workers[i].work);
+	}
+}
+
 /* Called to force commit of any outstanding atoms.  @commit_all_atoms controls
  * should we commit all atoms including new ones which are created after this
  * functions is called. */
@@ -1180,6 +1950,8 @@ int txnmgr_force_commit_all(struct super_block *super, int commit_all_atoms)
 
 	txnh = ctx->trans;
 
+	force_commit_parallel(super, start_time, commit_all_atoms);
+
       again:
 
 	spin_lock_txnmgr(mgr);
@@ -1190,8 +1962,7 @@ int txnmgr_force_commit_all(struct super_block *super, int commit_all_atoms)
 		/* Commit any atom which can be committed.  If @commit_new_atoms
 		 * is not set we commit only atoms which were created before
 		 * this call is started. */
-		if (commit_all_atoms
-		    || time_before_eq(atom->start_time, start_time)) {
+		if (atom_should_force(atom, start_time, commit_all_atoms)) {
 			if (atom->stage <= ASTAGE_POST_COMMIT) {
 				spin_unlock_txnmgr(mgr);
 
@@ -1238,31 +2009,15 @@ static int atom_is_committable(txn_atom * atom)
 	    atom->txnh_count == atom->nr_waiters && atom_should_commit(atom);
 }
 
-/* called periodically from ktxnmgrd to commit old atoms. Releases ktxnmgrd spin
- * lock at exit */
-int commit_some_atoms(txn_mgr * mgr)
+/* Find committable atom, return it locked. With @sync only atoms with
+   synchronous waiters are considered. Called under tmgr lock. */
+static txn_atom *find_committable_atom(txn_mgr *mgr, int sync)
 {
-	int ret = 0;
 	txn_atom *atom;
-	txn_handle *txnh;
-	reiser4_context *ctx;
-	struct list_head *pos, *tmp;
-
-	ctx = get_current_context();
-	assert("nikita-2444", ctx != NULL);
-
-	txnh = ctx->trans;
-	spin_lock_txnmgr(mgr);
-
-	/*
-	 * this is to avoid gcc complain that atom might be used
-	 * uninitialized
-	 */
-	atom = NULL;
 
-	/* look for atom to commit */
-	list_for_each_safe(pos, tmp, &mgr->atoms_list) {
-		atom = list_entry(pos, txn_atom, atom_link);
+	list_for_each_entry(atom, &mgr->atoms_list, atom_link) {
+		if (sync && !(atom->flags & ATOM_SYNC_WAITERS))
+			continue;
 		/*
 		 * first test without taking atom spin lock, whether it is
 		 * eligible for committing at all
@@ -1270,16 +2025,47 @@ int commit_some_atoms(txn_mgr * mgr)
 		if (atom_is_committable(atom)) {
 			/* now, take spin lock and re-check */
 			spin_lock_atom(atom);
-			if (atom_is_committable(atom))
-				break;
+			if (atom_is_committable(atom) &&
+			    (!sync || (atom->flags & ATOM_SYNC_WAITERS)))
+				return atom;
 			spin_unlock_atom(atom);
 		}
 	}
+	return NULL;
+}
+
+/* called periodically from ktxnmgrd to commit old atoms. Releases ktxnmgrd spin
+ * lock at exit.
+ *
+ * Atoms somebody waits for in fsync or sync are committed first. To keep
+ * background atoms moving, after REISER4_TXNMGR_SYNC_BATCH such picks in a row
+ * the oldest committable atom is taken regardless of waiters. */
+int commit_some_atoms(txn_mgr * mgr)
+{
+	txn_atom *atom;
+	txn_handle *txnh;
+	reiser4_context *ctx;
 
-	ret = (&mgr->atoms_list == pos);
+	ctx = get_current_context();
+	assert("nikita-2444", ctx != NULL);
+
+	txnh = ctx->trans;
+	spin_lock_txnmgr(mgr);
+
+	/* look for atom to commit */
+	atom = NULL;
+	if (mgr->nr_sync_picks < REISER4_TXNMGR_SYNC_BATCH)
+		atom = find_committable_atom(mgr, 1);
+	if (atom == NULL) {
+		atom = find_committable_atom(mgr, 0);
+		mgr->nr_sync_picks = 0;
+	} else if (list_first_entry(&mgr->atoms_list, txn_atom,
+				    atom_link) != atom)
+		/* somebody older may be committable */
+		mgr->nr_sync_picks++;
 	spin_unlock_txnmgr(mgr);
 
-	if (ret) {
+	if (atom == NULL) {
 		/* nothing found */
 		spin_unlock(&mgr->daemon->guard);
 		return 0;
@@ -1287,7 +2073,6 @@ int commit_some_atoms(txn_mgr * mgr)
 
 	spin_lock_txnh(txnh);
 
-	BUG_ON(atom == NULL);
 	/* Set the atom to force committing */
 	atom->flags |= ATOM_FORCE_COMMIT;
 
@@ -1356,6 +2141,25 @@ static int txn_try_to_fuse_small_atom(txn_mgr * tmgr, txn_atom * atom)
 	return 0;
 }
 
+/* Return true if flush_some_atom() may start flushing @atom. Atoms without
+   flushers are preferred, but if tmgr.atom_max_flushers allows, an atom gets
+   concurrent flushers, which start in different slums, see
+   find_first_dirty_jnode(). */
+static int atom_wants_flusher(txn_mgr * tmgr, txn_atom * atom)
+{
+	if (atom->stage >= ASTAGE_PRE_COMMIT)
+		return 0;
+	if (atom->nr_flushers == 0)
+		return 1;
+	/* do not let idle flushers join an atom which is about to be
+	   flushed out by its committer */
+	if (atom->flags & ATOM_FORCE_COMMIT)
+		return 0;
+	return tmgr->atom_max_flushers != 1 &&
+		(tmgr->atom_max_flushers == 0 ||
+		 atom->nr_flushers < tmgr->atom_max_flushers);
+}
+
 /* Calls jnode_flush for current atom if it exists; if not, just take another
    atom and call jnode_flush() for him.  If current transaction handle has
    already assigned atom (current atom) we have to close current transaction
@@ -1383,6 +2187,21 @@ flush_some_atom(jnode * start, long *nr_submitted, const struct writeback_contro
 	BUG_ON(*nr_submitted != 0);
 	assert("zam-1042", txnh != NULL);
 repeat:
+	if (txnh->atom == NULL && start != NULL) {
+		/* prefer the atom flush is asked to start from */
+		spin_lock_jnode(start);
+		atom = jnode_get_atom(start);
+		spin_unlock_jnode(start);
+		if (atom != NULL) {
+			if (atom_wants_flusher(tmgr, atom)) {
+				spin_lock_txnh(txnh);
+				capture_assign_txnh_nolock(atom, txnh);
+				spin_unlock_txnh(txnh);
+				goto assigned;
+			}
+			spin_unlock_atom(atom);
+		}
+	}
 	if (txnh->atom == NULL) {
 		/* current atom is not available, take first from txnmgr */
 		spin_lock_txnmgr(tmgr);
@@ -1394,11 +2213,11 @@ repeat:
 
 			/*
 			 * we need an atom which is not being committed and
-			 * which has no flushers (jnode_flush() add one flusher
-			 * at the beginning and subtract one at the end).
+			 * which can take one more flusher (jnode_flush() add
+			 * one flusher at the beginning and subtract one at the
+			 * end).
 			 */
-			if (atom->stage < ASTAGE_PRE_COMMIT &&
-			    atom->nr_flushers == 0) {
+			if (atom_wants_flusher(tmgr, atom)) {
 				spin_lock_txnh(txnh);
 				capture_assign_txnh_nolock(atom, txnh);
 				spin_unlock_txnh(txnh);
@@ -1417,8 +2236,7 @@ repeat:
 			list_for_each_entry(atom, &tmgr->atoms_list, atom_link) {
 				spin_lock_atom(atom);
 				/* Repeat the check from the above. */
-				if (atom->stage < ASTAGE_PRE_COMMIT
-				    && atom->nr_flushers == 0) {
+				if (atom_wants_flusher(tmgr, atom)) {
 					spin_lock_txnh(txnh);
 					capture_assign_txnh_nolock(atom, txnh);
 					spin_unlock_txnh(txnh);
@@ -1444,7 +2262,7 @@ repeat:
 		spin_unlock_txnmgr(tmgr);
 	} else
 		atom = get_current_atom_locked();
-
+ assigned:
 	BUG_ON(atom->super != ctx->super);
 	assert("vs-35", atom->super == ctx->super);
 	if (start) {
@@ -1745,6 +2563,54 @@ static int commit_txnh(txn_handle * txnh)
 
 /* TRY_CAPTURE */
 
+/* Atom affinity. A handle without an atom capturing a page of a file which
+   is not captured yet would start a new atom. If a neighbouring page of the
+   file is captured by an atom which is still open, the handle joins that
+   atom instead: modification of the extent item and of stat-data of the
+   file would fuse the two soon anyway, and a file written by several
+   threads is not spread over several atoms, which fuse with atoms of other
+   files on the way. Returns 1 if the handle was assigned to an atom. */
+static int capture_join_file_atom(txn_handle *txnh, jnode *node)
+{
+	jnode *neighbour = NULL;
+	txn_atom *atom = NULL;
+	unsigned long index;
+	int joined = 0;
+
+	if (!jnode_is_unformatted(node))
+		return 0;
+
+	index = index_jnode(node);
+	if (index != 0)
+		neighbour = jlookup(jnode_get_tree(node), node->key.j.objectid,
+				    index - 1);
+	if (neighbour == NULL && index != ULONG_MAX)
+		neighbour = jlookup(jnode_get_tree(node), node->key.j.objectid,
+				    index + 1);
+	if (neighbour == NULL)
+		return 0;
+
+	spin_lock_jnode(neighbour);
+	atom = jnode_get_atom(neighbour);
+	spin_unlock_jnode(neighbour);
+	if (atom != NULL) {
+		if (atom->stage == ASTAGE_CAPTURE_FUSE &&
+		    !atom_should_commit(atom)) {
+			spin_lock_txnh(txnh);
+			if (txnh->atom == NULL) {
+				capture_assign_txnh_nolock(atom, txnh);
+				joined = 1;
+			}
+			spin_unlock_txnh(txnh);
+		}
+		spin_unlock_atom(atom);
+	}
+	jput(neighbour);
+	if (joined)
+		atomic_inc(&get_current_super_private()->tmgr.nr_affine_joins);
+	return joined;
+}
+
 /* This routine attempts a single block-capture request.  It may return -E_REPEAT if some
    condition indicates that the request should be retried, and it may block if the
    txn_capture mode does not include the TXN_CAPTURE_NONBLOCKING request flag.
@@ -1812,6 +2678,8 @@ static int try_capture_block(
 		if (block_atom == NULL) {
 			spin_unlock_txnh(txnh);
 			spin_unlock_jnode(node);
+			if (capture_join_file_atom(txnh, node))
+				return RETERR(-E_REPEAT);
 			/* assign empty atom to the txnh and repeat */
 			return atom_begin_and_assign_to_txnh(atom_alloc, txnh);
 		} else {
@@ -1948,6 +2816,39 @@ build_capture_mode(jnode * node, znode_lock_mode lock_mode, txn_capture flags)
 	return cap_mode;
 }
 
+/* Capture fast path: the transaction handle is already bound to an open atom
+   and @node is not captured yet. In this case the only thing to do is to link
+   @node into the handle's atom, and this can be done without txnh spin lock
+   and atom reference games of try_capture_block(): ->atom pointer of our own
+   handle is changed by other threads only during fusion, which is done under
+   the atom lock, so once the atom is trylocked and the handle still points to
+   it, the pointer is stable.
+
+   Called with @node spin locked, returns non-zero, if @node was captured. The
+   jnode lock is held on return in any case. */
+static int try_capture_fast(txn_handle *txnh, jnode *node)
+{
+	txn_atom *atom;
+
+	assert_spin_locked(&(node->guard));
+
+	atom = READ_ONCE(txnh->atom);
+	if (atom == NULL || node->atom != NULL ||
+	    JF_ISSET(node, JNODE_MISSED_IN_CAPTURE))
+		return 0;
+
+	if (!spin_trylock_atom(atom))
+		return 0;
+
+	if (txnh->atom != atom || !atom_isopen(atom)) {
+		spin_unlock_atom(atom);
+		return 0;
+	}
+	capture_assign_block_nolock(atom, node);
+	spin_unlock_atom(atom);
+	return 1;
+}
+
 /* This is an external interface to try_capture_block(), it calls
    try_capture_block() repeatedly as long as -E_REPEAT is returned.
 
@@ -1966,6 +2867,7 @@ int reiser4_try_capture(jnode *node, znode_lock_mode lock_mode,
 	txn_atom *atom_alloc = NULL;
 	txn_capture cap_mode;
 	txn_handle *txnh = get_current_context()->trans;
+	txn_mgr *mgr = &get_current_super_private()->tmgr;
 	int ret;
 
 	assert_spin_locked(&(node->guard));
@@ -1984,6 +2886,13 @@ int reiser4_try_capture(jnode *node, znode_lock_mode lock_mode,
 			JF_SET(node, JNODE_MISSED_IN_CAPTURE);
 		return 0;
 	}
+	if (try_capture_fast(txnh, node)) {
+		percpu_counter_inc(&mgr->nr_fast_captures);
+		if (atom_alloc != NULL)
+			kmem_cache_free(_atom_slab, atom_alloc);
+		return 0;
+	}
+	percpu_counter_inc(&mgr->nr_slow_captures);
 	/* Repeat try_capture as long as -E_REPEAT is returned. */
 	ret = try_capture_block(txnh, node, cap_mode, &atom_alloc);
 	/* Regardless of non_blocking:
@@ -2311,9 +3220,13 @@ static void capture_assign_block_nolock(txn_atom *atom, jnode *node)
 
 	/* Pointer from jnode to atom is not counted in atom->refcount. */
 	node->atom = atom;
+	reiser4_stat_inc(jnode_get_tree(node)->super, REISER4_STAT_CAPTURES);
 
 	list_add_tail(&node->capture_link, ATOM_CLEAN_LIST(atom));
 	atom->capture_count += 1;
+	atom->capture_gen++;
+	percpu_counter_inc(&get_super_private(jnode_get_tree(node)->super)->
+			   tmgr.nr_captured);
 	/* reference to jnode is acquired by atom. */
 	jref(node);
 
@@ -2406,6 +3319,10 @@ void znode_make_dirty(znode * z)
 	assert("nikita-3560", znode_is_write_locked(z));
 
 	node = ZJNODE(z);
+	/* node is going to be modified, its checksum will have to be
+	   recalculated */
+	if (JF_ISSET(node, JNODE_CSUM_SET))
+		JF_CLR(node, JNODE_CSUM_SET);
 	/* znode is longterm locked, we can check dirty bit without spinlock */
 	if (JF_ISSET(node, JNODE_DIRTY)) {
 		/* znode is dirty already. All we have to do is to change znode version */
@@ -2630,6 +3547,21 @@ static void wakeup_atom_waitfor_list(txn_atom * atom)
 	}
 }
 
+/* Return true if somebody sleeps in capture_fuse_wait() waiting to capture a
+   node of @atom. Atom is locked. */
+int atom_has_capture_waiters(txn_atom * atom)
+{
+	txn_wait_links *wlinks;
+
+	assert_spin_locked(&(atom->alock));
+
+	list_for_each_entry(wlinks, &atom->fwaitfor_list, _fwaitfor_link) {
+		if (wlinks->waitfor_cb == wait_for_fusion)
+			return 1;
+	}
+	return 0;
+}
+
 /* Wakeup every handle on the atom's WAITING list */
 static void wakeup_atom_waiting_list(txn_atom * atom)
 {
@@ -2679,6 +3611,7 @@ static int capture_fuse_wait(txn_handle * txnh, txn_atom * atomf,
 {
 	int ret;
 	txn_wait_links wlinks;
+	ktime_t start;
 
 	assert("umka-213", txnh != NULL);
 	assert("umka-214", atomf != NULL);
@@ -2713,6 +3646,7 @@ static int capture_fuse_wait(txn_handle * txnh, txn_atom * atomf,
 	/* Go to sleep. */
 	spin_unlock_txnh(txnh);
 
+	start = ktime_get();
 	ret = reiser4_prepare_to_sleep(wlinks._lock_stack);
 	if (ret == 0) {
 		reiser4_go_to_sleep(wlinks._lock_stack);
@@ -2721,6 +3655,9 @@ static int capture_fuse_wait(txn_handle * txnh, txn_atom * atomf,
 
 	/* Remove from the waitfor list. */
 	spin_lock_atom(atomf);
+	trace_reiser4_capture_wait(atomf->super, atomf->atom_id,
+				   ktime_to_ns(ktime_sub(ktime_get(), start)),
+				   ret);
 
 	list_del(&wlinks._fwaitfor_link);
 	atom_dec_and_unlock(atomf);
@@ -2761,22 +3698,22 @@ static int capture_init_fusion(jnode *node, txn_handle *txnh, txn_capture mode)
 	txn_atom * txnh_atom = txnh->atom;
 	txn_atom * block_atom = node->atom;
 
-	atomic_inc(&txnh_atom->refcount);
-	atomic_inc(&block_atom->refcount);
-
+	/* no references are needed to lock the atoms, see comment at
+	   _atom_slab */
+	rcu_read_lock();
 	spin_unlock_txnh(txnh);
 	spin_unlock_jnode(node);
 
 	lock_two_atoms(txnh_atom, block_atom);
+	rcu_read_unlock();
 
+	/* neither pointer can change while both atoms are locked */
 	if (txnh->atom != txnh_atom || node->atom != block_atom ) {
-		release_two_atoms(txnh_atom, block_atom);
+		spin_unlock_atom(txnh_atom);
+		spin_unlock_atom(block_atom);
 		return RETERR(-E_REPEAT);
 	}
 
-	atomic_dec(&txnh_atom->refcount);
-	atomic_dec(&block_atom->refcount);
-
 	assert ("zam-1066", atom_isopen(txnh_atom));
 
 	if (txnh_atom->stage >= block_atom->stage ||
@@ -2868,6 +3805,8 @@ static void capture_fuse_into(txn_atom * small, txn_atom * large)
 	assert("jmacd-201", atom_isopen(small));
 	assert("jmacd-202", atom_isopen(large));
 
+	reiser4_stat_inc(reiser4_get_current_sb(), REISER4_STAT_FUSIONS);
+
 	/* Splice and update the per-level dirty jnode lists */
 	for (level = 0; level < REAL_MAX_ZTREE_HEIGHT + 1; level += 1) {
 		zcount +=
@@ -2897,6 +3836,9 @@ static void capture_fuse_into(txn_atom * small, txn_atom * large)
 	       zcount + small->num_queued == small->capture_count);
 	assert("jmacd-1065", tcount == small->txnh_count);
 
+	trace_reiser4_atom_fuse(large->super, small->atom_id, large->atom_id,
+				small->capture_count);
+
 	/* sum numbers of waiters threads */
 	large->nr_waiters += small->nr_waiters;
 	small->nr_waiters = 0;
@@ -2927,6 +3869,7 @@ static void capture_fuse_into(txn_atom * small, txn_atom * large)
 	/* Transfer list counts to large. */
 	large->txnh_count += small->txnh_count;
 	large->capture_count += small->capture_count;
+	large->capture_gen++;
 
 	/* Add all txnh references to large. */
 	atomic_add(small->txnh_count, &large->refcount);
@@ -2941,7 +3884,8 @@ static void capture_fuse_into(txn_atom * small, txn_atom * large)
 	large->flags |= small->flags;
 
 	/* Merge blocknr sets. */
-	blocknr_set_merge(&small->wandered_map, &large->wandered_map);
+	blocknr_tree_merge(&small->wandered_map, &large->wandered_map);
+	blocknr_set_merge(&small->alloc_set, &large->alloc_set);
 
 	/* Merge delete sets. */
 	atom_dset_merge(small, large);
@@ -3017,6 +3961,9 @@ void reiser4_uncapture_block(jnode * node)
 		JF_CLR(node, JNODE_FLUSH_QUEUED);
 	}
 	atom->capture_count -= 1;
+	atom->capture_gen++;
+	percpu_counter_dec(&get_super_private(jnode_get_tree(node)->super)->
+			   tmgr.nr_captured);
 	ON_DEBUG(count_jnode(atom, node, NODE_LIST(node), NOT_CAPTURED, 1));
 	node->atom = NULL;
 
@@ -3039,6 +3986,8 @@ void insert_into_atom_ovrwr_list(txn_atom * atom, jnode * node)
 	jref(node);
 	node->atom = atom;
 	atom->capture_count++;
+	percpu_counter_inc(&get_super_private(jnode_get_tree(node)->super)->
+			   tmgr.nr_captured);
 	ON_DEBUG(count_jnode(atom, node, NODE_LIST(node), OVRWR_LIST, 1));
 }
 
@@ -3077,12 +4026,86 @@ reiser4_block_nr txnmgr_count_deleted_blocks(void)
 	return result;
 }
 
+/* number of blocks commit of @atom gives back to free space: blocks reserved
+ * for its flush and blocks of its delete set. Locking is up to the caller */
+static reiser4_block_nr atom_reclaimable(txn_atom *atom)
+{
+	reiser4_block_nr nr = atom->flush_reserved;
+
+	atom_dset_deferred_apply(atom, count_deleted_blocks_actor, &nr, 0);
+	return nr;
+}
+
+/**
+ * txnmgr_reclaim_space - commit atoms to get free space back
+ * @super: super block
+ * @count: number of blocks wanted
+ *
+ * Called when grabbing of @count blocks failed. Rather than committing all
+ * atoms, commit the atom which gives most space back (see
+ * atom_reclaimable()), then the next one, until the committed atoms are
+ * estimated to give @count blocks back. Atoms which give nothing back, and
+ * atoms being committed by others already, are not waited for. Returns 0 if
+ * enough space is estimated to be reclaimed, -ENOSPC otherwise.
+ */
+int txnmgr_reclaim_space(struct super_block *super, __u64 count)
+{
+	txn_mgr *mgr = &get_super_private(super)->tmgr;
+	txn_handle *txnh = get_current_context()->trans;
+	reiser4_block_nr reclaimed = 0;
+
+	assert("", lock_stack_isclean(get_current_lock_stack()));
+	assert("", reiser4_commit_check_locks());
+
+	reiser4_txn_restart_current();
+
+	while (reclaimed < count) {
+		txn_atom *atom;
+		txn_atom *best = NULL;
+		reiser4_block_nr best_nr = 0;
+
+		spin_lock_txnmgr(mgr);
+		list_for_each_entry(atom, &mgr->atoms_list, atom_link) {
+			reiser4_block_nr nr;
+
+			spin_lock_atom(atom);
+			if (atom->stage < ASTAGE_PRE_COMMIT &&
+			    !(atom->flags & ATOM_FORCE_COMMIT)) {
+				nr = atom_reclaimable(atom);
+				if (nr > best_nr) {
+					best = atom;
+					best_nr = nr;
+				}
+			}
+			spin_unlock_atom(atom);
+		}
+		if (best == NULL) {
+			spin_unlock_txnmgr(mgr);
+			return RETERR(-ENOSPC);
+		}
+		/* atoms leave the list under txnmgr lock, so @best is alive,
+		 * but it could start commit meanwhile */
+		spin_lock_atom(best);
+		spin_unlock_txnmgr(mgr);
+		if (best->stage >= ASTAGE_PRE_COMMIT ||
+		    (best->flags & ATOM_FORCE_COMMIT)) {
+			spin_unlock_atom(best);
+			continue;
+		}
+		spin_lock_txnh(txnh);
+		capture_assign_txnh_nolock(best, txnh);
+		force_commit_atom(txnh);
+		reclaimed += best_nr;
+	}
+	return 0;
+}
+
 void atom_dset_init(txn_atom *atom)
 {
 	if (reiser4_is_set(reiser4_get_current_sb(), REISER4_DISCARD)) {
 		blocknr_list_init(&atom->discard.delete_set);
 	} else {
-		blocknr_set_init(&atom->nodiscard.delete_set);
+		blocknr_tree_init(&atom->nodiscard.delete_set);
 	}
 }
 
@@ -3091,7 +4114,7 @@ void atom_dset_destroy(txn_atom *atom)
 	if (reiser4_is_set(reiser4_get_current_sb(), REISER4_DISCARD)) {
 		blocknr_list_destroy(&atom->discard.delete_set);
 	} else {
-		blocknr_set_destroy(&atom->nodiscard.delete_set);
+		blocknr_tree_destroy(&atom->nodiscard.delete_set);
 	}
 }
 
@@ -3100,7 +4123,7 @@ void atom_dset_merge(txn_atom *from, txn_atom *to)
 	if (reiser4_is_set(reiser4_get_current_sb(), REISER4_DISCARD)) {
 		blocknr_list_merge(&from->discard.delete_set, &to->discard.delete_set);
 	} else {
-		blocknr_set_merge(&from->nodiscard.delete_set, &to->nodiscard.delete_set);
+		blocknr_tree_merge(&from->nodiscard.delete_set, &to->nodiscard.delete_set);
 	}
 }
 
@@ -3118,7 +4141,7 @@ int atom_dset_deferred_apply(txn_atom* atom,
 		                            data,
 		                            delete);
 	} else {
-		ret = blocknr_set_iterator(atom,
+		ret = blocknr_tree_iterator(atom,
 		                           &atom->nodiscard.delete_set,
 		                           actor,
 		                           data,
@@ -3142,9 +4165,9 @@ extern int atom_dset_deferred_add_extent(txn_atom *atom,
 		                              start,
 		                              len);
 	} else {
-		ret = blocknr_set_add_extent(atom,
+		ret = blocknr_tree_add_extent(atom,
 		                             &atom->nodiscard.delete_set,
-		                             (blocknr_set_entry**)new_entry,
+		                             (blocknr_tree_entry**)new_entry,
 		                             start,
 		                             len);
 	}
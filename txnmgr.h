@@ -14,8 +14,11 @@
 #include <linux/mm.h>
 #include <linux/types.h>
 #include <linux/spinlock.h>
+#include <linux/rbtree.h>
 #include <asm/atomic.h>
 #include <linux/wait.h>
+#include <linux/percpu_counter.h>
+#include <linux/ktime.h>
 
 /* TYPE DECLARATIONS */
 
@@ -113,7 +116,10 @@ typedef enum {
 	ATOM_FORCE_COMMIT = (1 << 0),
 	/* to avoid endless loop, mark the atom (which was considered as too
 	 * small) after failed attempt to fuse it. */
-	ATOM_CANCEL_FUSION = (1 << 1)
+	ATOM_CANCEL_FUSION = (1 << 1),
+	/* somebody (fsync, sync) waits for commit of this atom, so it is
+	 * committed ahead of background ones. See commit_some_atoms(). */
+	ATOM_SYNC_WAITERS = (1 << 2)
 } txn_flags;
 
 /* Flags for controlling commit_txnh */
@@ -246,13 +252,13 @@ struct txn_atom {
 	unsigned long start_time;
 
 	/* The atom's delete sets.
-	   "simple" are blocknr_set instances and are used when discard is disabled.
+	   "simple" are blocknr_tree instances and are used when discard is disabled.
 	   "discard" are blocknr_list instances and are used when discard is enabled. */
 	union {
 		struct {
 		/* The atom's delete set. It collects block numbers of the nodes
 		   which were deleted during the transaction. */
-			struct list_head delete_set;
+			struct rb_root delete_set;
 		} nodiscard;
 
 		struct {
@@ -265,7 +271,12 @@ struct txn_atom {
 	};
 
 	/* The atom's wandered_block mapping. */
-	struct list_head wandered_map;
+	struct rb_root wandered_map;
+
+	/* Blocks allocated during the transaction to unformatted nodes which
+	   have no jnodes (see reiser4_record_allocated()). The pre-commit hook
+	   marks them used in COMMIT BITMAP. */
+	struct list_head alloc_set;
 
 	/* The transaction's list of dirty captured nodes--per level.  Index
 	   by (level). dirty_nodes[0] is for znode-above-root */
@@ -320,6 +331,18 @@ struct txn_atom {
 	/* A counter of grabbed unformatted nodes, see a description of the
 	 * reiser4 space reservation scheme at block_alloc.c */
 	reiser4_block_nr flush_reserved;
+	/* bumped whenever a node enters or leaves this atom. Invalidates
+	   @flush_scan, see flush_scan_cache_lookup() in flush.c */
+	unsigned long capture_gen;
+	/* result of the last flush scan over this atom, reused when the next
+	   jnode_flush() starts from the same node */
+	struct {
+		jnode *start;
+		jnode *leftmost;
+		unsigned left_count;
+		unsigned right_count;
+		unsigned long gen;
+	} flush_scan;
 #if REISER4_DEBUG
 	void *committer;
 #endif
@@ -358,6 +381,53 @@ struct txn_handle {
 	struct list_head txnh_link;
 };
 
+/* Latencies tracked by transaction manager. Each one is kept as a log2
+   histogram of microseconds and is exported through debugfs. See
+   reiser4_txnmgr_debugfs_init(). */
+typedef enum {
+	/* time from atom creation to the beginning of its commit */
+	TXNMGR_LAT_ATOM_AGE,
+	/* duration of one jnode_flush() call */
+	TXNMGR_LAT_FLUSH,
+	/* allocation and submission of wandered blocks and tx records */
+	TXNMGR_LAT_ALLOC_TX,
+	/* commit_tx(): alloc_tx phase, i/o wait and journal header update */
+	TXNMGR_LAT_COMMIT_TX,
+	/* write_tx_back(): in-place write, i/o wait and journal footer update */
+	TXNMGR_LAT_WRITE_TX_BACK,
+	/* waiting for i/o in current_atom_finish_all_fq() */
+	TXNMGR_LAT_FQ_WAIT,
+	/* journal header or footer write, with cache flush */
+	TXNMGR_LAT_BARRIER,
+	/* reiser4_post_write_back_hook(): queueing of delete set for discard
+	   and deferred deallocation */
+	TXNMGR_LAT_DISCARD,
+	/* filemap_write_and_wait_range() of fsync */
+	TXNMGR_LAT_FDATAWRITE,
+	/* whole fsync of regular file */
+	TXNMGR_LAT_FSYNC,
+	/* part of fsync not spent in fdatawrite, jnode_flush, commit_tx,
+	   write_tx_back and discard phases of its own: waiting for atom
+	   fusion, group commit window, commit done by other thread */
+	TXNMGR_LAT_FSYNC_WAIT,
+	TXNMGR_LAT_NR
+} txnmgr_lat_t;
+
+/* bucket 0 counts zero, bucket N > 0 counts [2^(N-1), 2^N) us, the last one
+   also counts everything above */
+#define TXNMGR_LAT_BUCKETS (32)
+
+struct txnmgr_lat_hist {
+	atomic_t bucket[TXNMGR_LAT_BUCKETS];
+};
+
+/* phases of one fsync. Latencies accounted by the fsync caller while its
+   context points here are added to ->us, see reiser4_fsync_lat_begin() */
+struct txnmgr_fsync_lat {
+	ktime_t start;
+	u64 us[TXNMGR_LAT_NR];
+};
+
 /* The transaction manager: one is contained in the reiser4_super_info_data */
 struct txn_mgr {
 	/* A spinlock protecting the atom list, id_count, flush_control */
@@ -375,6 +445,12 @@ struct txn_mgr {
 	/* a mutex object for commit serialization */
 	struct mutex commit_mutex;
 
+	/* a mutex serializing write-back of overwrite sets and journal footer
+	   updates. It is taken by committing atom before commit_mutex is
+	   released, so atoms are written back in the order they commit. See
+	   reiser4_write_logs(). */
+	struct mutex wb_mutex;
+
 	/* a list of all txnmrgs served by particular daemon. */
 	struct list_head linkage;
 
@@ -387,8 +463,55 @@ struct txn_mgr {
 	unsigned int atom_min_size;
 	/* max number of concurrent flushers for one atom, 0 - unlimited.  */
 	unsigned int atom_max_flushers;
+	/* group commit window in microseconds, 0 - no group commit. See
+	   fsync_commit_atom(). */
+	unsigned int group_commit_window;
+	/* max number of overwrite set blocks under in-place write at a time,
+	   0 - unlimited. See write_tx_back(). */
+	unsigned int writeback_depth;
+	/* number of atoms with synchronous waiters which commit_some_atoms()
+	   picked in a row while there was committable atom without ones.
+	   Protected by daemon->guard. */
+	unsigned int nr_sync_picks;
+	/* write-back bandwidth in blocks per second, averaged over recent
+	   commits, 0 if not measured yet. See commit_current_atom(). */
+	unsigned long commit_bandwidth;
 	struct dentry *debugfs_atom_count;
 	struct dentry *debugfs_id_count;
+
+	/* capture statistics: number of reiser4_try_capture() calls that
+	   were satisfied without taking the txnh spin lock (see
+	   try_capture_fast()) and number of ones that went through
+	   try_capture_block(). */
+	struct percpu_counter nr_fast_captures;
+	struct percpu_counter nr_slow_captures;
+
+	/* atom which collects fsync callers during group commit window,
+	   protected by tmgr_lock. It holds a reference to the atom. */
+	txn_atom *group_atom;
+	/* number of group commits and number of fsync callers which joined
+	   them. Their ratio plus one is the average group commit batch. */
+	atomic_t nr_group_commits;
+	atomic_t nr_group_joined;
+	/* number of handles which joined the atom of the file they capture a
+	   page of instead of starting a new one, see
+	   capture_join_file_atom() */
+	atomic_t nr_affine_joins;
+	/* number of blocks captured by all atoms, and number of times
+	   writers were delayed because of it, see reiser4_throttle_capture() */
+	struct percpu_counter nr_captured;
+	atomic_t nr_throttled;
+	/* number of overwrite set nodes released early by copy-on-capture,
+	   see copy_on_capture() in wander.c */
+	atomic_t nr_copied_on_capture;
+
+	/* latency histograms, indexed by txnmgr_lat_t */
+	struct txnmgr_lat_hist lat[TXNMGR_LAT_NR];
+	/* the same, but of phases done by fsync callers only */
+	struct txnmgr_lat_hist fsync_lat[TXNMGR_LAT_NR];
+	/* fsync taking longer than that many milliseconds is logged with
+	   its phases, 0 disables logging */
+	unsigned int fsync_slow_ms;
 };
 
 /* FUNCTION DECLARATIONS */
@@ -399,8 +522,14 @@ struct txn_mgr {
 extern int init_txnmgr_static(void);
 extern void done_txnmgr_static(void);
 
-extern void reiser4_init_txnmgr(txn_mgr *);
+extern int reiser4_init_txnmgr(txn_mgr *);
 extern void reiser4_done_txnmgr(txn_mgr *);
+extern void reiser4_txnmgr_debugfs_init(txn_mgr *, struct dentry *);
+extern void txnmgr_lat_add(txn_mgr *, txnmgr_lat_t, u64 usecs);
+extern void txnmgr_lat_since(txn_mgr *, txnmgr_lat_t, ktime_t start);
+extern void reiser4_fsync_lat_begin(struct txnmgr_fsync_lat *, ktime_t start);
+extern void reiser4_fsync_lat_end(struct txnmgr_fsync_lat *,
+				  struct inode *);
 
 extern int reiser4_txn_reserve(int reserved);
 
@@ -411,12 +540,18 @@ extern void reiser4_txn_restart(reiser4_context * context);
 extern void reiser4_txn_restart_current(void);
 
 extern int txnmgr_force_commit_all(struct super_block *, int);
+extern int txnmgr_reclaim_space(struct super_block *, __u64 count);
 extern int current_atom_should_commit(void);
 
-extern jnode *find_first_dirty_jnode(txn_atom *, int);
+extern jnode *find_first_dirty_jnode(txn_atom *, int, struct flush_queue *);
+extern unsigned long jnode_slum_id(const jnode *);
 
 extern int commit_some_atoms(txn_mgr *);
 extern int force_commit_atom(txn_handle *);
+extern int fsync_commit_atom(txn_handle *);
+extern int txnmgr_commit_jnode_atom(jnode *);
+extern void reiser4_throttle_capture(txn_mgr *, unsigned long);
+extern int txnmgr_commit_inode_atoms(struct inode *);
 extern int flush_current_atom(int, long, long *, txn_atom **, jnode *);
 
 extern int flush_some_atom(jnode *, long *, const struct writeback_control *, int);
@@ -426,6 +561,7 @@ extern void reiser4_atom_set_stage(txn_atom * atom, txn_stage stage);
 extern int same_slum_check(jnode * base, jnode * check, int alloc_check,
 			   int alloc_value);
 extern void atom_dec_and_unlock(txn_atom * atom);
+extern int atom_has_capture_waiters(txn_atom * atom);
 
 extern int reiser4_try_capture(jnode * node, znode_lock_mode mode, txn_capture flags);
 extern int try_capture_page_to_invalidate(struct page *pg);
@@ -502,6 +638,25 @@ extern int blocknr_set_iterator(txn_atom * atom, struct list_head * bset,
 				blocknr_set_actor_f actor, void *data,
 				int delete);
 
+/* This is the block tree interface (see blocknrtree.c). The calling
+   convention of the add routines is that of blocknr_set_add */
+extern int blocknr_tree_init_static(void);
+extern void blocknr_tree_done_static(void);
+extern void blocknr_tree_init(struct rb_root *root);
+extern void blocknr_tree_destroy(struct rb_root *root);
+extern void blocknr_tree_merge(struct rb_root *from, struct rb_root *into);
+extern int blocknr_tree_add_extent(txn_atom *atom, struct rb_root *root,
+				   blocknr_tree_entry **new_entry,
+				   const reiser4_block_nr *start,
+				   const reiser4_block_nr *len);
+extern int blocknr_tree_add_pair(txn_atom *atom, struct rb_root *root,
+				 blocknr_tree_entry **new_entry,
+				 const reiser4_block_nr *a,
+				 const reiser4_block_nr *b);
+extern int blocknr_tree_iterator(txn_atom *atom, struct rb_root *root,
+				 blocknr_set_actor_f actor, void *data,
+				 int delete);
+
 /* This is the block list interface (see blocknrlist.c) */
 extern int blocknr_list_init_static(void);
 extern void blocknr_list_done_static(void);
@@ -509,6 +664,8 @@ extern void blocknr_list_init(struct list_head *blist);
 extern void blocknr_list_destroy(struct list_head *blist);
 extern void blocknr_list_merge(struct list_head *from, struct list_head *to);
 extern void blocknr_list_sort_and_join(struct list_head *blist);
+extern int blocknr_list_pop(struct list_head *blist, reiser4_block_nr *start,
+			    reiser4_block_nr *len);
 /**
  * The @atom should be locked.
  */
@@ -525,8 +682,8 @@ extern int blocknr_list_iterator(txn_atom *atom,
 
 /* These are wrappers for accessing and modifying atom's delete lists,
    depending on whether discard is enabled or not.
-   If it is enabled, (less memory efficient) blocknr_list is used for delete
-   list storage. Otherwise, blocknr_set is used for this purpose. */
+   If it is enabled, blocknr_list is used for delete list storage. Otherwise,
+   blocknr_tree is used for this purpose. */
 extern void atom_dset_init(txn_atom *atom);
 extern void atom_dset_destroy(txn_atom *atom);
 extern void atom_dset_merge(txn_atom *from, txn_atom *to);
@@ -709,6 +866,12 @@ struct flush_queue {
 	txn_atom *atom;
 	/* A wait queue head to wait on i/o completion */
 	wait_queue_head_t wait;
+	/* slum the owner of this fq flushes, 0 if none. Protected by atom
+	   lock. See jnode_slum_id() */
+	unsigned long slum;
+	/* when the last batch of this fq was submitted, for the write
+	   congestion controller */
+	ktime_t submit_time;
 #if REISER4_DEBUG
 	/* A thread which took this fq in exclusive use, NULL if fq is free,
 	 * used for debugging. */
@@ -10,6 +10,19 @@
 #include "debug.h"
 
 #include <asm/errno.h>
+#include <linux/seqlock.h>
+#include <linux/atomic.h>
+
+/* chain length statistics of a hash table, see prefix_hash_stat() */
+struct hash_chain_stat {
+	__u32 items;
+	__u32 buckets;
+	/* number of non-empty buckets */
+	__u32 used;
+	/* length of the longest chain */
+	__u32 longest;
+};
+
 /* Step 1: Use TYPE_SAFE_HASH_DECLARE() to define the TABLE and LINK objects
    based on the object type.  You need to declare the item type before
    this definition, define it after this definition. */
@@ -22,6 +35,11 @@ struct PREFIX##_hash_table_
 {                                                                                             \
   ITEM_TYPE  **_table;                                                                        \
   __u32        _buckets;                                                                      \
+  /* number of items in the table. Atomic, as chains of different buckets can be             \
+     changed concurrently under locks of their own */                                         \
+  atomic_t     _count;                                                                        \
+  /* odd while prefix_hash_rehash() moves items to a new bucket array */                      \
+  seqcount_t   _seq;                                                                          \
 };                                                                                            \
                                                                                               \
 struct PREFIX##_hash_link_                                                                    \
@@ -51,6 +69,10 @@ struct PREFIX##_hash_link_
    prefix_hash_find_index     Find an item w/ precomputed hash_index
    prefix_hash_remove         Remove an item, returns 1 if found, 0 if not found
    prefix_hash_remove_index   Remove an item w/ precomputed hash_index
+   prefix_hash_find_rcu       Find an item by key without the writer lock, see below
+   prefix_hash_rehash         Move all items to a larger bucket array
+   prefix_hash_overloaded     Check whether average chain is longer than given limit
+   prefix_hash_stat           Collect chain length statistics
 
    If you'd like something to be done differently, feel free to ask me
    for modifications.  Additional features that could be added but
@@ -73,6 +95,16 @@ struct PREFIX##_hash_link_
    The circularly-linked approach has the shortest code but requires
    two pointers per bucket, doubling the size of the bucket array (in
    addition to two pointers per item).
+
+   Tables can grow. Modifications of the table (insertions, removals and
+   prefix_hash_rehash()) are serialized by a lock of the user. Lookups done
+   under rcu_read_lock() only must use prefix_hash_find_rcu(): the hash
+   function is called with the table whose bucket array may be replaced
+   concurrently, so it must read hash->_buckets exactly once (READ_ONCE()),
+   and a miss is retried if a rehash was in progress. Old bucket array
+   returned by prefix_hash_rehash() may be freed only after an RCU grace
+   period. Tables never shrink: only a larger array can be installed, so a
+   reader which uses a stale bucket count never indexes beyond the array.
 */
 #define TYPE_SAFE_HASH_DEFINE(PREFIX,ITEM_TYPE,KEY_TYPE,KEY_NAME,LINK_NAME,HASH_FUNC,EQ_FUNC)	\
 											\
@@ -89,6 +121,8 @@ PREFIX##_hash_init (PREFIX##_hash_table *hash,						\
 {											\
   hash->_table   = (ITEM_TYPE**) KMALLOC (sizeof (ITEM_TYPE*) * buckets);		\
   hash->_buckets = buckets;								\
+  atomic_set(&hash->_count, 0);							\
+  seqcount_init(&hash->_seq);								\
   if (hash->_table == NULL)								\
     {											\
       return RETERR(-ENOMEM);								\
@@ -186,6 +220,7 @@ PREFIX##_hash_remove_index (PREFIX##_hash_table *hash,					\
     prefetch(&(*hash_item_p)->LINK_NAME._next);						\
     if (*hash_item_p == del_item) {                                                     \
       *hash_item_p = (*hash_item_p)->LINK_NAME._next;                                   \
+      atomic_dec(&hash->_count);							\
       return 1;                                                                         \
     }                                                                                   \
     hash_item_p = &(*hash_item_p)->LINK_NAME._next;                                     \
@@ -202,6 +237,7 @@ PREFIX##_hash_insert_index (PREFIX##_hash_table *hash,					\
 											\
   ins_item->LINK_NAME._next = hash->_table[hash_index];					\
   hash->_table[hash_index]  = ins_item;							\
+  atomic_inc(&hash->_count);							\
 }											\
 											\
 static __inline__ void									\
@@ -214,6 +250,7 @@ PREFIX##_hash_insert_index_rcu (PREFIX##_hash_table *hash,				\
   ins_item->LINK_NAME._next = hash->_table[hash_index];					\
   smp_wmb();    									\
   hash->_table[hash_index]  = ins_item;							\
+  atomic_inc(&hash->_count);							\
 }											\
 											\
 static __inline__ ITEM_TYPE*								\
@@ -288,6 +325,82 @@ PREFIX##_hash_next (PREFIX##_hash_table *hash,						\
   return next;										\
 }											\
 											\
+static __inline__ ITEM_TYPE*								\
+PREFIX##_hash_find_rcu (PREFIX##_hash_table *hash,					\
+		        KEY_TYPE const      *find_key)					\
+{											\
+  ITEM_TYPE *item;									\
+  __u32      hash_index;								\
+  unsigned   seq;									\
+											\
+  do {											\
+    seq = read_seqcount_begin(&hash->_seq);						\
+    hash_index = HASH_FUNC(hash, find_key);						\
+    /* pairs with smp_wmb() in prefix_hash_rehash() */					\
+    smp_rmb();										\
+    item = PREFIX##_hash_find_index (hash, hash_index, find_key);			\
+  } while (item == NULL && read_seqcount_retry(&hash->_seq, seq));			\
+  return item;										\
+}											\
+											\
+static __inline__ ITEM_TYPE**								\
+PREFIX##_hash_rehash (PREFIX##_hash_table *hash,					\
+		      ITEM_TYPE          **new_table,					\
+		      __u32                new_buckets)					\
+{											\
+  ITEM_TYPE **old_table = hash->_table;							\
+  __u32       old_buckets = hash->_buckets;						\
+  __u32       i;									\
+											\
+  assert("", new_buckets > old_buckets);						\
+											\
+  write_seqcount_begin(&hash->_seq);							\
+  /* array first: a reader seeing the new size sees the new array */			\
+  WRITE_ONCE(hash->_table, new_table);							\
+  smp_wmb();										\
+  WRITE_ONCE(hash->_buckets, new_buckets);						\
+  for (i = 0; i < old_buckets; ++ i) {							\
+    ITEM_TYPE *item;									\
+											\
+    while ((item = old_table[i]) != NULL) {						\
+      __u32 hash_index = HASH_FUNC(hash, &item->KEY_NAME);				\
+											\
+      old_table[i] = item->LINK_NAME._next;						\
+      item->LINK_NAME._next = new_table[hash_index];					\
+      new_table[hash_index] = item;							\
+    }											\
+  }											\
+  write_seqcount_end(&hash->_seq);							\
+  return old_table;									\
+}											\
+											\
+static __inline__ int									\
+PREFIX##_hash_overloaded (PREFIX##_hash_table *hash, __u32 max_load)			\
+{											\
+  return atomic_read(&hash->_count) > hash->_buckets * max_load;			\
+}											\
+											\
+static __inline__ void									\
+PREFIX##_hash_stat (PREFIX##_hash_table *hash, struct hash_chain_stat *stat)		\
+{											\
+  __u32 i;										\
+											\
+  memset(stat, 0, sizeof *stat);							\
+  stat->items = atomic_read(&hash->_count);						\
+  stat->buckets = hash->_buckets;							\
+  for (i = 0; i < hash->_buckets; ++ i) {						\
+    ITEM_TYPE *item;									\
+    __u32      len = 0;									\
+											\
+    for (item = hash->_table[i]; item != NULL; item = item->LINK_NAME._next)		\
+      ++ len;										\
+    if (len != 0)									\
+      ++ stat->used;									\
+    if (len > stat->longest)								\
+      stat->longest = len;								\
+  }											\
+}											\
+											\
 typedef struct {} PREFIX##_hash_dummy
 
 #define for_all_ht_buckets(table, head)					\
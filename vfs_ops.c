@@ -135,6 +135,53 @@ static void reiser4_d_release(struct dentry *dentry /* dentry released */ )
 	reiser4_free_dentry_fsdata(dentry);
 }
 
+/**
+ * reiser4_writeback_note - remember file written back
+ * @inode: file ->writepages() was called for
+ *
+ * Flush started by reiser4_writeback_inodes() begins with atoms holding pages
+ * of the files the write-back asked for, and with the files of its own
+ * cgroup writeback in particular, rather than with arbitrary atom. To that
+ * end, a captured jnode of each such file, up to REISER4_WB_STARTS of them,
+ * is remembered in the context, for reiser4_writeout() to start flush from.
+ */
+void reiser4_writeback_note(struct inode *inode)
+{
+	reiser4_context *ctx = get_current_context();
+	reiser4_tree *tree = reiser4_tree_by_inode(inode);
+	jnode *gang[16];
+	jnode *found = NULL;
+	int taken;
+	int i;
+
+	if (ctx->nr_wb_starts == REISER4_WB_STARTS)
+		return;
+
+	read_lock_tree(tree);
+	taken = radix_tree_gang_lookup(
+		jnode_tree_by_reiser4_inode(reiser4_inode_data(inode)),
+		(void **)gang, 0, ARRAY_SIZE(gang));
+	for (i = 0; i < taken; i++) {
+		/* unlocked check is enough for a hint */
+		if (READ_ONCE(gang[i]->atom) != NULL) {
+			found = jref(gang[i]);
+			break;
+		}
+	}
+	read_unlock_tree(tree);
+	if (found != NULL)
+		ctx->wb_start[ctx->nr_wb_starts++] = found;
+}
+
+/* release jnodes reiser4_writeout() did not start flush from */
+void reiser4_writeback_done(reiser4_context *ctx)
+{
+	while (ctx->wb_next < ctx->nr_wb_starts)
+		jput(ctx->wb_start[ctx->wb_next++]);
+	ctx->nr_wb_starts = 0;
+	ctx->wb_next = 0;
+}
+
 /*
  * Called by reiser4_sync_inodes(), during speculative write-back (through
  * pdflush, or balance_dirty_pages()).
@@ -163,7 +210,7 @@ void reiser4_writeout(struct super_block *sb, struct writeback_control *wbc)
 		jnode *node = NULL;
 
 		/* do not put more requests to overload write queue */
-		if (bdi_write_congested(inode_to_bdi(reiser4_get_super_fake(sb)))) {
+		if (flush_write_throttled(sb)) {
 			//blk_flush_plug(current);
 			break;
 		}
@@ -171,15 +218,22 @@ void reiser4_writeout(struct super_block *sb, struct writeback_control *wbc)
 		BUG_ON(wbc->nr_to_write <= 0);
 
 		if (get_current_context()->entd) {
-			entd_context *ent = get_entd_context(sb);
+			struct wbq *rq = entd_current_request();
 
-			if (ent->cur_request->node)
+			if (rq->node)
 				/*
 				 * this is ent thread and it managed to capture
 				 * requested page itself - start flush from
 				 * that page
 				 */
-				node = ent->cur_request->node;
+				node = rq->node;
+		} else {
+			reiser4_context *ctx = get_current_context();
+
+			if (ctx->wb_next < ctx->nr_wb_starts)
+				/* start from a file written back, see
+				   reiser4_writeback_note() */
+				node = ctx->wb_start[ctx->wb_next++];
 		}
 
 		result = flush_some_atom(node, &nr_submitted, wbc,
@@ -207,6 +261,9 @@ void reiser4_throttle_write(struct inode *inode)
 	reiser4_txn_restart(ctx);
 	current->journal_info = NULL;
 	balance_dirty_pages_ratelimited(inode->i_mapping);
+	reiser4_throttle_capture(&get_super_private(inode->i_sb)->tmgr,
+				 ctx->nr_marked_dirty - ctx->nr_throttled);
+	ctx->nr_throttled = ctx->nr_marked_dirty;
 	current->journal_info = ctx;
 }
 
@@ -24,6 +24,7 @@ int reiser4_writepage(struct page *, struct writeback_control *);
 int reiser4_set_page_dirty(struct page *);
 void reiser4_invalidatepage(struct page *, unsigned int offset, unsigned int length);
 int reiser4_releasepage(struct page *, gfp_t);
+ssize_t reiser4_direct_IO(struct kiocb *, struct iov_iter *);
 
 #ifdef CONFIG_MIGRATION
 int reiser4_migratepage(struct address_space *, struct page *,
@@ -39,9 +40,13 @@ extern int reiser4_del_nlink(struct inode *, struct inode *, int);
 extern int reiser4_start_up_io(struct page *page);
 extern void reiser4_throttle_write(struct inode *);
 extern int jnode_is_releasable(jnode *);
+extern int reiser4_init_jnode_shrinker(struct super_block *);
+extern void reiser4_done_jnode_shrinker(struct super_block *);
 
 #define CAPTURE_APAGE_BURST (1024l)
 void reiser4_writeout(struct super_block *, struct writeback_control *);
+extern void reiser4_writeback_note(struct inode *);
+extern void reiser4_writeback_done(reiser4_context *);
 
 extern void reiser4_handle_error(void);
 
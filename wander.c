@@ -81,6 +81,17 @@
    written tx head, submit an i/o for modified journal header block and wait
    for i/o completion.
 
+   With async_commit mount option steps 4-6 are different: wander records are
+   not written until step 5 is done for wandered blocks (and relocate set),
+   then they are submitted with the cache flush, and the journal header is
+   submitted with FUA right after them, without waiting for the wander
+   records. A crash may leave the journal header pointing to an incomplete
+   transaction, so the tx head stores a checksum of all wander records and
+   the journal header stores a copy of it along with the previous value of
+   the last committed transaction pointer. The journal replay discards the
+   last committed transaction if its wander records do not match the
+   checksum (see check_tx_csum()).
+
    NOTE: The special logging for bitmap blocks and some reiser4 super block
    fields makes processes of atom commit, flush and recovering a bit more
    complex (see comments in the source code for details).
@@ -97,6 +108,17 @@
 
    4. Free disk space which was used for wandered blocks and wander records.
 
+   Commit and playing are pipelined: atom commit (up to the journal header
+   update) is serialized by the per-fs commit mutex, the atom playing process
+   is serialized by the write-back mutex (txn_mgr->wb_mutex). A committing atom
+   takes the write-back mutex before it releases the commit mutex, so the next
+   atom may allocate and write its wandered blocks and wander records while
+   the previous one writes its overwrite set in-place, and journal footer
+   updates are still done in the order of commits. Bitmap blocks and the super
+   block are captured by committing atoms without fusion (see
+   insert_into_atom_ovrwr_list()), so they are written in-place and released
+   before the commit mutex is handed over (see write_special_set_back()).
+
    After the freeing of wandered blocks and wander records we have that journal
    footer points to the on-disk structure which might be overwritten soon.
    Neither the log writer nor the journal recovery procedure use that pointer
@@ -176,6 +198,11 @@
 #include "writeout.h"
 #include "inode.h"
 #include "entd.h"
+#include "flush.h"
+#include "checksum.h"
+#include "jdev.h"
+#include "dscale.h"
+#include "magazine.h"
 
 #include <linux/types.h>
 #include <linux/fs.h>		/* for struct super_block  */
@@ -183,10 +210,21 @@
 #include <linux/pagemap.h>
 #include <linux/bio.h>		/* for struct bio */
 #include <linux/blkdev.h>
+#include <linux/list_sort.h>
+#include <linux/sort.h>
+#include <linux/backing-dev.h>
+#include <linux/blk-cgroup.h>
 
 static int write_jnodes_to_disk_extent(
 	jnode *, int, const reiser4_block_nr *, flush_queue_t *, int);
 
+/* a run of blocks adjacent both at original and wandered locations */
+struct wander_run {
+	reiser4_block_nr original;
+	reiser4_block_nr wandered;
+	reiser4_block_nr len;
+};
+
 /* The commit_handle is a container for objects needed at atom commit time  */
 struct commit_handle {
 	/* A pointer to atom's list of OVRWR nodes */
@@ -197,6 +235,12 @@ struct commit_handle {
 	struct list_head tx_list;
 	/* number of wander records */
 	__u32 tx_size;
+	/* checksum of wander records in async_commit mode, 0 otherwise */
+	__u32 tx_csum;
+	/* wandered map for compact wander records, NULL if they are not
+	   used */
+	struct wander_run *runs;
+	int nr_runs;
 	/* 'committed' sb counters are saved here until atom is completely
 	   flushed  */
 	__u64 free_blocks;
@@ -208,12 +252,20 @@ struct commit_handle {
 	struct super_block *super;
 	/* The counter of modified bitmaps */
 	reiser4_block_nr nr_bitmap;
+	/* io heads with copies of overwrite set nodes released by
+	   copy_on_capture() */
+	struct list_head copy_set;
+	/* the released nodes, they are kept loaded until the copies are
+	   written */
+	jnode **copied;
+	int nr_copied;
 };
 
 static void init_commit_handle(struct commit_handle *ch, txn_atom *atom)
 {
 	memset(ch, 0, sizeof(struct commit_handle));
 	INIT_LIST_HEAD(&ch->tx_list);
+	INIT_LIST_HEAD(&ch->copy_set);
 
 	ch->atom = atom;
 	ch->super = reiser4_get_current_sb();
@@ -222,6 +274,7 @@ static void init_commit_handle(struct commit_handle *ch, txn_atom *atom)
 static void done_commit_handle(struct commit_handle *ch)
 {
 	assert("zam-690", list_empty(&ch->tx_list));
+	assert("", list_empty(&ch->copy_set));
 }
 
 /* fill journal header block data  */
@@ -244,6 +297,9 @@ static void format_journal_header(struct commit_handle *ch)
 
 	put_unaligned(cpu_to_le64(*jnode_get_block(txhead)),
 		      &header->last_committed_tx);
+	put_unaligned(cpu_to_le64(sbinfo->last_committed_tx),
+		      &header->prev_committed_tx);
+	put_unaligned(cpu_to_le32(ch->tx_csum), &header->tx_csum);
 
 	jrelse(sbinfo->journal_header);
 }
@@ -361,6 +417,45 @@ store_entry(jnode * node, int index, const reiser4_block_nr * a,
 	put_unaligned(cpu_to_le64(*b), &pairs[index].wandered);
 }
 
+/* add wander record @data to checksum @crc. Checksum field of the tx head is
+   taken as zero */
+static __u32 wander_record_csum(struct super_block *super, __u32 crc,
+				const char *data, int tx_head)
+{
+	struct crypto_shash *tfm = get_super_private(super)->csum_tfm;
+	size_t off = offsetof(struct tx_header, csum);
+	d32 zero = 0;
+
+	if (!tx_head)
+		return reiser4_crc32c(tfm, crc, data, super->s_blocksize);
+
+	crc = reiser4_crc32c(tfm, crc, data, off);
+	crc = reiser4_crc32c(tfm, crc, &zero, sizeof(zero));
+	off += sizeof(zero);
+	return reiser4_crc32c(tfm, crc, data + off, super->s_blocksize - off);
+}
+
+/* zero checksum means "not checksummed" */
+static inline __u32 wander_csum_final(__u32 crc)
+{
+	return crc ? crc : ~0U;
+}
+
+/* compute checksum of formatted wander records and store it in tx head */
+static void stamp_tx_csum(struct commit_handle *ch)
+{
+	jnode *txhead = list_entry(ch->tx_list.next, jnode, capture_link);
+	struct tx_header *header = (struct tx_header *)jdata(txhead);
+	__u32 crc = ~0U;
+	jnode *cur;
+
+	list_for_each_entry(cur, &ch->tx_list, capture_link)
+		crc = wander_record_csum(ch->super, crc, jdata(cur),
+					 cur == txhead);
+	ch->tx_csum = wander_csum_final(crc);
+	put_unaligned(cpu_to_le32(ch->tx_csum), &header->csum);
+}
+
 /* currently, wander records contains contain only wandered map, which depend on
    overwrite set size */
 static void get_tx_size(struct commit_handle *ch)
@@ -376,6 +471,152 @@ static void get_tx_size(struct commit_handle *ch)
 	    2;
 }
 
+/* scalable integers are unsigned, store differences of block numbers with
+   sign in the lowest bit */
+static inline __u64 zigzag_encode(reiser4_block_nr to, reiser4_block_nr from)
+{
+	__s64 delta = (__s64)(to - from);
+
+	return ((__u64)delta << 1) ^ (__u64)(delta >> 63);
+}
+
+static inline reiser4_block_nr zigzag_decode(__u64 value,
+					     reiser4_block_nr from)
+{
+	return from + (reiser4_block_nr)((value >> 1) ^ -(value & 1));
+}
+
+/* Store runs of @ch starting from @first in compact wander record @data, or
+   only count them if @data is NULL. Returns the number of runs which fit
+   into one record */
+static int encode_wander_runs(struct commit_handle *ch, int first, char *data)
+{
+	struct wander_runs *header = NULL;
+	unsigned char *pos = NULL;
+	reiser4_block_nr original = 0;
+	reiser4_block_nr wandered = 0;
+	int room;
+	int i;
+
+	if (data != NULL) {
+		header = (struct wander_runs *)(data +
+				sizeof(struct wander_record_header));
+		pos = (unsigned char *)(header + 1);
+	}
+	room = ch->super->s_blocksize - sizeof(struct wander_record_header) -
+		sizeof(struct wander_runs);
+
+	for (i = first; i < ch->nr_runs && i - first < U16_MAX; i++) {
+		struct wander_run *run = &ch->runs[i];
+		__u64 a = zigzag_encode(run->original, original);
+		__u64 b = zigzag_encode(run->wandered, wandered);
+		int need;
+
+		need = dscale_bytes_to_write(a) + dscale_bytes_to_write(b) +
+			dscale_bytes_to_write(run->len);
+		if (need > room)
+			break;
+		room -= need;
+		if (data != NULL) {
+			pos += dscale_write(pos, a);
+			pos += dscale_write(pos, b);
+			pos += dscale_write(pos, run->len);
+		}
+		original = run->original + run->len;
+		wandered = run->wandered + run->len;
+	}
+	if (data != NULL)
+		put_unaligned(cpu_to_le16(i - first), &header->nr_runs);
+	return i - first;
+}
+
+struct collect_wmap_params {
+	struct wander_run *runs;
+	int nr;
+	int max;
+};
+
+static int
+collect_wmap_actor(txn_atom * atom UNUSED_ARG, const reiser4_block_nr * a,
+		   const reiser4_block_nr * b, void *data)
+{
+	struct collect_wmap_params *params = data;
+
+	if (params->nr == params->max)
+		return RETERR(-E2BIG);
+	params->runs[params->nr].original = *a;
+	params->runs[params->nr].wandered = *b;
+	params->runs[params->nr].len = 1;
+	params->nr++;
+	return 0;
+}
+
+static int wander_run_cmp(const void *a, const void *b)
+{
+	const struct wander_run *r1 = a;
+	const struct wander_run *r2 = b;
+
+	if (r1->original < r2->original)
+		return -1;
+	return r1->original > r2->original;
+}
+
+/* Build the sorted list of runs of the wandered map. Compact wander records
+   are used only if they take less blocks than ordinary ones, so that space
+   grabbed for ch->tx_size records is enough. */
+static void prepare_wander_runs(struct commit_handle *ch)
+{
+	struct collect_wmap_params params;
+	txn_atom *atom;
+	int nr_records;
+	int first;
+	int i;
+	int ret;
+
+	assert("", ch->runs == NULL);
+
+	params.runs = kvmalloc_array(ch->overwrite_set_size,
+				     sizeof(struct wander_run),
+				     reiser4_ctx_gfp_mask_get());
+	if (params.runs == NULL)
+		/* fall back to ordinary wander records */
+		return;
+	params.nr = 0;
+	params.max = ch->overwrite_set_size;
+
+	atom = get_current_atom_locked();
+	ret = blocknr_tree_iterator(atom, &atom->wandered_map,
+				    &collect_wmap_actor, &params, 0);
+	spin_unlock_atom(atom);
+	if (ret != 0 || params.nr == 0)
+		goto fallback;
+
+	sort(params.runs, params.nr, sizeof(struct wander_run),
+	     wander_run_cmp, NULL);
+	ch->runs = params.runs;
+	ch->nr_runs = 1;
+	for (i = 1; i < params.nr; i++) {
+		struct wander_run *last = &ch->runs[ch->nr_runs - 1];
+
+		if (last->original + last->len == params.runs[i].original &&
+		    last->wandered + last->len == params.runs[i].wandered)
+			last->len++;
+		else
+			ch->runs[ch->nr_runs++] = params.runs[i];
+	}
+
+	for (nr_records = 0, first = 0; first < ch->nr_runs; nr_records++)
+		first += encode_wander_runs(ch, first, NULL);
+	if (nr_records + 1 < ch->tx_size) {
+		ch->tx_size = nr_records + 1;
+		return;
+	}
+	ch->runs = NULL;
+	ch->nr_runs = 0;
+ fallback:
+	kvfree(params.runs);
+}
+
 /* A special structure for using in store_wmap_actor() for saving its state
    between calls */
 struct store_wmap_params {
@@ -420,10 +661,12 @@ static int update_journal_header(struct commit_handle *ch)
 	struct reiser4_super_info_data *sbinfo = get_super_private(ch->super);
 	jnode *jh = sbinfo->journal_header;
 	jnode *head = list_entry(ch->tx_list.next, jnode, capture_link);
+	ktime_t start;
 	int ret;
 
 	format_journal_header(ch);
 
+	start = ktime_get();
 	ret = write_jnodes_to_disk_extent(jh, 1, jnode_get_block(jh), NULL,
 					  WRITEOUT_FLUSH_FUA);
 	if (ret)
@@ -433,7 +676,53 @@ static int update_journal_header(struct commit_handle *ch)
 	 * blk_run_queues(); */
 
 	ret = jwait_io(jh, WRITE);
+	txnmgr_lat_since(&sbinfo->tmgr, TXNMGR_LAT_BARRIER, start);
+
+	if (ret)
+		return ret;
+
+	sbinfo->last_committed_tx = *jnode_get_block(head);
+
+	return 0;
+}
+
+/* async_commit version of update_journal_header(). Relocate set and wandered
+   blocks are written already, but wander records are not. The cache flush
+   is attached to the wander records, so none of them can reach the media
+   before the blocks written earlier. The journal header does not wait for
+   them and is written with FUA only, the journal replay detects whether
+   the wander records it points to are complete by their checksum. */
+static int update_journal_header_async(struct commit_handle *ch)
+{
+	struct reiser4_super_info_data *sbinfo = get_super_private(ch->super);
+	jnode *jh = sbinfo->journal_header;
+	jnode *head = list_entry(ch->tx_list.next, jnode, capture_link);
+	jnode *cur;
+	ktime_t start;
+	int ret;
+
+	assert("", ch->tx_csum != 0);
 
+	start = ktime_get();
+	ret = write_jnode_list(&ch->tx_list, NULL, NULL, WRITEOUT_FLUSH_FUA);
+	if (ret)
+		return ret;
+
+	format_journal_header(ch);
+
+	ret = write_jnodes_to_disk_extent(jh, 1, jnode_get_block(jh), NULL,
+					  WRITEOUT_FUA);
+	list_for_each_entry(cur, &ch->tx_list, capture_link) {
+		int err = jwait_io(cur, WRITE);
+
+		if (ret == 0)
+			ret = err;
+	}
+	if (ret)
+		return ret;
+
+	ret = jwait_io(jh, WRITE);
+	txnmgr_lat_since(&sbinfo->tmgr, TXNMGR_LAT_BARRIER, start);
 	if (ret)
 		return ret;
 
@@ -450,9 +739,16 @@ static int update_journal_footer(struct commit_handle *ch)
 	reiser4_super_info_data *sbinfo = get_super_private(ch->super);
 
 	jnode *jf = sbinfo->journal_footer;
-
+	ktime_t start;
 	int ret;
 
+	/* in-place writes on the main device must be durable before the
+	   journal footer on the journal device is */
+	start = ktime_get();
+	ret = reiser4_jdev_flush_data(ch->super);
+	if (ret)
+		return ret;
+
 	format_journal_footer(ch);
 
 	ret = write_jnodes_to_disk_extent(jf, 1, jnode_get_block(jf), NULL,
@@ -464,12 +760,46 @@ static int update_journal_footer(struct commit_handle *ch)
 	 * blk_run_queue(); */
 
 	ret = jwait_io(jf, WRITE);
+	txnmgr_lat_since(&sbinfo->tmgr, TXNMGR_LAT_BARRIER, start);
 	if (ret)
 		return ret;
 
 	return 0;
 }
 
+/* Allocate up to @len blocks for wandered blocks or wander records. They are
+   taken from the external journal device while it has free space */
+static int alloc_journal_blocks(reiser4_block_nr *start, reiser4_block_nr *len,
+				reiser4_ba_flags_t flags)
+{
+	struct super_block *super = reiser4_get_current_sb();
+	reiser4_blocknr_hint hint;
+	int ret;
+
+	if (get_super_private(super)->jdev != NULL &&
+	    reiser4_jdev_alloc(super, *len, start, len) == 0)
+		return 0;
+
+	reiser4_blocknr_hint_init(&hint);
+	hint.block_stage = BLOCK_GRABBED;
+	ret = reiser4_alloc_blocks(&hint, start, len, flags);
+	reiser4_blocknr_hint_done(&hint);
+	return ret;
+}
+
+/* free blocks allocated by alloc_journal_blocks() */
+static void dealloc_journal_blocks(const reiser4_block_nr *start,
+				   reiser4_block_nr len, block_stage_t stage,
+				   reiser4_ba_flags_t flags)
+{
+	struct super_block *super = reiser4_get_current_sb();
+
+	if (reiser4_is_jdev_block(super, start))
+		reiser4_jdev_free(super, start, len);
+	else
+		reiser4_dealloc_blocks(start, &len, stage, flags);
+}
+
 /* free block numbers of wander records of already written in place transaction */
 static void dealloc_tx_list(struct commit_handle *ch)
 {
@@ -477,8 +807,8 @@ static void dealloc_tx_list(struct commit_handle *ch)
 		jnode *cur = list_entry(ch->tx_list.next, jnode, capture_link);
 		list_del(&cur->capture_link);
 		ON_DEBUG(INIT_LIST_HEAD(&cur->capture_link));
-		reiser4_dealloc_block(jnode_get_block(cur), 0,
-				      BA_DEFER | BA_FORMATTED);
+		dealloc_journal_blocks(jnode_get_block(cur), 1, 0,
+				       BA_DEFER | BA_FORMATTED);
 
 		unpin_jnode_data(cur);
 		reiser4_drop_io_head(cur);
@@ -497,7 +827,7 @@ dealloc_wmap_actor(txn_atom * atom UNUSED_ARG,
 	assert("zam-500", *b != 0);
 	assert("zam-501", !reiser4_blocknr_is_fake(b));
 
-	reiser4_dealloc_block(b, 0, BA_DEFER | BA_FORMATTED);
+	dealloc_journal_blocks(b, 1, 0, BA_DEFER | BA_FORMATTED);
 	return 0;
 }
 
@@ -506,8 +836,8 @@ static void dealloc_wmap(struct commit_handle *ch)
 {
 	assert("zam-696", ch->atom != NULL);
 
-	blocknr_set_iterator(ch->atom, &ch->atom->wandered_map,
-			     dealloc_wmap_actor, NULL, 1);
+	blocknr_tree_iterator(ch->atom, &ch->atom->wandered_map,
+			      dealloc_wmap_actor, NULL, 1);
 }
 
 /* helper function for alloc wandered blocks, which refill set of block
@@ -515,7 +845,6 @@ static void dealloc_wmap(struct commit_handle *ch)
 static int
 get_more_wandered_blocks(int count, reiser4_block_nr * start, int *len)
 {
-	reiser4_blocknr_hint hint;
 	int ret;
 
 	reiser4_block_nr wide_len = count;
@@ -524,10 +853,7 @@ get_more_wandered_blocks(int count, reiser4_block_nr * start, int *len)
 	   ZAM-FIXME-HANS: yes, what happened to our discussion of using a fixed
 	   reserved allocation area so as to get the best qualities of fixed
 	   journals? */
-	reiser4_blocknr_hint_init(&hint);
-	hint.block_stage = BLOCK_GRABBED;
-
-	ret = reiser4_alloc_blocks(&hint, start, &wide_len,
+	ret = alloc_journal_blocks(start, &wide_len,
 				   BA_FORMATTED | BA_USE_DEFAULT_SEARCH_START);
 	*len = (int)wide_len;
 
@@ -681,6 +1007,52 @@ static int get_overwrite_set(struct commit_handle *ch)
 	return ch->overwrite_set_size;
 }
 
+#ifdef CONFIG_CGROUP_WRITEBACK
+/*
+ * Cgroup the write-back of page of @node is to be charged to, referenced, or
+ * NULL. When cgroup_writeback mount option is set, unformatted nodes are
+ * charged to the cgroup the writeback of their inode is attached to, that is
+ * to the one which dirtied the inode. Formatted nodes are shared and are
+ * never charged.
+ */
+static struct cgroup_subsys_state *jnode_blkcg_css(jnode *node)
+{
+	struct cgroup_subsys_state *css = NULL;
+	struct bdi_writeback *wb;
+
+	if (!jnode_is_unformatted(node) ||
+	    !reiser4_is_set(reiser4_get_current_sb(),
+			    REISER4_CGROUP_WRITEBACK))
+		return NULL;
+
+	rcu_read_lock();
+	wb = READ_ONCE(jnode_get_mapping(node)->host->i_wb);
+	if (wb != NULL && wb->blkcg_css != NULL &&
+	    css_tryget(wb->blkcg_css))
+		css = wb->blkcg_css;
+	rcu_read_unlock();
+	return css;
+}
+
+static void bio_charge_blkcg(struct bio *bio, struct cgroup_subsys_state *css)
+{
+	if (css != NULL) {
+		bio_associate_blkg_from_css(bio, css);
+		css_put(css);
+	}
+}
+#else
+static inline struct cgroup_subsys_state *jnode_blkcg_css(jnode *node)
+{
+	return NULL;
+}
+
+static inline void bio_charge_blkcg(struct bio *bio,
+				    struct cgroup_subsys_state *css)
+{
+}
+#endif
+
 /**
  * write_jnodes_to_disk_extent - submit write request
  * @head:
@@ -697,6 +1069,7 @@ static int get_overwrite_set(struct commit_handle *ch)
  * done more efficiently by using flush_queue_t objects.
  * This function is the one which writes list of jnodes in batch mode. It does
  * all low-level things as bio construction and page states manipulation.
+ * A bio carries pages of one cgroup only, see jnode_blkcg_css().
  *
  * ZAM-FIXME-HANS: brief me on why this function exists, and why bios are
  * aggregated in this function instead of being left to the layers below
@@ -709,7 +1082,8 @@ static int write_jnodes_to_disk_extent(
 	flush_queue_t *fq, int flags)
 {
 	struct super_block *super = reiser4_get_current_sb();
-	int op_flags = (flags & WRITEOUT_FLUSH_FUA) ? REQ_PREFLUSH | REQ_FUA : 0;
+	int op_flags = (flags & WRITEOUT_FLUSH_FUA) ? REQ_PREFLUSH | REQ_FUA :
+		(flags & WRITEOUT_FUA) ? REQ_FUA : 0;
 	jnode *cur = first;
 	reiser4_block_nr block;
 
@@ -721,6 +1095,7 @@ static int write_jnodes_to_disk_extent(
 
 	while (nr > 0) {
 		struct bio *bio;
+		struct cgroup_subsys_state *css;
 		int nr_blocks = min(nr, BIO_MAX_PAGES);
 		int i;
 		int nr_used;
@@ -729,14 +1104,24 @@ static int write_jnodes_to_disk_extent(
 		if (!bio)
 			return RETERR(-ENOMEM);
 
-		bio_set_dev(bio, super->s_bdev);
-		bio->bi_iter.bi_sector = block * (super->s_blocksize >> 9);
+		reiser4_bio_set_block(bio, super, block);
+		css = jnode_blkcg_css(cur);
 		for (nr_used = 0, i = 0; i < nr_blocks; i++) {
 			struct page *pg;
 
 			pg = jnode_page(cur);
 			assert("zam-573", pg != NULL);
 
+			if (i > 0) {
+				struct cgroup_subsys_state *owner;
+
+				owner = jnode_blkcg_css(cur);
+				if (owner != NULL)
+					css_put(owner);
+				/* the rest goes to a bio of its owner */
+				if (owner != css)
+					break;
+			}
 			get_page(pg);
 
 			lock_and_wait_page_writeback(pg);
@@ -786,12 +1171,12 @@ static int write_jnodes_to_disk_extent(
 
 				spin_lock(&ent->guard);
 
-				if (pg == ent->cur_request->page) {
+				if (pg == entd_current_request()->page) {
 					/*
 					 * entd is called for this page. This
 					 * request is not in th etodo list
 					 */
-					ent->cur_request->written = 1;
+					entd_current_request()->written = 1;
 				} else {
 					/*
 					 * if we have written a page for which writepage
@@ -835,8 +1220,11 @@ static int write_jnodes_to_disk_extent(
 				undo_bio(bio);
 			else {
 				add_fq_to_bio(fq, bio);
+				flush_io_submitted(super, nr_used);
 				bio_get(bio);
 				bio_set_op_attrs(bio, WRITE, op_flags);
+				bio_charge_blkcg(bio, css);
+				css = NULL;
 				submit_bio(bio);
 				bio_put(bio);
 			}
@@ -847,22 +1235,48 @@ static int write_jnodes_to_disk_extent(
 		} else {
 			bio_put(bio);
 		}
+		if (css != NULL)
+			css_put(css);
 		nr -= nr_used;
 	}
 
 	return 0;
 }
 
+static int jnode_block_cmp(void *unused, struct list_head *a,
+			   struct list_head *b)
+{
+	const reiser4_block_nr *ba =
+		jnode_get_block(list_entry(a, jnode, capture_link));
+	const reiser4_block_nr *bb =
+		jnode_get_block(list_entry(b, jnode, capture_link));
+
+	if (*ba < *bb)
+		return -1;
+	return *ba > *bb;
+}
+
+/* Sort a list of j-nodes by block number, so that write_jnode_list() finds
+   the longest contiguous sequences in it. Blocks that become neighbours only
+   after relocation are merged this way into one bio. Must not be used for
+   lists whose order matters, like the list of wander records. */
+void sort_jnode_list(struct list_head *head)
+{
+	list_sort(NULL, head, jnode_block_cmp);
+}
+
 /* This is a procedure which recovers a contiguous sequences of disk block
    numbers in the given list of j-nodes and submits write requests on this
-   per-sequence basis */
+   per-sequence basis. The whole list is submitted under one block plug. */
 int
 write_jnode_list(struct list_head *head, flush_queue_t *fq,
 		 long *nr_submitted, int flags)
 {
-	int ret;
+	int ret = 0;
+	struct blk_plug plug;
 	jnode *beg = list_entry(head->next, jnode, capture_link);
 
+	blk_start_plug(&plug);
 	while (head != &beg->capture_link) {
 		int nr = 1;
 		jnode *cur = list_entry(beg->capture_link.next, jnode, capture_link);
@@ -877,15 +1291,16 @@ write_jnode_list(struct list_head *head, flush_queue_t *fq,
 		ret = write_jnodes_to_disk_extent(
 			beg, nr, jnode_get_block(beg), fq, flags);
 		if (ret)
-			return ret;
+			break;
 
 		if (nr_submitted)
 			*nr_submitted += nr;
 
 		beg = cur;
 	}
+	blk_finish_plug(&plug);
 
-	return 0;
+	return ret;
 }
 
 /* add given wandered mapping to atom's wandered map */
@@ -893,7 +1308,7 @@ static int
 add_region_to_wmap(jnode * cur, int len, const reiser4_block_nr * block_p)
 {
 	int ret;
-	blocknr_set_entry *new_bsep = NULL;
+	blocknr_tree_entry *new_bsep = NULL;
 	reiser4_block_nr block;
 
 	txn_atom *atom;
@@ -908,8 +1323,8 @@ add_region_to_wmap(jnode * cur, int len, const reiser4_block_nr * block_p)
 			assert("zam-536",
 			       !reiser4_blocknr_is_fake(jnode_get_block(cur)));
 			ret =
-			    blocknr_set_add_pair(atom, &atom->wandered_map,
-						 &new_bsep,
+			    blocknr_tree_add_pair(atom, &atom->wandered_map,
+						  &new_bsep,
 						 jnode_get_block(cur), &block);
 		} while (ret == -E_REPEAT);
 
@@ -984,7 +1399,6 @@ static int alloc_wandered_blocks(struct commit_handle *ch, flush_queue_t *fq)
    list, return pointer to the first jnode in the list */
 static int alloc_tx(struct commit_handle *ch, flush_queue_t * fq)
 {
-	reiser4_blocknr_hint hint;
 	reiser4_block_nr allocated = 0;
 	reiser4_block_nr first, len;
 	jnode *cur;
@@ -1002,19 +1416,14 @@ static int alloc_tx(struct commit_handle *ch, flush_queue_t * fq)
 	while (allocated < (unsigned)ch->tx_size) {
 		len = (ch->tx_size - allocated);
 
-		reiser4_blocknr_hint_init(&hint);
-
-		hint.block_stage = BLOCK_GRABBED;
-
 		/* FIXME: there should be some block allocation policy for
 		   nodes which contain wander records */
 
 		/* We assume that disk space for wandered record blocks can be
 		 * taken from reserved area. */
-		ret = reiser4_alloc_blocks(&hint, &first, &len,
+		ret = alloc_journal_blocks(&first, &len,
 					   BA_FORMATTED | BA_RESERVED |
 					   BA_USE_DEFAULT_SEARCH_START);
-		reiser4_blocknr_hint_done(&hint);
 
 		if (ret)
 			return ret;
@@ -1058,7 +1467,18 @@ static int alloc_tx(struct commit_handle *ch, flush_queue_t * fq)
 		}
 	}
 
-	{ /* Fill wander records with Wandered Set */
+	if (ch->runs != NULL) { /* Fill compact wander records with runs */
+		int first = 0;
+
+		cur = list_entry(txhead->capture_link.next, jnode, capture_link);
+		while (&ch->tx_list != &cur->capture_link) {
+			memcpy(jdata(cur), WANDER_RUNS_MAGIC,
+			       WANDER_RECORD_MAGIC_SIZE);
+			first += encode_wander_runs(ch, first, jdata(cur));
+			cur = list_entry(cur->capture_link.next, jnode, capture_link);
+		}
+		assert("", first == ch->nr_runs);
+	} else { /* Fill wander records with Wandered Set */
 		struct store_wmap_params params;
 		txn_atom *atom;
 
@@ -1069,11 +1489,14 @@ static int alloc_tx(struct commit_handle *ch, flush_queue_t * fq)
 		    wander_record_capacity(reiser4_get_current_sb());
 
 		atom = get_current_atom_locked();
-		blocknr_set_iterator(atom, &atom->wandered_map,
-				     &store_wmap_actor, &params, 0);
+		blocknr_tree_iterator(atom, &atom->wandered_map,
+				      &store_wmap_actor, &params, 0);
 		spin_unlock_atom(atom);
 	}
 
+	if (reiser4_is_set(ctx->super, REISER4_ASYNC_COMMIT))
+		stamp_tx_csum(ch);
+
 	{ /* relse all jnodes from tx_list */
 		cur = list_entry(ch->tx_list.next, jnode, capture_link);
 		while (&ch->tx_list != &cur->capture_link) {
@@ -1082,6 +1505,11 @@ static int alloc_tx(struct commit_handle *ch, flush_queue_t * fq)
 		}
 	}
 
+	/* in async_commit mode wander records are written by
+	   update_journal_header_async() */
+	if (ch->tx_csum != 0)
+		return 0;
+
 	ret = write_jnode_list(&ch->tx_list, fq, NULL, 0);
 
 	return ret;
@@ -1089,7 +1517,7 @@ static int alloc_tx(struct commit_handle *ch, flush_queue_t * fq)
       free_not_assigned:
 	/* We deallocate blocks not yet assigned to jnodes on tx_list. The
 	   caller takes care about invalidating of tx list  */
-	reiser4_dealloc_blocks(&first, &len, BLOCK_NOT_COUNTED, BA_FORMATTED);
+	dealloc_journal_blocks(&first, len, BLOCK_NOT_COUNTED, BA_FORMATTED);
 
 	return ret;
 }
@@ -1097,6 +1525,7 @@ static int alloc_tx(struct commit_handle *ch, flush_queue_t * fq)
 static int commit_tx(struct commit_handle *ch)
 {
 	flush_queue_t *fq;
+	ktime_t start;
 	int ret;
 
 	/* Grab more space for wandered records. */
@@ -1109,14 +1538,24 @@ static int commit_tx(struct commit_handle *ch)
 		return PTR_ERR(fq);
 
 	spin_unlock_atom(fq->atom);
+	start = ktime_get();
+	if (reiser4_is_set(ch->super, REISER4_COMPACT_JOURNAL))
+		/* so that wandered blocks are allocated in runs */
+		sort_jnode_list(ch->overwrite_set);
 	do {
 		ret = alloc_wandered_blocks(ch, fq);
 		if (ret)
 			break;
+		if (reiser4_is_set(ch->super, REISER4_COMPACT_JOURNAL))
+			prepare_wander_runs(ch);
 		ret = alloc_tx(ch, fq);
+		kvfree(ch->runs);
+		ch->runs = NULL;
 		if (ret)
 			break;
 	} while (0);
+	txnmgr_lat_since(&get_current_super_private()->tmgr,
+			 TXNMGR_LAT_ALLOC_TX, start);
 
 	reiser4_fq_put(fq);
 	if (ret)
@@ -1124,20 +1563,79 @@ static int commit_tx(struct commit_handle *ch)
 	ret = current_atom_finish_all_fq();
 	if (ret)
 		return ret;
+	/* relocate set and bitmaps on the main device must be durable before
+	   the journal header on the journal device is */
+	ret = reiser4_jdev_flush_data(ch->super);
+	if (ret)
+		return ret;
+	if (ch->tx_csum != 0)
+		return update_journal_header_async(ch);
 	return update_journal_header(ch);
 }
 
+/* Like write_jnode_list(), but keep no more than @depth blocks of @head
+   under write. Blocks are submitted in list order, so the oldest
+   submitted one is waited for to make room. @depth == 0 means no limit */
+static int write_jnode_list_bounded(struct list_head *head, flush_queue_t *fq,
+				    int flags, unsigned int depth)
+{
+	jnode *beg = list_entry(head->next, jnode, capture_link);
+	jnode *oldest = beg;
+	unsigned int inflight = 0;
+	int ret = 0;
+
+	if (depth == 0)
+		return write_jnode_list(head, fq, NULL, flags);
+
+	while (head != &beg->capture_link) {
+		unsigned int nr = 1;
+		jnode *cur = list_entry(beg->capture_link.next, jnode, capture_link);
+
+		while (head != &cur->capture_link && nr < depth) {
+			if (*jnode_get_block(cur) != *jnode_get_block(beg) + nr)
+				break;
+			++nr;
+			cur = list_entry(cur->capture_link.next, jnode, capture_link);
+		}
+
+		while (inflight + nr > depth && inflight > 0) {
+			wait_on_page_writeback(jnode_page(oldest));
+			oldest = list_entry(oldest->capture_link.next, jnode,
+					    capture_link);
+			--inflight;
+		}
+
+		ret = write_jnodes_to_disk_extent(
+			beg, nr, jnode_get_block(beg), fq, flags);
+		if (ret)
+			break;
+		inflight += nr;
+		beg = cur;
+	}
+	return ret;
+}
+
 static int write_tx_back(struct commit_handle * ch)
 {
+	unsigned int depth = get_super_private(ch->super)->tmgr.writeback_depth;
+
 	flush_queue_t *fq;
+	struct blk_plug plug;
 	int ret;
 
 	fq = get_fq_for_current_atom();
 	if (IS_ERR(fq))
 		return  PTR_ERR(fq);
 	spin_unlock_atom(fq->atom);
-	ret = write_jnode_list(
-		ch->overwrite_set, fq, NULL, WRITEOUT_FOR_PAGE_RECLAIM);
+	sort_jnode_list(ch->overwrite_set);
+	sort_jnode_list(&ch->copy_set);
+	blk_start_plug(&plug);
+	ret = write_jnode_list_bounded(ch->overwrite_set, fq,
+				       WRITEOUT_FOR_PAGE_RECLAIM, depth);
+	if (ret == 0)
+		ret = write_jnode_list_bounded(&ch->copy_set, fq,
+					       WRITEOUT_FOR_PAGE_RECLAIM, depth);
+	blk_finish_plug(&plug);
 	reiser4_fq_put(fq);
 	if (ret)
 		return ret;
@@ -1147,6 +1645,165 @@ static int write_tx_back(struct commit_handle * ch)
 	return update_journal_footer(ch);
 }
 
+/* Overwrite set nodes which are neither znodes nor unformatted nodes (bitmap
+   blocks and the super block jnode supplied by the disk format plugin) are
+   inserted into the overwrite set of a committing atom by
+   insert_into_atom_ovrwr_list(), bypassing capture_fuse_wait(). The next
+   committing atom wants them as soon as it enters reiser4_write_logs(), so
+   they are written in-place, waited for and released from the atom before the
+   commit mutex is released. */
+static int write_special_set_back(struct commit_handle *ch)
+{
+	struct list_head special;
+	flush_queue_t *fq;
+	jnode *cur, *next;
+	int ret;
+
+	INIT_LIST_HEAD(&special);
+	list_for_each_entry_safe(cur, next, ch->overwrite_set, capture_link) {
+		if (!jnode_is_znode(cur) && !jnode_is_unformatted(cur))
+			list_move_tail(&cur->capture_link, &special);
+	}
+	if (list_empty(&special))
+		return 0;
+
+	fq = get_fq_for_current_atom();
+	if (IS_ERR(fq)) {
+		list_splice(&special, ch->overwrite_set);
+		return PTR_ERR(fq);
+	}
+	spin_unlock_atom(fq->atom);
+	sort_jnode_list(&special);
+	ret = write_jnode_list(&special, fq, NULL, WRITEOUT_FOR_PAGE_RECLAIM);
+	reiser4_fq_put(fq);
+	if (ret == 0)
+		ret = current_atom_finish_all_fq();
+	if (ret) {
+		list_splice(&special, ch->overwrite_set);
+		return ret;
+	}
+
+	while (!list_empty(&special)) {
+		cur = list_entry(special.next, jnode, capture_link);
+		/* undo jload() done by get_overwrite_set() */
+		jrelse_tail(cur);
+		spin_lock_jnode(cur);
+		reiser4_uncapture_block(cur);
+		jput(cur);
+	}
+	return 0;
+}
+
+/* Copy-on-capture. After the transaction is committed to the journal
+   (ASTAGE_POST_COMMIT) the atom needs its overwrite set only for the data to
+   be written in-place. If somebody waits in capture_fuse_wait() to capture
+   a node of this atom, overwrite set nodes are copied to io heads, which are
+   written in place instead, and the nodes are released from the atom at
+   once, so that the waiters do not wait for write-back.
+
+   The copies cannot be overwritten on disk too early: whoever captures the
+   released nodes writes them in-place or frees their blocks only after taking
+   the write-back mutex, which is held by us until write-back completes. The
+   released nodes are kept loaded until then, so that they are not re-read
+   from their not yet updated in-place location. */
+static void copy_on_capture(struct commit_handle *ch)
+{
+	txn_mgr *mgr = &get_super_private(ch->super)->tmgr;
+	jnode *cur, *next;
+	int waiters;
+
+	spin_lock_atom(ch->atom);
+	waiters = atom_has_capture_waiters(ch->atom);
+	spin_unlock_atom(ch->atom);
+	if (!waiters)
+		return;
+
+	ch->copied = kmalloc_array(ch->overwrite_set_size, sizeof(jnode *),
+				   reiser4_ctx_gfp_mask_get());
+	if (ch->copied == NULL)
+		return;
+
+	list_for_each_entry_safe(cur, next, ch->overwrite_set, capture_link) {
+		struct page *pg = jnode_page(cur);
+		jnode *copy;
+
+		if (JF_ISSET(cur, JNODE_HEARD_BANSHEE) ||
+		    jnode_is_cluster_page(cur))
+			continue;
+		/* do not wait for the page lock: its owner may be waiting for
+		   this atom */
+		if (!trylock_page(pg))
+			continue;
+
+		copy = reiser4_alloc_io_head(jnode_get_block(cur));
+		if (copy == NULL) {
+			unlock_page(pg);
+			break;
+		}
+		if (jinit_new(copy, reiser4_ctx_gfp_mask_get())) {
+			jfree(copy);
+			unlock_page(pg);
+			break;
+		}
+		pin_jnode_data(copy);
+
+		/* the copy is written as an io head, so the checksum has to be
+		   set up here, see write_jnodes_to_disk_extent() */
+		if (jnode_is_znode(cur)) {
+			zload(JZNODE(cur));
+			if (node_plugin_by_node(JZNODE(cur))->csum)
+				node_plugin_by_node(JZNODE(cur))->csum(JZNODE(cur), 0);
+			zrelse(JZNODE(cur));
+		}
+		memcpy(jdata(copy), jdata(cur), ch->super->s_blocksize);
+		jrelse(copy);
+		list_add_tail(&copy->capture_link, &ch->copy_set);
+
+		/* the node data are safe in the journal and in the copy */
+		clear_page_dirty_for_io(pg);
+		unlock_page(pg);
+
+		/* jload() done by get_overwrite_set() is undone by
+		   put_copy_set() */
+		spin_lock_jnode(cur);
+		reiser4_uncapture_block(cur);
+		ch->copied[ch->nr_copied++] = cur;
+	}
+
+	if (ch->nr_copied) {
+		ch->overwrite_set_size -= ch->nr_copied;
+		atomic_add(ch->nr_copied, &mgr->nr_copied_on_capture);
+		spin_lock_atom(ch->atom);
+		reiser4_atom_send_event(ch->atom);
+		spin_unlock_atom(ch->atom);
+	}
+}
+
+/* release io heads allocated by copy_on_capture() and nodes they were copied
+   from */
+static void put_copy_set(struct commit_handle *ch)
+{
+	int i;
+
+	for (i = 0; i < ch->nr_copied; i++) {
+		jrelse_tail(ch->copied[i]);
+		/* reference of the atom the node was captured by */
+		jput(ch->copied[i]);
+	}
+	kfree(ch->copied);
+	ch->copied = NULL;
+	ch->nr_copied = 0;
+
+	while (!list_empty(&ch->copy_set)) {
+		jnode *cur = list_entry(ch->copy_set.next, jnode, capture_link);
+
+		list_del(&cur->capture_link);
+		ON_DEBUG(INIT_LIST_HEAD(&cur->capture_link));
+		unpin_jnode_data(cur);
+		reiser4_drop_io_head(cur);
+	}
+}
+
 /* We assume that at this moment all captured blocks are marked as RELOC or
    WANDER (belong to Relocate o Overwrite set), all nodes from Relocate set
    are submitted to write.
@@ -1158,14 +1815,20 @@ int reiser4_write_logs(long *nr_submitted)
 	struct super_block *super = reiser4_get_current_sb();
 	reiser4_super_info_data *sbinfo = get_super_private(super);
 	struct commit_handle ch;
+	ktime_t start;
 	int ret;
 
 	writeout_mode_enable();
 
+	mutex_lock(&sbinfo->tmgr.commit_mutex);
+
 	/* block allocator may add j-nodes to the clean_list */
 	ret = reiser4_pre_commit_hook();
-	if (ret)
+	if (ret) {
+		mutex_unlock(&sbinfo->tmgr.commit_mutex);
+		writeout_mode_disable();
 		return ret;
+	}
 
 	/* No locks are required if we take atom which stage >=
 	 * ASTAGE_PRE_COMMIT */
@@ -1212,6 +1875,8 @@ int reiser4_write_logs(long *nr_submitted)
 	if (ret <= 0) {
 		/* It is possible that overwrite set is empty here, it means
 		   all captured nodes are clean */
+		mutex_lock(&sbinfo->tmgr.wb_mutex);
+		mutex_unlock(&sbinfo->tmgr.commit_mutex);
 		goto up_and_ret;
 	}
 
@@ -1222,16 +1887,32 @@ int reiser4_write_logs(long *nr_submitted)
 	/* count all records needed for storing of the wandered set */
 	get_tx_size(&ch);
 
+	start = ktime_get();
 	ret = commit_tx(&ch);
-	if (ret)
-		goto up_and_ret;
+	txnmgr_lat_since(&sbinfo->tmgr, TXNMGR_LAT_COMMIT_TX, start);
+	if (ret == 0) {
+		reiser4_stat_add(super, REISER4_STAT_JOURNAL_BLOCKS,
+				 ch.overwrite_set_size + ch.tx_size);
+		spin_lock_atom(atom);
+		reiser4_atom_set_stage(atom, ASTAGE_POST_COMMIT);
+		spin_unlock_atom(atom);
+		reiser4_post_commit_hook();
 
-	spin_lock_atom(atom);
-	reiser4_atom_set_stage(atom, ASTAGE_POST_COMMIT);
-	spin_unlock_atom(atom);
-	reiser4_post_commit_hook();
+		ret = write_special_set_back(&ch);
+		if (ret == 0)
+			copy_on_capture(&ch);
+	}
 
-	ret = write_tx_back(&ch);
+	/* hand commit over to the next atom, keep write-back ordered */
+	mutex_lock(&sbinfo->tmgr.wb_mutex);
+	mutex_unlock(&sbinfo->tmgr.commit_mutex);
+
+	if (ret == 0) {
+		start = ktime_get();
+		ret = write_tx_back(&ch);
+		txnmgr_lat_since(&sbinfo->tmgr, TXNMGR_LAT_WRITE_TX_BACK,
+				 start);
+	}
 
       up_and_ret:
 	if (ret) {
@@ -1244,9 +1925,14 @@ int reiser4_write_logs(long *nr_submitted)
 	dealloc_tx_list(&ch);
 	dealloc_wmap(&ch);
 
+	start = ktime_get();
 	reiser4_post_write_back_hook();
+	txnmgr_lat_since(&sbinfo->tmgr, TXNMGR_LAT_DISCARD, start);
 
 	put_overwrite_set(&ch);
+	put_copy_set(&ch);
+
+	mutex_unlock(&sbinfo->tmgr.wb_mutex);
 
 	done_commit_handle(&ch);
 
@@ -1309,8 +1995,8 @@ static int check_wander_record(const jnode * node)
 	struct wander_record_header *RH =
 	    (struct wander_record_header *)jdata(node);
 
-	if (memcmp(&RH->magic, WANDER_RECORD_MAGIC, WANDER_RECORD_MAGIC_SIZE) !=
-	    0) {
+	if (memcmp(&RH->magic, WANDER_RECORD_MAGIC, WANDER_RECORD_MAGIC_SIZE) &&
+	    memcmp(&RH->magic, WANDER_RUNS_MAGIC, WANDER_RECORD_MAGIC_SIZE)) {
 		warning("zam-628", "wander record at block %s corrupted\n",
 			sprint_address(jnode_get_block(node)));
 		return RETERR(-EIO);
@@ -1319,6 +2005,71 @@ static int check_wander_record(const jnode * node)
 	return 0;
 }
 
+/* Verify the checksum of the transaction which tx head is at @tx_block
+   against @csum stored in the journal header. Returns 1 if the transaction
+   is complete, 0 if it is not, negative error code if it could not be read */
+static int check_tx_csum(struct super_block *s,
+			 const reiser4_block_nr *tx_block, __u32 csum)
+{
+	reiser4_block_nr block = *tx_block;
+	__u32 crc = ~0U;
+	__u32 total = 0;
+	__u32 i;
+	int ret = 1;
+
+	for (i = 0; ret == 1 && (i == 0 || i < total); i++) {
+		jnode *node;
+		char *data;
+
+		if (i != 0 && block == *tx_block)
+			/* the circle is shorter than it should be */
+			return 0;
+		node = reiser4_alloc_io_head(&block);
+		if (!node)
+			return RETERR(-ENOMEM);
+		ret = jload(node);
+		if (ret < 0) {
+			reiser4_drop_io_head(node);
+			return ret;
+		}
+		ret = 1;
+		data = jdata(node);
+		if (i == 0) {
+			struct tx_header *T = (struct tx_header *)data;
+
+			/* this may be a stale tx head of an earlier
+			   transaction, which is caught by its checksum */
+			if (memcmp(T->magic, TX_HEADER_MAGIC,
+				   TX_HEADER_MAGIC_SIZE) != 0 ||
+			    le32_to_cpu(get_unaligned(&T->csum)) != csum)
+				ret = 0;
+			total = le32_to_cpu(get_unaligned(&T->total));
+			block = le64_to_cpu(get_unaligned(&T->next_block));
+		} else {
+			struct wander_record_header *H =
+				(struct wander_record_header *)data;
+
+			if (memcmp(H->magic, WANDER_RECORD_MAGIC,
+				   WANDER_RECORD_MAGIC_SIZE) != 0 &&
+			    memcmp(H->magic, WANDER_RUNS_MAGIC,
+				   WANDER_RECORD_MAGIC_SIZE) != 0)
+				ret = 0;
+			block = le64_to_cpu(get_unaligned(&H->next_block));
+		}
+		if (ret == 1)
+			crc = wander_record_csum(s, crc, data, i == 0);
+		jrelse(node);
+		reiser4_drop_io_head(node);
+		if (ret == 1 && i + 1 < total &&
+		    !reiser4_blocknr_is_sane(&block) &&
+		    !reiser4_is_jdev_block(s, &block))
+			ret = 0;
+	}
+	if (ret == 1 && (block != *tx_block || wander_csum_final(crc) != csum))
+		ret = 0;
+	return ret;
+}
+
 /* fill commit_handler structure by everything what is needed for update_journal_footer */
 static int restore_commit_handle(struct commit_handle *ch, jnode *tx_head)
 {
@@ -1342,36 +2093,166 @@ static int restore_commit_handle(struct commit_handle *ch, jnode *tx_head)
 	return 0;
 }
 
-/* replay one transaction: restore and write overwrite set in place */
-static int replay_transaction(const struct super_block *s,
-			      jnode * tx_head,
-			      const reiser4_block_nr * log_rec_block_p,
-			      const reiser4_block_nr * end_block,
-			      unsigned int nr_wander_records)
+/* release io heads on @head. They are loaded if @loaded is set, otherwise
+   their reads may be still in flight */
+static void drop_replay_list(struct list_head *head, int loaded)
 {
-	reiser4_block_nr log_rec_block = *log_rec_block_p;
-	struct commit_handle ch;
-	LIST_HEAD(overwrite_set);
-	jnode *log;
+	while (!list_empty(head)) {
+		jnode *cur = list_entry(head->next, jnode, capture_link);
+
+		list_del_init(&cur->capture_link);
+		if (loaded || jload(cur) == 0)
+			jrelse(cur);
+		reiser4_drop_io_head(cur);
+	}
+}
+
+typedef int (*wander_pair_actor_f)(const reiser4_block_nr *original,
+				   const reiser4_block_nr *wandered,
+				   void *data);
+
+/* read scalable integer at *@pos, not crossing @end */
+static int read_wander_value(unsigned char **pos, unsigned char *end,
+			     __u64 *value)
+{
+	if (*pos >= end || *pos + dscale_bytes_to_read(*pos) > end)
+		return RETERR(-EIO);
+	*pos += dscale_read(*pos, value);
+	return 0;
+}
+
+/* call @actor for every pair of original and wandered locations stored in
+   wander record @log, which is either ordinary or compact one */
+static int wander_record_iterate(const struct super_block *s, jnode *log,
+				 wander_pair_actor_f actor, void *data)
+{
+	struct wander_record_header *header;
+	struct wander_runs *runs;
+	unsigned char *pos;
+	unsigned char *end;
+	reiser4_block_nr original = 0;
+	reiser4_block_nr wandered = 0;
+	int nr_runs;
 	int ret;
+	int i;
 
-	init_commit_handle(&ch, NULL);
-	ch.overwrite_set = &overwrite_set;
+	header = (struct wander_record_header *)jdata(log);
+	if (memcmp(header->magic, WANDER_RUNS_MAGIC,
+		   WANDER_RECORD_MAGIC_SIZE) != 0) {
+		struct wander_entry *entry = (struct wander_entry *)(header + 1);
 
-	restore_commit_handle(&ch, tx_head);
+		for (i = 0; i < wander_record_capacity(s); i++, entry++) {
+			reiser4_block_nr a;
+			reiser4_block_nr b;
 
-	while (log_rec_block != *end_block) {
-		struct wander_record_header *header;
-		struct wander_entry *entry;
+			b = le64_to_cpu(get_unaligned(&entry->wandered));
+			if (b == 0)
+				break;
+			a = le64_to_cpu(get_unaligned(&entry->original));
+			ret = actor(&a, &b, data);
+			if (ret)
+				return ret;
+		}
+		return 0;
+	}
 
-		int i;
+	runs = (struct wander_runs *)(header + 1);
+	nr_runs = le16_to_cpu(get_unaligned(&runs->nr_runs));
+	pos = (unsigned char *)(runs + 1);
+	end = (unsigned char *)jdata(log) + s->s_blocksize;
+	for (i = 0; i < nr_runs; i++) {
+		__u64 a, b, len, k;
+
+		if (read_wander_value(&pos, end, &a) ||
+		    read_wander_value(&pos, end, &b) ||
+		    read_wander_value(&pos, end, &len) || len == 0) {
+			warning("", "wander record at block %s corrupted\n",
+				sprint_address(jnode_get_block(log)));
+			return RETERR(-EIO);
+		}
+		original = zigzag_decode(a, original);
+		wandered = zigzag_decode(b, wandered);
+		for (k = 0; k < len; k++) {
+			reiser4_block_nr o = original + k;
+			reiser4_block_nr w = wandered + k;
+
+			ret = actor(&o, &w, data);
+			if (ret)
+				return ret;
+		}
+		original += len;
+		wandered += len;
+	}
+	return 0;
+}
+
+/* start reading of wandered block, see read_wander_records() */
+static int start_wandered_read(const reiser4_block_nr *original UNUSED_ARG,
+			       const reiser4_block_nr *wandered, void *data)
+{
+	struct list_head *pending = data;
+	jnode *node;
+
+	node = reiser4_alloc_io_head(wandered);
+	if (node == NULL)
+		return RETERR(-ENOMEM);
+	list_add_tail(&node->capture_link, pending);
+
+	return jstartio(node);
+}
+
+struct restore_params {
+	struct list_head *pending;
+	struct list_head *overwrite_set;
+};
+
+/* move io head of loaded wandered block to overwrite set, see
+   restore_overwrite_set() */
+static int restore_wandered(const reiser4_block_nr *original,
+			    const reiser4_block_nr *wandered, void *data)
+{
+	struct restore_params *params = data;
+	jnode *node;
+	int ret;
+
+	assert("", !list_empty(params->pending));
+	node = list_entry(params->pending->next, jnode, capture_link);
+	assert("", *jnode_get_block(node) == *wandered);
+
+	ret = jload(node);
+	if (ret < 0)
+		return ret;
+	list_move_tail(&node->capture_link, params->overwrite_set);
+
+	assert("zam-603", *original != 0);
+	jnode_set_block(node, original);
+	return 0;
+}
+
+/* load wander records of transaction @tx_head and put them on @logs, start
+   reading of all wandered blocks they refer to and put io heads of those on
+   @pending. The reads are not waited for */
+static int read_wander_records(const struct super_block *s, jnode *tx_head,
+			       struct list_head *logs,
+			       struct list_head *pending)
+{
+	struct tx_header *T = (struct tx_header *)jdata(tx_head);
+	unsigned int nr_wander_records;
+	reiser4_block_nr log_rec_block;
+	jnode *log;
+	int ret;
+
+	nr_wander_records = le32_to_cpu(get_unaligned(&T->total)) - 1;
+	log_rec_block = le64_to_cpu(get_unaligned(&T->next_block));
+
+	while (log_rec_block != *jnode_get_block(tx_head)) {
+		struct wander_record_header *header;
 
 		if (nr_wander_records == 0) {
 			warning("zam-631",
 				"number of wander records in the linked list"
 				" greater than number stored in tx head.\n");
-			ret = RETERR(-EIO);
-			goto free_ow_set;
+			return RETERR(-EIO);
 		}
 
 		log = reiser4_alloc_io_head(&log_rec_block);
@@ -1383,64 +2264,19 @@ static int replay_transaction(const struct super_block *s,
 			reiser4_drop_io_head(log);
 			return ret;
 		}
+		list_add_tail(&log->capture_link, logs);
 
 		ret = check_wander_record(log);
-		if (ret) {
-			jrelse(log);
-			reiser4_drop_io_head(log);
+		if (ret)
 			return ret;
-		}
 
 		header = (struct wander_record_header *)jdata(log);
 		log_rec_block = le64_to_cpu(get_unaligned(&header->next_block));
 
-		entry = (struct wander_entry *)(header + 1);
-
-		/* restore overwrite set from wander record content */
-		for (i = 0; i < wander_record_capacity(s); i++) {
-			reiser4_block_nr block;
-			jnode *node;
-
-			block = le64_to_cpu(get_unaligned(&entry->wandered));
-			if (block == 0)
-				break;
-
-			node = reiser4_alloc_io_head(&block);
-			if (node == NULL) {
-				ret = RETERR(-ENOMEM);
-				/*
-				 * FIXME-VS:???
-				 */
-				jrelse(log);
-				reiser4_drop_io_head(log);
-				goto free_ow_set;
-			}
-
-			ret = jload(node);
-
-			if (ret < 0) {
-				reiser4_drop_io_head(node);
-				/*
-				 * FIXME-VS:???
-				 */
-				jrelse(log);
-				reiser4_drop_io_head(log);
-				goto free_ow_set;
-			}
-
-			block = le64_to_cpu(get_unaligned(&entry->original));
-
-			assert("zam-603", block != 0);
-
-			jnode_set_block(node, &block);
-
-			list_add_tail(&node->capture_link, ch.overwrite_set);
-
-			++entry;
-		}
-
-		jrelse(log);
-		reiser4_drop_io_head(log);
+		ret = wander_record_iterate(s, log, start_wandered_read,
+					    pending);
+		if (ret)
+			return ret;
 
 		--nr_wander_records;
 	}
@@ -1448,122 +2284,151 @@ static int replay_transaction(const struct super_block *s,
 	if (nr_wander_records != 0) {
 		warning("zam-632", "number of wander records in the linked list"
 			" less than number stored in tx head.\n");
-		ret = RETERR(-EIO);
-		goto free_ow_set;
+		return RETERR(-EIO);
 	}
+	return 0;
+}
 
-	{			/* write wandered set in place */
-		write_jnode_list(ch.overwrite_set, NULL, NULL, 0);
-		ret = wait_on_jnode_list(ch.overwrite_set);
+/* wait for the reads started by read_wander_records(), move io heads from
+   @pending to @overwrite_set and assign them their original locations */
+static int restore_overwrite_set(const struct super_block *s,
+				 struct list_head *logs,
+				 struct list_head *pending,
+				 struct list_head *overwrite_set)
+{
+	struct restore_params params;
+	jnode *log;
+	int ret;
 
-		if (ret) {
-			ret = RETERR(-EIO);
-			goto free_ow_set;
-		}
+	params.pending = pending;
+	params.overwrite_set = overwrite_set;
+	list_for_each_entry(log, logs, capture_link) {
+		ret = wander_record_iterate(s, log, restore_wandered, &params);
+		if (ret)
+			return ret;
 	}
+	assert("", list_empty(pending));
+	return 0;
+}
 
-	ret = update_journal_footer(&ch);
-
-      free_ow_set:
+/* Blocks modified by several replayed transactions are written once, with
+   the content logged by the newest of them. @overwrite_set is built in
+   commit order and list_sort() is stable, so the last one of the nodes with
+   equal block numbers wins. */
+static void drop_overwritten(struct list_head *overwrite_set)
+{
+	jnode *cur;
+	jnode *next;
 
-	while (!list_empty(ch.overwrite_set)) {
-		jnode *cur = list_entry(ch.overwrite_set->next, jnode, capture_link);
+	sort_jnode_list(overwrite_set);
+	list_for_each_entry_safe(cur, next, overwrite_set, capture_link) {
+		if (&next->capture_link == overwrite_set ||
+		    *jnode_get_block(cur) != *jnode_get_block(next))
+			continue;
 		list_del_init(&cur->capture_link);
 		jrelse(cur);
 		reiser4_drop_io_head(cur);
 	}
-
-	list_del_init(&tx_head->capture_link);
-
-	done_commit_handle(&ch);
-
-	return ret;
 }
 
-/* find oldest committed and not played transaction and play it. The transaction
- * was committed and journal header block was updated but the blocks from the
- * process of writing the atom's overwrite set in-place and updating of journal
- * footer block were not completed. This function completes the process by
- * recovering the atom's overwrite set from their wandered locations and writes
- * them in-place and updating the journal footer. */
-static int replay_oldest_transaction(struct super_block *s)
+/* Replay all committed and not played transactions. The transactions were
+ * committed and journal header block was updated but the process of writing
+ * the atoms' overwrite sets in-place and updating of journal footer block was
+ * not completed. This function completes the process by recovering the
+ * overwrite sets from their wandered locations, writing them in-place and
+ * updating the journal footer.
+ *
+ * Only the chain of tx heads is read synchronously. Reads of wandered blocks
+ * of all transactions are started as soon as their wander records are
+ * parsed, the in-place writes are submitted in one batch, and the journal
+ * footer is written once, pointing to the newest transaction. If replay is
+ * interrupted, the footer still points to the oldest transaction, and
+ * everything is replayed again. */
+static int replay_committed_transactions(struct super_block *s,
+					 const reiser4_block_nr *last_flushed_tx,
+					 int *nr_tx_replayed)
 {
 	reiser4_super_info_data *sbinfo = get_super_private(s);
-	jnode *jf = sbinfo->journal_footer;
-	unsigned int total;
-	struct journal_footer *F;
-	struct tx_header *T;
-
+	struct commit_handle ch;
+	LIST_HEAD(tx_heads);
+	LIST_HEAD(logs);
+	LIST_HEAD(pending);
+	LIST_HEAD(overwrite_set);
+	struct blk_plug plug;
 	reiser4_block_nr prev_tx;
-	reiser4_block_nr last_flushed_tx;
-	reiser4_block_nr log_rec_block = 0;
-
 	jnode *tx_head;
+	int ret = 0;
 
-	int ret;
-
-	if ((ret = jload(jf)) < 0)
-		return ret;
-
-	F = (struct journal_footer *)jdata(jf);
-
-	last_flushed_tx = le64_to_cpu(get_unaligned(&F->last_flushed_tx));
-
-	jrelse(jf);
-
-	if (sbinfo->last_committed_tx == last_flushed_tx) {
+	*nr_tx_replayed = 0;
+	if (sbinfo->last_committed_tx == *last_flushed_tx) {
 		/* all transactions are replayed */
 		return 0;
 	}
 
+	/* collect not flushed transactions, the oldest one first */
 	prev_tx = sbinfo->last_committed_tx;
-
-	/* searching for oldest not flushed transaction */
-	while (1) {
+	while (prev_tx != *last_flushed_tx) {
 		tx_head = reiser4_alloc_io_head(&prev_tx);
-		if (!tx_head)
-			return RETERR(-ENOMEM);
+		if (!tx_head) {
+			ret = RETERR(-ENOMEM);
+			goto out;
+		}
 
 		ret = jload(tx_head);
 		if (ret < 0) {
 			reiser4_drop_io_head(tx_head);
-			return ret;
+			goto out;
 		}
+		list_add(&tx_head->capture_link, &tx_heads);
 
 		ret = check_tx_head(tx_head);
-		if (ret) {
-			jrelse(tx_head);
-			reiser4_drop_io_head(tx_head);
-			return ret;
-		}
-
-		T = (struct tx_header *)jdata(tx_head);
+		if (ret)
+			goto out;
 
-		prev_tx = le64_to_cpu(get_unaligned(&T->prev_tx));
+		prev_tx = le64_to_cpu(get_unaligned(
+			&((struct tx_header *)jdata(tx_head))->prev_tx));
+	}
 
-		if (prev_tx == last_flushed_tx)
+	blk_start_plug(&plug);
+	list_for_each_entry(tx_head, &tx_heads, capture_link) {
+		ret = read_wander_records(s, tx_head, &logs, &pending);
+		if (ret)
 			break;
-
-		jrelse(tx_head);
-		reiser4_drop_io_head(tx_head);
+		++*nr_tx_replayed;
 	}
+	blk_finish_plug(&plug);
+	if (ret)
+		goto out;
 
-	total = le32_to_cpu(get_unaligned(&T->total));
-	log_rec_block = le64_to_cpu(get_unaligned(&T->next_block));
-
-	pin_jnode_data(tx_head);
-	jrelse(tx_head);
+	ret = restore_overwrite_set(s, &logs, &pending, &overwrite_set);
+	if (ret)
+		goto out;
+	drop_overwritten(&overwrite_set);
 
-	ret =
-	    replay_transaction(s, tx_head, &log_rec_block,
-			       jnode_get_block(tx_head), total - 1);
+	/* write overwrite sets in place */
+	write_jnode_list(&overwrite_set, NULL, NULL, 0);
+	if (wait_on_jnode_list(&overwrite_set)) {
+		ret = RETERR(-EIO);
+		goto out;
+	}
 
-	unpin_jnode_data(tx_head);
+	init_commit_handle(&ch, NULL);
+	ch.overwrite_set = &overwrite_set;
+	tx_head = list_entry(tx_heads.prev, jnode, capture_link);
+	list_del_init(&tx_head->capture_link);
+	/* tx head is loaded, restore_commit_handle() cannot fail */
+	check_me("", restore_commit_handle(&ch, tx_head) == 0);
+	ret = update_journal_footer(&ch);
+	list_del_init(&tx_head->capture_link);
+	jrelse(tx_head);
 	reiser4_drop_io_head(tx_head);
-
-	if (ret)
-		return ret;
-	return -E_REPEAT;
+	done_commit_handle(&ch);
+ out:
+	drop_replay_list(&overwrite_set, 1);
+	drop_replay_list(&pending, 0);
+	drop_replay_list(&logs, 1);
+	drop_replay_list(&tx_heads, 1);
+	return ret;
 }
 
 /* The reiser4 journal current implementation was optimized to not to capture
@@ -1618,6 +2483,10 @@ int reiser4_journal_replay(struct super_block *s)
 	reiser4_super_info_data *sbinfo = get_super_private(s);
 	jnode *jh, *jf;
 	struct journal_header *header;
+	struct journal_footer *footer;
+	reiser4_block_nr last_flushed_tx;
+	reiser4_block_nr prev_committed_tx;
+	__u32 tx_csum;
 	int nr_tx_replayed = 0;
 	int ret;
 
@@ -1647,6 +2516,9 @@ int reiser4_journal_replay(struct super_block *s)
 		return ret;
 	}
 
+	footer = (struct journal_footer *)jdata(jf);
+	last_flushed_tx = le64_to_cpu(get_unaligned(&footer->last_flushed_tx));
+
 	jrelse(jf);
 
 	/* store last committed transaction info in reiser4 in-memory super
@@ -1663,14 +2535,28 @@ int reiser4_journal_replay(struct super_block *s)
 
 	header = (struct journal_header *)jdata(jh);
 	sbinfo->last_committed_tx = le64_to_cpu(get_unaligned(&header->last_committed_tx));
+	prev_committed_tx = le64_to_cpu(get_unaligned(&header->prev_committed_tx));
+	tx_csum = le32_to_cpu(get_unaligned(&header->tx_csum));
 
 	jrelse(jh);
 
-	/* replay committed transactions */
-	while ((ret = replay_oldest_transaction(s)) == -E_REPEAT)
-		nr_tx_replayed++;
+	if (tx_csum != 0 && sbinfo->last_committed_tx != last_flushed_tx) {
+		/* async commit: journal header might get to the disk before
+		   the wander records */
+		ret = check_tx_csum(s, &sbinfo->last_committed_tx, tx_csum);
+		if (ret < 0)
+			return ret;
+		if (ret == 0) {
+			warning("", "incomplete transaction at block %s "
+				"discarded",
+				sprint_address(&sbinfo->last_committed_tx));
+			sbinfo->last_committed_tx = prev_committed_tx;
+		}
+	}
 
-	return ret;
+	/* replay committed transactions */
+	return replay_committed_transactions(s, &last_flushed_tx,
+					     &nr_tx_replayed);
 }
 
 /* load journal control block (either journal header or journal footer block) */
@@ -1716,7 +2602,69 @@ void reiser4_done_journal_info(struct super_block *s)
 
 	unload_journal_control_block(&sbinfo->journal_header);
 	unload_journal_control_block(&sbinfo->journal_footer);
-	rcu_barrier();
+	reiser4_rcu_barrier();
+}
+
+/* true if journal header and footer at @loc say that all committed
+   transactions are played */
+static int journal_is_empty(const journal_location *loc)
+{
+	jnode *jh;
+	jnode *jf;
+	int ret;
+
+	ret = load_journal_control_block(&jh, &loc->header);
+	if (ret)
+		return ret;
+	ret = load_journal_control_block(&jf, &loc->footer);
+	if (ret == 0) {
+		ret = jload(jh);
+		if (ret == 0) {
+			ret = jload(jf);
+			if (ret == 0) {
+				struct journal_header *H;
+				struct journal_footer *F;
+
+				H = (struct journal_header *)jdata(jh);
+				F = (struct journal_footer *)jdata(jf);
+
+				ret = get_unaligned(&H->last_committed_tx) ==
+					get_unaligned(&F->last_flushed_tx);
+				jrelse(jf);
+			}
+			jrelse(jh);
+		}
+		unload_journal_control_block(&jf);
+	}
+	unload_journal_control_block(&jh);
+	return ret;
+}
+
+/* move journal control blocks to the external journal device. It is
+   formatted if it is used for the first time */
+static int attach_journal_device(struct super_block *s, journal_location *loc)
+{
+	int ret;
+
+	ret = reiser4_jdev_attach(s);
+	if (ret < 0)
+		return ret;
+	if (ret == 1) {
+		ret = journal_is_empty(loc);
+		if (ret < 0)
+			return ret;
+		if (ret == 0) {
+			warning("", "%s: journal has to be replayed before "
+				"journal device is used", s->s_id);
+			return RETERR(-EINVAL);
+		}
+		ret = reiser4_jdev_format(s);
+		if (ret)
+			return ret;
+	}
+	loc->header = REISER4_JDEV_BASE + REISER4_JDEV_HEADER_BLOCKNR;
+	loc->footer = REISER4_JDEV_BASE + REISER4_JDEV_FOOTER_BLOCKNR;
+	return 0;
 }
 
 /* load journal control blocks */
@@ -1732,6 +2680,12 @@ int reiser4_init_journal_info(struct super_block *s)
 	assert("zam-652", loc->header != 0);
 	assert("zam-653", loc->footer != 0);
 
+	if (sbinfo->jdev != NULL) {
+		ret = attach_journal_device(s, loc);
+		if (ret)
+			return ret;
+	}
+
 	ret = load_journal_control_block(&sbinfo->journal_header, &loc->header);
 
 	if (ret)
@@ -11,6 +11,8 @@
 
 #define TX_HEADER_MAGIC  "TxMagic4"
 #define WANDER_RECORD_MAGIC "LogMagc4"
+/* wander record which stores runs of blocks, see struct wander_runs */
+#define WANDER_RUNS_MAGIC "LogRuns4"
 
 #define TX_HEADER_MAGIC_SIZE  (8)
 #define WANDER_RECORD_MAGIC_SIZE (8)
@@ -19,6 +21,16 @@
 struct journal_header {
 	/* last written transaction head location */
 	d64 last_committed_tx;
+
+	/* The fields below are used by async_commit mode only, they are zero
+	   otherwise. Journal header is written there together with the wander
+	   records, so the transaction it points to may be incomplete after a
+	   crash. */
+
+	/* transaction head location before last_committed_tx was written */
+	d64 prev_committed_tx;
+	/* checksum of last committed transaction, copy of tx_header->csum */
+	d32 tx_csum;
 };
 
 typedef struct journal_location {
@@ -82,8 +94,10 @@ struct tx_header {
 	   transaction */
 	d32 total;
 
-	/* align next field to 8-byte boundary; this field always is zero */
-	d32 padding;
+	/* crc32c of all wander records of the transaction including this
+	   one (computed with this field set to zero). Zero if the transaction
+	   was committed without async_commit mount option */
+	d32 csum;
 
 	/* block number of previous transaction head */
 	d64 prev_tx;
@@ -110,6 +124,16 @@ struct wander_entry {
 	d64 wandered;		/* block wandered location */
 };
 
+/* Compact wander record (WANDER_RUNS_MAGIC) has struct wander_runs after the
+   header, followed by @nr_runs triples of scalable integers (see dscale.c):
+   original location, wandered location and length of a run of blocks which
+   are adjacent at both locations. Locations are stored as zigzag encoded
+   differences with the end of the previous run in the same record (0 for the
+   first one). */
+struct wander_runs {
+	d16 nr_runs;
+};
+
 /* REISER4 JOURNAL WRITER FUNCTIONS   */
 
 extern int reiser4_write_logs(long *);
@@ -120,6 +144,7 @@ extern int reiser4_init_journal_info(struct super_block *);
 extern void reiser4_done_journal_info(struct super_block *);
 
 extern int write_jnode_list(struct list_head *, flush_queue_t *, long *, int);
+extern void sort_jnode_list(struct list_head *);
 
 #endif				/* __FS_REISER4_WANDER_H__ */
 
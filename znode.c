@@ -154,16 +154,21 @@
 #include "tree_walk.h"
 #include "super.h"
 #include "reiser4.h"
+#include "magazine.h"
 
 #include <linux/pagemap.h>
 #include <linux/spinlock.h>
 #include <linux/slab.h>
 #include <linux/err.h>
+#include <linux/hash.h>
+#include <linux/vmalloc.h>
 
 static z_hash_table *get_htable(reiser4_tree *,
 				const reiser4_block_nr * const blocknr);
 static z_hash_table *znode_get_htable(const znode *);
 static void zdrop(znode *);
+static void zuncache_child(znode *);
+static void zchildren_done(znode *);
 
 /* hash table support */
 
@@ -184,7 +189,18 @@ blknrhashfn(z_hash_table * table, const reiser4_block_nr * b)
 {
 	assert("nikita-536", b != NULL);
 
-	return *b & (REISER4_ZNODE_HASH_TABLE_SIZE - 1);
+	/* table can be resized under RCU readers, read its size once */
+	return hash_64(*b, 32) & (READ_ONCE(table->_buckets) - 1);
+}
+
+/* lock serializing insertions into the buckets of both znode hash tables
+   @blocknr can hash to. As tables have at least REISER4_ZHASH_STRIPES
+   buckets, same bucket means same stripe whatever the size of the table */
+static inline spinlock_t *zhash_stripe(reiser4_tree * tree,
+				       const reiser4_block_nr * blocknr)
+{
+	return &tree->zhash_stripe[hash_64(*blocknr, 32) &
+				   (REISER4_ZHASH_STRIPES - 1)];
 }
 
 /* The hash table definition */
@@ -195,8 +211,205 @@ TYPE_SAFE_HASH_DEFINE(z, znode, reiser4_block_nr, zjnode.key.z, zjnode.link.z,
 #undef KFREE
 #undef KMALLOC
 
+/* schedule growth of @table if it got overloaded. Called with tree lock held
+ * after insertion */
+static inline void check_htable_load(reiser4_tree *tree, z_hash_table *table)
+{
+	if (unlikely(z_hash_overloaded(table, REISER4_HASH_MAX_LOAD) &&
+		     table->_buckets < REISER4_HASH_MAX_BUCKETS))
+		schedule_work(&tree->hash_resize);
+}
+
+/* double the number of buckets of @table if it is overloaded */
+static void grow_htable(reiser4_tree *tree, z_hash_table *table)
+{
+	znode **new_table;
+	znode **old_table;
+	__u32 buckets;
+
+	/* only this function changes the size, and it is serialized by the
+	 * work queue */
+	if (!z_hash_overloaded(table, REISER4_HASH_MAX_LOAD) ||
+	    table->_buckets >= REISER4_HASH_MAX_BUCKETS)
+		return;
+	buckets = table->_buckets * 2;
+	new_table = __vmalloc(sizeof(znode *) * buckets,
+			      GFP_NOFS | __GFP_NOWARN | __GFP_ZERO);
+	if (new_table == NULL)
+		return;
+	/* there is no reiser4 context here, lock counters are not updated */
+	write_lock(&tree->tree_lock);
+	old_table = z_hash_rehash(table, new_table, buckets);
+	write_unlock(&tree->tree_lock);
+	/* wait for lookups walking the old array */
+	synchronize_rcu();
+	vfree(old_table);
+}
+
+/**
+ * znodes_tree_grow - grow overloaded znode hash tables
+ * @tree: tree whose tables to grow
+ *
+ * This is called from the tree's hash_resize work, scheduled when insertion
+ * makes the average chain longer than REISER4_HASH_MAX_LOAD.
+ */
+void znodes_tree_grow(reiser4_tree * tree)
+{
+	grow_htable(tree, &tree->zhash_table);
+	grow_htable(tree, &tree->zfake_table);
+}
+
+/**
+ * znodes_tree_stat - collect chain length statistics of znode hash tables
+ * @tree: tree to look at
+ * @real: statistics of the table of znodes with real block numbers
+ * @fake: statistics of the table of znodes with fake block numbers
+ */
+void znodes_tree_stat(reiser4_tree * tree, struct hash_chain_stat *real,
+		      struct hash_chain_stat *fake)
+{
+	/* called from debugfs, there is no reiser4 context */
+	read_lock(&tree->tree_lock);
+	z_hash_stat(&tree->zhash_table, real);
+	z_hash_stat(&tree->zfake_table, fake);
+	read_unlock(&tree->tree_lock);
+}
+
+/*
+ * Znode shrinker.
+ *
+ * A znode without page is freed by zput() as soon as it has no references and
+ * no children in memory. But a znode whose page was released while children
+ * were still cached stays in the hash table after the last child goes away:
+ * nothing references it to release it. On a large tree such znodes pile up
+ * until unmount. The shrinker walks buckets of the znode hash table starting
+ * where the previous scan stopped, takes a reference to every idle znode it
+ * finds, and drops the references, so that zput() frees them the usual way.
+ */
+
+/* number of znodes released at once by znode shrinker */
+#define ZNODE_SHRINK_BATCH 32
+
+/* true if nothing keeps @node in memory. Checked under tree lock, jnode lock
+ * is not taken, so this is a hint: jnode_try_drop() re-checks under locks */
+static int znode_is_idle(znode * node)
+{
+	return atomic_read(&ZJNODE(node)->x_count) == 0 &&
+		atomic_read(&node->c_count) == 0 &&
+		jnode_page(ZJNODE(node)) == NULL &&
+		!ZF_ISSET(node, JNODE_RIP) &&
+		!ZF_ISSET(node, JNODE_HEARD_BANSHEE);
+}
+
+/* reference up to @nr idle znodes of @tree, looking at no more than
+ * @nr_to_scan of them */
+static int grab_idle_znodes(reiser4_tree * tree, znode ** batch, int nr,
+			    unsigned long *nr_to_scan)
+{
+	z_hash_table *table = &tree->zhash_table;
+	znode *node;
+	znode *next;
+	__u32 i;
+	int found = 0;
+
+	read_lock_tree(tree);
+	for (i = 0; i < table->_buckets && found < nr && *nr_to_scan != 0;
+	     i++) {
+		__u32 bucket = tree->zshrink_cursor++ & (table->_buckets - 1);
+
+		for_all_in_bucket(&table->_table[bucket], node, next,
+				  zjnode.link.z) {
+			if (*nr_to_scan != 0)
+				--*nr_to_scan;
+			if (!znode_is_idle(node))
+				continue;
+			/* tree lock is held, so nobody has passed the busy
+			 * check of jnode_try_drop() for this hashed znode */
+			zref(node);
+			batch[found++] = node;
+			if (found == nr)
+				break;
+		}
+	}
+	read_unlock_tree(tree);
+	return found;
+}
+
+static unsigned long znode_shrink_count(struct shrinker *shrink,
+					struct shrink_control *sc)
+{
+	reiser4_super_info_data *sbinfo;
+	unsigned long hashed;
+	unsigned long cached;
+
+	sbinfo = container_of(shrink, reiser4_super_info_data, znode_shrinker);
+	/* nodes with pages are released together with their pages */
+	hashed = atomic_read(&sbinfo->tree.zhash_table._count);
+	cached = READ_ONCE(sbinfo->fake->i_mapping->nrpages);
+	return hashed > cached ? hashed - cached : 0;
+}
+
+static unsigned long znode_shrink_scan(struct shrinker *shrink,
+				       struct shrink_control *sc)
+{
+	reiser4_super_info_data *sbinfo;
+	reiser4_context ctx;
+	znode *batch[ZNODE_SHRINK_BATCH];
+	unsigned long nr_to_scan = sc->nr_to_scan;
+	unsigned long freed = 0;
+	int found;
+	int i;
+
+	/* do not recurse into reiser4 from reclaim done by reiser4 itself */
+	if (!(sc->gfp_mask & __GFP_FS) || current->journal_info != NULL)
+		return SHRINK_STOP;
+
+	sbinfo = container_of(shrink, reiser4_super_info_data, znode_shrinker);
+	init_stack_context(&ctx, sbinfo->tree.super);
+	while (nr_to_scan != 0) {
+		found = grab_idle_znodes(&sbinfo->tree, batch,
+					 ZNODE_SHRINK_BATCH, &nr_to_scan);
+		if (found == 0)
+			break;
+		for (i = 0; i < found; i++)
+			/* this frees the znode, unless somebody looked it up
+			 * meanwhile */
+			zput(batch[i]);
+		freed += found;
+		cond_resched();
+	}
+	reiser4_exit_context(&ctx);
+	atomic_long_add(freed, &sbinfo->tree.nr_znodes_shrunk);
+	return freed;
+}
+
+/**
+ * reiser4_init_znode_shrinker - register shrinker of idle znodes
+ * @super: super block being mounted
+ */
+int reiser4_init_znode_shrinker(struct super_block *super)
+{
+	struct shrinker *shrinker = &get_super_private(super)->znode_shrinker;
+
+	shrinker->count_objects = znode_shrink_count;
+	shrinker->scan_objects = znode_shrink_scan;
+	shrinker->seeks = DEFAULT_SEEKS;
+	return register_shrinker(shrinker);
+}
+
+/**
+ * reiser4_done_znode_shrinker - unregister shrinker of idle znodes
+ * @super: super block being unmounted
+ *
+ * This is called before the tree is released.
+ */
+void reiser4_done_znode_shrinker(struct super_block *super)
+{
+	unregister_shrinker(&get_super_private(super)->znode_shrinker);
+}
+
 /* slab for znodes */
-static struct kmem_cache *znode_cache;
+static reiser4_mag_cache znode_cache;
 
 int znode_shift_order;
 
@@ -207,11 +420,13 @@ int znode_shift_order;
  */
 int init_znodes(void)
 {
-	znode_cache = kmem_cache_create("znode", sizeof(znode), 0,
+	int result;
+
+	result = reiser4_init_mag_cache(&znode_cache, "znode", sizeof(znode),
 					SLAB_HWCACHE_ALIGN |
-					SLAB_RECLAIM_ACCOUNT, NULL);
-	if (znode_cache == NULL)
-		return RETERR(-ENOMEM);
+					SLAB_RECLAIM_ACCOUNT);
+	if (result != 0)
+		return result;
 
 	for (znode_shift_order = 0; (1 << znode_shift_order) < sizeof(znode);
 	     ++znode_shift_order);
@@ -226,16 +441,20 @@ int init_znodes(void)
  */
 void done_znodes(void)
 {
-	destroy_reiser4_cache(&znode_cache);
+	reiser4_done_mag_cache(&znode_cache);
 }
 
 /* call this to initialise tree of znodes */
 int znodes_tree_init(reiser4_tree * tree /* tree to initialise znodes for */ )
 {
 	int result;
+	int i;
 	assert("umka-050", tree != NULL);
 
+	BUILD_BUG_ON(REISER4_ZHASH_STRIPES > REISER4_ZNODE_HASH_TABLE_SIZE);
 	rwlock_init(&tree->dk_lock);
+	for (i = 0; i < REISER4_ZHASH_STRIPES; i++)
+		spin_lock_init(&tree->zhash_stripe[i]);
 
 	result = z_hash_init(&tree->zhash_table, REISER4_ZNODE_HASH_TABLE_SIZE);
 	if (result != 0)
@@ -259,9 +478,12 @@ void zfree(znode * node /* znode to free */ )
 	assert("nikita-3295", node->left == NULL);
 	assert("nikita-3296", node->right == NULL);
 
+	assert("", node->children == NULL);
+	assert("", node->cached_in == NULL);
+
 	/* not yet phash_jnode_destroy(ZJNODE(node)); */
 
-	kmem_cache_free(znode_cache, node);
+	reiser4_mag_free(&znode_cache, node);
 }
 
 /* call this to free tree of znodes */
@@ -280,7 +502,7 @@ void znodes_tree_done(reiser4_tree * tree /* tree to finish with znodes of */ )
 
 	if (ztable->_table != NULL) {
 		for_all_in_htable(ztable, z, node, next) {
-			node->c_count = 0;
+			atomic_set(&node->c_count, 0);
 			node->in_parent.node = NULL;
 			assert("nikita-2179", atomic_read(&ZJNODE(node)->x_count) == 0);
 			zdrop(node);
@@ -293,7 +515,7 @@ void znodes_tree_done(reiser4_tree * tree /* tree to finish with znodes of */ )
 
 	if (ztable->_table != NULL) {
 		for_all_in_htable(ztable, z, node, next) {
-			node->c_count = 0;
+			atomic_set(&node->c_count, 0);
 			node->in_parent.node = NULL;
 			assert("nikita-2179", atomic_read(&ZJNODE(node)->x_count) == 0);
 			zdrop(node);
@@ -310,7 +532,7 @@ znode *zalloc(gfp_t gfp_flag /* allocation flag */ )
 {
 	znode *node;
 
-	node = kmem_cache_alloc(znode_cache, gfp_flag);
+	node = reiser4_mag_alloc(&znode_cache, gfp_flag);
 	return node;
 }
 
@@ -329,6 +551,7 @@ void zinit(znode * node, const znode * parent, reiser4_tree * tree)
 
 	jnode_init(&node->zjnode, tree, JNODE_FORMATTED_BLOCK);
 	reiser4_init_lock(&node->lock);
+	seqcount_init(&node->dk_seq);
 	init_parent_coord(&node->in_parent, parent);
 }
 
@@ -339,17 +562,22 @@ void zinit(znode * node, const znode * parent, reiser4_tree * tree)
 void znode_remove(znode * node /* znode to remove */ , reiser4_tree * tree)
 {
 	assert("nikita-2108", node != NULL);
-	assert("nikita-470", node->c_count == 0);
+	assert("nikita-470", atomic_read(&node->c_count) == 0);
 	assert_rw_write_locked(&(tree->tree_lock));
 
 	/* remove reference to this znode from cbk cache */
 	cbk_cache_invalidate(node, tree);
+	/* and from children cache of parent */
+	zuncache_child(node);
+	if (node->children != NULL)
+		zchildren_done(node);
 
 	/* update c_count of parent */
 	if (znode_parent(node) != NULL) {
-		assert("nikita-472", znode_parent(node)->c_count > 0);
+		assert("nikita-472",
+		       atomic_read(&znode_parent(node)->c_count) > 0);
 		/* father, onto your hands I forward my spirit... */
-		znode_parent(node)->c_count--;
+		atomic_dec(&znode_parent(node)->c_count);
 		node->in_parent.node = NULL;
 	} else {
 		/* orphaned znode?! Root? */
@@ -385,6 +613,7 @@ int znode_rehash(znode * node /* node to rehash */ ,
 	newtable = get_htable(tree, new_block_nr);
 
 	write_lock_tree(tree);
+	zuncache_child(node);
 	/* remove znode from hash-table */
 	z_hash_remove_rcu(oldtable, node);
 
@@ -397,6 +626,7 @@ int znode_rehash(znode * node /* node to rehash */ ,
 
 	/* insert it into hash */
 	z_hash_insert_rcu(newtable, node);
+	check_htable_load(tree, newtable);
 	write_unlock_tree(tree);
 	return 0;
 }
@@ -412,17 +642,15 @@ int znode_rehash(znode * node /* node to rehash */ ,
 znode *zlook(reiser4_tree * tree, const reiser4_block_nr * const blocknr)
 {
 	znode *result;
-	__u32 hash;
 	z_hash_table *htable;
 
 	assert("jmacd-506", tree != NULL);
 	assert("jmacd-507", blocknr != NULL);
 
 	htable = get_htable(tree, blocknr);
-	hash = blknrhashfn(htable, blocknr);
 
 	rcu_read_lock();
-	result = z_hash_find_index(htable, hash, blocknr);
+	result = z_hash_find_rcu(htable, blocknr);
 
 	if (result != NULL) {
 		add_x_ref(ZJNODE(result));
@@ -433,6 +661,180 @@ znode *zlook(reiser4_tree * tree, const reiser4_block_nr * const blocknr)
 	return result;
 }
 
+/* zlook_rcu() - find znode in a hash table without taking a reference
+
+   Caller holds rcu_read_lock() and may look at the returned znode only until
+   rcu_read_unlock(). Znodes being removed from the tree are not returned.
+*/
+znode *zlook_rcu(reiser4_tree * tree, const reiser4_block_nr * const blocknr)
+{
+	znode *result;
+
+	result = z_hash_find_rcu(get_htable(tree, blocknr), blocknr);
+	if (result != NULL && ZF_ISSET(result, JNODE_RIP))
+		result = NULL;
+	return result;
+}
+
+/* CHILDREN CACHE
+
+   child_znode() resolves block number of an internal item into the child
+   znode. Once resolved, the child is remembered in the children cache of
+   the parent, in the slot of the item position, so that the next lookups
+   through the same item dereference a pointer rather than probe the hash
+   table.
+
+   Slots hold no references. A znode is in one slot at most, the one its
+   ->cached_in points to, so that znode_remove() and znode_rehash() clear
+   it. Removal of the parent clears ->cached_in of the children it caches.
+   Items shift in the parent, so a slot is checked against the block number
+   of the item before use, and emptied when stale. Slots are read under
+   rcu_read_lock() by the owners of the parent lock, which keeps parent and
+   its cache alive and the parent from being removed.
+*/
+
+struct child_cache {
+	unsigned int size;
+	znode *slot[];
+};
+
+static znode **child_slot(znode * parent, pos_in_node_t pos)
+{
+	struct child_cache *cache = READ_ONCE(parent->children);
+
+	if (cache == NULL || pos >= cache->size)
+		return NULL;
+	return &cache->slot[pos];
+}
+
+/* empty @slot if it caches @node */
+static void zevict_child(znode ** slot, znode * node)
+{
+	if (cmpxchg(slot, node, NULL) == node)
+		WRITE_ONCE(node->cached_in, NULL);
+}
+
+/* remove @node from children cache of its parent */
+static void zuncache_child(znode * node)
+{
+	znode **slot = READ_ONCE(node->cached_in);
+
+	if (slot != NULL)
+		zevict_child(slot, node);
+}
+
+/* release children cache of @node being removed */
+static void zchildren_done(znode * node)
+{
+	struct child_cache *cache = node->children;
+	unsigned int i;
+
+	assert_rw_write_locked(&(znode_get_tree(node)->tree_lock));
+
+	for (i = 0; i < cache->size; i++) {
+		znode *child = cache->slot[i];
+
+		if (child != NULL)
+			zevict_child(&cache->slot[i], child);
+	}
+	node->children = NULL;
+	kfree(cache);
+}
+
+/**
+ * zlook_child - find child in children cache of parent
+ * @parent: locked parent
+ * @pos: position of internal item in @parent
+ * @blocknr: block number the item points to
+ *
+ * Returns referenced child with block number @blocknr if it is cached in
+ * the slot of @pos, NULL otherwise.
+ */
+znode *zlook_child(znode * parent, pos_in_node_t pos,
+		   const reiser4_block_nr * const blocknr)
+{
+	znode **slot;
+	znode *child;
+
+	assert("", znode_is_any_locked(parent));
+
+	slot = child_slot(parent, pos);
+	if (slot == NULL)
+		return NULL;
+
+	rcu_read_lock();
+	child = READ_ONCE(*slot);
+	if (child != NULL) {
+		if (disk_addr_eq(znode_get_block(child), blocknr) &&
+		    znode_get_level(child) + 1 == znode_get_level(parent)) {
+			add_x_ref(ZJNODE(child));
+			child = znode_rip_check(znode_get_tree(parent), child);
+		} else {
+			/* items of parent were shifted */
+			zevict_child(slot, child);
+			child = NULL;
+		}
+	}
+	rcu_read_unlock();
+
+	if (child != NULL &&
+	    unlikely(!disk_addr_eq(znode_get_block(child), blocknr))) {
+		/* relocated meanwhile */
+		zput(child);
+		child = NULL;
+	}
+	return child;
+}
+
+/**
+ * zcache_child - put child into children cache of parent
+ * @parent: locked parent
+ * @pos: position of internal item in @parent
+ * @child: referenced child the item points to
+ */
+void zcache_child(znode * parent, pos_in_node_t pos, znode * child)
+{
+	struct child_cache *cache;
+	znode **slot;
+	znode **cached;
+
+	assert("", znode_is_any_locked(parent));
+
+	if (unlikely(ZF_ISSET(parent, JNODE_HEARD_BANSHEE)) ||
+	    znode_get_level(child) + 1 != znode_get_level(parent))
+		return;
+	cache = READ_ONCE(parent->children);
+	if (cache == NULL) {
+		/* leave room for items inserted later */
+		unsigned int size = parent->nr_items + parent->nr_items / 2 + 1;
+
+		cache = kzalloc(struct_size(cache, slot, size),
+				reiser4_ctx_gfp_mask_get() | __GFP_NOWARN);
+		if (cache == NULL)
+			return;
+		cache->size = size;
+		if (cmpxchg(&parent->children, NULL, cache) != NULL) {
+			kfree(cache);
+			cache = READ_ONCE(parent->children);
+		}
+	}
+	if (pos >= cache->size)
+		return;
+	slot = &cache->slot[pos];
+	cached = READ_ONCE(child->cached_in);
+	if (cached == slot)
+		return;
+	if (cached != NULL && cached >= cache->slot &&
+	    cached < cache->slot + cache->size)
+		/* cached at old position of the item */
+		zevict_child(cached, child);
+	if (cmpxchg(&child->cached_in, NULL, slot) != NULL)
+		/* cached by another parent */
+		return;
+	if (cmpxchg(slot, NULL, child) != NULL)
+		WRITE_ONCE(child->cached_in, NULL);
+}
+
 /* return hash table where znode with block @blocknr is (or should be)
  * stored */
 static z_hash_table *get_htable(reiser4_tree * tree,
@@ -458,7 +860,7 @@ static z_hash_table *znode_get_htable(const znode * node)
    exists.  If znode is not found, allocate new one and return.  Result
    is returned with x_count reference increased.
 
-   LOCKS TAKEN:   TREE_LOCK, ZNODE_LOCK
+   LOCKS TAKEN:   TREE_LOCK (read), ZHASH STRIPE LOCK
    LOCK ORDERING: NONE
 */
 znode *zget(reiser4_tree * tree,
@@ -466,7 +868,6 @@ znode *zget(reiser4_tree * tree,
 	    znode * parent, tree_level level, gfp_t gfp_flag)
 {
 	znode *result;
-	__u32 hashi;
 
 	z_hash_table *zth;
 
@@ -475,18 +876,15 @@ znode *zget(reiser4_tree * tree,
 	assert("jmacd-514", level < REISER4_MAX_ZTREE_HEIGHT);
 
 	zth = get_htable(tree, blocknr);
-	hashi = blknrhashfn(zth, blocknr);
 
 	/* NOTE-NIKITA address-as-unallocated-blocknr still is not
 	   implemented. */
 
-	z_hash_prefetch_bucket(zth, hashi);
-
 	rcu_read_lock();
 	/* Find a matching BLOCKNR in the hash table.  If the znode is found,
 	   we obtain an reference (x_count) but the znode remains unlocked.
 	   Have to worry about race conditions later. */
-	result = z_hash_find_index(zth, hashi, blocknr);
+	result = z_hash_find_rcu(zth, blocknr);
 	/* According to the current design, the hash table lock protects new
 	   znode references. */
 	if (result != NULL) {
@@ -515,24 +913,32 @@ znode *zget(reiser4_tree * tree,
 		ZJNODE(result)->key.z = *blocknr;
 		result->level = level;
 
-		write_lock_tree(tree);
+		/* read tree lock keeps the table from being resized and
+		   znodes from being removed, the stripe lock serializes
+		   insertions into the bucket */
+		read_lock_tree(tree);
+		spin_lock(zhash_stripe(tree, blocknr));
 
-		shadow = z_hash_find_index(zth, hashi, blocknr);
+		/* table may have been resized since lookup above, so hash
+		   index is recomputed */
+		shadow = z_hash_find(zth, blocknr);
 		if (unlikely(shadow != NULL && !ZF_ISSET(shadow, JNODE_RIP))) {
 			jnode_list_remove(ZJNODE(result));
 			zfree(result);
 			result = shadow;
 		} else {
 			result->version = znode_build_version(tree);
-			z_hash_insert_index_rcu(zth, hashi, result);
+			z_hash_insert_rcu(zth, result);
+			check_htable_load(tree, zth);
 
 			if (parent != NULL)
-				++parent->c_count;
+				atomic_inc(&parent->c_count);
 		}
 
 		add_x_ref(ZJNODE(result));
 
-		write_unlock_tree(tree);
+		spin_unlock(zhash_stripe(tree, blocknr));
+		read_unlock_tree(tree);
 	}
 
 	assert("intelfx-6",
@@ -698,7 +1104,9 @@ reiser4_key *znode_set_rd_key(znode * node, const reiser4_key * key)
 	       keyeq(&node->rd_key, reiser4_min_key()) ||
 	       ZF_ISSET(node, JNODE_HEARD_BANSHEE));
 
+	write_seqcount_begin(&node->dk_seq);
 	node->rd_key = *key;
+	write_seqcount_end(&node->dk_seq);
 	ON_DEBUG(node->rd_key_version = atomic_inc_return(&delim_key_version));
 	return &node->rd_key;
 }
@@ -714,11 +1122,36 @@ reiser4_key *znode_set_ld_key(znode * node, const reiser4_key * key)
 	       znode_is_any_locked(node) || keyeq(&node->ld_key,
 						  reiser4_min_key()));
 
+	write_seqcount_begin(&node->dk_seq);
 	node->ld_key = *key;
+	write_seqcount_end(&node->dk_seq);
 	ON_DEBUG(node->ld_key_version = atomic_inc_return(&delim_key_version));
 	return &node->ld_key;
 }
 
+/**
+ * znode_read_dk - copy delimiting keys without dk lock
+ * @node: znode to query
+ * @ld: where to copy left delimiting key to, or NULL
+ * @rd: where to copy right delimiting key to, or NULL
+ *
+ * Keys are copied as they were at some moment, but may be changed by the
+ * time this returns. This is enough for checks which are repeated or
+ * recovered from when keys are found stale, that is for lookups.
+ */
+void znode_read_dk(const znode * node, reiser4_key * ld, reiser4_key * rd)
+{
+	unsigned seq;
+
+	do {
+		seq = read_seqcount_begin(&node->dk_seq);
+		if (ld != NULL)
+			*ld = node->ld_key;
+		if (rd != NULL)
+			*rd = node->rd_key;
+	} while (read_seqcount_retry(&node->dk_seq, seq));
+}
+
 /* true if @key is inside key range for @node */
 int znode_contains_key(znode * node /* znode to look in */ ,
 		       const reiser4_key * key /* key to look for */ )
@@ -731,19 +1164,18 @@ int znode_contains_key(znode * node /* znode to look in */ ,
 	    && keyle(key, znode_get_rd_key(node));
 }
 
-/* same as znode_contains_key(), but lock dk lock */
+/* same as znode_contains_key(), but without dk lock, see znode_read_dk() */
 int znode_contains_key_lock(znode * node /* znode to look in */ ,
 			    const reiser4_key * key /* key to look for */ )
 {
-	int result;
+	reiser4_key ld;
+	reiser4_key rd;
 
 	assert("umka-056", node != NULL);
 	assert("umka-057", key != NULL);
 
-	read_lock_dk(znode_get_tree(node));
-	result = znode_contains_key(node, key);
-	read_unlock_dk(znode_get_tree(node));
-	return result;
+	znode_read_dk(node, &ld, &rd);
+	return keyle(&ld, key) && keyle(key, &rd);
 }
 
 /* get parent pointer, assuming tree is not locked */
@@ -797,15 +1229,12 @@ int znode_just_created(const znode * node)
 	return (znode_page(node) == NULL);
 }
 
-/* obtain updated ->znode_epoch. See seal.c for description. */
+/* obtain updated ->znode_epoch. See seal.c for description. Seals only
+   compare versions for equality, what matters is that a version is never
+   handed out twice */
 __u64 znode_build_version(reiser4_tree * tree)
 {
-	__u64 result;
-
-	spin_lock(&tree->epoch_lock);
-	result = ++tree->znode_epoch;
-	spin_unlock(&tree->epoch_lock);
-	return result;
+	return atomic64_inc_return(&tree->znode_epoch);
 }
 
 void init_load_count(load_count * dh)
@@ -962,10 +1391,10 @@ static int znode_invariant_f(const znode * node /* znode to check */ ,
 	    /* for any znode, c_count of its parent is greater than 0 */
 	    _ergo(znode_parent(node) != NULL &&
 		  !znode_above_root(znode_parent(node)),
-		  znode_parent(node)->c_count > 0) &&
+		  atomic_read(&znode_parent(node)->c_count) > 0) &&
 	    /* leaves don't have children */
 	    _ergo(znode_get_level(node) == LEAF_LEVEL,
-		  node->c_count == 0) &&
+		  atomic_read(&node->c_count) == 0) &&
 	    _check(node->zjnode.jnodes.prev != NULL) &&
 	    _check(node->zjnode.jnodes.next != NULL) &&
 	    /* orphan doesn't have a parent */
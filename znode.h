@@ -18,6 +18,7 @@
 
 #include <linux/types.h>
 #include <linux/spinlock.h>
+#include <linux/seqlock.h>
 #include <linux/pagemap.h>	/* for PAGE_CACHE_SIZE */
 #include <asm/atomic.h>
 
@@ -47,13 +48,16 @@ typedef struct parent_coord {
     ->left
     ->right
     ->in_parent
-    ->c_count
+    ->c_count (zget() increments it under read tree lock)
 
    Following fields are protected by the global delimiting key lock (dk_lock):
 
     ->ld_key (to update ->ld_key long-term lock on the node is also required)
     ->rd_key
 
+   Writers also bump ->dk_seq, so that they can be read without dk_lock by
+   znode_read_dk().
+
    Following fields are protected by the long term lock:
 
     ->nr_items
@@ -114,9 +118,9 @@ struct znode {
 	   node into memory you must increase the c_count of its parent, when
 	   removing it from memory you must decrease the c_count.  This makes
 	   the code simpler, and the cases where it is suboptimal are truly
-	   obscure.
+	   obscure. Atomic, as zget() increments it under read tree lock.
 	 */
-	int c_count;
+	atomic_t c_count;
 
 	/* plugin of node attached to this znode. NULL if znode is not
 	   loaded. */
@@ -131,12 +135,24 @@ struct znode {
 	reiser4_key ld_key;
 	/* right delimiting key. */
 	reiser4_key rd_key;
+	/* changes of delimiting keys, see znode_read_dk() */
+	seqcount_t dk_seq;
 
 	/* znode's tree level */
 	__u16 level;
 	/* number of items in this node. This field is modified by node
 	 * plugin. */
 	__u16 nr_items;
+	/* position of the item found by the last lookup in this node. This
+	 * is only a hint: node plugin checks it against item keys before
+	 * use. */
+	__u16 search_hint;
+
+	/* children found through internal items of this node, see
+	 * zlook_child() */
+	struct child_cache *children;
+	/* slot of parent's children cache pointing to this znode */
+	znode **cached_in;
 
 #if REISER4_DEBUG
 	void *creator;
@@ -167,8 +183,14 @@ ON_DEBUG(extern atomic_t delim_key_version;
 extern znode *zget(reiser4_tree * tree, const reiser4_block_nr * const block,
 		   znode * parent, tree_level level, gfp_t gfp_flag);
 extern znode *zlook(reiser4_tree * tree, const reiser4_block_nr * const block);
+extern znode *zlook_rcu(reiser4_tree * tree,
+			const reiser4_block_nr * const block);
+extern znode *zlook_child(znode * parent, pos_in_node_t pos,
+			  const reiser4_block_nr * const block);
+extern void zcache_child(znode * parent, pos_in_node_t pos, znode * child);
 extern int zload(znode * node);
 extern int zload_ra(znode * node, ra_info_t * info);
+extern int zload_prefetch_batch(znode **, int nr);
 extern int zinit_new(znode * node, gfp_t gfp_flags);
 extern void zrelse(znode * node);
 extern void znode_change_parent(znode * new_parent, reiser4_block_nr * block);
@@ -195,6 +217,8 @@ extern reiser4_key *znode_get_ld_key(znode * node);
 
 extern reiser4_key *znode_set_rd_key(znode * node, const reiser4_key * key);
 extern reiser4_key *znode_set_ld_key(znode * node, const reiser4_key * key);
+extern void znode_read_dk(const znode * node, reiser4_key * ld,
+			  reiser4_key * rd);
 
 /* `connected' state checks */
 static inline int znode_is_right_connected(const znode * node)
@@ -223,6 +247,11 @@ extern int init_znodes(void);
 extern void done_znodes(void);
 extern int znodes_tree_init(reiser4_tree * ztree);
 extern void znodes_tree_done(reiser4_tree * ztree);
+extern void znodes_tree_grow(reiser4_tree * ztree);
+extern int reiser4_init_znode_shrinker(struct super_block *);
+extern void reiser4_done_znode_shrinker(struct super_block *);
+extern void znodes_tree_stat(reiser4_tree * ztree, struct hash_chain_stat *real,
+			     struct hash_chain_stat *fake);
 extern int znode_contains_key(znode * node, const reiser4_key * key);
 extern int znode_contains_key_lock(znode * node, const reiser4_key * key);
 extern unsigned znode_save_free_space(znode * node);